@@ -28,6 +28,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 
 /*****************************************************************************
@@ -84,6 +85,169 @@ extern int ds_make_timeout_us(struct ds_timespec *abstimeout,
 extern int ds_make_timeout_ms(struct ds_timespec *abstimeout,
 			      unsigned int timeout_ms);
 
+
+/*****************************************************************************
+ * Memory allocation
+ *****************************************************************************/
+
+/*
+ * Allocator used for all memory of libds, defaults to malloc(), realloc()
+ * and free() of C library. @opaque is passed to all callbacks.
+ */
+struct ds_allocator {
+	void *(*malloc)(size_t size, void *opaque);
+	void *(*realloc)(void *ptr, size_t size, void *opaque);
+	void (*free)(void *ptr, void *opaque);
+	void *opaque;
+};
+
+/**
+ * ds_set_allocator - route libds memory allocations to @allocator
+ * @allocator: allocator callbacks, NULL restores C library allocator
+ *
+ * Must be called before any libds objects are created, or after all have
+ * been freed and pooled pieces of appendable buffers have been released with
+ * ds_append_buffer_pool_flush() in all threads. Memory returned to caller by
+ * libds, such as list entries and asynchronous queue messages, must then be
+ * released with ds_free() (or matching libds free function) instead of
+ * free().
+ *
+ * Returns false if some of callbacks are missing.
+ */
+extern bool ds_set_allocator(const struct ds_allocator *allocator);
+
+/**
+ * ds_malloc - allocate memory with libds allocator
+ * @size: size of allocation
+ */
+extern void *ds_malloc(size_t size);
+
+/**
+ * ds_calloc - allocate zeroed array with libds allocator
+ * @nmemb: number of array elements
+ * @size: size of array element
+ */
+extern void *ds_calloc(size_t nmemb, size_t size);
+
+/**
+ * ds_realloc - resize allocation of libds allocator
+ * @ptr: old allocation, may be NULL
+ * @size: new size of allocation
+ */
+extern void *ds_realloc(void *ptr, size_t size);
+
+/**
+ * ds_free - free memory allocated with libds allocator
+ * @ptr: allocation, may be NULL
+ */
+extern void ds_free(void *ptr);
+
+/**
+ * ds_aligned_alloc - allocate aligned memory with libds allocator
+ * @align: alignment, power of two
+ * @size: size of allocation
+ *
+ * Allocation must be freed with ds_aligned_free().
+ */
+extern void *ds_aligned_alloc(size_t align, size_t size);
+
+/**
+ * ds_aligned_free - free memory allocated with ds_aligned_alloc()
+ * @ptr: allocation, may be NULL
+ */
+extern void ds_aligned_free(void *ptr);
+
+
+/*****************************************************************************
+ * Slab allocator for fixed size objects
+ *****************************************************************************/
+
+/* Objects cached per thread */
+#define DS_SLAB_MAGAZINE_SIZE 32
+
+/* Bytes allocated at once from libds allocator for new objects */
+#define DS_SLAB_CHUNK_BYTES (16 * 1024)
+
+struct ds_slab;
+
+/*
+ * Slab statistics. Objects are in use, on shared free list or cached in
+ * thread magazines. @footprint is all memory held by slab, in bytes.
+ */
+struct ds_slab_stats {
+	size_t obj_size;
+	size_t footprint;
+	unsigned long chunks;
+	unsigned long objs_total;
+	unsigned long objs_in_use;
+	unsigned long objs_free;
+	unsigned long objs_cached;
+	unsigned long magazines;
+};
+
+/**
+ * ds_slab_alloc - create new slab
+ * @obj_size: size of objects
+ * @align: alignment of objects, power of two or zero for pointer alignment
+ *
+ * Objects are carved from chunks of DS_SLAB_CHUNK_BYTES (or larger for
+ * large objects) and freed objects are kept in slab, so memory is returned
+ * to libds allocator only by ds_slab_purge() and ds_slab_free(). Each thread
+ * allocates from and frees to own magazine of DS_SLAB_MAGAZINE_SIZE objects
+ * and takes slab lock only when magazine runs empty or full. Each slab uses
+ * one pthread key.
+ */
+extern struct ds_slab *ds_slab_alloc(size_t obj_size, size_t align);
+
+/**
+ * ds_slab_free - free slab and all of its objects
+ * @slab: slab
+ *
+ * Objects do not need to be freed first. No thread may use slab after this.
+ */
+extern void ds_slab_free(struct ds_slab *slab);
+
+/**
+ * ds_slab_purge - free all objects of slab at once
+ * @slab: slab
+ *
+ * Chunks are returned to libds allocator and all objects of slab become
+ * invalid. Slab must not be in concurrent use.
+ */
+extern void ds_slab_purge(struct ds_slab *slab);
+
+/**
+ * ds_slab_obj_alloc - allocate object from slab
+ * @slab: slab
+ *
+ * Returns NULL in case of running out-of-memory.
+ */
+extern void *ds_slab_obj_alloc(struct ds_slab *slab);
+
+/**
+ * ds_slab_obj_free - return object to slab
+ * @slab: slab object was allocated from
+ * @obj: object, may be NULL
+ */
+extern void ds_slab_obj_free(struct ds_slab *slab, void *obj);
+
+/**
+ * ds_slab_obj_size - return object size of slab, rounded up to alignment
+ * @slab: slab
+ */
+extern size_t ds_slab_obj_size(const struct ds_slab *slab);
+
+/**
+ * ds_slab_get_stats - get slab statistics
+ * @slab: slab
+ * @stats: statistics output
+ *
+ * Counts of objects cached by other threads are approximate while slab is in
+ * use.
+ */
+extern void ds_slab_get_stats(struct ds_slab *slab,
+			      struct ds_slab_stats *stats);
+
 
 /*****************************************************************************
  * Doubly linked list
@@ -95,6 +259,7 @@ struct ds_list_entry {
 struct ds_linked_list {
 	struct ds_list_entry *head, *tail;
 	int count;
+	struct ds_slab *slab;
 };
 
 /**
@@ -163,8 +328,45 @@ static inline void ds_list_init(struct ds_linked_list *list)
 	list->head = NULL;
 	list->tail = NULL;
 	list->count = 0;
+	list->slab = NULL;
 }
 
+/* Minimum object size of slab for entries of ds_list_append() */
+#define DS_LIST_SLAB_OBJ_SIZE ds_sizeof_list_entry(void *)
+
+/**
+ * ds_list_set_slab - allocate list entries from slab
+ * @list: empty linked list
+ * @slab: slab for entries, NULL for libds allocator
+ *
+ * Entries created by ds_list_append() and ds_list_prepend() are then
+ * allocated from @slab, and ds_list_delete_entry() and ds_list_purge()
+ * return entries to @slab. Objects of @slab must be at least
+ * DS_LIST_SLAB_OBJ_SIZE bytes. Slab may be shared by several lists.
+ *
+ * Returns false if list is not empty or objects of @slab are too small.
+ */
+extern bool ds_list_set_slab(struct ds_linked_list *list, struct ds_slab *slab);
+
+/**
+ * __ds_list_new_entry - allocate list entry from slab or allocator of list
+ * @list: linked list
+ * @datasize: size of list entry buffer
+ *
+ * Returns NULL in case of running out-of-memory or if entry does not fit to
+ * slab object.
+ */
+extern struct ds_list_entry *__ds_list_new_entry(struct ds_linked_list *list,
+						 size_t datasize);
+
+/**
+ * __ds_list_free_entry - free entry allocated with __ds_list_new_entry()
+ * @list: linked list
+ * @entry: list entry, not on list
+ */
+extern void __ds_list_free_entry(struct ds_linked_list *list,
+				 struct ds_list_entry *entry);
+
 /**
  * ds_list_empty - checks if linked list is emptry
  * @list: linked list
@@ -304,6 +506,78 @@ static inline void ds_list_free(struct ds_linked_list *list)
 #define ds_list_for_each_tail(pos, list) \
 	for ((pos) = (list)->tail; (pos) != NULL; (pos) = (pos)->prev)
 
+/*
+ * Intrusive lists link ds_list_entry members embedded to caller structures,
+ * with ds_list_append_entry()/ds_list_prepend_entry() and
+ * ds_list_remove_entry(). Nothing is allocated and removal does not search
+ * list. Structure can be on several lists at once, through separate members.
+ * Entries are owned by caller, so ds_list_delete_entry(), ds_list_purge() and
+ * ds_list_free() must not be used with intrusive lists.
+ */
+
+/**
+ * ds_list_item - get structure embedding list entry
+ * @entry: list entry
+ * @type: type of structure
+ * @member: name of ds_list_entry member in @type
+ */
+#define ds_list_item(entry, type, member) ds_container_of(entry, type, member)
+
+/**
+ * __ds_list_item_or_null - ds_list_item() or NULL for NULL entry
+ */
+#define __ds_list_item_or_null(entry, type, member) \
+	((entry) != NULL ? ds_list_item(entry, type, member) : (type *)NULL)
+
+/**
+ * ds_list_first_item - get structure of first entry in list, NULL if empty
+ * @list: linked list
+ * @type: type of structure
+ * @member: name of ds_list_entry member in @type
+ */
+#define ds_list_first_item(list, type, member) \
+	__ds_list_item_or_null((list)->head, type, member)
+
+/**
+ * ds_list_next_item - get structure of next entry in list, NULL at end
+ * @pos: structure on list
+ * @type: type of structure
+ * @member: name of ds_list_entry member in @type
+ */
+#define ds_list_next_item(pos, type, member) \
+	__ds_list_item_or_null((pos)->member.next, type, member)
+
+/**
+ * ds_list_for_each_item - for statement macro for iterating structures of
+ *			   intrusive linked list forwards
+ * @pos: structure pointer used as cursor
+ * @list: linked list
+ * @type: type of structure
+ * @member: name of ds_list_entry member in @type
+ *
+ * NOTE: You may not remove entries from list within this for-loop.
+ */
+#define ds_list_for_each_item(pos, list, type, member) \
+	for ((pos) = ds_list_first_item(list, type, member); (pos) != NULL; \
+		(pos) = ds_list_next_item(pos, type, member))
+
+/**
+ * ds_list_for_each_item_safe - for statement macro for iterating structures
+ *				of intrusive linked list forwards, current
+ *				entry may be removed
+ * @pos: structure pointer used as cursor
+ * @next: structure pointer used for temporary storage
+ * @list: linked list
+ * @type: type of structure
+ * @member: name of ds_list_entry member in @type
+ */
+#define ds_list_for_each_item_safe(pos, next, list, type, member) \
+	for ((pos) = ds_list_first_item(list, type, member), \
+	     (next) = (pos) ? ds_list_next_item(pos, type, member) : NULL; \
+	     (pos) != NULL; \
+	     (pos) = (next), \
+	     (next) = (pos) ? ds_list_next_item(pos, type, member) : NULL)
+
 
 /*****************************************************************************
  * XOR linked list
@@ -315,6 +589,7 @@ struct ds_xorlist_entry {
 struct ds_xor_list {
 	struct ds_xorlist_entry *head, *tail;
 	int count;
+	struct ds_slab *slab;
 };
 
 /**
@@ -386,8 +661,27 @@ static inline void ds_xorlist_init(struct ds_xor_list *list)
 	list->head = NULL;
 	list->tail = NULL;
 	list->count = 0;
+	list->slab = NULL;
 }
 
+/* Minimum object size of slab for entries of ds_xorlist_append() */
+#define DS_XORLIST_SLAB_OBJ_SIZE ds_sizeof_xorlist_entry(void *)
+
+/**
+ * ds_xorlist_set_slab - allocate xor list entries from slab
+ * @list: empty xor linked list
+ * @slab: slab for entries, NULL for libds allocator
+ *
+ * Entries created by ds_xorlist_append() and ds_xorlist_prepend() are then
+ * allocated from @slab, and ds_xorlist_delete_entry() and ds_xorlist_purge()
+ * return entries to @slab. Objects of @slab must be at least
+ * DS_XORLIST_SLAB_OBJ_SIZE bytes.
+ *
+ * Returns false if list is not empty or objects of @slab are too small.
+ */
+extern bool ds_xorlist_set_slab(struct ds_xor_list *list,
+				struct ds_slab *slab);
+
 /**
  * ds_xorlist_empty - checks if xor linked list is emptry
  * @list: xor linked list
@@ -558,6 +852,172 @@ static inline void ds_xorlist_set_next(struct ds_xorlist_entry **prev,
 	for ((prev) = NULL, (pos) = (list)->tail; (pos) != NULL; \
 		ds_xorlist_set_next(&(prev), &(pos)))
 
+/**
+ * ds_xorlist_cursor - bidirectional position in xor list
+ * @list: xor linked list
+ * @prev: entry before cursor
+ * @pos: entry at cursor, NULL if cursor is between @prev and @next
+ * @next: entry after cursor
+ *
+ * Cursor keeps both neighbours of its position, so that entries can be
+ * inserted and removed at cursor in O(1). After removal, and when moved past
+ * either end of list, cursor has no entry and stays between neighbours.
+ */
+struct ds_xorlist_cursor {
+	struct ds_xor_list *list;
+	struct ds_xorlist_entry *prev, *pos, *next;
+};
+
+/**
+ * ds_xorlist_cursor_first - set cursor at first entry of xor list
+ * @cur: cursor
+ * @list: xor linked list
+ *
+ * Returns first entry, NULL if list is empty.
+ */
+static inline struct ds_xorlist_entry *
+ds_xorlist_cursor_first(struct ds_xorlist_cursor *cur,
+			struct ds_xor_list *list)
+{
+	cur->list = list;
+	cur->prev = NULL;
+	cur->pos = list->head;
+	cur->next = cur->pos ? ds_xorlist_next(NULL, cur->pos) : NULL;
+
+	return cur->pos;
+}
+
+/**
+ * ds_xorlist_cursor_last - set cursor at last entry of xor list
+ * @cur: cursor
+ * @list: xor linked list
+ *
+ * Returns last entry, NULL if list is empty.
+ */
+static inline struct ds_xorlist_entry *
+ds_xorlist_cursor_last(struct ds_xorlist_cursor *cur,
+		       struct ds_xor_list *list)
+{
+	cur->list = list;
+	cur->next = NULL;
+	cur->pos = list->tail;
+	cur->prev = cur->pos ? ds_xorlist_next(NULL, cur->pos) : NULL;
+
+	return cur->pos;
+}
+
+/**
+ * ds_xorlist_cursor_set - set cursor at @pos of xor list
+ * @cur: cursor
+ * @list: xor linked list
+ * @pos: entry of @list
+ * @prev: entry before @pos, NULL if @pos is first
+ */
+static inline void ds_xorlist_cursor_set(struct ds_xorlist_cursor *cur,
+					 struct ds_xor_list *list,
+					 struct ds_xorlist_entry *pos,
+					 struct ds_xorlist_entry *prev)
+{
+	cur->list = list;
+	cur->prev = prev;
+	cur->pos = pos;
+	cur->next = ds_xorlist_next(prev, pos);
+}
+
+/**
+ * ds_xorlist_cursor_next - move cursor to next entry
+ * @cur: cursor
+ *
+ * Entry after new position is prefetched, as it is needed to step further.
+ * Returns new entry at cursor, NULL if moved past end of list.
+ */
+static inline struct ds_xorlist_entry *
+ds_xorlist_cursor_next(struct ds_xorlist_cursor *cur)
+{
+	if (cur->pos)
+		cur->prev = cur->pos;
+	cur->pos = cur->next;
+	cur->next = cur->pos ? ds_xorlist_next(cur->prev, cur->pos) : NULL;
+	if (cur->next)
+		__builtin_prefetch(cur->next);
+
+	return cur->pos;
+}
+
+/**
+ * ds_xorlist_cursor_prev - move cursor to previous entry
+ * @cur: cursor
+ *
+ * Entry before new position is prefetched. Returns new entry at cursor, NULL
+ * if moved past start of list.
+ */
+static inline struct ds_xorlist_entry *
+ds_xorlist_cursor_prev(struct ds_xorlist_cursor *cur)
+{
+	if (cur->pos)
+		cur->next = cur->pos;
+	cur->pos = cur->prev;
+	cur->prev = cur->pos ? ds_xorlist_next(cur->next, cur->pos) : NULL;
+	if (cur->prev)
+		__builtin_prefetch(cur->prev);
+
+	return cur->pos;
+}
+
+/**
+ * ds_xorlist_cursor_insert_before - insert @entry before cursor position
+ * @cur: cursor
+ * @entry: new xor list entry
+ *
+ * Cursor stays at its entry, @entry becomes previous entry of cursor.
+ */
+extern void ds_xorlist_cursor_insert_before(struct ds_xorlist_cursor *cur,
+					    struct ds_xorlist_entry *entry);
+
+/**
+ * ds_xorlist_cursor_insert_after - insert @entry after cursor position
+ * @cur: cursor
+ * @entry: new xor list entry
+ *
+ * Cursor stays at its entry, @entry becomes next entry of cursor.
+ */
+extern void ds_xorlist_cursor_insert_after(struct ds_xorlist_cursor *cur,
+					   struct ds_xorlist_entry *entry);
+
+/**
+ * ds_xorlist_cursor_remove - remove entry at cursor from xor list
+ * @cur: cursor
+ *
+ * Entry element is removed from list but not freed. Cursor is left between
+ * neighbours of removed entry, so that ds_xorlist_cursor_next() and
+ * ds_xorlist_cursor_prev() move to them. Returns removed entry, NULL if
+ * cursor has no entry.
+ */
+extern struct ds_xorlist_entry *
+ds_xorlist_cursor_remove(struct ds_xorlist_cursor *cur);
+
+/**
+ * ds_xorlist_cursor_delete - delete entry at cursor from xor list
+ * @cur: cursor
+ *
+ * Like ds_xorlist_cursor_remove(), entry element is also freed.
+ */
+extern void ds_xorlist_cursor_delete(struct ds_xorlist_cursor *cur);
+
+/**
+ * ds_xorlist_cursor_for_each - for statement macro for iterating xor linked
+ *				list forwards with cursor
+ * @cur: cursor
+ * @pos: xor list position entry
+ * @list: xor linked list
+ *
+ * Entry at cursor may be removed or deleted with cursor within this for-loop,
+ * and entries inserted with cursor.
+ */
+#define ds_xorlist_cursor_for_each(cur, pos, list) \
+	for ((pos) = ds_xorlist_cursor_first(cur, list); (pos) != NULL; \
+		(pos) = ds_xorlist_cursor_next(cur))
+
 
 /*****************************************************************************
  * Queue, simple implementation by reusing ds_linked_list
@@ -575,6 +1035,22 @@ static inline void ds_queue_init(struct ds_queue *q)
 	ds_list_init(&q->q);
 }
 
+/**
+ * ds_queue_set_slab - allocate queue entries from slab
+ * @q: empty queue
+ * @slab: slab for entries, NULL for libds allocator
+ *
+ * Objects of @slab must be large enough for entries of all pushed data
+ * types, ds_sizeof_list_entry(type). Entries returned by
+ * ds_queue_pop_entry() must then be freed with ds_slab_obj_free().
+ *
+ * Returns false if queue is not empty or objects of @slab are too small.
+ */
+static inline bool ds_queue_set_slab(struct ds_queue *q, struct ds_slab *slab)
+{
+	return ds_list_set_slab(&q->q, slab);
+}
+
 /**
  * ds_queue_size - return number of data elements in queue
  * @q: queue
@@ -607,15 +1083,17 @@ static inline bool ds_queue_push_ptr(struct ds_queue *q, void *data)
 
 /**
  * ds_queue_push_data - push typed data element to begining of queue
- * @q: queue
+ * @queue: queue
  * @type: type of data
  * @data: data variable
  */
-#define ds_queue_push_data(q, type, data) do { \
+#define ds_queue_push_data(queue, type, data) do { \
 		struct ds_list_entry *__entry; \
-		ds_new_list_entry(__entry, type, data); \
-		if (__entry) \
-			ds_queue_push_entry(q, __entry); \
+		__entry = __ds_list_new_entry(&(queue)->q, sizeof(type)); \
+		if (__entry) { \
+			ds_set_list_entry_data(__entry, type, data); \
+			ds_queue_push_entry(queue, __entry); \
+		} \
 	} while(false)
 
 /**
@@ -715,81 +1193,774 @@ extern void ds_queue_free(struct ds_queue *q);
 #define ds_queue_for_each(pos, queue) \
 	ds_list_for_each_tail(pos, &((queue)->q))
 
-
+
 /*****************************************************************************
- * Asynchronous message queue between threads
+ * Double-ended queue, elements stored inline to growable circular array
  *****************************************************************************/
 
-/* private structure, defined in ds_async_queue.c */
-struct ds_async_queue;
+#define DS_DEQUE_MIN_CAPACITY 16
+#define DS_DEQUE_MAX_CAPACITY (1U << 30)
+
+/*
+ * Elements of @elem_size bytes are stored by value. @head and @tail are free
+ * running counters, masked with @mask to array index. Capacity is power of
+ * two and doubles when array becomes full.
+ */
+struct ds_deque {
+	unsigned char *elems;
+	size_t elem_size;
+	unsigned int capacity;
+	unsigned int mask;
+	unsigned int head, tail;
+};
 
 /**
- * ds_async_queue_alloc - create new ds_async_queue
+ * ds_deque_init - allocate deque
+ * @dq: deque structure to initialize
+ * @elem_size: size of elements
+ * @capacity: initial capacity, rounded up to power of two
+ *
+ * Returns false in case of memory allocation failure.
  */
-extern struct ds_async_queue *ds_async_queue_alloc(void);
+extern bool ds_deque_init(struct ds_deque *dq, size_t elem_size,
+			  unsigned int capacity);
 
 /**
- * ds_async_queue_free - frees ds_async_queue
- * @queue: queue to free
+ * ds_deque_free - free array of deque
+ * @dq: deque
  */
-extern void ds_async_queue_free(struct ds_async_queue *queue);
+extern void ds_deque_free(struct ds_deque *dq);
 
 /**
- * ds_async_queue_empty - checks if queue is empty
- * @queue: queue
+ * ds_deque_clear - drop all elements, keep array
+ * @dq: deque
  */
-extern bool ds_async_queue_empty(struct ds_async_queue *queue);
+static inline void ds_deque_clear(struct ds_deque *dq)
+{
+	dq->head = 0;
+	dq->tail = 0;
+}
 
 /**
- * ds_async_queue_push_timed - pushes new message to queue, with timeout
- * @queue: queue to push message to
- * @msg: pointer to message data
- * @msglen: size of message data
- * @abstime: absolute time of timeout
- *
- * Pushes message to queue. If queue is full, will block until there is space
- * or timeout is reached. If timeout is reached, returns -ETIMEDOUT. Otherwise
- * returns zero. Caller retains ownership of @msg object and may free it.
+ * ds_deque_size - return number of elements in deque
+ * @dq: deque
  */
-extern int ds_async_queue_push_timed(struct ds_async_queue *queue, void *msg,
-				     size_t msglen,
-				     const struct ds_timespec *abstime);
+static inline unsigned int ds_deque_size(const struct ds_deque *dq)
+{
+	return dq->tail - dq->head;
+}
 
 /**
- * ds_async_queue_try_push - tries to push new message to queue
- * @queue: queue to push message to
- * @msg: pointer to message data
- * @msglen: size of message data
- *
- * Tries to push message to queue. If queue is full, will return -ETIMEDOUT.
- * Otherwise returns zero. Caller retains ownership of @msg object and may
- * free it.
+ * ds_deque_empty - checks if deque is empty
+ * @dq: deque
  */
-extern int ds_async_queue_try_push(struct ds_async_queue *queue, void *msg,
-				   size_t msglen);
+static inline bool ds_deque_empty(const struct ds_deque *dq)
+{
+	return dq->tail == dq->head;
+}
 
 /**
- * ds_async_queue_push - pushes new message to queue
- * @queue: queue to push message to
- * @msg: pointer to message data
- * @msglen: size of message data
+ * ds_deque_reserve - grow array to hold @num more elements
+ * @dq: deque
+ * @num: number of elements to make room for
  *
- * Pushes message to queue. If queue is full, will block until there is space.
- * Caller retains ownership of @msg object and may free it.
+ * Returns false in case of memory allocation failure or if capacity would
+ * exceed DS_DEQUE_MAX_CAPACITY.
  */
-static inline void ds_async_queue_push(struct ds_async_queue *queue, void *msg,
-				       size_t msglen)
+extern bool ds_deque_reserve(struct ds_deque *dq, unsigned int num);
+
+/**
+ * ds_deque_at - return pointer to element, counted from front of deque
+ * @dq: deque
+ * @index: index of element, less than ds_deque_size()
+ */
+static inline void *ds_deque_at(const struct ds_deque *dq, unsigned int index)
 {
-	ds_async_queue_push_timed(queue, msg, msglen, NULL);
+	return dq->elems + ((dq->head + index) & dq->mask) * dq->elem_size;
 }
 
 /**
- * ds_async_queue_pop_timed - pops message from queue, with timeout
- * @queue: queue
- * @msg: returns pointer to message
- * @msglen: returns size of message
- * @abstime: absolute time of timeout
- *
+ * ds_deque_front - return pointer to first element, NULL if empty
+ * @dq: deque
+ */
+static inline void *ds_deque_front(const struct ds_deque *dq)
+{
+	return ds_deque_empty(dq) ? NULL : ds_deque_at(dq, 0);
+}
+
+/**
+ * ds_deque_back - return pointer to last element, NULL if empty
+ * @dq: deque
+ */
+static inline void *ds_deque_back(const struct ds_deque *dq)
+{
+	return ds_deque_empty(dq) ? NULL :
+				    ds_deque_at(dq, ds_deque_size(dq) - 1);
+}
+
+/**
+ * ds_deque_push_back - copy element to end of deque
+ * @dq: deque
+ * @elem: element of elem_size bytes
+ *
+ * Returns false in case of memory allocation failure.
+ */
+static inline bool ds_deque_push_back(struct ds_deque *dq, const void *elem)
+{
+	if (__builtin_expect(ds_deque_size(dq) == dq->capacity, 0) &&
+	    !ds_deque_reserve(dq, 1))
+		return false;
+
+	memcpy(dq->elems + (dq->tail & dq->mask) * dq->elem_size, elem,
+	       dq->elem_size);
+	dq->tail++;
+	return true;
+}
+
+/**
+ * ds_deque_push_front - copy element to start of deque
+ * @dq: deque
+ * @elem: element of elem_size bytes
+ *
+ * Returns false in case of memory allocation failure.
+ */
+static inline bool ds_deque_push_front(struct ds_deque *dq, const void *elem)
+{
+	if (__builtin_expect(ds_deque_size(dq) == dq->capacity, 0) &&
+	    !ds_deque_reserve(dq, 1))
+		return false;
+
+	dq->head--;
+	memcpy(dq->elems + (dq->head & dq->mask) * dq->elem_size, elem,
+	       dq->elem_size);
+	return true;
+}
+
+/**
+ * ds_deque_pop_front - remove first element of deque
+ * @dq: deque
+ * @elem: buffer of elem_size bytes for element, may be NULL
+ *
+ * Return false if deque is empty.
+ */
+static inline bool ds_deque_pop_front(struct ds_deque *dq, void *elem)
+{
+	if (ds_deque_empty(dq))
+		return false;
+
+	if (elem)
+		memcpy(elem, ds_deque_at(dq, 0), dq->elem_size);
+	dq->head++;
+	return true;
+}
+
+/**
+ * ds_deque_pop_back - remove last element of deque
+ * @dq: deque
+ * @elem: buffer of elem_size bytes for element, may be NULL
+ *
+ * Return false if deque is empty.
+ */
+static inline bool ds_deque_pop_back(struct ds_deque *dq, void *elem)
+{
+	if (ds_deque_empty(dq))
+		return false;
+
+	dq->tail--;
+	if (elem)
+		memcpy(elem, dq->elems + (dq->tail & dq->mask) * dq->elem_size,
+		       dq->elem_size);
+	return true;
+}
+
+/**
+ * ds_deque_push_data - push typed data element to end of deque, as in
+ *			ds_queue_push_data()
+ * @dq: deque
+ * @type: type of data, size must equal elem_size of deque
+ * @data: data variable
+ */
+#define ds_deque_push_data(dq, type, data) \
+	ds_deque_push_back(dq, (const type *)&(data))
+
+/**
+ * ds_deque_pop_data - pop typed data element from start of deque, as in
+ *		       ds_queue_pop_data()
+ * @dq: deque
+ * @type: type of data, size must equal elem_size of deque
+ * @data: data variable
+ *
+ * Return false if deque is empty, true if data was copied over to data variable
+ */
+#define ds_deque_pop_data(dq, type, data) \
+	ds_deque_pop_front(dq, (type *)&(data))
+
+/**
+ * ds_deque_for_each - for statement macro for iterating deque from front
+ * @pos: element pointer
+ * @idx: unsigned int index variable
+ * @dq: deque
+ *
+ * NOTE: You may not push or pop elements within this for-loop.
+ */
+#define ds_deque_for_each(pos, idx, dq) \
+	for ((idx) = 0; (idx) < ds_deque_size(dq) && \
+			((pos) = ds_deque_at(dq, idx), true); (idx)++)
+
+
+/*****************************************************************************
+ * Type-specialised containers
+ *****************************************************************************/
+/*
+ * Macros below generate inline functions for storing elements of one type to
+ * queue, linked list or ring, for example
+ *
+ *   DS_DECLARE_QUEUE(sample_queue, struct sample)
+ *
+ * declares 'struct sample_queue' and sample_queue_init(), sample_queue_push()
+ * and so on. Elements are stored and loaded with typed assignments instead of
+ * memcpy() through void pointer, so compiler can inline element access and
+ * keep small elements in registers. Generated structures wrap ds_queue,
+ * ds_linked_list and ds_deque, and can be used with their functions through
+ * member 'base'.
+ */
+
+/* Link @entry to start of @list */
+static inline void __ds_list_link_head(struct ds_linked_list *list,
+				       struct ds_list_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = list->head;
+
+	if (list->count++ > 0)
+		list->head->prev = entry;
+	else
+		list->tail = entry;
+	list->head = entry;
+}
+
+/* Link @entry to end of @list */
+static inline void __ds_list_link_tail(struct ds_linked_list *list,
+				       struct ds_list_entry *entry)
+{
+	entry->next = NULL;
+	entry->prev = list->tail;
+
+	if (list->count++ > 0)
+		list->tail->next = entry;
+	else
+		list->head = entry;
+	list->tail = entry;
+}
+
+/* Unlink and return last entry of non-empty @list */
+static inline struct ds_list_entry *
+				__ds_list_unlink_tail(struct ds_linked_list *list)
+{
+	struct ds_list_entry *entry = list->tail;
+
+	list->tail = entry->prev;
+	if (list->tail)
+		list->tail->next = NULL;
+	else
+		list->head = NULL;
+	list->count--;
+
+	return entry;
+}
+
+/**
+ * DS_DECLARE_QUEUE - declare FIFO queue of @type elements, see ds_queue
+ * @name: name of queue structure and prefix of functions
+ * @type: element type
+ *
+ * Declares:
+ *  void name_init(struct name *q)
+ *  bool name_set_slab(struct name *q, struct ds_slab *slab)
+ *  unsigned int name_size(struct name *q)
+ *  bool name_push(struct name *q, type data)
+ *  bool name_peek(struct name *q, type *data)
+ *  bool name_pop(struct name *q, type *data)
+ *  void name_free(struct name *q)
+ *
+ * Push returns false in case of running out-of-memory, peek and pop return
+ * false if queue is empty.
+ */
+#define DS_DECLARE_QUEUE(name, type) \
+struct name { \
+	struct ds_queue base; \
+}; \
+static inline void name##_init(struct name *q) \
+{ \
+	ds_queue_init(&q->base); \
+} \
+static inline bool name##_set_slab(struct name *q, struct ds_slab *slab) \
+{ \
+	return ds_queue_set_slab(&q->base, slab); \
+} \
+static inline unsigned int name##_size(struct name *q) \
+{ \
+	return ds_queue_size(&q->base); \
+} \
+static inline bool name##_push(struct name *q, type data) \
+{ \
+	struct ds_list_entry *entry; \
+ \
+	entry = __ds_list_new_entry(&q->base.q, sizeof(type)); \
+	if (!entry) \
+		return false; \
+ \
+	*ds_list_entry_data_ptr(type, entry) = data; \
+	__ds_list_link_head(&q->base.q, entry); \
+	return true; \
+} \
+static inline bool name##_peek(struct name *q, type *data) \
+{ \
+	if (ds_list_empty(&q->base.q)) \
+		return false; \
+ \
+	*data = ds_list_entry_data(type, q->base.q.tail); \
+	return true; \
+} \
+static inline bool name##_pop(struct name *q, type *data) \
+{ \
+	struct ds_list_entry *entry; \
+ \
+	if (ds_list_empty(&q->base.q)) \
+		return false; \
+ \
+	entry = __ds_list_unlink_tail(&q->base.q); \
+	*data = ds_list_entry_data(type, entry); \
+	__ds_list_free_entry(&q->base.q, entry); \
+	return true; \
+} \
+static inline void name##_free(struct name *q) \
+{ \
+	ds_queue_free(&q->base); \
+}
+
+/**
+ * DS_DECLARE_LIST - declare doubly linked list of @type elements, see
+ *		     ds_linked_list
+ * @name: name of list structure and prefix of functions
+ * @type: element type
+ *
+ * Declares:
+ *  void name_init(struct name *list)
+ *  bool name_set_slab(struct name *list, struct ds_slab *slab)
+ *  unsigned int name_size(struct name *list)
+ *  bool name_append(struct name *list, type data)
+ *  bool name_prepend(struct name *list, type data)
+ *  type *name_entry_data(struct ds_list_entry *entry)
+ *  void name_delete_entry(struct name *list, struct ds_list_entry *entry)
+ *  void name_free(struct name *list)
+ *
+ * Append and prepend return false in case of running out-of-memory. Entries
+ * are iterated with ds_list_for_each() on member 'base'.
+ */
+#define DS_DECLARE_LIST(name, type) \
+struct name { \
+	struct ds_linked_list base; \
+}; \
+static inline void name##_init(struct name *list) \
+{ \
+	ds_list_init(&list->base); \
+} \
+static inline bool name##_set_slab(struct name *list, struct ds_slab *slab) \
+{ \
+	return ds_list_set_slab(&list->base, slab); \
+} \
+static inline unsigned int name##_size(struct name *list) \
+{ \
+	return ds_list_size(&list->base); \
+} \
+static inline bool name##_append(struct name *list, type data) \
+{ \
+	struct ds_list_entry *entry; \
+ \
+	entry = __ds_list_new_entry(&list->base, sizeof(type)); \
+	if (!entry) \
+		return false; \
+ \
+	*ds_list_entry_data_ptr(type, entry) = data; \
+	__ds_list_link_tail(&list->base, entry); \
+	return true; \
+} \
+static inline bool name##_prepend(struct name *list, type data) \
+{ \
+	struct ds_list_entry *entry; \
+ \
+	entry = __ds_list_new_entry(&list->base, sizeof(type)); \
+	if (!entry) \
+		return false; \
+ \
+	*ds_list_entry_data_ptr(type, entry) = data; \
+	__ds_list_link_head(&list->base, entry); \
+	return true; \
+} \
+static inline type *name##_entry_data(struct ds_list_entry *entry) \
+{ \
+	return ds_list_entry_data_ptr(type, entry); \
+} \
+static inline void name##_delete_entry(struct name *list, \
+				       struct ds_list_entry *entry) \
+{ \
+	ds_list_delete_entry(&list->base, entry); \
+} \
+static inline void name##_free(struct name *list) \
+{ \
+	ds_list_free(&list->base); \
+}
+
+/**
+ * DS_DECLARE_RING - declare growable ring (double-ended queue) of @type
+ *		     elements, see ds_deque
+ * @name: name of ring structure and prefix of functions
+ * @type: element type
+ *
+ * Declares:
+ *  bool name_init(struct name *ring, unsigned int capacity)
+ *  void name_free(struct name *ring)
+ *  void name_clear(struct name *ring)
+ *  unsigned int name_size(const struct name *ring)
+ *  bool name_empty(const struct name *ring)
+ *  bool name_reserve(struct name *ring, unsigned int num)
+ *  type *name_at(const struct name *ring, unsigned int index)
+ *  bool name_push_back(struct name *ring, type data)
+ *  bool name_push_front(struct name *ring, type data)
+ *  bool name_pop_front(struct name *ring, type *data)
+ *  bool name_pop_back(struct name *ring, type *data)
+ *
+ * Init, reserve and push return false in case of memory allocation failure,
+ * pop returns false if ring is empty. Pop @data may be NULL.
+ */
+#define DS_DECLARE_RING(name, type) \
+struct name { \
+	struct ds_deque base; \
+}; \
+static inline bool name##_init(struct name *ring, unsigned int capacity) \
+{ \
+	return ds_deque_init(&ring->base, sizeof(type), capacity); \
+} \
+static inline void name##_free(struct name *ring) \
+{ \
+	ds_deque_free(&ring->base); \
+} \
+static inline void name##_clear(struct name *ring) \
+{ \
+	ds_deque_clear(&ring->base); \
+} \
+static inline unsigned int name##_size(const struct name *ring) \
+{ \
+	return ds_deque_size(&ring->base); \
+} \
+static inline bool name##_empty(const struct name *ring) \
+{ \
+	return ds_deque_empty(&ring->base); \
+} \
+static inline bool name##_reserve(struct name *ring, unsigned int num) \
+{ \
+	return ds_deque_reserve(&ring->base, num); \
+} \
+static inline type *name##_at(const struct name *ring, unsigned int index) \
+{ \
+	return &((type *)ring->base.elems)[(ring->base.head + index) & \
+					   ring->base.mask]; \
+} \
+static inline bool name##_push_back(struct name *ring, type data) \
+{ \
+	struct ds_deque *dq = &ring->base; \
+ \
+	if (__builtin_expect(ds_deque_size(dq) == dq->capacity, 0) && \
+	    !ds_deque_reserve(dq, 1)) \
+		return false; \
+ \
+	((type *)dq->elems)[dq->tail++ & dq->mask] = data; \
+	return true; \
+} \
+static inline bool name##_push_front(struct name *ring, type data) \
+{ \
+	struct ds_deque *dq = &ring->base; \
+ \
+	if (__builtin_expect(ds_deque_size(dq) == dq->capacity, 0) && \
+	    !ds_deque_reserve(dq, 1)) \
+		return false; \
+ \
+	((type *)dq->elems)[--dq->head & dq->mask] = data; \
+	return true; \
+} \
+static inline bool name##_pop_front(struct name *ring, type *data) \
+{ \
+	struct ds_deque *dq = &ring->base; \
+ \
+	if (ds_deque_empty(dq)) \
+		return false; \
+ \
+	if (data) \
+		*data = ((type *)dq->elems)[dq->head & dq->mask]; \
+	dq->head++; \
+	return true; \
+} \
+static inline bool name##_pop_back(struct name *ring, type *data) \
+{ \
+	struct ds_deque *dq = &ring->base; \
+ \
+	if (ds_deque_empty(dq)) \
+		return false; \
+ \
+	dq->tail--; \
+	if (data) \
+		*data = ((type *)dq->elems)[dq->tail & dq->mask]; \
+	return true; \
+}
+
+
+
+/*****************************************************************************
+ * Asynchronous message queue between threads
+ *****************************************************************************/
+
+/* private structure, defined in ds_async_queue.c */
+struct ds_async_queue;
+
+/**
+ * ds_async_queue_msg - message for batch operations
+ * @msg: pointer to message data
+ * @msglen: size of message data
+ */
+struct ds_async_queue_msg {
+	void *msg;
+	size_t msglen;
+};
+
+/**
+ * ds_async_queue_alloc - create new ds_async_queue, with default capacity of
+ *			  128 messages
+ */
+extern struct ds_async_queue *ds_async_queue_alloc(void);
+
+/**
+ * ds_async_queue_alloc_sized - create new ds_async_queue
+ * @capacity: maximum number of messages in queue, rounded up to power of two
+ *
+ * Queue is lock-free bounded ring, safe for multiple pushers and poppers.
+ * Threads are parked only when queue is empty or full.
+ */
+extern struct ds_async_queue *ds_async_queue_alloc_sized(unsigned int capacity);
+
+/**
+ * ds_async_queue_free - frees ds_async_queue
+ * @queue: queue to free
+ */
+extern void ds_async_queue_free(struct ds_async_queue *queue);
+
+/*
+ * How threads wait on empty or full queue: park immediately, spin up to
+ * spin time before parking, or spin for time adapted to how long recent
+ * waits took, but at most spin time. Parked threads sleep on futex where
+ * available and are woken one per message.
+ */
+enum ds_async_queue_wait_mode {
+	DS_ASYNC_QUEUE_WAIT_PARK = 0,
+	DS_ASYNC_QUEUE_WAIT_SPIN,
+	DS_ASYNC_QUEUE_WAIT_ADAPTIVE,
+};
+
+#define DS_ASYNC_QUEUE_DEFAULT_SPIN_NS 50000
+
+/**
+ * ds_async_queue_set_wait_mode - select waiting strategy of queue
+ * @queue: queue
+ * @mode: waiting strategy, default is DS_ASYNC_QUEUE_WAIT_PARK
+ * @max_spin_ns: spin time limit in nanoseconds, zero for
+ *		 DS_ASYNC_QUEUE_DEFAULT_SPIN_NS
+ *
+ * Spinning trades CPU time for hand-off latency, it helps only when pusher
+ * and popper run on different CPUs. Adaptive mode does not spin on single
+ * CPU systems.
+ */
+extern void ds_async_queue_set_wait_mode(struct ds_async_queue *queue,
+					 enum ds_async_queue_wait_mode mode,
+					 unsigned int max_spin_ns);
+
+/**
+ * ds_async_queue_empty - checks if queue is empty
+ * @queue: queue
+ */
+extern bool ds_async_queue_empty(struct ds_async_queue *queue);
+
+/**
+ * ds_async_queue_push_timed - pushes new message to queue, with timeout
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data
+ * @abstime: absolute time of timeout
+ *
+ * Pushes message to queue. If queue is full, will block until there is space
+ * or timeout is reached. If timeout is reached, returns -ETIMEDOUT. Otherwise
+ * returns zero. Caller retains ownership of @msg object and may free it.
+ */
+extern int ds_async_queue_push_timed(struct ds_async_queue *queue, void *msg,
+				     size_t msglen,
+				     const struct ds_timespec *abstime);
+
+/**
+ * ds_async_queue_try_push - tries to push new message to queue
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data
+ *
+ * Tries to push message to queue. If queue is full, will return -ETIMEDOUT.
+ * Otherwise returns zero. Caller retains ownership of @msg object and may
+ * free it.
+ */
+extern int ds_async_queue_try_push(struct ds_async_queue *queue, void *msg,
+				   size_t msglen);
+
+/**
+ * ds_async_queue_push - pushes new message to queue
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data
+ *
+ * Pushes message to queue. If queue is full, will block until there is space.
+ * Caller retains ownership of @msg object and may free it.
+ */
+static inline void ds_async_queue_push(struct ds_async_queue *queue, void *msg,
+				       size_t msglen)
+{
+	ds_async_queue_push_timed(queue, msg, msglen, NULL);
+}
+
+/**
+ * ds_async_queue_push_batch_timed - pushes array of messages to queue, with
+ *				     timeout
+ * @queue: queue to push messages to
+ * @msgs: messages to push
+ * @num: number of messages in @msgs
+ * @abstime: absolute time of timeout
+ *
+ * Pushes messages to queue, claiming as many queue slots at once as
+ * available. If queue is full, will block until there is space or timeout is
+ * reached. Returns number of messages pushed, which is less than @num if
+ * timeout was reached. If no message was pushed before timeout, returns
+ * -ETIMEDOUT. Caller retains ownership of message objects and may free them.
+ */
+extern int
+ds_async_queue_push_batch_timed(struct ds_async_queue *queue,
+				const struct ds_async_queue_msg *msgs,
+				unsigned int num,
+				const struct ds_timespec *abstime);
+
+/**
+ * ds_async_queue_push_batch - pushes array of messages to queue
+ * @queue: queue to push messages to
+ * @msgs: messages to push
+ * @num: number of messages in @msgs
+ *
+ * Pushes messages to queue. If queue is full, will block until there is
+ * space. Caller retains ownership of message objects and may free them.
+ */
+static inline int ds_async_queue_push_batch(struct ds_async_queue *queue,
+					const struct ds_async_queue_msg *msgs,
+					unsigned int num)
+{
+	return ds_async_queue_push_batch_timed(queue, msgs, num, NULL);
+}
+
+/**
+ * ds_async_queue_msg_alloc - allocate message buffer that can be passed to
+ *			      queue without copying
+ * @msglen: size of message data
+ *
+ * Returned buffer can be pushed with ds_async_queue_push_msg*() and is
+ * compatible with free(), as are all messages returned by ds_async_queue_pop*,
+ * unless allocator is changed with ds_set_allocator().
+ */
+extern void *ds_async_queue_msg_alloc(size_t msglen);
+
+/**
+ * ds_async_queue_msg_free - free message buffer
+ * @msg: buffer allocated with ds_async_queue_msg_alloc() or returned by
+ *	 ds_async_queue_pop*
+ */
+extern void ds_async_queue_msg_free(void *msg);
+
+/**
+ * ds_async_queue_push_msg_timed - pushes message buffer to queue without
+ *				   copying, with timeout
+ * @queue: queue to push message to
+ * @msg: message buffer allocated with ds_async_queue_msg_alloc() or popped
+ *	 from ds_async_queue
+ * @msglen: size of message data
+ * @abstime: absolute time of timeout
+ *
+ * Pushes message to queue. If queue is full, will block until there is space
+ * or timeout is reached. If timeout is reached, returns -ETIMEDOUT and caller
+ * retains ownership of @msg. Otherwise returns zero and ownership of @msg is
+ * passed to queue; caller must not access or free @msg anymore.
+ */
+extern int ds_async_queue_push_msg_timed(struct ds_async_queue *queue,
+					 void *msg, size_t msglen,
+					 const struct ds_timespec *abstime);
+
+/**
+ * ds_async_queue_try_push_msg - tries to push message buffer to queue without
+ *				 copying
+ * @queue: queue to push message to
+ * @msg: message buffer allocated with ds_async_queue_msg_alloc() or popped
+ *	 from ds_async_queue
+ * @msglen: size of message data
+ *
+ * Tries to push message to queue. If queue is full, will return -ETIMEDOUT
+ * and caller retains ownership of @msg. Otherwise returns zero and ownership
+ * of @msg is passed to queue.
+ */
+extern int ds_async_queue_try_push_msg(struct ds_async_queue *queue, void *msg,
+				       size_t msglen);
+
+/**
+ * ds_async_queue_push_msg - pushes message buffer to queue without copying
+ * @queue: queue to push message to
+ * @msg: message buffer allocated with ds_async_queue_msg_alloc() or popped
+ *	 from ds_async_queue
+ * @msglen: size of message data
+ *
+ * Pushes message to queue. If queue is full, will block until there is space.
+ * Ownership of @msg is passed to queue.
+ */
+static inline void ds_async_queue_push_msg(struct ds_async_queue *queue,
+					   void *msg, size_t msglen)
+{
+	ds_async_queue_push_msg_timed(queue, msg, msglen, NULL);
+}
+
+/**
+ * ds_async_queue_push_msg_batch_timed - pushes array of message buffers to
+ *					 queue without copying, with timeout
+ * @queue: queue to push messages to
+ * @msgs: messages to push, allocated with ds_async_queue_msg_alloc() or
+ *	  popped from ds_async_queue
+ * @num: number of messages in @msgs
+ * @abstime: absolute time of timeout
+ *
+ * Same as ds_async_queue_push_batch_timed(), but ownership of pushed messages
+ * is passed to queue. Caller retains ownership of messages that were not
+ * pushed before timeout, which are the last entries of @msgs.
+ */
+extern int
+ds_async_queue_push_msg_batch_timed(struct ds_async_queue *queue,
+				    const struct ds_async_queue_msg *msgs,
+				    unsigned int num,
+				    const struct ds_timespec *abstime);
+
+/**
+ * ds_async_queue_pop_timed - pops message from queue, with timeout
+ * @queue: queue
+ * @msg: returns pointer to message
+ * @msglen: returns size of message
+ * @abstime: absolute time of timeout
+ *
  * Pops message from queue. If queue is empty, will block until there is message
  * or timeout is reached. If timeout is reached, returns -ETIMEDOUT. Otherwise
  * returns zero. Caller must after use free data structure returned by @msg.
@@ -826,20 +1997,516 @@ static inline void ds_async_queue_pop(struct ds_async_queue *queue, void **msg,
 	ds_async_queue_pop_timed(queue, msg, msglen, NULL);
 }
 
+/**
+ * ds_async_queue_pop_batch_timed - pops up to @num messages from queue, with
+ *				    timeout
+ * @queue: queue
+ * @msgs: array to fill with popped messages
+ * @num: number of entries in @msgs
+ * @abstime: absolute time of timeout
+ *
+ * Pops all available messages, up to @num. If queue is empty, will block until
+ * there is message or timeout is reached. If timeout is reached, returns
+ * -ETIMEDOUT. Otherwise returns number of messages popped. Caller must after
+ * use free data structures returned in @msgs.
+ */
+extern int ds_async_queue_pop_batch_timed(struct ds_async_queue *queue,
+					  struct ds_async_queue_msg *msgs,
+					  unsigned int num,
+					  const struct ds_timespec *abstime);
+
+/**
+ * ds_async_queue_pop_batch - pops up to @num messages from queue
+ * @queue: queue
+ * @msgs: array to fill with popped messages
+ * @num: number of entries in @msgs
+ *
+ * Pops all available messages, up to @num. If queue is empty, will block until
+ * there is message. Returns number of messages popped. Caller must after use
+ * free data structures returned in @msgs.
+ */
+static inline int ds_async_queue_pop_batch(struct ds_async_queue *queue,
+					   struct ds_async_queue_msg *msgs,
+					   unsigned int num)
+{
+	return ds_async_queue_pop_batch_timed(queue, msgs, num, NULL);
+}
+
 
+/*****************************************************************************
+ * Event count, for parking threads waiting on lock-free data structures
+ *****************************************************************************/
+
+/* private structure, defined in ds_event.c */
+struct ds_event;
+
+/**
+ * ds_event_alloc - create new ds_event
+ */
+extern struct ds_event *ds_event_alloc(void);
+
+/**
+ * ds_event_free - frees ds_event
+ * @event: event to free
+ */
+extern void ds_event_free(struct ds_event *event);
+
+/**
+ * ds_event_prepare_wait - register as waiter before re-checking wait condition
+ * @event: event
+ *
+ * Returns key to be passed to ds_event_wait(). After this, caller must check
+ * its wait condition again and either call ds_event_cancel_wait() if
+ * condition has been met or ds_event_wait() to park.
+ */
+extern unsigned int ds_event_prepare_wait(struct ds_event *event);
+
+/**
+ * ds_event_cancel_wait - unregister waiter registered with
+ *			  ds_event_prepare_wait()
+ * @event: event
+ */
+extern void ds_event_cancel_wait(struct ds_event *event);
+
+/**
+ * ds_event_wait - park until event is signaled, with timeout
+ * @event: event
+ * @key: key returned by ds_event_prepare_wait()
+ * @abstime: absolute time of timeout, NULL for no timeout
+ *
+ * Returns immediately if event has been signaled after @key was taken. If
+ * timeout is reached, returns -ETIMEDOUT. Otherwise returns zero. Waiter is
+ * unregistered in both cases.
+ */
+extern int ds_event_wait(struct ds_event *event, unsigned int key,
+			 const struct ds_timespec *abstime);
+
+/**
+ * ds_event_signal - wake one waiter, call after publishing state change
+ * @event: event
+ *
+ * Cheap when there are no waiters, no locks are taken.
+ */
+extern void ds_event_signal(struct ds_event *event);
+
+/**
+ * ds_event_signal_many - wake up to @count waiters, call after publishing
+ *			  state change
+ * @event: event
+ * @count: number of waiters to wake
+ */
+extern void ds_event_signal_many(struct ds_event *event, unsigned int count);
+
+/**
+ * ds_event_broadcast - wake all waiters, call after publishing state change
+ * @event: event
+ */
+extern void ds_event_broadcast(struct ds_event *event);
+
+
+/*****************************************************************************
+ * Lock-free single-producer/single-consumer message queue between threads
+ *****************************************************************************/
+
+/* private structure, defined in ds_spsc_queue.c */
+struct ds_spsc_queue;
+
+/**
+ * ds_spsc_queue_alloc - create new ds_spsc_queue
+ * @capacity: maximum number of messages in queue, rounded up to power of two
+ * @slot_size: maximum size of message data
+ *
+ * Messages are stored inline to preallocated ring of fixed size slots, so
+ * push and pop do not allocate memory or take locks. Threads are parked only
+ * when ring is empty or full. Only one thread may push and only one thread
+ * may pop at same time.
+ */
+extern struct ds_spsc_queue *ds_spsc_queue_alloc(unsigned int capacity,
+						 size_t slot_size);
+
+/**
+ * ds_spsc_queue_free - frees ds_spsc_queue
+ * @queue: queue to free
+ */
+extern void ds_spsc_queue_free(struct ds_spsc_queue *queue);
+
+/**
+ * ds_spsc_queue_empty - checks if queue is empty
+ * @queue: queue
+ */
+extern bool ds_spsc_queue_empty(struct ds_spsc_queue *queue);
+
+/**
+ * ds_spsc_queue_push_timed - pushes new message to queue, with timeout
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data, at most slot size of queue
+ * @abstime: absolute time of timeout
+ *
+ * Copies message to queue. If queue is full, will block until there is space
+ * or timeout is reached. If timeout is reached, returns -ETIMEDOUT. If
+ * message is larger than slot size, returns -EINVAL. Otherwise returns zero.
+ */
+extern int ds_spsc_queue_push_timed(struct ds_spsc_queue *queue,
+				    const void *msg, size_t msglen,
+				    const struct ds_timespec *abstime);
+
+/**
+ * ds_spsc_queue_try_push - tries to push new message to queue
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data, at most slot size of queue
+ *
+ * Tries to push message to queue. If queue is full, will return -ETIMEDOUT.
+ * Otherwise same as ds_spsc_queue_push_timed().
+ */
+extern int ds_spsc_queue_try_push(struct ds_spsc_queue *queue,
+				  const void *msg, size_t msglen);
+
+/**
+ * ds_spsc_queue_push - pushes new message to queue
+ * @queue: queue to push message to
+ * @msg: pointer to message data
+ * @msglen: size of message data, at most slot size of queue
+ *
+ * Pushes message to queue. If queue is full, will block until there is space.
+ */
+static inline int ds_spsc_queue_push(struct ds_spsc_queue *queue,
+				     const void *msg, size_t msglen)
+{
+	return ds_spsc_queue_push_timed(queue, msg, msglen, NULL);
+}
+
+/**
+ * ds_spsc_queue_pop_timed - pops message from queue, with timeout
+ * @queue: queue
+ * @msg: buffer where message is copied to, at least slot size of queue
+ * @msglen: returns size of message
+ * @abstime: absolute time of timeout
+ *
+ * Pops message from queue. If queue is empty, will block until there is message
+ * or timeout is reached. If timeout is reached, returns -ETIMEDOUT. Otherwise
+ * returns zero.
+ */
+extern int ds_spsc_queue_pop_timed(struct ds_spsc_queue *queue, void *msg,
+				   size_t *msglen,
+				   const struct ds_timespec *abstime);
+
+/**
+ * ds_spsc_queue_try_pop - tries to pop message from queue
+ * @queue: queue
+ * @msg: buffer where message is copied to, at least slot size of queue
+ * @msglen: returns size of message
+ *
+ * Tries to pops message from queue. If queue is empty, returns -ETIMEDOUT.
+ * Otherwise returns zero.
+ */
+extern int ds_spsc_queue_try_pop(struct ds_spsc_queue *queue, void *msg,
+				 size_t *msglen);
+
+/**
+ * ds_spsc_queue_pop - pop message from queue
+ * @queue: queue
+ * @msg: buffer where message is copied to, at least slot size of queue
+ * @msglen: returns size of message
+ *
+ * Pops message from queue. If queue is empty, will block until there is
+ * message.
+ */
+static inline void ds_spsc_queue_pop(struct ds_spsc_queue *queue, void *msg,
+				     size_t *msglen)
+{
+	ds_spsc_queue_pop_timed(queue, msg, msglen, NULL);
+}
+
+
+/*****************************************************************************
+ * Wait group and work-stealing thread pool
+ *****************************************************************************/
+
+/*
+ * Wait group, counts outstanding tasks. Initialize with ds_wait_group_init(),
+ * add tasks with ds_wait_group_add() before they are started and mark them
+ * finished with ds_wait_group_done().
+ */
+struct ds_wait_group {
+	unsigned int count;
+	unsigned int busy;
+	struct ds_event *event;
+};
+
+/**
+ * ds_wait_group_init - initialize wait group with zero count
+ * @wg: wait group
+ *
+ * Returns false in case of memory allocation failure.
+ */
+extern bool ds_wait_group_init(struct ds_wait_group *wg);
+
+/**
+ * ds_wait_group_free - free wait group resources
+ * @wg: wait group, no thread may be waiting
+ */
+extern void ds_wait_group_free(struct ds_wait_group *wg);
+
+/**
+ * ds_wait_group_add - add @num outstanding tasks to wait group
+ * @wg: wait group
+ * @num: number of tasks
+ */
+static inline void ds_wait_group_add(struct ds_wait_group *wg, unsigned int num)
+{
+	__atomic_add_fetch(&wg->count, num, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * ds_wait_group_pending - return number of outstanding tasks
+ * @wg: wait group
+ */
+static inline unsigned int ds_wait_group_pending(struct ds_wait_group *wg)
+{
+	return __atomic_load_n(&wg->count, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * ds_wait_group_done - mark one task of wait group finished
+ * @wg: wait group
+ *
+ * Waiters are woken when count drops to zero.
+ */
+extern void ds_wait_group_done(struct ds_wait_group *wg);
+
+/**
+ * ds_wait_group_wait - wait until count of wait group drops to zero
+ * @wg: wait group
+ *
+ * Wait group may be freed or reused after this returns. Workers of
+ * ds_workqueue should use ds_workqueue_wait() instead, to keep running
+ * tasks while waiting.
+ */
+extern void ds_wait_group_wait(struct ds_wait_group *wg);
+
+/* Maximum number of worker threads of ds_workqueue */
+#define DS_WORKQUEUE_MAX_WORKERS 64
+
+/* Capacity of task deque of each worker, overflow goes to shared queue */
+#define DS_WORKQUEUE_DEQUE_SIZE 1024
+
+typedef void (*ds_work_func_t)(void *arg);
+
+/* private structure, defined in ds_workqueue.c */
+struct ds_workqueue;
+
+/*
+ * Workqueue statistics. @stolen tasks were taken from deque of other
+ * worker, @injected were submitted from outside of workers or overflowed
+ * worker deque, @parks counts times workers went to sleep.
+ */
+struct ds_workqueue_stats {
+	unsigned int num_workers;
+	unsigned long long submitted;
+	unsigned long long executed;
+	unsigned long long stolen;
+	unsigned long long injected;
+	unsigned long long parks;
+};
+
+/**
+ * ds_workqueue_alloc - create work-stealing thread pool
+ * @num_workers: number of worker threads, zero for number of online CPUs
+ *
+ * Each worker has Chase-Lev deque of tasks. Tasks submitted by worker are
+ * pushed to and popped from bottom of its own deque without locks, idle
+ * workers steal from top of deques of other workers. Tasks submitted by
+ * other threads go through shared queue. Workers park when there are no
+ * tasks.
+ */
+extern struct ds_workqueue *ds_workqueue_alloc(unsigned int num_workers);
+
+/**
+ * ds_workqueue_free - run all submitted tasks, stop workers and free pool
+ * @wq: workqueue, may not be called from worker of @wq
+ */
+extern void ds_workqueue_free(struct ds_workqueue *wq);
+
+/**
+ * ds_workqueue_submit - submit task to workqueue
+ * @wq: workqueue
+ * @func: task function
+ * @arg: argument for @func
+ * @wg: wait group to add task to and mark done after @func returns, or NULL
+ *
+ * Returns false in case of memory allocation failure.
+ */
+extern bool ds_workqueue_submit(struct ds_workqueue *wq, ds_work_func_t func,
+				void *arg, struct ds_wait_group *wg);
+
+/**
+ * ds_workqueue_wait - wait for wait group, running tasks of workqueue while
+ *		       waiting if called from worker
+ * @wq: workqueue
+ * @wg: wait group
+ *
+ * Lets tasks wait for their subtasks without blocking worker thread.
+ */
+extern void ds_workqueue_wait(struct ds_workqueue *wq, struct ds_wait_group *wg);
+
+/**
+ * ds_workqueue_num_workers - return number of worker threads
+ * @wq: workqueue
+ */
+extern unsigned int ds_workqueue_num_workers(const struct ds_workqueue *wq);
+
+/**
+ * ds_workqueue_current_worker - return index of worker running caller, -1 if
+ *				 caller is not worker of @wq
+ * @wq: workqueue
+ */
+extern int ds_workqueue_current_worker(struct ds_workqueue *wq);
+
+/**
+ * ds_workqueue_get_stats - get workqueue statistics
+ * @wq: workqueue
+ * @stats: statistics output
+ */
+extern void ds_workqueue_get_stats(struct ds_workqueue *wq,
+				   struct ds_workqueue_stats *stats);
+
+
+/*****************************************************************************
+ * Rings of samples, FIFO with window of consumed history
+ *****************************************************************************/
+
+/* Ring memory is aligned to cache line */
+#define DS_SAMPLE_RING_ALIGN 64
+
+/* Capacity limits of ring, number of values */
+#define DS_SAMPLE_RING_MIN_CAPACITY 64
+#define DS_SAMPLE_RING_MAX_CAPACITY (1U << 30)
+
+/**
+ * DS_DECLARE_SAMPLE_RING - declare ring of @type samples with history window
+ * @name: name of ring structure and prefix of functions
+ * @type: sample type
+ *
+ * Declares struct name_span {const type *values; unsigned int len} for
+ * contiguous segment of ring values, struct name and:
+ *  bool name_init(struct name *ring, unsigned int capacity,
+ *		   unsigned int history)
+ *  void name_free(struct name *ring)
+ *  void name_clear(struct name *ring)
+ *  unsigned int name_length(const struct name *ring)
+ *  unsigned int name_space(const struct name *ring)
+ *  bool name_reserve(struct name *ring, unsigned int num)
+ *  unsigned int name_write(struct name *ring, const type *values,
+ *			    unsigned int num)
+ *  type *name_get_end_free(struct name *ring, unsigned int *num)
+ *  void name_move_end(struct name *ring, unsigned int num)
+ *  unsigned int name_peek(const struct name *ring, unsigned int num,
+ *			   struct name_span spans[2])
+ *  void name_move_head(struct name *ring, unsigned int num)
+ *  unsigned int name_read(struct name *ring, type *values, unsigned int num)
+ *  unsigned int name_get_history(const struct name *ring, unsigned int num,
+ *				  struct name_span spans[2])
+ *
+ * Indexes run freely and are masked with power-of-two capacity. Writer never
+ * overwrites last @history consumed values, so those can be read without
+ * copying after consumer has moved past them.
+ *
+ * Init rounds capacity up to power of two together with history and returns
+ * false if out of memory or capacity is out of range. Reserve grows ring to
+ * have room for @num more values, keeping unread values and history, and
+ * returns false if out of memory. Write returns number of values written,
+ * less than @num if ring is full. Values stored to memory returned by
+ * get_end_free are added to ring with move_end. Peek returns up to @num
+ * unread values as two spans, second is empty unless values wrap around end
+ * of ring. Move_head consumes values into history. Get_history returns last
+ * consumed values, oldest value first. Spans stay valid until ring is grown,
+ * consumed further or freed.
+ *
+ * Functions not inlined here are defined in ds_sample_ring.c.
+ */
+#define DS_DECLARE_SAMPLE_RING(name, type) \
+struct name##_span { \
+	const type *values; \
+	unsigned int len; \
+}; \
+struct name { \
+	type *values; \
+	unsigned int capacity; \
+	unsigned int mask; \
+	unsigned int history; \
+	unsigned int history_len; \
+	unsigned int head; \
+	unsigned int tail; \
+}; \
+extern bool name##_init(struct name *ring, unsigned int capacity, \
+			unsigned int history); \
+extern void name##_free(struct name *ring); \
+extern void name##_clear(struct name *ring); \
+static inline unsigned int name##_length(const struct name *ring) \
+{ \
+	return ring->tail - ring->head; \
+} \
+static inline unsigned int name##_space(const struct name *ring) \
+{ \
+	return ring->capacity - ring->history - (ring->tail - ring->head); \
+} \
+extern bool name##_reserve(struct name *ring, unsigned int num); \
+extern unsigned int name##_write(struct name *ring, const type *values, \
+				 unsigned int num); \
+extern type *name##_get_end_free(struct name *ring, unsigned int *num); \
+static inline void name##_move_end(struct name *ring, unsigned int num) \
+{ \
+	ring->tail += num; \
+} \
+extern unsigned int name##_peek(const struct name *ring, unsigned int num, \
+				struct name##_span spans[2]); \
+extern void name##_move_head(struct name *ring, unsigned int num); \
+extern unsigned int name##_read(struct name *ring, type *values, \
+				unsigned int num); \
+extern unsigned int name##_get_history(const struct name *ring, \
+				       unsigned int num, \
+				       struct name##_span spans[2]);
+
+/* Ring of float samples */
+DS_DECLARE_SAMPLE_RING(ds_float_ring, float)
+
+#define DS_FLOAT_RING_ALIGN DS_SAMPLE_RING_ALIGN
+#define DS_FLOAT_RING_MIN_CAPACITY DS_SAMPLE_RING_MIN_CAPACITY
+#define DS_FLOAT_RING_MAX_CAPACITY DS_SAMPLE_RING_MAX_CAPACITY
+
+/* Ring of int16 fixed-point samples, half the memory traffic per value */
+DS_DECLARE_SAMPLE_RING(ds_i16_ring, int16_t)
+
+#define DS_I16_RING_ALIGN DS_SAMPLE_RING_ALIGN
+#define DS_I16_RING_MIN_CAPACITY DS_SAMPLE_RING_MIN_CAPACITY
+#define DS_I16_RING_MAX_CAPACITY DS_SAMPLE_RING_MAX_CAPACITY
+
+
 /*****************************************************************************
  * Appendable buffer, scatter/gather memory buffer with ability to append new
  * data.
  *****************************************************************************/
 
+/* Allocation size limits of internal buffer pieces (including piece header) */
+#define DS_APPEND_BUFFER_MIN_PIECE_LEN 256
+#define DS_APPEND_BUFFER_MAX_PIECE_LEN (64 * 1024)
+
+struct ds_append_buffer_index;
+
 struct ds_append_buffer {
 	struct ds_xor_list list;
 	unsigned int length;
 	unsigned int first_offset;
+	unsigned int piece_len;
+	unsigned int max_piece_len;
+	struct ds_append_buffer_index *index;
 };
 
 /**
- * ds_append_buffer_init - initialize appendable buffer
+ * ds_append_buffer_init - initialize appendable buffer, with fixed size
+ *			   (DS_APPEND_BUFFER_MIN_PIECE_LEN) internal pieces
  * @buf: buffer structure to initialize
  */
 static inline void ds_append_buffer_init(struct ds_append_buffer *buf)
@@ -847,8 +2514,42 @@ static inline void ds_append_buffer_init(struct ds_append_buffer *buf)
 	ds_xorlist_init(&buf->list);
 	buf->length = 0;
 	buf->first_offset = 0;
+	buf->piece_len = DS_APPEND_BUFFER_MIN_PIECE_LEN;
+	buf->max_piece_len = DS_APPEND_BUFFER_MIN_PIECE_LEN;
+	buf->index = NULL;
 }
 
+/**
+ * ds_append_buffer_init_sized - initialize appendable buffer with piece size
+ *				 policy
+ * @buf: buffer structure to initialize
+ * @piece_len: allocation size of first internal piece
+ * @max_piece_len: allocation size limit for internal pieces
+ *
+ * Sizes are rounded up to power-of-two size classes between
+ * DS_APPEND_BUFFER_MIN_PIECE_LEN and DS_APPEND_BUFFER_MAX_PIECE_LEN. If
+ * @max_piece_len is larger than @piece_len, each new piece is allocated twice
+ * as large as previous until @max_piece_len is reached. Otherwise all pieces
+ * are allocated with fixed size @piece_len.
+ */
+extern void ds_append_buffer_init_sized(struct ds_append_buffer *buf,
+					unsigned int piece_len,
+					unsigned int max_piece_len);
+
+/**
+ * ds_append_buffer_enable_index - enable piece index for fast offset lookups
+ * @abuf: appendable buffer
+ *
+ * Index keeps cumulative offsets of buffer pieces up to date on append and
+ * head moves, making offset lookups (ds_append_buffer_copy(),
+ * ds_append_buffer_get_spans(), ds_append_buffer_move_head() and
+ * ds_append_buffer_iterator_seek()) logarithmic to number of pieces instead of
+ * linear. Index is released by ds_append_buffer_free().
+ *
+ * Returns false in case of memory allocation failure.
+ */
+extern bool ds_append_buffer_enable_index(struct ds_append_buffer *abuf);
+
 /**
  * ds_append_buffer_length - get length of data stored to buffer
  * @buf: appendable buffer
@@ -874,6 +2575,18 @@ extern void ds_append_buffer_free(struct ds_append_buffer *buf);
 extern void ds_append_buffer_move(struct ds_append_buffer *new_buf,
 				  struct ds_append_buffer *old_buf);
 
+/**
+ * ds_append_buffer_splice - move all data of @src_buf to end of @dst_buf
+ * @dst_buf: buffer which data is appended to
+ * @src_buf: buffer which data is moved, left empty
+ *
+ * Pieces are moved between buffers without copying data, except for
+ * partially consumed first piece of @src_buf. Returns number of bytes moved,
+ * less than length of @src_buf in case of memory allocation failure.
+ */
+extern unsigned int ds_append_buffer_splice(struct ds_append_buffer *dst_buf,
+					    struct ds_append_buffer *src_buf);
+
 /**
  * ds_append_buffer_clone - makes copy of @old_buf to @new_buf.
  * @new_buf: empty buffer
@@ -987,6 +2700,107 @@ extern bool ds_append_buffer_finish_write_buffer(struct ds_append_buffer *abuf,
 extern bool ds_append_buffer_append_piece(struct ds_append_buffer *abuf,
 					  void *piece, unsigned int buflen);
 
+/**
+ * ds_append_buffer_release_t - release function for external data appended
+ *				with ds_append_buffer_append_external()
+ * @opaque: pointer given at append
+ * @data: appended data
+ * @len: length of @data
+ */
+typedef void (*ds_append_buffer_release_t)(void *opaque, void *data,
+					   unsigned int len);
+
+/**
+ * ds_append_buffer_append_external - append memory owned by caller at end of
+ *				      appendable buffer without copying
+ * @abuf: appendable buffer
+ * @data: data to append, must stay valid and unmodified until released
+ * @len: length of @data
+ * @release: called when @abuf no longer references @data (head has been moved
+ *	     past it or buffer is freed), can be NULL
+ * @opaque: passed to @release
+ *
+ * Data following @data is appended to new pieces. Clone of buffer gets its
+ * own copy of external data. Returns false in case of memory allocation
+ * failure, @release is not called then.
+ */
+extern bool ds_append_buffer_append_external(struct ds_append_buffer *abuf,
+					     void *data, unsigned int len,
+					     ds_append_buffer_release_t release,
+					     void *opaque);
+
+/**
+ * ds_append_buffer_span - contiguous memory segment of appendable buffer data
+ * @data: pointer to first byte of segment
+ * @len: number of bytes in segment
+ */
+struct ds_append_buffer_span {
+	void *data;
+	unsigned int len;
+};
+
+/**
+ * ds_append_buffer_get_spans - get contiguous memory segments covering range
+ *				of appendable buffer data
+ * @abuf: appendable buffer
+ * @offset: offset to @abuf where range starts
+ * @len: length of range
+ * @spans: array where segments are stored
+ * @max_spans: number of entries in @spans
+ *
+ * Returns number of segments stored to @spans. Range is clipped at end of
+ * @abuf data and at @max_spans segments. Segments point directly to internal
+ * buffer memory and remain valid until head of @abuf is moved past them or
+ * @abuf is freed.
+ */
+extern unsigned int
+ds_append_buffer_get_spans(struct ds_append_buffer *abuf, unsigned int offset,
+			   unsigned int len,
+			   struct ds_append_buffer_span *spans,
+			   unsigned int max_spans);
+
+/**
+ * ds_append_buffer_pool_stats - statistics of per-thread pool of internal
+ *				 buffer pieces
+ * @hits: piece allocations served from pool
+ * @misses: piece allocations that had to use malloc()
+ * @releases: pieces returned to pool
+ * @frees: pieces freed with free() because pool was full
+ * @pooled_pieces: number of pieces currently in pool
+ * @pooled_bytes: memory currently held by pool
+ */
+struct ds_append_buffer_pool_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long releases;
+	unsigned long frees;
+	unsigned int pooled_pieces;
+	unsigned long pooled_bytes;
+};
+
+/**
+ * ds_append_buffer_pool_get_stats - get piece pool statistics of current
+ *				     thread
+ * @stats: structure to store statistics to
+ */
+extern void
+ds_append_buffer_pool_get_stats(struct ds_append_buffer_pool_stats *stats);
+
+/**
+ * ds_append_buffer_pool_set_limit - set per size class limit of pooled memory
+ *				     for current thread
+ * @class_bytes: maximum bytes pooled for each piece size class, zero disables
+ *		 pooling for current thread
+ *
+ * Pieces exceeding new limit are freed.
+ */
+extern void ds_append_buffer_pool_set_limit(unsigned int class_bytes);
+
+/**
+ * ds_append_buffer_pool_flush - free all pooled pieces of current thread
+ */
+extern void ds_append_buffer_pool_flush(void);
+
 /**
  * ds_append_buffer_iterator - appendable buffer iterator helper structure
  *
@@ -994,6 +2808,7 @@ extern bool ds_append_buffer_append_piece(struct ds_append_buffer *abuf,
  */
 struct ds_append_buffer_iterator {
 	unsigned char *pchar;
+	void *ppiece;
 	void *pprev;
 	unsigned int ppos;
 	unsigned int pos;
@@ -1007,6 +2822,20 @@ extern void
 ds_append_buffer_iterator_init(struct ds_append_buffer *abuf,
 			       struct ds_append_buffer_iterator *iter);
 
+/**
+ * ds_append_buffer_iterator_seek - initialize appendable buffer iterator at
+ *				    @offset
+ * @abuf: appendable buffer
+ * @iter: iterator structure
+ * @offset: offset to @abuf where iterator is positioned
+ *
+ * Uses piece index if enabled with ds_append_buffer_enable_index().
+ */
+extern void
+ds_append_buffer_iterator_seek(struct ds_append_buffer *abuf,
+			       struct ds_append_buffer_iterator *iter,
+			       unsigned int offset);
+
 /**
  * __ds_append_buffer_iterator_forward - slow path for moving iterator forward
  *					 by @add bytes
@@ -1083,6 +2912,23 @@ static inline unsigned int ds_append_buffer_iterator_pos(
 	return iter->pos;
 }
 
+/**
+ * ds_append_buffer_iterator_span - get contiguous data from current iterator
+ *				    position to end of current piece
+ * @iter: iterator
+ * @len: number of bytes in returned segment is stored here
+ *
+ * ds_append_buffer_iterator_has_reached_end() must be checked before calling
+ * this function and must not be called if iterator has reached the end!
+ */
+static inline void *ds_append_buffer_iterator_span(
+					struct ds_append_buffer_iterator *iter,
+					unsigned int *len)
+{
+	*len = iter->pmax - iter->ppos;
+	return iter->pchar;
+}
+
 /**
  * ds_queue_for_each - for statement macro for iterating appendable buffer
  *		       byte data
@@ -1094,4 +2940,19 @@ static inline unsigned int ds_append_buffer_iterator_pos(
 		!ds_append_buffer_iterator_has_reached_end(iter); \
 			ds_append_buffer_iterator_forward(iter, 1))
 
+/**
+ * ds_append_buffer_for_each_span - for statement macro for iterating
+ *				    appendable buffer data one contiguous
+ *				    segment at time
+ * @iter: iterator structure to be used, will be reseted
+ * @abuf: appendable buffer to be iterated
+ * @span: pointer variable where segment start is stored
+ * @len: unsigned int variable where segment length is stored
+ */
+#define ds_append_buffer_for_each_span(iter, abuf, span, len) \
+	for (ds_append_buffer_iterator_init(abuf, iter); \
+		!ds_append_buffer_iterator_has_reached_end(iter) && \
+		((span) = ds_append_buffer_iterator_span(iter, &(len)), 1); \
+			ds_append_buffer_iterator_forward(iter, len))
+
 #endif /* __LIBDS__DS_H__ */
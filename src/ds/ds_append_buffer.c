@@ -24,64 +24,509 @@
  *
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <memory.h>
 
 #include "ds.h"
 
-#define DS_APPEND_BUFFER_PIECE_LEN 256
+/* Number of piece size classes, DS_APPEND_BUFFER_MIN_PIECE_LEN << n */
+#define DS_APPEND_BUFFER_NUM_CLASSES 9
 
-#if DS_APPEND_BUFFER_PIECE_LEN <= 256
-	typedef unsigned char piece_datalen_t;
-#elif DS_APPEND_BUFFER_PIECE_LEN <= 65536
-	typedef unsigned short piece_datalen_t;
-#else
-	typedef unsigned int piece_datalen_t;
+/* Default per-thread limit of pooled memory for each piece size class */
+#ifndef DS_APPEND_BUFFER_POOL_CLASS_BYTES
+	#define DS_APPEND_BUFFER_POOL_CLASS_BYTES (64 * 1024)
 #endif
 
-#define DS_APPEND_BUFFER_PIECE_DATA_LEN (DS_APPEND_BUFFER_PIECE_LEN - \
-					 sizeof(struct ds_xorlist_entry) - \
-					 sizeof(piece_datalen_t))
+/* Minimum number of pooled pieces per size class (unless pool disabled) */
+#define DS_APPEND_BUFFER_POOL_MIN_PIECES 2
+
+/* Initial number of entries in piece index */
+#define DS_APPEND_BUFFER_INDEX_MIN_ENTRIES 16
+
+/*
+ * Pieces are allocated in power-of-two size classes, from
+ * DS_APPEND_BUFFER_MIN_PIECE_LEN up to DS_APPEND_BUFFER_MAX_PIECE_LEN bytes
+ * (including piece header). Data length must be able to present full length
+ * of largest piece.
+ *
+ * Data of allocated pieces is stored after piece header. External pieces
+ * point to memory owned by caller and are always full.
+ */
+typedef unsigned int piece_datalen_t;
 
 struct ds_append_buffer_piece {
 	struct ds_xorlist_entry entry;
 	piece_datalen_t datalen;
-	unsigned char data[DS_APPEND_BUFFER_PIECE_DATA_LEN];
+	piece_datalen_t size;
+	unsigned char *data;
+	unsigned char storage[];
+};
+
+/* Stored in place of data array of external piece */
+struct ds_append_buffer_external {
+	ds_append_buffer_release_t release;
+	void *opaque;
 };
 
 static inline struct ds_append_buffer_piece *
 iterator_to_piece(struct ds_append_buffer_iterator *iter)
 {
-	/*
-	 * iter->pchar and iter->ppos have enough offset information to
-         * reconstruct piece pointer.
-	 */
-	return ds_container_of(iter->pchar - iter->ppos,
-			       struct ds_append_buffer_piece, data);
+	return iter->ppiece;
 }
 
 static inline struct ds_append_buffer_piece *
-iterator_to_piece_prev(struct ds_append_buffer_iterator *iter)
+entry_to_piece(struct ds_xorlist_entry *entry)
 {
-	/*
-	 * iter->pchar and iter->ppos have enough offset information to
-         * reconstruct piece pointer.
-	 */
-	return ds_container_of(iter->pprev,
-			       struct ds_append_buffer_piece, data);
+	return ds_container_of(entry, struct ds_append_buffer_piece, entry);
 }
 
-static inline struct ds_append_buffer_piece *
-entry_to_piece(struct ds_xorlist_entry *entry)
+static inline bool piece_is_external(struct ds_append_buffer_piece *piece)
 {
-	return ds_container_of(entry, struct ds_append_buffer_piece, entry);
+	return piece->data != piece->storage;
+}
+
+/*
+ * Piece index, array of pieces with cumulative offsets of their first bytes.
+ * Offsets are counted from creation of index and use modular arithmetic, so
+ * only differences of offsets are meaningful.
+ */
+struct ds_append_buffer_index_entry {
+	struct ds_append_buffer_piece *piece;
+	unsigned int start;
+};
+
+struct ds_append_buffer_index {
+	unsigned int first;	/* first used entry */
+	unsigned int num;	/* number of used entries */
+	unsigned int size;	/* number of allocated entries */
+	unsigned int head;	/* cumulative offset of first byte of buffer */
+	struct ds_append_buffer_index_entry entries[];
+};
+
+/**
+ * piece_len_to_class - round piece allocation length up to size class
+ * @len: requested allocation length
+ */
+static unsigned int piece_len_to_class(unsigned int len)
+{
+	unsigned int class_len = DS_APPEND_BUFFER_MIN_PIECE_LEN;
+
+	while (class_len < len && class_len < DS_APPEND_BUFFER_MAX_PIECE_LEN)
+		class_len <<= 1;
+
+	return class_len;
 }
 
 /**
- * ds_append_buffer_free - free internal data structures and data of buffer
- * @buf: buffer to free
+ * piece_class_index - get size class index of piece allocation length
+ * @alloc_len: allocation length, must be one of size class lengths
  */
-void ds_append_buffer_free(struct ds_append_buffer *buf)
+static unsigned int piece_class_index(unsigned int alloc_len)
+{
+	unsigned int idx = 0;
+
+	while ((DS_APPEND_BUFFER_MIN_PIECE_LEN << idx) < alloc_len)
+		idx++;
+
+	return idx;
+}
+
+/*
+ * Per-thread pool of unused pieces. Pieces are recycled through pool instead
+ * of malloc/free, avoiding allocator contention and fragmentation in
+ * steady-state where buffers are drained and refilled. Pooled pieces are
+ * linked through 'entry.prevnext'.
+ */
+struct piece_pool {
+	struct ds_append_buffer_piece *pieces[DS_APPEND_BUFFER_NUM_CLASSES];
+	unsigned int num_pieces[DS_APPEND_BUFFER_NUM_CLASSES];
+	unsigned int class_bytes;
+	struct ds_append_buffer_pool_stats stats;
+};
+
+static pthread_key_t piece_pool_key;
+static pthread_once_t piece_pool_once = PTHREAD_ONCE_INIT;
+static bool piece_pool_key_ok;
+
+static void piece_pool_release(struct piece_pool *pool)
+{
+	struct ds_append_buffer_piece *piece;
+	unsigned int i;
+
+	for (i = 0; i < DS_APPEND_BUFFER_NUM_CLASSES; i++) {
+		while ((piece = pool->pieces[i]) != NULL) {
+			pool->pieces[i] = (void *)piece->entry.prevnext;
+			ds_free(piece);
+		}
+
+		pool->num_pieces[i] = 0;
+	}
+
+	pool->stats.pooled_pieces = 0;
+	pool->stats.pooled_bytes = 0;
+}
+
+static void piece_pool_destructor(void *__pool)
+{
+	struct piece_pool *pool = __pool;
+
+	piece_pool_release(pool);
+	ds_free(pool);
+}
+
+static void piece_pool_key_init(void)
+{
+	piece_pool_key_ok = pthread_key_create(&piece_pool_key,
+					       piece_pool_destructor) == 0;
+}
+
+/**
+ * piece_pool_get - get piece pool of current thread
+ * @create: allocate pool if current thread does not have one yet
+ *
+ * Returns NULL if pool is not available.
+ */
+static struct piece_pool *piece_pool_get(bool create)
+{
+	struct piece_pool *pool;
+
+	pthread_once(&piece_pool_once, piece_pool_key_init);
+	if (!piece_pool_key_ok)
+		return NULL;
+
+	pool = pthread_getspecific(piece_pool_key);
+	if (pool || !create)
+		return pool;
+
+	pool = ds_calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->class_bytes = DS_APPEND_BUFFER_POOL_CLASS_BYTES;
+
+	if (pthread_setspecific(piece_pool_key, pool) != 0) {
+		ds_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/**
+ * piece_pool_class_limit - maximum number of pooled pieces in size class
+ */
+static unsigned int piece_pool_class_limit(struct piece_pool *pool,
+					   unsigned int idx)
+{
+	unsigned int limit;
+
+	if (pool->class_bytes == 0)
+		return 0;
+
+	limit = pool->class_bytes / (DS_APPEND_BUFFER_MIN_PIECE_LEN << idx);
+	if (limit < DS_APPEND_BUFFER_POOL_MIN_PIECES)
+		limit = DS_APPEND_BUFFER_POOL_MIN_PIECES;
+
+	return limit;
+}
+
+/**
+ * piece_alloc - allocate new empty piece
+ * @alloc_len: allocation size of piece, including piece header
+ */
+static struct ds_append_buffer_piece *piece_alloc(unsigned int alloc_len)
+{
+	struct ds_append_buffer_piece *piece;
+	struct piece_pool *pool;
+	unsigned int idx;
+
+	pool = piece_pool_get(true);
+	if (pool) {
+		idx = piece_class_index(alloc_len);
+		piece = pool->pieces[idx];
+		if (piece) {
+			/* Reuse piece from pool */
+			pool->pieces[idx] = (void *)piece->entry.prevnext;
+			pool->num_pieces[idx]--;
+
+			pool->stats.hits++;
+			pool->stats.pooled_pieces--;
+			pool->stats.pooled_bytes -= alloc_len;
+
+			piece->datalen = 0;
+			return piece;
+		}
+
+		pool->stats.misses++;
+	}
+
+	piece = ds_malloc(alloc_len);
+	if (!piece)
+		return NULL;
+
+	piece->datalen = 0;
+	piece->size = alloc_len - sizeof(*piece);
+	piece->data = piece->storage;
+
+	return piece;
+}
+
+/**
+ * piece_free - free piece, or return piece to pool of current thread
+ * @piece: piece to free
+ */
+static void piece_free(struct ds_append_buffer_piece *piece)
+{
+	unsigned int alloc_len = sizeof(*piece) + piece->size;
+	struct ds_append_buffer_external *ext;
+	struct piece_pool *pool;
+	unsigned int idx;
+
+	if (piece_is_external(piece)) {
+		ext = (void *)piece->storage;
+		if (ext->release)
+			ext->release(ext->opaque, piece->data, piece->size);
+		ds_free(piece);
+		return;
+	}
+
+	/* Only size class pieces are pooled */
+	pool = alloc_len <= DS_APPEND_BUFFER_MAX_PIECE_LEN &&
+	       piece_len_to_class(alloc_len) == alloc_len ?
+			piece_pool_get(true) : NULL;
+	if (pool) {
+		idx = piece_class_index(alloc_len);
+		if (pool->num_pieces[idx] < piece_pool_class_limit(pool, idx)) {
+			piece->entry.prevnext = (uintptr_t)pool->pieces[idx];
+			pool->pieces[idx] = piece;
+			pool->num_pieces[idx]++;
+
+			pool->stats.releases++;
+			pool->stats.pooled_pieces++;
+			pool->stats.pooled_bytes += alloc_len;
+			return;
+		}
+
+		pool->stats.frees++;
+	}
+
+	ds_free(piece);
+}
+
+/**
+ * ds_append_buffer_pool_get_stats - get piece pool statistics of current
+ *				     thread
+ * @stats: structure to store statistics to
+ */
+void ds_append_buffer_pool_get_stats(struct ds_append_buffer_pool_stats *stats)
+{
+	struct piece_pool *pool = piece_pool_get(false);
+
+	if (!pool) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	*stats = pool->stats;
+}
+
+/**
+ * ds_append_buffer_pool_set_limit - set per size class limit of pooled memory
+ *				     for current thread
+ * @class_bytes: maximum bytes pooled for each piece size class, zero disables
+ *		 pooling for current thread
+ *
+ * Pieces exceeding new limit are freed.
+ */
+void ds_append_buffer_pool_set_limit(unsigned int class_bytes)
+{
+	struct ds_append_buffer_piece *piece;
+	struct piece_pool *pool;
+	unsigned int i, limit, alloc_len;
+
+	pool = piece_pool_get(true);
+	if (!pool)
+		return;
+
+	pool->class_bytes = class_bytes;
+
+	for (i = 0; i < DS_APPEND_BUFFER_NUM_CLASSES; i++) {
+		limit = piece_pool_class_limit(pool, i);
+		alloc_len = DS_APPEND_BUFFER_MIN_PIECE_LEN << i;
+
+		while (pool->num_pieces[i] > limit) {
+			piece = pool->pieces[i];
+			pool->pieces[i] = (void *)piece->entry.prevnext;
+			pool->num_pieces[i]--;
+
+			pool->stats.pooled_pieces--;
+			pool->stats.pooled_bytes -= alloc_len;
+			ds_free(piece);
+		}
+	}
+}
+
+/**
+ * ds_append_buffer_pool_flush - free all pooled pieces of current thread
+ */
+void ds_append_buffer_pool_flush(void)
+{
+	struct piece_pool *pool = piece_pool_get(false);
+
+	if (pool)
+		piece_pool_release(pool);
+}
+
+/**
+ * append_buffer_alloc_piece - allocate new piece using piece size policy of
+ *			       appendable buffer
+ * @abuf: appendable buffer
+ */
+static struct ds_append_buffer_piece *
+append_buffer_alloc_piece(struct ds_append_buffer *abuf)
+{
+	struct ds_append_buffer_piece *piece;
+
+	piece = piece_alloc(abuf->piece_len);
+	if (!piece)
+		return NULL;
+
+	/* Geometric growth, next piece will be twice as large */
+	if (abuf->piece_len < abuf->max_piece_len)
+		abuf->piece_len <<= 1;
+
+	return piece;
+}
+
+/**
+ * append_buffer_index_drop - release piece index of appendable buffer
+ * @abuf: appendable buffer
+ */
+static void append_buffer_index_drop(struct ds_append_buffer *abuf)
+{
+	ds_free(abuf->index);
+	abuf->index = NULL;
+}
+
+/**
+ * append_buffer_index_add - add new last piece of appendable buffer to index
+ * @abuf: appendable buffer
+ * @piece: piece that was appended to piece list
+ *
+ * Previous last piece must not grow after this. If index cannot be grown,
+ * index is released and lookups fall back to walking piece list.
+ */
+static void append_buffer_index_add(struct ds_append_buffer *abuf,
+				    struct ds_append_buffer_piece *piece)
+{
+	struct ds_append_buffer_index *index = abuf->index;
+	struct ds_append_buffer_index_entry *last;
+	unsigned int start;
+
+	if (!index)
+		return;
+
+	/* New piece starts where previous last piece ends */
+	if (index->num > 0) {
+		last = &index->entries[index->first + index->num - 1];
+		start = last->start + last->piece->datalen;
+	} else {
+		start = index->head - abuf->first_offset;
+	}
+
+	if (index->first + index->num == index->size) {
+		if (index->first > 0) {
+			/* Reuse space released by moving head */
+			memmove(index->entries, &index->entries[index->first],
+				index->num * sizeof(index->entries[0]));
+			index->first = 0;
+		} else {
+			index = ds_realloc(index, sizeof(*index) +
+					   index->size * 2 *
+					   sizeof(index->entries[0]));
+			if (!index) {
+				/* out of memory */
+				append_buffer_index_drop(abuf);
+				return;
+			}
+
+			index->size *= 2;
+			abuf->index = index;
+		}
+	}
+
+	index->entries[index->first + index->num].piece = piece;
+	index->entries[index->first + index->num].start = start;
+	index->num++;
+}
+
+/**
+ * ds_append_buffer_enable_index - enable piece index for fast offset lookups
+ * @abuf: appendable buffer
+ *
+ * Returns false in case of memory allocation failure.
+ */
+bool ds_append_buffer_enable_index(struct ds_append_buffer *abuf)
+{
+	struct ds_append_buffer_index *index;
+	struct ds_xorlist_cursor cur;
+	struct ds_xorlist_entry *pos;
+
+	if (abuf->index)
+		return true;
+
+	index = ds_malloc(sizeof(*index) + DS_APPEND_BUFFER_INDEX_MIN_ENTRIES *
+					sizeof(index->entries[0]));
+	if (!index)
+		return false;
+
+	index->first = 0;
+	index->num = 0;
+	index->size = DS_APPEND_BUFFER_INDEX_MIN_ENTRIES;
+	index->head = abuf->first_offset;
+	abuf->index = index;
+
+	/* Add existing pieces */
+	ds_xorlist_cursor_for_each(&cur, pos, &abuf->list) {
+		append_buffer_index_add(abuf, entry_to_piece(pos));
+		if (!abuf->index)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * ds_append_buffer_init_sized - initialize appendable buffer with piece size
+ *				 policy
+ * @buf: buffer structure to initialize
+ * @piece_len: allocation size of first internal piece
+ * @max_piece_len: allocation size limit for internal pieces
+ *
+ * Sizes are rounded up to power-of-two size classes between
+ * DS_APPEND_BUFFER_MIN_PIECE_LEN and DS_APPEND_BUFFER_MAX_PIECE_LEN. If
+ * @max_piece_len is larger than @piece_len, each new piece is allocated twice
+ * as large as previous until @max_piece_len is reached. Otherwise all pieces
+ * are allocated with fixed size @piece_len.
+ */
+void ds_append_buffer_init_sized(struct ds_append_buffer *buf,
+				 unsigned int piece_len,
+				 unsigned int max_piece_len)
+{
+	ds_append_buffer_init(buf);
+
+	buf->piece_len = piece_len_to_class(piece_len);
+	buf->max_piece_len = piece_len_to_class(max_piece_len);
+	if (buf->max_piece_len < buf->piece_len)
+		buf->max_piece_len = buf->piece_len;
+}
+
+/**
+ * append_buffer_clear - free data of buffer, but keep piece index
+ * @buf: buffer to clear
+ */
+static void append_buffer_clear(struct ds_append_buffer *buf)
 {
 	struct ds_append_buffer_piece *piece;
 
@@ -97,10 +542,26 @@ void ds_append_buffer_free(struct ds_append_buffer *buf)
 		buf->first_offset = 0;
 
 		/* free buffer piece */
-		free(piece);
+		piece_free(piece);
+	}
+
+	if (buf->index) {
+		buf->index->first = 0;
+		buf->index->num = 0;
+		buf->index->head = 0;
 	}
 }
 
+/**
+ * ds_append_buffer_free - free internal data structures and data of buffer
+ * @buf: buffer to free
+ */
+void ds_append_buffer_free(struct ds_append_buffer *buf)
+{
+	append_buffer_clear(buf);
+	append_buffer_index_drop(buf);
+}
+
 /**
  * ds_append_buffer_move - move internal data structures from one buffer to
  *			   another, also clears the old buffer.
@@ -114,8 +575,79 @@ void ds_append_buffer_move(struct ds_append_buffer *new,
 	/* Copy header (pointers etc) */
 	*new = *old;
 
-	/* Clear/reinitialize old header */
+	/* Clear/reinitialize old header, but keep piece size policy */
 	ds_append_buffer_init(old);
+	old->piece_len = new->piece_len;
+	old->max_piece_len = new->max_piece_len;
+}
+
+/**
+ * ds_append_buffer_splice - move all data of @src_buf to end of @dst_buf
+ * @dst_buf: buffer which data is appended to
+ * @src_buf: buffer which data is moved, left empty
+ *
+ * Pieces are moved between buffers, only partially consumed first piece of
+ * @src_buf is copied when @dst_buf is not empty. Returns number of bytes
+ * moved, less than length of @src_buf in case of memory allocation failure.
+ */
+unsigned int ds_append_buffer_splice(struct ds_append_buffer *dst,
+				     struct ds_append_buffer *src)
+{
+	struct ds_append_buffer_piece *piece;
+	unsigned int len, moved = 0;
+
+	if (src->length == 0) {
+		append_buffer_clear(src);
+		return 0;
+	}
+
+	if (dst->length == 0) {
+		/* Drop empty pieces, first piece offset is taken as is */
+		append_buffer_clear(dst);
+		dst->first_offset = src->first_offset;
+	} else if (src->first_offset > 0) {
+		/* Data before offset is not part of buffer, copy rest */
+		piece = entry_to_piece(ds_xorlist_first(&src->list));
+		len = piece->datalen - src->first_offset;
+
+		moved = ds_append_buffer_append(dst,
+					piece->data + src->first_offset, len);
+		if (moved < len) {
+			/* out of memory */
+			ds_append_buffer_move_head(src, moved);
+			return moved;
+		}
+
+		ds_append_buffer_move_head(src, len);
+	}
+
+	while (!ds_xorlist_empty(&src->list)) {
+		piece = entry_to_piece(ds_xorlist_first(&src->list));
+		ds_xorlist_remove_entry(&src->list, &piece->entry, NULL);
+
+		len = piece->datalen - src->first_offset;
+		src->first_offset = 0;
+
+		/* Pieces without data are not moved */
+		if (piece->datalen == 0) {
+			piece_free(piece);
+			continue;
+		}
+
+		ds_xorlist_append_entry(&dst->list, &piece->entry);
+		append_buffer_index_add(dst, piece);
+		dst->length += len;
+		moved += len;
+	}
+
+	src->length = 0;
+	if (src->index) {
+		src->index->first = 0;
+		src->index->num = 0;
+		src->index->head = 0;
+	}
+
+	return moved;
 }
 
 /**
@@ -135,12 +667,24 @@ bool ds_append_buffer_clone(struct ds_append_buffer *new,
 	/* Copy header and reinitialize the list structure */
 	*new = *old;
 	ds_xorlist_init(&new->list);
+	new->index = NULL;
 
 	ds_xorlist_for_each(prev, pos, &old->list) {
 		old_piece = entry_to_piece(pos);
 
-		/* Allocate new clone piece */
-		new_piece = malloc(sizeof(*new_piece));
+		/* Allocate new clone piece, same size as old */
+		if (piece_is_external(old_piece)) {
+			/* Clone owns copy of external data */
+			new_piece = ds_malloc(sizeof(*new_piece) +
+					      old_piece->size);
+			if (new_piece) {
+				new_piece->size = old_piece->size;
+				new_piece->data = new_piece->storage;
+			}
+		} else {
+			new_piece = piece_alloc(sizeof(*old_piece) +
+						old_piece->size);
+		}
 		if (!new_piece)
 			return false;
 
@@ -152,6 +696,10 @@ bool ds_append_buffer_clone(struct ds_append_buffer *new,
 		ds_xorlist_append_entry(&new->list, &new_piece->entry);
 	}
 
+	/* Clone has its own index */
+	if (old->index)
+		return ds_append_buffer_enable_index(new);
+
 	return true;
 }
 
@@ -170,7 +718,7 @@ copy_to_append_buffer_piece(struct ds_append_buffer_piece *piece,
 	unsigned int space_left;
 
 	/* Check if input buffer can fully fit this piece */
-	space_left = sizeof(piece->data) - piece->datalen;
+	space_left = piece->size - piece->datalen;
 	if (len <= space_left) {
 		memmove(piece->data + piece->datalen, buf, len);
 		piece->datalen += len;
@@ -227,15 +775,15 @@ unsigned int ds_append_buffer_append(struct ds_append_buffer *abuf,
 
 	/* Buffer did not fit in to last buffer piece, create new pieces */
 	do {
-		last = malloc(sizeof(*last));
+		last = append_buffer_alloc_piece(abuf);
 		if (!last) {
 			/* out of memory! */
 			return total_copied;
 		}
 
-		/* Initialize piece and add to piece list */
-		last->datalen = 0;
+		/* Add new piece to piece list */
 		ds_xorlist_append_entry(&abuf->list, &last->entry);
+		append_buffer_index_add(abuf, last);
 
 		/* Copy new buffer data to new piece */
 		bytes_copied = copy_to_append_buffer_piece(last, inbuf, len);
@@ -269,8 +817,7 @@ unsigned int ds_append_buffer_copy(struct ds_append_buffer *abuf,
 	unsigned int piece_len, bytes_copied = 0;
 
 	/* Initialize iterator for offset jump */
-	ds_append_buffer_iterator_init(abuf, &iter);
-	ds_append_buffer_iterator_forward(&iter, offset);
+	ds_append_buffer_iterator_seek(abuf, &iter, offset);
 
 	/* offset is out of reach? */
 	if (ds_append_buffer_iterator_has_reached_end(&iter))
@@ -301,6 +848,47 @@ unsigned int ds_append_buffer_copy(struct ds_append_buffer *abuf,
 	return bytes_copied;
 }
 
+/**
+ * ds_append_buffer_get_spans - get contiguous memory segments covering range
+ *				of appendable buffer data
+ * @abuf: appendable buffer
+ * @offset: offset to @abuf where range starts
+ * @len: length of range
+ * @spans: array where segments are stored
+ * @max_spans: number of entries in @spans
+ *
+ * Returns number of segments stored to @spans.
+ */
+unsigned int ds_append_buffer_get_spans(struct ds_append_buffer *abuf,
+					unsigned int offset, unsigned int len,
+					struct ds_append_buffer_span *spans,
+					unsigned int max_spans)
+{
+	struct ds_append_buffer_iterator iter;
+	unsigned int span_len, num_spans = 0;
+	void *span;
+
+	/* Initialize iterator for offset jump */
+	ds_append_buffer_iterator_seek(abuf, &iter, offset);
+
+	while (len > 0 && num_spans < max_spans &&
+	       !ds_append_buffer_iterator_has_reached_end(&iter)) {
+		span = ds_append_buffer_iterator_span(&iter, &span_len);
+		if (span_len > len)
+			span_len = len;
+
+		spans[num_spans].data = span;
+		spans[num_spans].len = span_len;
+		num_spans++;
+
+		/* Proceed to next piece */
+		ds_append_buffer_iterator_forward(&iter, span_len);
+		len -= span_len;
+	}
+
+	return num_spans;
+}
+
 /**
  * ds_append_buffer_move_head - moves head of buffer forward and frees memory
  *                              left unused
@@ -310,53 +898,55 @@ unsigned int ds_append_buffer_copy(struct ds_append_buffer *abuf,
 bool ds_append_buffer_move_head(struct ds_append_buffer *abuf, unsigned int add)
 {
 	struct ds_xorlist_entry *prev;
-	struct ds_append_buffer_piece *piece, *prev_piece;
+	struct ds_append_buffer_piece *piece;
 	struct ds_append_buffer_iterator iter;
+	struct ds_xorlist_cursor cur;
+	unsigned int num_freed = 0;
 
 	/* Allow moving head at end of buffer */
 	if (add == abuf->length) {
-		ds_append_buffer_free(abuf);
+		append_buffer_clear(abuf);
 		return true;
 	} else if (add > abuf->length) {
 		/* In error case, clear buffer anyway but return false */
-		ds_append_buffer_free(abuf);
+		append_buffer_clear(abuf);
 		return false;
 	}
 
 	/* Initialize iterator and get new begining */
-	ds_append_buffer_iterator_init(abuf, &iter);
-	ds_append_buffer_iterator_forward(&iter, add);
+	ds_append_buffer_iterator_seek(abuf, &iter, add);
 
 	/*
 	 * Set this piece as first piece of appendable buffer by removing
          * previous pieces from linked list and freeing them.
 	 */
 	piece = iterator_to_piece(&iter);
-	prev = iter.pprev;
-	while (prev) {
-		prev_piece = entry_to_piece(prev);
-
-		/* remove list entry */
-		ds_xorlist_remove_entry(&abuf->list, prev, &piece->entry);
-
-		/* get next prev */
-		prev = ds_xorlist_next(&piece->entry, prev);
+	ds_xorlist_cursor_set(&cur, &abuf->list, &piece->entry, iter.pprev);
+	while ((prev = ds_xorlist_cursor_prev(&cur)) != NULL) {
+		/* remove list entry, cursor stays before piece */
+		ds_xorlist_cursor_remove(&cur);
 
 		/* free buffer piece */
-		free(prev_piece);
+		piece_free(entry_to_piece(prev));
+		num_freed++;
 	}
 
 	abuf->first_offset = iter.ppos;
 	abuf->length -= add;
 
+	if (abuf->index) {
+		abuf->index->first += num_freed;
+		abuf->index->num -= num_freed;
+		abuf->index->head += add;
+	}
+
 	/* Free buffer when reached end */
 	if (abuf->length == 0 && !ds_xorlist_empty(&abuf->list))
-		ds_append_buffer_free(abuf);
+		append_buffer_clear(abuf);
 
 	return true;
 }
 
-
 /**
  * ds_append_buffer_append_piece - append piece_buf at end of appendable buffer.
  * 				   NOTE: appendable buffer must not have
@@ -373,13 +963,14 @@ bool ds_append_buffer_append_piece(struct ds_append_buffer *abuf,
 				   void *piece_buf, unsigned int buflen)
 {
 	struct ds_append_buffer_piece *piece =
-		ds_container_of(piece_buf, struct ds_append_buffer_piece, data);
+		ds_container_of(piece_buf, struct ds_append_buffer_piece,
+				storage);
 	struct ds_xorlist_entry *lentry = ds_xorlist_last(&abuf->list);
 
 	if (lentry) {
 		struct ds_append_buffer_piece *last = entry_to_piece(lentry);
 		/* check that last entry does not have used bytes */
-		if (last->datalen < sizeof(last->data))
+		if (last->datalen < last->size)
 			return false;
 	}
 
@@ -387,11 +978,54 @@ bool ds_append_buffer_append_piece(struct ds_append_buffer *abuf,
 
 	/* add new piece and adjust buffer length */
 	ds_xorlist_append_entry(&abuf->list, &piece->entry);
+	append_buffer_index_add(abuf, piece);
 	abuf->length += buflen;
 
 	return true;
 }
 
+/**
+ * ds_append_buffer_append_external - append memory owned by caller at end of
+ *				      appendable buffer without copying
+ * @abuf: appendable buffer
+ * @data: data to append
+ * @len: length of @data
+ * @release: called when @abuf no longer references @data, can be NULL
+ * @opaque: passed to @release
+ */
+bool ds_append_buffer_append_external(struct ds_append_buffer *abuf,
+				      void *data, unsigned int len,
+				      ds_append_buffer_release_t release,
+				      void *opaque)
+{
+	struct ds_append_buffer_piece *piece;
+	struct ds_append_buffer_external *ext;
+
+	if (len == 0) {
+		if (release)
+			release(opaque, data, len);
+		return true;
+	}
+
+	piece = ds_malloc(sizeof(*piece) + sizeof(*ext));
+	if (!piece)
+		return false;
+
+	ext = (void *)piece->storage;
+	ext->release = release;
+	ext->opaque = opaque;
+	piece->data = data;
+	piece->size = len;
+	piece->datalen = len;
+
+	/* add new piece and adjust buffer length */
+	ds_xorlist_append_entry(&abuf->list, &piece->entry);
+	append_buffer_index_add(abuf, piece);
+	abuf->length += len;
+
+	return true;
+}
+
 /**
  * ds_append_buffer_new_piece - allocate new internal data buffer and return
  *                              pointer to it's data array.
@@ -401,12 +1035,11 @@ void *ds_append_buffer_new_piece(unsigned int *buflen)
 {
 	struct ds_append_buffer_piece *piece;
 
-	piece = malloc(sizeof(*piece));
+	piece = piece_alloc(DS_APPEND_BUFFER_MIN_PIECE_LEN);
 	if (!piece)
 		return NULL;
 
-	piece->datalen = 0;
-	*buflen = sizeof(piece->data);
+	*buflen = piece->size;
 
 	return piece->data;
 }
@@ -418,9 +1051,10 @@ void *ds_append_buffer_new_piece(unsigned int *buflen)
 void ds_append_buffer_free_piece(void *piece_buf)
 {
 	struct ds_append_buffer_piece *piece =
-		ds_container_of(piece_buf, struct ds_append_buffer_piece, data);
+		ds_container_of(piece_buf, struct ds_append_buffer_piece,
+				storage);
 
-	free(piece);
+	piece_free(piece);
 }
 
 /**
@@ -446,7 +1080,7 @@ void *ds_append_buffer_get_end_free(struct ds_append_buffer *abuf,
 	 * return free/unused part of last piece (or null if no free space
 	 * left)
 	 */
-	*freelen = sizeof(piece->data) - piece->datalen;
+	*freelen = piece->size - piece->datalen;
 	if (*freelen == 0)
 		return NULL;
 	return &piece->data[piece->datalen];
@@ -471,7 +1105,7 @@ bool ds_append_buffer_move_end(struct ds_append_buffer *abuf, unsigned int add)
 	piece = entry_to_piece(lentry);
 
 	/* moving more than is possible?! */
-	if (add > sizeof(piece->data) - piece->datalen)
+	if (add > piece->size - piece->datalen)
 		return false;
 
 	piece->datalen += add;
@@ -494,15 +1128,21 @@ void *ds_append_buffer_get_write_buffer(struct ds_append_buffer *abuf,
 
 	piece_buf = ds_append_buffer_get_end_free(abuf, buflen);
 	if (!piece_buf) {
+		struct ds_append_buffer_piece *piece;
+
 		/*
 		 * All memory used by append_buffer is fully utilized, allocate
 		 * new internal buffer structure.
 		 */
-		piece_buf = ds_append_buffer_new_piece(buflen);
-		if (!piece_buf) {
+		piece = append_buffer_alloc_piece(abuf);
+		if (!piece) {
 			/* out of mem */
+			*buflen = 0;
 			return NULL;
 		}
+
+		*buflen = piece->size;
+		piece_buf = piece->data;
 	}
 
 	return piece_buf;
@@ -526,7 +1166,7 @@ bool ds_append_buffer_finish_write_buffer(struct ds_append_buffer *abuf,
 		piece = entry_to_piece(lentry);
 		if ((unsigned long)write_buf >= (unsigned long)piece->data &&
 		    (unsigned long)write_buf <
-			(unsigned long)&piece->data[sizeof(piece->data)]) {
+			(unsigned long)&piece->data[piece->size]) {
 			/* finish by moving end pointer */
 			return ds_append_buffer_move_end(abuf, buflen);
 		}
@@ -546,6 +1186,7 @@ void ds_append_buffer_iterator_init(struct ds_append_buffer *abuf,
 	struct ds_append_buffer_piece *piece;
 
 	iter->pchar = NULL;
+	iter->ppiece = NULL;
 	iter->pprev = NULL;
 	iter->ppos = abuf->first_offset;
 	iter->pos = 0;
@@ -559,10 +1200,66 @@ void ds_append_buffer_iterator_init(struct ds_append_buffer *abuf,
 		return;
 
 	piece = entry_to_piece(first);
+	iter->ppiece = piece;
 	iter->pchar = piece->data + iter->ppos;
 	iter->pmax = piece->datalen;
 }
 
+/**
+ * ds_append_buffer_iterator_seek - initialize appendable buffer iterator at
+ *				    @offset
+ * @abuf: appendable buffer
+ * @iter: iterator structure
+ * @offset: offset to @abuf where iterator is positioned
+ */
+void ds_append_buffer_iterator_seek(struct ds_append_buffer *abuf,
+				    struct ds_append_buffer_iterator *iter,
+				    unsigned int offset)
+{
+	struct ds_append_buffer_index *index = abuf->index;
+	struct ds_append_buffer_index_entry *entries;
+	struct ds_append_buffer_piece *piece;
+	unsigned int base, target, lo, hi, mid;
+
+	/* Past end of buffer? */
+	if (offset >= abuf->length) {
+		ds_append_buffer_iterator_init(abuf, iter);
+		iter->pchar = NULL;
+		iter->ppos = 0;
+		iter->pos = abuf->length;
+		return;
+	}
+
+	/* Without index, walk piece list */
+	if (!index || index->num == 0) {
+		ds_append_buffer_iterator_init(abuf, iter);
+		ds_append_buffer_iterator_forward(iter, offset);
+		return;
+	}
+
+	/* Binary search last piece starting at or before @offset */
+	entries = &index->entries[index->first];
+	base = entries[0].start;
+	target = index->head + offset - base;
+	lo = 0;
+	hi = index->num - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (entries[mid].start - base <= target)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	piece = entries[lo].piece;
+	iter->pprev = lo > 0 ? &entries[lo - 1].piece->entry : NULL;
+	iter->ppos = target - (entries[lo].start - base);
+	iter->ppiece = piece;
+	iter->pchar = piece->data + iter->ppos;
+	iter->pmax = piece->datalen;
+	iter->pos = offset;
+}
+
 /**
  * __ds_append_buffer_iterator_forward - slow path for moving iterator forward
  *					 by @add bytes
@@ -605,8 +1302,11 @@ void __ds_append_buffer_iterator_forward(
 
 		iter->pprev = &piece->entry;
 		piece = entry_to_piece(next);
+		iter->ppiece = piece;
 		iter->pchar = piece->data;
 		iter->pmax = piece->datalen;
 		add -= steps_left;
-	} while (add > 0);
+
+		/* Empty trailing piece is stepped over even when @add is zero */
+	} while (true);
 }
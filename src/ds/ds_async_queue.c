@@ -23,213 +23,552 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "ds.h"
 
+/* Default capacity of queue allocated with ds_async_queue_alloc() */
 #define ASYNC_QUEUE_MAX_SIZE (128)
 
+/* Number of message copies prepared at once by batch push */
+#define ASYNC_QUEUE_COPY_BATCH 16
+
+/* Keep producer and consumer owned positions on separate cache lines */
+#define ASYNC_QUEUE_CACHELINE_SIZE 64
+
+/* Adaptive spin is at least this long, nanoseconds */
+#define ASYNC_QUEUE_MIN_SPIN_NS 500
+
+/* Polls of ring between clock reads while spinning */
+#define ASYNC_QUEUE_SPIN_POLLS 32
+
 #ifndef DEBUG
 	#define DISABLE_RUNTIME_TESTS
 #endif
 
 #define ds_assert(x)
 
-struct ds_message {
+/*
+ * Bounded multi-producer/multi-consumer ring (Dmitry Vyukov's design). Each
+ * cell has sequence number telling whether it is free or holds message for
+ * current lap of ring. Producers and consumers claim positions with single
+ * compare-and-swap, a range of positions when doing batch operations.
+ */
+struct ds_message_cell {
+	unsigned long seq;
 	void *data;
 	size_t data_length;
 };
 
 struct ds_async_queue {
-	struct ds_linked_list message_list;
+	/* Claimed by producers */
+	unsigned long enqueue_pos;
+	unsigned char __pad0[ASYNC_QUEUE_CACHELINE_SIZE];
+
+	/* Claimed by consumers */
+	unsigned long dequeue_pos;
+	unsigned char __pad1[ASYNC_QUEUE_CACHELINE_SIZE];
+
+	/* Read-only after allocation */
+	unsigned long mask;
+	struct ds_message_cell *cells;
 
-	pthread_mutex_t mutex;
-	pthread_cond_t cond_wait_msg;
-	pthread_cond_t cond_wait_free;
+	struct ds_event *not_empty;
+	struct ds_event *not_full;
+
+	/* Waiting strategy, spin_est is updated by spinning threads */
+	unsigned int wait_mode;
+	unsigned int max_spin_ns;
+	unsigned int spin_est_ns;
 };
 
 static void ds_async_queue_runtime_tests(struct ds_async_queue *queue);
 
 /**
- * ds_alloc_message_list_entry - allocate message structure of requested size
+ * ds_alloc_message - allocate and fill message data
+ * @msg: message data to copy
  * @msglen: size of message data
  *
- * Allocates memory in such way that memory can be freed by using
- * pointer to message data. Simplifies handling data for ds_async_pop_*
- * caller as they can use regular free() for returned pointer.
- * Also avoids doing triple malloc for ds_list_entry + message + data.
- *
- * Memory structure will be:
- *  [message data (len: msglen + alignment)][struct ds_list_entry][struct ds_message]
+ * Message data is allocated with ds_async_queue_msg_alloc() so that
+ * ds_async_pop_* caller can use ds_async_queue_msg_free() for returned pointer.
  */
-static struct ds_list_entry *ds_alloc_message_list_entry(size_t msglen)
+static void *ds_alloc_message(const void *msg, size_t msglen)
 {
-	struct ds_list_entry *entry;
-	size_t orig_len = msglen;
-	unsigned char *mem;
-	struct ds_message *message;
+	void *data;
 
-	/* Alloc message structure so that it can be passed by
-	 * ds_async_queue_pop as regular malloced pointer.
-	 */
+	data = ds_async_queue_msg_alloc(msglen);
+	if (!data)
+		return NULL;
 
-	/* align length to long word size */
-	if (msglen % sizeof(long) != 0)
-		msglen = (msglen / sizeof(long) + 1) * sizeof(long);
+	memcpy(data, msg, msglen);
 
-	/* TODO: hard_malloc, tries to free resources, sleeps, etc on ENOMEM */
-	mem = malloc(msglen + ds_sizeof_list_entry(struct ds_message));
-	if (!mem)
+	return data;
+}
+
+struct ds_async_queue *ds_async_queue_alloc_sized(unsigned int capacity)
+{
+	struct ds_async_queue *queue;
+	unsigned long i, size;
+
+	if (capacity == 0 || capacity > (1U << 31))
 		return NULL;
 
-	entry = (void *)&mem[msglen];
-	message = ds_list_entry_data_ptr(struct ds_message, entry);
-	message->data_length = orig_len;
-	message->data = mem;
+	/* round capacity up to power of two, for masking positions */
+	for (size = 1; size < capacity; size <<= 1)
+		;
 
-	return entry;
+	queue = ds_malloc(sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	memset(queue, 0, sizeof(*queue));
+
+	queue->mask = size - 1;
+	queue->cells = ds_malloc(size * sizeof(queue->cells[0]));
+	queue->not_empty = ds_event_alloc();
+	queue->not_full = ds_event_alloc();
+	if (!queue->cells || !queue->not_empty || !queue->not_full) {
+		ds_event_free(queue->not_full);
+		ds_event_free(queue->not_empty);
+		ds_free(queue->cells);
+		ds_free(queue);
+		return NULL;
+	}
+
+	/* all cells free for first lap */
+	for (i = 0; i < size; i++)
+		queue->cells[i].seq = i;
+
+	ds_async_queue_runtime_tests(queue);
+
+	return queue;
 }
 
-static void ds_free_message(struct ds_message *msg)
+struct ds_async_queue *ds_async_queue_alloc(void)
 {
-	free(msg->data);
+	return ds_async_queue_alloc_sized(ASYNC_QUEUE_MAX_SIZE);
 }
 
-struct ds_async_queue *ds_async_queue_alloc(void)
+/**
+ * queue_claim - claim range of positions from ring
+ * @queue: queue
+ * @pos: enqueue_pos or dequeue_pos of queue
+ * @lap: 0 for claiming free cells, 1 for claiming cells with message
+ * @max: maximum number of positions to claim
+ * @first: first claimed position is stored here
+ *
+ * Returns number of positions claimed, zero if ring is full/empty.
+ */
+static unsigned int queue_claim(struct ds_async_queue *queue,
+				unsigned long *pos, unsigned long lap,
+				unsigned int max, unsigned long *first)
 {
-	struct ds_async_queue *queue;
-	int ret;
+	struct ds_message_cell *cell;
+	unsigned long start, seq;
+	unsigned int num;
+	long dif = 0;
+
+	if (max == 0)
+		return 0;
+
+	start = __atomic_load_n(pos, __ATOMIC_RELAXED);
+
+	while (true) {
+		/* count cells ready for this lap */
+		for (num = 0; num < max; num++) {
+			cell = &queue->cells[(start + num) & queue->mask];
+			seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+			dif = (long)(seq - (start + num + lap));
+			if (dif != 0)
+				break;
+		}
 
-	queue = malloc(sizeof(*queue));
-	if (!queue)
-		return NULL;
+		if (num == 0) {
+			/* position moved by others, retry */
+			if (dif > 0) {
+				start = __atomic_load_n(pos, __ATOMIC_RELAXED);
+				continue;
+			}
 
-	memset(queue, 0, sizeof(*queue));
+			/* full/empty */
+			return 0;
+		}
 
-	ds_list_init(&queue->message_list);
+		if (__atomic_compare_exchange_n(pos, &start, start + num, true,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			break;
 
-	ret = pthread_mutex_init(&queue->mutex, NULL);
-	if (ret) {
-		free(queue);
-		return NULL;
+		/* start was updated by failed compare-and-swap */
 	}
 
-	ret = pthread_cond_init(&queue->cond_wait_msg, NULL);
-	if (ret) {
-		pthread_mutex_destroy(&queue->mutex);
-		free(queue);
-		return NULL;
+	*first = start;
+	return num;
+}
+
+/**
+ * queue_enqueue - push range of messages to ring, without blocking
+ * @queue: queue
+ * @msgs: messages, ownership of message data is passed to queue
+ * @num: number of messages
+ *
+ * Returns number of messages pushed.
+ */
+static unsigned int queue_enqueue(struct ds_async_queue *queue,
+				  const struct ds_async_queue_msg *msgs,
+				  unsigned int num)
+{
+	struct ds_message_cell *cell;
+	unsigned long first, i;
+	unsigned int claimed;
+
+	claimed = queue_claim(queue, &queue->enqueue_pos, 0, num, &first);
+
+	for (i = 0; i < claimed; i++) {
+		cell = &queue->cells[(first + i) & queue->mask];
+
+		cell->data = msgs[i].msg;
+		cell->data_length = msgs[i].msglen;
+
+		/* publish message */
+		__atomic_store_n(&cell->seq, first + i + 1, __ATOMIC_RELEASE);
 	}
 
-	ret = pthread_cond_init(&queue->cond_wait_free, NULL);
-	if (ret) {
-		pthread_cond_destroy(&queue->cond_wait_msg);
-		pthread_mutex_destroy(&queue->mutex);
-		free(queue);
-		return NULL;
+	return claimed;
+}
+
+/**
+ * queue_dequeue - pop range of messages from ring, without blocking
+ * @queue: queue
+ * @msgs: message array to fill
+ * @num: maximum number of messages
+ *
+ * Returns number of messages popped.
+ */
+static unsigned int queue_dequeue(struct ds_async_queue *queue,
+				  struct ds_async_queue_msg *msgs,
+				  unsigned int num)
+{
+	struct ds_message_cell *cell;
+	unsigned long first, i;
+	unsigned int claimed;
+
+	claimed = queue_claim(queue, &queue->dequeue_pos, 1, num, &first);
+
+	for (i = 0; i < claimed; i++) {
+		cell = &queue->cells[(first + i) & queue->mask];
+
+		msgs[i].msg = cell->data;
+		msgs[i].msglen = cell->data_length;
+
+		/* release cell for next lap */
+		__atomic_store_n(&cell->seq, first + i + queue->mask + 1,
+				 __ATOMIC_RELEASE);
 	}
 
-	ds_async_queue_runtime_tests(queue);
+	return claimed;
+}
 
-	return queue;
+void ds_async_queue_set_wait_mode(struct ds_async_queue *queue,
+				  enum ds_async_queue_wait_mode mode,
+				  unsigned int max_spin_ns)
+{
+	if (max_spin_ns == 0)
+		max_spin_ns = DS_ASYNC_QUEUE_DEFAULT_SPIN_NS;
+
+	/* spinning on single CPU only delays thread we are waiting for */
+	if (mode == DS_ASYNC_QUEUE_WAIT_ADAPTIVE &&
+	    sysconf(_SC_NPROCESSORS_ONLN) == 1)
+		mode = DS_ASYNC_QUEUE_WAIT_PARK;
+
+	__atomic_store_n(&queue->max_spin_ns, max_spin_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->spin_est_ns, max_spin_ns / 2,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->wait_mode, mode, __ATOMIC_RELAXED);
 }
 
-void ds_async_queue_free(struct ds_async_queue *queue)
+static inline void queue_cpu_relax(void)
 {
-	pthread_mutex_lock(&queue->mutex);
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
 
-	ds_list_purge(&queue->message_list, (void(*)(void *))ds_free_message);
+static unsigned long long queue_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool queue_has_message(struct ds_async_queue *queue)
+{
+	return !ds_async_queue_empty(queue);
+}
 
-	pthread_mutex_unlock(&queue->mutex);
+static bool queue_has_room(struct ds_async_queue *queue)
+{
+	unsigned long pos;
 
-	pthread_cond_destroy(&queue->cond_wait_free);
-	pthread_cond_destroy(&queue->cond_wait_msg);
-	pthread_mutex_destroy(&queue->mutex);
+	pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
 
-	free(queue);
+	return __atomic_load_n(&queue->cells[pos & queue->mask].seq,
+			       __ATOMIC_ACQUIRE) == pos;
 }
 
-bool ds_async_queue_empty(struct ds_async_queue *queue)
+/**
+ * queue_spin - poll queue before parking, by waiting strategy of queue
+ * @queue: queue
+ * @ready: wait condition
+ * @abstime: absolute time of timeout of caller
+ *
+ * Returns true if @ready became true while spinning.
+ */
+static bool queue_spin(struct ds_async_queue *queue,
+		       bool (*ready)(struct ds_async_queue *queue),
+		       const struct ds_timespec *abstime)
 {
-	bool empty;
+	unsigned int mode, limit, est, polls;
+	unsigned long long start, elapsed;
+	bool found = false;
+
+	mode = __atomic_load_n(&queue->wait_mode, __ATOMIC_RELAXED);
+	if (mode == DS_ASYNC_QUEUE_WAIT_PARK)
+		return false;
+
+	/* try-operations do not wait at all */
+	if (abstime && abstime->tv_sec == 0 && abstime->tv_nsec == 0)
+		return false;
+
+	limit = __atomic_load_n(&queue->max_spin_ns, __ATOMIC_RELAXED);
+	est = __atomic_load_n(&queue->spin_est_ns, __ATOMIC_RELAXED);
+	if (mode == DS_ASYNC_QUEUE_WAIT_ADAPTIVE &&
+	    limit > 2 * est + ASYNC_QUEUE_MIN_SPIN_NS)
+		limit = 2 * est + ASYNC_QUEUE_MIN_SPIN_NS;
+
+	start = queue_now_ns();
+	elapsed = 0;
+
+	while (elapsed < limit) {
+		for (polls = 0; polls < ASYNC_QUEUE_SPIN_POLLS; polls++) {
+			if (ready(queue)) {
+				found = true;
+				break;
+			}
+			queue_cpu_relax();
+		}
 
-	pthread_mutex_lock(&queue->mutex);
-	empty = ds_list_empty(&queue->message_list);
-	pthread_mutex_unlock(&queue->mutex);
+		elapsed = queue_now_ns() - start;
+		if (found)
+			break;
+	}
 
-	return empty;
+	if (mode == DS_ASYNC_QUEUE_WAIT_ADAPTIVE) {
+		/* moving average of successful spins, decay on failure */
+		if (found)
+			est += ((long long)elapsed - (long long)est) / 8;
+		else
+			est -= est / 8;
+		__atomic_store_n(&queue->spin_est_ns, est, __ATOMIC_RELAXED);
+	}
+
+	return found;
 }
 
-static int pthread_cond_xwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
-			      const struct ds_timespec *abstime)
+void ds_async_queue_free(struct ds_async_queue *queue)
 {
-	struct timespec ts;
+	struct ds_async_queue_msg msg;
+
+	while (queue_dequeue(queue, &msg, 1) == 1)
+		ds_async_queue_msg_free(msg.msg);
+
+	ds_event_free(queue->not_full);
+	ds_event_free(queue->not_empty);
+	ds_free(queue->cells);
+	ds_free(queue);
+}
 
-	if (!abstime)
-		return pthread_cond_wait(cond, mutex);
+bool ds_async_queue_empty(struct ds_async_queue *queue)
+{
+	unsigned long pos;
 
-	if (abstime->tv_sec == 0 && abstime->tv_nsec == 0)
-		return ETIMEDOUT;
+	pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_ACQUIRE);
 
-	ts.tv_sec = abstime->tv_sec;
-	ts.tv_nsec = abstime->tv_nsec;
-	return pthread_cond_timedwait(cond, mutex, &ts);
+	return __atomic_load_n(&queue->cells[pos & queue->mask].seq,
+			       __ATOMIC_ACQUIRE) != pos + 1;
 }
 
-int ds_async_queue_push_timed(struct ds_async_queue *queue, void *msg,
-			      size_t msglen, const struct ds_timespec *abstime)
+/**
+ * queue_push_batch - push messages to queue, blocking when full
+ * @queue: queue
+ * @msgs: messages, ownership of message data is passed to queue
+ * @num: number of messages
+ * @abstime: absolute time of timeout
+ *
+ * Returns number of messages pushed, or -ETIMEDOUT if timeout was reached
+ * before any message was pushed.
+ */
+static int queue_push_batch(struct ds_async_queue *queue,
+			    const struct ds_async_queue_msg *msgs,
+			    unsigned int num, const struct ds_timespec *abstime)
 {
-	struct ds_list_entry *entry;
-	size_t count;
+	unsigned int pushed = 0, n;
+	unsigned int key;
 	int ret;
 
-	pthread_mutex_lock(&queue->mutex);
+	while (pushed < num) {
+		n = queue_enqueue(queue, msgs + pushed, num - pushed);
+		if (n == 0 && queue_spin(queue, queue_has_room, abstime))
+			continue;
+		if (n == 0) {
+			/* full, park until poppers free cells */
+			key = ds_event_prepare_wait(queue->not_full);
+
+			n = queue_enqueue(queue, msgs + pushed, num - pushed);
+			if (n == 0) {
+				ret = ds_event_wait(queue->not_full, key,
+						    abstime);
+				if (ret)
+					return pushed ? pushed : ret;
+				continue;
+			}
+
+			ds_event_cancel_wait(queue->not_full);
+		}
 
-	/* check if size of message queue has grown too big */
-	while ((count = ds_list_size(&queue->message_list)) >=
-			ASYNC_QUEUE_MAX_SIZE) {
-		ret = pthread_cond_xwait(&queue->cond_wait_free, &queue->mutex,
-					 abstime);
+		pushed += n;
 
-		if (ret == ETIMEDOUT) {
-			pthread_mutex_unlock(&queue->mutex);
-			return -ETIMEDOUT;
-		}
+		/* wake as many poppers as there are new messages */
+		ds_event_signal_many(queue->not_empty, n);
 	}
 
-	/* alloc and copy message */
-	entry = ds_alloc_message_list_entry(msglen);
-	/*
-	 * TODO: hard_malloc, tries to free resources, sleeps and retries
-	 * after ENOMEM
-	 */
-	if (!entry)
-		return -ENOMEM;
-
-	memmove(ds_list_entry_data_ptr(struct ds_message, entry)->data, msg,
-		msglen);
-
-	/* add new message to the list */
-	ds_list_append_entry(&queue->message_list, entry);
-
-	if (count == 0) {
-		/* Signal about new message in the list.
-		 *
-		 * Note: we don't need to signal if list was not empty, as
-		 * non-empty list means that none was currently waiting for
-		 * messages.
+	return pushed;
+}
+
+/**
+ * queue_push_copies - push copies of messages to queue, blocking when full
+ * @queue: queue
+ * @msgs: messages, caller retains ownership of message data
+ * @num: number of messages
+ * @abstime: absolute time of timeout
+ *
+ * Returns number of messages pushed, or -ETIMEDOUT/-ENOMEM if no message was
+ * pushed.
+ */
+static int queue_push_copies(struct ds_async_queue *queue,
+			     const struct ds_async_queue_msg *msgs,
+			     unsigned int num, const struct ds_timespec *abstime)
+{
+	struct ds_async_queue_msg copies[ASYNC_QUEUE_COPY_BATCH];
+	unsigned int pushed = 0, i, n;
+	int ret;
+
+	while (pushed < num) {
+		/* copy next chunk of messages */
+		n = num - pushed;
+		if (n > ASYNC_QUEUE_COPY_BATCH)
+			n = ASYNC_QUEUE_COPY_BATCH;
+
+		for (i = 0; i < n; i++) {
+			copies[i].msg = ds_alloc_message(msgs[pushed + i].msg,
+						msgs[pushed + i].msglen);
+			if (!copies[i].msg)
+				break;
+			copies[i].msglen = msgs[pushed + i].msglen;
+		}
+
+		/*
+		 * TODO: hard_malloc, tries to free resources, sleeps and
+		 * retries after ENOMEM
 		 */
-		pthread_cond_broadcast(&queue->cond_wait_msg);
+		n = i;
+		if (n == 0)
+			return pushed ? pushed : -ENOMEM;
+
+		ret = queue_push_batch(queue, copies, n, abstime);
+		if (ret < 0)
+			ret = 0;
+
+		/* free copies that did not fit before timeout */
+		for (i = ret; i < n; i++)
+			ds_free(copies[i].msg);
+
+		pushed += ret;
+		if (ret < n)
+			return pushed ? pushed : -ETIMEDOUT;
 	}
 
-	pthread_mutex_unlock(&queue->mutex);
+	return pushed;
+}
 
-	return 0;
+/**
+ * queue_pop_batch - pop messages from queue, blocking when empty
+ * @queue: queue
+ * @msgs: message array to fill
+ * @num: maximum number of messages
+ * @abstime: absolute time of timeout
+ */
+static int queue_pop_batch(struct ds_async_queue *queue,
+			   struct ds_async_queue_msg *msgs, unsigned int num,
+			   const struct ds_timespec *abstime)
+{
+	unsigned int popped, key;
+	int ret;
+
+	if (num == 0)
+		return 0;
+
+	while (true) {
+		popped = queue_dequeue(queue, msgs, num);
+		if (popped > 0)
+			break;
+
+		if (queue_spin(queue, queue_has_message, abstime))
+			continue;
+
+		/* empty, park until pushers add messages */
+		key = ds_event_prepare_wait(queue->not_empty);
+
+		popped = queue_dequeue(queue, msgs, num);
+		if (popped > 0) {
+			ds_event_cancel_wait(queue->not_empty);
+			break;
+		}
+
+		ret = ds_event_wait(queue->not_empty, key, abstime);
+		if (ret)
+			return ret;
+	}
+
+	/* wake as many pushers as there are free cells */
+	ds_event_signal_many(queue->not_full, popped);
+
+	return popped;
+}
+
+int ds_async_queue_push_timed(struct ds_async_queue *queue, void *msg,
+			      size_t msglen, const struct ds_timespec *abstime)
+{
+	struct ds_async_queue_msg qmsg;
+	int ret;
+
+	qmsg.msg = msg;
+	qmsg.msglen = msglen;
+
+	ret = queue_push_copies(queue, &qmsg, 1, abstime);
+
+	return ret < 0 ? ret : 0;
 }
 
 int ds_async_queue_try_push(struct ds_async_queue *queue, void *msg,
@@ -239,44 +578,72 @@ int ds_async_queue_try_push(struct ds_async_queue *queue, void *msg,
 	return ds_async_queue_push_timed(queue, msg, msglen, &no_timeout);
 }
 
-int ds_async_queue_pop_timed(struct ds_async_queue *queue, void **msg,
-			     size_t *msglen, const struct ds_timespec *abstime)
+int ds_async_queue_push_batch_timed(struct ds_async_queue *queue,
+				    const struct ds_async_queue_msg *msgs,
+				    unsigned int num,
+				    const struct ds_timespec *abstime)
+{
+	return queue_push_copies(queue, msgs, num, abstime);
+}
+
+void *ds_async_queue_msg_alloc(size_t msglen)
 {
-	struct ds_list_entry *entry;
-	struct ds_message *message;
+	/* TODO: hard_malloc, tries to free resources, sleeps, etc on ENOMEM */
+	return ds_malloc(msglen ? msglen : 1);
+}
+
+void ds_async_queue_msg_free(void *msg)
+{
+	ds_free(msg);
+}
+
+int ds_async_queue_push_msg_timed(struct ds_async_queue *queue, void *msg,
+				  size_t msglen,
+				  const struct ds_timespec *abstime)
+{
+	struct ds_async_queue_msg qmsg;
 	int ret;
 
-	*msg = NULL;
-	if (msglen)
-		*msglen = 0;
+	qmsg.msg = msg;
+	qmsg.msglen = msglen;
 
-	pthread_mutex_lock(&queue->mutex);
+	ret = queue_push_batch(queue, &qmsg, 1, abstime);
 
-	while (ds_list_empty(&queue->message_list)) {
-		ret = pthread_cond_xwait(&queue->cond_wait_msg, &queue->mutex,
-					 abstime);
+	return ret < 0 ? ret : 0;
+}
 
-		if (ret == ETIMEDOUT) {
-			pthread_mutex_unlock(&queue->mutex);
-			return -ETIMEDOUT;
-		}
-	}
+int ds_async_queue_try_push_msg(struct ds_async_queue *queue, void *msg,
+				size_t msglen)
+{
+	struct ds_timespec no_timeout = {0, 0};
+	return ds_async_queue_push_msg_timed(queue, msg, msglen, &no_timeout);
+}
 
-	entry = ds_list_first(&queue->message_list);
-	message = ds_list_entry_data_ptr(struct ds_message, entry);
+int ds_async_queue_push_msg_batch_timed(struct ds_async_queue *queue,
+					const struct ds_async_queue_msg *msgs,
+					unsigned int num,
+					const struct ds_timespec *abstime)
+{
+	return queue_push_batch(queue, msgs, num, abstime);
+}
 
-	*msg = message->data;
-	if (msglen)
-		*msglen = message->data_length;
+int ds_async_queue_pop_timed(struct ds_async_queue *queue, void **msg,
+			     size_t *msglen, const struct ds_timespec *abstime)
+{
+	struct ds_async_queue_msg qmsg;
+	int ret;
 
-	ds_list_remove_entry(&queue->message_list, entry);
+	*msg = NULL;
+	if (msglen)
+		*msglen = 0;
 
-	if (ds_list_size(&queue->message_list) == ASYNC_QUEUE_MAX_SIZE - 1) {
-		/* Signal about list being small enough for new messages. */
-		pthread_cond_broadcast(&queue->cond_wait_free);
-	}
+	ret = queue_pop_batch(queue, &qmsg, 1, abstime);
+	if (ret < 0)
+		return ret;
 
-	pthread_mutex_unlock(&queue->mutex);
+	*msg = qmsg.msg;
+	if (msglen)
+		*msglen = qmsg.msglen;
 
 	return 0;
 }
@@ -288,12 +655,18 @@ int ds_async_queue_try_pop(struct ds_async_queue *queue, void **msg,
 	return ds_async_queue_pop_timed(queue, msg, msglen, &no_timeout);
 }
 
+int ds_async_queue_pop_batch_timed(struct ds_async_queue *queue,
+				   struct ds_async_queue_msg *msgs,
+				   unsigned int num,
+				   const struct ds_timespec *abstime)
+{
+	return queue_pop_batch(queue, msgs, num, abstime);
+}
+
 #ifndef DISABLE_RUNTIME_TESTS
 static void ds_async_queue_runtime_tests(struct ds_async_queue *queue)
 {
-	struct ds_list_entry *entry;
 	static bool tests_done = false;
-	struct ds_message *message;
 	char buf[11];
 	char *popbuf;
 	size_t popbuflen;
@@ -304,20 +677,9 @@ static void ds_async_queue_runtime_tests(struct ds_async_queue *queue)
 	tests_done = true;
 
 	/* Test alloc/free message */
-	entry = ds_alloc_message_list_entry(31);
-	message = ds_list_entry_data_ptr(struct ds_message, entry);
-	memset(message->data, 0xCC, 31);
-	free(message->data);
-
-	entry = ds_alloc_message_list_entry(32);
-	message = ds_list_entry_data_ptr(struct ds_message, entry);
-	memset(message->data, 0xCC, 32);
-	free(message->data);
-
-	entry = ds_alloc_message_list_entry(33);
-	message = ds_list_entry_data_ptr(struct ds_message, entry);
-	memset(message->data, 0xCC, 33);
-	free(message->data);
+	memset(buf, 0xCC, sizeof(buf));
+	ds_free(ds_alloc_message(buf, 0));
+	ds_free(ds_alloc_message(buf, sizeof(buf)));
 
 	/* Test pushing and poping queue */
 	memset(buf, 0x55, sizeof(buf));
@@ -325,23 +687,20 @@ static void ds_async_queue_runtime_tests(struct ds_async_queue *queue)
 	ds_async_queue_push(queue, buf, sizeof(buf));
 	ds_async_queue_pop(queue, (void*)&popbuf, &popbuflen);
 
-	free(popbuf);
+	ds_free(popbuf);
 
 	/* Test pushing 10 entries to queue and poping theim */
-	m = ASYNC_QUEUE_MAX_SIZE < 10 ? ASYNC_QUEUE_MAX_SIZE : 10;
+	m = queue->mask + 1 < 10 ? queue->mask + 1 : 10;
 	for (i = 0; i < m; i++) {
 		ds_async_queue_push(queue, buf, 1 + i);
 	}
 
-	ds_assert(ds_list_size(&queue->message_list) ==
-		(ASYNC_QUEUE_MAX_SIZE < 10 ? ASYNC_QUEUE_MAX_SIZE : 10));
-
 	for (i = 0; i < m; i++) {
 		ds_async_queue_pop(queue, (void*)&popbuf, &popbuflen);
 
 		ds_assert(popbuflen == 1 + i);
 
-		free(popbuf);
+		ds_free(popbuf);
 	}
 }
 #else
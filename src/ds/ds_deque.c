@@ -0,0 +1,111 @@
+/*
+ * Double-ended queue on growable circular array
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "ds.h"
+
+static unsigned int deque_round_capacity(unsigned int num)
+{
+	unsigned int capacity;
+
+	/* round up to power of two, for masking indexes */
+	for (capacity = DS_DEQUE_MIN_CAPACITY; capacity < num; capacity <<= 1)
+		;
+
+	return capacity;
+}
+
+bool ds_deque_init(struct ds_deque *dq, size_t elem_size,
+		   unsigned int capacity)
+{
+	memset(dq, 0, sizeof(*dq));
+
+	if (elem_size == 0 || capacity > DS_DEQUE_MAX_CAPACITY)
+		return false;
+
+	dq->elem_size = elem_size;
+	dq->capacity = deque_round_capacity(capacity);
+	dq->mask = dq->capacity - 1;
+
+	if ((size_t)-1 / elem_size < dq->capacity)
+		return false;
+
+	dq->elems = ds_malloc((size_t)dq->capacity * elem_size);
+	if (!dq->elems)
+		return false;
+
+	return true;
+}
+
+void ds_deque_free(struct ds_deque *dq)
+{
+	ds_free(dq->elems);
+	dq->elems = NULL;
+	dq->capacity = 0;
+	dq->mask = 0;
+	ds_deque_clear(dq);
+}
+
+bool ds_deque_reserve(struct ds_deque *dq, unsigned int num)
+{
+	unsigned int size = ds_deque_size(dq);
+	unsigned int capacity, first;
+	unsigned char *elems;
+
+	if (dq->capacity - size >= num)
+		return true;
+
+	if (num > DS_DEQUE_MAX_CAPACITY - size)
+		return false;
+
+	capacity = deque_round_capacity(size + num);
+	if ((size_t)-1 / dq->elem_size < capacity)
+		return false;
+
+	elems = ds_malloc((size_t)capacity * dq->elem_size);
+	if (!elems)
+		return false;
+
+	/* linearize elements to start of new array */
+	first = dq->capacity - (dq->head & dq->mask);
+	if (first > size)
+		first = size;
+	if (size > 0) {
+		memcpy(elems, ds_deque_at(dq, 0), (size_t)first * dq->elem_size);
+		memcpy(elems + (size_t)first * dq->elem_size, dq->elems,
+		       (size_t)(size - first) * dq->elem_size);
+	}
+	ds_free(dq->elems);
+
+	dq->elems = elems;
+	dq->capacity = capacity;
+	dq->mask = capacity - 1;
+	dq->head = 0;
+	dq->tail = size;
+
+	return true;
+}
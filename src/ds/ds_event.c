@@ -0,0 +1,288 @@
+/*
+ * Event count, for parking threads waiting on lock-free data structures.
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <time.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "ds.h"
+
+/*
+ * On Linux, waiters park with futex on sequence number of event. Define
+ * DS_EVENT_NO_FUTEX to use mutex and condition variable instead.
+ */
+#if defined(__linux__) && !defined(DS_EVENT_NO_FUTEX)
+	#define DS_EVENT_FUTEX
+	#include <unistd.h>
+	#include <sys/syscall.h>
+	#include <linux/futex.h>
+#endif
+
+/*
+ * Waiters register themselves before re-checking their wait condition, and
+ * notifiers check for registered waiters only after publishing their state
+ * change. With sequentially consistent ordering on both sides, either waiter
+ * sees the change or notifier sees the waiter. Notifiers without registered
+ * waiters do not enter kernel or touch the mutex at all.
+ */
+struct ds_event {
+	unsigned int seq;
+	unsigned int waiters;
+
+#ifndef DS_EVENT_FUTEX
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+#ifdef DS_EVENT_FUTEX
+struct ds_event *ds_event_alloc(void)
+{
+	struct ds_event *event;
+
+	event = ds_malloc(sizeof(*event));
+	if (!event)
+		return NULL;
+
+	memset(event, 0, sizeof(*event));
+
+	return event;
+}
+
+void ds_event_free(struct ds_event *event)
+{
+	ds_free(event);
+}
+#else
+struct ds_event *ds_event_alloc(void)
+{
+	struct ds_event *event;
+	int ret;
+
+	event = ds_malloc(sizeof(*event));
+	if (!event)
+		return NULL;
+
+	memset(event, 0, sizeof(*event));
+
+	ret = pthread_mutex_init(&event->mutex, NULL);
+	if (ret) {
+		ds_free(event);
+		return NULL;
+	}
+
+	ret = pthread_cond_init(&event->cond, NULL);
+	if (ret) {
+		pthread_mutex_destroy(&event->mutex);
+		ds_free(event);
+		return NULL;
+	}
+
+	return event;
+}
+
+void ds_event_free(struct ds_event *event)
+{
+	if (!event)
+		return;
+
+	pthread_cond_destroy(&event->cond);
+	pthread_mutex_destroy(&event->mutex);
+
+	ds_free(event);
+}
+#endif
+
+unsigned int ds_event_prepare_wait(struct ds_event *event)
+{
+	__atomic_add_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+
+	return __atomic_load_n(&event->seq, __ATOMIC_SEQ_CST);
+}
+
+void ds_event_cancel_wait(struct ds_event *event)
+{
+	__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifdef DS_EVENT_FUTEX
+static int futex_wait(unsigned int *addr, unsigned int val,
+		      const struct timespec *abstime)
+{
+	/* absolute timeout on realtime clock, as from ds_make_timeout_us() */
+	return syscall(SYS_futex, addr, abstime ?
+			FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME :
+			FUTEX_WAIT_PRIVATE, val, abstime, NULL,
+		       FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_wake(unsigned int *addr, unsigned int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE,
+		count > INT_MAX ? INT_MAX : (int)count, NULL, NULL, 0);
+}
+
+int ds_event_wait(struct ds_event *event, unsigned int key,
+		  const struct ds_timespec *abstime)
+{
+	struct timespec ts;
+	int ret = 0;
+
+	/* Zero timeout, do not park at all */
+	if (abstime && abstime->tv_sec == 0 && abstime->tv_nsec == 0) {
+		ds_event_cancel_wait(event);
+		return -ETIMEDOUT;
+	}
+
+	if (abstime) {
+		ts.tv_sec = abstime->tv_sec;
+		ts.tv_nsec = abstime->tv_nsec;
+	}
+
+	while (__atomic_load_n(&event->seq, __ATOMIC_SEQ_CST) == key) {
+		if (futex_wait(&event->seq, key, abstime ? &ts : NULL) == 0)
+			continue;
+
+		if (errno == ETIMEDOUT || errno == EINVAL) {
+			/* Event might still have been signaled just now */
+			if (__atomic_load_n(&event->seq, __ATOMIC_SEQ_CST) ==
+									key)
+				ret = -ETIMEDOUT;
+			break;
+		}
+
+		/* EAGAIN, seq changed before sleeping, or EINTR */
+	}
+
+	ds_event_cancel_wait(event);
+
+	return ret;
+}
+
+static void ds_event_notify(struct ds_event *event, unsigned int count)
+{
+	unsigned int waiters;
+
+	/* Order state change of caller before check for waiters */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	waiters = __atomic_load_n(&event->waiters, __ATOMIC_SEQ_CST);
+	if (__builtin_expect(waiters == 0, 1))
+		return;
+
+	__atomic_add_fetch(&event->seq, 1, __ATOMIC_SEQ_CST);
+
+	/* only as many waiters as asked are woken, others keep sleeping */
+	futex_wake(&event->seq, count);
+}
+#else
+int ds_event_wait(struct ds_event *event, unsigned int key,
+		  const struct ds_timespec *abstime)
+{
+	struct timespec ts;
+	int ret = 0;
+
+	/* Zero timeout, do not park at all */
+	if (abstime && abstime->tv_sec == 0 && abstime->tv_nsec == 0) {
+		ds_event_cancel_wait(event);
+		return -ETIMEDOUT;
+	}
+
+	if (abstime) {
+		ts.tv_sec = abstime->tv_sec;
+		ts.tv_nsec = abstime->tv_nsec;
+	}
+
+	pthread_mutex_lock(&event->mutex);
+
+	while (__atomic_load_n(&event->seq, __ATOMIC_SEQ_CST) == key) {
+		if (!abstime) {
+			pthread_cond_wait(&event->cond, &event->mutex);
+			continue;
+		}
+
+		ret = pthread_cond_timedwait(&event->cond, &event->mutex, &ts);
+		if (ret == ETIMEDOUT || ret == EINVAL) {
+			/* Event might still have been signaled just now */
+			if (__atomic_load_n(&event->seq, __ATOMIC_SEQ_CST) !=
+									key)
+				ret = 0;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&event->mutex);
+
+	ds_event_cancel_wait(event);
+
+	return ret ? -ETIMEDOUT : 0;
+}
+
+static void ds_event_notify(struct ds_event *event, unsigned int count)
+{
+	unsigned int waiters;
+
+	/* Order state change of caller before check for waiters */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	waiters = __atomic_load_n(&event->waiters, __ATOMIC_SEQ_CST);
+	if (__builtin_expect(waiters == 0, 1))
+		return;
+
+	pthread_mutex_lock(&event->mutex);
+
+	__atomic_add_fetch(&event->seq, 1, __ATOMIC_SEQ_CST);
+
+	if (count >= waiters) {
+		pthread_cond_broadcast(&event->cond);
+	} else {
+		while (count--)
+			pthread_cond_signal(&event->cond);
+	}
+
+	pthread_mutex_unlock(&event->mutex);
+}
+#endif
+
+void ds_event_signal(struct ds_event *event)
+{
+	ds_event_notify(event, 1);
+}
+
+void ds_event_signal_many(struct ds_event *event, unsigned int count)
+{
+	if (count > 0)
+		ds_event_notify(event, count);
+}
+
+void ds_event_broadcast(struct ds_event *event)
+{
+	ds_event_notify(event, ~0U);
+}
@@ -44,7 +44,7 @@
  */
 struct ds_list_entry *ds_list_entry_alloc(size_t datasize)
 {
-	return calloc(1, sizeof(struct ds_list_entry) + datasize);
+	return ds_calloc(1, sizeof(struct ds_list_entry) + datasize);
 }
 
 /**
@@ -93,11 +93,69 @@ void ds_list_prepend_entry(struct ds_linked_list *list,
 	}
 }
 
-static struct ds_list_entry *alloc_entry(void *data)
+/**
+ * ds_list_set_slab - allocate list entries from slab
+ * @list: empty linked list
+ * @slab: slab for entries, NULL for libds allocator
+ *
+ * Returns false if list is not empty or objects of @slab are too small.
+ */
+bool ds_list_set_slab(struct ds_linked_list *list, struct ds_slab *slab)
+{
+	if (!ds_list_empty(list))
+		return false;
+	if (slab && ds_slab_obj_size(slab) < DS_LIST_SLAB_OBJ_SIZE)
+		return false;
+
+	list->slab = slab;
+	return true;
+}
+
+/**
+ * __ds_list_new_entry - allocate list entry from slab or allocator of list
+ * @list: linked list
+ * @datasize: size of list entry buffer
+ */
+struct ds_list_entry *__ds_list_new_entry(struct ds_linked_list *list,
+					  size_t datasize)
+{
+	struct ds_list_entry *entry;
+
+	if (!list->slab)
+		return ds_list_entry_alloc(datasize);
+
+	if (sizeof(*entry) + datasize > ds_slab_obj_size(list->slab))
+		return NULL;
+
+	entry = ds_slab_obj_alloc(list->slab);
+	if (entry)
+		memset(entry, 0, sizeof(*entry) + datasize);
+
+	return entry;
+}
+
+/**
+ * __ds_list_free_entry - free entry allocated with __ds_list_new_entry()
+ * @list: linked list
+ * @entry: list entry, not on list
+ */
+void __ds_list_free_entry(struct ds_linked_list *list,
+			  struct ds_list_entry *entry)
+{
+	if (list->slab)
+		ds_slab_obj_free(list->slab, entry);
+	else
+		ds_free(entry);
+}
+
+static struct ds_list_entry *alloc_entry(struct ds_linked_list *list,
+					 void *data)
 {
 	struct ds_list_entry *entry;
 
-	ds_new_list_entry(entry, void *, data);
+	entry = __ds_list_new_entry(list, sizeof(void *));
+	if (entry)
+		ds_set_list_entry_data(entry, void *, data);
 
 	return entry;
 }
@@ -111,7 +169,7 @@ static struct ds_list_entry *alloc_entry(void *data)
  */
 bool ds_list_append(struct ds_linked_list *list, void *data)
 {
-	struct ds_list_entry *entry = alloc_entry(data);
+	struct ds_list_entry *entry = alloc_entry(list, data);
 
 	if (!entry)
 		return false;
@@ -129,7 +187,7 @@ bool ds_list_append(struct ds_linked_list *list, void *data)
  */
 bool ds_list_prepend(struct ds_linked_list *list, void *data)
 {
-	struct ds_list_entry *entry = alloc_entry(data);
+	struct ds_list_entry *entry = alloc_entry(list, data);
 
 	if (!entry)
 		return false;
@@ -211,7 +269,7 @@ void ds_list_delete_entry(struct ds_linked_list *list,
 	memset(entry, 0xCC, sizeof(*entry));
 #endif
 
-	free(entry);
+	__ds_list_free_entry(list, entry);
 }
 
 /**
@@ -250,8 +308,10 @@ void ds_list_purge(struct ds_linked_list *list,
 		if (data_free)
 			(*data_free)(ds_list_entry_data(void *, pos));
 
-		free(pos);
+		__ds_list_free_entry(list, pos);
 	}
 
-	ds_list_init(list);
+	list->head = NULL;
+	list->tail = NULL;
+	list->count = 0;
 }
@@ -79,7 +79,7 @@ void *ds_queue_pop_ptr(struct ds_queue *q)
 		return NULL;
 
 	data = ds_list_entry_data(void *, last);
-	free(last);
+	__ds_list_free_entry(&q->q, last);
 
 	return data;
 }
@@ -100,7 +100,7 @@ bool __ds_queue_pop_data(struct ds_queue *q, void *buf, size_t buflen)
 		return false;
 
 	memmove(buf, ds_list_entry_data_ptr(void, last), buflen);
-	free(last);
+	__ds_list_free_entry(&q->q, last);
 
 	return true;
 }
@@ -116,7 +116,7 @@ void ds_queue_free(struct ds_queue *q)
 	while (ds_queue_size(q) > 0) {
 		entry = ds_queue_pop_entry(q);
 		if (entry)
-			free(entry);
+			__ds_list_free_entry(&q->q, entry);
 	}
 }
 
@@ -0,0 +1,237 @@
+/*
+ * Fixed-capacity rings of samples with history window.
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "ds.h"
+
+static unsigned int sample_ring_round_capacity(unsigned int num)
+{
+	unsigned int capacity;
+
+	/* round up to power of two, for masking indexes */
+	for (capacity = DS_SAMPLE_RING_MIN_CAPACITY; capacity < num;
+	     capacity <<= 1)
+		;
+
+	return capacity;
+}
+
+/*
+ * Defines functions declared by DS_DECLARE_SAMPLE_RING(name, type), all
+ * sample types share this one implementation.
+ */
+#define DS_DEFINE_SAMPLE_RING(name, type) \
+static type *name##_alloc_values(unsigned int capacity) \
+{ \
+	return ds_aligned_alloc(DS_SAMPLE_RING_ALIGN, \
+				capacity * sizeof(type)); \
+} \
+ \
+/* Copy @num values starting at ring index @pos to linear buffer @out */ \
+static void name##_copy_out(const struct name *ring, unsigned int pos, \
+			    type *out, unsigned int num) \
+{ \
+	unsigned int offset = pos & ring->mask; \
+	unsigned int first = ring->capacity - offset; \
+ \
+	if (num == 0) \
+		return; \
+	if (first > num) \
+		first = num; \
+ \
+	memcpy(out, &ring->values[offset], first * sizeof(type)); \
+	memcpy(out + first, ring->values, (num - first) * sizeof(type)); \
+} \
+ \
+/* Spans of @num values starting at ring index @pos */ \
+static void name##_spans(const struct name *ring, unsigned int pos, \
+			 unsigned int num, struct name##_span spans[2]) \
+{ \
+	unsigned int offset = pos & ring->mask; \
+	unsigned int first = ring->capacity - offset; \
+ \
+	if (first > num) \
+		first = num; \
+ \
+	spans[0].values = &ring->values[offset]; \
+	spans[0].len = first; \
+	spans[1].values = ring->values; \
+	spans[1].len = num - first; \
+} \
+ \
+bool name##_init(struct name *ring, unsigned int capacity, \
+		 unsigned int history) \
+{ \
+	memset(ring, 0, sizeof(*ring)); \
+ \
+	if (capacity == 0 || capacity > DS_SAMPLE_RING_MAX_CAPACITY || \
+	    history > DS_SAMPLE_RING_MAX_CAPACITY - capacity) \
+		return false; \
+ \
+	ring->capacity = sample_ring_round_capacity(capacity + history); \
+	ring->mask = ring->capacity - 1; \
+	ring->history = history; \
+ \
+	ring->values = name##_alloc_values(ring->capacity); \
+	if (!ring->values) { \
+		memset(ring, 0, sizeof(*ring)); \
+		return false; \
+	} \
+ \
+	return true; \
+} \
+ \
+void name##_free(struct name *ring) \
+{ \
+	ds_aligned_free(ring->values); \
+	memset(ring, 0, sizeof(*ring)); \
+} \
+ \
+void name##_clear(struct name *ring) \
+{ \
+	ring->head = 0; \
+	ring->tail = 0; \
+	ring->history_len = 0; \
+} \
+ \
+bool name##_reserve(struct name *ring, unsigned int num) \
+{ \
+	unsigned int length = name##_length(ring); \
+	unsigned int kept = ring->history_len; \
+	unsigned int capacity; \
+	type *values; \
+ \
+	if (name##_space(ring) >= num) \
+		return true; \
+ \
+	if (num > DS_SAMPLE_RING_MAX_CAPACITY - ring->history - length) \
+		return false; \
+ \
+	capacity = sample_ring_round_capacity(ring->history + length + num); \
+	values = name##_alloc_values(capacity); \
+	if (!values) \
+		return false; \
+ \
+	/* linearize kept history and unread values to start of new ring */ \
+	name##_copy_out(ring, ring->head - kept, values, kept + length); \
+	ds_aligned_free(ring->values); \
+ \
+	ring->values = values; \
+	ring->capacity = capacity; \
+	ring->mask = capacity - 1; \
+	ring->head = kept; \
+	ring->tail = kept + length; \
+ \
+	return true; \
+} \
+ \
+type *name##_get_end_free(struct name *ring, unsigned int *num) \
+{ \
+	unsigned int offset = ring->tail & ring->mask; \
+	unsigned int space = name##_space(ring); \
+ \
+	*num = ring->capacity - offset; \
+	if (*num > space) \
+		*num = space; \
+ \
+	return &ring->values[offset]; \
+} \
+ \
+unsigned int name##_write(struct name *ring, const type *values, \
+			  unsigned int num) \
+{ \
+	unsigned int len, pos = 0; \
+	type *end; \
+ \
+	while (pos < num) { \
+		end = name##_get_end_free(ring, &len); \
+		if (len == 0) \
+			break; \
+		if (len > num - pos) \
+			len = num - pos; \
+ \
+		memcpy(end, values + pos, len * sizeof(type)); \
+		name##_move_end(ring, len); \
+		pos += len; \
+	} \
+ \
+	return pos; \
+} \
+ \
+unsigned int name##_peek(const struct name *ring, unsigned int num, \
+			 struct name##_span spans[2]) \
+{ \
+	unsigned int length = name##_length(ring); \
+ \
+	if (num > length) \
+		num = length; \
+ \
+	name##_spans(ring, ring->head, num, spans); \
+ \
+	return num; \
+} \
+ \
+void name##_move_head(struct name *ring, unsigned int num) \
+{ \
+	unsigned int length = name##_length(ring); \
+ \
+	if (num > length) \
+		num = length; \
+ \
+	ring->head += num; \
+ \
+	/* consumed values stay readable up to history window */ \
+	ring->history_len = ring->history - ring->history_len > num ? \
+				ring->history_len + num : ring->history; \
+} \
+ \
+unsigned int name##_read(struct name *ring, type *values, unsigned int num) \
+{ \
+	unsigned int length = name##_length(ring); \
+ \
+	if (num > length) \
+		num = length; \
+ \
+	name##_copy_out(ring, ring->head, values, num); \
+	name##_move_head(ring, num); \
+ \
+	return num; \
+} \
+ \
+unsigned int name##_get_history(const struct name *ring, unsigned int num, \
+				struct name##_span spans[2]) \
+{ \
+	if (num > ring->history_len) \
+		num = ring->history_len; \
+ \
+	name##_spans(ring, ring->head - num, num, spans); \
+ \
+	return num; \
+}
+
+DS_DEFINE_SAMPLE_RING(ds_float_ring, float)
+DS_DEFINE_SAMPLE_RING(ds_i16_ring, int16_t)
@@ -0,0 +1,375 @@
+/*
+ * Slab allocator for fixed size objects with per-thread magazines
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+
+#include "ds.h"
+
+/* Objects moved between magazine and shared free list at once */
+#define SLAB_MAGAZINE_BATCH (DS_SLAB_MAGAZINE_SIZE / 2)
+
+/* Free objects are linked through their first word */
+struct slab_free_obj {
+	struct slab_free_obj *next;
+};
+
+struct slab_chunk {
+	struct slab_chunk *next;
+};
+
+/*
+ * Per-thread cache of free objects. Only owner thread modifies @objs, @count
+ * is also read by ds_slab_get_stats().
+ */
+struct slab_magazine {
+	struct ds_list_entry entry;
+	struct ds_slab *slab;
+	unsigned int count;
+	void *objs[DS_SLAB_MAGAZINE_SIZE];
+};
+
+struct ds_slab {
+	pthread_mutex_t lock;
+	pthread_key_t key;
+
+	/* Read-only after allocation */
+	size_t obj_size;
+	size_t align;
+	size_t chunk_header;
+	size_t chunk_size;
+	unsigned int chunk_objs;
+
+	/* Protected by lock */
+	struct slab_chunk *chunks;
+	struct slab_free_obj *free_objs;
+	unsigned long num_chunks;
+	unsigned long num_free;
+	struct ds_linked_list magazines;
+};
+
+static size_t slab_round_up(size_t value, size_t align)
+{
+	return (value + align - 1) & ~(align - 1);
+}
+
+static inline unsigned int magazine_count(const struct slab_magazine *mag)
+{
+	return __atomic_load_n(&mag->count, __ATOMIC_RELAXED);
+}
+
+static inline void magazine_set_count(struct slab_magazine *mag,
+				      unsigned int count)
+{
+	__atomic_store_n(&mag->count, count, __ATOMIC_RELAXED);
+}
+
+static inline void slab_push_free(struct ds_slab *slab, void *obj)
+{
+	struct slab_free_obj *free_obj = obj;
+
+	free_obj->next = slab->free_objs;
+	slab->free_objs = free_obj;
+	slab->num_free++;
+}
+
+/* Carve objects of new chunk to free list, called with lock held */
+static bool slab_grow(struct ds_slab *slab)
+{
+	struct slab_chunk *chunk;
+	unsigned char *obj;
+	unsigned int i;
+
+	chunk = ds_aligned_alloc(slab->align, slab->chunk_size);
+	if (!chunk)
+		return false;
+
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->num_chunks++;
+
+	/* push backwards so that objects are handed out in address order */
+	obj = (unsigned char *)chunk + slab->chunk_header;
+	for (i = slab->chunk_objs; i > 0; i--)
+		slab_push_free(slab, obj + (i - 1) * slab->obj_size);
+
+	return true;
+}
+
+/* Take one object from free list, called with lock held */
+static void *slab_pop_free(struct ds_slab *slab)
+{
+	struct slab_free_obj *free_obj;
+
+	if (!slab->free_objs && !slab_grow(slab))
+		return NULL;
+
+	free_obj = slab->free_objs;
+	slab->free_objs = free_obj->next;
+	slab->num_free--;
+
+	return free_obj;
+}
+
+/* Thread exit, return cached objects to shared free list */
+static void slab_magazine_destroy(void *arg)
+{
+	struct slab_magazine *mag = arg;
+	struct ds_slab *slab = mag->slab;
+	unsigned int i;
+
+	pthread_mutex_lock(&slab->lock);
+	for (i = 0; i < mag->count; i++)
+		slab_push_free(slab, mag->objs[i]);
+	ds_list_remove_entry(&slab->magazines, &mag->entry);
+	pthread_mutex_unlock(&slab->lock);
+
+	ds_free(mag);
+}
+
+/* Magazine of calling thread, NULL if it cannot be allocated */
+static struct slab_magazine *slab_get_magazine(struct ds_slab *slab)
+{
+	struct slab_magazine *mag;
+
+	mag = pthread_getspecific(slab->key);
+	if (mag)
+		return mag;
+
+	mag = ds_malloc(sizeof(*mag));
+	if (!mag)
+		return NULL;
+
+	mag->slab = slab;
+	mag->count = 0;
+
+	if (pthread_setspecific(slab->key, mag) != 0) {
+		ds_free(mag);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&slab->lock);
+	ds_list_append_entry(&slab->magazines, &mag->entry);
+	pthread_mutex_unlock(&slab->lock);
+
+	return mag;
+}
+
+struct ds_slab *ds_slab_alloc(size_t obj_size, size_t align)
+{
+	struct ds_slab *slab;
+
+	if (align == 0)
+		align = sizeof(void *);
+	if (align & (align - 1))
+		return NULL;
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+
+	if (obj_size < sizeof(struct slab_free_obj))
+		obj_size = sizeof(struct slab_free_obj);
+
+	slab = ds_calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->obj_size = slab_round_up(obj_size, align);
+	slab->align = align;
+	slab->chunk_header = slab_round_up(sizeof(struct slab_chunk), align);
+
+	/* each chunk fills at least one magazine */
+	slab->chunk_objs = (DS_SLAB_CHUNK_BYTES - slab->chunk_header) /
+			   slab->obj_size;
+	if (slab->chunk_objs < DS_SLAB_MAGAZINE_SIZE)
+		slab->chunk_objs = DS_SLAB_MAGAZINE_SIZE;
+	slab->chunk_size = slab->chunk_header +
+			   slab->chunk_objs * slab->obj_size;
+
+	ds_list_init(&slab->magazines);
+
+	if (pthread_mutex_init(&slab->lock, NULL) != 0) {
+		ds_free(slab);
+		return NULL;
+	}
+
+	if (pthread_key_create(&slab->key, slab_magazine_destroy) != 0) {
+		pthread_mutex_destroy(&slab->lock);
+		ds_free(slab);
+		return NULL;
+	}
+
+	return slab;
+}
+
+/* Free all chunks and forget all free objects, called with lock held */
+static void slab_release_chunks(struct ds_slab *slab)
+{
+	struct slab_magazine *mag;
+	struct slab_chunk *chunk, *next;
+
+	ds_list_for_each_item(mag, &slab->magazines, struct slab_magazine,
+			      entry)
+		magazine_set_count(mag, 0);
+
+	for (chunk = slab->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		ds_aligned_free(chunk);
+	}
+
+	slab->chunks = NULL;
+	slab->free_objs = NULL;
+	slab->num_chunks = 0;
+	slab->num_free = 0;
+}
+
+void ds_slab_purge(struct ds_slab *slab)
+{
+	pthread_mutex_lock(&slab->lock);
+	slab_release_chunks(slab);
+	pthread_mutex_unlock(&slab->lock);
+}
+
+void ds_slab_free(struct ds_slab *slab)
+{
+	struct slab_magazine *mag, *next;
+
+	if (!slab)
+		return;
+
+	/* destructors are not called for deleted key */
+	pthread_key_delete(slab->key);
+
+	slab_release_chunks(slab);
+
+	ds_list_for_each_item_safe(mag, next, &slab->magazines,
+				   struct slab_magazine, entry)
+		ds_free(mag);
+
+	pthread_mutex_destroy(&slab->lock);
+	ds_free(slab);
+}
+
+void *ds_slab_obj_alloc(struct ds_slab *slab)
+{
+	struct slab_magazine *mag;
+	unsigned int count;
+	void *obj;
+
+	mag = slab_get_magazine(slab);
+	if (mag) {
+		count = mag->count;
+		if (count > 0) {
+			magazine_set_count(mag, count - 1);
+			return mag->objs[count - 1];
+		}
+	}
+
+	pthread_mutex_lock(&slab->lock);
+
+	obj = slab_pop_free(slab);
+
+	/* refill magazine for following allocations */
+	if (obj && mag) {
+		for (count = 0; count < SLAB_MAGAZINE_BATCH; count++) {
+			void *extra = slab_pop_free(slab);
+
+			if (!extra)
+				break;
+			mag->objs[count] = extra;
+		}
+		magazine_set_count(mag, count);
+	}
+
+	pthread_mutex_unlock(&slab->lock);
+
+	return obj;
+}
+
+void ds_slab_obj_free(struct ds_slab *slab, void *obj)
+{
+	struct slab_magazine *mag;
+	unsigned int count;
+
+	if (!obj)
+		return;
+
+	mag = slab_get_magazine(slab);
+	if (mag) {
+		count = mag->count;
+		if (count < DS_SLAB_MAGAZINE_SIZE) {
+			mag->objs[count] = obj;
+			magazine_set_count(mag, count + 1);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&slab->lock);
+
+	slab_push_free(slab, obj);
+
+	/* flush half of full magazine, keep rest for following allocations */
+	if (mag) {
+		count = mag->count;
+		while (count > DS_SLAB_MAGAZINE_SIZE - SLAB_MAGAZINE_BATCH)
+			slab_push_free(slab, mag->objs[--count]);
+		magazine_set_count(mag, count);
+	}
+
+	pthread_mutex_unlock(&slab->lock);
+}
+
+size_t ds_slab_obj_size(const struct ds_slab *slab)
+{
+	return slab->obj_size;
+}
+
+void ds_slab_get_stats(struct ds_slab *slab, struct ds_slab_stats *stats)
+{
+	struct slab_magazine *mag;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&slab->lock);
+
+	ds_list_for_each_item(mag, &slab->magazines, struct slab_magazine,
+			      entry) {
+		stats->objs_cached += magazine_count(mag);
+		stats->magazines++;
+	}
+
+	stats->obj_size = slab->obj_size;
+	stats->chunks = slab->num_chunks;
+	stats->objs_total = slab->num_chunks * slab->chunk_objs;
+	stats->objs_free = slab->num_free;
+	stats->footprint = sizeof(*slab) + slab->num_chunks * slab->chunk_size +
+			   stats->magazines * sizeof(*mag);
+
+	pthread_mutex_unlock(&slab->lock);
+
+	if (stats->objs_free + stats->objs_cached < stats->objs_total)
+		stats->objs_in_use = stats->objs_total - stats->objs_free -
+				     stats->objs_cached;
+}
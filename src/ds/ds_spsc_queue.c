@@ -0,0 +1,227 @@
+/*
+ * Lock-free single-producer/single-consumer message queue.
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+
+#include "ds.h"
+
+/* Keep producer and consumer owned indexes on separate cache lines */
+#define SPSC_QUEUE_CACHELINE_SIZE 64
+
+struct ds_spsc_slot {
+	size_t data_length;
+	unsigned char data[];
+};
+
+struct ds_spsc_queue {
+	/* Written by producer */
+	unsigned int tail;
+	unsigned int cached_head;
+	unsigned char __pad0[SPSC_QUEUE_CACHELINE_SIZE];
+
+	/* Written by consumer */
+	unsigned int head;
+	unsigned int cached_tail;
+	unsigned char __pad1[SPSC_QUEUE_CACHELINE_SIZE];
+
+	/* Read-only after allocation */
+	unsigned int capacity;
+	size_t slot_size;
+	size_t slot_stride;
+	unsigned char *slots;
+
+	struct ds_event *not_empty;
+	struct ds_event *not_full;
+};
+
+static inline struct ds_spsc_slot *spsc_slot(struct ds_spsc_queue *queue,
+					     unsigned int index)
+{
+	index &= queue->capacity - 1;
+
+	return (void *)&queue->slots[index * queue->slot_stride];
+}
+
+struct ds_spsc_queue *ds_spsc_queue_alloc(unsigned int capacity,
+					  size_t slot_size)
+{
+	struct ds_spsc_queue *queue;
+	unsigned int slots;
+
+	if (capacity == 0 || capacity > (1U << 31))
+		return NULL;
+
+	/* round capacity up to power of two, for masking indexes */
+	for (slots = 1; slots < capacity; slots <<= 1)
+		;
+
+	queue = ds_malloc(sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	memset(queue, 0, sizeof(*queue));
+
+	queue->capacity = slots;
+	queue->slot_size = slot_size;
+
+	/* align slots to long word size */
+	queue->slot_stride = sizeof(struct ds_spsc_slot) + slot_size;
+	if (queue->slot_stride % sizeof(long) != 0)
+		queue->slot_stride = (queue->slot_stride / sizeof(long) + 1) *
+				     sizeof(long);
+
+	queue->slots = ds_malloc(queue->slot_stride * slots);
+	queue->not_empty = ds_event_alloc();
+	queue->not_full = ds_event_alloc();
+	if (!queue->slots || !queue->not_empty || !queue->not_full) {
+		ds_spsc_queue_free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+void ds_spsc_queue_free(struct ds_spsc_queue *queue)
+{
+	ds_event_free(queue->not_full);
+	ds_event_free(queue->not_empty);
+	ds_free(queue->slots);
+	ds_free(queue);
+}
+
+bool ds_spsc_queue_empty(struct ds_spsc_queue *queue)
+{
+	return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) ==
+	       __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+int ds_spsc_queue_push_timed(struct ds_spsc_queue *queue, const void *msg,
+			     size_t msglen, const struct ds_timespec *abstime)
+{
+	unsigned int tail = queue->tail;
+	struct ds_spsc_slot *slot;
+	unsigned int key;
+	int ret;
+
+	if (msglen > queue->slot_size)
+		return -EINVAL;
+
+	/* check if ring is full, refresh cached head only when needed */
+	while (tail - queue->cached_head == queue->capacity) {
+		queue->cached_head = __atomic_load_n(&queue->head,
+						     __ATOMIC_ACQUIRE);
+		if (tail - queue->cached_head != queue->capacity)
+			break;
+
+		/* full, park until consumer frees slot */
+		key = ds_event_prepare_wait(queue->not_full);
+
+		queue->cached_head = __atomic_load_n(&queue->head,
+						     __ATOMIC_SEQ_CST);
+		if (tail - queue->cached_head != queue->capacity) {
+			ds_event_cancel_wait(queue->not_full);
+			break;
+		}
+
+		ret = ds_event_wait(queue->not_full, key, abstime);
+		if (ret)
+			return ret;
+	}
+
+	/* copy message to slot */
+	slot = spsc_slot(queue, tail);
+	slot->data_length = msglen;
+	memcpy(slot->data, msg, msglen);
+
+	/* publish new message */
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	ds_event_signal(queue->not_empty);
+
+	return 0;
+}
+
+int ds_spsc_queue_try_push(struct ds_spsc_queue *queue, const void *msg,
+			   size_t msglen)
+{
+	struct ds_timespec no_timeout = {0, 0};
+	return ds_spsc_queue_push_timed(queue, msg, msglen, &no_timeout);
+}
+
+int ds_spsc_queue_pop_timed(struct ds_spsc_queue *queue, void *msg,
+			    size_t *msglen, const struct ds_timespec *abstime)
+{
+	unsigned int head = queue->head;
+	struct ds_spsc_slot *slot;
+	unsigned int key;
+	int ret;
+
+	if (msglen)
+		*msglen = 0;
+
+	/* check if ring is empty, refresh cached tail only when needed */
+	while (queue->cached_tail == head) {
+		queue->cached_tail = __atomic_load_n(&queue->tail,
+						     __ATOMIC_ACQUIRE);
+		if (queue->cached_tail != head)
+			break;
+
+		/* empty, park until producer adds message */
+		key = ds_event_prepare_wait(queue->not_empty);
+
+		queue->cached_tail = __atomic_load_n(&queue->tail,
+						     __ATOMIC_SEQ_CST);
+		if (queue->cached_tail != head) {
+			ds_event_cancel_wait(queue->not_empty);
+			break;
+		}
+
+		ret = ds_event_wait(queue->not_empty, key, abstime);
+		if (ret)
+			return ret;
+	}
+
+	/* copy message from slot */
+	slot = spsc_slot(queue, head);
+	memcpy(msg, slot->data, slot->data_length);
+	if (msglen)
+		*msglen = slot->data_length;
+
+	/* release slot for producer */
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	ds_event_signal(queue->not_full);
+
+	return 0;
+}
+
+int ds_spsc_queue_try_pop(struct ds_spsc_queue *queue, void *msg,
+			  size_t *msglen)
+{
+	struct ds_timespec no_timeout = {0, 0};
+	return ds_spsc_queue_pop_timed(queue, msg, msglen, &no_timeout);
+}
@@ -23,6 +23,8 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
@@ -92,3 +94,133 @@ int ds_make_timeout_ms(struct ds_timespec *abstimeout, unsigned int timeout_ms)
 {
 	return ds_make_timeout_us(abstimeout, timeout_ms * 1000);
 }
+
+static void *default_malloc(size_t size, void *opaque)
+{
+	(void)opaque;
+	return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *opaque)
+{
+	(void)opaque;
+	return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *opaque)
+{
+	(void)opaque;
+	free(ptr);
+}
+
+static struct ds_allocator allocator = {
+	default_malloc, default_realloc, default_free, NULL
+};
+
+/**
+ * ds_set_allocator - route libds memory allocations to @new_allocator
+ * @new_allocator: allocator callbacks, NULL restores C library allocator
+ */
+bool ds_set_allocator(const struct ds_allocator *new_allocator)
+{
+	if (!new_allocator) {
+		allocator.malloc = default_malloc;
+		allocator.realloc = default_realloc;
+		allocator.free = default_free;
+		allocator.opaque = NULL;
+		return true;
+	}
+
+	if (!new_allocator->malloc || !new_allocator->realloc ||
+	    !new_allocator->free)
+		return false;
+
+	allocator = *new_allocator;
+	return true;
+}
+
+/**
+ * ds_malloc - allocate memory with libds allocator
+ * @size: size of allocation
+ */
+void *ds_malloc(size_t size)
+{
+	return allocator.malloc(size, allocator.opaque);
+}
+
+/**
+ * ds_calloc - allocate zeroed array with libds allocator
+ * @nmemb: number of array elements
+ * @size: size of array element
+ */
+void *ds_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+
+	ptr = ds_malloc(nmemb * size);
+	if (ptr)
+		memset(ptr, 0, nmemb * size);
+
+	return ptr;
+}
+
+/**
+ * ds_realloc - resize allocation of libds allocator
+ * @ptr: old allocation, may be NULL
+ * @size: new size of allocation
+ */
+void *ds_realloc(void *ptr, size_t size)
+{
+	return allocator.realloc(ptr, size, allocator.opaque);
+}
+
+/**
+ * ds_free - free memory allocated with libds allocator
+ * @ptr: allocation, may be NULL
+ */
+void ds_free(void *ptr)
+{
+	if (ptr)
+		allocator.free(ptr, allocator.opaque);
+}
+
+/**
+ * ds_aligned_alloc - allocate aligned memory with libds allocator
+ * @align: alignment, power of two
+ * @size: size of allocation
+ *
+ * Pointer to underlying allocation is stored just before aligned area.
+ */
+void *ds_aligned_alloc(size_t align, size_t size)
+{
+	uintptr_t addr;
+	void *raw;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	if (size > (size_t)-1 - align - sizeof(void *))
+		return NULL;
+
+	raw = ds_malloc(size + align - 1 + sizeof(void *));
+	if (!raw)
+		return NULL;
+
+	addr = ((uintptr_t)raw + sizeof(void *) + align - 1) &
+	       ~(uintptr_t)(align - 1);
+	((void **)addr)[-1] = raw;
+
+	return (void *)addr;
+}
+
+/**
+ * ds_aligned_free - free memory allocated with ds_aligned_alloc()
+ * @ptr: allocation, may be NULL
+ */
+void ds_aligned_free(void *ptr)
+{
+	if (ptr)
+		ds_free(((void **)ptr)[-1]);
+}
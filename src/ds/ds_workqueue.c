@@ -0,0 +1,575 @@
+/*
+ * Work-stealing thread pool with Chase-Lev deques, and wait groups
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "ds.h"
+
+#define WORKQUEUE_CACHELINE_SIZE 64
+
+/* Microseconds worker waiting for wait group sleeps between task checks */
+#define WORKQUEUE_HELP_WAIT_US 1000
+
+struct wq_task {
+	ds_work_func_t func;
+	void *arg;
+	struct ds_wait_group *wg;
+};
+
+/*
+ * Chase-Lev deque, "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (Lê et al., 2013), with fixed size array. Owner pushes and takes at
+ * @bottom, thieves steal at @top. Slots are accessed atomically since thief
+ * may read slot that owner is overwriting, thief then fails its CAS on @top.
+ */
+struct wq_worker {
+	long top;
+	unsigned char __pad0[WORKQUEUE_CACHELINE_SIZE];
+
+	long bottom;
+	unsigned int seed;
+	unsigned char __pad1[WORKQUEUE_CACHELINE_SIZE];
+
+	struct wq_task *tasks[DS_WORKQUEUE_DEQUE_SIZE];
+
+	struct ds_workqueue *wq;
+	unsigned int index;
+	pthread_t thread;
+
+	/* Written by owner, read by ds_workqueue_get_stats() */
+	unsigned long long executed;
+	unsigned long long stolen;
+	unsigned long long parks;
+};
+
+struct ds_workqueue {
+	struct wq_worker *workers;
+	unsigned int num_workers;
+	unsigned int num_started;
+
+	pthread_key_t key;
+	struct ds_slab *task_slab;
+
+	/* Tasks submitted but not yet taken for running */
+	unsigned int pending;
+	bool stopping;
+	struct ds_event *event;
+
+	/* Shared queue for tasks from outside of workers */
+	pthread_mutex_t inject_lock;
+	struct ds_deque inject;
+	unsigned int inject_len;
+
+	unsigned long long submitted;
+	unsigned long long injected;
+};
+
+static inline void wq_stat_inc(unsigned long long *stat)
+{
+	__atomic_add_fetch(stat, 1, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long wq_stat_load(unsigned long long *stat)
+{
+	return __atomic_load_n(stat, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+ * Wait group
+ *****************************************************************************/
+
+bool ds_wait_group_init(struct ds_wait_group *wg)
+{
+	wg->count = 0;
+	wg->busy = 0;
+	wg->event = ds_event_alloc();
+
+	return wg->event != NULL;
+}
+
+void ds_wait_group_free(struct ds_wait_group *wg)
+{
+	ds_event_free(wg->event);
+	wg->event = NULL;
+}
+
+void ds_wait_group_done(struct ds_wait_group *wg)
+{
+	/* waiter may free wait group as soon as count is zero and not busy */
+	__atomic_add_fetch(&wg->busy, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_sub_fetch(&wg->count, 1, __ATOMIC_SEQ_CST) == 0)
+		ds_event_broadcast(wg->event);
+
+	__atomic_sub_fetch(&wg->busy, 1, __ATOMIC_RELEASE);
+}
+
+/* Wait until concurrent ds_wait_group_done() calls have returned */
+static void wait_group_wait_idle(struct ds_wait_group *wg)
+{
+	while (__atomic_load_n(&wg->busy, __ATOMIC_ACQUIRE) != 0)
+		sched_yield();
+}
+
+void ds_wait_group_wait(struct ds_wait_group *wg)
+{
+	unsigned int key;
+
+	while (ds_wait_group_pending(wg) != 0) {
+		key = ds_event_prepare_wait(wg->event);
+		if (ds_wait_group_pending(wg) == 0) {
+			ds_event_cancel_wait(wg->event);
+			break;
+		}
+
+		ds_event_wait(wg->event, key, NULL);
+	}
+
+	wait_group_wait_idle(wg);
+}
+
+/*****************************************************************************
+ * Task deque
+ *****************************************************************************/
+
+/* Owner only. Returns false if deque is full. */
+static bool deque_push(struct wq_worker *w, struct wq_task *task)
+{
+	long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= DS_WORKQUEUE_DEQUE_SIZE)
+		return false;
+
+	__atomic_store_n(&w->tasks[b & (DS_WORKQUEUE_DEQUE_SIZE - 1)], task,
+			 __ATOMIC_RELAXED);
+
+	/* publish task to thieves */
+	__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Owner only */
+static struct wq_task *deque_take(struct wq_worker *w)
+{
+	struct wq_task *task;
+	long b, t;
+
+	b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+	if (t > b) {
+		/* empty */
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	task = __atomic_load_n(&w->tasks[b & (DS_WORKQUEUE_DEQUE_SIZE - 1)],
+			       __ATOMIC_RELAXED);
+	if (t == b) {
+		/* last task, race against thieves */
+		if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, false,
+						 __ATOMIC_SEQ_CST,
+						 __ATOMIC_RELAXED))
+			task = NULL;
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+
+	return task;
+}
+
+/* Any thread. Returns NULL if deque is empty or steal lost race. */
+static struct wq_task *deque_steal(struct wq_worker *w)
+{
+	struct wq_task *task;
+	long b, t;
+
+	t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+
+	if (t >= b)
+		return NULL;
+
+	task = __atomic_load_n(&w->tasks[t & (DS_WORKQUEUE_DEQUE_SIZE - 1)],
+			       __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, false,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+
+	return task;
+}
+
+/*****************************************************************************
+ * Workqueue
+ *****************************************************************************/
+
+static struct wq_worker *wq_current_worker(struct ds_workqueue *wq)
+{
+	struct wq_worker *w = pthread_getspecific(wq->key);
+
+	return w && w->wq == wq ? w : NULL;
+}
+
+static bool wq_inject(struct ds_workqueue *wq, struct wq_task *task)
+{
+	bool ok;
+
+	pthread_mutex_lock(&wq->inject_lock);
+	ok = ds_deque_push_back(&wq->inject, &task);
+	if (ok)
+		__atomic_add_fetch(&wq->inject_len, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&wq->inject_lock);
+
+	if (ok)
+		wq_stat_inc(&wq->injected);
+
+	return ok;
+}
+
+static struct wq_task *wq_take_injected(struct ds_workqueue *wq)
+{
+	struct wq_task *task = NULL;
+
+	if (__atomic_load_n(&wq->inject_len, __ATOMIC_ACQUIRE) == 0)
+		return NULL;
+
+	pthread_mutex_lock(&wq->inject_lock);
+	if (ds_deque_pop_front(&wq->inject, &task))
+		__atomic_sub_fetch(&wq->inject_len, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&wq->inject_lock);
+
+	return task;
+}
+
+static unsigned int wq_random(unsigned int *seed)
+{
+	/* xorshift32 */
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+
+	return *seed;
+}
+
+/* Find task for worker @w, or for non-worker thread if @w is NULL */
+static struct wq_task *wq_find_task(struct ds_workqueue *wq,
+				    struct wq_worker *w)
+{
+	struct wq_task *task;
+	unsigned int i, start, victim;
+
+	if (w) {
+		task = deque_take(w);
+		if (task)
+			return task;
+	}
+
+	task = wq_take_injected(wq);
+	if (task)
+		return task;
+
+	/* steal from other workers, starting from random victim */
+	start = w ? wq_random(&w->seed) : 0;
+	for (i = 0; i < wq->num_workers; i++) {
+		victim = (start + i) % wq->num_workers;
+		if (w && victim == w->index)
+			continue;
+
+		task = deque_steal(&wq->workers[victim]);
+		if (task) {
+			if (w)
+				wq_stat_inc(&w->stolen);
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+static void wq_run_task(struct ds_workqueue *wq, struct wq_worker *w,
+			struct wq_task *task)
+{
+	struct ds_wait_group *wg = task->wg;
+
+	__atomic_sub_fetch(&wq->pending, 1, __ATOMIC_SEQ_CST);
+
+	task->func(task->arg);
+	ds_slab_obj_free(wq->task_slab, task);
+
+	if (w)
+		wq_stat_inc(&w->executed);
+	if (wg)
+		ds_wait_group_done(wg);
+}
+
+static void *wq_worker_thread(void *arg)
+{
+	struct wq_worker *w = arg;
+	struct ds_workqueue *wq = w->wq;
+	struct wq_task *task;
+	unsigned int key;
+
+	pthread_setspecific(wq->key, w);
+
+	while (true) {
+		task = wq_find_task(wq, w);
+		if (task) {
+			wq_run_task(wq, w, task);
+			continue;
+		}
+
+		/* tasks may be pending in deque of worker running them */
+		if (__atomic_load_n(&wq->pending, __ATOMIC_SEQ_CST) != 0) {
+			sched_yield();
+			continue;
+		}
+
+		key = ds_event_prepare_wait(wq->event);
+		if (__atomic_load_n(&wq->pending, __ATOMIC_SEQ_CST) != 0) {
+			ds_event_cancel_wait(wq->event);
+			continue;
+		}
+		if (__atomic_load_n(&wq->stopping, __ATOMIC_SEQ_CST)) {
+			ds_event_cancel_wait(wq->event);
+			break;
+		}
+
+		wq_stat_inc(&w->parks);
+		ds_event_wait(wq->event, key, NULL);
+	}
+
+	return NULL;
+}
+
+static unsigned int wq_default_num_workers(void)
+{
+	long num = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return num > 0 ? (unsigned int)num : 1;
+}
+
+struct ds_workqueue *ds_workqueue_alloc(unsigned int num_workers)
+{
+	struct ds_workqueue *wq;
+	struct wq_worker *w;
+	unsigned int i;
+
+	if (num_workers == 0)
+		num_workers = wq_default_num_workers();
+	if (num_workers > DS_WORKQUEUE_MAX_WORKERS)
+		num_workers = DS_WORKQUEUE_MAX_WORKERS;
+
+	wq = ds_calloc(1, sizeof(*wq));
+	if (!wq)
+		return NULL;
+
+	wq->num_workers = num_workers;
+	wq->workers = ds_aligned_alloc(WORKQUEUE_CACHELINE_SIZE,
+				       num_workers * sizeof(*wq->workers));
+	wq->task_slab = ds_slab_alloc(sizeof(struct wq_task), 0);
+	wq->event = ds_event_alloc();
+	if (!wq->workers || !wq->task_slab || !wq->event)
+		goto err_free;
+
+	if (!ds_deque_init(&wq->inject, sizeof(struct wq_task *), 0))
+		goto err_free;
+
+	if (pthread_mutex_init(&wq->inject_lock, NULL) != 0)
+		goto err_deque;
+
+	if (pthread_key_create(&wq->key, NULL) != 0)
+		goto err_mutex;
+
+	memset(wq->workers, 0, num_workers * sizeof(*wq->workers));
+	for (i = 0; i < num_workers; i++) {
+		w = &wq->workers[i];
+		w->wq = wq;
+		w->index = i;
+		w->seed = 0x9e3779b9U * (i + 1);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		if (pthread_create(&wq->workers[i].thread, NULL,
+				   wq_worker_thread, &wq->workers[i]) != 0)
+			break;
+		wq->num_started++;
+	}
+
+	if (wq->num_started < num_workers)
+		goto err_stop;
+
+	return wq;
+
+err_stop:
+	__atomic_store_n(&wq->stopping, true, __ATOMIC_SEQ_CST);
+	ds_event_broadcast(wq->event);
+	for (i = 0; i < wq->num_started; i++)
+		pthread_join(wq->workers[i].thread, NULL);
+	pthread_key_delete(wq->key);
+err_mutex:
+	pthread_mutex_destroy(&wq->inject_lock);
+err_deque:
+	ds_deque_free(&wq->inject);
+err_free:
+	ds_event_free(wq->event);
+	ds_slab_free(wq->task_slab);
+	ds_aligned_free(wq->workers);
+	ds_free(wq);
+	return NULL;
+}
+
+void ds_workqueue_free(struct ds_workqueue *wq)
+{
+	unsigned int i;
+
+	if (!wq)
+		return;
+
+	__atomic_store_n(&wq->stopping, true, __ATOMIC_SEQ_CST);
+	ds_event_broadcast(wq->event);
+
+	for (i = 0; i < wq->num_started; i++)
+		pthread_join(wq->workers[i].thread, NULL);
+
+	pthread_key_delete(wq->key);
+	pthread_mutex_destroy(&wq->inject_lock);
+	ds_deque_free(&wq->inject);
+	ds_event_free(wq->event);
+	ds_slab_free(wq->task_slab);
+	ds_aligned_free(wq->workers);
+	ds_free(wq);
+}
+
+bool ds_workqueue_submit(struct ds_workqueue *wq, ds_work_func_t func,
+			 void *arg, struct ds_wait_group *wg)
+{
+	struct wq_worker *w = wq_current_worker(wq);
+	struct wq_task *task;
+
+	task = ds_slab_obj_alloc(wq->task_slab);
+	if (!task)
+		return false;
+
+	task->func = func;
+	task->arg = arg;
+	task->wg = wg;
+
+	if (wg)
+		ds_wait_group_add(wg, 1);
+
+	/* counted before push, so that parking workers see task coming */
+	__atomic_add_fetch(&wq->pending, 1, __ATOMIC_SEQ_CST);
+
+	if (!(w && deque_push(w, task)) && !wq_inject(wq, task)) {
+		__atomic_sub_fetch(&wq->pending, 1, __ATOMIC_SEQ_CST);
+		if (wg)
+			ds_wait_group_done(wg);
+		ds_slab_obj_free(wq->task_slab, task);
+		return false;
+	}
+
+	wq_stat_inc(&wq->submitted);
+	ds_event_signal(wq->event);
+
+	return true;
+}
+
+void ds_workqueue_wait(struct ds_workqueue *wq, struct ds_wait_group *wg)
+{
+	struct wq_worker *w = wq_current_worker(wq);
+	struct ds_timespec abstime;
+	struct wq_task *task;
+	unsigned int key;
+
+	if (!w) {
+		ds_wait_group_wait(wg);
+		return;
+	}
+
+	while (ds_wait_group_pending(wg) != 0) {
+		task = wq_find_task(wq, w);
+		if (task) {
+			wq_run_task(wq, w, task);
+			continue;
+		}
+
+		/*
+		 * Remaining tasks are run by other workers. They may submit
+		 * more tasks, so sleep only briefly before checking again.
+		 */
+		key = ds_event_prepare_wait(wg->event);
+		if (ds_wait_group_pending(wg) == 0) {
+			ds_event_cancel_wait(wg->event);
+			break;
+		}
+		if (ds_make_timeout_us(&abstime, WORKQUEUE_HELP_WAIT_US) != 0) {
+			ds_event_cancel_wait(wg->event);
+			sched_yield();
+			continue;
+		}
+		ds_event_wait(wg->event, key, &abstime);
+	}
+
+	wait_group_wait_idle(wg);
+}
+
+unsigned int ds_workqueue_num_workers(const struct ds_workqueue *wq)
+{
+	return wq->num_workers;
+}
+
+int ds_workqueue_current_worker(struct ds_workqueue *wq)
+{
+	struct wq_worker *w = wq_current_worker(wq);
+
+	return w ? (int)w->index : -1;
+}
+
+void ds_workqueue_get_stats(struct ds_workqueue *wq,
+			    struct ds_workqueue_stats *stats)
+{
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->num_workers = wq->num_workers;
+	stats->submitted = wq_stat_load(&wq->submitted);
+	stats->injected = wq_stat_load(&wq->injected);
+
+	for (i = 0; i < wq->num_workers; i++) {
+		stats->executed += wq_stat_load(&wq->workers[i].executed);
+		stats->stolen += wq_stat_load(&wq->workers[i].stolen);
+		stats->parks += wq_stat_load(&wq->workers[i].parks);
+	}
+}
@@ -43,7 +43,7 @@
  */
 struct ds_xorlist_entry *ds_xorlist_entry_alloc(size_t datasize)
 {
-	return calloc(1, sizeof(struct ds_xorlist_entry) + datasize);
+	return ds_calloc(1, sizeof(struct ds_xorlist_entry) + datasize);
 }
 
 /**
@@ -88,15 +88,52 @@ void ds_xorlist_prepend_entry(struct ds_xor_list *list,
 	}
 }
 
-static struct ds_xorlist_entry *alloc_entry(void *data)
+/**
+ * ds_xorlist_set_slab - allocate xor list entries from slab
+ * @list: empty xor linked list
+ * @slab: slab for entries, NULL for libds allocator
+ *
+ * Returns false if list is not empty or objects of @slab are too small.
+ */
+bool ds_xorlist_set_slab(struct ds_xor_list *list, struct ds_slab *slab)
+{
+	if (!ds_xorlist_empty(list))
+		return false;
+	if (slab && ds_slab_obj_size(slab) < DS_XORLIST_SLAB_OBJ_SIZE)
+		return false;
+
+	list->slab = slab;
+	return true;
+}
+
+static struct ds_xorlist_entry *alloc_entry(struct ds_xor_list *list,
+					    void *data)
 {
 	struct ds_xorlist_entry *entry;
 
-	ds_new_xorlist_entry(entry, void *, data);
+	if (!list->slab) {
+		ds_new_xorlist_entry(entry, void *, data);
+		return entry;
+	}
+
+	entry = ds_slab_obj_alloc(list->slab);
+	if (entry) {
+		entry->prevnext = 0;
+		ds_set_xorlist_entry_data(entry, void *, data);
+	}
 
 	return entry;
 }
 
+static void free_entry(struct ds_xor_list *list,
+		       struct ds_xorlist_entry *entry)
+{
+	if (list->slab)
+		ds_slab_obj_free(list->slab, entry);
+	else
+		ds_free(entry);
+}
+
 /**
  * ds_xorlist_append - add new data element at end of xor list
  * @list: xor linked list
@@ -106,7 +143,7 @@ static struct ds_xorlist_entry *alloc_entry(void *data)
  */
 bool ds_xorlist_append(struct ds_xor_list *list, void *data)
 {
-	struct ds_xorlist_entry *entry = alloc_entry(data);
+	struct ds_xorlist_entry *entry = alloc_entry(list, data);
 
 	if (!entry)
 		return false;
@@ -124,7 +161,7 @@ bool ds_xorlist_append(struct ds_xor_list *list, void *data)
  */
 bool ds_xorlist_prepend(struct ds_xor_list *list, void *data)
 {
-	struct ds_xorlist_entry *entry = alloc_entry(data);
+	struct ds_xorlist_entry *entry = alloc_entry(list, data);
 
 	if (!entry)
 		return false;
@@ -233,7 +270,87 @@ void ds_xorlist_delete_entry(struct ds_xor_list *list,
 	memset(entry, 0xCC, sizeof(*entry));
 #endif
 
-	free(entry);
+	free_entry(list, entry);
+}
+
+/* Link @entry between neighbours @prev and @next of xor list */
+static void link_entry(struct ds_xor_list *list, struct ds_xorlist_entry *entry,
+		       struct ds_xorlist_entry *prev,
+		       struct ds_xorlist_entry *next)
+{
+	entry->prevnext = (uintptr_t)prev ^ (uintptr_t)next;
+
+	if (prev)
+		prev->prevnext ^= (uintptr_t)next ^ (uintptr_t)entry;
+	else
+		list->head = entry;
+
+	if (next)
+		next->prevnext ^= (uintptr_t)prev ^ (uintptr_t)entry;
+	else
+		list->tail = entry;
+
+	list->count++;
+}
+
+/**
+ * ds_xorlist_cursor_insert_before - insert @entry before cursor position
+ * @cur: cursor
+ * @entry: new xor list entry
+ */
+void ds_xorlist_cursor_insert_before(struct ds_xorlist_cursor *cur,
+				     struct ds_xorlist_entry *entry)
+{
+	link_entry(cur->list, entry, cur->prev,
+		   cur->pos ? cur->pos : cur->next);
+	cur->prev = entry;
+}
+
+/**
+ * ds_xorlist_cursor_insert_after - insert @entry after cursor position
+ * @cur: cursor
+ * @entry: new xor list entry
+ */
+void ds_xorlist_cursor_insert_after(struct ds_xorlist_cursor *cur,
+				    struct ds_xorlist_entry *entry)
+{
+	link_entry(cur->list, entry, cur->pos ? cur->pos : cur->prev,
+		   cur->next);
+	cur->next = entry;
+}
+
+/**
+ * ds_xorlist_cursor_remove - remove entry at cursor from xor list
+ * @cur: cursor
+ *
+ * Entry element is removed from list but not freed.
+ */
+struct ds_xorlist_entry *ds_xorlist_cursor_remove(struct ds_xorlist_cursor *cur)
+{
+	struct ds_xorlist_entry *entry = cur->pos;
+
+	if (!entry)
+		return NULL;
+
+	ds_xorlist_remove_entry(cur->list, entry, cur->prev);
+	cur->pos = NULL;
+
+	return entry;
+}
+
+/**
+ * ds_xorlist_cursor_delete - delete entry at cursor from xor list
+ * @cur: cursor
+ *
+ * Entry element is also freed.
+ */
+void ds_xorlist_cursor_delete(struct ds_xorlist_cursor *cur)
+{
+	if (!cur->pos)
+		return;
+
+	ds_xorlist_delete_entry(cur->list, cur->pos, cur->prev);
+	cur->pos = NULL;
 }
 
 /**
@@ -273,12 +390,14 @@ void ds_xorlist_purge(struct ds_xor_list *list, void(*data_free)(void *data))
 		if (data_free)
 			(*data_free)(ds_xorlist_entry_data(void *, pos));
 
-		free(pos);
+		free_entry(list, pos);
 
 		prev = pos;
 		pos = next;
 		next = next ? ds_xorlist_next(prev, next) : NULL;
 	}
 
-	ds_xorlist_init(list);
+	list->head = NULL;
+	list->tail = NULL;
+	list->count = 0;
 }
@@ -28,6 +28,9 @@
 #define __LIBIO__IO_H__
 
 #include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
 #include "ds.h"
 
 
@@ -54,6 +57,145 @@ extern void io_sleep_to(struct ds_timespec *abstime);
  */
 extern void io_usleep(unsigned int usec);
 
+/**
+ * io_sleep_until_ns - sleep to absolute time of monotonic clock
+ * @deadline_ns: time in future to sleep to, see io_get_monotonic_ns()
+ */
+extern void io_sleep_until_ns(unsigned long long deadline_ns);
+
+/**
+ * io_get_monotonic_ns - get time of monotonic clock in nanoseconds, for
+ *			 measuring intervals
+ */
+extern unsigned long long io_get_monotonic_ns(void);
+
+/**
+ * io_stats_add - add @num to statistics counter
+ *
+ * Counters are updated and read with relaxed atomics, without locks.
+ */
+static inline void io_stats_add(unsigned long long *counter,
+				unsigned long long num)
+{
+	__atomic_fetch_add(counter, num, __ATOMIC_RELAXED);
+}
+
+/**
+ * io_stats_max - raise statistics counter to @value if it is lower
+ */
+static inline void io_stats_max(unsigned long long *counter,
+				unsigned long long value)
+{
+	unsigned long long old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+	while (old < value &&
+	       !__atomic_compare_exchange_n(counter, &old, value, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * io_stats_load - read statistics counter
+ */
+static inline unsigned long long
+io_stats_load(const unsigned long long *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*
+ * Maximum number of value columns (channels) decoded from text input.
+ */
+#define IO_MAX_CHANNELS 8
+
+/*
+ * Sample format of values queue. Queued float values are rounded to two
+ * decimals, so int16 fixed-point values in units of 1/IO_SAMPLE_INT16_SCALE
+ * carry same precision in half the memory, within range of +-327.67.
+ */
+enum io_sample_format {
+	IO_SAMPLE_FLOAT32 = 0,
+	IO_SAMPLE_INT16,
+};
+
+#define IO_SAMPLE_INT16_SCALE 100
+
+/**
+ * io_sample_clamp_i16 - saturate fixed-point @value to int16 range
+ */
+static inline int16_t io_sample_clamp_i16(long value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+
+	return value;
+}
+
+/**
+ * io_sample_to_i16 - convert @value to int16 fixed-point sample
+ *
+ * Rounds as float values queue does, saturates and converts NaN to zero.
+ */
+static inline int16_t io_sample_to_i16(float value)
+{
+	float fixed = roundf(value * (float)IO_SAMPLE_INT16_SCALE);
+
+	if (fixed >= INT16_MAX)
+		return INT16_MAX;
+	if (fixed <= INT16_MIN)
+		return INT16_MIN;
+	if (fixed != fixed)
+		return 0;
+
+	return (int16_t)fixed;
+}
+
+/**
+ * io_sample_from_i16 - convert int16 fixed-point sample to float value
+ *
+ * Result equals float values queue rounding of value within int16 range.
+ */
+static inline float io_sample_from_i16(int16_t value)
+{
+	return value / (float)IO_SAMPLE_INT16_SCALE;
+}
+
+/*
+ * Maximum length of ECG data line formatted by io_format_data_line(),
+ * including terminating null.
+ */
+#define IO_DATA_LINE_MAX_LEN 48
+
+/**
+ * io_format_data_line - format @value as "%.02f\n" without snprintf()
+ * @buf: output buffer, at least IO_DATA_LINE_MAX_LEN bytes
+ * @value: value to format
+ *
+ * Output is null terminated and identical to snprintf().
+ *
+ * Returns length of formatted line without terminating null.
+ */
+extern unsigned int io_format_data_line(char *buf, float value);
+
+/* Maximum number of decimals of io_format_fixed_line() */
+#define IO_FORMAT_MAX_DECIMALS 4
+
+/**
+ * io_format_fixed_line - format @value as "%.*f\n" with @decimals without
+ *			  snprintf()
+ * @buf: output buffer, at least IO_DATA_LINE_MAX_LEN bytes
+ * @value: value to format
+ * @decimals: number of decimals, up to IO_FORMAT_MAX_DECIMALS
+ *
+ * Output is null terminated and identical to snprintf().
+ *
+ * Returns length of formatted line without terminating null.
+ */
+extern unsigned int io_format_fixed_line(char *buf, float value,
+					 unsigned int decimals);
+
 /**
  * (internal) io_set_latest_error - set error string for currently happened
  *				    error
@@ -81,6 +223,7 @@ extern const char *io_get_latest_error(void);
  */
 
 struct io_parser;
+struct io_context;
 
 enum io_parser_ret {
 	IO_PARSER_RET_CONTINUE = 0,
@@ -88,17 +231,89 @@ enum io_parser_ret {
 	IO_PARSER_RET_ERROR,
 };
 
+/**
+ * io_seek_source - random access to input stream of parser, for seeking
+ * @filename: name of file of stream, NULL if stream is not file as such
+ * @length: length of stream in bytes
+ * @read: read up to @len bytes at @offset to @buf, returns number of bytes
+ *	  read (less than @len at end of stream) or -1 on error
+ * @find_line: find start of line at or before line @line (counted from zero
+ *	       at start of stream), stores its offset and line number (optional)
+ * @priv: private data of source
+ */
+struct io_seek_source {
+	const char *filename;
+	unsigned long long length;
+	int (*read)(const struct io_seek_source *src, unsigned long long offset,
+		    void *buf, unsigned int len);
+	bool (*find_line)(const struct io_seek_source *src,
+			  unsigned long long line, unsigned long long *offset,
+			  unsigned long long *line_start);
+	void *priv;
+};
+
+/**
+ * io_parser_ops - parser functions provided by module
+ * @name: short name of parser, for statistics
+ * @get_child: returns parser that receives output of this parser (optional)
+ * @seek_time: moves parser stack to time of stream, see
+ *	       io_parser_seek_time() (optional)
+ */
 struct io_parser_ops {
+	const char *name;
 	enum io_parser_ret (*parse)(struct io_parser *parser,
 				    struct ds_append_buffer *buffer,
 				    bool final);
 	bool (*wait_queue)(struct io_parser *parser);
 	bool (*destroy)(struct io_parser *parser);
 	bool (*reset)(struct io_parser *parser);
+	void (*set_context)(struct io_parser *parser, struct io_context *ctx);
+	struct io_parser *(*get_child)(struct io_parser *parser);
+	bool (*seek_time)(struct io_parser *parser,
+			  const struct io_seek_source *src, double seconds,
+			  unsigned long long *offset);
+};
+
+/**
+ * io_parser_stats - counters of parser, updated with io_stats_add()
+ * @parse_calls: number of io_parser_parse() calls
+ * @bytes_in: bytes consumed from input buffer
+ * @bytes_out: bytes passed to child parser
+ * @parse_ns: time spent in parse, including child parsers
+ * @decode_ns: time spent in decoder of parser, for example inflate()
+ */
+struct io_parser_stats {
+	unsigned long long parse_calls;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	unsigned long long parse_ns;
+	unsigned long long decode_ns;
+};
+
+/**
+ * io_sink - receiver of decoded sample blocks of parser stack
+ * @emit_block: receives @num_frames interleaved frames of @channels values,
+ *		@time is time of first frame in seconds from start of stream
+ *		and @channel_id is id given to io_parser_set_sink(). Returns
+ *		false on error.
+ * @priv: private data of sink
+ *
+ * Parsers fill frames to local block and pass whole block to sink in one
+ * call. Without sink, blocks are pushed to values queue of parser context.
+ */
+struct io_sink {
+	bool (*emit_block)(struct io_sink *sink, const float *frames,
+			   unsigned int num_frames, unsigned int channels,
+			   unsigned int channel_id, double time);
+	void *priv;
 };
 
 struct io_parser {
 	const struct io_parser_ops *ops;
+	struct io_context *ctx;
+	struct io_sink *sink;
+	unsigned int sink_channel_id;
+	struct io_parser_stats stats;
 };
 
 /**
@@ -108,6 +323,10 @@ static inline void io_parser_init(struct io_parser *parser,
 				  const struct io_parser_ops *ops)
 {
 	parser->ops = ops;
+	parser->ctx = NULL;
+	parser->sink = NULL;
+	parser->sink_channel_id = 0;
+	memset(&parser->stats, 0, sizeof(parser->stats));
 }
 
 /**
@@ -145,249 +364,1875 @@ extern bool io_parser_destroy(struct io_parser *parser);
  */
 extern bool io_parser_reset(struct io_parser *parser);
 
-
-/*****************************************************************************
- * Text parser
- *****************************************************************************/
-/*
- * Final parser for text-format ECG data (top of parser stack, input from
- * bottom)
+/**
+ * io_parser_set_context - set IO context that receives values from parser
+ *			   stack
+ * @parser: bottom of parser stack
+ * @ctx: context to use
  */
+extern void io_parser_set_context(struct io_parser *parser,
+				  struct io_context *ctx);
 
 /**
- * io_new_text_parser - allocate and initialize new EGC text parser
+ * io_parser_get_context - get IO context of parser, global context is used
+ *			   if none has been set
  */
-extern struct io_parser *io_new_text_parser(void);
+extern struct io_context *io_parser_get_context(struct io_parser *parser);
 
-
-/*****************************************************************************
- * gzip file parser/decompressor
- *****************************************************************************/
+/**
+ * io_parser_get_child - get parser receiving output of @parser, NULL at top
+ *			 of parser stack
+ */
+extern struct io_parser *io_parser_get_child(struct io_parser *parser);
 
 /**
- * io_new_gz_parser - allocate and initialize new GZ parser
+ * io_parser_set_sink - set sink that receives values from parser stack
+ *			instead of IO context
+ * @parser: bottom of parser stack
+ * @sink: sink to use, NULL for values queue of context
+ * @channel_id: id passed to @sink with each block
  */
-extern struct io_parser *io_new_gz_parser(struct io_parser *child);
+extern void io_parser_set_sink(struct io_parser *parser, struct io_sink *sink,
+			       unsigned int channel_id);
+
+/**
+ * io_parser_emit_block - pass block of decoded frames to sink of parser
+ * @parser: parser producing values
+ * @frames: @num_frames interleaved frames of io_context_get_channels()
+ *	    values of context of @parser
+ * @num_frames: number of frames
+ * @time: time of first frame in seconds from start of stream
+ */
+extern bool io_parser_emit_block(struct io_parser *parser, const float *frames,
+				 unsigned int num_frames, double time);
+
+/**
+ * io_parser_emit_block_i16 - pass block of int16 fixed-point frames to sink
+ *			      of parser
+ *
+ * Like io_parser_emit_block(), for parsers decoding fixed-point input. Frames
+ * are queued as such to context in IO_SAMPLE_INT16 format, sinks receive
+ * float frames.
+ */
+extern bool io_parser_emit_block_i16(struct io_parser *parser,
+				     const int16_t *frames,
+				     unsigned int num_frames, double time);
+
+/**
+ * io_parser_seek_time - move parser stack to time of input stream
+ * @parser: bottom of parser stack
+ * @src: random access to input stream of @parser
+ * @seconds: time from start of stream
+ * @offset: offset of @src where input continues is stored here
+ *
+ * Parser reads what it needs through @src and sets its state (delta-coding,
+ * resampling) so that values from @offset onwards continue as if stream had
+ * been parsed from start. Seeking past end of stream moves to end of stream.
+ *
+ * On failure, parser stack is reset and @offset is set to zero, so that
+ * input continues from start of stream.
+ */
+extern bool io_parser_seek_time(struct io_parser *parser,
+				const struct io_seek_source *src,
+				double seconds, unsigned long long *offset);
 
 
 /*****************************************************************************
- * Modular input subsystem
+ * Resampler
  *****************************************************************************/
-struct io_input;
+/*
+ * Converts values at variable input interval to fixed output rate. Input
+ * points are buffered and interpolated in blocks, output frames are passed
+ * to emit function in blocks.
+ */
 
-enum io_input_wait_ret {
-	IO_INPUT_WAIT_NEW = 0,
-	IO_INPUT_WAIT_STOP,
-	IO_INPUT_WAIT_ERROR
+/* Default output rate of context, 4ms interval */
+#define IO_DEFAULT_SAMPLE_RATE 250
+
+/* Input points interpolated per block */
+#define IO_RESAMPLER_BLOCK_POINTS 64
+
+/* Output frames passed per call to emit function */
+#define IO_RESAMPLER_BLOCK_FRAMES 128
+
+enum io_resample_kernel {
+	IO_RESAMPLE_LINEAR = 0,
+	IO_RESAMPLE_CUBIC,
 };
 
 /**
- * io_input_ops - input functions provided by module
- * @wait: waits for input from source (return false when stopped by stop_wait)
- * @read: reads input from source (must be non-blocking)
- * @stop_wait: stops wait that was previously issued (return false on error)
+ * io_resampler_emit_t - receives @num_frames frames of resampler output
  */
-struct io_input_ops {
-	int (*read)(struct io_input *input, int *error);
-	enum io_input_wait_ret (*wait)(struct io_input *input);
-	bool (*stop_wait)(struct io_input *input);
-	bool (*destroy)(struct io_input *input);
-	bool (*reopen)(struct io_input *input);
-};
+typedef void (*io_resampler_emit_t)(void *opaque, const float *frames,
+				    unsigned int num_frames);
 
-struct io_input {
-	const struct io_input_ops *ops;
-	struct io_parser *parser;
-	struct ds_append_buffer inbuf;
+struct io_resampler {
+	io_resampler_emit_t emit;
+	void *opaque;
+
+	enum io_resample_kernel kernel;
+	unsigned int channels;
+	double interval;
+
+	/*
+	 * Timekeeping is relative to first input point, because absolute
+	 * start time might be large.
+	 */
+	bool started;
+	double start_time;
+	unsigned long long int next_out;
+
+	/* Buffered input points, first unprocessed segment at @first_seg */
+	unsigned int num_points;
+	unsigned int first_seg;
+	double times[IO_RESAMPLER_BLOCK_POINTS];
+	float values[IO_RESAMPLER_BLOCK_POINTS * IO_MAX_CHANNELS];
+
+	unsigned int num_out;
+	float out[IO_RESAMPLER_BLOCK_FRAMES * IO_MAX_CHANNELS];
 };
 
 /**
- * io_input_init - initialize io_input structure
- * @input: input structure to initialize
- * @ops: operators for current input module
- * @parser: bottom of parser stack to use
+ * io_resampler_init - initialize resampler
+ * @rs: resampler to initialize
+ * @rate: output rate in Hz
+ * @kernel: interpolation kernel
+ * @channels: values per input point and output frame
+ * @emit: function receiving output frames
+ * @opaque: passed to @emit
  */
-static inline void io_input_init(struct io_input *input,
-				 const struct io_input_ops *ops,
-				 struct io_parser *parser)
-{
-	ds_append_buffer_init(&input->inbuf);
-	input->ops = ops;
-	input->parser = parser;
-}
+extern void io_resampler_init(struct io_resampler *rs, unsigned int rate,
+			      enum io_resample_kernel kernel,
+			      unsigned int channels, io_resampler_emit_t emit,
+			      void *opaque);
 
 /**
- * io_input_init - free internal io_input structures
+ * io_resampler_reset - drop buffered input, next point starts new stream
  */
-static inline void io_input_free(struct io_input *input)
-{
-	ds_append_buffer_free(&input->inbuf);
-}
+extern void io_resampler_reset(struct io_resampler *rs);
 
 /**
- * io_input_process - process currently available input
+ * io_resampler_push - add input point to resampler
+ * @rs: resampler
+ * @time: time of point in seconds
+ * @values: one value for each channel
+ *
+ * Output is produced when block of input points is full or at
+ * io_resampler_flush().
  */
-extern int io_input_process(struct io_input *input, int *error);
+extern void io_resampler_push(struct io_resampler *rs, double time,
+			      const float *values);
 
 /**
- * io_input_process_loop - processing loop for input
+ * io_resampler_flush - interpolate buffered input points and emit output
+ * @rs: resampler
+ * @final: last point of stream has been pushed, cubic kernel emits tail
+ *	   that would otherwise wait for next point
  */
-extern void io_input_process_loop(struct io_input *input);
+extern void io_resampler_flush(struct io_resampler *rs, bool final);
 
 /**
- * io_input_read - wrapper around input->ops->read, reads data from input to
- *		   input->inbuf.
+ * io_resampler_seek - reset resampler to continue stream at output frame
+ * @rs: resampler
+ * @start_time: time of first input point of stream
+ * @frame: index of next output frame, frame zero is at @start_time
+ *
+ * Output continues as if stream had been resampled from its start, when
+ * input points are pushed starting io_resampler_history() points before
+ * last point for which io_resampler_is_before() is true.
  */
-extern int io_input_read(struct io_input *input, int *error);
+extern void io_resampler_seek(struct io_resampler *rs, double start_time,
+			      unsigned long long frame);
 
 /**
- * io_input_wait - wrapper around input->ops->wait, waits data to become
- *		   available at input
+ * io_resampler_is_before - check if input segment ending at point of @time
+ *			    emits no output after io_resampler_seek()
  */
-extern enum io_input_wait_ret io_input_wait(struct io_input *input);
+extern bool io_resampler_is_before(const struct io_resampler *rs,
+				   double time);
 
 /**
- * io_input_stop_wait - wrapper around input->ops->stop_wait, interrupts
- *			waiting of input in remote thread
+ * io_resampler_history - number of input points interpolation kernel needs
+ *			  before segment
+ */
+extern unsigned int io_resampler_history(const struct io_resampler *rs);
+
+
+/*****************************************************************************
+ * Delta coding kernels
+ *****************************************************************************/
+/*
+ * Block-wise delta encoding and decoding of interleaved frames, vectorized
+ * where available. Results are bit-exact with one value at a time scalar
+ * code. @prev carries last frame between blocks of same stream, start
+ * stream with zeroed @prev.
  */
-extern bool io_input_stop_wait(struct io_input *input);
 
 /**
- * io_input_destroy - wrapper around input->ops->destroy, frees internal
- *		      io_input structures
+ * io_delta_encode - adjacent difference of interleaved frames
+ * @deltas: @num_frames * @channels differences are stored here, must not
+ *	    overlap @values
+ * @values: interleaved frames
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last frame of @values
  */
-extern bool io_input_destroy(struct io_input *input);
+extern void io_delta_encode(float *deltas, const float *values,
+			    unsigned int num_frames, unsigned int channels,
+			    float *prev);
 
 /**
- * io_input_reopen - wrapper around input->ops->reopen, reopens input source
+ * io_delta_decode - prefix sum of interleaved delta frames, in place
+ * @values: @num_frames * @channels deltas, replaced with values
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last decoded frame
+ *
+ * Float sums keep stream order of each channel, only frames of four or more
+ * channels are vectorized.
  */
-extern bool io_input_reopen(struct io_input *input);
+extern void io_delta_decode(float *values, unsigned int num_frames,
+			    unsigned int channels, float *prev);
+
+/**
+ * io_delta_encode_fixed - adjacent difference of interleaved fixed-point
+ *			   frames, wrapping around at 32 bits
+ */
+extern void io_delta_encode_fixed(int32_t *deltas, const int32_t *values,
+				  unsigned int num_frames,
+				  unsigned int channels, int32_t *prev);
+
+/**
+ * io_delta_decode_fixed - prefix sum of interleaved fixed-point delta
+ *			   frames, in place, wrapping around at 32 bits
+ */
+extern void io_delta_decode_fixed(int32_t *values, unsigned int num_frames,
+				  unsigned int channels, int32_t *prev);
+
 
-
 /*****************************************************************************
- * Generic file descriptor input module
+ * Text parser
  *****************************************************************************/
+/*
+ * Final parser for text-format ECG data (top of parser stack, input from
+ * bottom)
+ */
 
-typedef int (*io_generic_fd_open)(struct io_input *io, void *priv);
-typedef bool (*io_generic_fd_close)(struct io_input *io, void *priv);
+/**
+ * io_new_text_parser - allocate and initialize new EGC text parser
+ */
+extern struct io_parser *io_new_text_parser(void);
 
 /**
- * io_new_generic_fd_input - allocate and initialize file descriptor input
- *			     module
- * @parser: bottom of parser stack to use
- * @open_func: function for opening/reopening file descriptor
- * @close_func: function for closing file descriptor
- * @priv: private data for open_func
+ * io_load_txt_file - load whole uncompressed text file, parsing chunks of
+ *		      file in parallel
+ * @filename: name of file
+ * @channels: values per output frame
+ * @rate: output rate in Hz, zero for IO_DEFAULT_SAMPLE_RATE
+ * @kernel: interpolation kernel used for resampling to @rate
+ * @num_threads: number of parser threads, zero for number of CPUs
+ * @num_frames: number of loaded frames is stored here
+ *
+ * File is split to chunks at newlines and chunks are parsed by workqueue
+ * tasks. Delta-decoding and resampling state is carried over chunk seams
+ * when parsed points are merged in file order. Frames are same as text
+ * parser passes to context for first input stream of file, before rounding
+ * of context queue. Returns interleaved frames to be freed with free(), or
+ * NULL on error.
  */
-extern struct io_input *io_new_generic_fd_input(struct io_parser *parser,
-						io_generic_fd_open open_func,
-						io_generic_fd_close close_func,
-						void *priv);
+extern float *io_load_txt_file(const char *filename, unsigned int channels,
+			       unsigned int rate,
+			       enum io_resample_kernel kernel,
+			       unsigned int num_threads,
+			       unsigned int *num_frames);
+
 
-
 /*****************************************************************************
- * File input module
+ * Binary sample file parser
  *****************************************************************************/
 /*
- * Simple file input module
+ * Final parser for binary sample files. All fields are little-endian.
+ *
+ * Header, IO_BIN_HEADER_LEN bytes:
+ *   magic "ECGB", version (u8), encoding (u8, enum io_bin_encoding),
+ *   channels (u8), reserved (u8), sample rate in Hz (u32), scale (u32)
+ *
+ * Followed by blocks of IO_BIN_BLOCK_HEADER_LEN bytes header:
+ *   number of frames (u32), payload length in bytes (u32)
+ * and payload with values of frames in channel interleaved order. Fixed-point
+ * values are value * scale. Delta coded blocks store each value as zigzag
+ * varint of difference to previous fixed-point value of same channel,
+ * starting from zero in each block.
  */
 
+#define IO_BIN_MAGIC "ECGB"
+#define IO_BIN_VERSION 1
+#define IO_BIN_HEADER_LEN 16
+#define IO_BIN_BLOCK_HEADER_LEN 8
+
+/* Fixed-point scale used by io_save_bin_file(), two decimals */
+#define IO_BIN_DEFAULT_SCALE 100
+
+/* Frames per block written by io_save_bin_file() */
+#define IO_BIN_BLOCK_FRAMES 1024
+
+/* Largest block accepted by parser */
+#define IO_BIN_MAX_BLOCK_FRAMES 4096
+
+enum io_bin_encoding {
+	IO_BIN_INT16 = 1,	/* fixed-point int16 */
+	IO_BIN_FLOAT32,		/* IEEE float32 */
+	IO_BIN_DELTA_VARINT,	/* fixed-point deltas, zigzag varints */
+};
+
 /**
- * io_new_file_input - allocate and initialize file input module
- * @parser: bottom of parser stack to use
- * @filename: file to open for input
+ * io_new_bin_parser - allocate and initialize new binary sample file parser
+ *
+ * Channels of file are mapped to channels of context, missing channels are
+ * zero. Input at sample rate other than output rate of context is resampled.
  */
-extern struct io_input *io_new_file_input(struct io_parser *parser,
-					  const char *filename);
+extern struct io_parser *io_new_bin_parser(void);
 
 
 /*****************************************************************************
- * External input module
+ * gzip file parser/decompressor
  *****************************************************************************/
 
-/*
- * Input module for external input, for example from Bluetooth/device-driver in
- * ObjC.
- * New data is pushed from ObjC/driver using io_external_input_push_data(). For
- * examples, see test-unit source-code.
- */
+/* Default size of decompression output window */
+#define IO_GZ_DEFAULT_WINDOW_LEN (32 * 1024)
 
 /**
- * io_new_external_input - allocate and initialize external input module
- * @parser: bottom of parser stack to use
+ * io_new_gz_parser - allocate and initialize new GZ parser
  */
-extern struct io_input *io_new_external_input(struct io_parser *parser);
+extern struct io_parser *io_new_gz_parser(struct io_parser *child);
 
 /**
- * io_external_input_push_data - push new data to input system
- * @ext_input: input structure allocated with io_new_external_input()
- * @buf: buffer with new data
- * @buflen: length of buffer in bytes
+ * io_new_gz_parser_sized - allocate and initialize new GZ parser with output
+ *			    window size
+ * @child: parser receiving decompressed data
+ * @window_len: size of decompression output window, limited to
+ *		DS_APPEND_BUFFER_MIN_PIECE_LEN...DS_APPEND_BUFFER_MAX_PIECE_LEN
  *
- * Returns number of bytes pushed (returns < buflen when out of memory).
+ * Data is inflated directly to @window_len pieces passed to @child.
  */
-extern int io_external_input_push_data(struct io_input *ext_input, void *buf,
-				       unsigned int buflen);
+extern struct io_parser *io_new_gz_parser_sized(struct io_parser *child,
+						unsigned int window_len);
+
 
 
 /*****************************************************************************
- * File saving support
+ * Pipelined parser stage
  *****************************************************************************/
-/**
- * io_save_txt_file - save @values to file with name @filename, using text
+/*
+ * Pipe parser runs child parser stack in own thread, so that stacked parsers
+ * can be split over cores, for example
+ *
+ *   io_new_gz_parser(io_new_pipe_parser(io_new_text_parser(), 0))
+ *
+ * inflates in input thread and parses text in pipe thread. Input buffer
+ * pieces of parent are moved to pipe as whole, without copying. Parent is
+ * stopped with IO_PARSER_RET_QUEUE_FULL when pipe is full and child is
+ * waiting for room in values queue, io_parser_wait_queue() waits for room in
+ * pipe. Parse with @final set returns after child has handled end of stream.
+ *
+ * Child is run in pipe thread when values go to sink or to context doing IO
+ * in IO thread or event loop (see io_context_queue_is_shared()), otherwise
+ * in caller thread as without pipe. Child errors are returned by next parse.
+ */
+
+/* Default number of input buffers queued to pipe thread */
+#define IO_PIPE_DEFAULT_QUEUE_LEN 8
+
+/**
+ * io_new_pipe_parser - allocate and initialize new pipe parser, running
+ *			@child in own thread
+ * @child: parser receiving input of pipe
+ * @queue_len: input buffers queued to @child before parent is stopped,
+ *	       zero for IO_PIPE_DEFAULT_QUEUE_LEN
+ */
+extern struct io_parser *io_new_pipe_parser(struct io_parser *child,
+					    unsigned int queue_len);
+
+
+/*****************************************************************************
+ * gzip random access index
+ *****************************************************************************/
+/*
+ * Access points of gzip compressed file, every span bytes of uncompressed
+ * data at deflate block boundary. Each point keeps 32 KiB of preceding data
+ * as inflate window, so that decompression can be started from point
+ * instead of start of file. Index is saved next to file, with
+ * IO_GZ_INDEX_SUFFIX appended to filename.
+ *
+ * For seeking by samples, points also record start of first complete line
+ * after point and number of lines before it.
+ */
+
+#define IO_GZ_INDEX_WINDOW_LEN (32 * 1024)
+#define IO_GZ_INDEX_DEFAULT_SPAN (1024 * 1024)
+#define IO_GZ_INDEX_SUFFIX ".idx"
+
+/* private structure, defined in io_gz_index.c */
+struct io_gz_index;
+
+struct io_gz_access_point {
+	/* offset of first compressed byte of point in file */
+	unsigned long long in;
+	/* number of bits of byte before @in that belong to point, 0 to 7 */
+	unsigned int bits;
+	/* offset of point in uncompressed data */
+	unsigned long long out;
+	/* uncompressed offset of first line starting at or after @out */
+	unsigned long long line_start;
+	/* number of lines before @line_start */
+	unsigned long long line;
+};
+
+/**
+ * io_gz_index_build - build index by decompressing whole gzip file
+ * @filename: name of gzip file
+ * @span: uncompressed bytes between access points, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Concatenated members are indexed as one stream, trailing garbage after
+ * last member is ignored. Returns NULL on error.
+ */
+extern struct io_gz_index *io_gz_index_build(const char *filename,
+					     unsigned int span);
+
+/**
+ * io_gz_index_save - save index next to gzip file
+ * @index: index of file
+ * @filename: name of gzip file, index is saved to filename with
+ *	      IO_GZ_INDEX_SUFFIX appended
+ */
+extern bool io_gz_index_save(const struct io_gz_index *index,
+			     const char *filename);
+
+/**
+ * io_gz_index_load - load index saved next to gzip file
+ * @filename: name of gzip file
+ *
+ * Returns NULL if index file is missing or invalid, or if it was built for
+ * different contents of @filename.
+ */
+extern struct io_gz_index *io_gz_index_load(const char *filename);
+
+/**
+ * io_gz_index_open - load index of gzip file, or build and save it if file
+ *		      has no valid index yet
+ * @filename: name of gzip file
+ * @span: access point span used when index is built, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Failure to save built index (for example, read-only directory) is not an
+ * error.
+ */
+extern struct io_gz_index *io_gz_index_open(const char *filename,
+					    unsigned int span);
+
+/**
+ * io_gz_index_free - free index
+ */
+extern void io_gz_index_free(struct io_gz_index *index);
+
+/**
+ * io_gz_index_num_points - number of access points of index
+ */
+extern unsigned int io_gz_index_num_points(const struct io_gz_index *index);
+
+/**
+ * io_gz_index_length - length of uncompressed data of indexed file
+ */
+extern unsigned long long io_gz_index_length(const struct io_gz_index *index);
+
+/**
+ * io_gz_index_num_lines - number of newlines in uncompressed data of
+ *			   indexed file
+ */
+extern unsigned long long
+		io_gz_index_num_lines(const struct io_gz_index *index);
+
+/**
+ * io_gz_index_get_point - get access point @i of index
+ *
+ * Returns false if @i is out of range.
+ */
+extern bool io_gz_index_get_point(const struct io_gz_index *index,
+				  unsigned int i,
+				  struct io_gz_access_point *point);
+
+/**
+ * io_gz_index_find_offset - find last access point at or before uncompressed
+ *			     @offset
+ */
+extern unsigned int io_gz_index_find_offset(const struct io_gz_index *index,
+					    unsigned long long offset);
+
+/**
+ * io_gz_index_find_line - find last access point with line start at or
+ *			   before line @line
+ */
+extern unsigned int io_gz_index_find_line(const struct io_gz_index *index,
+					  unsigned long long line);
+
+/**
+ * io_gz_index_get_window - get inflate window of access point
+ * @index: index
+ * @i: access point
+ * @window: IO_GZ_INDEX_WINDOW_LEN bytes buffer
+ *
+ * Raw inflate started from point is primed with bits of byte before
+ * point and with window as dictionary. Returns length of window, which may
+ * be zero, or -1 on error.
+ */
+extern int io_gz_index_get_window(const struct io_gz_index *index,
+				  unsigned int i, unsigned char *window);
+
+/**
+ * io_gz_index_read - read uncompressed data of indexed gzip file
+ * @index: index of file
+ * @fd: file descriptor of gzip file, file position is not changed
+ * @offset: offset in uncompressed data
+ * @buf: buffer for data
+ * @len: number of bytes to read
+ *
+ * Inflates from closest access point before @offset, at most span of index
+ * is decompressed and discarded. Returns number of bytes read, less than
+ * @len at end of data, or -1 on error.
+ */
+extern int io_gz_index_read(const struct io_gz_index *index, int fd,
+			    unsigned long long offset, void *buf,
+			    unsigned int len);
+
+/*
+ * Building index while writing compressed stream. Uncompressed data is
+ * passed in stream order, points are added at deflate block boundaries.
+ */
+
+/**
+ * io_gz_index_alloc - allocate empty index
+ * @span: uncompressed bytes between access points, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ */
+extern struct io_gz_index *io_gz_index_alloc(unsigned int span);
+
+/**
+ * io_gz_index_add_data - pass uncompressed data to index in stream order
+ * @index: index being built
+ * @data: uncompressed data
+ * @len: length of @data
+ */
+extern void io_gz_index_add_data(struct io_gz_index *index, const void *data,
+				 unsigned int len);
+
+/**
+ * io_gz_index_needs_point - check if span has been reached since last access
+ *			     point
+ */
+extern bool io_gz_index_needs_point(const struct io_gz_index *index);
+
+/**
+ * io_gz_index_add_point - add access point at current uncompressed position
+ * @index: index being built
+ * @in: offset of first compressed byte of point in file
+ * @bits: number of bits of byte before @in that belong to point, 0 to 7
+ *
+ * Compressed stream must be at deflate block boundary. Window of point is
+ * data passed with io_gz_index_add_data() since start of member.
+ */
+extern bool io_gz_index_add_point(struct io_gz_index *index,
+				  unsigned long long in, unsigned int bits);
+
+/**
+ * io_gz_index_finish - resolve line starts of access points after all data
+ *			has been passed to index
+ *
+ * Must be called before index is saved or used for lookups.
+ */
+extern void io_gz_index_finish(struct io_gz_index *index);
+
+
+/*****************************************************************************
+ * Modular input subsystem
+ *****************************************************************************/
+struct io_input;
+
+enum io_input_wait_ret {
+	IO_INPUT_WAIT_NEW = 0,
+	IO_INPUT_WAIT_STOP,
+	IO_INPUT_WAIT_ERROR
+};
+
+/**
+ * io_input_ops - input functions provided by module
+ * @wait: waits for input from source (return false when stopped by stop_wait)
+ * @read: reads input from source (must be non-blocking)
+ * @stop_wait: stops wait that was previously issued (return false on error)
+ * @get_fd: returns file descriptor that becomes readable on new input, for
+ *	    event loop (optional, return -1 if none)
+ */
+struct io_input_ops {
+	int (*read)(struct io_input *input, int *error);
+	enum io_input_wait_ret (*wait)(struct io_input *input);
+	bool (*stop_wait)(struct io_input *input);
+	bool (*destroy)(struct io_input *input);
+	bool (*reopen)(struct io_input *input);
+	int (*get_fd)(struct io_input *input);
+	bool (*seek_time)(struct io_input *input, double seconds);
+};
+
+/**
+ * io_input_stats - counters of input, updated with io_stats_add()
+ * @reads: number of reads that returned new data
+ * @bytes_in: bytes read from source
+ * @reopens: number of times input has been reopened
+ */
+struct io_input_stats {
+	unsigned long long reads;
+	unsigned long long bytes_in;
+	unsigned long long reopens;
+};
+
+struct io_input {
+	const struct io_input_ops *ops;
+	struct io_parser *parser;
+	struct ds_append_buffer inbuf;
+	bool parser_queue_full;
+	struct io_input_stats stats;
+};
+
+/**
+ * io_input_init - initialize io_input structure
+ * @input: input structure to initialize
+ * @ops: operators for current input module
+ * @parser: bottom of parser stack to use
+ */
+static inline void io_input_init(struct io_input *input,
+				 const struct io_input_ops *ops,
+				 struct io_parser *parser)
+{
+	/* Let read windows grow, parsers consume input span by span */
+	ds_append_buffer_init_sized(&input->inbuf,
+				    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	input->ops = ops;
+	input->parser = parser;
+	input->parser_queue_full = false;
+	memset(&input->stats, 0, sizeof(input->stats));
+}
+
+/**
+ * io_input_init - free internal io_input structures
+ */
+static inline void io_input_free(struct io_input *input)
+{
+	ds_append_buffer_free(&input->inbuf);
+}
+
+/**
+ * io_input_process - process currently available input
+ */
+extern int io_input_process(struct io_input *input, int *error);
+
+/**
+ * io_input_process_loop - processing loop for input
+ */
+extern void io_input_process_loop(struct io_input *input);
+
+/**
+ * io_input_read - wrapper around input->ops->read, reads data from input to
+ *		   input->inbuf.
+ */
+extern int io_input_read(struct io_input *input, int *error);
+
+/**
+ * io_input_wait - wrapper around input->ops->wait, waits data to become
+ *		   available at input
+ */
+extern enum io_input_wait_ret io_input_wait(struct io_input *input);
+
+/**
+ * io_input_stop_wait - wrapper around input->ops->stop_wait, interrupts
+ *			waiting of input in remote thread
+ */
+extern bool io_input_stop_wait(struct io_input *input);
+
+/**
+ * io_input_destroy - wrapper around input->ops->destroy, frees internal
+ *		      io_input structures
+ */
+extern bool io_input_destroy(struct io_input *input);
+
+/**
+ * io_input_reopen - wrapper around input->ops->reopen, reopens input source
+ */
+extern bool io_input_reopen(struct io_input *input);
+
+/**
+ * io_input_get_fd - wrapper around input->ops->get_fd, returns pollable file
+ *		     descriptor of input or -1
+ */
+extern int io_input_get_fd(struct io_input *input);
+
+/**
+ * io_input_seek_time - wrapper around input->ops->seek_time, moves input to
+ *			time of stream
+ * @input: input, must not be processed by other threads during seek
+ * @seconds: time from start of stream, first value returned after seek is
+ *	     at or after this time
+ *
+ * Only inputs with random access (regular files) can be seeked. Buffered
+ * input is dropped. See io_parser_seek_time() for handling of failure.
+ */
+extern bool io_input_seek_time(struct io_input *input, double seconds);
+
+
+/*****************************************************************************
+ * Generic file descriptor input module
+ *****************************************************************************/
+
+typedef int (*io_generic_fd_open)(struct io_input *io, void *priv);
+typedef bool (*io_generic_fd_close)(struct io_input *io, void *priv);
+
+/**
+ * io_new_generic_fd_input - allocate and initialize file descriptor input
+ *			     module
+ * @parser: bottom of parser stack to use
+ * @open_func: function for opening/reopening file descriptor
+ * @close_func: function for closing file descriptor
+ * @priv: private data for open_func
+ */
+extern struct io_input *io_new_generic_fd_input(struct io_parser *parser,
+						io_generic_fd_open open_func,
+						io_generic_fd_close close_func,
+						void *priv);
+
+
+/*****************************************************************************
+ * Event loop input driver
+ *****************************************************************************/
+/*
+ * Event loop reads and parses inputs of many contexts on small pool of worker
+ * threads, using single epoll instance. Contexts are attached with
+ * io_context_set_event_loop().
+ */
+struct io_event_loop;
+struct io_event_source;
+
+/* Maximum number of worker threads of event loop */
+#define IO_EVENT_LOOP_MAX_THREADS 64
+
+/**
+ * io_event_loop_alloc - allocate event loop and start worker threads
+ * @num_threads: number of worker threads, zero for number of CPUs
+ */
+extern struct io_event_loop *io_event_loop_alloc(unsigned int num_threads);
+
+/**
+ * io_event_loop_free - stop worker threads and free event loop
+ * @loop: event loop, inputs of all contexts using @loop must be closed
+ */
+extern void io_event_loop_free(struct io_event_loop *loop);
+
+/**
+ * io_event_loop_add - register input of context to event loop (internal)
+ *
+ * Returns NULL if @input can not be driven by event loop.
+ */
+extern struct io_event_source *io_event_loop_add(struct io_event_loop *loop,
+						 struct io_context *ctx,
+						 struct io_input *input);
+
+/**
+ * io_event_loop_remove - unregister and free event source (internal)
+ */
+extern void io_event_loop_remove(struct io_event_source *src);
+
+/**
+ * io_event_loop_resume - continue parked source after values have been
+ *			  dequeued from its context (internal)
+ */
+extern void io_event_loop_resume(struct io_event_source *src);
+
+
+/*****************************************************************************
+ * Pacing scheduler
+ *****************************************************************************/
+/*
+ * Pacing scheduler releases paced consumers of many contexts from single
+ * thread, using hashed timer wheel on monotonic clock. Deadlines are rounded
+ * up to scheduler tick, so consumers due on same tick are released by one
+ * wake-up. Contexts are attached with io_context_set_pacer().
+ */
+struct io_pacer;
+
+/* Default resolution of pacing scheduler */
+#define IO_PACER_DEFAULT_TICK_US 250
+
+/* Slots of timer wheel, power of two */
+#define IO_PACER_WHEEL_SLOTS 256
+
+/**
+ * io_pacer_stats - snapshot of statistics of pacing scheduler
+ * @tick_ns: resolution of scheduler
+ * @pending: sleepers currently waiting for release
+ * @wakeups: timed wake-ups of pacer thread
+ * @releases: sleepers released
+ * @max_batch: most sleepers released by single wake-up
+ * @drift_ns: total time pacer thread woke up after its scheduled tick
+ * @max_drift_ns: largest single wake-up drift
+ * @overshoot_ns: total time sleepers resumed after their deadline
+ * @max_overshoot_ns: largest single overshoot
+ */
+struct io_pacer_stats {
+	unsigned long long tick_ns;
+	unsigned int pending;
+	unsigned long long wakeups;
+	unsigned long long releases;
+	unsigned long long max_batch;
+	unsigned long long drift_ns;
+	unsigned long long max_drift_ns;
+	unsigned long long overshoot_ns;
+	unsigned long long max_overshoot_ns;
+};
+
+/**
+ * io_pacer_alloc - allocate pacing scheduler and start its thread
+ * @tick_us: resolution of scheduler in microseconds, zero for
+ *	     IO_PACER_DEFAULT_TICK_US
+ */
+extern struct io_pacer *io_pacer_alloc(unsigned int tick_us);
+
+/**
+ * io_pacer_free - stop pacer thread and free pacing scheduler
+ * @pacer: pacing scheduler, contexts using @pacer must be freed or detached
+ *	   first
+ */
+extern void io_pacer_free(struct io_pacer *pacer);
+
+/**
+ * io_pacer_sleep_until - block until pacer releases caller
+ * @pacer: pacing scheduler
+ * @deadline_ns: time of monotonic clock, see io_get_monotonic_ns()
+ *
+ * Caller is released on first tick at or after @deadline_ns. Returns
+ * immediately if @deadline_ns has passed.
+ */
+extern void io_pacer_sleep_until(struct io_pacer *pacer,
+				 unsigned long long deadline_ns);
+
+/**
+ * io_pacer_get_stats - take snapshot of statistics of pacing scheduler
+ * @pacer: pacing scheduler
+ * @stats: snapshot is stored here
+ */
+extern void io_pacer_get_stats(struct io_pacer *pacer,
+			       struct io_pacer_stats *stats);
+
+
+/*****************************************************************************
+ * File input module
+ *****************************************************************************/
+/*
+ * Simple file input module
+ */
+
+/* Length of reads done by file input for regular files */
+#define IO_FILE_INPUT_CHUNK_LEN (128 * 1024)
+
+/**
+ * io_new_file_input - allocate and initialize file input module
+ * @parser: bottom of parser stack to use
+ * @filename: file to open for input
+ *
+ * Regular files are read in IO_FILE_INPUT_CHUNK_LEN chunks passed to parser
+ * without copying, with sequential kernel readahead.
+ */
+extern struct io_input *io_new_file_input(struct io_parser *parser,
+					  const char *filename);
+
+
+/*****************************************************************************
+ * Memory mapped file input module
+ *****************************************************************************/
+/*
+ * Input module mapping whole file to memory. Mapped pages are passed to
+ * parser as external pieces of input buffer, without read() copies.
+ */
+
+/* Maximum unparsed mapped input passed to parser at once */
+#define IO_MMAP_INPUT_CHUNK_LEN (256 * 1024)
+
+/**
+ * io_new_mmap_file_input - allocate and initialize memory mapped file input
+ *			    module
+ * @parser: bottom of parser stack to use
+ * @filename: file to map for input
+ */
+extern struct io_input *io_new_mmap_file_input(struct io_parser *parser,
+					       const char *filename);
+
+
+/*****************************************************************************
+ * External input module
+ *****************************************************************************/
+
+/*
+ * Input module for external input, for example from Bluetooth/device-driver in
+ * ObjC.
+ * New data is pushed from ObjC/driver using io_external_input_push_data(). For
+ * examples, see test-unit source-code.
+ */
+
+/**
+ * io_new_external_input - allocate and initialize external input module
+ * @parser: bottom of parser stack to use
+ */
+extern struct io_input *io_new_external_input(struct io_parser *parser);
+
+/**
+ * io_external_input_set_watermarks - limit amount of pushed, unread data
+ * @ext_input: input structure allocated with io_new_external_input()
+ * @high_bytes: pushing stops when this much data is buffered, zero for no
+ *		limit
+ * @low_bytes: blocked pushing continues when buffered data drops to this
+ * @block: if true, pushers block until there is room, otherwise pushes are
+ *	   short
+ *
+ * Returns false if @low_bytes is larger than @high_bytes.
+ */
+extern bool io_external_input_set_watermarks(struct io_input *ext_input,
+					     unsigned int high_bytes,
+					     unsigned int low_bytes,
+					     bool block);
+
+/**
+ * io_external_input_push_data - push new data to input system
+ * @ext_input: input structure allocated with io_new_external_input()
+ * @buf: buffer with new data
+ * @buflen: length of buffer in bytes
+ *
+ * Returns number of bytes pushed (returns < buflen when out of memory, when
+ * high watermark is reached and pushing does not block, or when input is
+ * closed while blocked).
+ */
+extern int io_external_input_push_data(struct io_input *ext_input, void *buf,
+				       unsigned int buflen);
+
+/**
+ * io_external_input_push_buffer - push memory owned by caller to input system
+ *				   without copying
+ * @ext_input: input structure allocated with io_new_external_input()
+ * @buf: buffer with new data, must stay valid until @release is called
+ * @buflen: length of buffer in bytes
+ * @release: called when input no longer references @buf, can be NULL
+ * @opaque: passed to @release
+ *
+ * Buffer is pushed whole when there is any room below high watermark.
+ * Returns false when out of memory, when high watermark is reached and
+ * pushing does not block, or when input is closed while blocked. @release is
+ * not called in that case.
+ */
+extern bool io_external_input_push_buffer(struct io_input *ext_input,
+					  void *buf, unsigned int buflen,
+					  ds_append_buffer_release_t release,
+					  void *opaque);
+
+
+/*****************************************************************************
+ * File saving support
+ *****************************************************************************/
+/**
+ * io_save_txt_file - save @values to file with name @filename, using text
  *		      formating
  * @filename: filename to use
  * @values: data points to save (ecg data, 4ms intervals, 250pps)
  * @num_values: number of values
  *
- * Text format contains each data point on new line. Each data point is
- * presented as floating-point with two desimals.
+ * Text format contains each data point on new line. Each data point is
+ * presented as floating-point with two desimals.
+ *
+ * Example file:
+ *  1.000
+ *  2.000
+ *  2.110
+ *  0.220
+ *  0.230
+ *  0.260
+ *
+ * Data can also be saved delta-encoded, where first data point is saved as such
+ * and following numbers are stored as delta of previous value. First line of
+ * file will be "#deltaenc" for detection.
+ * 
+ * Above example file as delta-encoded:
+ *  #deltaenc
+ *  1.000
+ *  1.000
+ *  0.110
+ *  -1.890
+ *  0.010
+ *  0.030
+ */
+extern bool io_save_txt_file(const char *filename, float *values,
+			     unsigned int num_values);
+
+/**
+ * io_save_gz_txt_file - save @values to file with name @filename, using text
+ *			 formating and gzip compression.
+ * @filename: filename to use
+ * @values: data points to save (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Text format is same as with io_save_txt_file()
+ */
+extern bool io_save_gz_txt_file(const char *filename, float *values,
+				unsigned int num_values);
+
+/* Maximum number of compression threads of io_save_gz_txt_file_parallel() */
+#define IO_SAVE_GZ_MAX_THREADS 16
+
+/**
+ * io_save_gz_txt_file_parallel - save @values to file with name @filename,
+ *				  using text formating and gzip compression on
+ *				  worker threads.
+ * @filename: filename to use
+ * @values: data points to save (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ * @level: compression level 1 to 9, or -1 for zlib default
+ * @num_threads: number of compression threads, zero for number of CPUs
+ *
+ * Text format is same as with io_save_txt_file(). Text is compressed in
+ * 128 KiB blocks in parallel, result is standard single member gzip file.
+ */
+extern bool io_save_gz_txt_file_parallel(const char *filename, float *values,
+					 unsigned int num_values, int level,
+					 unsigned int num_threads);
+
+/**
+ * io_save_gz_txt_file_indexed - save @values to file with name @filename,
+ *				 using text formating and gzip compression,
+ *				 and save random access index next to file.
+ * @filename: filename to use
+ * @values: data points to save (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ * @index_span: uncompressed bytes between access points, zero for
+ *		IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Text format is same as with io_save_txt_file(). File is compressed at
+ * best compression level on worker threads, see
+ * io_save_gz_txt_file_parallel(). Index is saved to filename with
+ * IO_GZ_INDEX_SUFFIX appended.
+ */
+extern bool io_save_gz_txt_file_indexed(const char *filename, float *values,
+					unsigned int num_values,
+					unsigned int index_span);
+
+/*
+ * Streaming saving. Values are appended in any number of calls, formatted
+ * text is written out (and compressed) by background thread while caller
+ * continues. Amount of pending text is bounded, appending blocks when writer
+ * thread falls behind.
+ */
+struct io_saver;
+
+/**
+ * io_saver_open_txt - open streaming saver, output same as io_save_txt_file
+ * @filename: filename to use
+ *
+ * Returns NULL on error.
+ */
+extern struct io_saver *io_saver_open_txt(const char *filename);
+
+/**
+ * io_saver_open_gz_txt - open streaming saver, output same as
+ *			  io_save_gz_txt_file
+ * @filename: filename to use
+ *
+ * Returns NULL on error.
+ */
+extern struct io_saver *io_saver_open_gz_txt(const char *filename);
+
+/**
+ * io_saver_open_gz_txt_parallel - open streaming saver, output same as
+ *				   io_save_gz_txt_file_parallel
+ * @filename: filename to use
+ * @level: compression level 1 to 9, or -1 for zlib default
+ * @num_threads: number of compression threads, zero for number of CPUs
+ *
+ * Returns NULL on error.
+ */
+extern struct io_saver *io_saver_open_gz_txt_parallel(const char *filename,
+						      int level,
+						      unsigned int num_threads);
+
+/**
+ * io_saver_open_gz_txt_indexed - open streaming saver like
+ *				  io_saver_open_gz_txt_parallel, also saving
+ *				  random access index of file
+ * @filename: filename to use
+ * @level: compression level 1 to 9, or -1 for zlib default
+ * @num_threads: number of compression threads, zero for number of CPUs
+ * @index_span: uncompressed bytes between access points, zero for no index
+ *
+ * Index is saved at io_saver_close(), see io_gz_index_load(). Access points
+ * are at starts of 128 KiB compression blocks, so span is rounded up to
+ * block size.
+ *
+ * Returns NULL on error.
+ */
+extern struct io_saver *io_saver_open_gz_txt_indexed(const char *filename,
+						     int level,
+						     unsigned int num_threads,
+						     unsigned int index_span);
+
+/**
+ * io_saver_append - append @values to file
+ * @saver: saver
+ * @values: data points to append (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Returns false if saving has failed, on this or earlier call.
+ */
+extern bool io_saver_append(struct io_saver *saver, const float *values,
+			    unsigned int num_values);
+
+/**
+ * io_saver_append_i16 - append int16 fixed-point @values to file
+ *
+ * See io_saver_append().
+ */
+extern bool io_saver_append_i16(struct io_saver *saver, const int16_t *values,
+				unsigned int num_values);
+
+/**
+ * io_saver_get_sink - get sink appending blocks of parser stack to file
+ * @saver: saver
+ *
+ * First channel of each frame is saved.
+ */
+extern struct io_sink *io_saver_get_sink(struct io_saver *saver);
+
+/**
+ * io_saver_flush - pass appended values to writer thread, without waiting
+ * @saver: saver
+ */
+extern void io_saver_flush(struct io_saver *saver);
+
+/**
+ * io_saver_close - write remaining values, close file and free @saver
+ * @saver: saver
+ *
+ * Returns false if any write failed.
+ */
+extern bool io_saver_close(struct io_saver *saver);
+
+/**
+ * io_save_bin_file - save frames to binary sample file with name @filename
+ * @filename: filename to use
+ * @frames: frames to save, @channels values each
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @sample_rate: sample rate of frames in Hz
+ * @encoding: encoding of values
+ *
+ * Fixed-point encodings use IO_BIN_DEFAULT_SCALE, int16 values outside of
+ * range are saturated. See io_new_bin_parser() for file format.
+ */
+extern bool io_save_bin_file(const char *filename, const float *frames,
+			     unsigned int num_frames, unsigned int channels,
+			     unsigned int sample_rate,
+			     enum io_bin_encoding encoding);
+
+/**
+ * io_save_bin_file_i16 - save int16 fixed-point frames to binary sample file
+ *			  with name @filename
+ *
+ * See io_save_bin_file(). Fixed-point encodings store @frames losslessly, as
+ * IO_BIN_DEFAULT_SCALE equals IO_SAMPLE_INT16_SCALE.
+ */
+extern bool io_save_bin_file_i16(const char *filename, const int16_t *frames,
+				 unsigned int num_frames,
+				 unsigned int channels,
+				 unsigned int sample_rate,
+				 enum io_bin_encoding encoding);
+
+
+/*****************************************************************************
+ * Network streaming output
+ *****************************************************************************/
+/*
+ * Streamer encodes each batch of values once as "%.02f\n" data lines to
+ * shared frame and sends frame to all subscribers with non-blocking sockets.
+ * Frames waiting for room in socket of slow TCP subscriber are queued and
+ * written with next send or io_streamer_flush(), up to limit after which
+ * drop policy of subscriber is applied.
+ */
+struct io_streamer;
+
+/* Frames queued for TCP subscriber by default */
+#define IO_STREAMER_DEFAULT_MAX_QUEUED 64
+
+/* Values encoded to one frame at most, larger batches are split */
+#define IO_STREAMER_MAX_FRAME_VALUES 512
+
+enum io_stream_drop_policy {
+	IO_STREAM_DROP_OLDEST = 0,	/* drop oldest queued frame */
+	IO_STREAM_DROP_NEWEST,		/* drop new frame */
+	IO_STREAM_DISCONNECT,		/* remove subscriber */
+};
+
+/**
+ * io_stream_stats - counters of subscriber
+ * @bytes_sent: bytes written to socket
+ * @frames_sent: frames written fully
+ * @dropped_frames: frames dropped because of full queue or socket buffer
+ * @queued_frames: frames currently waiting for room in socket
+ * @error: errno of latest send error, zero if none
+ */
+struct io_stream_stats {
+	unsigned long long bytes_sent;
+	unsigned long long frames_sent;
+	unsigned long long dropped_frames;
+	unsigned int queued_frames;
+	int error;
+};
+
+/**
+ * io_streamer_alloc - allocate streamer without subscribers
+ */
+extern struct io_streamer *io_streamer_alloc(void);
+
+/**
+ * io_streamer_free - remove all subscribers and free streamer
+ */
+extern void io_streamer_free(struct io_streamer *streamer);
+
+/**
+ * io_streamer_add_tcp - add connected stream socket as subscriber
+ * @streamer: streamer
+ * @fd: connected socket, streamer takes ownership and sets it non-blocking
+ * @policy: handling of new frames when @max_queued frames are waiting
+ * @max_queued: frames queued for slow subscriber, zero for
+ *		IO_STREAMER_DEFAULT_MAX_QUEUED
+ *
+ * Subscriber is disconnected and its socket closed on send error.
+ *
+ * Returns id of subscriber, or -1 on error. On error @fd is not closed.
+ */
+extern int io_streamer_add_tcp(struct io_streamer *streamer, int fd,
+			       enum io_stream_drop_policy policy,
+			       unsigned int max_queued);
+
+/**
+ * io_streamer_add_udp - add datagram destination as subscriber
+ * @streamer: streamer
+ * @fd: datagram socket used for sending, remains owned by caller and may be
+ *	shared by many subscribers
+ * @addr: destination address
+ * @addrlen: length of @addr
+ *
+ * Each frame is sent as one datagram. Datagrams to subscribers sharing
+ * socket are sent with one sendmmsg(). Datagram that cannot be sent without
+ * blocking is dropped.
+ *
+ * Returns id of subscriber, or -1 on error.
+ */
+extern int io_streamer_add_udp(struct io_streamer *streamer, int fd,
+			       const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * io_streamer_remove - remove subscriber, socket of TCP subscriber is closed
+ *
+ * Returns false if there is no subscriber with @id, for example because it
+ * was disconnected by streamer.
+ */
+extern bool io_streamer_remove(struct io_streamer *streamer, int id);
+
+/**
+ * io_streamer_send - encode @values once and send them to all subscribers
+ * @streamer: streamer
+ * @values: values to send (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Returns false when out of memory.
+ */
+extern bool io_streamer_send(struct io_streamer *streamer, const float *values,
+			     unsigned int num_values);
+
+/**
+ * io_streamer_flush - write frames queued for slow TCP subscribers
+ */
+extern void io_streamer_flush(struct io_streamer *streamer);
+
+/**
+ * io_streamer_get_stats - get counters of subscriber
+ *
+ * Returns false if there is no subscriber with @id.
+ */
+extern bool io_streamer_get_stats(struct io_streamer *streamer, int id,
+				  struct io_stream_stats *stats);
+
+/**
+ * io_streamer_num_subscribers - number of current subscribers
+ */
+extern unsigned int io_streamer_num_subscribers(struct io_streamer *streamer);
+
+/**
+ * io_streamer_get_sink - get sink streaming blocks of parser stack
+ *
+ * First channel of each frame is streamed.
+ */
+extern struct io_sink *io_streamer_get_sink(struct io_streamer *streamer);
+
+
+/*****************************************************************************
+ * IO contexts
+ *****************************************************************************/
+/*
+ * IO context owns input, queue of decoded values and pacing timer of one
+ * stream. Independent contexts do not share locks, so multiple streams can be
+ * decoded in parallel. Global io_main functions operate on io_main_context().
+ */
+
+/*
+ * Default number of values buffered by IO thread before parser is stopped,
+ * see io_context_set_queue_watermarks()
+ */
+#define IO_QUEUE_DEFAULT_HIGH_VALUES 4096
+
+/* Maximum number of consumed frames kept by io_context_set_history() */
+#define IO_MAX_HISTORY_FRAMES (1U << 20)
+
+/* Maximum depth of parser stack reported by io_context_get_stats() */
+#define IO_STATS_MAX_PARSERS 4
+
+/*
+ * Buckets of end-to-end latency histogram. Bucket 0 counts latencies below
+ * 2us and bucket n from 2^n to 2^(n+1) us, last bucket all above.
+ */
+#define IO_STATS_LATENCY_BUCKETS 24
+
+/**
+ * io_stats - snapshot of statistics of context, see io_context_get_stats()
+ * @input: counters of current input
+ * @num_parsers: depth of parser stack of current input
+ * @parser_names: name of each parser, bottom of stack first
+ * @parsers: counters of each parser, bottom of stack first
+ * @values_queued: values pushed to values queue by parsers
+ * @values_consumed: values returned to consumer
+ * @queue_depth: values currently in queue
+ * @queue_max_depth: largest number of values queued at once
+ * @pacing_sleeps: number of paced returns to consumer
+ * @pacing_late_ns: total time paced returns were late from their schedule,
+ *		    sleep overshoot included
+ * @pacing_max_late_ns: largest delay of single paced return
+ * @pacing_overshoot_ns: total time sleeps of consumer lasted past their
+ *			 deadline
+ * @pacing_max_overshoot_ns: largest overshoot of single sleep
+ * @latency: histogram of time from push of values to queue until consumer
+ *	     gets them, enabled with io_context_set_latency_histogram()
+ *
+ * Counters of context accumulate over inputs, counters of input and parsers
+ * are for current input.
+ */
+struct io_stats {
+	struct io_input_stats input;
+	unsigned int num_parsers;
+	const char *parser_names[IO_STATS_MAX_PARSERS];
+	struct io_parser_stats parsers[IO_STATS_MAX_PARSERS];
+
+	unsigned long long values_queued;
+	unsigned long long values_consumed;
+	unsigned long long queue_depth;
+	unsigned long long queue_max_depth;
+
+	unsigned long long pacing_sleeps;
+	unsigned long long pacing_late_ns;
+	unsigned long long pacing_max_late_ns;
+	unsigned long long pacing_overshoot_ns;
+	unsigned long long pacing_max_overshoot_ns;
+
+	unsigned long long latency[IO_STATS_LATENCY_BUCKETS];
+};
+
+/**
+ * io_context_alloc - allocate new IO context
+ */
+extern struct io_context *io_context_alloc(void);
+
+/**
+ * io_context_free - close input of context and free context
+ */
+extern void io_context_free(struct io_context *ctx);
+
+/**
+ * io_main_context - get global IO context used by io_main functions
+ */
+extern struct io_context *io_main_context(void);
+
+/**
+ * io_context_set_io_thread - select where IO for context input is done
+ * @ctx: IO context
+ * @enable: if true, inputs opened after this call are read and parsed in
+ *	    dedicated IO thread, otherwise in io_context_get_next_values()
+ *	    caller thread
+ *
+ * With IO thread, decoded values are buffered to bounded queue and parsers
+ * are stopped with IO_PARSER_RET_QUEUE_FULL until consumer has made room.
+ */
+extern void io_context_set_io_thread(struct io_context *ctx, bool enable);
+
+/**
+ * io_context_set_event_loop - drive context inputs by event loop
+ * @ctx: IO context
+ * @loop: event loop, or NULL to stop using event loop
  *
- * Example file:
- *  1.000
- *  2.000
- *  2.110
- *  0.220
- *  0.230
- *  0.260
+ * Inputs opened after this call are read and parsed by worker threads of
+ * @loop. Inputs without pollable file descriptor use dedicated IO thread.
+ */
+extern void io_context_set_event_loop(struct io_context *ctx,
+				      struct io_event_loop *loop);
+
+/**
+ * io_context_set_pacer - pace context by shared pacing scheduler
+ * @ctx: IO context
+ * @pacer: pacing scheduler, or NULL to sleep in consumer thread (default)
+ */
+extern void io_context_set_pacer(struct io_context *ctx,
+				 struct io_pacer *pacer);
+
+/**
+ * io_context_get_stats - take snapshot of statistics of context
+ * @ctx: IO context
+ * @stats: snapshot is stored here
  *
- * Data can also be saved delta-encoded, where first data point is saved as such
- * and following numbers are stored as delta of previous value. First line of
- * file will be "#deltaenc" for detection.
- * 
- * Above example file as delta-encoded:
- *  #deltaenc
- *  1.000
- *  1.000
- *  0.110
- *  -1.890
- *  0.010
- *  0.030
+ * Can be called from any thread. Counters are read without stopping IO, so
+ * snapshot is not atomic over all counters.
  */
-extern bool io_save_txt_file(const char *filename, float *values,
-			     unsigned int num_values);
+extern void io_context_get_stats(struct io_context *ctx,
+				 struct io_stats *stats);
 
 /**
- * io_save_gz_txt_file - save @values to file with name @filename, using text
- *			 formating and gzip compression.
- * @filename: filename to use
- * @values: data points to save (ecg data, 4ms intervals, 250pps)
- * @num_values: number of values
+ * io_context_set_latency_histogram - enable histogram of end-to-end sample
+ *				      latency
+ * @ctx: IO context
+ * @enable: if true, push time of value batches is recorded and latency is
+ *	    counted when consumer gets last value of batch
+ */
+extern void io_context_set_latency_histogram(struct io_context *ctx,
+					     bool enable);
+
+/**
+ * io_context_set_queue_watermarks - set limits of values queued by IO thread
+ * @ctx: IO context
+ * @high_values: parsing stops when this many values are queued
+ * @low_values: parsing continues when queue drops below this many values
  *
- * Text format is same as with io_save_txt_file()
+ * Returns false if @high_values is zero or @low_values is not in range
+ * 1..@high_values.
  */
-extern bool io_save_gz_txt_file(const char *filename, float *values,
-				unsigned int num_values);
+extern bool io_context_set_queue_watermarks(struct io_context *ctx,
+					    unsigned int high_values,
+					    unsigned int low_values);
+
+/**
+ * io_context_set_external_input_watermarks - limit data buffered by external
+ *					      inputs of context
+ * @ctx: IO context
+ * @high_bytes: pushing stops when this much pushed data is unread, zero for
+ *		no limit (default)
+ * @low_bytes: blocked pushing continues when unread data drops to this
+ * @block: if true, pushers block until there is room, otherwise pushes are
+ *	   short
+ *
+ * Applies to external inputs opened after this call. Returns false if
+ * @low_bytes is larger than @high_bytes.
+ */
+extern bool io_context_set_external_input_watermarks(struct io_context *ctx,
+						     unsigned int high_bytes,
+						     unsigned int low_bytes,
+						     bool block);
+
+/**
+ * io_context_input_stopping - check if input of context is being closed
+ *			       (internal, for IO thread and event loop)
+ */
+extern bool io_context_input_stopping(struct io_context *ctx);
+
+/**
+ * io_context_input_done - tell consumer that input of context has ended and
+ *			   no more values will come (internal)
+ */
+extern void io_context_input_done(struct io_context *ctx);
+
+enum io_pacing_mode {
+	IO_PACING_REALTIME = 0,
+	IO_PACING_SPEEDUP,
+	IO_PACING_UNTHROTTLED,
+};
+
+/**
+ * io_context_set_pacing - select how fast values are returned from context
+ * @ctx: IO context
+ * @mode: IO_PACING_REALTIME returns values at 4ms per value (default),
+ *	  IO_PACING_SPEEDUP at @speed times real time and IO_PACING_UNTHROTTLED
+ *	  as fast as input can be decoded
+ * @speed: speed-up factor for IO_PACING_SPEEDUP, ignored by other modes
+ */
+extern void io_context_set_pacing(struct io_context *ctx,
+				  enum io_pacing_mode mode,
+				  unsigned int speed);
+
+/**
+ * io_context_set_channels - set number of value columns decoded from input
+ * @ctx: IO context
+ * @num_channels: channels per frame, 1 to IO_MAX_CHANNELS. Applies to inputs
+ *		  opened after this call, missing columns are decoded as zero.
+ *
+ * Returns false if @num_channels is out of range.
+ */
+extern bool io_context_set_channels(struct io_context *ctx,
+				    unsigned int num_channels);
+
+/**
+ * io_context_set_history - keep last consumed frames readable with
+ *			    io_context_get_history()
+ * @ctx: IO context
+ * @num_frames: number of frames, up to IO_MAX_HISTORY_FRAMES. Applies to
+ *		inputs opened after this call.
+ *
+ * Consumed values stay in values queue ring until overwritten, so history
+ * does not need separate copy of stream. Returns false if @num_frames is out
+ * of range.
+ */
+extern bool io_context_set_history(struct io_context *ctx,
+				   unsigned int num_frames);
+
+/**
+ * io_context_get_history - copy last consumed frames of current input
+ * @ctx: IO context
+ * @frames: buffer for @num_frames * channels values, oldest frame first
+ * @num_frames: number of frames wanted
+ *
+ * Returns number of frames copied, less than @num_frames if fewer frames have
+ * been consumed or history set with io_context_set_history() is shorter.
+ */
+extern unsigned int io_context_get_history(struct io_context *ctx,
+					   float *frames,
+					   unsigned int num_frames);
+
+/**
+ * io_context_get_channels - get number of channels in frames of current input
+ */
+extern unsigned int io_context_get_channels(struct io_context *ctx);
+
+/**
+ * io_context_set_sample_rate - set output rate of values decoded from input
+ * @ctx: IO context
+ * @rate: output rate in Hz, IO_DEFAULT_SAMPLE_RATE (4ms interval) by default
+ * @kernel: interpolation used for resampling input to @rate
+ *
+ * Applies to inputs opened after this call. Pacing of returned values follows
+ * @rate. Returns false if @rate is zero.
+ */
+extern bool io_context_set_sample_rate(struct io_context *ctx,
+				       unsigned int rate,
+				       enum io_resample_kernel kernel);
+
+/**
+ * io_context_get_sample_rate - get output rate of current input
+ * @ctx: IO context
+ * @kernel: if not NULL, interpolation kernel of current input is stored here
+ */
+extern unsigned int io_context_get_sample_rate(struct io_context *ctx,
+					       enum io_resample_kernel *kernel);
+
+/**
+ * io_context_set_sample_format - set format of values queue
+ * @ctx: IO context
+ * @format: IO_SAMPLE_FLOAT32 by default, IO_SAMPLE_INT16 halves memory of
+ *	    queue and history and lets fixed-point binary input be queued
+ *	    without conversion
+ *
+ * Applies to inputs opened after this call. Values are returned in either
+ * format, conversion is done when values are dequeued.
+ */
+extern void io_context_set_sample_format(struct io_context *ctx,
+					 enum io_sample_format format);
+
+/**
+ * io_context_get_sample_format - get format of values queue of current input
+ */
+extern enum io_sample_format
+io_context_get_sample_format(struct io_context *ctx);
+
+/**
+ * io_context_set_input - set new input for context, previous input is closed
+ * @ctx: IO context
+ * @input: new input, parser stack of input is set to emit values to @ctx
+ */
+extern void io_context_set_input(struct io_context *ctx,
+				 struct io_input *input);
+
+/**
+ * io_context_open_txt_file_input - open file with name @filename for context
+ *				    input
+ */
+extern void io_context_open_txt_file_input(struct io_context *ctx,
+					   const char *filename);
+
+/**
+ * io_context_open_bin_file_input - open binary sample file with name
+ *				    @filename for context input
+ *
+ * File is memory mapped, gzip compressed files are decompressed.
+ */
+extern void io_context_open_bin_file_input(struct io_context *ctx,
+					   const char *filename);
+
+/**
+ * io_context_open_txt_external_input - open external text input for context
+ */
+extern void io_context_open_txt_external_input(struct io_context *ctx);
+
+/**
+ * io_context_push_external_input - push data to context input that has been
+ *				    opened with
+ *				    io_context_open_txt_external_input()
+ * @ctx: IO context
+ * @buf: buffer with new data
+ * @buflen: length of buffer in bytes
+ *
+ * Returns number of bytes pushed (returns < buflen when out of memory, or
+ * when watermark set by io_context_set_external_input_watermarks() is
+ * reached).
+ */
+extern int io_context_push_external_input(struct io_context *ctx, void *buf,
+					  unsigned int buflen);
+
+/**
+ * io_context_push_external_input_buffer - push memory owned by caller to
+ *					   context external input without
+ *					   copying
+ * @ctx: IO context
+ * @buf: buffer with new data, must stay valid until @release is called
+ * @buflen: length of buffer in bytes
+ * @release: called when input no longer references @buf, can be NULL
+ * @opaque: passed to @release
+ *
+ * Returns false if input is not open or when out of memory, @release is not
+ * called in that case.
+ */
+extern bool io_context_push_external_input_buffer(struct io_context *ctx,
+						  void *buf,
+						  unsigned int buflen,
+						  ds_append_buffer_release_t release,
+						  void *opaque);
+
+/**
+ * io_context_close_input - close input of context
+ */
+extern void io_context_close_input(struct io_context *ctx);
+
+/**
+ * io_context_seek_time - move input of context to time of stream
+ * @ctx: IO context
+ * @seconds: time from start of stream
+ *
+ * Queued values and history are dropped and pacing restarts. Next frame
+ * consumed is first output frame at or after @seconds, same as when stream
+ * is read from start. Regular text files, plain or gzip compressed, opened
+ * with io_context_open_txt_file_input() can be seeked. Random access index
+ * of gzip file is built on first seek, see io_gz_index_open().
+ *
+ * Returns false if context has no input or input cannot seek. When seek of
+ * seekable input fails, input restarts from start of stream.
+ */
+extern bool io_context_seek_time(struct io_context *ctx, double seconds);
+
+/**
+ * io_context_queue_push_4ms_interval_value - add @data_value to ECG input data
+ *					      queue of context
+ *
+ * With multiple channels, @data_value is pushed to first channel and others
+ * are set to zero.
+ */
+extern bool io_context_queue_push_4ms_interval_value(struct io_context *ctx,
+						     float data_value);
+
+/**
+ * io_context_queue_push_frames - add @num_frames frames of @frames to ECG
+ *				  input data queue of context
+ * @ctx: IO context
+ * @frames: interleaved frames of io_context_get_channels() values
+ * @num_frames: number of frames
+ */
+extern bool io_context_queue_push_frames(struct io_context *ctx,
+					 const float *frames,
+					 unsigned int num_frames);
+
+/**
+ * io_context_queue_push_frames_i16 - add @num_frames int16 fixed-point frames
+ *				      of @frames to ECG input data queue of
+ *				      context
+ *
+ * See io_context_queue_push_frames().
+ */
+extern bool io_context_queue_push_frames_i16(struct io_context *ctx,
+					     const int16_t *frames,
+					     unsigned int num_frames);
+
+/**
+ * io_context_get_sink - get sink pushing blocks of parser stack to ECG input
+ *			 data queue of context
+ *
+ * Blocks of any channel id are accepted, frames must have
+ * io_context_get_channels() values.
+ */
+extern struct io_sink *io_context_get_sink(struct io_context *ctx);
+
+/**
+ * io_context_queue_push_4ms_interval_frame - add frame of @values to ECG
+ *					      input data queue of context
+ * @ctx: IO context
+ * @values: one value for each of io_context_get_channels() channels
+ */
+extern bool io_context_queue_push_4ms_interval_frame(struct io_context *ctx,
+						     const float *values);
+
+/**
+ * io_context_queue_is_full - check if ECG input data queue of context is full
+ *
+ * Always false when IO is done in caller thread.
+ */
+extern bool io_context_queue_is_full(struct io_context *ctx);
+
+/**
+ * io_context_queue_is_shared - check if ECG input data queue of context is
+ *				filled outside consumer thread
+ *
+ * True when IO is done in IO thread or event loop, values may then be pushed
+ * to queue from any thread.
+ */
+extern bool io_context_queue_is_shared(struct io_context *ctx);
+
+/**
+ * io_context_queue_wait_free - wait until ECG input data queue of context has
+ *				room
+ *
+ * Returns false if input is being closed.
+ */
+extern bool io_context_queue_wait_free(struct io_context *ctx);
+
+/**
+ * io_context_get_next_values - process next batch of context input data to
+ *				ECG data values
+ * @ctx: IO context
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ */
+extern bool io_context_get_next_values(struct io_context *ctx, float *values,
+				       unsigned int num_values);
+
+/**
+ * io_context_get_next_frames - get next batch of multi-channel frames,
+ *				interleaved
+ * @ctx: IO context
+ * @frames: buffer for @num_frames * io_context_get_channels() values
+ * @num_frames: number of frames to get
+ */
+extern bool io_context_get_next_frames(struct io_context *ctx, float *frames,
+				       unsigned int num_frames);
+
+/**
+ * io_context_get_next_values_i16 - get next batch of values as int16
+ *				    fixed-point
+ *
+ * See io_context_get_next_values() and io_context_set_sample_format().
+ */
+extern bool io_context_get_next_values_i16(struct io_context *ctx,
+					   int16_t *values,
+					   unsigned int num_values);
+
+/**
+ * io_context_get_next_frames_i16 - get next batch of multi-channel frames as
+ *				    int16 fixed-point, interleaved
+ *
+ * See io_context_get_next_frames().
+ */
+extern bool io_context_get_next_frames_i16(struct io_context *ctx,
+					   int16_t *frames,
+					   unsigned int num_frames);
+
+/**
+ * io_context_get_next_frames_soa - get next batch of multi-channel frames,
+ *				    as separate array for each channel
+ * @ctx: IO context
+ * @channels: @num_channels arrays of @num_frames values, channels not in
+ *	      input are set to zero
+ * @num_channels: number of arrays in @channels
+ * @num_frames: number of frames to get
+ */
+extern bool io_context_get_next_frames_soa(struct io_context *ctx,
+					   float *const *channels,
+					   unsigned int num_channels,
+					   unsigned int num_frames);
+
+/**
+ * io_context_get_next_data_line - get data line buffer for sending ECG data
+ *				   of context over network.
+ * @ctx: IO context
+ * @line_buffer: buffer to write data line to
+ * @buflen: length of buffer
+ *
+ * Returns number of bytes written to buffer.
+ */
+extern unsigned int io_context_get_next_data_line(struct io_context *ctx,
+						  char *line_buffer,
+						  unsigned int buflen);
+
+/**
+ * io_context_get_next_data_lines - get data lines of multiple values of
+ *				    context for sending ECG data over network.
+ * @ctx: IO context
+ * @line_buffer: buffer to write data lines to
+ * @buflen: length of buffer
+ * @max_values: maximum number of values to get
+ *
+ * Gets up to @max_values values with one dequeue, limited by room in
+ * @line_buffer for IO_DATA_LINE_MAX_LEN bytes per value. Output is null
+ * terminated.
+ *
+ * Returns number of bytes written to buffer.
+ */
+extern unsigned int io_context_get_next_data_lines(struct io_context *ctx,
+						   char *line_buffer,
+						   unsigned int buflen,
+						   unsigned int max_values);
+
 
-
 /*****************************************************************************
  * IO library main functions
  *****************************************************************************/
+/**
+ * io_main_set_pacing - select how fast values are returned from global input
+ * @mode: pacing mode, see io_context_set_pacing()
+ * @speed: speed-up factor for IO_PACING_SPEEDUP
+ */
+extern void io_main_set_pacing(enum io_pacing_mode mode, unsigned int speed);
+
 /**
  * io_open_txt_file_input - open file with name @filename for global input
  */
 extern void io_open_txt_file_input(const char *filename);
 
+/**
+ * io_open_bin_file_input - open binary sample file with name @filename for
+ *			    global input
+ */
+extern void io_open_bin_file_input(const char *filename);
+
 /**
  * io_open_txt_external_input - open external text input for global input
  */
@@ -403,11 +2248,53 @@ extern void io_open_txt_external_input(void);
  */
 extern int io_push_external_input(void *buf, unsigned int buflen);
 
+/**
+ * io_push_external_input_buffer - push memory owned by caller to global
+ *				   external input without copying
+ *
+ * See io_context_push_external_input_buffer().
+ */
+extern bool io_push_external_input_buffer(void *buf, unsigned int buflen,
+					  ds_append_buffer_release_t release,
+					  void *opaque);
+
 /**
  * io_close_main_input - close previously global input
  */
 extern void io_close_main_input(void);
 
+/**
+ * io_main_seek_time - move global input to time of stream
+ *
+ * See io_context_seek_time().
+ */
+extern bool io_main_seek_time(double seconds);
+
+/**
+ * io_main_set_io_thread - select where IO for global input is done
+ * @enable: if true, inputs opened after this call are read and parsed in
+ *	    dedicated IO thread, otherwise in io_main_queue_get_next_values()
+ *	    caller thread
+ *
+ * With IO thread, decoded values are buffered to bounded queue and parsers
+ * are stopped with IO_PARSER_RET_QUEUE_FULL until consumer has made room.
+ */
+extern void io_main_set_io_thread(bool enable);
+
+/**
+ * io_main_set_channels - set number of value columns decoded from global input
+ *
+ * See io_context_set_channels().
+ */
+extern bool io_main_set_channels(unsigned int num_channels);
+
+/**
+ * io_main_set_sample_format - set format of global values queue
+ *
+ * See io_context_set_sample_format().
+ */
+extern void io_main_set_sample_format(enum io_sample_format format);
+
 
 /*****************************************************************************
  * ECG data input, main IO queue
@@ -418,6 +2305,20 @@ extern void io_close_main_input(void);
  */
 extern bool io_main_queue_push_4ms_interval_value(float data_value);
 
+/**
+ * io_main_queue_is_full - check if global ECG input data queue is full
+ *
+ * Always false when IO is done in caller thread.
+ */
+extern bool io_main_queue_is_full(void);
+
+/**
+ * io_main_queue_wait_free - wait until global ECG input data queue has room
+ *
+ * Returns false if input is being closed.
+ */
+extern bool io_main_queue_wait_free(void);
+
 /**
  * io_main_queue_get_next_values - process next batch of input data to ECG data
  *				   values
@@ -427,6 +2328,65 @@ extern bool io_main_queue_push_4ms_interval_value(float data_value);
 extern bool io_main_queue_get_next_values(float *values,
 					  unsigned int num_values);
 
+/**
+ * io_main_queue_get_next_values_i16 - process next batch of input data to
+ *				       int16 fixed-point ECG data values
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ */
+extern bool io_main_queue_get_next_values_i16(int16_t *values,
+					      unsigned int num_values);
+
+/**
+ * io_main_get_stats - take snapshot of statistics of global context
+ *
+ * See io_context_get_stats().
+ */
+extern void io_main_get_stats(struct io_stats *stats);
+
+/**
+ * io_main_set_history - keep last consumed frames of global input readable
+ *
+ * See io_context_set_history().
+ */
+extern bool io_main_set_history(unsigned int num_frames);
+
+/**
+ * io_main_get_history - copy last consumed frames of global input
+ *
+ * See io_context_get_history().
+ */
+extern unsigned int io_main_get_history(float *frames,
+					unsigned int num_frames);
+
+/**
+ * io_main_set_sample_rate - set output rate of values decoded from global
+ *			     input
+ *
+ * See io_context_set_sample_rate().
+ */
+extern bool io_main_set_sample_rate(unsigned int rate,
+				    enum io_resample_kernel kernel);
+
+/**
+ * io_main_queue_get_next_frames - get next batch of multi-channel frames from
+ *				   global input, interleaved
+ * @frames: buffer for @num_frames * channels values
+ * @num_frames: number of frames to get
+ */
+extern bool io_main_queue_get_next_frames(float *frames,
+					  unsigned int num_frames);
+
+/**
+ * io_main_queue_get_next_frames_soa - get next batch of multi-channel frames
+ *				       from global input, array per channel
+ *
+ * See io_context_get_next_frames_soa().
+ */
+extern bool io_main_queue_get_next_frames_soa(float *const *channels,
+					      unsigned int num_channels,
+					      unsigned int num_frames);
+
 /**
  * io_main_get_next_data_line - get data line buffer for sending ECG data over
  *                              network.
@@ -438,4 +2398,17 @@ extern bool io_main_queue_get_next_values(float *values,
 extern unsigned int io_main_get_next_data_line(char *line_buffer,
 					       unsigned int buflen);
 
+/**
+ * io_main_get_next_data_lines - get data lines of multiple values for sending
+ *				 ECG data over network.
+ * @line_buffer: buffer to write data lines to
+ * @buflen: length of buffer
+ * @max_values: maximum number of values to get
+ *
+ * Returns number of bytes written to buffer.
+ */
+extern unsigned int io_main_get_next_data_lines(char *line_buffer,
+						unsigned int buflen,
+						unsigned int max_values);
+
 #endif /*__LIBIO__IO_H__*/
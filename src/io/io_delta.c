@@ -0,0 +1,265 @@
+/*
+ * Block-wise delta coding kernels
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "io.h"
+
+/*
+ * Vectors of four lanes. Float lanes are only added or subtracted lane by
+ * lane, in same order as scalar code, so results are bit-exact with it.
+ * Integer lanes wrap around like unsigned scalar arithmetic.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DELTA_SIMD 1
+
+typedef __m128 delta_vf;
+typedef __m128i delta_vi;
+
+#define vf_load(p)	_mm_loadu_ps(p)
+#define vf_store(p, v)	_mm_storeu_ps(p, v)
+#define vf_add(a, b)	_mm_add_ps(a, b)
+#define vf_sub(a, b)	_mm_sub_ps(a, b)
+
+#define vi_load(p)	_mm_loadu_si128((const __m128i *)(p))
+#define vi_store(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define vi_add(a, b)	_mm_add_epi32(a, b)
+#define vi_sub(a, b)	_mm_sub_epi32(a, b)
+#define vi_dup(x)	_mm_set1_epi32(x)
+#define vi_dup2(x0, x1)	_mm_set_epi32(x1, x0, x1, x0)
+
+/* lanes moved up by one or two, zeros shifted in */
+#define vi_up1(v)	_mm_slli_si128(v, 4)
+#define vi_up2(v)	_mm_slli_si128(v, 8)
+
+/* last frame of one or two channels broadcast over vector */
+#define vi_last1(v)	_mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3))
+#define vi_last2(v)	_mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DELTA_SIMD 1
+
+typedef float32x4_t delta_vf;
+typedef int32x4_t delta_vi;
+
+#define vf_load(p)	vld1q_f32(p)
+#define vf_store(p, v)	vst1q_f32(p, v)
+#define vf_add(a, b)	vaddq_f32(a, b)
+#define vf_sub(a, b)	vsubq_f32(a, b)
+
+#define vi_load(p)	vld1q_s32(p)
+#define vi_store(p, v)	vst1q_s32(p, v)
+#define vi_add(a, b)	vaddq_s32(a, b)
+#define vi_sub(a, b)	vsubq_s32(a, b)
+#define vi_dup(x)	vdupq_n_s32(x)
+#define vi_dup2(x0, x1)	vcombine_s32(vset_lane_s32(x1, vdup_n_s32(x0), 1), \
+				     vset_lane_s32(x1, vdup_n_s32(x0), 1))
+
+#define vi_up1(v)	vextq_s32(vdupq_n_s32(0), v, 3)
+#define vi_up2(v)	vextq_s32(vdupq_n_s32(0), v, 2)
+
+#define vi_last1(v)	vdupq_n_s32(vgetq_lane_s32(v, 3))
+#define vi_last2(v)	vcombine_s32(vget_high_s32(v), vget_high_s32(v))
+#else
+#define DELTA_SIMD 0
+#endif
+
+static inline int32_t delta_add32(int32_t a, int32_t b)
+{
+	return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static inline int32_t delta_sub32(int32_t a, int32_t b)
+{
+	return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+/**
+ * io_delta_encode - adjacent difference of interleaved frames
+ * @deltas: @num_frames * @channels differences are stored here, must not
+ *	    overlap @values
+ * @values: interleaved frames
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last frame of @values
+ */
+void io_delta_encode(float *deltas, const float *values,
+		     unsigned int num_frames, unsigned int channels,
+		     float *prev)
+{
+	unsigned int i, num = num_frames * channels;
+
+	if (num_frames == 0)
+		return;
+
+	for (i = 0; i < channels; i++)
+		deltas[i] = values[i] - prev[i];
+
+#if DELTA_SIMD
+	/* differences are independent of each other */
+	for (; i + 4 <= num; i += 4)
+		vf_store(deltas + i, vf_sub(vf_load(values + i),
+					    vf_load(values + i - channels)));
+#endif
+	for (; i < num; i++)
+		deltas[i] = values[i] - values[i - channels];
+
+	memcpy(prev, values + num - channels, channels * sizeof(*prev));
+}
+
+/**
+ * io_delta_decode - prefix sum of interleaved delta frames, in place
+ * @values: @num_frames * @channels deltas, replaced with values
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last decoded frame
+ *
+ * Each channel is summed in stream order, as float addition is not
+ * associative. Only frames of four or more channels are vectorized, lanes
+ * of vector then depend on earlier vectors only.
+ */
+void io_delta_decode(float *values, unsigned int num_frames,
+		     unsigned int channels, float *prev)
+{
+	unsigned int i, num = num_frames * channels;
+
+	if (num_frames == 0)
+		return;
+
+	for (i = 0; i < channels; i++)
+		values[i] = prev[i] + values[i];
+
+#if DELTA_SIMD
+	if (channels >= 4)
+		for (; i + 4 <= num; i += 4)
+			vf_store(values + i,
+				 vf_add(vf_load(values + i - channels),
+					vf_load(values + i)));
+#endif
+	for (; i < num; i++)
+		values[i] = values[i - channels] + values[i];
+
+	memcpy(prev, values + num - channels, channels * sizeof(*prev));
+}
+
+/**
+ * io_delta_encode_fixed - adjacent difference of interleaved fixed-point
+ *			   frames
+ * @deltas: @num_frames * @channels differences are stored here, must not
+ *	    overlap @values
+ * @values: interleaved frames
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last frame of @values
+ *
+ * Differences wrap around at 32 bits, io_delta_decode_fixed() reverses them.
+ */
+void io_delta_encode_fixed(int32_t *deltas, const int32_t *values,
+			   unsigned int num_frames, unsigned int channels,
+			   int32_t *prev)
+{
+	unsigned int i, num = num_frames * channels;
+
+	if (num_frames == 0)
+		return;
+
+	for (i = 0; i < channels; i++)
+		deltas[i] = delta_sub32(values[i], prev[i]);
+
+#if DELTA_SIMD
+	for (; i + 4 <= num; i += 4)
+		vi_store(deltas + i, vi_sub(vi_load(values + i),
+					    vi_load(values + i - channels)));
+#endif
+	for (; i < num; i++)
+		deltas[i] = delta_sub32(values[i], values[i - channels]);
+
+	memcpy(prev, values + num - channels, channels * sizeof(*prev));
+}
+
+/**
+ * io_delta_decode_fixed - prefix sum of interleaved fixed-point delta
+ *			   frames, in place
+ * @values: @num_frames * @channels deltas, replaced with values
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @prev: last frame of previous block, updated to last decoded frame
+ *
+ * Integer sums wrap around and are associative, so one and two channel
+ * frames are summed inside vector with log-step scan.
+ */
+void io_delta_decode_fixed(int32_t *values, unsigned int num_frames,
+			   unsigned int channels, int32_t *prev)
+{
+	unsigned int i = 0, num = num_frames * channels;
+#if DELTA_SIMD
+	delta_vi v, carry;
+#endif
+
+	if (num_frames == 0)
+		return;
+
+#if DELTA_SIMD
+	if (channels == 1) {
+		carry = vi_dup(prev[0]);
+		for (; i + 4 <= num; i += 4) {
+			v = vi_load(values + i);
+			v = vi_add(v, vi_up1(v));
+			v = vi_add(v, vi_up2(v));
+			v = vi_add(v, carry);
+			vi_store(values + i, v);
+			carry = vi_last1(v);
+		}
+	} else if (channels == 2) {
+		carry = vi_dup2(prev[0], prev[1]);
+		for (; i + 4 <= num; i += 4) {
+			v = vi_load(values + i);
+			v = vi_add(v, vi_up2(v));
+			v = vi_add(v, carry);
+			vi_store(values + i, v);
+			carry = vi_last2(v);
+		}
+	}
+#endif
+
+	/* first frame not summed in vectors above */
+	if (i == 0)
+		for (; i < channels; i++)
+			values[i] = delta_add32(prev[i], values[i]);
+
+#if DELTA_SIMD
+	if (channels >= 4)
+		for (; i + 4 <= num; i += 4)
+			vi_store(values + i,
+				 vi_add(vi_load(values + i - channels),
+					vi_load(values + i)));
+#endif
+	for (; i < num; i++)
+		values[i] = delta_add32(values[i - channels], values[i]);
+
+	memcpy(prev, values + num - channels, channels * sizeof(*prev));
+}
@@ -0,0 +1,593 @@
+/*
+ * Event loop driver for multiplexing many inputs on small thread pool
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "io.h"
+
+/* Events handled per epoll_wait() by worker */
+#define EVENT_LOOP_MAX_EVENTS 64
+
+/* Initial size of source table */
+#define EVENT_LOOP_MIN_SOURCES 16
+
+/* epoll data of wake eventfd, sources use slot index and generation */
+#define EVENT_LOOP_WAKE_ID UINT64_MAX
+
+/*
+ * Registered input. Fd is armed with EPOLLONESHOT so that only one worker
+ * processes source at time, worker rearms fd after processing. Sources whose
+ * context queue is full are parked until consumer resumes them, resume of
+ * running source makes worker process it again.
+ *
+ * State is protected by loop lock. Epoll events carry slot index and
+ * generation instead of pointer, so that event already returned to worker
+ * for removed source is ignored.
+ */
+struct io_event_source {
+	struct io_event_loop *loop;
+	struct io_context *ctx;
+	struct io_input *input;
+	int fd;
+
+	unsigned int slot;
+	unsigned int gen;
+
+	bool running;
+	bool rerun;
+	bool parked;
+	bool pending;
+	bool removed;
+	bool done;
+
+	struct io_event_source *next_pending;
+};
+
+struct io_event_loop {
+	int epoll_fd;
+	int wake_fd;
+
+	pthread_mutex_t lock;
+	pthread_cond_t idle_cond;
+
+	/* source table, indexed by slot */
+	struct io_event_source **sources;
+	unsigned int *gens;
+	unsigned int num_slots;
+
+	/* resumed sources waiting for worker */
+	struct io_event_source *pending_head;
+	struct io_event_source **pending_tail;
+
+	bool stopping;
+
+	unsigned int num_threads;
+	pthread_t *threads;
+};
+
+static uint64_t event_source_id(const struct io_event_source *src)
+{
+	return ((uint64_t)src->gen << 32) | src->slot;
+}
+
+/* Arm fd of source for one event, lock held */
+static bool event_source_arm(struct io_event_source *src, int op)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = event_source_id(src);
+
+	return epoll_ctl(src->loop->epoll_fd, op, src->fd, &ev) == 0;
+}
+
+/* Wake up one worker for pending sources, lock held */
+static void event_loop_wake(struct io_event_loop *loop)
+{
+	uint64_t one = 1;
+
+	if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+		/* counter full, workers are already woken */
+	}
+}
+
+/* Look up source of epoll event and mark it running, lock held */
+static struct io_event_source *event_loop_claim(struct io_event_loop *loop,
+						uint64_t id)
+{
+	unsigned int slot = id & 0xffffffff;
+	struct io_event_source *src;
+
+	if (slot >= loop->num_slots || loop->gens[slot] != id >> 32)
+		return NULL;
+
+	src = loop->sources[slot];
+	if (!src || src->removed || src->running)
+		return NULL;
+
+	src->running = true;
+	return src;
+}
+
+/* Take next resumed source and mark it running, lock held */
+static struct io_event_source *event_loop_claim_pending(
+						struct io_event_loop *loop)
+{
+	struct io_event_source *src = loop->pending_head;
+	uint64_t count;
+
+	if (!src) {
+		/* stop wakeup must stay readable for all workers */
+		if (loop->stopping)
+			return NULL;
+
+		/* clear wake counter until next resume */
+		if (read(loop->wake_fd, &count, sizeof(count)) < 0) {
+			/* already cleared by other worker */
+		}
+		return NULL;
+	}
+
+	loop->pending_head = src->next_pending;
+	if (!loop->pending_head)
+		loop->pending_tail = &loop->pending_head;
+
+	src->next_pending = NULL;
+	src->pending = false;
+	src->running = true;
+
+	return src;
+}
+
+/* Unlink source from pending list, lock held */
+static void event_loop_unlink_pending(struct io_event_loop *loop,
+				      struct io_event_source *src)
+{
+	struct io_event_source **pos;
+
+	for (pos = &loop->pending_head; *pos; pos = &(*pos)->next_pending) {
+		if (*pos != src)
+			continue;
+
+		*pos = src->next_pending;
+		if (!*pos)
+			loop->pending_tail = pos;
+		break;
+	}
+
+	src->next_pending = NULL;
+	src->pending = false;
+}
+
+/*
+ * End of input or error, restart input from beginning like IO thread does.
+ * Reopened input might have new fd, so fd is registered again.
+ */
+static bool event_source_reopen(struct io_event_source *src)
+{
+	struct io_event_loop *loop = src->loop;
+	bool ok;
+
+	if (io_context_input_stopping(src->ctx) ||
+	    !io_input_reopen(src->input))
+		return false;
+
+	pthread_mutex_lock(&loop->lock);
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+	src->fd = io_input_get_fd(src->input);
+	ok = src->fd >= 0 && event_source_arm(src, EPOLL_CTL_ADD);
+	if (ok) {
+		/* reopened input is processed on first event */
+		src->rerun = false;
+		src->running = false;
+		if (src->removed)
+			pthread_cond_broadcast(&loop->idle_cond);
+	}
+	pthread_mutex_unlock(&loop->lock);
+
+	return ok;
+}
+
+/*
+ * Read and parse available input of claimed source. Context is only accessed
+ * while source is running, remover waits for that.
+ */
+static void event_source_process(struct io_event_source *src)
+{
+	struct io_event_loop *loop = src->loop;
+	bool done;
+	int ret, error;
+
+	do {
+		ret = io_input_process(src->input, &error);
+		if (ret < 0 && event_source_reopen(src))
+			return;
+
+		pthread_mutex_lock(&loop->lock);
+
+		/* wait for more input */
+		done = ret < 0 || (ret == 0 && !src->removed &&
+				   !event_source_arm(src, EPOLL_CTL_MOD));
+		if (done || ret == 0 || src->removed)
+			break;
+
+		/*
+		 * Queue of context is full, park until consumer has dequeued
+		 * values. Unless consumer already did so while running.
+		 */
+		if (!src->rerun) {
+			src->parked = true;
+			break;
+		}
+
+		src->rerun = false;
+		pthread_mutex_unlock(&loop->lock);
+	} while (true);
+
+	if (done) {
+		pthread_mutex_unlock(&loop->lock);
+
+		/* no more values, let consumer know */
+		io_context_input_done(src->ctx);
+
+		pthread_mutex_lock(&loop->lock);
+		src->done = true;
+	}
+
+	src->rerun = false;
+	src->running = false;
+	if (src->removed)
+		pthread_cond_broadcast(&loop->idle_cond);
+
+	pthread_mutex_unlock(&loop->lock);
+}
+
+static void *event_loop_worker(void *arg)
+{
+	struct io_event_loop *loop = arg;
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	struct io_event_source *src;
+	int i, num;
+
+	while (true) {
+		num = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS,
+				 -1);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < num; i++) {
+			pthread_mutex_lock(&loop->lock);
+
+			if (events[i].data.u64 == EVENT_LOOP_WAKE_ID) {
+				if (loop->stopping) {
+					/* wake fd stays readable for others */
+					pthread_mutex_unlock(&loop->lock);
+					return NULL;
+				}
+
+				while ((src = event_loop_claim_pending(loop))) {
+					pthread_mutex_unlock(&loop->lock);
+					event_source_process(src);
+					pthread_mutex_lock(&loop->lock);
+				}
+
+				pthread_mutex_unlock(&loop->lock);
+				continue;
+			}
+
+			src = event_loop_claim(loop, events[i].data.u64);
+			pthread_mutex_unlock(&loop->lock);
+
+			if (src)
+				event_source_process(src);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * io_event_loop_alloc - allocate event loop and start worker threads
+ * @num_threads: number of worker threads, zero for number of CPUs
+ *
+ * Returns NULL on error.
+ */
+struct io_event_loop *io_event_loop_alloc(unsigned int num_threads)
+{
+	struct io_event_loop *loop;
+	struct epoll_event ev;
+	unsigned int i;
+	long cpus;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	pthread_mutex_init(&loop->lock, NULL);
+	pthread_cond_init(&loop->idle_cond, NULL);
+	loop->pending_tail = &loop->pending_head;
+	loop->wake_fd = -1;
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		io_set_latest_error("%s():%d: could not create epoll instance "
+				    "(errno: %d)", __func__, __LINE__, errno);
+		goto err_free;
+	}
+
+	/* Level-triggered eventfd, wakes workers for resumed sources */
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->wake_fd < 0) {
+		io_set_latest_error("%s():%d: could not create eventfd "
+				    "(errno: %d)", __func__, __LINE__, errno);
+		goto err_free;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = EVENT_LOOP_WAKE_ID;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+		io_set_latest_error("%s():%d: could not register eventfd "
+				    "(errno: %d)", __func__, __LINE__, errno);
+		goto err_free;
+	}
+
+	if (num_threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = cpus > 0 ? cpus : 1;
+	}
+	if (num_threads > IO_EVENT_LOOP_MAX_THREADS)
+		num_threads = IO_EVENT_LOOP_MAX_THREADS;
+
+	loop->threads = calloc(num_threads, sizeof(*loop->threads));
+	if (!loop->threads) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto err_free;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&loop->threads[i], NULL, event_loop_worker,
+				   loop) != 0) {
+			io_set_latest_error("%s():%d: could not create worker "
+					    "thread", __func__, __LINE__);
+			break;
+		}
+		loop->num_threads++;
+	}
+
+	if (loop->num_threads == 0)
+		goto err_free;
+
+	return loop;
+
+err_free:
+	io_event_loop_free(loop);
+	return NULL;
+}
+
+/**
+ * io_event_loop_free - stop worker threads and free event loop
+ * @loop: event loop, inputs of all contexts using @loop must be closed
+ */
+void io_event_loop_free(struct io_event_loop *loop)
+{
+	unsigned int i;
+
+	if (!loop)
+		return;
+
+	pthread_mutex_lock(&loop->lock);
+	loop->stopping = true;
+	if (loop->wake_fd >= 0)
+		event_loop_wake(loop);
+	pthread_mutex_unlock(&loop->lock);
+
+	for (i = 0; i < loop->num_threads; i++)
+		pthread_join(loop->threads[i], NULL);
+
+	if (loop->wake_fd >= 0)
+		close(loop->wake_fd);
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+
+	pthread_cond_destroy(&loop->idle_cond);
+	pthread_mutex_destroy(&loop->lock);
+
+	free(loop->threads);
+	free(loop->sources);
+	free(loop->gens);
+	free(loop);
+}
+
+/* Find free slot in source table, growing table if needed, lock held */
+static bool event_loop_get_slot(struct io_event_loop *loop, unsigned int *slot)
+{
+	struct io_event_source **sources;
+	unsigned int i, *gens, num_slots;
+
+	for (i = 0; i < loop->num_slots; i++) {
+		if (!loop->sources[i]) {
+			*slot = i;
+			return true;
+		}
+	}
+
+	num_slots = loop->num_slots ? loop->num_slots * 2 :
+				      EVENT_LOOP_MIN_SOURCES;
+
+	sources = realloc(loop->sources, num_slots * sizeof(*sources));
+	if (!sources)
+		return false;
+	loop->sources = sources;
+
+	gens = realloc(loop->gens, num_slots * sizeof(*gens));
+	if (!gens)
+		return false;
+	loop->gens = gens;
+
+	for (i = loop->num_slots; i < num_slots; i++) {
+		loop->sources[i] = NULL;
+		loop->gens[i] = 0;
+	}
+
+	*slot = loop->num_slots;
+	loop->num_slots = num_slots;
+
+	return true;
+}
+
+/**
+ * io_event_loop_add - register input of context to event loop
+ * @loop: event loop
+ * @ctx: context receiving values of @input
+ * @input: input with pollable file descriptor
+ *
+ * Returns NULL if @input can not be driven by event loop.
+ */
+struct io_event_source *io_event_loop_add(struct io_event_loop *loop,
+					  struct io_context *ctx,
+					  struct io_input *input)
+{
+	struct io_event_source *src;
+	unsigned int slot;
+	int fd;
+
+	fd = io_input_get_fd(input);
+	if (fd < 0)
+		return NULL;
+
+	src = calloc(1, sizeof(*src));
+	if (!src) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	src->loop = loop;
+	src->ctx = ctx;
+	src->input = input;
+	src->fd = fd;
+
+	pthread_mutex_lock(&loop->lock);
+
+	if (!event_loop_get_slot(loop, &slot)) {
+		pthread_mutex_unlock(&loop->lock);
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		free(src);
+		return NULL;
+	}
+
+	src->slot = slot;
+	src->gen = loop->gens[slot];
+
+	/* fails for fds that epoll does not support, such as regular files */
+	if (!event_source_arm(src, EPOLL_CTL_ADD)) {
+		pthread_mutex_unlock(&loop->lock);
+		free(src);
+		return NULL;
+	}
+
+	loop->sources[slot] = src;
+
+	pthread_mutex_unlock(&loop->lock);
+
+	return src;
+}
+
+/**
+ * io_event_loop_remove - unregister and free event source
+ * @src: event source
+ *
+ * Waits until worker processing @src has finished. Input of source is not
+ * destroyed.
+ */
+void io_event_loop_remove(struct io_event_source *src)
+{
+	struct io_event_loop *loop = src->loop;
+
+	pthread_mutex_lock(&loop->lock);
+
+	src->removed = true;
+	while (src->running)
+		pthread_cond_wait(&loop->idle_cond, &loop->lock);
+
+	if (src->pending)
+		event_loop_unlink_pending(loop, src);
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+
+	/* events already returned for this source are ignored */
+	loop->sources[src->slot] = NULL;
+	loop->gens[src->slot]++;
+
+	pthread_mutex_unlock(&loop->lock);
+
+	free(src);
+}
+
+/**
+ * io_event_loop_resume - continue parked source after consumer has dequeued
+ *			  values from queue of its context
+ * @src: event source
+ */
+void io_event_loop_resume(struct io_event_source *src)
+{
+	struct io_event_loop *loop = src->loop;
+
+	pthread_mutex_lock(&loop->lock);
+
+	if (src->removed || src->done) {
+		/* not processed anymore */
+	} else if (src->running) {
+		/* worker processes source again before parking */
+		src->rerun = true;
+	} else if (src->parked) {
+		src->parked = false;
+		src->pending = true;
+
+		*loop->pending_tail = src;
+		loop->pending_tail = &src->next_pending;
+
+		event_loop_wake(loop);
+	}
+
+	pthread_mutex_unlock(&loop->lock);
+}
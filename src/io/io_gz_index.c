@@ -0,0 +1,1064 @@
+/*
+ * Random access index for gzip compressed files
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* pread() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "priv_zlib.h"
+#include "io.h"
+
+#define GZ_INDEX_MAGIC "ECGI"
+#define GZ_INDEX_VERSION 1
+
+#define GZ_INDEX_HEADER_LEN 48
+#define GZ_INDEX_POINT_LEN 44
+
+/* Compressed input read per call while building index or reading data */
+#define GZ_INDEX_INPUT_LEN (16 * 1024)
+
+#define GZ_INDEX_TRAILER_LEN 8
+
+/*
+ * Access point. Window is kept deflated, it is inflated only when stream is
+ * started from point.
+ */
+struct gz_index_point {
+	struct io_gz_access_point ap;
+	unsigned int window_len;
+	unsigned int window_clen;
+	unsigned char *window;
+};
+
+struct io_gz_index {
+	unsigned int span;
+
+	unsigned int num_points;
+	unsigned int max_points;
+	struct gz_index_point *points;
+
+	/* uncompressed data fed so far */
+	unsigned long long length;
+	unsigned long long lines;
+	bool at_line_start;
+
+	/* line start of last point not yet seen */
+	bool line_pending;
+
+	/* last IO_GZ_INDEX_WINDOW_LEN bytes of current member */
+	unsigned int window_len;
+	unsigned char window[IO_GZ_INDEX_WINDOW_LEN];
+};
+
+static void gz_index_put_le32(unsigned char *buf, unsigned long val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+	buf[2] = (val >> 16) & 0xff;
+	buf[3] = (val >> 24) & 0xff;
+}
+
+static void gz_index_put_le64(unsigned char *buf, unsigned long long val)
+{
+	gz_index_put_le32(buf, val & 0xffffffffUL);
+	gz_index_put_le32(buf + 4, val >> 32);
+}
+
+static unsigned long gz_index_get_le32(const unsigned char *buf)
+{
+	return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8) |
+	       ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
+}
+
+static unsigned long long gz_index_get_le64(const unsigned char *buf)
+{
+	return gz_index_get_le32(buf) |
+	       ((unsigned long long)gz_index_get_le32(buf + 4) << 32);
+}
+
+/**
+ * io_gz_index_alloc - allocate empty index
+ * @span: uncompressed bytes between access points, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ */
+struct io_gz_index *io_gz_index_alloc(unsigned int span)
+{
+	struct io_gz_index *index;
+
+	index = calloc(1, sizeof(*index));
+	if (!index) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	index->span = span ? span : IO_GZ_INDEX_DEFAULT_SPAN;
+	index->at_line_start = true;
+
+	return index;
+}
+
+/**
+ * io_gz_index_free - free index
+ */
+void io_gz_index_free(struct io_gz_index *index)
+{
+	unsigned int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->num_points; i++)
+		free(index->points[i].window);
+	free(index->points);
+	free(index);
+}
+
+/* Keep tail of uncompressed data as window for next access point */
+static void gz_index_update_window(struct io_gz_index *index,
+				   const unsigned char *data, unsigned int len)
+{
+	unsigned int keep;
+
+	if (len >= IO_GZ_INDEX_WINDOW_LEN) {
+		memcpy(index->window, data + len - IO_GZ_INDEX_WINDOW_LEN,
+		       IO_GZ_INDEX_WINDOW_LEN);
+		index->window_len = IO_GZ_INDEX_WINDOW_LEN;
+		return;
+	}
+
+	keep = IO_GZ_INDEX_WINDOW_LEN - len;
+	if (keep > index->window_len)
+		keep = index->window_len;
+
+	memmove(index->window, index->window + index->window_len - keep,
+		keep);
+	memcpy(index->window + keep, data, len);
+	index->window_len = keep + len;
+}
+
+/**
+ * io_gz_index_add_data - pass uncompressed data to index in stream order
+ * @index: index being built
+ * @data: decompressed data
+ * @len: length of @data
+ *
+ * Data following access point added with io_gz_index_add_point() resolves
+ * line start of point.
+ */
+void io_gz_index_add_data(struct io_gz_index *index, const void *data,
+			  unsigned int len)
+{
+	const unsigned char *pos = data, *end = pos + len, *nl;
+	struct io_gz_access_point *ap;
+
+	if (len == 0)
+		return;
+
+	while ((nl = memchr(pos, '\n', end - pos)) != NULL) {
+		if (index->line_pending) {
+			ap = &index->points[index->num_points - 1].ap;
+			ap->line_start = index->length +
+					 (nl - (const unsigned char *)data) + 1;
+			ap->line = index->lines + 1;
+			index->line_pending = false;
+		}
+
+		index->lines++;
+		pos = nl + 1;
+	}
+
+	index->at_line_start = end[-1] == '\n';
+	index->length += len;
+
+	gz_index_update_window(index, data, len);
+}
+
+/* Current member of stream ended, next member starts without window */
+static void gz_index_start_member(struct io_gz_index *index)
+{
+	index->window_len = 0;
+}
+
+/**
+ * io_gz_index_needs_point - check if span has been reached since last access
+ *			     point
+ */
+bool io_gz_index_needs_point(const struct io_gz_index *index)
+{
+	const struct gz_index_point *last;
+
+	if (index->num_points == 0)
+		return true;
+
+	last = &index->points[index->num_points - 1];
+	return index->length - last->ap.out >= index->span;
+}
+
+static bool gz_index_deflate_window(struct gz_index_point *point,
+				    const unsigned char *window,
+				    unsigned int len)
+{
+	unsigned long bound;
+	z_stream zs;
+	int ret;
+
+	point->window_len = len;
+	point->window_clen = 0;
+	point->window = NULL;
+	if (len == 0)
+		return true;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	bound = deflateBound(&zs, len);
+	point->window = malloc(bound);
+	if (!point->window) {
+		deflateEnd(&zs);
+		return false;
+	}
+
+	zs.next_in = (unsigned char *)window;
+	zs.avail_in = len;
+	zs.next_out = point->window;
+	zs.avail_out = bound;
+	ret = deflate(&zs, Z_FINISH);
+	point->window_clen = bound - zs.avail_out;
+	deflateEnd(&zs);
+
+	if (ret != Z_STREAM_END) {
+		free(point->window);
+		point->window = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static struct gz_index_point *gz_index_new_point(struct io_gz_index *index)
+{
+	struct gz_index_point *points;
+	unsigned int max_points;
+
+	if (index->num_points == index->max_points) {
+		max_points = index->max_points ? index->max_points * 2 : 16;
+		points = realloc(index->points, max_points * sizeof(*points));
+		if (!points)
+			return NULL;
+
+		index->points = points;
+		index->max_points = max_points;
+	}
+
+	return &index->points[index->num_points];
+}
+
+/**
+ * io_gz_index_add_point - add access point at current uncompressed position
+ * @index: index being built
+ * @in: offset of first compressed byte of point in file
+ * @bits: number of bits of byte before @in that belong to point, 0 to 7
+ *
+ * Compressed stream must be at deflate block boundary. Window of point is
+ * data passed with io_gz_index_add_data() since start of member.
+ */
+bool io_gz_index_add_point(struct io_gz_index *index, unsigned long long in,
+			   unsigned int bits)
+{
+	struct gz_index_point *point;
+
+	point = gz_index_new_point(index);
+	if (!point ||
+	    !gz_index_deflate_window(point, index->window,
+				     index->window_len)) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		return false;
+	}
+
+	point->ap.in = in;
+	point->ap.bits = bits;
+	point->ap.out = index->length;
+	point->ap.line_start = index->length;
+	point->ap.line = index->lines;
+
+	/* point in middle of line, line start is found from following data */
+	index->line_pending = !index->at_line_start;
+	index->num_points++;
+
+	return true;
+}
+
+/**
+ * io_gz_index_finish - resolve line starts of access points after all data
+ *			has been passed to index
+ *
+ * Lines of points without line start in following data begin at end of data.
+ */
+void io_gz_index_finish(struct io_gz_index *index)
+{
+	struct io_gz_access_point *ap;
+
+	if (!index->line_pending)
+		return;
+
+	ap = &index->points[index->num_points - 1].ap;
+	ap->line_start = index->length;
+	ap->line = index->lines + 1;
+	index->line_pending = false;
+}
+
+/*
+ * Read more compressed input for @zs, @pos is file offset of next byte to
+ * read. Returns false on read error.
+ */
+static bool gz_index_fill_input(int fd, unsigned char *buf, z_stream *zs,
+				unsigned long long *pos)
+{
+	ssize_t len;
+
+	if (zs->avail_in > 0)
+		memmove(buf, zs->next_in, zs->avail_in);
+
+	do {
+		len = pread(fd, buf + zs->avail_in,
+			    GZ_INDEX_INPUT_LEN - zs->avail_in, *pos);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0)
+		return false;
+
+	zs->next_in = buf;
+	zs->avail_in += len;
+	*pos += len;
+
+	return true;
+}
+
+/*
+ * Check for next gzip member after end of member. Returns false at end of
+ * file or at trailing garbage.
+ */
+static bool gz_index_next_member(int fd, unsigned char *buf, z_stream *zs,
+				 unsigned long long *pos, bool *error)
+{
+	if (zs->avail_in < 2 && !gz_index_fill_input(fd, buf, zs, pos)) {
+		io_set_latest_error("%s():%d: read failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		*error = true;
+		return false;
+	}
+
+	return zs->avail_in >= 2 && zs->next_in[0] == 0x1f &&
+	       zs->next_in[1] == 0x8b;
+}
+
+/**
+ * io_gz_index_build - build index by decompressing whole gzip file
+ * @filename: name of gzip file
+ * @span: uncompressed bytes between access points, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Concatenated members are indexed as one stream, trailing garbage after
+ * last member is ignored. Returns NULL on error.
+ */
+struct io_gz_index *io_gz_index_build(const char *filename, unsigned int span)
+{
+	unsigned char *in_buf = NULL, *out_buf = NULL;
+	struct io_gz_index *index;
+	unsigned long long pos = 0;
+	unsigned int out_len;
+	bool error = false, in_member = true;
+	z_stream zs;
+	int fd, ret;
+
+	index = io_gz_index_alloc(span);
+	if (!index)
+		return NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		io_gz_index_free(index);
+		return NULL;
+	}
+
+	memset(&zs, 0, sizeof(zs));
+	in_buf = malloc(GZ_INDEX_INPUT_LEN);
+	out_buf = malloc(IO_GZ_INDEX_WINDOW_LEN);
+	if (!in_buf || !out_buf ||
+	    inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		free(in_buf);
+		free(out_buf);
+		close(fd);
+		io_gz_index_free(index);
+		return NULL;
+	}
+
+	while (in_member) {
+		if (zs.avail_in == 0) {
+			if (!gz_index_fill_input(fd, in_buf, &zs, &pos)) {
+				io_set_latest_error("%s():%d: could not read "
+						    "file[%s] (errno: %d)",
+						    __func__, __LINE__,
+						    filename, errno);
+				error = true;
+				break;
+			}
+			if (zs.avail_in == 0) {
+				io_set_latest_error("%s():%d: file[%s] ends "
+						    "in middle of gzip member",
+						    __func__, __LINE__,
+						    filename);
+				error = true;
+				break;
+			}
+		}
+
+		zs.next_out = out_buf;
+		zs.avail_out = IO_GZ_INDEX_WINDOW_LEN;
+
+		/* stops at end of header and at each deflate block */
+		ret = inflate(&zs, Z_BLOCK);
+		if (ret != Z_OK && ret != Z_STREAM_END &&
+		    ret != Z_BUF_ERROR) {
+			io_set_latest_error("%s():%d: inflate failed "
+					    "(errno: %d, err-msg: %s)",
+					    __func__, __LINE__, ret,
+					    zs.msg ? zs.msg : "");
+			error = true;
+			break;
+		}
+
+		out_len = IO_GZ_INDEX_WINDOW_LEN - zs.avail_out;
+		io_gz_index_add_data(index, out_buf, out_len);
+
+		if (ret == Z_STREAM_END) {
+			in_member = gz_index_next_member(fd, in_buf, &zs, &pos,
+							 &error);
+			if (in_member) {
+				gz_index_start_member(index);
+				inflateReset(&zs);
+			}
+			continue;
+		}
+
+		/* block boundary, but not at end of last block */
+		if ((zs.data_type & 128) && !(zs.data_type & 64) &&
+		    io_gz_index_needs_point(index) &&
+		    !io_gz_index_add_point(index, pos - zs.avail_in,
+					   zs.data_type & 7)) {
+			error = true;
+			break;
+		}
+	}
+
+	inflateEnd(&zs);
+	free(in_buf);
+	free(out_buf);
+	close(fd);
+
+	if (!error && index->num_points == 0) {
+		io_set_latest_error("%s():%d: file[%s] has no gzip data",
+				    __func__, __LINE__, filename);
+		error = true;
+	}
+
+	if (error) {
+		io_gz_index_free(index);
+		return NULL;
+	}
+
+	io_gz_index_finish(index);
+	return index;
+}
+
+/* Sidecar file name of index of @filename */
+static bool gz_index_filename(char *buf, size_t buflen, const char *filename)
+{
+	int len;
+
+	len = snprintf(buf, buflen, "%s%s", filename, IO_GZ_INDEX_SUFFIX);
+	if (len < 0 || (size_t)len >= buflen) {
+		io_set_latest_error("%s():%d: too long filename[%s]", __func__,
+				    __LINE__, filename);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Length and last bytes of gzip file, stored in index to detect that file
+ * has changed after index was built.
+ */
+static bool gz_index_file_id(const char *filename, unsigned long long *len,
+			     unsigned char *trailer)
+{
+	struct stat st;
+	ssize_t ret;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		return false;
+	}
+
+	memset(trailer, 0, GZ_INDEX_TRAILER_LEN);
+	ret = 0;
+	if (fstat(fd, &st) == 0) {
+		*len = st.st_size;
+		if (*len >= GZ_INDEX_TRAILER_LEN)
+			ret = pread(fd, trailer, GZ_INDEX_TRAILER_LEN,
+				    *len - GZ_INDEX_TRAILER_LEN);
+	} else {
+		ret = -1;
+	}
+	close(fd);
+
+	if (ret < 0) {
+		io_set_latest_error("%s():%d: could not read file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * io_gz_index_save - save index next to gzip file
+ * @index: index of file
+ * @filename: name of gzip file, index is saved to filename with
+ *	      IO_GZ_INDEX_SUFFIX appended
+ */
+bool io_gz_index_save(const struct io_gz_index *index, const char *filename)
+{
+	unsigned char header[GZ_INDEX_HEADER_LEN], rec[GZ_INDEX_POINT_LEN];
+	const struct gz_index_point *point;
+	char index_filename[MAXPATHLEN];
+	unsigned long long file_len = 0;
+	unsigned int i;
+	FILE *file;
+	bool ok;
+
+	if (!gz_index_filename(index_filename, sizeof(index_filename),
+			       filename))
+		return false;
+
+	memset(header, 0, sizeof(header));
+	if (!gz_index_file_id(filename, &file_len, &header[24]))
+		return false;
+
+	memcpy(header, GZ_INDEX_MAGIC, 4);
+	header[4] = GZ_INDEX_VERSION;
+	gz_index_put_le32(&header[8], index->span);
+	gz_index_put_le32(&header[12], index->num_points);
+	gz_index_put_le64(&header[16], file_len);
+	gz_index_put_le64(&header[32], index->length);
+	gz_index_put_le64(&header[40], index->lines);
+
+	file = fopen(index_filename, "wb");
+	if (!file) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    index_filename, errno);
+		return false;
+	}
+
+	ok = fwrite(header, sizeof(header), 1, file) == 1;
+	for (i = 0; ok && i < index->num_points; i++) {
+		point = &index->points[i];
+
+		gz_index_put_le64(&rec[0], point->ap.in);
+		gz_index_put_le64(&rec[8], point->ap.out);
+		gz_index_put_le64(&rec[16], point->ap.line_start);
+		gz_index_put_le64(&rec[24], point->ap.line);
+		gz_index_put_le32(&rec[32], point->ap.bits);
+		gz_index_put_le32(&rec[36], point->window_len);
+		gz_index_put_le32(&rec[40], point->window_clen);
+
+		ok = fwrite(rec, sizeof(rec), 1, file) == 1 &&
+		     (point->window_clen == 0 ||
+		      fwrite(point->window, point->window_clen, 1, file) == 1);
+	}
+
+	if (fclose(file) != 0)
+		ok = false;
+
+	if (!ok) {
+		io_set_latest_error("%s():%d: could not write file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    index_filename, errno);
+		unlink(index_filename);
+	}
+
+	return ok;
+}
+
+/* Read access point records of index file */
+static bool gz_index_load_points(struct io_gz_index *index, FILE *file,
+				 unsigned int num_points)
+{
+	unsigned char rec[GZ_INDEX_POINT_LEN];
+	struct gz_index_point *point;
+	unsigned long long prev_out = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_points; i++) {
+		if (fread(rec, sizeof(rec), 1, file) != 1)
+			return false;
+
+		point = gz_index_new_point(index);
+		if (!point)
+			return false;
+
+		point->ap.in = gz_index_get_le64(&rec[0]);
+		point->ap.out = gz_index_get_le64(&rec[8]);
+		point->ap.line_start = gz_index_get_le64(&rec[16]);
+		point->ap.line = gz_index_get_le64(&rec[24]);
+		point->ap.bits = gz_index_get_le32(&rec[32]);
+		point->window_len = gz_index_get_le32(&rec[36]);
+		point->window_clen = gz_index_get_le32(&rec[40]);
+		point->window = NULL;
+
+		/* points are in stream order */
+		if (point->ap.bits > 7 ||
+		    point->window_len > IO_GZ_INDEX_WINDOW_LEN ||
+		    point->window_clen > 2 * IO_GZ_INDEX_WINDOW_LEN ||
+		    (i > 0 && point->ap.out <= prev_out) ||
+		    point->ap.line_start < point->ap.out ||
+		    point->ap.line_start > index->length)
+			return false;
+		prev_out = point->ap.out;
+
+		if (point->window_clen > 0) {
+			point->window = malloc(point->window_clen);
+			if (!point->window)
+				return false;
+			if (fread(point->window, point->window_clen, 1,
+				  file) != 1) {
+				free(point->window);
+				return false;
+			}
+		}
+
+		index->num_points++;
+	}
+
+	return true;
+}
+
+/**
+ * io_gz_index_load - load index saved next to gzip file
+ * @filename: name of gzip file
+ *
+ * Returns NULL if index file is missing or invalid, or if it was built for
+ * different contents of @filename.
+ */
+struct io_gz_index *io_gz_index_load(const char *filename)
+{
+	unsigned char header[GZ_INDEX_HEADER_LEN];
+	unsigned char trailer[GZ_INDEX_TRAILER_LEN];
+	char index_filename[MAXPATHLEN];
+	unsigned long long file_len = 0;
+	struct io_gz_index *index;
+	unsigned int num_points;
+	FILE *file;
+
+	if (!gz_index_filename(index_filename, sizeof(index_filename),
+			       filename))
+		return NULL;
+
+	if (!gz_index_file_id(filename, &file_len, trailer))
+		return NULL;
+
+	file = fopen(index_filename, "rb");
+	if (!file) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    index_filename, errno);
+		return NULL;
+	}
+
+	if (fread(header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header, GZ_INDEX_MAGIC, 4) != 0 ||
+	    header[4] != GZ_INDEX_VERSION) {
+		io_set_latest_error("%s():%d: file[%s] is not gzip index",
+				    __func__, __LINE__, index_filename);
+		fclose(file);
+		return NULL;
+	}
+
+	if (gz_index_get_le64(&header[16]) != file_len ||
+	    memcmp(&header[24], trailer, sizeof(trailer)) != 0) {
+		io_set_latest_error("%s():%d: index file[%s] is out of date",
+				    __func__, __LINE__, index_filename);
+		fclose(file);
+		return NULL;
+	}
+
+	index = io_gz_index_alloc(gz_index_get_le32(&header[8]));
+	if (!index) {
+		fclose(file);
+		return NULL;
+	}
+
+	num_points = gz_index_get_le32(&header[12]);
+	index->length = gz_index_get_le64(&header[32]);
+	index->lines = gz_index_get_le64(&header[40]);
+
+	if (num_points == 0 ||
+	    !gz_index_load_points(index, file, num_points)) {
+		io_set_latest_error("%s():%d: index file[%s] is corrupted",
+				    __func__, __LINE__, index_filename);
+		io_gz_index_free(index);
+		index = NULL;
+	}
+
+	fclose(file);
+	return index;
+}
+
+/**
+ * io_gz_index_open - load index of gzip file, or build and save it if file
+ *		      has no valid index yet
+ * @filename: name of gzip file
+ * @span: access point span used when index is built, zero for
+ *	  IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Failure to save built index (for example, read-only directory) is not an
+ * error.
+ */
+struct io_gz_index *io_gz_index_open(const char *filename, unsigned int span)
+{
+	struct io_gz_index *index;
+
+	index = io_gz_index_load(filename);
+	if (index)
+		return index;
+
+	index = io_gz_index_build(filename, span);
+	if (index)
+		io_gz_index_save(index, filename);
+
+	return index;
+}
+
+/**
+ * io_gz_index_num_points - number of access points of index
+ */
+unsigned int io_gz_index_num_points(const struct io_gz_index *index)
+{
+	return index->num_points;
+}
+
+/**
+ * io_gz_index_length - length of uncompressed data of indexed file
+ */
+unsigned long long io_gz_index_length(const struct io_gz_index *index)
+{
+	return index->length;
+}
+
+/**
+ * io_gz_index_num_lines - number of newlines in uncompressed data of
+ *			   indexed file
+ */
+unsigned long long io_gz_index_num_lines(const struct io_gz_index *index)
+{
+	return index->lines;
+}
+
+/**
+ * io_gz_index_get_point - get access point @i of index
+ *
+ * Returns false if @i is out of range.
+ */
+bool io_gz_index_get_point(const struct io_gz_index *index, unsigned int i,
+			   struct io_gz_access_point *point)
+{
+	if (i >= index->num_points)
+		return false;
+
+	*point = index->points[i].ap;
+	return true;
+}
+
+/**
+ * io_gz_index_find_offset - find last access point at or before uncompressed
+ *			     @offset
+ */
+unsigned int io_gz_index_find_offset(const struct io_gz_index *index,
+				     unsigned long long offset)
+{
+	unsigned int lo = 0, hi = index->num_points, mid;
+
+	/* first point is at start of data */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (index->points[mid].ap.out <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * io_gz_index_find_line - find last access point with line start at or
+ *			   before line @line
+ */
+unsigned int io_gz_index_find_line(const struct io_gz_index *index,
+				   unsigned long long line)
+{
+	unsigned int lo = 0, hi = index->num_points, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (index->points[mid].ap.line <= line)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * io_gz_index_get_window - get inflate window of access point
+ * @index: index
+ * @i: access point
+ * @window: IO_GZ_INDEX_WINDOW_LEN bytes buffer
+ *
+ * Returns length of window, which may be zero, or -1 on error.
+ */
+int io_gz_index_get_window(const struct io_gz_index *index, unsigned int i,
+			   unsigned char *window)
+{
+	const struct gz_index_point *point;
+	z_stream zs;
+	int ret;
+
+	if (i >= index->num_points)
+		return -1;
+
+	point = &index->points[i];
+	if (point->window_len == 0)
+		return 0;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return -1;
+
+	zs.next_in = point->window;
+	zs.avail_in = point->window_clen;
+	zs.next_out = window;
+	zs.avail_out = point->window_len;
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END || zs.avail_out != 0) {
+		io_set_latest_error("%s():%d: corrupted index window",
+				    __func__, __LINE__);
+		return -1;
+	}
+
+	return point->window_len;
+}
+
+/* Set up raw inflate to continue from access point @i */
+static bool gz_index_prime(const struct io_gz_index *index, unsigned int i,
+			   int fd, z_stream *zs)
+{
+	const struct io_gz_access_point *ap = &index->points[i].ap;
+	unsigned char window[IO_GZ_INDEX_WINDOW_LEN];
+	unsigned char byte;
+	int len;
+
+	len = io_gz_index_get_window(index, i, window);
+	if (len < 0)
+		return false;
+
+	if (ap->bits > 0) {
+		if (ap->in == 0 || pread(fd, &byte, 1, ap->in - 1) != 1) {
+			io_set_latest_error("%s():%d: read failed (errno: %d)",
+					    __func__, __LINE__, errno);
+			return false;
+		}
+
+		inflatePrime(zs, ap->bits, byte >> (8 - ap->bits));
+	}
+
+	if (len > 0 && inflateSetDictionary(zs, window, len) != Z_OK) {
+		io_set_latest_error("%s():%d: inflateSetDictionary failed",
+				    __func__, __LINE__);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * io_gz_index_read - read uncompressed data of indexed gzip file
+ * @index: index of file
+ * @fd: file descriptor of gzip file, file position is not changed
+ * @offset: offset in uncompressed data
+ * @buf: buffer for data
+ * @len: number of bytes to read
+ *
+ * Inflates from closest access point before @offset, at most span of index
+ * is decompressed and discarded. Returns number of bytes read, less than
+ * @len at end of data, or -1 on error.
+ */
+int io_gz_index_read(const struct io_gz_index *index, int fd,
+		     unsigned long long offset, void *buf, unsigned int len)
+{
+	unsigned char *in_buf, *out_buf;
+	unsigned long long pos, out;
+	unsigned int i, avail, num, got = 0;
+	bool raw = true, error = false;
+	z_stream zs;
+	int ret;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+	if (offset >= index->length || len == 0)
+		return 0;
+
+	i = io_gz_index_find_offset(index, offset);
+	pos = index->points[i].ap.in;
+	out = index->points[i].ap.out;
+
+	memset(&zs, 0, sizeof(zs));
+	in_buf = malloc(GZ_INDEX_INPUT_LEN);
+	out_buf = malloc(IO_GZ_INDEX_WINDOW_LEN);
+	if (!in_buf || !out_buf || inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		free(in_buf);
+		free(out_buf);
+		return -1;
+	}
+
+	if (!gz_index_prime(index, i, fd, &zs)) {
+		error = true;
+		goto out;
+	}
+
+	while (got < len) {
+		if (zs.avail_in == 0) {
+			if (!gz_index_fill_input(fd, in_buf, &zs, &pos)) {
+				io_set_latest_error("%s():%d: read failed "
+						    "(errno: %d)", __func__,
+						    __LINE__, errno);
+				error = true;
+				break;
+			}
+			if (zs.avail_in == 0)
+				break;
+		}
+
+		/* discard data before offset, then inflate to @buf */
+		if (out < offset) {
+			zs.next_out = out_buf;
+			zs.avail_out = offset - out < IO_GZ_INDEX_WINDOW_LEN ?
+				       offset - out : IO_GZ_INDEX_WINDOW_LEN;
+		} else {
+			zs.next_out = (unsigned char *)buf + got;
+			zs.avail_out = len - got;
+		}
+		avail = zs.avail_out;
+
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END &&
+		    ret != Z_BUF_ERROR) {
+			io_set_latest_error("%s():%d: inflate failed "
+					    "(errno: %d, err-msg: %s)",
+					    __func__, __LINE__, ret,
+					    zs.msg ? zs.msg : "");
+			error = true;
+			break;
+		}
+
+		num = avail - zs.avail_out;
+		if (out < offset)
+			out += num;
+		else
+			got += num;
+
+		if (ret != Z_STREAM_END)
+			continue;
+
+		/* raw deflate leaves gzip trailer of member unread */
+		if (raw) {
+			while (zs.avail_in < GZ_INDEX_TRAILER_LEN) {
+				num = zs.avail_in;
+				if (!gz_index_fill_input(fd, in_buf, &zs,
+							 &pos) ||
+				    zs.avail_in == num)
+					break;
+			}
+			if (zs.avail_in < GZ_INDEX_TRAILER_LEN)
+				break;
+			zs.next_in += GZ_INDEX_TRAILER_LEN;
+			zs.avail_in -= GZ_INDEX_TRAILER_LEN;
+		}
+
+		if (!gz_index_next_member(fd, in_buf, &zs, &pos, &error))
+			break;
+
+		/* gzip mode parses header and trailer of next members */
+		inflateReset2(&zs, 16 + MAX_WBITS);
+		raw = false;
+	}
+
+out:
+	inflateEnd(&zs);
+	free(in_buf);
+	free(out_buf);
+
+	return error ? -1 : (int)got;
+}
@@ -38,7 +38,7 @@ int io_input_process(struct io_input *input, int *error)
 
 	*error = 0;
 	ret = io_input_read(input, error); /* non-blocking */
-	if (ret == 0) {
+	if (ret == 0 && !input->parser_queue_full) {
 		/* no new input */
 		return 0;
 	}
@@ -49,13 +49,22 @@ int io_input_process(struct io_input *input, int *error)
 	/* might modify buffer or leave as is if not enough input yet */
 	eret = io_parser_parse(input->parser, &input->inbuf, end_of_input);
 
-	if (end_of_input && ds_append_buffer_length(&input->inbuf) > 0) {
+	/*
+	 * Parser stopped because of full queue, buffered input needs to be
+	 * parsed again after queue has room, even if no new input arrives.
+	 */
+	input->parser_queue_full = (eret == IO_PARSER_RET_QUEUE_FULL);
+
+	if (end_of_input && !input->parser_queue_full &&
+	    ds_append_buffer_length(&input->inbuf) > 0) {
 		/*
 		 * At end of data, clear buffer.
 		 * Parser had chance to handle the data.
 		 */
 		ds_append_buffer_free(&input->inbuf);
-		ds_append_buffer_init(&input->inbuf);
+		ds_append_buffer_init_sized(&input->inbuf,
+					    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+					    DS_APPEND_BUFFER_MAX_PIECE_LEN);
 	}
 
 	switch (eret) {
@@ -79,18 +88,21 @@ void io_input_process_loop(struct io_input *input)
 	int error, ret;
 
 	while (io_input_wait(input) == IO_INPUT_WAIT_NEW) {
-		error = 0;
-		ret = io_input_process(input, &error);
-		if (ret < 0)
-			break;
-		if (ret > 0) {
-			/*
-			 * Input queue was full. Wait until there is room for
-			 * more input values.
-			 */
-			if (!io_parser_wait_queue(input->parser))
-				break;
-		}
+		do {
+			error = 0;
+			ret = io_input_process(input, &error);
+			if (ret < 0)
+				return;
+			if (ret > 0) {
+				/*
+				 * Input queue was full. Wait until there is
+				 * room for more input values and continue
+				 * with already buffered input.
+				 */
+				if (!io_parser_wait_queue(input->parser))
+					return;
+			}
+		} while (ret > 0);
 	}
 }
 
@@ -100,10 +112,18 @@ void io_input_process_loop(struct io_input *input)
  */
 int io_input_read(struct io_input *input, int *error)
 {
-	if (input->ops->read)
-		return input->ops->read(input, error);
+	int ret;
 
-	return -1;
+	if (!input->ops->read)
+		return -1;
+
+	ret = input->ops->read(input, error);
+	if (ret > 0) {
+		io_stats_add(&input->stats.reads, 1);
+		io_stats_add(&input->stats.bytes_in, ret);
+	}
+
+	return ret;
 }
 
 /**
@@ -150,9 +170,49 @@ bool io_input_destroy(struct io_input *input)
  */
 bool io_input_reopen(struct io_input *input)
 {
-	if (input->ops->reopen)
-		return input->ops->reopen(input);
+	if (!input->ops->reopen)
+		return false;
 
-	return false;
+	io_stats_add(&input->stats.reopens, 1);
+
+	return input->ops->reopen(input);
 }
 
+
+/**
+ * io_input_get_fd - wrapper around input->ops->get_fd, returns pollable file
+ *		     descriptor of input or -1
+ */
+int io_input_get_fd(struct io_input *input)
+{
+	if (input->ops->get_fd)
+		return input->ops->get_fd(input);
+
+	return -1;
+}
+
+/**
+ * io_input_seek_time - wrapper around input->ops->seek_time, moves input to
+ *			time of stream
+ */
+bool io_input_seek_time(struct io_input *input, double seconds)
+{
+	bool ok;
+
+	if (!input->ops->seek_time) {
+		io_set_latest_error("%s():%d: input cannot seek", __func__,
+				    __LINE__);
+		return false;
+	}
+
+	ok = input->ops->seek_time(input, seconds);
+
+	/* Buffered input is from previous position of stream */
+	ds_append_buffer_free(&input->inbuf);
+	ds_append_buffer_init_sized(&input->inbuf,
+				    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	input->parser_queue_full = false;
+
+	return ok;
+}
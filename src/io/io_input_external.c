@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "io.h"
 
@@ -38,6 +39,16 @@ struct external_input_priv {
 	pthread_cond_t cond;
 	struct ds_append_buffer buf;
 	bool has_new;
+	bool stop;
+
+	/* Watermarks of pushed data, no limit if high_bytes is zero */
+	pthread_cond_t room_cond;
+	unsigned int high_bytes;
+	unsigned int low_bytes;
+	bool block;
+
+	/* Input is being closed, blocked pushers return */
+	bool closing;
 };
 
 static inline struct external_input_priv *
@@ -49,28 +60,28 @@ static inline struct external_input_priv *
 static int external_input_read(struct io_input *input, int *error)
 {
 	struct external_input_priv *priv = external_input_priv(input);
-	unsigned char buf[128];
-	unsigned int rlen, wlen;
-	int read_bytes = 0;
+	int read_bytes;
+
+	*error = 0;
 
 	pthread_mutex_lock(&priv->mutex);
 
-	while (ds_append_buffer_length(&priv->buf) > 0) {
-		/* Copy bytes from input buffer ... */
-		rlen = ds_append_buffer_copy(&priv->buf, 0, buf, sizeof(buf));
-		read_bytes += rlen;
+	/*
+	 * Parser stopped on full queue, keep rest in push buffer so that
+	 * pushers see backpressure.
+	 */
+	if (priv->high_bytes > 0 && input->parser_queue_full &&
+	    ds_append_buffer_length(&input->inbuf) >= priv->high_bytes) {
+		pthread_mutex_unlock(&priv->mutex);
+		return 0;
+	}
 
-		/* Move head pointer forward */
-		ds_append_buffer_move_head(&priv->buf, rlen);
+	/* Move pushed buffer pieces to input buffer, without copying */
+	read_bytes = ds_append_buffer_splice(&input->inbuf, &priv->buf);
 
-		/* Append bytes to output buffer ... */
-		wlen = ds_append_buffer_append(&input->inbuf, buf, rlen);
-		if (wlen < rlen) {
-			/* out of memory? */
-			read_bytes -= (rlen - wlen);
-			break;
-		}
-	}
+	/* Push buffer is now empty, below any low watermark */
+	if (read_bytes > 0 && priv->high_bytes > 0)
+		pthread_cond_broadcast(&priv->room_cond);
 
 	pthread_mutex_unlock(&priv->mutex);
 
@@ -84,20 +95,18 @@ enum io_input_wait_ret external_input_wait(struct io_input *input)
 
 	pthread_mutex_lock(&priv->mutex);
 
-	/* Check if new input was added ... */
-	if (!priv->has_new) {
-		/* Wait for input ... */
+	/* Wait for input or stop request ... */
+	while (!priv->has_new && !priv->stop)
 		pthread_cond_wait(&priv->cond, &priv->mutex);
 
-		/* Recheck if new input was added ... */
-		if (priv->has_new)
-			ret = IO_INPUT_WAIT_NEW;
-		else
-			ret = IO_INPUT_WAIT_STOP;
+	/* Stop request takes priority, new input is left for next wait */
+	if (priv->stop) {
+		priv->stop = false;
+		ret = IO_INPUT_WAIT_STOP;
+	} else {
+		priv->has_new = false;
 	}
 
-	priv->has_new = false;
-
 	pthread_mutex_unlock(&priv->mutex);
 
 	return ret;
@@ -107,8 +116,16 @@ static bool external_input_stop_wait(struct io_input *input)
 {
 	struct external_input_priv *priv = external_input_priv(input);
 
-	/* wake up all waiters */
+	/*
+	 * Wake up all waiters. Stop is only requested when input is being
+	 * closed, so pushers blocked on full buffer are released for good.
+	 */
+	pthread_mutex_lock(&priv->mutex);
+	priv->stop = true;
+	priv->closing = true;
 	pthread_cond_broadcast(&priv->cond);
+	pthread_cond_broadcast(&priv->room_cond);
+	pthread_mutex_unlock(&priv->mutex);
 
 	return true;
 }
@@ -124,6 +141,7 @@ static bool external_input_destroy(struct io_input *input)
 	ds_append_buffer_free(&priv->buf);
 	pthread_mutex_unlock(&priv->mutex);
 
+	pthread_cond_destroy(&priv->room_cond);
 	pthread_cond_destroy(&priv->cond);
 	pthread_mutex_destroy(&priv->mutex);
 
@@ -169,39 +187,158 @@ struct io_input *io_new_external_input(struct io_parser *parser)
 	/* Initialize */
 	io_input_init(&einput->input, &external_input_ops, parser);
 
-	ds_append_buffer_init(&einput->buf);
+	/* Pushed data is spliced to parser piece by piece, let pieces grow */
+	ds_append_buffer_init_sized(&einput->buf,
+				    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
 	pthread_mutex_init(&einput->mutex, NULL);
 	pthread_cond_init(&einput->cond, NULL);
+	pthread_cond_init(&einput->room_cond, NULL);
 
 	return &einput->input;
 }
 
+/**
+ * io_external_input_set_watermarks - limit amount of pushed, unread data
+ * @ext_input: input structure allocated with io_new_external_input()
+ * @high_bytes: pushing stops when this much data is buffered, zero for no
+ *		limit
+ * @low_bytes: blocked pushing continues when buffered data drops to this
+ * @block: if true, pushers block until there is room, otherwise pushes are
+ *	   short
+ *
+ * Returns false if @low_bytes is larger than @high_bytes.
+ */
+bool io_external_input_set_watermarks(struct io_input *ext_input,
+				      unsigned int high_bytes,
+				      unsigned int low_bytes, bool block)
+{
+	struct external_input_priv *priv = external_input_priv(ext_input);
+
+	if (high_bytes > 0 && low_bytes > high_bytes) {
+		io_set_latest_error("%s():%d: low watermark %u above high "
+				    "watermark %u", __func__, __LINE__,
+				    low_bytes, high_bytes);
+		return false;
+	}
+
+	pthread_mutex_lock(&priv->mutex);
+	priv->high_bytes = high_bytes;
+	priv->low_bytes = low_bytes;
+	priv->block = block;
+	pthread_cond_broadcast(&priv->room_cond);
+	pthread_mutex_unlock(&priv->mutex);
+
+	return true;
+}
+
+/*
+ * Wait until push buffer has room, mutex held. Returns number of bytes that
+ * can be pushed, zero if push should stop.
+ */
+static unsigned int external_input_wait_room(struct external_input_priv *priv)
+{
+	unsigned int len;
+
+	if (priv->high_bytes == 0)
+		return UINT_MAX;
+
+	len = ds_append_buffer_length(&priv->buf);
+	if (len < priv->high_bytes)
+		return priv->high_bytes - len;
+
+	if (!priv->block)
+		return 0;
+
+	/* Full, continue after reader has taken data below low watermark */
+	while (!priv->closing && priv->high_bytes > 0 &&
+	       ds_append_buffer_length(&priv->buf) > priv->low_bytes)
+		pthread_cond_wait(&priv->room_cond, &priv->mutex);
+
+	if (priv->closing)
+		return 0;
+	if (priv->high_bytes == 0)
+		return UINT_MAX;
+
+	return priv->high_bytes - ds_append_buffer_length(&priv->buf);
+}
+
 /**
  * io_external_input_push_data - push new data to input system
  * @ext_input: input structure allocated with io_new_external_input()
  * @buf: buffer with new data
  * @buflen: length of buffer in bytes
  *
- * Returns number of bytes pushed (returns < buflen when out of memory).
+ * Returns number of bytes pushed (returns < buflen when out of memory, when
+ * high watermark is reached and pushing does not block, or when input is
+ * closed while blocked).
  */
 int io_external_input_push_data(struct io_input *ext_input, void *buf,
 				unsigned int buflen)
 {
 	struct external_input_priv *priv = external_input_priv(ext_input);
-	int alen;
+	unsigned int room, len, alen, pos = 0;
 
 	pthread_mutex_lock(&priv->mutex);
-	alen = ds_append_buffer_append(&priv->buf, buf, buflen);
-	if (alen < buflen) {
-		/* out of memory! do we continue as nothing happened or break? */
-		/* ignore non-mem for now */
-		buflen = alen;
+	while (pos < buflen) {
+		room = external_input_wait_room(priv);
+		if (room == 0)
+			break;
+
+		len = buflen - pos < room ? buflen - pos : room;
+		alen = ds_append_buffer_append(&priv->buf,
+					       (unsigned char *)buf + pos, len);
+		pos += alen;
+
+		if (alen > 0) {
+			/* wake up waiting thread */
+			priv->has_new = true;
+			pthread_cond_signal(&priv->cond);
+		}
+
+		if (alen < len) {
+			/* out of memory */
+			break;
+		}
 	}
-	priv->has_new = true;
+	pthread_mutex_unlock(&priv->mutex);
+
+	return pos;
+}
+
+/**
+ * io_external_input_push_buffer - push memory owned by caller to input system
+ *				   without copying
+ * @ext_input: input structure allocated with io_new_external_input()
+ * @buf: buffer with new data, must stay valid until @release is called
+ * @buflen: length of buffer in bytes
+ * @release: called when input no longer references @buf, can be NULL
+ * @opaque: passed to @release
+ *
+ * Buffer is pushed whole when there is any room below high watermark.
+ * Returns false when out of memory, when high watermark is reached and
+ * pushing does not block, or when input is closed while blocked. @release is
+ * not called in that case.
+ */
+bool io_external_input_push_buffer(struct io_input *ext_input, void *buf,
+				   unsigned int buflen,
+				   ds_append_buffer_release_t release,
+				   void *opaque)
+{
+	struct external_input_priv *priv = external_input_priv(ext_input);
+	bool ret = false;
+
+	pthread_mutex_lock(&priv->mutex);
+	if (external_input_wait_room(priv) > 0)
+		ret = ds_append_buffer_append_external(&priv->buf, buf, buflen,
+						       release, opaque);
+	if (ret)
+		priv->has_new = true;
 	pthread_mutex_unlock(&priv->mutex);
 
 	/* wake up waiting thread */
-	pthread_cond_signal(&priv->cond);
+	if (ret)
+		pthread_cond_signal(&priv->cond);
 
-	return buflen;
+	return ret;
 }
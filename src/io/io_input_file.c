@@ -23,23 +23,357 @@
  *
  */
 
+/* pread(), posix_fadvise(), posix_memalign() */
+#define _POSIX_C_SOURCE 200809L
+
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <pthread.h>
 
 #include "io.h"
 
+/* Alignment of read buffers */
+#define FILE_INPUT_BUF_ALIGN 4096
+
+/* Read buffers kept for reuse, chunks in flight plus parsed one */
+#define FILE_INPUT_POOL_BUFS 4
+
 struct file_input_priv {
 	int fd;
 	char filename[MAXPATHLEN];
 };
 
+/*
+ * Pool of read buffers, referenced by input and by each input buffer piece
+ * using buffer of pool. Reusing buffers avoids faulting in new pages for
+ * every chunk.
+ */
+struct readahead_pool {
+	unsigned int refs;
+	pthread_mutex_t lock;
+	unsigned int num_free;
+	void *bufs[FILE_INPUT_POOL_BUFS];
+};
+
+/*
+ * Regular file input, reading large chunks that are passed to parser as
+ * buffer pieces. Kernel reads ahead of parser asynchronously.
+ */
+struct readahead_input_priv {
+	struct io_input input;
+
+	char filename[MAXPATHLEN];
+	struct readahead_pool *pool;
+	int fd;
+	off_t offset;
+	bool stop;
+};
+
+static inline struct readahead_input_priv *
+readahead_input_priv(struct io_input *input)
+{
+	return ds_container_of(input, struct readahead_input_priv, input);
+}
+
+static struct readahead_pool *readahead_pool_alloc(void)
+{
+	struct readahead_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->refs = 1;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+}
+
+static void readahead_pool_put(struct readahead_pool *pool)
+{
+	unsigned int i;
+
+	if (__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	for (i = 0; i < pool->num_free; i++)
+		free(pool->bufs[i]);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/* Get read buffer, reference to pool is taken for buffer */
+static void *readahead_pool_get_buf(struct readahead_pool *pool)
+{
+	void *buf = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_free > 0)
+		buf = pool->bufs[--pool->num_free];
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!buf && posix_memalign(&buf, FILE_INPUT_BUF_ALIGN,
+				   IO_FILE_INPUT_CHUNK_LEN) != 0)
+		return NULL;
+
+	__atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+
+	return buf;
+}
+
+static void readahead_pool_put_buf(struct readahead_pool *pool, void *buf)
+{
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_free < FILE_INPUT_POOL_BUFS) {
+		pool->bufs[pool->num_free++] = buf;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	free(buf);
+	readahead_pool_put(pool);
+}
+
+static void readahead_input_release(void *opaque, void *data,
+				    unsigned int len)
+{
+	readahead_pool_put_buf(opaque, data);
+}
+
+static int readahead_input_open(struct readahead_input_priv *priv)
+{
+	int fd;
+
+	fd = open(priv->filename, O_RDONLY);
+	if (fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    priv->filename, errno);
+		return -1;
+	}
+
+	/*
+	 * Double kernel readahead window, so that asynchronous readahead
+	 * stays ahead of chunk reads. POSIX_FADV_WILLNEED is not used, it
+	 * blocks submitting reads and is slower than plain readahead.
+	 */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return fd;
+}
+
+static int readahead_input_read(struct io_input *input, int *error)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+	unsigned int buffered;
+	void *buf;
+	ssize_t rlen;
+
+	*error = 0;
+
+	/* Parser has not consumed previous input yet */
+	buffered = ds_append_buffer_length(&input->inbuf);
+	if (buffered >= IO_FILE_INPUT_CHUNK_LEN)
+		return 0;
+
+	buf = readahead_pool_get_buf(priv->pool);
+	if (!buf) {
+		/* out of mem */
+		return 0;
+	}
+
+	do {
+		rlen = pread(priv->fd, buf, IO_FILE_INPUT_CHUNK_LEN,
+			     priv->offset);
+	} while (rlen < 0 && errno == EINTR);
+
+	if (rlen <= 0) {
+		/* end of file */
+		*error = rlen < 0 ? errno : ENOSPC;
+		readahead_pool_put_buf(priv->pool, buf);
+		return -1;
+	}
+
+	priv->offset += rlen;
+
+	/* Pass read buffer to parser without copying */
+	if (!ds_append_buffer_append_external(&input->inbuf, buf, rlen,
+					      readahead_input_release,
+					      priv->pool)) {
+		/* out of mem, read again later */
+		priv->offset -= rlen;
+		readahead_pool_put_buf(priv->pool, buf);
+		return 0;
+	}
+
+	return rlen;
+}
+
+static enum io_input_wait_ret readahead_input_wait(struct io_input *input)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+
+	/* Regular file always has input, until end of file is read */
+	if (__atomic_exchange_n(&priv->stop, false, __ATOMIC_ACQ_REL))
+		return IO_INPUT_WAIT_STOP;
+
+	return IO_INPUT_WAIT_NEW;
+}
+
+static bool readahead_input_stop_wait(struct io_input *input)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+
+	__atomic_store_n(&priv->stop, true, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool readahead_input_destroy(struct io_input *input)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+
+	if (!io_parser_destroy(input->parser))
+		return false;
+
+	/* releases buffered pieces */
+	io_input_free(&priv->input);
+	readahead_pool_put(priv->pool);
+	close(priv->fd);
+	free(priv);
+
+	return true;
+}
+
+static bool readahead_input_reopen(struct io_input *input)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+	int fd;
+
+	/* reset parser */
+	if (!io_parser_reset(input->parser))
+		return false;
+
+	/* open file again, file might have been replaced */
+	fd = readahead_input_open(priv);
+	if (fd < 0)
+		return false;
+
+	close(priv->fd);
+	priv->fd = fd;
+	priv->offset = 0;
+
+	return true;
+}
+
+static int readahead_source_read(const struct io_seek_source *src,
+				 unsigned long long offset, void *buf,
+				 unsigned int len)
+{
+	const struct readahead_input_priv *priv = src->priv;
+	ssize_t rlen;
+
+	do {
+		rlen = pread(priv->fd, buf, len, offset);
+	} while (rlen < 0 && errno == EINTR);
+
+	if (rlen < 0) {
+		io_set_latest_error("%s():%d: could not read file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    priv->filename, errno);
+		return -1;
+	}
+
+	return rlen;
+}
+
+static bool readahead_input_seek_time(struct io_input *input, double seconds)
+{
+	struct readahead_input_priv *priv = readahead_input_priv(input);
+	struct io_seek_source src;
+	unsigned long long offset;
+	struct stat st;
+	bool ok;
+
+	if (fstat(priv->fd, &st) < 0) {
+		io_set_latest_error("%s():%d: could not stat file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    priv->filename, errno);
+		return false;
+	}
+
+	src.filename = priv->filename;
+	src.length = st.st_size;
+	src.read = readahead_source_read;
+	src.find_line = NULL;
+	src.priv = priv;
+
+	/* on failure, parser is reset to start of file */
+	ok = io_parser_seek_time(input->parser, &src, seconds, &offset);
+	priv->offset = offset;
+
+	/* stop request left by stopped IO thread would end new position */
+	__atomic_store_n(&priv->stop, false, __ATOMIC_RELEASE);
+
+	return ok;
+}
+
+static const struct io_input_ops readahead_input_ops = {
+	.read = readahead_input_read,
+	.wait = readahead_input_wait,
+	.stop_wait = readahead_input_stop_wait,
+	.destroy = readahead_input_destroy,
+	.reopen = readahead_input_reopen,
+	.seek_time = readahead_input_seek_time,
+};
+
+static struct io_input *io_new_readahead_file_input(struct io_parser *parser,
+						    const char *filename)
+{
+	struct readahead_input_priv *rinput;
+
+	rinput = calloc(1, sizeof(*rinput));
+	if (!rinput) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto err_destroy_parser;
+	}
+
+	/* Initialize */
+	io_input_init(&rinput->input, &readahead_input_ops, parser);
+	snprintf(rinput->filename, sizeof(rinput->filename), "%s", filename);
+
+	rinput->pool = readahead_pool_alloc();
+	if (!rinput->pool) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto err_free;
+	}
+
+	rinput->fd = readahead_input_open(rinput);
+	if (rinput->fd < 0)
+		goto err_put_pool;
+
+	return &rinput->input;
+
+err_put_pool:
+	readahead_pool_put(rinput->pool);
+err_free:
+	io_input_free(&rinput->input);
+	free(rinput);
+err_destroy_parser:
+	io_parser_destroy(parser);
+	return NULL;
+}
+
 static bool file_input_close(struct io_input *input, void *__priv)
 {
 	struct file_input_priv *priv = __priv;
@@ -89,16 +423,23 @@ static int file_input_open(struct io_input *input, void *__priv)
  * io_new_file_input - allocate and initialize file input module
  * @parser: bottom of parser stack to use
  * @filename: file to open for input
+ *
+ * Regular files are read in large chunks with kernel readahead, other files
+ * (pipes, devices) through generic fd input.
  */
 struct io_input *io_new_file_input(struct io_parser *parser,
 				   const char *filename)
 {
 	struct file_input_priv *finput;
 	struct io_input *io;
+	struct stat st;
 
 	if (!parser)
 		return NULL;
 
+	if (stat(filename, &st) == 0 && S_ISREG(st.st_mode))
+		return io_new_readahead_file_input(parser, filename);
+
 	finput = calloc(1, sizeof(*finput));
 	if (!finput) {
 		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
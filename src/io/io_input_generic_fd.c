@@ -32,6 +32,7 @@
 #include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <pthread.h>
 
 #include "io.h"
 
@@ -39,9 +40,15 @@ struct fd_input_priv {
 	struct io_input input;
 
 	int fd;
-	int wait_sockets[2];
 	void *priv;
 
+	/*
+	 * Socketpair used for signal stop_wait to poll(), created on first
+	 * wait. Inputs driven by event loop never wait and only use one fd.
+	 */
+	pthread_mutex_t wait_lock;
+	int wait_sockets[2];
+
 	io_generic_fd_open open_func;
 	io_generic_fd_close close_func;
 };
@@ -106,13 +113,64 @@ out:
 	return err;
 }
 
+static void fd_input_close_wait_sockets(struct fd_input_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (priv->wait_sockets[i] < 0)
+			continue;
+
+		shutdown(priv->wait_sockets[i], SHUT_RDWR);
+		close(priv->wait_sockets[i]);
+		priv->wait_sockets[i] = -1;
+	}
+}
+
+/* Set up wait socketpair if not yet done, wait_lock held */
+static bool fd_input_open_wait_sockets(struct fd_input_priv *priv)
+{
+	int i;
+
+	if (priv->wait_sockets[0] >= 0)
+		return true;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, priv->wait_sockets) < 0) {
+		io_set_latest_error("%s():%d: could not create waiting "
+				    "socketpair (errno: %d)", __func__,
+				    __LINE__, errno);
+		priv->wait_sockets[0] = -1;
+		priv->wait_sockets[1] = -1;
+		return false;
+	}
+
+	/* make sockets non-blocking */
+	for (i = 0; i < 2; i++) {
+		if (!io_set_fd_nonblocking(priv->wait_sockets[i])) {
+			io_set_latest_error("%s():%d: could not set socket[%d] "
+					    "non-blocking (errno: %d)",
+					    __func__, __LINE__, i, errno);
+			fd_input_close_wait_sockets(priv);
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static enum io_input_wait_ret fd_input_wait(struct io_input *input)
 {
 	struct fd_input_priv *priv = fd_input_priv(input);
 	struct pollfd fds[2];
 	int ret, err;
 	unsigned char tmp[16];
-	bool interrupted;
+	bool interrupted, ok;
+
+	pthread_mutex_lock(&priv->wait_lock);
+	ok = fd_input_open_wait_sockets(priv);
+	pthread_mutex_unlock(&priv->wait_lock);
+	if (!ok)
+		return IO_INPUT_WAIT_ERROR;
 
 	/* read all input from wait socket */
 	do {
@@ -168,10 +226,16 @@ static bool fd_input_stop_wait(struct io_input *input)
 {
 	struct fd_input_priv *priv = fd_input_priv(input);
 	unsigned char s = 's';
-	ssize_t wlen;
+	ssize_t wlen = -1;
 
-	/* Writing to wait socket to wake up poll() */
-	wlen = write(priv->wait_sockets[0], &s, 1);
+	/*
+	 * Writing to wait socket to wake up poll(). Without socketpair,
+	 * nothing has waited yet and caller has to retry.
+	 */
+	pthread_mutex_lock(&priv->wait_lock);
+	if (priv->wait_sockets[0] >= 0)
+		wlen = write(priv->wait_sockets[0], &s, 1);
+	pthread_mutex_unlock(&priv->wait_lock);
 
 	return (wlen > 0);
 }
@@ -180,11 +244,7 @@ static bool fd_input_destroy(struct io_input *input)
 {
 	struct fd_input_priv *priv = fd_input_priv(input);
 
-	shutdown(priv->wait_sockets[0], SHUT_RDWR);
-	shutdown(priv->wait_sockets[1], SHUT_RDWR);
-
-	close(priv->wait_sockets[0]);
-	close(priv->wait_sockets[1]);
+	fd_input_close_wait_sockets(priv);
 
 	if (!priv->close_func(input, priv->priv))
 		return false;
@@ -195,6 +255,7 @@ static bool fd_input_destroy(struct io_input *input)
 		return false;
 
 	io_input_free(&priv->input);
+	pthread_mutex_destroy(&priv->wait_lock);
 	free(priv->priv);
 	free(priv);
 
@@ -219,12 +280,18 @@ static bool fd_input_reopen(struct io_input *input)
 	return true;
 }
 
+static int fd_input_get_fd(struct io_input *input)
+{
+	return fd_input_priv(input)->fd;
+}
+
 static const struct io_input_ops fd_input_ops = {
 	.read = fd_input_read,
 	.wait = fd_input_wait,
 	.stop_wait = fd_input_stop_wait,
 	.destroy = fd_input_destroy,
 	.reopen = fd_input_reopen,
+	.get_fd = fd_input_get_fd,
 };
 
 /**
@@ -241,7 +308,6 @@ struct io_input *io_new_generic_fd_input(struct io_parser *parser,
 					 void *priv)
 {
 	struct fd_input_priv *finput;
-	int i;
 
 	if (!parser)
 		return NULL;
@@ -259,36 +325,19 @@ struct io_input *io_new_generic_fd_input(struct io_parser *parser,
 	finput->priv = priv;
 	finput->open_func = open_func;
 	finput->close_func = close_func;
-
-	/* Setup up socketpair used for signal stop_wait to poll() */
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, finput->wait_sockets) < 0) {
-		io_set_latest_error("%s():%d: could not create waiting "
-				    "socketpair (errno: %d)", __func__,
-				    __LINE__, errno);
-		goto err_free;
-	}
-
-	/* make sockets non-blocking */
-	for (i = 0; i < 2; i++) {
-		if (!io_set_fd_nonblocking(finput->wait_sockets[i])) {
-			io_set_latest_error("%s():%d: could not set socket[%d] "
-					    "non-blocking (errno: %d)",
-					    __func__, __LINE__, i, errno);
-			goto err_close_sockets;
-		}
-	}
+	pthread_mutex_init(&finput->wait_lock, NULL);
+	finput->wait_sockets[0] = -1;
+	finput->wait_sockets[1] = -1;
 
 	/* open file descriptor */
 	finput->fd = finput->open_func(&finput->input, finput->priv);
 	if (finput->fd < 0)
-		goto err_close_sockets;
+		goto err_free;
 
 	return &finput->input;
 
-err_close_sockets:
-	close(finput->wait_sockets[0]);
-	close(finput->wait_sockets[1]);
 err_free:
+	pthread_mutex_destroy(&finput->wait_lock);
 	io_input_free(&finput->input);
 	free(finput);
 err_destroy_parser:
@@ -0,0 +1,285 @@
+/*
+ * Memory mapped file input module
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* posix_madvise() */
+#define _POSIX_C_SOURCE 200112L
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "io.h"
+
+/*
+ * Mapping of file, referenced by input and by each input buffer piece
+ * pointing to it. Unmapped when last reference is dropped.
+ */
+struct mmap_region {
+	unsigned int refs;
+	unsigned char *addr;
+	size_t len;
+};
+
+struct mmap_input_priv {
+	struct io_input input;
+
+	char filename[MAXPATHLEN];
+	struct mmap_region *region;
+	size_t offset;
+	bool stop;
+};
+
+static inline struct mmap_input_priv *mmap_input_priv(struct io_input *input)
+{
+	return ds_container_of(input, struct mmap_input_priv, input);
+}
+
+static struct mmap_region *mmap_region_get(struct mmap_region *region)
+{
+	__atomic_add_fetch(&region->refs, 1, __ATOMIC_RELAXED);
+	return region;
+}
+
+static void mmap_region_put(struct mmap_region *region)
+{
+	if (__atomic_sub_fetch(&region->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	if (region->len > 0)
+		munmap(region->addr, region->len);
+	free(region);
+}
+
+static void mmap_input_release(void *opaque, void *data, unsigned int len)
+{
+	mmap_region_put(opaque);
+}
+
+static struct mmap_region *mmap_region_open(const char *filename)
+{
+	struct mmap_region *region;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		io_set_latest_error("%s():%d: could not stat file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		goto err_close;
+	}
+
+	region = calloc(1, sizeof(*region));
+	if (!region) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto err_close;
+	}
+
+	region->refs = 1;
+	region->len = st.st_size;
+
+	/* empty file cannot be mapped, reads end of file immediately */
+	if (region->len > 0) {
+		addr = mmap(NULL, region->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			io_set_latest_error("%s():%d: could not map file[%s] "
+					    "(errno: %d)", __func__, __LINE__,
+					    filename, errno);
+			free(region);
+			goto err_close;
+		}
+
+		region->addr = addr;
+
+		/* let kernel read ahead aggressively */
+		posix_madvise(addr, region->len, POSIX_MADV_SEQUENTIAL);
+	}
+
+	/* mapping stays valid after closing file descriptor */
+	close(fd);
+
+	return region;
+
+err_close:
+	close(fd);
+	return NULL;
+}
+
+static int mmap_input_read(struct io_input *input, int *error)
+{
+	struct mmap_input_priv *priv = mmap_input_priv(input);
+	struct mmap_region *region = priv->region;
+	unsigned int buffered, len;
+	size_t left;
+
+	*error = 0;
+
+	/* end of file */
+	left = region->len - priv->offset;
+	if (left == 0) {
+		*error = ENOSPC;
+		return -1;
+	}
+
+	/* Parser has not consumed previous input yet */
+	buffered = ds_append_buffer_length(&input->inbuf);
+	if (buffered >= IO_MMAP_INPUT_CHUNK_LEN)
+		return 0;
+
+	len = IO_MMAP_INPUT_CHUNK_LEN - buffered;
+	if (len > left)
+		len = left;
+
+	/* Pass mapped pages to parser, piece holds reference to mapping */
+	if (!ds_append_buffer_append_external(&input->inbuf,
+					      region->addr + priv->offset, len,
+					      mmap_input_release,
+					      mmap_region_get(region))) {
+		/* out of mem */
+		mmap_region_put(region);
+		return 0;
+	}
+
+	priv->offset += len;
+
+	return len;
+}
+
+static enum io_input_wait_ret mmap_input_wait(struct io_input *input)
+{
+	struct mmap_input_priv *priv = mmap_input_priv(input);
+
+	/* Mapped file always has input, until end of file is read */
+	if (__atomic_exchange_n(&priv->stop, false, __ATOMIC_ACQ_REL))
+		return IO_INPUT_WAIT_STOP;
+
+	return IO_INPUT_WAIT_NEW;
+}
+
+static bool mmap_input_stop_wait(struct io_input *input)
+{
+	struct mmap_input_priv *priv = mmap_input_priv(input);
+
+	__atomic_store_n(&priv->stop, true, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool mmap_input_destroy(struct io_input *input)
+{
+	struct mmap_input_priv *priv = mmap_input_priv(input);
+
+	if (!io_parser_destroy(input->parser))
+		return false;
+
+	/* releases references of buffered pieces */
+	io_input_free(&priv->input);
+	mmap_region_put(priv->region);
+	free(priv);
+
+	return true;
+}
+
+static bool mmap_input_reopen(struct io_input *input)
+{
+	struct mmap_input_priv *priv = mmap_input_priv(input);
+	struct mmap_region *region;
+
+	/* reset parser */
+	if (!io_parser_reset(input->parser))
+		return false;
+
+	/* map file again, file might have changed */
+	region = mmap_region_open(priv->filename);
+	if (!region)
+		return false;
+
+	mmap_region_put(priv->region);
+	priv->region = region;
+	priv->offset = 0;
+
+	return true;
+}
+
+static const struct io_input_ops mmap_input_ops = {
+	.read = mmap_input_read,
+	.wait = mmap_input_wait,
+	.stop_wait = mmap_input_stop_wait,
+	.destroy = mmap_input_destroy,
+	.reopen = mmap_input_reopen,
+};
+
+/**
+ * io_new_mmap_file_input - allocate and initialize memory mapped file input
+ *			    module
+ * @parser: bottom of parser stack to use
+ * @filename: file to map for input
+ */
+struct io_input *io_new_mmap_file_input(struct io_parser *parser,
+					const char *filename)
+{
+	struct mmap_input_priv *minput;
+
+	if (!parser)
+		return NULL;
+
+	minput = calloc(1, sizeof(*minput));
+	if (!minput) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto err_destroy_parser;
+	}
+
+	/* Initialize */
+	io_input_init(&minput->input, &mmap_input_ops, parser);
+	snprintf(minput->filename, sizeof(minput->filename), "%s", filename);
+
+	minput->region = mmap_region_open(minput->filename);
+	if (!minput->region)
+		goto err_free;
+
+	return &minput->input;
+
+err_free:
+	io_input_free(&minput->input);
+	free(minput);
+err_destroy_parser:
+	io_parser_destroy(parser);
+	return NULL;
+}
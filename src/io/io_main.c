@@ -25,67 +25,1907 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <memory.h>
 #include <math.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "io.h"
 
-static struct io_main {
+/* Maximum number of values dequeued by io_context_get_next_data_lines() */
+#define IO_DATA_LINES_MAX_VALUES 256
+
+/* Frames deinterleaved per copy by io_context_copy_frames() */
+#define IO_COPY_CHUNK_FRAMES 64
+
+/* Value batches tracked at once for latency histogram, power of two */
+#define IO_LATENCY_MARKS 64
+
+/* Counters of context, updated with io_stats_add() */
+struct io_context_stats {
+	unsigned long long values_queued;
+	unsigned long long values_consumed;
+	unsigned long long queue_max_depth;
+	unsigned long long pacing_sleeps;
+	unsigned long long pacing_late_ns;
+	unsigned long long pacing_max_late_ns;
+	unsigned long long pacing_overshoot_ns;
+	unsigned long long pacing_max_overshoot_ns;
+	unsigned long long latency[IO_STATS_LATENCY_BUCKETS];
+};
+
+/* Push time of value batch ending at queue position @pos */
+struct io_latency_mark {
+	unsigned long long pos;
+	unsigned long long time_ns;
+};
+
+struct io_context {
+	/* Serializes consumers and input open/close */
+	pthread_mutex_t main_lock;
+
+	/* Protects input for external input pushers */
+	pthread_mutex_t input_lock;
+
+	/* Protects values queue when IO thread is used */
+	pthread_mutex_t values_lock;
+	pthread_cond_t values_cond;
+	pthread_cond_t free_cond;
+
+	/* Use IO thread for inputs opened after io_context_set_io_thread() */
+	bool use_io_thread;
+
+	/* Event loop for inputs opened after io_context_set_event_loop() */
+	struct io_event_loop *event_loop;
+
+	/* Pacing of values returned to consumer */
+	enum io_pacing_mode pacing_mode;
+	unsigned int pacing_speed;
+	struct io_pacer *pacer;
+
+	/*
+	 * Values buffered by IO thread before parser is stopped with
+	 * IO_PARSER_RET_QUEUE_FULL, and level queue must drop below before
+	 * parsing continues. Larger requests by consumer raise limit
+	 * temporarily.
+	 */
+	unsigned int queue_high_values;
+	unsigned int queue_low_values;
+
+	/* Watermarks for external inputs opened after
+	 * io_context_set_external_input_watermarks() */
+	unsigned int ext_high_bytes;
+	unsigned int ext_low_bytes;
+	bool ext_block;
+
+	/* Channels for inputs opened after io_context_set_channels() */
+	unsigned int channels;
+
+	/* Channels in each frame of values queue of current input */
+	unsigned int frame_channels;
+
+	/* Output rate for inputs opened after io_context_set_sample_rate() */
+	unsigned int sample_rate;
+	enum io_resample_kernel resample_kernel;
+
+	/* Output rate and resampling of current input */
+	unsigned int frame_rate;
+	enum io_resample_kernel frame_kernel;
+
+	/* Consumed frames kept readable for inputs opened after
+	 * io_context_set_history() */
+	unsigned int history_frames;
+
+	/* Values queue format for inputs opened after
+	 * io_context_set_sample_format() */
+	enum io_sample_format sample_format;
+
+	/*
+	 * Values queue of current input, with history of consumed values. Ring
+	 * of @frame_format is used.
+	 */
+	struct io_input *input;
+	enum io_sample_format frame_format;
+	struct ds_float_ring values_ring;
+	struct ds_i16_ring values_ring_i16;
+
+	/* Sink pushing parser blocks to values queue */
+	struct io_sink sink;
+
+	/*
+	 * Statistics. Latency marks and queue positions of current input are
+	 * protected like values queue.
+	 */
+	struct io_context_stats stats;
+	bool latency_enabled;
+	struct io_latency_mark latency_marks[IO_LATENCY_MARKS];
+	unsigned int latency_head;
+	unsigned int latency_tail;
+	unsigned long long queue_in_pos;
+	unsigned long long queue_out_pos;
+
+	/* Monotonic time of next paced return, zero until first return */
+	unsigned long long next_ns;
+
+	/*
+	 * IO thread state, protected by values_lock. With event loop source,
+	 * io_thread_running is set as IO is done outside consumer thread.
+	 */
+	struct io_event_source *event_source;
+	pthread_t io_thread;
+	bool io_thread_running;
+	bool io_thread_done;
+	bool stopping;
+	unsigned int wanted_bytes;
+};
+
+/* Number of values in values queue */
+static inline unsigned int io_context_queued_values(struct io_context *ctx)
+{
+	if (ctx->frame_format == IO_SAMPLE_INT16)
+		return ds_i16_ring_length(&ctx->values_ring_i16);
+
+	return ds_float_ring_length(&ctx->values_ring);
+}
+
+/*
+ * Number of bytes in values queue, as float values. Limits of queue are in
+ * float bytes regardless of format.
+ */
+static inline unsigned int io_context_queued_bytes(struct io_context *ctx)
+{
+	return io_context_queued_values(ctx) * sizeof(float);
+}
+
+static struct io_context main_context = {
+	.main_lock = PTHREAD_MUTEX_INITIALIZER,
+	.input_lock = PTHREAD_MUTEX_INITIALIZER,
+	.values_lock = PTHREAD_MUTEX_INITIALIZER,
+	.values_cond = PTHREAD_COND_INITIALIZER,
+	.free_cond = PTHREAD_COND_INITIALIZER,
+	.queue_high_values = IO_QUEUE_DEFAULT_HIGH_VALUES,
+	.queue_low_values = IO_QUEUE_DEFAULT_HIGH_VALUES,
+	.channels = 1,
+	.frame_channels = 1,
+	.sample_rate = IO_DEFAULT_SAMPLE_RATE,
+	.frame_rate = IO_DEFAULT_SAMPLE_RATE,
+};
+
+/**
+ * io_main_context - get global IO context used by io_main functions
+ */
+struct io_context *io_main_context(void)
+{
+	return &main_context;
+}
+
+/**
+ * io_context_alloc - allocate new IO context
+ */
+struct io_context *io_context_alloc(void)
+{
+	struct io_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	pthread_mutex_init(&ctx->main_lock, NULL);
+	pthread_mutex_init(&ctx->input_lock, NULL);
+	pthread_mutex_init(&ctx->values_lock, NULL);
+	pthread_cond_init(&ctx->values_cond, NULL);
+	pthread_cond_init(&ctx->free_cond, NULL);
+
+	ctx->queue_high_values = IO_QUEUE_DEFAULT_HIGH_VALUES;
+	ctx->queue_low_values = IO_QUEUE_DEFAULT_HIGH_VALUES;
+	ctx->channels = 1;
+	ctx->frame_channels = 1;
+	ctx->sample_rate = IO_DEFAULT_SAMPLE_RATE;
+	ctx->frame_rate = IO_DEFAULT_SAMPLE_RATE;
+
+	return ctx;
+}
+
+/**
+ * io_context_free - close input of context and free context
+ */
+void io_context_free(struct io_context *ctx)
+{
+	if (!ctx)
+		return;
+
+	io_context_close_input(ctx);
+
+	pthread_cond_destroy(&ctx->free_cond);
+	pthread_cond_destroy(&ctx->values_cond);
+	pthread_mutex_destroy(&ctx->values_lock);
+	pthread_mutex_destroy(&ctx->input_lock);
+	pthread_mutex_destroy(&ctx->main_lock);
+
+	free(ctx);
+}
+
+/**
+ * io_context_input_stopping - check if input of context is being closed
+ */
+bool io_context_input_stopping(struct io_context *ctx)
+{
+	bool stopping;
+
+	pthread_mutex_lock(&ctx->values_lock);
+	stopping = ctx->stopping;
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	return stopping;
+}
+
+/**
+ * io_context_input_done - tell consumer that input of context has ended and
+ *			   no more values will come
+ */
+void io_context_input_done(struct io_context *ctx)
+{
+	/* Let consumer and closer know that no more values will come */
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->io_thread_done = true;
+	pthread_cond_broadcast(&ctx->values_cond);
+	pthread_mutex_unlock(&ctx->values_lock);
+}
+
+/**
+ * io_context_thread - IO thread, runs input processing loop for context input
+ */
+static void *io_context_thread(void *arg)
+{
+	struct io_context *ctx = arg;
+	struct io_input *input = ctx->input;
+
+	do {
+		io_input_process_loop(input);
+
+		/* End of input or error, restart input from beginning */
+		if (io_context_input_stopping(ctx) || !io_input_reopen(input))
+			break;
+	} while (true);
+
+	io_context_input_done(ctx);
+
+	return NULL;
+}
+
+/**
+ * io_context_remove_event_source - stop event loop from processing context
+ *				    input
+ */
+static void io_context_remove_event_source(struct io_context *ctx)
+{
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->stopping = true;
+	pthread_cond_broadcast(&ctx->free_cond);
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	/* Waits for worker processing input */
+	io_event_loop_remove(ctx->event_source);
+
+	ctx->event_source = NULL;
+	ctx->io_thread_running = false;
+}
+
+/**
+ * io_context_stop_io_thread - stop and join IO thread of context
+ */
+static void io_context_stop_io_thread(struct io_context *ctx)
+{
+	struct ds_timespec abstime;
+	struct timespec ts;
+
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->stopping = true;
+	pthread_cond_broadcast(&ctx->free_cond);
+
+	/*
+	 * Input wait might miss stop if IO thread was not yet waiting, so
+	 * repeat until thread is done.
+	 */
+	while (!ctx->io_thread_done) {
+		io_input_stop_wait(ctx->input);
+
+		ds_make_timeout_ms(&abstime, 10);
+		ts.tv_sec = abstime.tv_sec;
+		ts.tv_nsec = abstime.tv_nsec;
+		pthread_cond_timedwait(&ctx->values_cond, &ctx->values_lock,
+				       &ts);
+	}
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	pthread_join(ctx->io_thread, NULL);
+	ctx->io_thread_running = false;
+}
+
+/**
+ * io_context_stop_io - stop IO thread or event loop from processing context
+ *			input, input is kept open
+ */
+static void io_context_stop_io(struct io_context *ctx)
+{
+	if (ctx->event_source)
+		io_context_remove_event_source(ctx);
+	else if (ctx->io_thread_running)
+		io_context_stop_io_thread(ctx);
+}
+
+/**
+ * io_context_start_io - start processing context input in event loop or IO
+ *			 thread, if enabled for context
+ */
+static void io_context_start_io(struct io_context *ctx)
+{
+	if (ctx->input && ctx->event_loop) {
+		/* Queue is shared with worker threads, as with IO thread */
+		ctx->io_thread_running = true;
+
+		/* Inputs without pollable fd fall back to IO thread */
+		ctx->event_source = io_event_loop_add(ctx->event_loop, ctx,
+						      ctx->input);
+		ctx->io_thread_running = ctx->event_source != NULL;
+	}
+
+	if (ctx->input && !ctx->event_source &&
+	    (ctx->use_io_thread || ctx->event_loop)) {
+		ctx->io_thread_running = true;
+
+		/* On failure, fall back to doing IO in caller thread */
+		if (pthread_create(&ctx->io_thread, NULL, io_context_thread,
+				   ctx) != 0) {
+			io_set_latest_error("%s():%d: could not create IO "
+					    "thread (errno: %d)", __func__,
+					    __LINE__, errno);
+			ctx->io_thread_running = false;
+		}
+	}
+}
+
+/**
+ * __io_context_close_input - close input of context, lockless
+ */
+static void __io_context_close_input(struct io_context *ctx)
+{
+	if (ctx->input) {
+		/*
+		 * Release external input pushers blocked on full input while
+		 * holding input_lock.
+		 */
+		io_input_stop_wait(ctx->input);
+		io_context_stop_io(ctx);
+
+		pthread_mutex_lock(&ctx->input_lock);
+		io_input_destroy(ctx->input);
+		ds_float_ring_free(&ctx->values_ring);
+		ds_i16_ring_free(&ctx->values_ring_i16);
+
+		ctx->input = NULL;
+		ctx->next_ns = 0;
+		ctx->io_thread_done = false;
+		ctx->stopping = false;
+		ctx->wanted_bytes = 0;
+		pthread_mutex_unlock(&ctx->input_lock);
+	}
+}
+
+/**
+ * io_context_wake_consumer - wake up consumer waiting on IO thread, so that
+ *			      main_lock gets released
+ */
+static void io_context_wake_consumer(struct io_context *ctx)
+{
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->stopping = true;
+	pthread_cond_broadcast(&ctx->values_cond);
+	pthread_mutex_unlock(&ctx->values_lock);
+}
+
+/**
+ * io_context_close_input - close input of context
+ */
+void io_context_close_input(struct io_context *ctx)
+{
+	io_context_wake_consumer(ctx);
+
+	pthread_mutex_lock(&ctx->main_lock);
+	__io_context_close_input(ctx);
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_set_input - set new input for context, previous input is closed
+ * @ctx: IO context
+ * @input: new input, parser stack of input is set to emit values to @ctx
+ */
+void io_context_set_input(struct io_context *ctx, struct io_input *input)
+{
+	io_context_wake_consumer(ctx);
+
+	pthread_mutex_lock(&ctx->main_lock);
+
+	/* Close currently open input */
+	__io_context_close_input(ctx);
+
+	/* Parsed values go to this context */
+	ctx->frame_channels = ctx->channels;
+	ctx->frame_rate = ctx->sample_rate;
+	ctx->frame_kernel = ctx->resample_kernel;
+	ctx->frame_format = ctx->sample_format;
+	if (input)
+		io_parser_set_context(input->parser, ctx);
+
+	pthread_mutex_lock(&ctx->input_lock);
+	ctx->input = input;
+	pthread_mutex_unlock(&ctx->input_lock);
+
+	/*
+	 * Ring is sized for queue limit of IO thread and grows only for larger
+	 * consumer requests, or when IO is done in consumer thread and parser
+	 * outputs large batches. On allocation failure, ring is allocated on
+	 * first push.
+	 */
+	if (ctx->frame_format == IO_SAMPLE_INT16)
+		ds_i16_ring_init(&ctx->values_ring_i16,
+				 ctx->queue_high_values +
+				 IO_RESAMPLER_BLOCK_FRAMES * IO_MAX_CHANNELS,
+				 ctx->history_frames * ctx->frame_channels);
+	else
+		ds_float_ring_init(&ctx->values_ring, ctx->queue_high_values +
+				   IO_RESAMPLER_BLOCK_FRAMES * IO_MAX_CHANNELS,
+				   ctx->history_frames * ctx->frame_channels);
+
+	/* Clear timer */
+	ctx->next_ns = 0;
+
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->stopping = false;
+	ctx->io_thread_done = false;
+	ctx->wanted_bytes = 0;
+	ctx->latency_head = 0;
+	ctx->latency_tail = 0;
+	ctx->queue_in_pos = 0;
+	ctx->queue_out_pos = 0;
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	io_context_start_io(ctx);
+
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_seek_time - move input of context to time of stream
+ * @ctx: IO context
+ * @seconds: time from start of stream
+ *
+ * Waits for consumer of context to return, consumer is not interrupted.
+ */
+bool io_context_seek_time(struct io_context *ctx, double seconds)
+{
+	bool ok;
+
+	pthread_mutex_lock(&ctx->main_lock);
+
+	if (!ctx->input || !ctx->input->ops->seek_time) {
+		pthread_mutex_unlock(&ctx->main_lock);
+		io_set_latest_error("%s():%d: input cannot seek", __func__,
+				    __LINE__);
+		return false;
+	}
+
+	/* Input is not processed by other threads while it is moved */
+	io_context_stop_io(ctx);
+
+	pthread_mutex_lock(&ctx->input_lock);
+	ok = io_input_seek_time(ctx->input, seconds);
+	pthread_mutex_unlock(&ctx->input_lock);
+
+	/* Values and history of previous position are dropped */
+	pthread_mutex_lock(&ctx->values_lock);
+	ds_float_ring_clear(&ctx->values_ring);
+	ds_i16_ring_clear(&ctx->values_ring_i16);
+	ctx->stopping = false;
+	ctx->io_thread_done = false;
+	ctx->wanted_bytes = 0;
+	ctx->latency_head = 0;
+	ctx->latency_tail = 0;
+	ctx->queue_in_pos = 0;
+	ctx->queue_out_pos = 0;
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	/* Restart pacing */
+	ctx->next_ns = 0;
+
+	io_context_start_io(ctx);
+
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return ok;
+}
+
+/**
+ * io_context_set_io_thread - select where IO for context input is done
+ * @ctx: IO context
+ * @enable: if true, inputs opened after this call are read and parsed in
+ *	    dedicated IO thread, otherwise in io_context_get_next_values()
+ *	    caller thread
+ */
+void io_context_set_io_thread(struct io_context *ctx, bool enable)
+{
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->use_io_thread = enable;
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_set_event_loop - drive context inputs by event loop
+ * @ctx: IO context
+ * @loop: event loop, or NULL to stop using event loop
+ *
+ * Inputs opened after this call are read and parsed by worker threads of
+ * @loop. Inputs without pollable file descriptor use dedicated IO thread.
+ */
+void io_context_set_event_loop(struct io_context *ctx,
+			       struct io_event_loop *loop)
+{
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->event_loop = loop;
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_set_pacer - pace context by shared pacing scheduler
+ * @ctx: IO context
+ * @pacer: pacing scheduler, or NULL to sleep in consumer thread (default)
+ */
+void io_context_set_pacer(struct io_context *ctx, struct io_pacer *pacer)
+{
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->pacer = pacer;
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_stats_load_parser - read counters of parser
+ */
+static void io_stats_load_parser(struct io_parser_stats *dst,
+				 const struct io_parser_stats *src)
+{
+	dst->parse_calls = io_stats_load(&src->parse_calls);
+	dst->bytes_in = io_stats_load(&src->bytes_in);
+	dst->bytes_out = io_stats_load(&src->bytes_out);
+	dst->parse_ns = io_stats_load(&src->parse_ns);
+	dst->decode_ns = io_stats_load(&src->decode_ns);
+}
+
+/**
+ * io_context_get_stats - take snapshot of statistics of context
+ * @ctx: IO context
+ * @stats: snapshot is stored here
+ *
+ * Can be called from any thread. Counters are read without stopping IO, so
+ * snapshot is not atomic over all counters.
+ */
+void io_context_get_stats(struct io_context *ctx, struct io_stats *stats)
+{
+	struct io_parser *parser;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->values_queued = io_stats_load(&ctx->stats.values_queued);
+	stats->values_consumed = io_stats_load(&ctx->stats.values_consumed);
+	stats->queue_max_depth = io_stats_load(&ctx->stats.queue_max_depth);
+	stats->pacing_sleeps = io_stats_load(&ctx->stats.pacing_sleeps);
+	stats->pacing_late_ns = io_stats_load(&ctx->stats.pacing_late_ns);
+	stats->pacing_max_late_ns =
+			io_stats_load(&ctx->stats.pacing_max_late_ns);
+	stats->pacing_overshoot_ns =
+			io_stats_load(&ctx->stats.pacing_overshoot_ns);
+	stats->pacing_max_overshoot_ns =
+			io_stats_load(&ctx->stats.pacing_max_overshoot_ns);
+	for (i = 0; i < IO_STATS_LATENCY_BUCKETS; i++)
+		stats->latency[i] = io_stats_load(&ctx->stats.latency[i]);
+
+	/*
+	 * Do not take main_lock, consumer might be holding it while waiting
+	 * for input. Input is closed under input_lock.
+	 */
+	pthread_mutex_lock(&ctx->input_lock);
+	if (ctx->input) {
+		pthread_mutex_lock(&ctx->values_lock);
+		stats->queue_depth = io_context_queued_values(ctx);
+		pthread_mutex_unlock(&ctx->values_lock);
+
+		stats->input.reads = io_stats_load(&ctx->input->stats.reads);
+		stats->input.bytes_in =
+				io_stats_load(&ctx->input->stats.bytes_in);
+		stats->input.reopens =
+				io_stats_load(&ctx->input->stats.reopens);
+
+		parser = ctx->input->parser;
+		for (i = 0; parser && i < IO_STATS_MAX_PARSERS; i++) {
+			stats->parser_names[i] = parser->ops->name;
+			io_stats_load_parser(&stats->parsers[i],
+					     &parser->stats);
+			parser = io_parser_get_child(parser);
+		}
+		stats->num_parsers = i;
+	}
+	pthread_mutex_unlock(&ctx->input_lock);
+}
+
+/**
+ * io_context_set_latency_histogram - enable histogram of end-to-end sample
+ *				      latency
+ * @ctx: IO context
+ * @enable: if true, push time of value batches is recorded and latency is
+ *	    counted when consumer gets last value of batch
+ */
+void io_context_set_latency_histogram(struct io_context *ctx, bool enable)
+{
+	__atomic_store_n(&ctx->latency_enabled, enable, __ATOMIC_RELAXED);
+}
+
+/**
+ * io_context_set_queue_watermarks - set limits of values queued by IO thread
+ * @ctx: IO context
+ * @high_values: parsing stops when this many values are queued
+ * @low_values: parsing continues when queue drops below this many values
+ *
+ * Returns false if @high_values is zero or @low_values is not in range
+ * 1..@high_values.
+ */
+bool io_context_set_queue_watermarks(struct io_context *ctx,
+				     unsigned int high_values,
+				     unsigned int low_values)
+{
+	if (high_values == 0 || low_values == 0 || low_values > high_values ||
+	    high_values > UINT_MAX / sizeof(float)) {
+		io_set_latest_error("%s():%d: invalid queue watermarks %u/%u",
+				    __func__, __LINE__, high_values,
+				    low_values);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->values_lock);
+	ctx->queue_high_values = high_values;
+	ctx->queue_low_values = low_values;
+	pthread_cond_broadcast(&ctx->free_cond);
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	return true;
+}
+
+/**
+ * io_context_set_external_input_watermarks - limit data buffered by external
+ *					      inputs of context
+ * @ctx: IO context
+ * @high_bytes: pushing stops when this much pushed data is unread, zero for
+ *		no limit (default)
+ * @low_bytes: blocked pushing continues when unread data drops to this
+ * @block: if true, pushers block until there is room, otherwise pushes are
+ *	   short
+ *
+ * Applies to external inputs opened after this call. Returns false if
+ * @low_bytes is larger than @high_bytes.
+ */
+bool io_context_set_external_input_watermarks(struct io_context *ctx,
+					      unsigned int high_bytes,
+					      unsigned int low_bytes,
+					      bool block)
+{
+	if (high_bytes > 0 && low_bytes > high_bytes) {
+		io_set_latest_error("%s():%d: low watermark %u above high "
+				    "watermark %u", __func__, __LINE__,
+				    low_bytes, high_bytes);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->ext_high_bytes = high_bytes;
+	ctx->ext_low_bytes = low_bytes;
+	ctx->ext_block = block;
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return true;
+}
+
+/**
+ * io_context_set_pacing - select how fast values are returned from context
+ * @ctx: IO context
+ * @mode: IO_PACING_REALTIME returns values at 4ms per value (default),
+ *	  IO_PACING_SPEEDUP at @speed times real time and IO_PACING_UNTHROTTLED
+ *	  as fast as input can be decoded
+ * @speed: speed-up factor for IO_PACING_SPEEDUP, ignored by other modes
+ */
+void io_context_set_pacing(struct io_context *ctx, enum io_pacing_mode mode,
+			   unsigned int speed)
+{
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->pacing_mode = mode;
+	ctx->pacing_speed = speed > 0 ? speed : 1;
+
+	/* Restart timer with new pace */
+	ctx->next_ns = 0;
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_set_channels - set number of value columns decoded from input
+ * @ctx: IO context
+ * @num_channels: channels per frame, 1 to IO_MAX_CHANNELS. Applies to inputs
+ *		  opened after this call.
+ *
+ * Returns false if @num_channels is out of range.
+ */
+bool io_context_set_channels(struct io_context *ctx, unsigned int num_channels)
+{
+	if (num_channels < 1 || num_channels > IO_MAX_CHANNELS) {
+		io_set_latest_error("%s():%d: invalid number of channels: %u",
+				    __func__, __LINE__, num_channels);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->channels = num_channels;
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return true;
+}
+
+/**
+ * io_context_set_history - keep last consumed frames readable with
+ *			    io_context_get_history()
+ * @ctx: IO context
+ * @num_frames: number of frames, up to IO_MAX_HISTORY_FRAMES. Applies to
+ *		inputs opened after this call.
+ *
+ * Returns false if @num_frames is out of range.
+ */
+bool io_context_set_history(struct io_context *ctx, unsigned int num_frames)
+{
+	if (num_frames > IO_MAX_HISTORY_FRAMES) {
+		io_set_latest_error("%s():%d: invalid number of history frames: "
+				    "%u", __func__, __LINE__, num_frames);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->history_frames = num_frames;
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return true;
+}
+
+/**
+ * io_context_get_history - copy last consumed frames of current input
+ * @ctx: IO context
+ * @frames: buffer for @num_frames * channels values, oldest frame first
+ * @num_frames: number of frames wanted
+ *
+ * Returns number of frames copied, less than @num_frames if fewer frames have
+ * been consumed or history set with io_context_set_history() is shorter.
+ */
+unsigned int io_context_get_history(struct io_context *ctx, float *frames,
+				    unsigned int num_frames)
+{
+	struct ds_float_ring_span spans[2];
+	struct ds_i16_ring_span spans_i16[2];
+	unsigned int i, j, num = 0;
+
+	pthread_mutex_lock(&ctx->main_lock);
+
+	if (!ctx->input || num_frames > IO_MAX_HISTORY_FRAMES)
+		goto out;
+
+	/* IO thread may grow ring while pushing */
+	if (ctx->io_thread_running)
+		pthread_mutex_lock(&ctx->values_lock);
+
+	if (ctx->frame_format == IO_SAMPLE_INT16) {
+		num = ds_i16_ring_get_history(&ctx->values_ring_i16,
+					      num_frames * ctx->frame_channels,
+					      spans_i16);
+		for (i = 0; i < 2; i++) {
+			for (j = 0; j < spans_i16[i].len; j++)
+				*frames++ = io_sample_from_i16(
+						spans_i16[i].values[j]);
+		}
+	} else {
+		num = ds_float_ring_get_history(&ctx->values_ring,
+						num_frames *
+						ctx->frame_channels, spans);
+		if (num > 0) {
+			memcpy(frames, spans[0].values,
+			       spans[0].len * sizeof(float));
+			memcpy(frames + spans[0].len, spans[1].values,
+			       spans[1].len * sizeof(float));
+		}
+	}
+
+	if (ctx->io_thread_running)
+		pthread_mutex_unlock(&ctx->values_lock);
+
+	num /= ctx->frame_channels;
+out:
+	pthread_mutex_unlock(&ctx->main_lock);
+	return num;
+}
+
+/**
+ * io_context_get_channels - get number of channels in frames of current input
+ */
+unsigned int io_context_get_channels(struct io_context *ctx)
+{
+	return ctx->frame_channels;
+}
+
+/**
+ * io_context_set_sample_rate - set output rate of values decoded from input
+ * @ctx: IO context
+ * @rate: output rate in Hz, IO_DEFAULT_SAMPLE_RATE is 4ms interval
+ * @kernel: interpolation used for resampling input to @rate
+ *
+ * Applies to inputs opened after this call. Returns false if @rate is zero.
+ */
+bool io_context_set_sample_rate(struct io_context *ctx, unsigned int rate,
+				enum io_resample_kernel kernel)
+{
+	if (rate == 0) {
+		io_set_latest_error("%s():%d: invalid sample rate: %u",
+				    __func__, __LINE__, rate);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->sample_rate = rate;
+	ctx->resample_kernel = kernel;
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return true;
+}
+
+/**
+ * io_context_get_sample_rate - get output rate of current input
+ * @ctx: IO context
+ * @kernel: if not NULL, interpolation kernel of current input is stored here
+ */
+unsigned int io_context_get_sample_rate(struct io_context *ctx,
+					enum io_resample_kernel *kernel)
+{
+	if (kernel)
+		*kernel = ctx->frame_kernel;
+
+	return ctx->frame_rate;
+}
+
+/**
+ * io_context_set_sample_format - set format of values queue
+ * @ctx: IO context
+ * @format: format for inputs opened after this call
+ */
+void io_context_set_sample_format(struct io_context *ctx,
+				  enum io_sample_format format)
+{
+	pthread_mutex_lock(&ctx->main_lock);
+	ctx->sample_format = format;
+	pthread_mutex_unlock(&ctx->main_lock);
+}
+
+/**
+ * io_context_get_sample_format - get format of values queue of current input
+ */
+enum io_sample_format io_context_get_sample_format(struct io_context *ctx)
+{
+	return ctx->frame_format;
+}
+
+/**
+ * io_context_open_txt_file_input - open file with name @filename for context
+ *				    input
+ *
+ * Basic file handler, ECG data in ASCII file
+ */
+void io_context_open_txt_file_input(struct io_context *ctx,
+				    const char *filename)
+{
+	/* Create new input, TXT parser, file input */
+	io_context_set_input(ctx, io_new_file_input(io_new_gz_parser(
+		io_new_text_parser()), filename));
+}
+
+/**
+ * io_context_open_bin_file_input - open binary sample file with name
+ *				    @filename for context input
+ *
+ * File is memory mapped, gzip compressed files are decompressed.
+ */
+void io_context_open_bin_file_input(struct io_context *ctx,
+				    const char *filename)
+{
+	/* Create new input, binary parser, memory mapped file input */
+	io_context_set_input(ctx, io_new_mmap_file_input(io_new_gz_parser(
+		io_new_bin_parser()), filename));
+}
+
+/**
+ * io_context_open_txt_external_input - open external text input for context
+ */
+void io_context_open_txt_external_input(struct io_context *ctx)
+{
 	struct io_input *input;
-	struct ds_append_buffer input_values_buffer;
-	struct ds_timespec next_time;
-} io_main;
 
-static pthread_mutex_t main_lock = PTHREAD_MUTEX_INITIALIZER;
+	/* Create new external input with TXT parser */
+	input = io_new_external_input(io_new_text_parser());
+	if (input) {
+		pthread_mutex_lock(&ctx->main_lock);
+		io_external_input_set_watermarks(input, ctx->ext_high_bytes,
+						 ctx->ext_low_bytes,
+						 ctx->ext_block);
+		pthread_mutex_unlock(&ctx->main_lock);
+	}
+
+	io_context_set_input(ctx, input);
+}
+
+/**
+ * io_context_push_external_input - push data to context input that has been
+ *				    opened with
+ *				    io_context_open_txt_external_input()
+ * @ctx: IO context
+ * @buf: buffer with new data
+ * @buflen: length of buffer in bytes
+ *
+ * Returns number of bytes pushed (returns < buflen when out of memory, or
+ * when watermark set by io_context_set_external_input_watermarks() is
+ * reached).
+ */
+int io_context_push_external_input(struct io_context *ctx, void *buf,
+				   unsigned int buflen)
+{
+	int ret = 0;
+
+	/*
+	 * Do not take main_lock, consumer might be holding it while waiting
+	 * for this input.
+	 */
+	pthread_mutex_lock(&ctx->input_lock);
+	if (ctx->input)
+		ret = io_external_input_push_data(ctx->input, buf, buflen);
+	pthread_mutex_unlock(&ctx->input_lock);
+
+	return ret;
+}
+
+/**
+ * io_context_push_external_input_buffer - push memory owned by caller to
+ *					   context external input without
+ *					   copying
+ * @ctx: IO context
+ * @buf: buffer with new data, must stay valid until @release is called
+ * @buflen: length of buffer in bytes
+ * @release: called when input no longer references @buf, can be NULL
+ * @opaque: passed to @release
+ *
+ * Returns false if input is not open or when out of memory, @release is not
+ * called in that case.
+ */
+bool io_context_push_external_input_buffer(struct io_context *ctx, void *buf,
+					   unsigned int buflen,
+					   ds_append_buffer_release_t release,
+					   void *opaque)
+{
+	bool ret = false;
+
+	/* Do not take main_lock, see io_context_push_external_input() */
+	pthread_mutex_lock(&ctx->input_lock);
+	if (ctx->input)
+		ret = io_external_input_push_buffer(ctx->input, buf, buflen,
+						    release, opaque);
+	pthread_mutex_unlock(&ctx->input_lock);
+
+	return ret;
+}
+
+/**
+ * __io_context_queue_is_full - check values queue limit, values_lock must be
+ *				held
+ */
+static bool __io_context_queue_is_full(struct io_context *ctx)
+{
+	unsigned int len = io_context_queued_bytes(ctx);
+
+	return len >= ctx->queue_high_values * sizeof(float) &&
+	       len >= ctx->wanted_bytes;
+}
+
+/**
+ * __io_context_queue_has_room - check if queue has dropped below low
+ *				 watermark, values_lock must be held
+ */
+static bool __io_context_queue_has_room(struct io_context *ctx)
+{
+	unsigned int len = io_context_queued_bytes(ctx);
+
+	return len < ctx->queue_low_values * sizeof(float) ||
+	       len < ctx->wanted_bytes;
+}
+
+/**
+ * io_context_queue_is_full - check if ECG input data queue of context is full
+ *
+ * Always false when IO is done in caller thread.
+ */
+bool io_context_queue_is_full(struct io_context *ctx)
+{
+	bool full;
+
+	if (!ctx->io_thread_running)
+		return false;
+
+	pthread_mutex_lock(&ctx->values_lock);
+	full = __io_context_queue_is_full(ctx) && !ctx->stopping;
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	return full;
+}
+
+/**
+ * io_context_queue_is_shared - check if ECG input data queue of context is
+ *				filled outside consumer thread
+ */
+bool io_context_queue_is_shared(struct io_context *ctx)
+{
+	return ctx->io_thread_running;
+}
+
+/**
+ * io_context_queue_wait_free - wait until ECG input data queue of context has
+ *				room
+ *
+ * Returns false if input is being closed.
+ */
+bool io_context_queue_wait_free(struct io_context *ctx)
+{
+	bool ret;
+
+	if (!ctx->io_thread_running)
+		return true;
+
+	pthread_mutex_lock(&ctx->values_lock);
+	/* Continue only after consumer has drained queue below low watermark */
+	while (!__io_context_queue_has_room(ctx) && !ctx->stopping)
+		pthread_cond_wait(&ctx->free_cond, &ctx->values_lock);
+	ret = !ctx->stopping;
+	pthread_mutex_unlock(&ctx->values_lock);
+
+	return ret;
+}
+
+/**
+ * io_context_stats_pushed - count @num values pushed to values queue
+ *
+ * Called with values queue protected.
+ */
+static void io_context_stats_pushed(struct io_context *ctx, unsigned int num)
+{
+	struct io_latency_mark *mark;
+
+	io_stats_add(&ctx->stats.values_queued, num);
+	io_stats_max(&ctx->stats.queue_max_depth,
+		     io_context_queued_values(ctx));
+
+	ctx->queue_in_pos += num;
+
+	if (!__atomic_load_n(&ctx->latency_enabled, __ATOMIC_RELAXED))
+		return;
+
+	/* Batches pushed while all marks are in use are not sampled */
+	if (ctx->latency_tail - ctx->latency_head == IO_LATENCY_MARKS)
+		return;
+
+	mark = &ctx->latency_marks[ctx->latency_tail++ &
+				   (IO_LATENCY_MARKS - 1)];
+	mark->pos = ctx->queue_in_pos;
+	mark->time_ns = io_get_monotonic_ns();
+}
+
+/**
+ * io_context_stats_consumed - count @num values taken by consumer and
+ *			       latency of value batches consumed fully
+ *
+ * Called with values queue protected.
+ */
+static void io_context_stats_consumed(struct io_context *ctx,
+				      unsigned int num)
+{
+	struct io_latency_mark *mark;
+	unsigned long long now = 0, usec;
+	unsigned int bucket;
+
+	io_stats_add(&ctx->stats.values_consumed, num);
+
+	ctx->queue_out_pos += num;
+
+	while (ctx->latency_head != ctx->latency_tail) {
+		mark = &ctx->latency_marks[ctx->latency_head &
+					   (IO_LATENCY_MARKS - 1)];
+		if (mark->pos > ctx->queue_out_pos)
+			break;
+
+		if (now == 0)
+			now = io_get_monotonic_ns();
+
+		/* Log2 buckets of microseconds */
+		usec = (now - mark->time_ns) / 1000;
+		bucket = usec < 2 ? 0 : 63 - __builtin_clzll(usec);
+		if (bucket >= IO_STATS_LATENCY_BUCKETS)
+			bucket = IO_STATS_LATENCY_BUCKETS - 1;
+		io_stats_add(&ctx->stats.latency[bucket], 1);
+
+		ctx->latency_head++;
+	}
+}
+
+/**
+ * io_context_store_float - store @num_values values of @values in @format to
+ *			    float values queue
+ *
+ * Returns number of values stored. Called with values queue protected.
+ */
+static unsigned int io_context_store_float(struct io_context *ctx,
+					   enum io_sample_format format,
+					   const void *values,
+					   unsigned int num_values)
+{
+	const int16_t *values_i16 = values;
+	const float *values_f = values;
+	unsigned int i, num, pos = 0;
+	float *end;
+
+	while (pos < num_values) {
+		end = ds_float_ring_get_end_free(&ctx->values_ring, &num);
+		if (num == 0)
+			break;
+		if (num > num_values - pos)
+			num = num_values - pos;
+
+		/*
+		 * TODO: Find and fix the real bug... our iPhone part is having
+		 * strange performance problem with too accurate floating-point
+		 * values.
+		 */
+		if (format == IO_SAMPLE_INT16) {
+			for (i = 0; i < num; i++)
+				end[i] = io_sample_from_i16(
+						values_i16[pos + i]);
+		} else {
+			for (i = 0; i < num; i++)
+				end[i] = roundf(values_f[pos + i] * 100.0f) /
+					 100;
+		}
+
+		ds_float_ring_move_end(&ctx->values_ring, num);
+		pos += num;
+	}
+
+	return pos;
+}
+
+/**
+ * io_context_store_i16 - store @num_values values of @values in @format to
+ *			  int16 values queue
+ *
+ * Returns number of values stored. Called with values queue protected.
+ */
+static unsigned int io_context_store_i16(struct io_context *ctx,
+					 enum io_sample_format format,
+					 const void *values,
+					 unsigned int num_values)
+{
+	const int16_t *values_i16 = values;
+	const float *values_f = values;
+	unsigned int i, num, pos = 0;
+	int16_t *end;
+
+	while (pos < num_values) {
+		end = ds_i16_ring_get_end_free(&ctx->values_ring_i16, &num);
+		if (num == 0)
+			break;
+		if (num > num_values - pos)
+			num = num_values - pos;
+
+		if (format == IO_SAMPLE_INT16) {
+			memcpy(end, values_i16 + pos, num * sizeof(*end));
+		} else {
+			for (i = 0; i < num; i++)
+				end[i] = io_sample_to_i16(values_f[pos + i]);
+		}
+
+		ds_i16_ring_move_end(&ctx->values_ring_i16, num);
+		pos += num;
+	}
+
+	return pos;
+}
+
+/**
+ * io_context_push_values - add @num_frames frames of @frames in @format to
+ *			    values queue of context
+ */
+static bool io_context_push_values(struct io_context *ctx,
+				   enum io_sample_format format,
+				   const void *frames, unsigned int num_frames)
+{
+	unsigned int values = num_frames * ctx->frame_channels;
+	unsigned int pos;
+	bool reserved;
+
+	if (ctx->io_thread_running)
+		pthread_mutex_lock(&ctx->values_lock);
+
+	if (ctx->frame_format == IO_SAMPLE_INT16) {
+		reserved = ds_i16_ring_reserve(&ctx->values_ring_i16, values);
+		pos = io_context_store_i16(ctx, format, frames, values);
+	} else {
+		reserved = ds_float_ring_reserve(&ctx->values_ring, values);
+		pos = io_context_store_float(ctx, format, frames, values);
+	}
+
+	if (!reserved)
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+
+	io_context_stats_pushed(ctx, pos);
+
+	if (ctx->io_thread_running) {
+		if (io_context_queued_bytes(ctx) >=
+							ctx->wanted_bytes)
+			pthread_cond_signal(&ctx->values_cond);
+		pthread_mutex_unlock(&ctx->values_lock);
+	}
+
+	return reserved;
+}
+
+/**
+ * io_context_queue_push_frames - add @num_frames frames of @frames to ECG
+ *				  input data queue of context
+ * @ctx: IO context
+ * @frames: interleaved frames of io_context_get_channels() values
+ * @num_frames: number of frames
+ */
+bool io_context_queue_push_frames(struct io_context *ctx, const float *frames,
+				  unsigned int num_frames)
+{
+	return io_context_push_values(ctx, IO_SAMPLE_FLOAT32, frames,
+				      num_frames);
+}
+
+/**
+ * io_context_queue_push_frames_i16 - add @num_frames int16 fixed-point frames
+ *				      of @frames to ECG input data queue of
+ *				      context
+ * @ctx: IO context
+ * @frames: interleaved frames of io_context_get_channels() values
+ * @num_frames: number of frames
+ */
+bool io_context_queue_push_frames_i16(struct io_context *ctx,
+				      const int16_t *frames,
+				      unsigned int num_frames)
+{
+	return io_context_push_values(ctx, IO_SAMPLE_INT16, frames,
+				      num_frames);
+}
+
+static bool io_context_sink_emit_block(struct io_sink *sink,
+				       const float *frames,
+				       unsigned int num_frames,
+				       unsigned int channels,
+				       unsigned int channel_id, double time)
+{
+	struct io_context *ctx = sink->priv;
+
+	if (channels != ctx->frame_channels) {
+		io_set_latest_error("%s():%d: block has %u channels, context "
+				    "has %u", __func__, __LINE__, channels,
+				    ctx->frame_channels);
+		return false;
+	}
+
+	return io_context_queue_push_frames(ctx, frames, num_frames);
+}
+
+/**
+ * io_context_get_sink - get sink pushing blocks of parser stack to ECG input
+ *			 data queue of context
+ */
+struct io_sink *io_context_get_sink(struct io_context *ctx)
+{
+	ctx->sink.emit_block = io_context_sink_emit_block;
+	ctx->sink.priv = ctx;
+
+	return &ctx->sink;
+}
+
+/**
+ * io_context_queue_push_4ms_interval_frame - add frame of @values to ECG
+ *					      input data queue of context
+ * @ctx: IO context
+ * @values: one value for each of io_context_get_channels() channels
+ */
+bool io_context_queue_push_4ms_interval_frame(struct io_context *ctx,
+					      const float *values)
+{
+	return io_context_queue_push_frames(ctx, values, 1);
+}
+
+/**
+ * io_context_queue_push_4ms_interval_value - add @data_value to ECG input data
+ *					      queue of context
+ *
+ * With multiple channels, @data_value is pushed to first channel and others
+ * are set to zero.
+ */
+bool io_context_queue_push_4ms_interval_value(struct io_context *ctx,
+					      float data_value)
+{
+	float frame[IO_MAX_CHANNELS] = { data_value, };
+
+	return io_context_queue_push_4ms_interval_frame(ctx, frame);
+}
+
+/**
+ * io_context_fill_values - process input in caller thread until values queue
+ *			    has @bytes of values
+ */
+static bool io_context_fill_values(struct io_context *ctx, unsigned int bytes)
+{
+	int ret, error;
+
+	while (io_context_queued_bytes(ctx) < bytes) {
+		bool reopen = false;
+
+		switch (io_input_wait(ctx->input)) {
+		case IO_INPUT_WAIT_NEW:
+			ret = io_input_process(ctx->input, &error);
+			if (ret < 0)
+				reopen = true;
+			break;
+		case IO_INPUT_WAIT_ERROR:
+			reopen = true;
+			break;
+		case IO_INPUT_WAIT_STOP:
+		default:
+			return false;
+		}
+
+		if (reopen && !io_input_reopen(ctx->input))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * io_context_wait_values - wait until IO thread has queued @bytes of values
+ *
+ * Called with values_lock held.
+ */
+static bool io_context_wait_values(struct io_context *ctx, unsigned int bytes)
+{
+	/* Let IO thread queue over limit for large requests */
+	ctx->wanted_bytes = bytes;
+	pthread_cond_signal(&ctx->free_cond);
+	if (ctx->event_source)
+		io_event_loop_resume(ctx->event_source);
+
+	while (io_context_queued_bytes(ctx) < bytes) {
+		if (ctx->io_thread_done || ctx->stopping)
+			break;
+
+		pthread_cond_wait(&ctx->values_cond, &ctx->values_lock);
+	}
+
+	ctx->wanted_bytes = 0;
+
+	return io_context_queued_bytes(ctx) >= bytes;
+}
+
+/**
+ * io_context_pace - sleep until paced return of @num_frames frames is due
+ *
+ * Schedule advances by output rate interval (4ms by default) per frame, or
+ * fraction of that when speeding up, so that libio does not return values at
+ * higher rate. Schedule is absolute, so consumer that has fallen behind
+ * catches up without sleeping and lateness is counted to statistics.
+ */
+static void io_context_pace(struct io_context *ctx, unsigned int num_frames)
+{
+	unsigned long long ns, now, late_ns;
+
+	now = io_get_monotonic_ns();
+
+	/* On first run, just initialize timer. */
+	if (ctx->next_ns == 0) {
+		ctx->next_ns = now;
+		return;
+	}
+
+	ns = 1000000000ULL * num_frames / ctx->frame_rate;
+	if (ctx->pacing_mode == IO_PACING_SPEEDUP)
+		ns /= ctx->pacing_speed;
+	ctx->next_ns += ns;
+
+	/* Deadline might be in past, then there is no sleep at all. */
+	if (now < ctx->next_ns) {
+		if (ctx->pacer)
+			io_pacer_sleep_until(ctx->pacer, ctx->next_ns);
+		else
+			io_sleep_until_ns(ctx->next_ns);
+		now = io_get_monotonic_ns();
+
+		late_ns = now > ctx->next_ns ? now - ctx->next_ns : 0;
+		io_stats_add(&ctx->stats.pacing_overshoot_ns, late_ns);
+		io_stats_max(&ctx->stats.pacing_max_overshoot_ns, late_ns);
+	}
+
+	late_ns = now > ctx->next_ns ? now - ctx->next_ns : 0;
+	io_stats_add(&ctx->stats.pacing_sleeps, 1);
+	io_stats_add(&ctx->stats.pacing_late_ns, late_ns);
+	io_stats_max(&ctx->stats.pacing_max_late_ns, late_ns);
+}
+
+/*
+ * Destination for frames dequeued by io_context_get_frames(). Either
+ * @interleaved, or @num_channels arrays at @channels (@channels_i16), of
+ * values in @format.
+ */
+struct io_frames_dest {
+	enum io_sample_format format;
+	void *interleaved;
+	float *const *channels;
+	int16_t *const *channels_i16;
+	unsigned int num_channels;
+};
+
+/**
+ * io_context_read_values - move @num values from values queue to @out,
+ *			    converted to @format
+ */
+static void io_context_read_values(struct io_context *ctx,
+				   enum io_sample_format format, void *out,
+				   unsigned int num)
+{
+	struct ds_float_ring_span spans[2];
+	struct ds_i16_ring_span spans_i16[2];
+	int16_t *out_i16 = out;
+	float *out_f = out;
+	unsigned int i, j;
+
+	if (ctx->frame_format == IO_SAMPLE_INT16) {
+		if (format == IO_SAMPLE_INT16) {
+			ds_i16_ring_read(&ctx->values_ring_i16, out, num);
+			return;
+		}
+
+		num = ds_i16_ring_peek(&ctx->values_ring_i16, num, spans_i16);
+		for (i = 0; i < 2; i++) {
+			for (j = 0; j < spans_i16[i].len; j++)
+				*out_f++ = io_sample_from_i16(
+						spans_i16[i].values[j]);
+		}
+		ds_i16_ring_move_head(&ctx->values_ring_i16, num);
+		return;
+	}
+
+	if (format == IO_SAMPLE_FLOAT32) {
+		ds_float_ring_read(&ctx->values_ring, out, num);
+		return;
+	}
+
+	num = ds_float_ring_peek(&ctx->values_ring, num, spans);
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < spans[i].len; j++)
+			*out_i16++ = io_sample_to_i16(spans[i].values[j]);
+	}
+	ds_float_ring_move_head(&ctx->values_ring, num);
+}
+
+/**
+ * io_context_copy_frames - move @num_frames frames from values queue to
+ *			    @dest
+ */
+static void io_context_copy_frames(struct io_context *ctx,
+				   unsigned int num_frames,
+				   const struct io_frames_dest *dest)
+{
+	unsigned int frame_channels = ctx->frame_channels;
+	float chunk[IO_COPY_CHUNK_FRAMES * IO_MAX_CHANNELS];
+	int16_t chunk_i16[IO_COPY_CHUNK_FRAMES * IO_MAX_CHANNELS];
+	unsigned int i, ch, pos, num;
+
+	io_context_stats_consumed(ctx, num_frames * frame_channels);
+
+	if (dest->interleaved) {
+		/* Copy data from values queue to values array. */
+		io_context_read_values(ctx, dest->format, dest->interleaved,
+				       num_frames * frame_channels);
+		return;
+	}
+
+	/* Deinterleave through small chunk buffer */
+	for (pos = 0; pos < num_frames; pos += num) {
+		num = num_frames - pos;
+		if (num > IO_COPY_CHUNK_FRAMES)
+			num = IO_COPY_CHUNK_FRAMES;
+
+		if (dest->format == IO_SAMPLE_INT16) {
+			io_context_read_values(ctx, IO_SAMPLE_INT16, chunk_i16,
+					       num * frame_channels);
+
+			for (ch = 0; ch < dest->num_channels; ch++) {
+				int16_t *out = dest->channels_i16[ch] + pos;
+
+				if (ch >= frame_channels) {
+					memset(out, 0, num * sizeof(*out));
+					continue;
+				}
+
+				for (i = 0; i < num; i++)
+					out[i] = chunk_i16[i * frame_channels +
+							   ch];
+			}
+			continue;
+		}
+
+		io_context_read_values(ctx, IO_SAMPLE_FLOAT32, chunk,
+				       num * frame_channels);
+
+		for (ch = 0; ch < dest->num_channels; ch++) {
+			float *out = dest->channels[ch] + pos;
+
+			if (ch >= frame_channels) {
+				memset(out, 0, num * sizeof(float));
+				continue;
+			}
+
+			for (i = 0; i < num; i++)
+				out[i] = chunk[i * frame_channels + ch];
+		}
+	}
+}
 
 /**
- * __io_close_main_input - close previously global input, lockless
+ * io_context_clear_frames - clear @num_frames frames of @dest in error case
  */
-static void __io_close_main_input(void)
+static void io_context_clear_frames(struct io_context *ctx,
+				    unsigned int num_frames,
+				    const struct io_frames_dest *dest)
 {
-	if (io_main.input) {
-		io_input_destroy(io_main.input);
-		ds_append_buffer_free(&io_main.input_values_buffer);
+	size_t size = dest->format == IO_SAMPLE_INT16 ? sizeof(int16_t) :
+							sizeof(float);
+	unsigned int ch;
+
+	if (dest->interleaved) {
+		memset(dest->interleaved, 0,
+		       num_frames * ctx->frame_channels * size);
+		return;
+	}
 
-		memset(&io_main, 0, sizeof(io_main));
+	for (ch = 0; ch < dest->num_channels; ch++) {
+		if (dest->format == IO_SAMPLE_INT16)
+			memset(dest->channels_i16[ch], 0, num_frames * size);
+		else
+			memset(dest->channels[ch], 0, num_frames * size);
 	}
 }
 
 /**
- * io_close_main_input - close previously global input
+ * io_context_get_frames - process next batch of context input data to ECG
+ *			   data frames
+ * @ctx: IO context
+ * @num_frames: number of frames to get
+ * @dest: where to store frames
  */
-void io_close_main_input(void)
+static bool io_context_get_frames(struct io_context *ctx,
+				  unsigned int num_frames,
+				  const struct io_frames_dest *dest)
 {
-	pthread_mutex_lock(&main_lock);
-	__io_close_main_input();
-	pthread_mutex_unlock(&main_lock);
+	unsigned int bytes;
+	bool retval, has_room;
+
+	pthread_mutex_lock(&ctx->main_lock);
+
+	bytes = num_frames * ctx->frame_channels * sizeof(float);
+
+	if (!ctx->input)
+		goto err;
+
+	if (ctx->io_thread_running) {
+		/* IO is done in IO thread, just dequeue values */
+		pthread_mutex_lock(&ctx->values_lock);
+		retval = io_context_wait_values(ctx, bytes);
+		has_room = false;
+		if (retval) {
+			io_context_copy_frames(ctx, num_frames, dest);
+
+			/*
+			 * Wake up IO thread if it is waiting for room, once
+			 * queue has dropped below low watermark.
+			 */
+			has_room = __io_context_queue_has_room(ctx);
+			if (has_room)
+				pthread_cond_signal(&ctx->free_cond);
+		}
+		pthread_mutex_unlock(&ctx->values_lock);
+
+		/* Continue event loop source parked on full queue */
+		if (ctx->event_source && has_room)
+			io_event_loop_resume(ctx->event_source);
+
+		if (!retval)
+			goto err;
+	} else {
+		/* Do IO in caller thread context. */
+		if (!io_context_fill_values(ctx, bytes)) {
+			retval = false;
+			goto out;
+		}
+
+		io_context_copy_frames(ctx, num_frames, dest);
+	}
+
+	/* Unthrottled returns values as fast as they are decoded */
+	if (ctx->pacing_mode != IO_PACING_UNTHROTTLED)
+		io_context_pace(ctx, num_frames);
+
+	retval = true;
+	goto out;
+
+err:
+	/* In error case, clear input values array */
+	io_context_clear_frames(ctx, num_frames, dest);
+
+	retval = false;
+out:
+	pthread_mutex_unlock(&ctx->main_lock);
+
+	return retval;
 }
 
 /**
- * io_set_main_input - set new global input
+ * io_context_get_next_values - process next batch of context input data to
+ *				ECG data values
+ * @ctx: IO context
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ *
+ * With multiple channels, values of first channel are returned.
  */
-static void io_set_main_input(struct io_input *input)
+bool io_context_get_next_values(struct io_context *ctx, float *values,
+				unsigned int num_values)
 {
-	pthread_mutex_lock(&main_lock);
+	struct io_frames_dest dest = {
+		.format = IO_SAMPLE_FLOAT32,
+		.channels = &values,
+		.num_channels = 1,
+	};
 
-	/* Close currently open input */
-	__io_close_main_input();
+	/* single channel frames can be copied as such */
+	if (ctx->frame_channels == 1)
+		dest.interleaved = values;
 
-	/* Create new main input, TXT parser, file input */
-	io_main.input = input;
+	return io_context_get_frames(ctx, num_values, &dest);
+}
 
-	/*
-	 * Use append buffer for qeueuing as it's more effencient at storing
-	 * large data sets than ds_queue
-	 */
-	ds_append_buffer_init(&io_main.input_values_buffer);
+/**
+ * io_context_get_next_values_i16 - process next batch of context input data to
+ *				    int16 fixed-point ECG data values
+ * @ctx: IO context
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ *
+ * With multiple channels, values of first channel are returned.
+ */
+bool io_context_get_next_values_i16(struct io_context *ctx, int16_t *values,
+				    unsigned int num_values)
+{
+	struct io_frames_dest dest = {
+		.format = IO_SAMPLE_INT16,
+		.channels_i16 = &values,
+		.num_channels = 1,
+	};
 
-	/* Clear timer */
-	memset(&io_main.next_time, 0, sizeof(io_main.next_time));
+	/* single channel frames can be copied as such */
+	if (ctx->frame_channels == 1)
+		dest.interleaved = values;
+
+	return io_context_get_frames(ctx, num_values, &dest);
+}
+
+/**
+ * io_context_get_next_frames - get next batch of multi-channel frames,
+ *				interleaved
+ * @ctx: IO context
+ * @frames: buffer for @num_frames * io_context_get_channels() values
+ * @num_frames: number of frames to get
+ */
+bool io_context_get_next_frames(struct io_context *ctx, float *frames,
+				unsigned int num_frames)
+{
+	struct io_frames_dest dest = {
+		.format = IO_SAMPLE_FLOAT32,
+		.interleaved = frames,
+	};
+
+	return io_context_get_frames(ctx, num_frames, &dest);
+}
+
+/**
+ * io_context_get_next_frames_i16 - get next batch of multi-channel frames as
+ *				    int16 fixed-point, interleaved
+ * @ctx: IO context
+ * @frames: buffer for @num_frames * io_context_get_channels() values
+ * @num_frames: number of frames to get
+ */
+bool io_context_get_next_frames_i16(struct io_context *ctx, int16_t *frames,
+				    unsigned int num_frames)
+{
+	struct io_frames_dest dest = {
+		.format = IO_SAMPLE_INT16,
+		.interleaved = frames,
+	};
+
+	return io_context_get_frames(ctx, num_frames, &dest);
+}
+
+/**
+ * io_context_get_next_frames_soa - get next batch of multi-channel frames,
+ *				    as separate array for each channel
+ * @ctx: IO context
+ * @channels: @num_channels arrays of @num_frames values, channels not in
+ *	      input are set to zero
+ * @num_channels: number of arrays in @channels
+ * @num_frames: number of frames to get
+ */
+bool io_context_get_next_frames_soa(struct io_context *ctx,
+				    float *const *channels,
+				    unsigned int num_channels,
+				    unsigned int num_frames)
+{
+	struct io_frames_dest dest = {
+		.format = IO_SAMPLE_FLOAT32,
+		.channels = channels,
+		.num_channels = num_channels,
+	};
+
+	return io_context_get_frames(ctx, num_frames, &dest);
+}
+
+/**
+ * io_context_get_next_data_line - get data line buffer for sending ECG data
+ *				   of context over network.
+ * @ctx: IO context
+ * @line_buffer: buffer to write data line to
+ * @buflen: length of buffer
+ *
+ * Returns number of bytes written to buffer.
+ */
+unsigned int io_context_get_next_data_line(struct io_context *ctx,
+					   char *line_buffer,
+					   unsigned int buflen)
+{
+	char line[IO_DATA_LINE_MAX_LEN];
+	unsigned int slen, len;
+	float value = 0;
+
+	/* get next data value to send */
+	io_context_get_next_values(ctx, &value, 1);
+
+	/* truncate like snprintf() */
+	slen = io_format_data_line(line, value);
+	if (buflen > 0) {
+		len = slen < buflen ? slen : buflen - 1;
+		memcpy(line_buffer, line, len);
+		line_buffer[len] = '\0';
+	}
+
+	return slen;
+}
+
+/**
+ * io_context_get_next_data_lines - get data lines of multiple values of
+ *				    context for sending ECG data over network.
+ * @ctx: IO context
+ * @line_buffer: buffer to write data lines to
+ * @buflen: length of buffer
+ * @max_values: maximum number of values to get
+ *
+ * Gets up to @max_values values with one dequeue, limited by room in
+ * @line_buffer for IO_DATA_LINE_MAX_LEN bytes per value. Output is null
+ * terminated.
+ *
+ * Returns number of bytes written to buffer.
+ */
+unsigned int io_context_get_next_data_lines(struct io_context *ctx,
+					    char *line_buffer,
+					    unsigned int buflen,
+					    unsigned int max_values)
+{
+	float values[IO_DATA_LINES_MAX_VALUES];
+	unsigned int i, num_values, pos = 0;
+
+	num_values = buflen / IO_DATA_LINE_MAX_LEN;
+	if (num_values > max_values)
+		num_values = max_values;
+	if (num_values > IO_DATA_LINES_MAX_VALUES)
+		num_values = IO_DATA_LINES_MAX_VALUES;
+
+	if (num_values == 0) {
+		if (buflen > 0)
+			line_buffer[0] = '\0';
+		return 0;
+	}
+
+	/* get next data values to send, values are zero on error */
+	io_context_get_next_values(ctx, values, num_values);
+
+	for (i = 0; i < num_values; i++)
+		pos += io_format_data_line(line_buffer + pos, values[i]);
+
+	return pos;
+}
+
+/*
+ * Global input, wrappers around io_main_context()
+ */
+
+/**
+ * io_close_main_input - close previously global input
+ */
+void io_close_main_input(void)
+{
+	io_context_close_input(&main_context);
+}
+
+/**
+ * io_main_seek_time - move global input to time of stream
+ */
+bool io_main_seek_time(double seconds)
+{
+	return io_context_seek_time(&main_context, seconds);
+}
+
+/**
+ * io_main_set_io_thread - select where IO for global input is done
+ * @enable: if true, inputs opened after this call are read and parsed in
+ *	    dedicated IO thread, otherwise in io_main_queue_get_next_values()
+ *	    caller thread
+ */
+void io_main_set_io_thread(bool enable)
+{
+	io_context_set_io_thread(&main_context, enable);
+}
 
-	pthread_mutex_unlock(&main_lock);
+/**
+ * io_main_set_pacing - select how fast values are returned from global input
+ * @mode: pacing mode, see io_context_set_pacing()
+ * @speed: speed-up factor for IO_PACING_SPEEDUP
+ */
+void io_main_set_pacing(enum io_pacing_mode mode, unsigned int speed)
+{
+	io_context_set_pacing(&main_context, mode, speed);
 }
 
 /**
@@ -95,9 +1935,16 @@ static void io_set_main_input(struct io_input *input)
  */
 void io_open_txt_file_input(const char *filename)
 {
-	/* Create new main input, TXT parser, file input */
-	io_set_main_input(io_new_file_input(io_new_gz_parser(
-		io_new_text_parser()), filename));
+	io_context_open_txt_file_input(&main_context, filename);
+}
+
+/**
+ * io_open_bin_file_input - open binary sample file with name @filename for
+ *			    global input
+ */
+void io_open_bin_file_input(const char *filename)
+{
+	io_context_open_bin_file_input(&main_context, filename);
 }
 
 /**
@@ -105,8 +1952,7 @@ void io_open_txt_file_input(const char *filename)
  */
 void io_open_txt_external_input(void)
 {
-	/* Create new external input with TXT parser */
-	io_set_main_input(io_new_external_input(io_new_text_parser()));
+	io_context_open_txt_external_input(&main_context);
 }
 
 /**
@@ -119,13 +1965,41 @@ void io_open_txt_external_input(void)
  */
 int io_push_external_input(void *buf, unsigned int buflen)
 {
-	int ret;
+	return io_context_push_external_input(&main_context, buf, buflen);
+}
+
+/**
+ * io_push_external_input_buffer - push memory owned by caller to global
+ *				   external input without copying
+ *
+ * See io_context_push_external_input_buffer().
+ */
+bool io_push_external_input_buffer(void *buf, unsigned int buflen,
+				   ds_append_buffer_release_t release,
+				   void *opaque)
+{
+	return io_context_push_external_input_buffer(&main_context, buf,
+						     buflen, release, opaque);
+}
 
-	pthread_mutex_lock(&main_lock);
-	ret = io_external_input_push_data(io_main.input, buf, buflen);
-	pthread_mutex_unlock(&main_lock);
+/**
+ * io_main_queue_is_full - check if global ECG input data queue is full
+ *
+ * Always false when IO is done in caller thread.
+ */
+bool io_main_queue_is_full(void)
+{
+	return io_context_queue_is_full(&main_context);
+}
 
-	return ret;
+/**
+ * io_main_queue_wait_free - wait until global ECG input data queue has room
+ *
+ * Returns false if input is being closed.
+ */
+bool io_main_queue_wait_free(void)
+{
+	return io_context_queue_wait_free(&main_context);
 }
 
 /**
@@ -134,103 +2008,102 @@ int io_push_external_input(void *buf, unsigned int buflen)
  */
 bool io_main_queue_push_4ms_interval_value(float data_value)
 {
-	/*
-	 * TODO: Find and fix the real bug... our iPhone part is having strange
-	 * performance problem with too accurate floating-point values.
-	 */
-	data_value = roundf(data_value * 100.0f) / 100;
-
-	ds_append_buffer_append(&io_main.input_values_buffer, &data_value,
-				sizeof(data_value));
-
-	return true;
+	return io_context_queue_push_4ms_interval_value(&main_context,
+							data_value);
 }
 
 /**
- * io_main_queue_get_next_values - process next batch of input data to ECG data
- *				   values
- * @values: values buffer to fill with new values
- * @num_values: elements in @values buffer
+ * io_main_set_channels - set number of value columns decoded from global input
  */
-bool io_main_queue_get_next_values(float *values, unsigned int num_values)
+bool io_main_set_channels(unsigned int num_channels)
 {
-	int ret, error, i;
-	bool retval;
-
-	pthread_mutex_lock(&main_lock);
-
-	if (!io_main.input) {
-		/* In error case, clear input values array */
-		for (i = 0; i < num_values; i++)
-			values[i] = 0.0f;
+	return io_context_set_channels(&main_context, num_channels);
+}
 
-		retval = false;
-		goto out;
-	}
+/**
+ * io_main_set_sample_format - set format of global values queue
+ */
+void io_main_set_sample_format(enum io_sample_format format)
+{
+	io_context_set_sample_format(&main_context, format);
+}
 
-	/*
-	 * For now, do IO in caller thread context. This may be moved to remote
-	 * IO thread in future.
-	 */
-	while (ds_append_buffer_length(&io_main.input_values_buffer) <
-						num_values * sizeof(float)) {
-		bool reopen = false;
+/**
+ * io_main_get_stats - take snapshot of statistics of global context
+ */
+void io_main_get_stats(struct io_stats *stats)
+{
+	io_context_get_stats(&main_context, stats);
+}
 
-		switch (io_input_wait(io_main.input)) {
-		case IO_INPUT_WAIT_NEW:
-			ret = io_input_process(io_main.input, &error);
-			if (ret < 0)
-				reopen = true;
-			break;
-		case IO_INPUT_WAIT_ERROR:
-			reopen = true;
-			break;
-		case IO_INPUT_WAIT_STOP:
-		default:
-			retval = false;
-			goto out;
-		}
+/**
+ * io_main_set_history - keep last consumed frames of global input readable
+ */
+bool io_main_set_history(unsigned int num_frames)
+{
+	return io_context_set_history(&main_context, num_frames);
+}
 
-		if (reopen && io_input_reopen(io_main.input) < 0) {
-			retval = false;
-			goto out;
-		}
-	}
+/**
+ * io_main_get_history - copy last consumed frames of global input
+ */
+unsigned int io_main_get_history(float *frames, unsigned int num_frames)
+{
+	return io_context_get_history(&main_context, frames, num_frames);
+}
 
-	/* Copy data from values queue to values array. */
-	ds_append_buffer_copy(&io_main.input_values_buffer, 0, values,
-			      num_values * sizeof(float));
+/**
+ * io_main_set_sample_rate - set output rate of values decoded from global
+ *			     input
+ */
+bool io_main_set_sample_rate(unsigned int rate, enum io_resample_kernel kernel)
+{
+	return io_context_set_sample_rate(&main_context, rate, kernel);
+}
 
-	/* Clear copied data from values queue. */
-	ds_append_buffer_move_head(&io_main.input_values_buffer,
-				   num_values * sizeof(float));
+/**
+ * io_main_queue_get_next_frames - get next batch of multi-channel frames from
+ *				   global input, interleaved
+ */
+bool io_main_queue_get_next_frames(float *frames, unsigned int num_frames)
+{
+	return io_context_get_next_frames(&main_context, frames, num_frames);
+}
 
-	if (io_main.next_time.tv_sec != 0 || io_main.next_time.tv_nsec != 0) {
-		/*
-		 * Set up sleep. We receive values at average 4ms intervals so
-		 * sleep to (last_time + (4ms * num_values)).
-		 */
-		ds_add_timesec_usec(&io_main.next_time, 4000 * num_values);
-		
-		/*
-		 * Sleep until enough time is passed since last read. This is
-		 * to fill time between reads, so that libio does not return
-		 * values at higher than 4ms interval rate.
-		 * 
-		 * Note: This might not sleep at all, as sleep is to absolute
-		 * time. That time might be in past.
-		 */
-		io_sleep_to(&io_main.next_time);
-	} else {
-		/* On first run, just initialize timer. */
-		ds_get_curr_timespec(&io_main.next_time);
-	}
+/**
+ * io_main_queue_get_next_frames_soa - get next batch of multi-channel frames
+ *				       from global input, array per channel
+ */
+bool io_main_queue_get_next_frames_soa(float *const *channels,
+				       unsigned int num_channels,
+				       unsigned int num_frames)
+{
+	return io_context_get_next_frames_soa(&main_context, channels,
+					      num_channels, num_frames);
+}
 
-	retval = true;
-out:
-	pthread_mutex_unlock(&main_lock);
+/**
+ * io_main_queue_get_next_values - process next batch of input data to ECG data
+ *				   values
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ */
+bool io_main_queue_get_next_values(float *values, unsigned int num_values)
+{
+	return io_context_get_next_values(&main_context, values, num_values);
+}
 
-	return retval;
+/**
+ * io_main_queue_get_next_values_i16 - process next batch of input data to
+ *				       int16 fixed-point ECG data values
+ * @values: values buffer to fill with new values
+ * @num_values: elements in @values buffer
+ */
+bool io_main_queue_get_next_values_i16(int16_t *values,
+				       unsigned int num_values)
+{
+	return io_context_get_next_values_i16(&main_context, values,
+					      num_values);
 }
 
 /**
@@ -243,15 +2116,23 @@ out:
  */
 unsigned int io_main_get_next_data_line(char *line_buffer, unsigned int buflen)
 {
-	float value = 0;
-	int slen;
-
-	/* get next data value to send */
-	io_main_queue_get_next_values(&value, 1);
-
-	slen = snprintf(line_buffer, buflen, "%.02f\n", value);
-	if (slen < 0)
-		return 0;
+	return io_context_get_next_data_line(&main_context, line_buffer,
+					     buflen);
+}
 
-	return slen;
+/**
+ * io_main_get_next_data_lines - get data lines of multiple values for sending
+ *				 ECG data over network.
+ * @line_buffer: buffer to write data lines to
+ * @buflen: length of buffer
+ * @max_values: maximum number of values to get
+ *
+ * Returns number of bytes written to buffer.
+ */
+unsigned int io_main_get_next_data_lines(char *line_buffer,
+					 unsigned int buflen,
+					 unsigned int max_values)
+{
+	return io_context_get_next_data_lines(&main_context, line_buffer,
+					      buflen, max_values);
 }
@@ -0,0 +1,354 @@
+/*
+ * Shared pacing scheduler for paced IO contexts
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "io.h"
+
+#define PACER_WHEEL_MASK (IO_PACER_WHEEL_SLOTS - 1)
+
+/* Pacer thread is idle, waiting for first sleeper */
+#define PACER_IDLE ULLONG_MAX
+
+/*
+ * Thread blocked in io_pacer_sleep_until(), lives on its stack. Sleeper is
+ * in wheel slot of its release tick until pacer thread posts @sem, released
+ * sleepers do not need pacer lock to resume.
+ */
+struct pacer_sleeper {
+	struct ds_list_entry entry;
+	unsigned long long tick;
+	sem_t sem;
+};
+
+/*
+ * Hashed timer wheel. Slot of sleeper is its release tick modulo number of
+ * slots, so slot may hold sleepers of later rotations which are skipped
+ * until their tick is reached. State is protected by lock, except overshoot
+ * counters which sleepers update with io_stats_add().
+ */
+struct io_pacer {
+	pthread_mutex_t lock;
+
+	/* wakes pacer thread, uses monotonic clock for timed waits */
+	pthread_cond_t cond;
+
+	unsigned long long tick_ns;
+
+	/* sleepers up to this tick have been released */
+	unsigned long long cur_tick;
+
+	/* tick pacer thread is waiting for, PACER_IDLE if none */
+	unsigned long long wake_tick;
+
+	unsigned int pending;
+	struct ds_linked_list wheel[IO_PACER_WHEEL_SLOTS];
+
+	struct io_pacer_stats stats;
+
+	bool stopping;
+	bool thread_started;
+	pthread_t thread;
+};
+
+static void pacer_release(struct io_pacer *pacer, struct ds_linked_list *slot,
+			  struct pacer_sleeper *sleeper)
+{
+	ds_list_remove_entry(slot, &sleeper->entry);
+	sem_post(&sleeper->sem);
+	pacer->pending--;
+	pacer->stats.releases++;
+}
+
+/* First tick after cur_tick with sleeper due, or one rotation ahead */
+static unsigned long long pacer_next_tick(struct io_pacer *pacer)
+{
+	struct pacer_sleeper *sleeper;
+	unsigned long long tick;
+	unsigned int i;
+
+	for (i = 1; i <= IO_PACER_WHEEL_SLOTS; i++) {
+		tick = pacer->cur_tick + i;
+
+		ds_list_for_each_item(sleeper,
+				      &pacer->wheel[tick & PACER_WHEEL_MASK],
+				      struct pacer_sleeper, entry)
+			if (sleeper->tick == tick)
+				return tick;
+	}
+
+	return pacer->cur_tick + IO_PACER_WHEEL_SLOTS;
+}
+
+/* Release sleepers due by @now_tick */
+static void pacer_advance(struct io_pacer *pacer, unsigned long long now_tick)
+{
+	struct pacer_sleeper *sleeper, *next;
+	struct ds_linked_list *slot;
+	unsigned long long tick, released;
+
+	/* each slot is visited at most once */
+	tick = pacer->cur_tick + 1;
+	if (now_tick - pacer->cur_tick > IO_PACER_WHEEL_SLOTS)
+		tick = now_tick - IO_PACER_WHEEL_SLOTS + 1;
+
+	released = pacer->stats.releases;
+	for (; tick <= now_tick; tick++) {
+		slot = &pacer->wheel[tick & PACER_WHEEL_MASK];
+
+		ds_list_for_each_item_safe(sleeper, next, slot,
+					   struct pacer_sleeper, entry)
+			if (sleeper->tick <= now_tick)
+				pacer_release(pacer, slot, sleeper);
+	}
+
+	released = pacer->stats.releases - released;
+	if (released > pacer->stats.max_batch)
+		pacer->stats.max_batch = released;
+
+	pacer->cur_tick = now_tick;
+}
+
+static void pacer_release_all(struct io_pacer *pacer)
+{
+	struct pacer_sleeper *sleeper, *next;
+	unsigned int i;
+
+	for (i = 0; i < IO_PACER_WHEEL_SLOTS; i++)
+		ds_list_for_each_item_safe(sleeper, next, &pacer->wheel[i],
+					   struct pacer_sleeper, entry)
+			pacer_release(pacer, &pacer->wheel[i], sleeper);
+}
+
+static void *pacer_thread(void *arg)
+{
+	struct io_pacer *pacer = arg;
+	unsigned long long now, wake_ns;
+	struct timespec ts;
+
+	pthread_mutex_lock(&pacer->lock);
+
+	while (!pacer->stopping) {
+		if (pacer->pending == 0) {
+			pacer->wake_tick = PACER_IDLE;
+			pthread_cond_wait(&pacer->cond, &pacer->lock);
+			continue;
+		}
+
+		/*
+		 * Sleep to absolute tick, so that time spent releasing does not
+		 * accumulate. New sleeper due before wake_tick wakes us early.
+		 */
+		pacer->wake_tick = pacer_next_tick(pacer);
+		wake_ns = pacer->wake_tick * pacer->tick_ns;
+		ts.tv_sec = wake_ns / 1000000000ULL;
+		ts.tv_nsec = wake_ns % 1000000000ULL;
+		pthread_cond_timedwait(&pacer->cond, &pacer->lock, &ts);
+
+		now = io_get_monotonic_ns();
+		if (now < wake_ns)
+			continue;
+
+		pacer->stats.wakeups++;
+		pacer->stats.drift_ns += now - wake_ns;
+		if (now - wake_ns > pacer->stats.max_drift_ns)
+			pacer->stats.max_drift_ns = now - wake_ns;
+
+		pacer_advance(pacer, now / pacer->tick_ns);
+	}
+
+	pacer_release_all(pacer);
+	pthread_mutex_unlock(&pacer->lock);
+
+	return NULL;
+}
+
+/**
+ * io_pacer_alloc - allocate pacing scheduler and start its thread
+ * @tick_us: resolution of scheduler in microseconds, zero for
+ *	     IO_PACER_DEFAULT_TICK_US
+ *
+ * Returns NULL on error.
+ */
+struct io_pacer *io_pacer_alloc(unsigned int tick_us)
+{
+	struct io_pacer *pacer;
+	pthread_condattr_t attr;
+	unsigned int i;
+
+	pacer = calloc(1, sizeof(*pacer));
+	if (!pacer) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	pacer->tick_ns = 1000ULL * (tick_us ? tick_us :
+				    IO_PACER_DEFAULT_TICK_US);
+	pacer->cur_tick = io_get_monotonic_ns() / pacer->tick_ns;
+	pacer->wake_tick = PACER_IDLE;
+	for (i = 0; i < IO_PACER_WHEEL_SLOTS; i++)
+		ds_list_init(&pacer->wheel[i]);
+
+	pthread_mutex_init(&pacer->lock, NULL);
+
+	/* Deadlines are on monotonic clock, unaffected by wall-clock steps */
+	pthread_condattr_init(&attr);
+	if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0) {
+		io_set_latest_error("%s():%d: monotonic clock not supported "
+				    "for condition variables", __func__,
+				    __LINE__);
+		pthread_condattr_destroy(&attr);
+		pthread_mutex_destroy(&pacer->lock);
+		free(pacer);
+		return NULL;
+	}
+	pthread_cond_init(&pacer->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&pacer->thread, NULL, pacer_thread, pacer) != 0) {
+		io_set_latest_error("%s():%d: could not create pacer thread",
+				    __func__, __LINE__);
+		io_pacer_free(pacer);
+		return NULL;
+	}
+	pacer->thread_started = true;
+
+	return pacer;
+}
+
+/**
+ * io_pacer_free - stop pacer thread and free pacing scheduler
+ * @pacer: pacing scheduler, contexts using @pacer must be freed or detached
+ *	   first
+ */
+void io_pacer_free(struct io_pacer *pacer)
+{
+	if (!pacer)
+		return;
+
+	if (pacer->thread_started) {
+		pthread_mutex_lock(&pacer->lock);
+		pacer->stopping = true;
+		pthread_cond_signal(&pacer->cond);
+		pthread_mutex_unlock(&pacer->lock);
+
+		pthread_join(pacer->thread, NULL);
+	}
+
+	pthread_cond_destroy(&pacer->cond);
+	pthread_mutex_destroy(&pacer->lock);
+	free(pacer);
+}
+
+/**
+ * io_pacer_sleep_until - block until pacer releases caller
+ * @pacer: pacing scheduler
+ * @deadline_ns: time of monotonic clock, see io_get_monotonic_ns()
+ *
+ * Caller is released on first tick at or after @deadline_ns, released
+ * together with all other sleepers due on same tick. Returns immediately if
+ * @deadline_ns has passed.
+ */
+void io_pacer_sleep_until(struct io_pacer *pacer,
+			  unsigned long long deadline_ns)
+{
+	struct pacer_sleeper sleeper;
+	unsigned long long now;
+
+	now = io_get_monotonic_ns();
+	if (now >= deadline_ns)
+		return;
+
+	sleeper.tick = (deadline_ns + pacer->tick_ns - 1) / pacer->tick_ns;
+	sem_init(&sleeper.sem, 0, 0);
+
+	pthread_mutex_lock(&pacer->lock);
+
+	if (pacer->stopping) {
+		pthread_mutex_unlock(&pacer->lock);
+		sem_destroy(&sleeper.sem);
+		io_sleep_until_ns(deadline_ns);
+		return;
+	}
+
+	/* Wheel position is stale after idle period */
+	if (pacer->pending == 0)
+		pacer->cur_tick = io_get_monotonic_ns() / pacer->tick_ns;
+
+	/*
+	 * Scheduler may have advanced past release tick before lock was
+	 * taken, slot would then only be scanned after full wheel rotation
+	 */
+	if (sleeper.tick <= pacer->cur_tick) {
+		pthread_mutex_unlock(&pacer->lock);
+		sem_destroy(&sleeper.sem);
+		return;
+	}
+
+	ds_list_append_entry(&pacer->wheel[sleeper.tick & PACER_WHEEL_MASK],
+			     &sleeper.entry);
+	pacer->pending++;
+
+	if (sleeper.tick < pacer->wake_tick)
+		pthread_cond_signal(&pacer->cond);
+
+	pthread_mutex_unlock(&pacer->lock);
+
+	while (sem_wait(&sleeper.sem) != 0 && errno == EINTR)
+		;
+	sem_destroy(&sleeper.sem);
+
+	now = io_get_monotonic_ns();
+	if (now > deadline_ns) {
+		io_stats_add(&pacer->stats.overshoot_ns, now - deadline_ns);
+		io_stats_max(&pacer->stats.max_overshoot_ns,
+			     now - deadline_ns);
+	}
+}
+
+/**
+ * io_pacer_get_stats - take snapshot of statistics of pacing scheduler
+ * @pacer: pacing scheduler
+ * @stats: snapshot is stored here
+ */
+void io_pacer_get_stats(struct io_pacer *pacer, struct io_pacer_stats *stats)
+{
+	pthread_mutex_lock(&pacer->lock);
+	*stats = pacer->stats;
+	stats->overshoot_ns = io_stats_load(&pacer->stats.overshoot_ns);
+	stats->max_overshoot_ns = io_stats_load(&pacer->stats.max_overshoot_ns);
+	stats->pending = pacer->pending;
+	stats->tick_ns = pacer->tick_ns;
+	pthread_mutex_unlock(&pacer->lock);
+}
@@ -31,6 +31,9 @@
 
 #include "io.h"
 
+/* Frames of int16 block converted at once for sink */
+#define PARSER_SINK_CHUNK_FRAMES 128
+
 /**
  * io_parser_parse - parse data in received input buffer
  * @parser: parser to use
@@ -51,10 +54,23 @@ enum io_parser_ret io_parser_parse(struct io_parser *parser,
 				   struct ds_append_buffer *buffer,
 				   bool final)
 {
-	if (parser->ops->parse)
-		return parser->ops->parse(parser, buffer, final);
+	unsigned int len = ds_append_buffer_length(buffer);
+	unsigned long long start;
+	enum io_parser_ret ret;
+
+	if (!parser->ops->parse)
+		return IO_PARSER_RET_ERROR;
+
+	start = io_get_monotonic_ns();
+	ret = parser->ops->parse(parser, buffer, final);
+
+	io_stats_add(&parser->stats.parse_calls, 1);
+	io_stats_add(&parser->stats.parse_ns, io_get_monotonic_ns() - start);
+	if (ds_append_buffer_length(buffer) < len)
+		io_stats_add(&parser->stats.bytes_in,
+			     len - ds_append_buffer_length(buffer));
 
-	return IO_PARSER_RET_ERROR;
+	return ret;
 }
 
 /**
@@ -62,7 +78,7 @@ enum io_parser_ret io_parser_parse(struct io_parser *parser,
  */
 bool io_parser_wait_queue(struct io_parser *parser)
 {
-	if (parser->ops->parse)
+	if (parser->ops->wait_queue)
 		return parser->ops->wait_queue(parser);
 
 	return false;
@@ -90,3 +106,154 @@ bool io_parser_reset(struct io_parser *parser)
 
 	return true;
 }
+
+/**
+ * io_parser_set_context - set IO context that receives values from parser
+ *			   stack
+ * @parser: bottom of parser stack
+ * @ctx: context to use
+ */
+void io_parser_set_context(struct io_parser *parser, struct io_context *ctx)
+{
+	parser->ctx = ctx;
+
+	/* let parser pass context to child parsers */
+	if (parser->ops->set_context)
+		parser->ops->set_context(parser, ctx);
+}
+
+/**
+ * io_parser_get_context - get IO context of parser, global context is used
+ *			   if none has been set
+ */
+struct io_context *io_parser_get_context(struct io_parser *parser)
+{
+	if (parser->ctx)
+		return parser->ctx;
+
+	return io_main_context();
+}
+
+/**
+ * io_parser_get_child - get parser receiving output of @parser, NULL at top
+ *			 of parser stack
+ */
+struct io_parser *io_parser_get_child(struct io_parser *parser)
+{
+	if (parser->ops->get_child)
+		return parser->ops->get_child(parser);
+
+	return NULL;
+}
+
+/**
+ * io_parser_set_sink - set sink that receives values from parser stack
+ *			instead of IO context
+ * @parser: bottom of parser stack
+ * @sink: sink to use, NULL for values queue of context
+ * @channel_id: id passed to @sink with each block
+ */
+void io_parser_set_sink(struct io_parser *parser, struct io_sink *sink,
+			unsigned int channel_id)
+{
+	for (; parser; parser = io_parser_get_child(parser)) {
+		parser->sink = sink;
+		parser->sink_channel_id = channel_id;
+	}
+}
+
+/**
+ * io_parser_emit_block - pass block of decoded frames to sink of parser
+ * @parser: parser producing values
+ * @frames: @num_frames interleaved frames of io_context_get_channels()
+ *	    values of context of @parser
+ * @num_frames: number of frames
+ * @time: time of first frame in seconds from start of stream
+ */
+bool io_parser_emit_block(struct io_parser *parser, const float *frames,
+			  unsigned int num_frames, double time)
+{
+	struct io_context *ctx = io_parser_get_context(parser);
+	struct io_sink *sink = parser->sink;
+
+	if (num_frames == 0)
+		return true;
+
+	if (!sink)
+		return io_context_queue_push_frames(ctx, frames, num_frames);
+
+	return sink->emit_block(sink, frames, num_frames,
+				io_context_get_channels(ctx),
+				parser->sink_channel_id, time);
+}
+
+/**
+ * io_parser_emit_block_i16 - pass block of int16 fixed-point frames to sink
+ *			      of parser
+ * @parser: parser producing values
+ * @frames: @num_frames interleaved frames of io_context_get_channels()
+ *	    values of context of @parser
+ * @num_frames: number of frames
+ * @time: time of first frame in seconds from start of stream
+ */
+bool io_parser_emit_block_i16(struct io_parser *parser, const int16_t *frames,
+			      unsigned int num_frames, double time)
+{
+	struct io_context *ctx = io_parser_get_context(parser);
+	unsigned int channels = io_context_get_channels(ctx);
+	unsigned int rate = io_context_get_sample_rate(ctx, NULL);
+	float block[PARSER_SINK_CHUNK_FRAMES * IO_MAX_CHANNELS];
+	unsigned int i, num;
+
+	if (num_frames == 0)
+		return true;
+
+	if (!parser->sink)
+		return io_context_queue_push_frames_i16(ctx, frames,
+							num_frames);
+
+	/* sinks take float frames */
+	for (; num_frames > 0; num_frames -= num, frames += num * channels) {
+		num = num_frames < PARSER_SINK_CHUNK_FRAMES ?
+				num_frames : PARSER_SINK_CHUNK_FRAMES;
+
+		for (i = 0; i < num * channels; i++)
+			block[i] = io_sample_from_i16(frames[i]);
+
+		if (!io_parser_emit_block(parser, block, num, time))
+			return false;
+
+		time += (double)num / rate;
+	}
+
+	return true;
+}
+
+/**
+ * io_parser_seek_time - move parser stack to time of input stream
+ * @parser: bottom of parser stack
+ * @src: random access to input stream of @parser
+ * @seconds: time from start of stream
+ * @offset: offset of @src where input continues is stored here
+ *
+ * On failure, parser stack is reset and @offset is set to zero.
+ */
+bool io_parser_seek_time(struct io_parser *parser,
+			 const struct io_seek_source *src, double seconds,
+			 unsigned long long *offset)
+{
+	if (parser->ops->seek_time &&
+	    parser->ops->seek_time(parser, src, seconds, offset))
+		return true;
+
+	if (!parser->ops->seek_time)
+		io_set_latest_error("%s():%d: parser '%s' cannot seek",
+				    __func__, __LINE__,
+				    parser->ops->name ? parser->ops->name :
+							"unknown");
+
+	io_parser_reset(parser);
+	*offset = 0;
+
+	return false;
+}
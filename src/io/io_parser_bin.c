@@ -0,0 +1,514 @@
+/*
+ * Binary sample file parser
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "io.h"
+
+/* Frames decoded at once before passing to context or resampler */
+#define BIN_DECODE_FRAMES 128
+
+/* Largest encoded value, varint of 32-bit delta */
+#define BIN_MAX_VALUE_LEN 5
+
+enum bin_state {
+	PARSE_BIN_HEADER = 0,
+	PARSE_BIN_BLOCK,
+};
+
+struct bin_parser_priv {
+	struct io_parser parser;
+
+	/* context receiving parsed values */
+	struct io_context *ctx;
+
+	enum bin_state state;
+
+	/* format of current file */
+	enum io_bin_encoding encoding;
+	unsigned int file_channels;
+	unsigned int file_rate;
+	float scale;
+
+	/* output channels of context, resampling to output rate */
+	unsigned int channels;
+	bool resample;
+	struct io_resampler resampler;
+
+	/* fixed-point values go to int16 values queue without conversion */
+	bool fixed_out;
+	unsigned long long int index;
+
+	/* payload of block spanning multiple input pieces */
+	unsigned char *block_buf;
+	unsigned int block_buf_len;
+};
+
+static inline struct bin_parser_priv *bin_parser_priv(struct io_parser *parser)
+{
+	return ds_container_of(parser, struct bin_parser_priv, parser);
+}
+
+static inline uint32_t bin_get_le32(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) |
+	       ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static inline bool bin_get_varint(const unsigned char **pos,
+				  const unsigned char *end, uint32_t *val)
+{
+	const unsigned char *p = *pos;
+	unsigned int shift;
+	uint32_t v = 0;
+
+	for (shift = 0; shift < 7 * BIN_MAX_VALUE_LEN && p < end; shift += 7) {
+		v |= (uint32_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pos = p;
+			*val = v;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void bin_resampler_emit(void *opaque, const float *frames,
+			       unsigned int num_frames)
+{
+	struct bin_parser_priv *priv = opaque;
+	struct io_resampler *rs = &priv->resampler;
+
+	io_parser_emit_block(&priv->parser, frames, num_frames,
+			     (rs->next_out - num_frames) * rs->interval);
+}
+
+static void bin_emit_frames(struct bin_parser_priv *priv, const float *frames,
+			    unsigned int num_frames)
+{
+	unsigned int i;
+
+	if (!priv->resample) {
+		io_parser_emit_block(&priv->parser, frames, num_frames,
+				     (double)priv->index / priv->file_rate);
+		priv->index += num_frames;
+		return;
+	}
+
+	for (i = 0; i < num_frames; i++, frames += priv->channels)
+		io_resampler_push(&priv->resampler,
+				  (double)priv->index++ / priv->file_rate,
+				  frames);
+}
+
+/* Check file header and set up conversion to context format */
+static bool bin_parse_header(struct bin_parser_priv *priv,
+			     const unsigned char *header)
+{
+	enum io_resample_kernel kernel;
+	unsigned int rate, scale;
+
+	priv->encoding = header[5];
+	priv->file_channels = header[6];
+	priv->file_rate = bin_get_le32(&header[8]);
+	scale = bin_get_le32(&header[12]);
+
+	if (memcmp(header, IO_BIN_MAGIC, 4) != 0 ||
+	    header[4] != IO_BIN_VERSION) {
+		io_set_latest_error("%s():%d: not binary sample file",
+				    __func__, __LINE__);
+		return false;
+	}
+
+	if (priv->encoding < IO_BIN_INT16 ||
+	    priv->encoding > IO_BIN_DELTA_VARINT ||
+	    priv->file_channels == 0 || priv->file_channels > IO_MAX_CHANNELS ||
+	    priv->file_rate == 0 ||
+	    (scale == 0 && priv->encoding != IO_BIN_FLOAT32)) {
+		io_set_latest_error("%s():%d: invalid binary sample file "
+				    "header: encoding: %u, channels: %u, "
+				    "rate: %u, scale: %u", __func__, __LINE__,
+				    priv->encoding, priv->file_channels,
+				    priv->file_rate, scale);
+		return false;
+	}
+
+	priv->scale = scale;
+	priv->channels = io_context_get_channels(priv->ctx);
+	priv->index = 0;
+
+	rate = io_context_get_sample_rate(priv->ctx, &kernel);
+	priv->resample = rate != priv->file_rate;
+	if (priv->resample)
+		io_resampler_init(&priv->resampler, rate, kernel,
+				  priv->channels, bin_resampler_emit, priv);
+
+	priv->fixed_out = !priv->resample &&
+			  priv->encoding != IO_BIN_FLOAT32 &&
+			  scale == IO_SAMPLE_INT16_SCALE &&
+			  io_context_get_sample_format(priv->ctx) ==
+							IO_SAMPLE_INT16;
+
+	return true;
+}
+
+static bool bin_check_block(struct bin_parser_priv *priv,
+			    unsigned int num_frames, unsigned int len)
+{
+	unsigned long num_values = (unsigned long)num_frames *
+				   priv->file_channels;
+	bool ok;
+
+	switch (priv->encoding) {
+	case IO_BIN_INT16:
+		ok = len == num_values * 2;
+		break;
+	case IO_BIN_FLOAT32:
+		ok = len == num_values * 4;
+		break;
+	case IO_BIN_DELTA_VARINT:
+	default:
+		ok = len >= num_values && len <= num_values * BIN_MAX_VALUE_LEN;
+		break;
+	}
+
+	if (!ok || num_frames > IO_BIN_MAX_BLOCK_FRAMES) {
+		io_set_latest_error("%s():%d: invalid binary block: frames: "
+				    "%u, length: %u", __func__, __LINE__,
+				    num_frames, len);
+		return false;
+	}
+
+	return true;
+}
+
+/* Pass fixed-point chunk of @n frames to context as int16 frames */
+static const unsigned char *bin_emit_fixed(struct bin_parser_priv *priv,
+					   const unsigned char *pos,
+					   const int32_t *fixed, unsigned int n)
+{
+	int16_t frames[BIN_DECODE_FRAMES * IO_MAX_CHANNELS];
+	unsigned int j, c, channels = priv->channels;
+	unsigned int file_channels = priv->file_channels;
+	int16_t value, *frame = frames;
+
+	for (j = 0; j < n; j++) {
+		for (c = 0; c < file_channels; c++) {
+			if (priv->encoding == IO_BIN_INT16) {
+				value = (int16_t)(pos[0] | (pos[1] << 8));
+				pos += 2;
+			} else {
+				value = io_sample_clamp_i16(
+						fixed[j * file_channels + c]);
+			}
+
+			if (c < channels)
+				frame[c] = value;
+		}
+
+		/* channels missing from file */
+		for (; c < channels; c++)
+			frame[c] = 0;
+
+		frame += channels;
+	}
+
+	io_parser_emit_block_i16(&priv->parser, frames, n,
+				 (double)priv->index / priv->file_rate);
+	priv->index += n;
+
+	return pos;
+}
+
+/* Decode block payload and pass frames to context */
+static bool bin_decode_block(struct bin_parser_priv *priv,
+			     const unsigned char *pos, unsigned int len,
+			     unsigned int num_frames)
+{
+	float frames[BIN_DECODE_FRAMES * IO_MAX_CHANNELS];
+	int32_t fixed[BIN_DECODE_FRAMES * IO_MAX_CHANNELS];
+	unsigned int i, j, c, n, channels = priv->channels;
+	unsigned int file_channels = priv->file_channels;
+	int32_t prev[IO_MAX_CHANNELS] = { 0 };
+	const unsigned char *end = pos + len;
+	bool delta = priv->encoding != IO_BIN_INT16 &&
+		     priv->encoding != IO_BIN_FLOAT32;
+	float value, *frame;
+	uint32_t u32;
+
+	for (i = 0; i < num_frames; i += n) {
+		n = num_frames - i;
+		if (n > BIN_DECODE_FRAMES)
+			n = BIN_DECODE_FRAMES;
+
+		/* deltas of chunk are summed at once */
+		if (delta) {
+			for (j = 0; j < n * file_channels; j++) {
+				if (!bin_get_varint(&pos, end, &u32))
+					goto err;
+
+				/* zigzag decode */
+				fixed[j] = (int32_t)(u32 >> 1) ^
+					   -(int32_t)(u32 & 1);
+			}
+
+			io_delta_decode_fixed(fixed, n, file_channels, prev);
+		}
+
+		if (priv->fixed_out) {
+			pos = bin_emit_fixed(priv, pos, fixed, n);
+			continue;
+		}
+
+		frame = frames;
+		for (j = 0; j < n; j++) {
+			for (c = 0; c < file_channels; c++) {
+				switch (priv->encoding) {
+				case IO_BIN_INT16:
+					value = (int16_t)(pos[0] |
+							  (pos[1] << 8)) /
+						priv->scale;
+					pos += 2;
+					break;
+				case IO_BIN_FLOAT32:
+					u32 = bin_get_le32(pos);
+					memcpy(&value, &u32, sizeof(value));
+					pos += 4;
+					break;
+				case IO_BIN_DELTA_VARINT:
+				default:
+					value = fixed[j * file_channels + c] /
+						priv->scale;
+					break;
+				}
+
+				if (c < channels)
+					frame[c] = value;
+			}
+
+			/* channels missing from file */
+			for (; c < channels; c++)
+				frame[c] = 0.0f;
+
+			frame += channels;
+		}
+
+		bin_emit_frames(priv, frames, n);
+	}
+
+	if (pos != end)
+		goto err;
+
+	return true;
+
+err:
+	io_set_latest_error("%s():%d: corrupted binary block",
+			    __func__, __LINE__);
+	return false;
+}
+
+/* Get contiguous payload of block at @offset, copy if it spans pieces */
+static const unsigned char *bin_get_payload(struct bin_parser_priv *priv,
+					    struct ds_append_buffer *buffer,
+					    unsigned int offset,
+					    unsigned int len)
+{
+	struct ds_append_buffer_span span;
+	unsigned char *buf;
+
+	if (len == 0)
+		return priv->block_buf;
+
+	if (ds_append_buffer_get_spans(buffer, offset, len, &span, 1) == 1 &&
+	    span.len == len)
+		return span.data;
+
+	if (priv->block_buf_len < len) {
+		buf = realloc(priv->block_buf, len);
+		if (!buf) {
+			io_set_latest_error("%s():%d: realloc failed "
+					    "(errno: %d)", __func__, __LINE__,
+					    errno);
+			return NULL;
+		}
+
+		priv->block_buf = buf;
+		priv->block_buf_len = len;
+	}
+
+	ds_append_buffer_copy(buffer, offset, priv->block_buf, len);
+
+	return priv->block_buf;
+}
+
+static enum io_parser_ret __bin_parser_parse(struct bin_parser_priv *priv,
+					     struct ds_append_buffer *buffer,
+					     bool final)
+{
+	unsigned char header[IO_BIN_HEADER_LEN];
+	unsigned int num_frames, len;
+	const unsigned char *payload;
+
+	while (true) {
+		switch (priv->state) {
+		case PARSE_BIN_HEADER:
+			if (ds_append_buffer_copy(buffer, 0, header,
+						  IO_BIN_HEADER_LEN) <
+							IO_BIN_HEADER_LEN)
+				goto need_more;
+
+			if (!bin_parse_header(priv, header))
+				return IO_PARSER_RET_ERROR;
+
+			ds_append_buffer_move_head(buffer, IO_BIN_HEADER_LEN);
+			priv->state = PARSE_BIN_BLOCK;
+			break;
+
+		case PARSE_BIN_BLOCK:
+			if (ds_append_buffer_copy(buffer, 0, header,
+						  IO_BIN_BLOCK_HEADER_LEN) <
+							IO_BIN_BLOCK_HEADER_LEN)
+				goto need_more;
+
+			num_frames = bin_get_le32(&header[0]);
+			len = bin_get_le32(&header[4]);
+			if (!bin_check_block(priv, num_frames, len))
+				return IO_PARSER_RET_ERROR;
+
+			/* wait for whole block */
+			if (ds_append_buffer_length(buffer) <
+						IO_BIN_BLOCK_HEADER_LEN + len)
+				goto need_more;
+
+			payload = bin_get_payload(priv, buffer,
+						  IO_BIN_BLOCK_HEADER_LEN,
+						  len);
+			if (!payload ||
+			    !bin_decode_block(priv, payload, len, num_frames))
+				return IO_PARSER_RET_ERROR;
+
+			ds_append_buffer_move_head(buffer,
+						   IO_BIN_BLOCK_HEADER_LEN +
+						   len);
+
+			/* Leave rest of input in buffer until queue has room */
+			if (io_context_queue_is_full(priv->ctx))
+				return IO_PARSER_RET_QUEUE_FULL;
+			break;
+		}
+	}
+
+need_more:
+	if (final && ds_append_buffer_length(buffer) > 0) {
+		io_set_latest_error("%s():%d: truncated binary sample file",
+				    __func__, __LINE__);
+		return IO_PARSER_RET_ERROR;
+	}
+
+	return IO_PARSER_RET_CONTINUE;
+}
+
+static enum io_parser_ret bin_parser_parse(struct io_parser *parser,
+					   struct ds_append_buffer *buffer,
+					   bool final)
+{
+	struct bin_parser_priv *priv = bin_parser_priv(parser);
+	enum io_parser_ret eret;
+
+	eret = __bin_parser_parse(priv, buffer, final);
+
+	/* Resample input frames decoded by this call */
+	if (priv->state != PARSE_BIN_HEADER && priv->resample)
+		io_resampler_flush(&priv->resampler, final);
+
+	return eret;
+}
+
+static bool bin_parser_wait_queue(struct io_parser *parser)
+{
+	struct bin_parser_priv *priv = bin_parser_priv(parser);
+
+	return io_context_queue_wait_free(priv->ctx);
+}
+
+static bool bin_parser_destroy(struct io_parser *parser)
+{
+	struct bin_parser_priv *priv = bin_parser_priv(parser);
+
+	free(priv->block_buf);
+	free(priv);
+	return true;
+}
+
+static bool bin_parser_reset(struct io_parser *parser)
+{
+	struct bin_parser_priv *priv = bin_parser_priv(parser);
+
+	priv->state = PARSE_BIN_HEADER;
+
+	return true;
+}
+
+static void bin_parser_set_context(struct io_parser *parser,
+				   struct io_context *ctx)
+{
+	struct bin_parser_priv *priv = bin_parser_priv(parser);
+
+	priv->ctx = io_parser_get_context(parser);
+}
+
+static const struct io_parser_ops bin_parser_ops = {
+	.name = "bin",
+	.parse = bin_parser_parse,
+	.wait_queue = bin_parser_wait_queue,
+	.destroy = bin_parser_destroy,
+	.reset = bin_parser_reset,
+	.set_context = bin_parser_set_context,
+};
+
+/**
+ * io_new_bin_parser - allocate and initialize new binary sample file parser
+ */
+struct io_parser *io_new_bin_parser(void)
+{
+	struct bin_parser_priv *priv;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	io_parser_init(&priv->parser, &bin_parser_ops);
+	io_parser_reset(&priv->parser);
+	priv->ctx = io_parser_get_context(&priv->parser);
+
+	return &priv->parser;
+}
@@ -23,10 +23,17 @@
  *
  */
 
+/* open() */
+#define _POSIX_C_SOURCE 200112L
+
+#include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "priv_zlib.h"
 #include "io.h"
@@ -36,6 +43,10 @@
 #define GZ_MAGIC_CM 0x08
 
 #define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+/* Freed zlib allocations kept for reuse by later streams */
+#define GZ_ZALLOC_CACHE_LEN 8
 
 enum gz_flags {
 	GZIP_FLAG_FTEXT = (1 << 0),
@@ -54,6 +65,8 @@ enum gz_state {
 	PARSE_GZIP_FHCRC,
 	DO_PASSTHROUGH,
 	DO_DECOMPRESSION,
+	PARSE_GZIP_TRAILER,
+	CHECK_MEMBER_MAGIC,
 	DONE,
 };
 
@@ -65,10 +78,30 @@ struct gz_parser_priv {
 	unsigned int gz_flags;
 
 	bool zlib_initialized;
+	unsigned int window_len;
 	struct ds_append_buffer decompr_buf;
 	z_stream zstream;
-	unsigned char z_buf[256];
-	unsigned int z_buf_bytes;
+	bool z_pending;
+
+	/* CRC32 and length of decompressed data of current member */
+	unsigned long crc;
+	unsigned long isize;
+
+	/*
+	 * After seek, decompression starts from access point inside member:
+	 * output before seek position is discarded and member trailer cannot
+	 * be verified.
+	 */
+	struct io_gz_index *index;
+	unsigned long long skip_out;
+	bool partial_member;
+};
+
+/* Decompressed data of indexed gzip file, as seek source of child parser */
+struct gz_seek_view {
+	struct io_seek_source src;
+	const struct io_gz_index *index;
+	int fd;
 };
 
 static inline struct gz_parser_priv *gz_parser_priv(struct io_parser *parser)
@@ -76,14 +109,70 @@ static inline struct gz_parser_priv *gz_parser_priv(struct io_parser *parser)
 	return ds_container_of(parser, struct gz_parser_priv, parser);
 }
 
+/* Header of zlib allocation, keeps size for reuse from cache */
+union gz_zalloc_hdr {
+	size_t size;
+	void *ptr;
+	long double ld;
+};
+
+/*
+ * Inflate state and window allocations are same size for all streams, so
+ * blocks freed by one parser are handed to next one instead of malloc().
+ */
+static struct {
+	pthread_mutex_t lock;
+	unsigned int num;
+	union gz_zalloc_hdr *blocks[GZ_ZALLOC_CACHE_LEN];
+} gz_zalloc_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static void *gz_zalloc(void *o, unsigned int items, unsigned int size)
 {
-	return calloc(items, size);
+	union gz_zalloc_hdr *hdr = NULL;
+	size_t len;
+	unsigned int i;
+
+	if (size && items > (SIZE_MAX - sizeof(*hdr)) / size)
+		return NULL;
+	len = (size_t)items * size;
+
+	pthread_mutex_lock(&gz_zalloc_cache.lock);
+	for (i = 0; i < gz_zalloc_cache.num; i++) {
+		if (gz_zalloc_cache.blocks[i]->size != len)
+			continue;
+
+		hdr = gz_zalloc_cache.blocks[i];
+		gz_zalloc_cache.blocks[i] =
+			gz_zalloc_cache.blocks[--gz_zalloc_cache.num];
+		break;
+	}
+	pthread_mutex_unlock(&gz_zalloc_cache.lock);
+
+	if (!hdr) {
+		hdr = malloc(sizeof(*hdr) + len);
+		if (!hdr)
+			return NULL;
+
+		hdr->size = len;
+	}
+
+	return hdr + 1;
 }
 
 static void gz_zfree(void *o, void *mem)
 {
-	free(mem);
+	union gz_zalloc_hdr *hdr = (union gz_zalloc_hdr *)mem - 1;
+
+	pthread_mutex_lock(&gz_zalloc_cache.lock);
+	if (gz_zalloc_cache.num < GZ_ZALLOC_CACHE_LEN) {
+		gz_zalloc_cache.blocks[gz_zalloc_cache.num++] = hdr;
+		hdr = NULL;
+	}
+	pthread_mutex_unlock(&gz_zalloc_cache.lock);
+
+	free(hdr);
 }
 
 static void gz_close_zlib(struct io_parser *parser)
@@ -94,30 +183,71 @@ static void gz_close_zlib(struct io_parser *parser)
 		return;
 
 	inflateEnd(&priv->zstream);
-	ds_append_buffer_free(&priv->decompr_buf);
 
 	priv->zlib_initialized = false;
-	priv->z_buf_bytes = 0;
+	priv->z_pending = false;
 }
 
-static void gz_initialize_zlib(struct io_parser *parser)
+/*
+ * Start inflating new gzip member. Inflate state is allocated for first
+ * member only and reset for following members and after parser reset.
+ */
+static bool gz_start_member(struct io_parser *parser)
 {
 	struct gz_parser_priv *priv = gz_parser_priv(parser);
+	int ret;
+
+	priv->z_pending = false;
+	priv->crc = crc32(0L, Z_NULL, 0);
+	priv->isize = 0;
+	priv->partial_member = false;
+
+	if (priv->zlib_initialized) {
+		ret = inflateReset2(&priv->zstream, -15);
+	} else {
+		memset(&priv->zstream, 0, sizeof(priv->zstream));
+
+		priv->zstream.zalloc = gz_zalloc;
+		priv->zstream.zfree = gz_zfree;
+		priv->zstream.next_in = Z_NULL;
+		priv->zstream.avail_in = 0;
+		ret = inflateInit2(&priv->zstream, -15);
+
+		priv->zlib_initialized = (ret == Z_OK);
+	}
+
+	if (ret != Z_OK) {
+		io_set_latest_error("%s():%d: inflate init failed (errno: %d)",
+				    __func__, __LINE__, ret);
+		return false;
+	}
+
+	return true;
+}
+
+/* Input ended or trailing garbage after last member, flush child */
+static enum io_parser_ret gz_finish(struct gz_parser_priv *priv,
+				    struct ds_append_buffer *buffer)
+{
+	ds_append_buffer_move_head(buffer, ds_append_buffer_length(buffer));
+	priv->state = DONE;
 
-	if (priv->zlib_initialized)
-		gz_close_zlib(parser);
+	return io_parser_parse(priv->child, &priv->decompr_buf, true);
+}
 
-	ds_append_buffer_init(&priv->decompr_buf);
-	memset(&priv->zstream, 0, sizeof(priv->zstream));
+/* Waiting for more input, let child parse data it left over */
+static enum io_parser_ret gz_parse_child_pending(struct gz_parser_priv *priv)
+{
+	if (ds_append_buffer_length(&priv->decompr_buf) == 0)
+		return IO_PARSER_RET_CONTINUE;
 
-	priv->zstream.zalloc = gz_zalloc;
-	priv->zstream.zfree =gz_zfree;
-	priv->zstream.next_in = Z_NULL;
-	priv->zstream.avail_in = 0;
-	inflateInit2(&priv->zstream, -15);
+	return io_parser_parse(priv->child, &priv->decompr_buf, false);
+}
 
-	priv->zlib_initialized = true;
-	priv->z_buf_bytes = 0;
+static unsigned long gz_get_le32(const unsigned char *buf)
+{
+	return (unsigned long)buf[0] | ((unsigned long)buf[1] << 8) |
+	       ((unsigned long)buf[2] << 16) | ((unsigned long)buf[3] << 24);
 }
 
 static bool gz_skip_null_term_string(struct ds_append_buffer *buffer)
@@ -158,28 +288,25 @@ static int gz_decompress(struct io_parser *parser,
 {
 	struct gz_parser_priv *priv = gz_parser_priv(parser);
 	z_stream *zinf = &priv->zstream;
-	unsigned int out_bytes, wbuflen = 0;
+	struct ds_append_buffer_iterator iter;
+	unsigned int in_bytes = 0, out_bytes, wbuflen = 0;
+	unsigned long long start;
 	void *write_buf;
 	int ret;
 
-	/* Check if data in z_buf has been processed */
-	if (zinf->avail_in == 0) {
-		/* read in new bytes */
-		priv->z_buf_bytes = ds_append_buffer_copy(buffer, 0,
-							  priv->z_buf,
-							  sizeof(priv->z_buf));
-
-		zinf->next_in = priv->z_buf;
-		zinf->avail_in = priv->z_buf_bytes;
-
-		if (priv->z_buf_bytes == 0) {
-			/* no more input */
-			return -1;
-		}
-
-		/* move buffer head forward */
-		ds_append_buffer_move_head(buffer, priv->z_buf_bytes);
+	/* Feed zlib directly from first piece of input buffer, no copying */
+	ds_append_buffer_iterator_init(buffer, &iter);
+	if (!ds_append_buffer_iterator_has_reached_end(&iter)) {
+		zinf->next_in = ds_append_buffer_iterator_span(&iter,
+							       &in_bytes);
+	} else if (!priv->z_pending) {
+		/* no more input */
+		return -1;
+	} else {
+		/* no new input, but zlib might still have output pending */
+		zinf->next_in = Z_NULL;
 	}
+	zinf->avail_in = in_bytes;
 
 	/* Avoid memory copies, inflate() directly to append_buffer... */
 	write_buf = ds_append_buffer_get_write_buffer(&priv->decompr_buf,
@@ -193,23 +320,55 @@ static int gz_decompress(struct io_parser *parser,
 	zinf->avail_out = wbuflen;
 
 	/* TODO: test-case for final and Z_FINISH */
+	start = io_get_monotonic_ns();
 	ret = inflate(zinf, /*final ? Z_FINISH :*/ Z_SYNC_FLUSH);
+	io_stats_add(&priv->parser.stats.decode_ns,
+		     io_get_monotonic_ns() - start);
+
+	/*
+	 * Move buffer head forward by consumed bytes. Input pointer is not
+	 * kept over calls as buffer head might be moved by others.
+	 */
+	ds_append_buffer_move_head(buffer, in_bytes - zinf->avail_in);
+	zinf->next_in = Z_NULL;
+	zinf->avail_in = 0;
+
+	/* Output window filled up, zlib might have more output pending */
+	priv->z_pending = (zinf->avail_out == 0);
 
 	if (ret == Z_OK || ret == Z_STREAM_END) {
+		/* end of member, more members might follow */
 		if (ret == Z_STREAM_END) {
-			priv->state = DONE;
-			final = true;
+			priv->state = PARSE_GZIP_TRAILER;
+			priv->z_pending = false;
 		}
 
 		out_bytes = wbuflen - zinf->avail_out;
 
+		/* checksum for member trailer */
+		priv->crc = crc32(priv->crc, write_buf, out_bytes);
+		priv->isize += out_bytes;
+
 		/* append new write buffer at end of appendable buffer */
 		ds_append_buffer_finish_write_buffer(&priv->decompr_buf,
 						     write_buf, out_bytes);
+		io_stats_add(&priv->parser.stats.bytes_out, out_bytes);
+
+		/* output between access point and seek position */
+		if (priv->skip_out > 0) {
+			out_bytes = ds_append_buffer_length(&priv->decompr_buf);
+			if (out_bytes > priv->skip_out)
+				out_bytes = priv->skip_out;
+
+			ds_append_buffer_move_head(&priv->decompr_buf,
+						   out_bytes);
+			priv->skip_out -= out_bytes;
+		}
 
 		/* pass bytes to child parser */
-		ret = io_parser_parse(priv->child, &priv->decompr_buf, final);
-		if (ret != IO_PARSER_RET_CONTINUE || priv->state == DONE) {
+		ret = io_parser_parse(priv->child, &priv->decompr_buf, false);
+		if (ret != IO_PARSER_RET_CONTINUE ||
+		    priv->state != DO_DECOMPRESSION) {
 			*outret = ret;
 			return 1;
 		}
@@ -343,7 +502,7 @@ new_state:
 		 * Handle header-checksum if gzip-flag say that file contains
 		 * it.
 		 */
-		if (priv->gz_flags & PARSE_GZIP_FHCRC) {
+		if (priv->gz_flags & GZIP_FLAG_FHCRC) {
 			if (ds_append_buffer_length(buffer) < 2)
 				return IO_PARSER_RET_CONTINUE;
 
@@ -354,7 +513,8 @@ new_state:
 		ds_append_buffer_copy(buffer, 0, header, 2);
 
 		/* Header parsed, continue to decompression */
-		gz_initialize_zlib(parser);
+		if (!gz_start_member(parser))
+			return IO_PARSER_RET_ERROR;
 		priv->state = DO_DECOMPRESSION;
 
 		goto new_state;
@@ -374,21 +534,74 @@ new_state:
 		*/
 		do {
 			loopret = gz_decompress(parser, buffer, final, &ret);
-			if (loopret == 1)
+			if (loopret == 1) {
+				/* member ended, continue with trailer */
+				if (ret == IO_PARSER_RET_CONTINUE &&
+				    priv->state != DO_DECOMPRESSION)
+					goto new_state;
 				return ret;
+			}
 		} while (loopret == 0);
 
-		/* If final flag is set, let child parser know/flush */
+		/* Input ended in middle of member, let child parser flush. */
 		if (final)
-			return io_parser_parse(priv->child, &priv->decompr_buf,
-					       true);
+			return gz_finish(priv, buffer);
 
-		return IO_PARSER_RET_CONTINUE;
+		/*
+		 * Let child parser handle decompressed data left over from
+		 * previous full queue.
+		 */
+		return io_parser_parse(priv->child, &priv->decompr_buf, false);
+
+	/* Verify CRC32 and ISIZE of member */
+	case PARSE_GZIP_TRAILER:
+		if (ds_append_buffer_length(buffer) < GZIP_TRAILER_LEN) {
+			if (final)
+				return gz_finish(priv, buffer);
+			return gz_parse_child_pending(priv);
+		}
+
+		ds_append_buffer_copy(buffer, 0, header, GZIP_TRAILER_LEN);
+		ds_append_buffer_move_head(buffer, GZIP_TRAILER_LEN);
+
+		if (!priv->partial_member &&
+		    (gz_get_le32(&header[0]) != (priv->crc & 0xffffffffUL) ||
+		     gz_get_le32(&header[4]) != (priv->isize & 0xffffffffUL))) {
+			io_set_latest_error("%s():%d: gzip member checksum "
+					    "mismatch", __func__, __LINE__);
+			return IO_PARSER_RET_ERROR;
+		}
+
+		priv->state = CHECK_MEMBER_MAGIC;
+
+		/* Passthrough */
+
+	/* Concatenated gzip members are decompressed as one stream */
+	case CHECK_MEMBER_MAGIC:
+		if (ds_append_buffer_length(buffer) < 3) {
+			if (final)
+				return gz_finish(priv, buffer);
+			return gz_parse_child_pending(priv);
+		}
+
+		ds_append_buffer_copy(buffer, 0, header, 3);
+		if (header[0] != GZ_MAGIC_ID1 || header[1] != GZ_MAGIC_ID2 ||
+		    header[2] != GZ_MAGIC_CM)
+			return gz_finish(priv, buffer);
+
+		priv->state = PARSE_GZIP_HEADER;
+		goto new_state;
 
 	/* Decompression done, ignore trailing bytes. */
 	case DONE:
 		ds_append_buffer_move_head(buffer,
 					   ds_append_buffer_length(buffer));
+
+		/* Child might have left data unparsed because of full queue */
+		if (ds_append_buffer_length(&priv->decompr_buf) > 0)
+			return io_parser_parse(priv->child, &priv->decompr_buf,
+					       true);
+
 		return IO_PARSER_RET_CONTINUE;
 	}
 }
@@ -397,15 +610,8 @@ static bool gz_parser_wait_queue(struct io_parser *parser)
 {
 	struct gz_parser_priv *priv = gz_parser_priv(parser);
 
-	switch (priv->state) {
-	case DO_PASSTHROUGH:
-		return io_parser_wait_queue(priv->child);
-	case DO_DECOMPRESSION:
-		/* TODO: some work needed here? */
-		return true;
-	default:
-		return true;
-	}
+	/* Values queue is owned by child parser in all states */
+	return io_parser_wait_queue(priv->child);
 }
 
 static bool gz_parser_destroy(struct io_parser *parser)
@@ -413,33 +619,226 @@ static bool gz_parser_destroy(struct io_parser *parser)
 	struct gz_parser_priv *priv = gz_parser_priv(parser);
 
 	gz_close_zlib(parser);
+	ds_append_buffer_free(&priv->decompr_buf);
+	io_gz_index_free(priv->index);
 	io_parser_destroy(priv->child);
 	free(parser);
 
 	return true;
 }
 
+/* Drop state of current stream, inflate state is reset at next member */
+static void gz_reset_stream(struct gz_parser_priv *priv)
+{
+	priv->state = CHECK_MAGIC;
+	priv->z_pending = false;
+	priv->skip_out = 0;
+	ds_append_buffer_free(&priv->decompr_buf);
+	ds_append_buffer_init_sized(&priv->decompr_buf, priv->window_len,
+				    priv->window_len);
+}
+
 static bool gz_parser_reset(struct io_parser *parser)
 {
 	struct gz_parser_priv *priv = gz_parser_priv(parser);
 
-	priv->state = CHECK_MAGIC;
-	gz_close_zlib(parser);
+	gz_reset_stream(priv);
+
+	/* file might be replaced when input is reopened */
+	io_gz_index_free(priv->index);
+	priv->index = NULL;
 
 	return io_parser_reset(priv->child);
 }
 
+static int gz_seek_view_read(const struct io_seek_source *src,
+			     unsigned long long offset, void *buf,
+			     unsigned int len)
+{
+	const struct gz_seek_view *view = src->priv;
+
+	return io_gz_index_read(view->index, view->fd, offset, buf, len);
+}
+
+static bool gz_seek_view_find_line(const struct io_seek_source *src,
+				   unsigned long long line,
+				   unsigned long long *offset,
+				   unsigned long long *line_start)
+{
+	const struct gz_seek_view *view = src->priv;
+	struct io_gz_access_point point;
+
+	io_gz_index_get_point(view->index,
+			      io_gz_index_find_line(view->index, line),
+			      &point);
+
+	*offset = point.line_start;
+	*line_start = point.line;
+	return true;
+}
+
+/**
+ * gz_seek_inflate - start raw inflate from access point before decompressed
+ *		     offset @out
+ * @offset: compressed offset of access point is stored here
+ */
+static bool gz_seek_inflate(struct gz_parser_priv *priv,
+			    const struct io_seek_source *src,
+			    unsigned long long out, unsigned long long *offset)
+{
+	struct io_gz_access_point point;
+	unsigned char *window, byte;
+	unsigned int i;
+	int len;
+
+	if (out >= io_gz_index_length(priv->index)) {
+		priv->state = DONE;
+		*offset = src->length;
+		return true;
+	}
+
+	i = io_gz_index_find_offset(priv->index, out);
+	io_gz_index_get_point(priv->index, i, &point);
+
+	window = malloc(IO_GZ_INDEX_WINDOW_LEN);
+	if (!window) {
+		io_set_latest_error("%s():%d: malloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return false;
+	}
+
+	len = io_gz_index_get_window(priv->index, i, window);
+	if (len < 0 || !gz_start_member(&priv->parser))
+		goto err;
+
+	/* bits of byte before point belong to first block */
+	if (point.bits > 0) {
+		if (point.in == 0 ||
+		    src->read(src, point.in - 1, &byte, 1) != 1) {
+			io_set_latest_error("%s():%d: could not read access "
+					    "point", __func__, __LINE__);
+			goto err;
+		}
+
+		inflatePrime(&priv->zstream, point.bits,
+			     byte >> (8 - point.bits));
+	}
+
+	if (len > 0 &&
+	    inflateSetDictionary(&priv->zstream, window, len) != Z_OK) {
+		io_set_latest_error("%s():%d: inflateSetDictionary failed",
+				    __func__, __LINE__);
+		goto err;
+	}
+
+	free(window);
+
+	priv->state = DO_DECOMPRESSION;
+	priv->skip_out = out - point.out;
+	priv->partial_member = true;
+	*offset = point.in;
+
+	return true;
+
+err:
+	free(window);
+	return false;
+}
+
+static bool gz_parser_seek_time(struct io_parser *parser,
+				const struct io_seek_source *src,
+				double seconds, unsigned long long *offset)
+{
+	struct gz_parser_priv *priv = gz_parser_priv(parser);
+	unsigned char header[3];
+	struct gz_seek_view view;
+	unsigned long long out;
+	bool ok;
+	int ret;
+
+	gz_reset_stream(priv);
+
+	ret = src->read(src, 0, header, sizeof(header));
+	if (ret < 0)
+		return false;
+
+	/* not compressed, child seeks in same stream */
+	if (ret < 3 || header[0] != GZ_MAGIC_ID1 ||
+	    header[1] != GZ_MAGIC_ID2 || header[2] != GZ_MAGIC_CM) {
+		priv->state = DO_PASSTHROUGH;
+		return io_parser_seek_time(priv->child, src, seconds, offset);
+	}
+
+	if (!src->filename) {
+		io_set_latest_error("%s():%d: gzip stream is not file, cannot "
+				    "seek", __func__, __LINE__);
+		return false;
+	}
+
+	/* index is built on first seek and saved next to file */
+	if (!priv->index) {
+		priv->index = io_gz_index_open(src->filename, 0);
+		if (!priv->index)
+			return false;
+	}
+
+	view.index = priv->index;
+	view.fd = open(src->filename, O_RDONLY);
+	if (view.fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    src->filename, errno);
+		return false;
+	}
+
+	view.src.filename = NULL;
+	view.src.length = io_gz_index_length(priv->index);
+	view.src.read = gz_seek_view_read;
+	view.src.find_line = gz_seek_view_find_line;
+	view.src.priv = &view;
+
+	ok = io_parser_seek_time(priv->child, &view.src, seconds, &out) &&
+	     gz_seek_inflate(priv, src, out, offset);
+
+	close(view.fd);
+
+	return ok;
+}
+
+static void gz_parser_set_context(struct io_parser *parser,
+				  struct io_context *ctx)
+{
+	struct gz_parser_priv *priv = gz_parser_priv(parser);
+
+	io_parser_set_context(priv->child, ctx);
+}
+
+static struct io_parser *gz_parser_get_child(struct io_parser *parser)
+{
+	struct gz_parser_priv *priv = gz_parser_priv(parser);
+
+	return priv->child;
+}
+
 static const struct io_parser_ops gz_parser_ops = {
+	.name = "gzip",
 	.parse = gz_parser_parse,
 	.wait_queue = gz_parser_wait_queue,
 	.destroy = gz_parser_destroy,
 	.reset = gz_parser_reset,
+	.set_context = gz_parser_set_context,
+	.get_child = gz_parser_get_child,
+	.seek_time = gz_parser_seek_time,
 };
 
 /**
- * io_new_gz_parser - allocate and initialize new GZ parser
+ * io_new_gz_parser_sized - allocate and initialize new GZ parser with output
+ *			    window size
+ * @child: parser receiving decompressed data
+ * @window_len: size of decompression output window
  */
-struct io_parser *io_new_gz_parser(struct io_parser *child)
+struct io_parser *io_new_gz_parser_sized(struct io_parser *child,
+					 unsigned int window_len)
 {
 	struct gz_parser_priv *priv;
 
@@ -455,9 +854,22 @@ struct io_parser *io_new_gz_parser(struct io_parser *child)
 	}
 
 	priv->child = child;
+	priv->window_len = window_len;
 	priv->state = CHECK_MAGIC;
+
+	/* Large pieces, so that inflate() fills big output window per call */
+	ds_append_buffer_init_sized(&priv->decompr_buf, window_len,
+				    window_len);
 	io_parser_init(&priv->parser, &gz_parser_ops);
 	io_parser_reset(&priv->parser);
 
 	return &priv->parser;
 }
+
+/**
+ * io_new_gz_parser - allocate and initialize new GZ parser
+ */
+struct io_parser *io_new_gz_parser(struct io_parser *child)
+{
+	return io_new_gz_parser_sized(child, IO_GZ_DEFAULT_WINDOW_LEN);
+}
@@ -0,0 +1,407 @@
+/*
+ * Pipelined parser stage
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ *
+ * Pipe parser runs its child parser in own thread. Input buffer pieces are
+ * handed to pipe thread through single-producer/single-consumer queue, so
+ * that parent stage (for example inflate of gzip parser) and child stage
+ * (text parser) run on separate cores.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "io.h"
+
+struct pipe_msg {
+	/* pieces of input, moved from buffer of parent */
+	struct ds_append_buffer buf;
+	bool final;
+	bool quit;
+};
+
+struct pipe_parser_priv {
+	struct io_parser parser;
+	struct io_parser *child;
+
+	struct ds_spsc_queue *queue;
+	unsigned int queue_len;
+	bool thread_running;
+	pthread_t thread;
+
+	/* Signaled by pipe thread after changing state below */
+	struct ds_event *event;
+
+	/* Messages pushed by parent, written by parent thread only */
+	unsigned int pushed;
+
+	/* Messages parsed, and state of child, written by pipe thread only */
+	unsigned int done;
+	bool child_full;
+	bool failed;
+
+	/* Input left unparsed by child, owned by pipe thread */
+	struct ds_append_buffer work_buf;
+};
+
+static inline struct pipe_parser_priv *pipe_parser_priv(
+						struct io_parser *parser)
+{
+	return ds_container_of(parser, struct pipe_parser_priv, parser);
+}
+
+/* Number of messages queued or being parsed by pipe thread */
+static unsigned int pipe_in_flight(struct pipe_parser_priv *priv)
+{
+	return priv->pushed - __atomic_load_n(&priv->done, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * pipe_wait - wait until at most @max messages are in flight
+ * @stop_if_child_full: give up if child of pipe thread is waiting for room
+ *			in values queue
+ *
+ * Returns false if gave up because of full child.
+ */
+static bool pipe_wait(struct pipe_parser_priv *priv, unsigned int max,
+		      bool stop_if_child_full)
+{
+	unsigned int key;
+
+	while (pipe_in_flight(priv) > max) {
+		key = ds_event_prepare_wait(priv->event);
+
+		if (pipe_in_flight(priv) <= max) {
+			ds_event_cancel_wait(priv->event);
+			break;
+		}
+
+		if (stop_if_child_full &&
+		    __atomic_load_n(&priv->child_full, __ATOMIC_SEQ_CST)) {
+			ds_event_cancel_wait(priv->event);
+			return false;
+		}
+
+		ds_event_wait(priv->event, key, NULL);
+	}
+
+	return true;
+}
+
+/* Let pipe thread finish all queued messages */
+static void pipe_wait_idle(struct pipe_parser_priv *priv)
+{
+	pipe_wait(priv, 0, false);
+}
+
+static void pipe_reset_work_buf(struct pipe_parser_priv *priv)
+{
+	ds_append_buffer_free(&priv->work_buf);
+	ds_append_buffer_init_sized(&priv->work_buf,
+				    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+}
+
+/* Parse message in pipe thread, waiting for room in values queue */
+static void pipe_handle_msg(struct pipe_parser_priv *priv,
+			    struct pipe_msg *msg)
+{
+	enum io_parser_ret ret;
+	unsigned int len;
+
+	if (__atomic_load_n(&priv->failed, __ATOMIC_SEQ_CST)) {
+		/* discard input until reset */
+		ds_append_buffer_free(&msg->buf);
+		return;
+	}
+
+	len = ds_append_buffer_length(&msg->buf);
+	if (ds_append_buffer_splice(&priv->work_buf, &msg->buf) < len) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		ret = IO_PARSER_RET_ERROR;
+		goto out;
+	}
+
+	do {
+		ret = io_parser_parse(priv->child, &priv->work_buf,
+				      msg->final);
+		if (ret != IO_PARSER_RET_QUEUE_FULL)
+			break;
+
+		/* Parent stops with IO_PARSER_RET_QUEUE_FULL once pipe fills */
+		__atomic_store_n(&priv->child_full, true, __ATOMIC_SEQ_CST);
+		ds_event_signal(priv->event);
+
+		if (!io_parser_wait_queue(priv->child))
+			ret = IO_PARSER_RET_ERROR;
+
+		__atomic_store_n(&priv->child_full, false, __ATOMIC_SEQ_CST);
+	} while (ret == IO_PARSER_RET_QUEUE_FULL);
+
+out:
+	ds_append_buffer_free(&msg->buf);
+
+	if (ret == IO_PARSER_RET_ERROR)
+		__atomic_store_n(&priv->failed, true, __ATOMIC_SEQ_CST);
+
+	/* Child had chance to handle end of stream */
+	if (ret == IO_PARSER_RET_ERROR || msg->final)
+		pipe_reset_work_buf(priv);
+}
+
+static void *pipe_thread(void *arg)
+{
+	struct pipe_parser_priv *priv = arg;
+	struct pipe_msg msg;
+	size_t msglen;
+
+	while (true) {
+		ds_spsc_queue_pop(priv->queue, &msg, &msglen);
+		if (msg.quit)
+			break;
+
+		pipe_handle_msg(priv, &msg);
+
+		__atomic_add_fetch(&priv->done, 1, __ATOMIC_SEQ_CST);
+		ds_event_signal(priv->event);
+	}
+
+	return NULL;
+}
+
+/*
+ * Child pushes values from pipe thread only if values queue of context is
+ * locked for IO thread, or if values go to sink. Otherwise consumer and
+ * parser share caller thread and child is run there.
+ */
+static bool pipe_use_thread(struct pipe_parser_priv *priv)
+{
+	struct io_parser *parser = &priv->parser;
+
+	return priv->thread_running &&
+	       (parser->sink ||
+		io_context_queue_is_shared(io_parser_get_context(parser)));
+}
+
+static enum io_parser_ret pipe_parser_parse(struct io_parser *parser,
+					    struct ds_append_buffer *buffer,
+					    bool final)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+	struct pipe_msg msg;
+	unsigned int len;
+
+	if (!pipe_use_thread(priv)) {
+		pipe_wait_idle(priv);
+		if (priv->failed)
+			return IO_PARSER_RET_ERROR;
+
+		return io_parser_parse(priv->child, buffer, final);
+	}
+
+	if (__atomic_load_n(&priv->failed, __ATOMIC_SEQ_CST)) {
+		ds_append_buffer_move_head(buffer,
+					   ds_append_buffer_length(buffer));
+		return IO_PARSER_RET_ERROR;
+	}
+
+	len = ds_append_buffer_length(buffer);
+	if (len == 0 && !final)
+		return IO_PARSER_RET_CONTINUE;
+
+	/*
+	 * Pipe is full. Wait for pipe thread, unless child waits for consumer
+	 * to make room, then stop parent until there is room in pipe.
+	 */
+	if (!pipe_wait(priv, priv->queue_len - 1, true))
+		return IO_PARSER_RET_QUEUE_FULL;
+
+	/* Whole buffer is passed, without copying pieces */
+	ds_append_buffer_move(&msg.buf, buffer);
+	msg.final = final;
+	msg.quit = false;
+
+	ds_spsc_queue_push(priv->queue, &msg, sizeof(msg));
+	priv->pushed++;
+
+	io_stats_add(&parser->stats.bytes_out, len);
+
+	/* At end of stream, values are available when parse returns */
+	if (final) {
+		pipe_wait_idle(priv);
+		if (priv->failed)
+			return IO_PARSER_RET_ERROR;
+	}
+
+	return IO_PARSER_RET_CONTINUE;
+}
+
+static bool pipe_parser_wait_queue(struct io_parser *parser)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+
+	if (!pipe_use_thread(priv))
+		return io_parser_wait_queue(priv->child);
+
+	/* Pipe thread waits on child for room in values queue */
+	pipe_wait(priv, priv->queue_len - 1, false);
+
+	return !__atomic_load_n(&priv->failed, __ATOMIC_SEQ_CST);
+}
+
+static bool pipe_parser_destroy(struct io_parser *parser)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+	struct pipe_msg msg;
+
+	if (priv->thread_running) {
+		ds_append_buffer_init(&msg.buf);
+		msg.final = false;
+		msg.quit = true;
+
+		ds_spsc_queue_push(priv->queue, &msg, sizeof(msg));
+		pthread_join(priv->thread, NULL);
+	}
+
+	ds_append_buffer_free(&priv->work_buf);
+	if (priv->queue)
+		ds_spsc_queue_free(priv->queue);
+	if (priv->event)
+		ds_event_free(priv->event);
+	io_parser_destroy(priv->child);
+	free(parser);
+
+	return true;
+}
+
+static bool pipe_parser_reset(struct io_parser *parser)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+
+	/* Pipe thread is idle until next message */
+	pipe_wait_idle(priv);
+	pipe_reset_work_buf(priv);
+	priv->failed = false;
+
+	return io_parser_reset(priv->child);
+}
+
+static void pipe_parser_set_context(struct io_parser *parser,
+				    struct io_context *ctx)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+
+	pipe_wait_idle(priv);
+	io_parser_set_context(priv->child, ctx);
+}
+
+static struct io_parser *pipe_parser_get_child(struct io_parser *parser)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+
+	return priv->child;
+}
+
+static bool pipe_parser_seek_time(struct io_parser *parser,
+				  const struct io_seek_source *src,
+				  double seconds, unsigned long long *offset)
+{
+	struct pipe_parser_priv *priv = pipe_parser_priv(parser);
+
+	/* Queued input is from previous position of stream */
+	pipe_wait_idle(priv);
+	pipe_reset_work_buf(priv);
+	priv->failed = false;
+
+	return io_parser_seek_time(priv->child, src, seconds, offset);
+}
+
+static const struct io_parser_ops pipe_parser_ops = {
+	.name = "pipe",
+	.parse = pipe_parser_parse,
+	.wait_queue = pipe_parser_wait_queue,
+	.destroy = pipe_parser_destroy,
+	.reset = pipe_parser_reset,
+	.set_context = pipe_parser_set_context,
+	.get_child = pipe_parser_get_child,
+	.seek_time = pipe_parser_seek_time,
+};
+
+/**
+ * io_new_pipe_parser - allocate and initialize new pipe parser, running
+ *			@child in own thread
+ * @child: parser receiving input of pipe
+ * @queue_len: input buffers queued to @child before parent is stopped,
+ *	       zero for IO_PIPE_DEFAULT_QUEUE_LEN
+ */
+struct io_parser *io_new_pipe_parser(struct io_parser *child,
+				     unsigned int queue_len)
+{
+	struct pipe_parser_priv *priv;
+	int err;
+
+	if (!child)
+		return NULL;
+
+	if (queue_len == 0)
+		queue_len = IO_PIPE_DEFAULT_QUEUE_LEN;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		io_parser_destroy(child);
+		return NULL;
+	}
+
+	priv->child = child;
+	priv->queue_len = queue_len;
+	ds_append_buffer_init_sized(&priv->work_buf,
+				    DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	io_parser_init(&priv->parser, &pipe_parser_ops);
+
+	priv->queue = ds_spsc_queue_alloc(queue_len, sizeof(struct pipe_msg));
+	priv->event = ds_event_alloc();
+	if (!priv->queue || !priv->event) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		goto err;
+	}
+
+	err = pthread_create(&priv->thread, NULL, pipe_thread, priv);
+	if (err != 0) {
+		io_set_latest_error("%s():%d: could not create pipe thread "
+				    "(errno: %d)", __func__, __LINE__, err);
+		goto err;
+	}
+	priv->thread_running = true;
+
+	return &priv->parser;
+
+err:
+	pipe_parser_destroy(&priv->parser);
+	return NULL;
+}
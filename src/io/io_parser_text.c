@@ -23,15 +23,27 @@
  *
  */
 
+/* posix_madvise() */
+#define _POSIX_C_SOURCE 200112L
+
+#include <unistd.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "io.h"
 
 #define TEXT_PARSER_MAX_LINE_LEN 64
 
+/* Frames of 4ms fixed interval input gathered before passing to sink */
+#define TEXT_PARSER_BLOCK_FRAMES 128
+
 enum text_state {
 	CHECK_FIRST_LINES = 0,
 	CHECK_FIRST_LINES_IS_DELTAENCODED,
@@ -44,18 +56,25 @@ enum text_state {
 struct text_parser_priv {
 	struct io_parser parser;
 
+	/* context receiving parsed values */
+	struct io_context *ctx;
+
 	enum text_state state;
 	bool first_read;
 	bool delta_encoded;
 
-	/*
-	 * for interpolating variable input interval to 4ms.
-	 *
-	 * timekeeping requires 'double' because start_time might be large.
-	 */
-	double start_time, cur_time, prev_time;
-	unsigned long long int add_time_ms;
-	float cur_value,  prev_value;
+	/* previous input point, for delta-encoded input */
+	double prev_time;
+	float prev_value[IO_MAX_CHANNELS];
+
+	/* for converting input interval to output rate of context */
+	struct io_resampler resampler;
+	unsigned long long int fixed_index;
+	bool resample_fixed;
+
+	/* 4ms fixed interval frames not yet passed to sink */
+	unsigned int block_frames;
+	float block[TEXT_PARSER_BLOCK_FRAMES * IO_MAX_CHANNELS];
 };
 
 static inline struct text_parser_priv *
@@ -64,59 +83,470 @@ static inline struct text_parser_priv *
 	return ds_container_of(parser, struct text_parser_priv, parser);
 }
 
-static float interpolate(float prev_time, float next_time, float prev_value,
-			 float next_value, float cur_time)
+/*
+ * Locale independent number scanners, replacing sscanf() for input lines.
+ * Plain decimal numbers are converted with exact fast path, other forms
+ * (inf, nan, hex-floats, too many digits) fall back to strtod()/strtof().
+ */
+
+/* Powers of ten that are exact in double */
+static const double text_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define TEXT_MAX_MANTISSA_DIGITS 19
+
+struct text_decimal {
+	unsigned long long int mantissa;
+	int exponent;
+	bool negative;
+};
+
+static inline bool text_is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool text_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char *text_skip_space(const char *str)
 {
-	float value_len = (next_value - prev_value);
-	float time_len = (next_time - prev_time);
-	float cur_prev_len = (cur_time - prev_time);
+	while (text_is_space(*str))
+		str++;
 
-	return (cur_prev_len * value_len / time_len) + prev_value;
+	return str;
 }
 
-static void adjust_interval(struct text_parser_priv *priv, double second,
-			    float value)
+/**
+ * text_scan_decimal - scan plain decimal number in strtod() syntax
+ * @str: pointer to string, moved to end of number on success
+ * @dec: scanned number
+ *
+ * Returns false if there is no plain decimal number at @str or if it cannot
+ * be presented exactly in @dec.
+ */
+static bool text_scan_decimal(const char **str, struct text_decimal *dec)
 {
-	float cur_value;
+	const char *pos = *str, *exp_pos;
+	unsigned int digits = 0, num_digits = 0;
+	int exponent = 0, exp_value = 0;
+	bool exp_negative = false;
 
-	if (!priv->first_read) {		
-		priv->prev_value = value;
-		priv->prev_time = second;
-		priv->start_time = second;
-		priv->add_time_ms = 0;
-		priv->cur_time = priv->start_time + priv->add_time_ms / 1000.0;
+	dec->negative = false;
+	dec->mantissa = 0;
 
-		priv->first_read = true;
-		return;
+	if (*pos == '-' || *pos == '+')
+		dec->negative = (*pos++ == '-');
+
+	/* hex-float */
+	if (pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X'))
+		return false;
+
+	for (; text_is_digit(*pos); pos++, num_digits++) {
+		if (digits == 0 && *pos == '0')
+			continue;
+		if (++digits > TEXT_MAX_MANTISSA_DIGITS)
+			return false;
+		dec->mantissa = dec->mantissa * 10 + (*pos - '0');
 	}
 
-	if (priv->delta_encoded) {
-		second = priv->prev_time + second;
-		value = priv->prev_value + value;
+	if (*pos == '.') {
+		for (pos++; text_is_digit(*pos); pos++, num_digits++) {
+			exponent--;
+			if (digits == 0 && *pos == '0')
+				continue;
+			if (++digits > TEXT_MAX_MANTISSA_DIGITS)
+				return false;
+			dec->mantissa = dec->mantissa * 10 + (*pos - '0');
+		}
 	}
 
-	while (priv->cur_time <= second + 0.0001) {
-		cur_value = interpolate(priv->prev_time, second,
-					priv->prev_value, value,
-					priv->cur_time);
+	/* no digits, might be inf or nan */
+	if (num_digits == 0)
+		return false;
 
-		io_main_queue_push_4ms_interval_value(cur_value);
+	if (*pos == 'e' || *pos == 'E') {
+		exp_pos = pos + 1;
+		if (*exp_pos == '-' || *exp_pos == '+')
+			exp_negative = (*exp_pos++ == '-');
 
-		priv->add_time_ms += 4;
-		priv->cur_time = priv->start_time + priv->add_time_ms / 1000.0;
+		for (pos = exp_pos; text_is_digit(*pos); pos++) {
+			/* out of fast path range anyway */
+			if (exp_value < 10000)
+				exp_value = exp_value * 10 + (*pos - '0');
+		}
+		exponent += exp_negative ? -exp_value : exp_value;
 	}
 
-	priv->prev_time = second;
-	priv->prev_value = value;
+	dec->exponent = exponent;
+	*str = pos;
+	return true;
+}
+
+/**
+ * text_skip_exponent_mark - skip exponent mark left over by strtod()
+ *
+ * sscanf() consumes exponent mark and sign even when no exponent digits
+ * follow, strtod() does not.
+ */
+static const char *text_skip_exponent_mark(const char *start, const char *end)
+{
+	const char *pos = text_skip_space(start);
+	char mark = 'e';
+
+	if (*pos == '-' || *pos == '+')
+		pos++;
+
+	if (pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X'))
+		mark = 'p';
+	else if (!text_is_digit(*pos) && *pos != '.')
+		return end; /* inf or nan */
+
+	/* number already has exponent */
+	for (; pos < end; pos++)
+		if ((*pos | 0x20) == mark)
+			return end;
+
+	if ((*end | 0x20) == mark) {
+		end++;
+		if (*end == '-' || *end == '+')
+			end++;
+	}
+
+	return end;
+}
+
+/**
+ * text_scan_double - scan double like sscanf() with "%lf"
+ */
+static bool text_scan_double(const char **str, double *value)
+{
+	const char *start = text_skip_space(*str), *pos = start;
+	struct text_decimal dec;
+	double result;
+	char *end;
+
+	/* exact when mantissa and power of ten are exact doubles */
+	if (text_scan_decimal(&pos, &dec) &&
+	    dec.mantissa <= (1ULL << 53) &&
+	    dec.exponent >= -22 && dec.exponent <= 22) {
+		result = (double)dec.mantissa;
+		if (dec.exponent < 0)
+			result /= text_pow10[-dec.exponent];
+		else
+			result *= text_pow10[dec.exponent];
+
+		*value = dec.negative ? -result : result;
+		*str = pos;
+		return true;
+	}
+
+	*value = strtod(start, &end);
+	if (end == start)
+		return false;
+
+	*str = text_skip_exponent_mark(start, end);
+	return true;
+}
+
+/**
+ * text_scan_float - scan float like sscanf() with "%f"
+ */
+static bool text_scan_float(const char **str, float *value)
+{
+	const char *start = text_skip_space(*str), *pos = start;
+	struct text_decimal dec;
+	double result;
+	char *end;
+
+	/*
+	 * Mantissa and power of ten are exact floats, so result of division
+	 * or multiplication rounded to double and then to float is same as
+	 * correctly rounded float.
+	 */
+	if (text_scan_decimal(&pos, &dec) &&
+	    dec.mantissa <= (1ULL << 24) &&
+	    dec.exponent >= -10 && dec.exponent <= 10) {
+		result = (double)dec.mantissa;
+		if (dec.exponent < 0)
+			result /= text_pow10[-dec.exponent];
+		else
+			result *= text_pow10[dec.exponent];
+
+		*value = (float)(dec.negative ? -result : result);
+		*str = pos;
+		return true;
+	}
+
+	*value = strtof(start, &end);
+	if (end == start)
+		return false;
+
+	*str = text_skip_exponent_mark(start, end);
+	return true;
+}
+
+/**
+ * text_scan_int - scan integer like sscanf() with "%d"
+ */
+static bool text_scan_int(const char **str, int *value)
+{
+	const char *pos = text_skip_space(*str);
+	unsigned long int result = 0, limit;
+	bool negative = false;
+	long int lvalue;
+
+	if (*pos == '-' || *pos == '+')
+		negative = (*pos++ == '-');
+
+	if (!text_is_digit(*pos))
+		return false;
+
+	/* saturate to long range like strtol() does for sscanf() */
+	limit = negative ? (unsigned long int)LONG_MAX + 1 : LONG_MAX;
+	for (; text_is_digit(*pos); pos++) {
+		if (result > (limit - (*pos - '0')) / 10)
+			result = limit;
+		else
+			result = result * 10 + (*pos - '0');
+	}
+
+	if (negative)
+		lvalue = result > LONG_MAX ? LONG_MIN : -(long int)result;
+	else
+		lvalue = result;
+
+	*value = (int)lvalue;
+	*str = pos;
+	return true;
+}
+
+/**
+ * text_scan_columns - scan additional value columns of line
+ * @line: rest of line after first value column
+ * @values: values of columns, missing columns are set to zero
+ * @num_values: number of columns to scan
+ */
+static void text_scan_columns(const char *line, float *values,
+			      unsigned int num_values)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_values; i++) {
+		if (!text_scan_float(&line, &values[i]))
+			break;
+	}
+
+	for (; i < num_values; i++)
+		values[i] = 0.0f;
+}
+
+/**
+ * text_scan_date_line - scan line like sscanf() with "%d:%lf %f", with
+ *			 @num_values value columns
+ *
+ * Returns number of scanned values, counting only first value column.
+ */
+static int text_scan_date_line(const char *line, int *minute, double *second,
+			       float *values, unsigned int num_values)
+{
+	if (!text_scan_int(&line, minute))
+		return 0;
+	if (*line++ != ':')
+		return 1;
+	if (!text_scan_double(&line, second))
+		return 1;
+	if (!text_scan_float(&line, &values[0]))
+		return 2;
+
+	text_scan_columns(line, values + 1, num_values - 1);
+	return 3;
+}
+
+/**
+ * text_scan_interval_line - scan line like sscanf() with "%lf %f", with
+ *			     @num_values value columns
+ *
+ * Returns number of scanned values, counting only first value column.
+ */
+static int text_scan_interval_line(const char *line, double *second,
+				   float *values, unsigned int num_values)
+{
+	if (!text_scan_double(&line, second))
+		return 0;
+	if (!text_scan_float(&line, &values[0]))
+		return 1;
+
+	text_scan_columns(line, values + 1, num_values - 1);
+	return 2;
+}
+
+/**
+ * text_scan_value_line - scan line like sscanf() with "%f", with @num_values
+ *			  value columns
+ *
+ * Returns number of scanned values, counting only first value column.
+ */
+static int text_scan_value_line(const char *line, float *values,
+				unsigned int num_values)
+{
+	if (!text_scan_float(&line, &values[0]))
+		return 0;
+
+	text_scan_columns(line, values + 1, num_values - 1);
+	return 1;
+}
+
+/**
+ * text_detect_line - detect file type from first value line
+ *
+ * Returns state handling lines of detected type, or DETECT_FILE_TYPE if
+ * @line is not value line.
+ */
+static enum text_state text_detect_line(const char *line)
+{
+	double second;
+	float value;
+	int minute;
+	int num;
+
+	if (text_scan_date_line(line, &minute, &second, &value, 1) == 3)
+		return HANDLE_DATE_INTERVAL_FILE;
+
+	num = text_scan_interval_line(line, &second, &value, 1);
+	if (num == 2)
+		return HANDLE_FLOAT_INTERVAL_FILE;
+	if (num == 1)
+		return HANDLE_4MS_FIXED_INTERVAL_FILE;
+
+	return DETECT_FILE_TYPE;
+}
+
+/**
+ * text_scan_point - scan value line of file type handled by @state
+ * @state: one of HANDLE_*_FILE states
+ * @line: input line
+ * @second: time of point in seconds, not used for 4ms fixed interval files
+ * @values: @num_values values of point
+ * @num_values: number of value columns
+ *
+ * Returns false if line is not of file type, i.e. input stream has ended.
+ */
+static bool text_scan_point(enum text_state state, const char *line,
+			    double *second, float *values,
+			    unsigned int num_values)
+{
+	int minute;
+
+	switch (state) {
+	case HANDLE_DATE_INTERVAL_FILE:
+		if (text_scan_date_line(line, &minute, second, values,
+					num_values) != 3)
+			return false;
+
+		*second = *second + 60.0 * minute;
+		return true;
+
+	case HANDLE_FLOAT_INTERVAL_FILE:
+		return text_scan_interval_line(line, second, values,
+					       num_values) == 2;
+
+	case HANDLE_4MS_FIXED_INTERVAL_FILE:
+		return text_scan_value_line(line, values, num_values) == 1;
+
+	default:
+		return false;
+	}
+}
+
+static void text_resampler_emit(void *opaque, const float *frames,
+				unsigned int num_frames)
+{
+	struct text_parser_priv *priv = opaque;
+	struct io_resampler *rs = &priv->resampler;
+
+	io_parser_emit_block(&priv->parser, frames, num_frames,
+			     (rs->next_out - num_frames) * rs->interval);
+}
+
+/* Pass gathered 4ms fixed interval frames to sink */
+static void text_flush_block(struct text_parser_priv *priv)
+{
+	unsigned int num = priv->block_frames;
+
+	if (num == 0)
+		return;
+
+	priv->block_frames = 0;
+	io_parser_emit_block(&priv->parser, priv->block, num,
+			     (priv->fixed_index - num) * 0.004);
+}
+
+static void text_push_fixed_frame(struct text_parser_priv *priv,
+				  const float *values, unsigned int channels)
+{
+	memcpy(&priv->block[priv->block_frames * channels], values,
+	       channels * sizeof(*values));
+	priv->fixed_index++;
+
+	if (++priv->block_frames == TEXT_PARSER_BLOCK_FRAMES)
+		text_flush_block(priv);
+}
+
+/* First value line of input stream, set up resampling to context rate */
+static void text_start_stream(struct text_parser_priv *priv,
+			      unsigned int num_values)
+{
+	enum io_resample_kernel kernel;
+	unsigned int rate;
+
+	rate = io_context_get_sample_rate(priv->ctx, &kernel);
+	io_resampler_init(&priv->resampler, rate, kernel, num_values,
+			  text_resampler_emit, priv);
+
+	/* 4ms fixed interval input is passed as such at default rate */
+	priv->resample_fixed = rate != IO_DEFAULT_SAMPLE_RATE;
+	priv->fixed_index = 0;
+	priv->block_frames = 0;
+
+	priv->first_read = true;
+}
+
+/* Input stream ended or restarted, emit all remaining values */
+static void text_end_stream(struct text_parser_priv *priv)
+{
+	if (!priv->first_read)
+		return;
+
+	text_flush_block(priv);
+	io_resampler_flush(&priv->resampler, true);
 }
 
+static void adjust_interval(struct text_parser_priv *priv, double second,
+			    float *values, unsigned int num_values)
+{
+	if (!priv->first_read) {
+		text_start_stream(priv, num_values);
+	} else if (priv->delta_encoded) {
+		second = priv->prev_time + second;
+		io_delta_decode(values, 1, num_values, priv->prev_value);
+	}
+
+	io_resampler_push(&priv->resampler, second, values);
+
+	priv->prev_time = second;
+	memcpy(priv->prev_value, values, num_values * sizeof(*values));
+}
 static enum io_parser_ret text_parser_handle_line(struct text_parser_priv *priv,
 						  char *line, bool final)
 {
-	float value;
+	unsigned int channels = io_context_get_channels(priv->ctx);
+	float values[IO_MAX_CHANNELS];
 	double second;
-	int minute;
-	int num = 0;
 	bool first_line = false;
 
 new_state:
@@ -130,22 +560,9 @@ new_state:
 		priv->first_read = false;
 		/* fall-through */
 	case DETECT_FILE_TYPE:
-		num = sscanf(line, "%d:%lf %f", &minute, &second, &value);
-		if (num == 3) {
-			priv->state = HANDLE_DATE_INTERVAL_FILE;
-			goto new_state;
-		}
-
-		num = sscanf(line, "%lf %f", &second, &value);
-		if (num == 2) {
-			priv->state = HANDLE_FLOAT_INTERVAL_FILE;
+		priv->state = text_detect_line(line);
+		if (priv->state != DETECT_FILE_TYPE)
 			goto new_state;
-		}
-
-		if (num == 1) {
-			priv->state = HANDLE_4MS_FIXED_INTERVAL_FILE;
-			goto new_state;
-		}
 
 		/* Ignore invalid first lines */
 		if (first_line) {
@@ -162,27 +579,15 @@ new_state:
 		return IO_PARSER_RET_ERROR;
 
 	case HANDLE_DATE_INTERVAL_FILE:
-		num = sscanf(line, "%d:%lf %f", &minute, &second, &value);
-		if (num == 3) {
-			adjust_interval(priv, second + 60.0 * minute, value);
-		} else {
-			/* 
-			 * restarted reading file from begining, need to reset.
-			 */
-			priv->state = CHECK_FIRST_LINES;
-			goto new_state;
-		}
-
-		break;
-
 	case HANDLE_FLOAT_INTERVAL_FILE:
-		num = sscanf(line, "%lf %f", &second, &value);
-		if (num == 2) {
-			adjust_interval(priv, second, value);
+		if (text_scan_point(priv->state, line, &second, values,
+				    channels)) {
+			adjust_interval(priv, second, values, channels);
 		} else {
 			/*
 			 * restarted reading file from begining, need to reset.
 			 */
+			text_end_stream(priv);
 			priv->state = CHECK_FIRST_LINES;
 			goto new_state;
 		}
@@ -190,23 +595,28 @@ new_state:
 		break;
 
 	case HANDLE_4MS_FIXED_INTERVAL_FILE:
-		num = sscanf(line, "%f", &value);
-		if (num == 1) {
+		if (text_scan_point(priv->state, line, NULL, values, channels)) {
 			if (!priv->first_read) {
-				priv->prev_value = 0.0f;
-				priv->first_read = true;
+				memset(priv->prev_value, 0,
+				       sizeof(priv->prev_value));
+				text_start_stream(priv, channels);
 			}
 
-			if (priv->delta_encoded) {
-				value += priv->prev_value;
-				priv->prev_value = value;
-			}
+			if (priv->delta_encoded)
+				io_delta_decode(values, 1, channels,
+						priv->prev_value);
 
-			io_main_queue_push_4ms_interval_value(value);
+			if (priv->resample_fixed)
+				io_resampler_push(&priv->resampler,
+						  priv->fixed_index++ * 0.004,
+						  values);
+			else
+				text_push_fixed_frame(priv, values, channels);
 		} else {
 			/*
 			 * restarted reading file from begining, need to reset.
 			 */
+			text_end_stream(priv);
 			priv->state = CHECK_FIRST_LINES;
 			goto new_state;
 		}
@@ -217,90 +627,873 @@ new_state:
 	return IO_PARSER_RET_CONTINUE;
 }
 
-static enum io_parser_ret text_parser_parse(struct io_parser *parser,
-					    struct ds_append_buffer *buffer,
-					    bool final)
-{
-	struct text_parser_priv *priv = text_parser_priv(parser);
-	struct ds_append_buffer_iterator iter;
-	char buf[TEXT_PARSER_MAX_LINE_LEN];
-	enum io_parser_ret eret;
-	unsigned int llen, clen;
-
-restart:
-	ds_append_buffer_for_each(&iter, buffer) {
-		/* Find end of line */
-		if (ds_append_buffer_iterator_byte(&iter) == '\n') {
-			llen = ds_append_buffer_iterator_pos(&iter) + 1;
-			clen = llen >= sizeof(buf) ? sizeof(buf) : llen;
-
-			/* copy line to temporary buffer */
-			ds_append_buffer_copy(buffer, 0, buf, clen);
-
-			/* null terminate string */
-			buf[clen - 1] = 0;
-
-			/* move buffer head forward */
-			ds_append_buffer_move_head(buffer, llen);
+/*
+ * Newline search over contiguous data. With SIMD, newlines of whole block
+ * are found at once and returned from bit-mask, otherwise memchr() is used.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TEXT_BLOCK_LEN 32
+#define TEXT_MASK_BITS 1
 
-			/* handle new line */
-			eret = text_parser_handle_line(priv, buf, false);
-			if (eret != IO_PARSER_RET_CONTINUE)
-				return eret;
+static inline unsigned long long int text_newline_mask(const char *data)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)data);
 
-			goto restart;
-		}
-	}
+	return (unsigned int)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXT_BLOCK_LEN 16
+#define TEXT_MASK_BITS 1
 
-	if (final) {
-		llen = ds_append_buffer_length(buffer) + 1;
-		clen = llen >= sizeof(buf) ? sizeof(buf) : llen;
+static inline unsigned long long int text_newline_mask(const char *data)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)data);
 
-		/* copy line to temporary buffer */
-		ds_append_buffer_copy(buffer, 0, buf, clen - 1);
-		buf[clen - 1] = '\0';
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TEXT_BLOCK_LEN 16
+#define TEXT_MASK_BITS 4
 
-		/* handle new line */
-		return text_parser_handle_line(priv, buf, final);
-	}
+static inline unsigned long long int text_newline_mask(const char *data)
+{
+	uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)data),
+				 vdupq_n_u8('\n'));
+	uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
 
-	return IO_PARSER_RET_CONTINUE;
+	/* four mask bits per byte */
+	return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
 }
+#else
+#define TEXT_BLOCK_LEN UINT_MAX
+#define TEXT_MASK_BITS 1
 
-static bool text_parser_wait_queue(struct io_parser *parser)
+static inline unsigned long long int text_newline_mask(const char *data)
 {
-	return true;
+	return 0;
 }
+#endif
 
-static bool text_parser_destroy(struct io_parser *parser)
+struct text_newline_scan {
+	const char *data;
+	unsigned int len;
+	unsigned int next;	/* start of next unscanned data */
+	unsigned int block;	/* start of block in mask */
+	unsigned long long int mask;
+};
+
+static inline void text_newline_scan_init(struct text_newline_scan *scan,
+					  const char *data, unsigned int len)
 {
-	free(parser);
-	return true;
+	scan->data = data;
+	scan->len = len;
+	scan->next = 0;
+	scan->block = 0;
+	scan->mask = 0;
 }
 
-static bool text_parser_reset(struct io_parser *parser)
+/**
+ * text_next_newline - find next newline in data of @scan
+ * @scan: scan state
+ * @pos: offset of newline is stored here
+ *
+ * Returns false if there is no more newlines.
+ */
+static inline bool text_next_newline(struct text_newline_scan *scan,
+				     unsigned int *pos)
 {
-	struct text_parser_priv *priv = text_parser_priv(parser);
+	const char *nl;
+	unsigned int bit;
 
-	priv->state = CHECK_FIRST_LINES;
-	priv->first_read = false;
+	while (scan->mask == 0) {
+		if (scan->len - scan->next < TEXT_BLOCK_LEN) {
+			/* tail shorter than block */
+			nl = memchr(scan->data + scan->next, '\n',
+				    scan->len - scan->next);
+			if (!nl) {
+				scan->next = scan->len;
+				return false;
+			}
 
+			*pos = nl - scan->data;
+			scan->next = *pos + 1;
+			return true;
+		}
+
+		scan->block = scan->next;
+		scan->mask = text_newline_mask(scan->data + scan->block);
+		scan->next += TEXT_BLOCK_LEN;
+	}
+
+	bit = __builtin_ctzll(scan->mask) & ~(TEXT_MASK_BITS - 1);
+	scan->mask &= ~(((1ULL << TEXT_MASK_BITS) - 1) << bit);
+
+	*pos = scan->block + bit / TEXT_MASK_BITS;
 	return true;
 }
 
-static const struct io_parser_ops text_parser_ops = {
-	.parse = text_parser_parse,
-	.wait_queue = text_parser_wait_queue,
-	.destroy = text_parser_destroy,
-	.reset = text_parser_reset,
-};
-
 /**
- * io_new_text_parser - allocate and initialize new EGC text parser
+ * text_find_line_end - find position of first newline in buffer
+ * @buffer: input buffer
+ * @pos: position of newline is stored here
+ *
+ * Returns false if buffer does not contain full line.
  */
-struct io_parser *io_new_text_parser(void)
+static bool text_find_line_end(struct ds_append_buffer *buffer,
+			       unsigned int *pos)
 {
-	struct text_parser_priv *priv;
+	struct ds_append_buffer_iterator iter;
+	unsigned char *span, *nl;
+	unsigned int len;
+
+	/* Scan buffer one piece at time */
+	ds_append_buffer_for_each_span(&iter, buffer, span, len) {
+		nl = memchr(span, '\n', len);
+		if (nl) {
+			*pos = ds_append_buffer_iterator_pos(&iter) +
+			       (nl - span);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static enum io_parser_ret __text_parser_parse(struct text_parser_priv *priv,
+					      struct ds_append_buffer *buffer,
+					      bool final)
+{
+	enum io_parser_ret eret = IO_PARSER_RET_CONTINUE;
+	struct ds_append_buffer_iterator iter;
+	struct text_newline_scan scan;
+	char buf[TEXT_PARSER_MAX_LINE_LEN];
+	unsigned int llen, clen, start, nl, span_len;
+	const char *span;
+
+	while (true) {
+		ds_append_buffer_iterator_init(buffer, &iter);
+		if (ds_append_buffer_iterator_has_reached_end(&iter))
+			break;
+
+		/*
+		 * Handle all complete lines in first piece directly from
+		 * piece, then move buffer head forward once.
+		 */
+		span = ds_append_buffer_iterator_span(&iter, &span_len);
+		text_newline_scan_init(&scan, span, span_len);
+		start = 0;
+
+		while (eret == IO_PARSER_RET_CONTINUE &&
+		       text_next_newline(&scan, &nl)) {
+			llen = nl - start;
+			clen = llen < sizeof(buf) ? llen : sizeof(buf) - 1;
+
+			/* copy line to temporary buffer, null terminated */
+			memcpy(buf, span + start, clen);
+			buf[clen] = 0;
+			start = nl + 1;
+
+			/* handle new line */
+			eret = text_parser_handle_line(priv, buf, false);
+
+			/* Leave rest of input in buffer until queue has room */
+			if (eret == IO_PARSER_RET_CONTINUE &&
+			    io_context_queue_is_full(priv->ctx))
+				eret = IO_PARSER_RET_QUEUE_FULL;
+		}
+
+		if (start > 0) {
+			ds_append_buffer_move_head(buffer, start);
+			if (eret != IO_PARSER_RET_CONTINUE)
+				return eret;
+			continue;
+		}
+
+		/* Line continues over end of first piece */
+		if (!text_find_line_end(buffer, &llen))
+			break;
+
+		llen++;
+		clen = llen >= sizeof(buf) ? sizeof(buf) : llen;
+
+		/* copy line to temporary buffer */
+		ds_append_buffer_copy(buffer, 0, buf, clen);
+
+		/* null terminate string */
+		buf[clen - 1] = 0;
+
+		/* move buffer head forward */
+		ds_append_buffer_move_head(buffer, llen);
+
+		/* handle new line */
+		eret = text_parser_handle_line(priv, buf, false);
+		if (eret != IO_PARSER_RET_CONTINUE)
+			return eret;
+
+		/* Leave rest of input in buffer until queue has room */
+		if (io_context_queue_is_full(priv->ctx))
+			return IO_PARSER_RET_QUEUE_FULL;
+	}
+
+	if (final) {
+		llen = ds_append_buffer_length(buffer) + 1;
+		clen = llen >= sizeof(buf) ? sizeof(buf) : llen;
+
+		/* copy line to temporary buffer */
+		ds_append_buffer_copy(buffer, 0, buf, clen - 1);
+		buf[clen - 1] = '\0';
+
+		/* last line is handled, do not leave it for next call */
+		ds_append_buffer_move_head(buffer, llen - 1);
+
+		/* handle new line */
+		return text_parser_handle_line(priv, buf, final);
+	}
+
+	return IO_PARSER_RET_CONTINUE;
+}
+
+static bool text_parser_wait_queue(struct io_parser *parser)
+{
+	struct text_parser_priv *priv = text_parser_priv(parser);
+
+	return io_context_queue_wait_free(priv->ctx);
+}
+
+static bool text_parser_destroy(struct io_parser *parser)
+{
+	free(parser);
+	return true;
+}
+
+static enum io_parser_ret text_parser_parse(struct io_parser *parser,
+					    struct ds_append_buffer *buffer,
+					    bool final)
+{
+	struct text_parser_priv *priv = text_parser_priv(parser);
+	enum io_parser_ret eret;
+
+	eret = __text_parser_parse(priv, buffer, final);
+
+	/* Pass frames and resample input points buffered by this call */
+	if (priv->first_read) {
+		text_flush_block(priv);
+		io_resampler_flush(&priv->resampler, final);
+	}
+
+	return eret;
+}
+
+static bool text_parser_reset(struct io_parser *parser)
+{
+	struct text_parser_priv *priv = text_parser_priv(parser);
+
+	priv->state = CHECK_FIRST_LINES;
+	priv->first_read = false;
+	priv->block_frames = 0;
+
+	return true;
+}
+
+static void text_parser_set_context(struct io_parser *parser,
+				    struct io_context *ctx)
+{
+	struct text_parser_priv *priv = text_parser_priv(parser);
+
+	priv->ctx = io_parser_get_context(parser);
+}
+
+/*
+ * Seeking. Stream is scanned through random access source without emitting
+ * values. Header lines and first point are read from start of stream, then
+ * line where output continues is searched: timestamps of interval files are
+ * binary searched and line of 4ms fixed interval files is counted. State at
+ * line of delta-encoded file depends on all previous lines, so these are
+ * summed line by line, still without resampling.
+ */
+
+/* Bytes read from seek source at once */
+#define TEXT_SEEK_READ_LEN (64 * 1024)
+
+/* Bytes read at once when looking for line boundary around offset */
+#define TEXT_SEEK_PROBE_LEN 256
+
+/* Non-value lines allowed before first value line */
+#define TEXT_SEEK_MAX_HEADER_LINES 1024
+
+/* Points kept while summing delta-encoded lines, resampler history + 3 */
+#define TEXT_SEEK_RING_POINTS 4
+
+struct text_seek_reader {
+	const struct io_seek_source *src;
+	unsigned long long pos;	/* stream offset of buf[0] */
+	unsigned int len;
+	unsigned int next;	/* start of next unread line in buf */
+	bool eof;
+	char buf[TEXT_SEEK_READ_LEN];
+};
+
+/* First value line of stream and file type */
+struct text_seek_stream {
+	enum text_state state;
+	bool delta_encoded;
+	unsigned long long data_start;
+	unsigned long long data_line;
+	double start_time;
+};
+
+struct text_seek_point {
+	unsigned long long offset;
+	double time;
+	float values[IO_MAX_CHANNELS];
+};
+
+static void text_seek_reader_init(struct text_seek_reader *rd,
+				  const struct io_seek_source *src,
+				  unsigned long long offset)
+{
+	rd->src = src;
+	rd->pos = offset;
+	rd->len = 0;
+	rd->next = 0;
+	rd->eof = offset >= src->length;
+}
+
+static inline unsigned long long
+		text_seek_reader_offset(const struct text_seek_reader *rd)
+{
+	return rd->pos + rd->next;
+}
+
+/* Move unread data to start of buffer and read more after it */
+static bool text_seek_reader_fill(struct text_seek_reader *rd)
+{
+	int ret;
+
+	rd->pos += rd->next;
+	rd->len -= rd->next;
+	memmove(rd->buf, rd->buf + rd->next, rd->len);
+	rd->next = 0;
+
+	ret = rd->src->read(rd->src, rd->pos + rd->len, rd->buf + rd->len,
+			    sizeof(rd->buf) - rd->len);
+	if (ret < 0)
+		return false;
+
+	rd->len += ret;
+	rd->eof = ret == 0 || rd->pos + rd->len >= rd->src->length;
+
+	return true;
+}
+
+/**
+ * text_seek_next_line - read next line, truncated and null terminated like
+ *			 lines passed to text_parser_handle_line()
+ *
+ * Returns 1 on new line, 0 at end of stream and -1 on error.
+ */
+static int text_seek_next_line(struct text_seek_reader *rd, char *line)
+{
+	unsigned int llen, clen, skip = 1;
+	const char *nl;
+
+	while (true) {
+		nl = memchr(rd->buf + rd->next, '\n', rd->len - rd->next);
+		if (nl) {
+			llen = nl - (rd->buf + rd->next);
+			break;
+		}
+
+		if (rd->eof) {
+			/* last line without newline */
+			if (rd->next == rd->len)
+				return 0;
+			llen = rd->len - rd->next;
+			skip = 0;
+			break;
+		}
+
+		if (rd->next == 0 && rd->len == sizeof(rd->buf)) {
+			io_set_latest_error("%s():%d: too long line at offset "
+					    "%llu", __func__, __LINE__,
+					    rd->pos);
+			return -1;
+		}
+
+		if (!text_seek_reader_fill(rd))
+			return -1;
+	}
+
+	clen = llen < TEXT_PARSER_MAX_LINE_LEN ? llen :
+						 TEXT_PARSER_MAX_LINE_LEN - 1;
+	memcpy(line, rd->buf + rd->next, clen);
+	line[clen] = 0;
+	rd->next += llen + skip;
+
+	return 1;
+}
+
+/**
+ * text_seek_skip_lines - skip @count lines
+ * @rd: reader
+ * @count: number of lines to skip
+ * @skipped: number of skipped lines, less than @count at end of stream
+ */
+static bool text_seek_skip_lines(struct text_seek_reader *rd,
+				 unsigned long long count,
+				 unsigned long long *skipped)
+{
+	struct text_newline_scan scan;
+	unsigned int nl = 0;
+
+	*skipped = 0;
+
+	while (*skipped < count) {
+		text_newline_scan_init(&scan, rd->buf + rd->next,
+				       rd->len - rd->next);
+		while (*skipped < count && text_next_newline(&scan, &nl))
+			(*skipped)++;
+
+		if (*skipped == count) {
+			rd->next += nl + 1;
+			break;
+		}
+
+		rd->next = rd->len;
+		if (rd->eof)
+			break;
+		if (!text_seek_reader_fill(rd))
+			return false;
+	}
+
+	return true;
+}
+
+/* Read header lines and first point, like text_parser_handle_line() */
+static bool text_seek_header(struct text_seek_reader *rd,
+			     struct text_seek_stream *st, unsigned int channels)
+{
+	char line[TEXT_PARSER_MAX_LINE_LEN];
+	enum text_state state = CHECK_FIRST_LINES;
+	float values[IO_MAX_CHANNELS];
+	unsigned long long offset;
+	int ret;
+
+	st->data_line = 0;
+	st->delta_encoded = false;
+
+	while (true) {
+		offset = text_seek_reader_offset(rd);
+		ret = text_seek_next_line(rd, line);
+		if (ret < 0)
+			return false;
+		if (ret == 0 || st->data_line == TEXT_SEEK_MAX_HEADER_LINES) {
+			io_set_latest_error("%s():%d: no value lines in input",
+					    __func__, __LINE__);
+			return false;
+		}
+
+		if (state == CHECK_FIRST_LINES)
+			st->delta_encoded = false;
+
+		st->state = text_detect_line(line);
+		if (st->state != DETECT_FILE_TYPE)
+			break;
+
+		if (strcmp(line, "#deltaenc") == 0) {
+			state = CHECK_FIRST_LINES_IS_DELTAENCODED;
+			st->delta_encoded = true;
+		} else {
+			state = CHECK_FIRST_LINES;
+		}
+
+		st->data_line++;
+	}
+
+	st->data_start = offset;
+	st->start_time = 0.0;
+	if (st->state != HANDLE_4MS_FIXED_INTERVAL_FILE)
+		text_scan_point(st->state, line, &st->start_time, values,
+				channels);
+
+	return true;
+}
+
+/**
+ * text_seek_line_at - find start of first line at or after @offset
+ *
+ * Returns false on error, @line_start is set to length of stream if there is
+ * no such line.
+ */
+static bool text_seek_line_at(const struct io_seek_source *src,
+			      const struct text_seek_stream *st,
+			      unsigned long long offset,
+			      unsigned long long *line_start)
+{
+	char buf[TEXT_SEEK_PROBE_LEN];
+	const char *nl;
+	int ret;
+
+	if (offset <= st->data_start) {
+		*line_start = st->data_start;
+		return true;
+	}
+
+	/* line starts after previous newline */
+	for (offset--; offset < src->length; offset += ret) {
+		ret = src->read(src, offset, buf, sizeof(buf));
+		if (ret < 0)
+			return false;
+		if (ret == 0)
+			break;
+
+		nl = memchr(buf, '\n', ret);
+		if (nl) {
+			*line_start = offset + (nl - buf) + 1;
+			return true;
+		}
+	}
+
+	*line_start = src->length;
+	return true;
+}
+
+/* Find start of line before line starting at @line_start */
+static bool text_seek_prev_line(const struct io_seek_source *src,
+				const struct text_seek_stream *st,
+				unsigned long long *line_start)
+{
+	char buf[TEXT_SEEK_PROBE_LEN];
+	unsigned long long end, start;
+	unsigned int len;
+	int ret;
+
+	if (*line_start <= st->data_start)
+		return true;
+
+	/* skip newline ending previous line */
+	for (end = *line_start - 1; end > st->data_start; end = start) {
+		start = end > st->data_start + sizeof(buf) ?
+			end - sizeof(buf) : st->data_start;
+		len = end - start;
+
+		ret = src->read(src, start, buf, len);
+		if (ret < (int)len) {
+			if (ret >= 0)
+				io_set_latest_error("%s():%d: short read",
+						    __func__, __LINE__);
+			return false;
+		}
+
+		while (len > 0) {
+			if (buf[--len] == '\n') {
+				*line_start = start + len + 1;
+				return true;
+			}
+		}
+	}
+
+	*line_start = st->data_start;
+	return true;
+}
+
+/**
+ * text_seek_probe - check if first line starting at or after @offset is
+ *		     needed after seek, i.e. is not before output frame of
+ *		     resampler
+ * @line_start: start of line is stored here
+ *
+ * Returns 1 if line is needed or stream ends, 0 if line is before, and -1 on
+ * error.
+ */
+static int text_seek_probe(struct text_parser_priv *priv,
+			   const struct io_seek_source *src,
+			   const struct text_seek_stream *st,
+			   unsigned long long offset,
+			   unsigned long long *line_start)
+{
+	unsigned int channels = io_context_get_channels(priv->ctx);
+	char line[TEXT_PARSER_MAX_LINE_LEN];
+	float values[IO_MAX_CHANNELS];
+	double second;
+	char *nl;
+	int ret;
+
+	if (!text_seek_line_at(src, st, offset, line_start))
+		return -1;
+	if (*line_start >= src->length)
+		return 1;
+
+	ret = src->read(src, *line_start, line, sizeof(line) - 1);
+	if (ret < 0)
+		return -1;
+	line[ret] = 0;
+	nl = strchr(line, '\n');
+	if (nl)
+		*nl = 0;
+
+	/* line not of file type ends stream */
+	if (!text_scan_point(st->state, line, &second, values, channels))
+		return 1;
+
+	return !io_resampler_is_before(&priv->resampler, second);
+}
+
+/* Binary search of timestamps, from first line needed by resampler */
+static bool text_seek_search(struct text_parser_priv *priv,
+			     const struct io_seek_source *src,
+			     const struct text_seek_stream *st,
+			     unsigned long long *offset)
+{
+	unsigned long long lo = st->data_start, hi = src->length, mid;
+	unsigned long long line_start;
+	unsigned int i;
+	int ret;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		ret = text_seek_probe(priv, src, st, mid, &line_start);
+		if (ret < 0)
+			return false;
+		if (ret)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	if (text_seek_probe(priv, src, st, lo, &line_start) < 0)
+		return false;
+
+	if (line_start >= src->length) {
+		*offset = src->length;
+		return true;
+	}
+
+	/* last point before output, and kernel history before it */
+	for (i = 0; i < 1 + io_resampler_history(&priv->resampler); i++) {
+		if (!text_seek_prev_line(src, st, &line_start))
+			return false;
+	}
+
+	*offset = line_start;
+	return true;
+}
+
+/* Sum delta-encoded interval lines until first line needed by resampler */
+static bool text_seek_scan_delta(struct text_parser_priv *priv,
+				 struct text_seek_reader *rd,
+				 const struct text_seek_stream *st,
+				 unsigned long long *offset)
+{
+	unsigned int channels = io_context_get_channels(priv->ctx);
+	unsigned int keep = 1 + io_resampler_history(&priv->resampler);
+	struct text_seek_point ring[TEXT_SEEK_RING_POINTS], *pt, *prev;
+	char line[TEXT_PARSER_MAX_LINE_LEN];
+	float sum[IO_MAX_CHANNELS];
+	unsigned long long i, start;
+	int ret;
+
+	text_seek_reader_init(rd, rd->src, st->data_start);
+
+	for (i = 0; ; i++) {
+		pt = &ring[i % TEXT_SEEK_RING_POINTS];
+		pt->offset = text_seek_reader_offset(rd);
+
+		ret = text_seek_next_line(rd, line);
+		if (ret < 0)
+			return false;
+		if (ret == 0 || !text_scan_point(st->state, line, &pt->time,
+						 pt->values, channels)) {
+			*offset = rd->src->length;
+			return true;
+		}
+
+		/* first point is absolute */
+		if (i > 0) {
+			prev = &ring[(i - 1) % TEXT_SEEK_RING_POINTS];
+			memcpy(sum, prev->values, channels * sizeof(*sum));
+			pt->time += prev->time;
+			io_delta_decode(pt->values, 1, channels, sum);
+		}
+
+		if (!io_resampler_is_before(&priv->resampler, pt->time))
+			break;
+	}
+
+	/* point @i is needed, continue from kernel history before it */
+	start = i > keep ? i - keep : 0;
+	*offset = ring[start % TEXT_SEEK_RING_POINTS].offset;
+	if (start > 0) {
+		prev = &ring[(start - 1) % TEXT_SEEK_RING_POINTS];
+		priv->prev_time = prev->time;
+		memcpy(priv->prev_value, prev->values,
+		       channels * sizeof(*prev->values));
+	}
+
+	return true;
+}
+
+/**
+ * text_seek_fixed - find line @line of 4ms fixed interval file
+ *
+ * Values of delta-encoded file are summed up to line, otherwise lines are
+ * only counted.
+ */
+static bool text_seek_fixed(struct text_parser_priv *priv,
+			    struct text_seek_reader *rd,
+			    const struct text_seek_stream *st,
+			    unsigned long long line, unsigned long long *offset)
+{
+	unsigned int channels = io_context_get_channels(priv->ctx);
+	unsigned long long i, start = st->data_start, start_line = 0, skipped;
+	char buf[TEXT_PARSER_MAX_LINE_LEN];
+	float values[IO_MAX_CHANNELS];
+	int ret;
+
+	if (st->delta_encoded) {
+		text_seek_reader_init(rd, rd->src, st->data_start);
+
+		for (i = 0; i < line; i++) {
+			ret = text_seek_next_line(rd, buf);
+			if (ret < 0)
+				return false;
+			if (ret == 0 || !text_scan_point(st->state, buf, NULL,
+							 values, channels)) {
+				*offset = rd->src->length;
+				return true;
+			}
+
+			io_delta_decode(values, 1, channels, priv->prev_value);
+		}
+
+		*offset = text_seek_reader_offset(rd);
+		return true;
+	}
+
+	/* count lines from closest known line start */
+	if (rd->src->find_line &&
+	    !rd->src->find_line(rd->src, st->data_line + line, &start,
+				&start_line))
+		return false;
+
+	if (start_line > st->data_line && start > st->data_start) {
+		start_line -= st->data_line;
+	} else {
+		start = st->data_start;
+		start_line = 0;
+	}
+
+	text_seek_reader_init(rd, rd->src, start);
+	if (!text_seek_skip_lines(rd, line - start_line, &skipped))
+		return false;
+
+	*offset = skipped < line - start_line ? rd->src->length :
+						text_seek_reader_offset(rd);
+	return true;
+}
+
+/* Point of 4ms fixed interval file from where resampler continues */
+static unsigned long long text_seek_fixed_point(struct text_parser_priv *priv,
+						unsigned long long frame,
+						unsigned int rate)
+{
+	struct io_resampler *rs = &priv->resampler;
+	unsigned long long point, history = io_resampler_history(rs);
+
+	/* points are at times of text_parser_handle_line() */
+	if (!io_resampler_is_before(rs, 0.0))
+		return 0;
+
+	point = frame * IO_DEFAULT_SAMPLE_RATE / rate;
+	while (point > 0 && !io_resampler_is_before(rs, point * 0.004))
+		point--;
+	while (io_resampler_is_before(rs, (point + 1) * 0.004))
+		point++;
+
+	return point > history ? point - history : 0;
+}
+
+static bool text_parser_seek_time(struct io_parser *parser,
+				  const struct io_seek_source *src,
+				  double seconds, unsigned long long *offset)
+{
+	struct text_parser_priv *priv = text_parser_priv(parser);
+	unsigned int channels = io_context_get_channels(priv->ctx);
+	struct text_seek_reader *rd;
+	struct text_seek_stream st;
+	enum io_resample_kernel kernel;
+	unsigned long long frame, point;
+	unsigned int rate;
+	bool ok;
+
+	rd = malloc(sizeof(*rd));
+	if (!rd) {
+		io_set_latest_error("%s():%d: malloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return false;
+	}
+
+	text_seek_reader_init(rd, src, 0);
+	if (!text_seek_header(rd, &st, channels)) {
+		free(rd);
+		return false;
+	}
+
+	/* first output frame at or after @seconds */
+	rate = io_context_get_sample_rate(priv->ctx, &kernel);
+	frame = seconds > 0 ? (unsigned long long)ceil(seconds * rate - 1e-6) :
+			      0;
+
+	/* continue stream as if started at first value line */
+	priv->state = st.state;
+	priv->delta_encoded = st.delta_encoded;
+	priv->prev_time = 0.0;
+	memset(priv->prev_value, 0, sizeof(priv->prev_value));
+	text_start_stream(priv, channels);
+
+	if (st.state == HANDLE_4MS_FIXED_INTERVAL_FILE) {
+		point = frame;
+		if (priv->resample_fixed) {
+			io_resampler_seek(&priv->resampler, 0.0, frame);
+			point = text_seek_fixed_point(priv, frame, rate);
+		}
+		priv->fixed_index = point;
+
+		ok = text_seek_fixed(priv, rd, &st, point, offset);
+	} else {
+		io_resampler_seek(&priv->resampler, st.start_time, frame);
+
+		if (st.delta_encoded)
+			ok = text_seek_scan_delta(priv, rd, &st, offset);
+		else
+			ok = text_seek_search(priv, src, &st, offset);
+	}
+
+	free(rd);
+	return ok;
+}
+
+static const struct io_parser_ops text_parser_ops = {
+	.name = "text",
+	.parse = text_parser_parse,
+	.wait_queue = text_parser_wait_queue,
+	.destroy = text_parser_destroy,
+	.reset = text_parser_reset,
+	.set_context = text_parser_set_context,
+	.seek_time = text_parser_seek_time,
+};
+
+/**
+ * io_new_text_parser - allocate and initialize new EGC text parser
+ */
+struct io_parser *io_new_text_parser(void)
+{
+	struct text_parser_priv *priv;
 
 	priv = calloc(1, sizeof(*priv));
 	if (!priv) {
@@ -311,6 +1504,527 @@ struct io_parser *io_new_text_parser(void)
 
 	io_parser_init(&priv->parser, &text_parser_ops);
 	io_parser_reset(&priv->parser);
+	priv->ctx = io_parser_get_context(&priv->parser);
 
 	return &priv->parser;
 }
+
+/*
+ * Parallel loading of whole file. File is split at newlines to chunks that
+ * are parsed to points by tasks of workqueue. Delta-decoding and resampling
+ * need previous points, so they are done in file order when chunks are
+ * merged.
+ */
+
+/* Minimum length of chunk parsed by one task */
+#define TEXT_LOAD_MIN_CHUNK_LEN (256 * 1024)
+
+/* Maximum length of chunk, line offsets of chunk are unsigned int */
+#define TEXT_LOAD_MAX_CHUNK_LEN (1U << 30)
+
+/* Chunks per thread, to balance uneven progress of threads */
+#define TEXT_LOAD_CHUNKS_PER_THREAD 4
+
+struct text_load_chunk {
+	/* Input, set before task is started */
+	const char *data;
+	unsigned int len;
+	enum text_state state;
+	unsigned int channels;
+
+	/* Parsed points, @times is NULL for 4ms fixed interval files */
+	unsigned int num_points;
+	unsigned int max_points;
+	double *times;
+	float *values;
+
+	/* line not of file type was found, rest of file is not loaded */
+	bool end_of_stream;
+	bool failed;
+};
+
+struct text_load_output {
+	unsigned int channels;
+	unsigned int num_frames;
+	unsigned int max_frames;
+	float *frames;
+	bool failed;
+};
+
+static bool text_load_chunk_grow(struct text_load_chunk *chunk)
+{
+	unsigned int max_points;
+	double *times = NULL;
+	float *values;
+
+	/* lines of value files are typically at least eight characters */
+	max_points = chunk->max_points ? chunk->max_points * 2 :
+					 chunk->len / 8 + 16;
+	if (max_points <= chunk->max_points ||
+	    max_points > UINT_MAX / IO_MAX_CHANNELS)
+		return false;
+
+	values = realloc(chunk->values, (size_t)max_points * chunk->channels *
+					sizeof(*values));
+	if (!values)
+		return false;
+	chunk->values = values;
+
+	if (chunk->state != HANDLE_4MS_FIXED_INTERVAL_FILE) {
+		times = realloc(chunk->times, max_points * sizeof(*times));
+		if (!times)
+			return false;
+		chunk->times = times;
+	}
+
+	chunk->max_points = max_points;
+	return true;
+}
+
+/* Scan one line of chunk, returns false at end of stream or error */
+static bool text_load_chunk_line(struct text_load_chunk *chunk,
+				 const char *line, unsigned int llen)
+{
+	char buf[TEXT_PARSER_MAX_LINE_LEN];
+	unsigned int clen;
+	double second;
+
+	if (chunk->num_points == chunk->max_points &&
+	    !text_load_chunk_grow(chunk)) {
+		chunk->failed = true;
+		return false;
+	}
+
+	/* copy line to temporary buffer, null terminated */
+	clen = llen < sizeof(buf) ? llen : sizeof(buf) - 1;
+	memcpy(buf, line, clen);
+	buf[clen] = 0;
+
+	if (!text_scan_point(chunk->state, buf, &second,
+			     &chunk->values[chunk->num_points * chunk->channels],
+			     chunk->channels)) {
+		chunk->end_of_stream = true;
+		return false;
+	}
+
+	if (chunk->times)
+		chunk->times[chunk->num_points] = second;
+	chunk->num_points++;
+
+	return true;
+}
+
+static void text_load_chunk_task(void *arg)
+{
+	struct text_load_chunk *chunk = arg;
+	struct text_newline_scan scan;
+	unsigned int start = 0, nl;
+
+	text_newline_scan_init(&scan, chunk->data, chunk->len);
+
+	while (text_next_newline(&scan, &nl)) {
+		if (!text_load_chunk_line(chunk, chunk->data + start,
+					  nl - start))
+			return;
+		start = nl + 1;
+	}
+
+	/* last line of file without newline */
+	if (start < chunk->len)
+		text_load_chunk_line(chunk, chunk->data + start,
+				     chunk->len - start);
+}
+
+static bool text_load_output_reserve(struct text_load_output *out,
+				     unsigned int num_frames)
+{
+	unsigned int max_frames = out->max_frames ? out->max_frames : 1024;
+	float *frames;
+
+	if (num_frames > UINT_MAX / IO_MAX_CHANNELS - out->num_frames)
+		return false;
+
+	while (max_frames - out->num_frames < num_frames) {
+		if (max_frames > UINT_MAX / IO_MAX_CHANNELS / 2)
+			max_frames = UINT_MAX / IO_MAX_CHANNELS;
+		else
+			max_frames *= 2;
+	}
+
+	if (max_frames == out->max_frames && out->frames)
+		return true;
+
+	frames = realloc(out->frames, (size_t)max_frames * out->channels *
+				      sizeof(*frames));
+	if (!frames)
+		return false;
+
+	out->frames = frames;
+	out->max_frames = max_frames;
+	return true;
+}
+
+static void text_load_append(struct text_load_output *out,
+			     const float *frames, unsigned int num_frames)
+{
+	if (out->failed || !text_load_output_reserve(out, num_frames)) {
+		out->failed = true;
+		return;
+	}
+
+	memcpy(&out->frames[out->num_frames * out->channels], frames,
+	       (size_t)num_frames * out->channels * sizeof(*frames));
+	out->num_frames += num_frames;
+}
+
+static void text_load_emit(void *opaque, const float *frames,
+			   unsigned int num_frames)
+{
+	text_load_append(opaque, frames, num_frames);
+}
+
+/**
+ * text_load_detect - find first value line like CHECK_FIRST_LINES and
+ *		      DETECT_FILE_TYPE states of parser
+ * @data: file data
+ * @len: length of @data
+ * @start: offset of first value line is stored here
+ * @delta_encoded: set if line before first value line is delta marker
+ *
+ * Returns state for handling detected file type, DETECT_FILE_TYPE if file
+ * has no value lines.
+ */
+static enum text_state text_load_detect(const char *data, size_t len,
+					size_t *start, bool *delta_encoded)
+{
+	char buf[TEXT_PARSER_MAX_LINE_LEN];
+	enum text_state state;
+	size_t pos = 0, llen;
+	const char *nl;
+
+	*delta_encoded = false;
+
+	while (pos < len) {
+		nl = memchr(data + pos, '\n', len - pos);
+		llen = nl ? (size_t)(nl - (data + pos)) : len - pos;
+
+		/* copy line to temporary buffer, null terminated */
+		if (llen > sizeof(buf) - 1)
+			llen = sizeof(buf) - 1;
+		memcpy(buf, data + pos, llen);
+		buf[llen] = 0;
+
+		state = text_detect_line(buf);
+		if (state != DETECT_FILE_TYPE) {
+			*start = pos;
+			return state;
+		}
+
+		/* marker must be right before first value line */
+		*delta_encoded = strcmp(buf, "#deltaenc") == 0;
+		if (!nl)
+			break;
+		pos = nl - data + 1;
+	}
+
+	return DETECT_FILE_TYPE;
+}
+
+/* Split @data to chunks ending at newlines, returns number of chunks */
+static unsigned int text_load_split(const char *data, size_t len,
+				    size_t chunk_len,
+				    struct text_load_chunk *chunks,
+				    unsigned int max_chunks)
+{
+	unsigned int num = 0;
+	size_t pos = 0, end, search;
+	const char *nl;
+
+	while (pos < len && num < max_chunks) {
+		end = len;
+		if (len - pos > chunk_len && num < max_chunks - 1) {
+			/* extend chunk to end of line */
+			end = pos + chunk_len;
+			search = len - end;
+			if (search > TEXT_LOAD_MAX_CHUNK_LEN - chunk_len)
+				search = TEXT_LOAD_MAX_CHUNK_LEN - chunk_len;
+
+			nl = memchr(data + end, '\n', search);
+			end = nl ? (size_t)(nl - data) + 1 : end + search;
+		}
+
+		chunks[num].data = data + pos;
+		chunks[num].len = end - pos;
+		num++;
+		pos = end;
+	}
+
+	return num;
+}
+
+/* Delta-decode and resample points of chunks in file order */
+static bool text_load_merge(struct text_load_chunk *chunks,
+			    unsigned int num_chunks, bool delta_encoded,
+			    unsigned int rate, enum io_resample_kernel kernel,
+			    struct text_load_output *out)
+{
+	enum text_state state = chunks[0].state;
+	unsigned int channels = out->channels;
+	float prev_value[IO_MAX_CHANNELS] = { 0, };
+	struct io_resampler *rs = NULL;
+	unsigned long long int fixed_index = 0;
+	struct text_load_chunk *chunk;
+	double prev_time = 0.0;
+	bool first = true;
+	unsigned int i, j, skip;
+	float *values;
+
+	/* output is allocated even if no frames are produced */
+	if (!text_load_output_reserve(out, 0))
+		return false;
+
+	/* 4ms fixed interval input is passed as such at default rate */
+	if (state != HANDLE_4MS_FIXED_INTERVAL_FILE ||
+	    rate != IO_DEFAULT_SAMPLE_RATE) {
+		rs = malloc(sizeof(*rs));
+		if (!rs)
+			return false;
+		io_resampler_init(rs, rate, kernel, channels, text_load_emit,
+				  out);
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		chunk = &chunks[i];
+		if (chunk->failed) {
+			free(rs);
+			return false;
+		}
+
+		values = chunk->values;
+
+		if (delta_encoded) {
+			/* first point of interval file is absolute */
+			skip = 0;
+			if (first && chunk->times && chunk->num_points > 0) {
+				memcpy(prev_value, values,
+				       channels * sizeof(*values));
+				prev_time = chunk->times[0];
+				skip = 1;
+			}
+
+			io_delta_decode(values + skip * channels,
+					chunk->num_points - skip, channels,
+					prev_value);
+
+			if (chunk->times) {
+				for (j = skip; j < chunk->num_points; j++) {
+					prev_time += chunk->times[j];
+					chunk->times[j] = prev_time;
+				}
+			}
+		}
+
+		if (chunk->num_points > 0)
+			first = false;
+
+		if (!rs) {
+			text_load_append(out, values, chunk->num_points);
+		} else {
+			for (j = 0; j < chunk->num_points; j++)
+				io_resampler_push(rs, chunk->times ?
+						  chunk->times[j] :
+						  fixed_index++ * 0.004,
+						  &values[j * channels]);
+		}
+
+		/* free parsed points early, merge output grows meanwhile */
+		free(chunk->times);
+		free(chunk->values);
+		chunk->times = NULL;
+		chunk->values = NULL;
+
+		if (chunk->end_of_stream)
+			break;
+	}
+
+	if (rs) {
+		io_resampler_flush(rs, true);
+		free(rs);
+	}
+
+	return !out->failed;
+}
+
+/**
+ * io_load_txt_file - load whole uncompressed text file, parsing chunks of
+ *		      file in parallel
+ * @filename: name of file
+ * @channels: values per output frame
+ * @rate: output rate in Hz, zero for IO_DEFAULT_SAMPLE_RATE
+ * @kernel: interpolation kernel used for resampling to @rate
+ * @num_threads: number of parser threads, zero for number of CPUs
+ * @num_frames: number of loaded frames is stored here
+ *
+ * Frames are same as text parser passes to context for first input stream
+ * of file. Returns interleaved frames to be freed with free(), or NULL on
+ * error.
+ */
+float *io_load_txt_file(const char *filename, unsigned int channels,
+			unsigned int rate, enum io_resample_kernel kernel,
+			unsigned int num_threads, unsigned int *num_frames)
+{
+	struct text_load_output out = { 0, };
+	struct text_load_chunk *chunks = NULL;
+	struct ds_workqueue *wq = NULL;
+	struct ds_wait_group wg;
+	unsigned int i, num_chunks, max_chunks;
+	size_t len, start, chunk_len;
+	enum text_state state;
+	bool delta_encoded;
+	const char *data;
+	struct stat st;
+	void *addr;
+	long cpus;
+	int fd;
+
+	if (channels == 0 || channels > IO_MAX_CHANNELS) {
+		io_set_latest_error("%s():%d: invalid number of channels %u",
+				    __func__, __LINE__, channels);
+		return NULL;
+	}
+
+	if (rate == 0)
+		rate = IO_DEFAULT_SAMPLE_RATE;
+
+	if (num_threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = cpus > 0 ? cpus : 1;
+	}
+	if (num_threads > DS_WORKQUEUE_MAX_WORKERS)
+		num_threads = DS_WORKQUEUE_MAX_WORKERS;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		io_set_latest_error("%s():%d: could not stat file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		close(fd);
+		return NULL;
+	}
+
+	len = st.st_size;
+	if (len == 0) {
+		io_set_latest_error("%s():%d: file[%s] is empty", __func__,
+				    __LINE__, filename);
+		close(fd);
+		return NULL;
+	}
+
+	addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		io_set_latest_error("%s():%d: could not map file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		return NULL;
+	}
+	data = addr;
+
+	/* chunks are read by all threads at once */
+	posix_madvise(addr, len, POSIX_MADV_WILLNEED);
+
+	if (len >= 2 && (unsigned char)data[0] == 0x1f &&
+	    (unsigned char)data[1] == 0x8b) {
+		io_set_latest_error("%s():%d: file[%s] is gzip compressed",
+				    __func__, __LINE__, filename);
+		goto out;
+	}
+
+	state = text_load_detect(data, len, &start, &delta_encoded);
+	if (state == DETECT_FILE_TYPE) {
+		io_set_latest_error("%s():%d: file[%s] has no value lines",
+				    __func__, __LINE__, filename);
+		goto out;
+	}
+
+	/* single thread parses file as one chunk where possible */
+	len -= start;
+	max_chunks = num_threads > 1 ?
+		     num_threads * TEXT_LOAD_CHUNKS_PER_THREAD : 1;
+	chunk_len = len / max_chunks;
+	if (chunk_len < TEXT_LOAD_MIN_CHUNK_LEN)
+		chunk_len = TEXT_LOAD_MIN_CHUNK_LEN;
+	if (chunk_len > TEXT_LOAD_MAX_CHUNK_LEN / 2)
+		chunk_len = TEXT_LOAD_MAX_CHUNK_LEN / 2;
+	max_chunks = len / chunk_len + 2;
+
+	chunks = calloc(max_chunks, sizeof(*chunks));
+	if (!chunks) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		goto out;
+	}
+
+	num_chunks = text_load_split(data + start, len, chunk_len, chunks,
+				     max_chunks);
+	for (i = 0; i < num_chunks; i++) {
+		chunks[i].state = state;
+		chunks[i].channels = channels;
+	}
+
+	if (num_threads > 1 && num_chunks > 1) {
+		wq = ds_workqueue_alloc(num_threads);
+		if (wq && !ds_wait_group_init(&wg)) {
+			ds_workqueue_free(wq);
+			wq = NULL;
+		}
+	}
+
+	if (wq) {
+		for (i = 0; i < num_chunks; i++) {
+			if (!ds_workqueue_submit(wq, text_load_chunk_task,
+						 &chunks[i], &wg))
+				text_load_chunk_task(&chunks[i]);
+		}
+
+		ds_workqueue_wait(wq, &wg);
+		ds_wait_group_free(&wg);
+		ds_workqueue_free(wq);
+	} else {
+		/* stop at end of stream, rest of file is not needed */
+		for (i = 0; i < num_chunks; i++) {
+			text_load_chunk_task(&chunks[i]);
+			if (chunks[i].end_of_stream || chunks[i].failed)
+				break;
+		}
+		num_chunks = i < num_chunks ? i + 1 : num_chunks;
+	}
+
+	out.channels = channels;
+	if (!text_load_merge(chunks, num_chunks, delta_encoded, rate, kernel,
+			     &out)) {
+		io_set_latest_error("%s():%d: out of memory", __func__,
+				    __LINE__);
+		free(out.frames);
+		out.frames = NULL;
+	} else {
+		*num_frames = out.num_frames;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		free(chunks[i].times);
+		free(chunks[i].values);
+	}
+	free(chunks);
+
+out:
+	munmap(addr, st.st_size);
+	return out.frames;
+}
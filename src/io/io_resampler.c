@@ -0,0 +1,294 @@
+/*
+ * Resampler for variable interval input
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "io.h"
+
+/*
+ * Output frame at time of input point may be emitted slightly before point
+ * is passed, number of seconds.
+ */
+#define RESAMPLER_TIME_SLACK 0.0001
+
+/* Per-segment polynomial, value = ((c[3] * f + c[2]) * f + c[1]) * f + c[0] */
+struct resampler_coeffs {
+	float c[4][IO_MAX_CHANNELS];
+};
+
+static inline const float *resampler_point(const struct io_resampler *rs,
+					   unsigned int idx)
+{
+	return &rs->values[idx * rs->channels];
+}
+
+static void resampler_emit(struct io_resampler *rs)
+{
+	if (rs->num_out == 0)
+		return;
+
+	rs->emit(rs->opaque, rs->out, rs->num_out);
+	rs->num_out = 0;
+}
+
+/*
+ * Coefficients for segment @seg, from point @seg to point @seg + 1. For cubic
+ * kernel, Catmull-Rom spline over neighbour points is used and missing
+ * neighbours at stream start and end are replaced with segment end points.
+ */
+static void resampler_segment_coeffs(const struct io_resampler *rs,
+				     unsigned int seg,
+				     struct resampler_coeffs *k)
+{
+	const float *p0, *p1, *p2, *p3;
+	unsigned int c;
+
+	p1 = resampler_point(rs, seg);
+	p2 = resampler_point(rs, seg + 1);
+
+	if (rs->kernel == IO_RESAMPLE_LINEAR) {
+		for (c = 0; c < rs->channels; c++) {
+			k->c[0][c] = p1[c];
+			k->c[1][c] = p2[c] - p1[c];
+		}
+		return;
+	}
+
+	p0 = seg > 0 ? resampler_point(rs, seg - 1) : p1;
+	p3 = seg + 2 < rs->num_points ? resampler_point(rs, seg + 2) : p2;
+
+	for (c = 0; c < rs->channels; c++) {
+		k->c[0][c] = p1[c];
+		k->c[1][c] = 0.5f * (p2[c] - p0[c]);
+		k->c[2][c] = 0.5f * (2.0f * p0[c] - 5.0f * p1[c] +
+				     4.0f * p2[c] - p3[c]);
+		k->c[3][c] = 0.5f * (3.0f * (p1[c] - p2[c]) + p3[c] - p0[c]);
+	}
+}
+
+/* Evaluate @num_frames output frames at segment positions @frac */
+static void resampler_kernel(struct io_resampler *rs,
+			     const struct resampler_coeffs *k,
+			     const float *frac, unsigned int num_frames)
+{
+	unsigned int i, c, channels = rs->channels;
+	float *out = &rs->out[rs->num_out * channels];
+	float f;
+
+	if (rs->kernel == IO_RESAMPLE_LINEAR) {
+		for (i = 0; i < num_frames; i++, out += channels) {
+			f = frac[i];
+			for (c = 0; c < channels; c++)
+				out[c] = k->c[0][c] + f * k->c[1][c];
+		}
+	} else {
+		for (i = 0; i < num_frames; i++, out += channels) {
+			f = frac[i];
+			for (c = 0; c < channels; c++)
+				out[c] = ((k->c[3][c] * f + k->c[2][c]) * f +
+					  k->c[1][c]) * f + k->c[0][c];
+		}
+	}
+
+	rs->num_out += num_frames;
+}
+
+/* Emit all output frames up to end of segment @seg */
+static void resampler_process_segment(struct io_resampler *rs,
+				      unsigned int seg)
+{
+	float frac[IO_RESAMPLER_BLOCK_FRAMES];
+	struct resampler_coeffs k;
+	double t0, t1, len, inv_len, out_time;
+	unsigned int num = 0;
+	bool have_coeffs = false;
+
+	t0 = rs->times[seg];
+	t1 = rs->times[seg + 1];
+	len = t1 - t0;
+	inv_len = len > 0 ? 1.0 / len : 0.0;
+
+	while (true) {
+		out_time = rs->next_out * rs->interval;
+		if (out_time > t1 + RESAMPLER_TIME_SLACK)
+			break;
+
+		/* zero length segment outputs segment end value */
+		frac[num++] = len > 0 ? (float)((out_time - t0) * inv_len) :
+					1.0f;
+		rs->next_out++;
+
+		if (rs->num_out + num < IO_RESAMPLER_BLOCK_FRAMES)
+			continue;
+
+		if (!have_coeffs) {
+			resampler_segment_coeffs(rs, seg, &k);
+			have_coeffs = true;
+		}
+		resampler_kernel(rs, &k, frac, num);
+		resampler_emit(rs);
+		num = 0;
+	}
+
+	if (num == 0)
+		return;
+
+	if (!have_coeffs)
+		resampler_segment_coeffs(rs, seg, &k);
+	resampler_kernel(rs, &k, frac, num);
+}
+
+/**
+ * io_resampler_init - initialize resampler
+ * @rs: resampler to initialize
+ * @rate: output rate in Hz
+ * @kernel: interpolation kernel
+ * @channels: values per input point and output frame
+ * @emit: function receiving output frames
+ * @opaque: passed to @emit
+ */
+void io_resampler_init(struct io_resampler *rs, unsigned int rate,
+		       enum io_resample_kernel kernel, unsigned int channels,
+		       io_resampler_emit_t emit, void *opaque)
+{
+	rs->emit = emit;
+	rs->opaque = opaque;
+	rs->kernel = kernel;
+	rs->channels = channels;
+	rs->interval = 1.0 / (rate ? rate : IO_DEFAULT_SAMPLE_RATE);
+
+	io_resampler_reset(rs);
+}
+
+/**
+ * io_resampler_reset - drop buffered input, next point starts new stream
+ */
+void io_resampler_reset(struct io_resampler *rs)
+{
+	rs->started = false;
+	rs->start_time = 0.0;
+	rs->next_out = 0;
+	rs->num_points = 0;
+	rs->first_seg = 0;
+	rs->num_out = 0;
+}
+
+/**
+ * io_resampler_push - add input point to resampler
+ * @rs: resampler
+ * @time: time of point in seconds
+ * @values: one value for each channel
+ */
+void io_resampler_push(struct io_resampler *rs, double time,
+		       const float *values)
+{
+	if (!rs->started) {
+		rs->start_time = time;
+		rs->started = true;
+	}
+
+	if (rs->num_points == IO_RESAMPLER_BLOCK_POINTS)
+		io_resampler_flush(rs, false);
+
+	rs->times[rs->num_points] = time - rs->start_time;
+	memcpy(&rs->values[rs->num_points * rs->channels], values,
+	       rs->channels * sizeof(*values));
+	rs->num_points++;
+}
+
+/**
+ * io_resampler_flush - interpolate buffered input points and emit output
+ * @rs: resampler
+ * @final: last point of stream has been pushed
+ */
+void io_resampler_flush(struct io_resampler *rs, bool final)
+{
+	unsigned int seg, end_seg, keep_from;
+
+	/*
+	 * Linear segment needs its end points, cubic also next point after
+	 * segment unless stream has ended.
+	 */
+	end_seg = rs->num_points;
+	if (end_seg > 0)
+		end_seg--;
+	if (rs->kernel == IO_RESAMPLE_CUBIC && !final && end_seg > 0)
+		end_seg--;
+
+	if (rs->first_seg < end_seg) {
+		for (seg = rs->first_seg; seg < end_seg; seg++)
+			resampler_process_segment(rs, seg);
+
+		/* keep points needed by next segment */
+		keep_from = end_seg;
+		if (rs->kernel == IO_RESAMPLE_CUBIC && keep_from > 0)
+			keep_from--;
+
+		rs->num_points -= keep_from;
+		memmove(rs->times, &rs->times[keep_from],
+			rs->num_points * sizeof(rs->times[0]));
+		memmove(rs->values, &rs->values[keep_from * rs->channels],
+			rs->num_points * rs->channels * sizeof(rs->values[0]));
+		rs->first_seg = end_seg - keep_from;
+	}
+
+	resampler_emit(rs);
+}
+
+/**
+ * io_resampler_seek - reset resampler to continue stream at output frame
+ * @rs: resampler
+ * @start_time: time of first input point of stream
+ * @frame: index of next output frame
+ */
+void io_resampler_seek(struct io_resampler *rs, double start_time,
+		       unsigned long long frame)
+{
+	io_resampler_reset(rs);
+
+	rs->started = true;
+	rs->start_time = start_time;
+	rs->next_out = frame;
+}
+
+/**
+ * io_resampler_is_before - check if input segment ending at point of @time
+ *			    emits no output after io_resampler_seek()
+ */
+bool io_resampler_is_before(const struct io_resampler *rs, double time)
+{
+	/* same comparison as in resampler_process_segment() */
+	return rs->next_out * rs->interval >
+	       (time - rs->start_time) + RESAMPLER_TIME_SLACK;
+}
+
+/**
+ * io_resampler_history - number of input points interpolation kernel needs
+ *			  before segment
+ */
+unsigned int io_resampler_history(const struct io_resampler *rs)
+{
+	return rs->kernel == IO_RESAMPLE_CUBIC ? 1 : 0;
+}
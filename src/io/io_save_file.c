@@ -27,26 +27,68 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <math.h>
 #include <errno.h>
 
 #include "priv_zlib.h"
 #include "io.h"
 
+/* Text compressed per block by parallel gzip saver */
+#define PGZ_BLOCK_LEN (128 * 1024)
+
+/* Preset dictionary from end of previous block, deflate window size */
+#define PGZ_DICT_LEN (32 * 1024)
+
+/* Blocks queued or being compressed, per worker thread */
+#define PGZ_BLOCKS_PER_THREAD 2
+
+#define PGZ_MAX_INFLIGHT (IO_SAVE_GZ_MAX_THREADS * PGZ_BLOCKS_PER_THREAD)
+
+/* Buffered text is passed to writer thread when this much is pending */
+#define SAVE_WRITER_FLUSH_LEN (64 * 1024)
+
+/* Buffers queued to writer thread, appending blocks when full */
+#define SAVER_MAX_PENDING 8
+
+/* Buffer pieces passed to one ops->writev call */
+#define SAVE_WRITER_MAX_SPANS 16
+
+/* Decimals of delta-encoded text */
+#define SAVE_DELTA_DECIMALS 3
+
+/* Options passed to ops->open */
+struct io_save_opts {
+	int level;
+	unsigned int num_threads;
+
+	/* access point span of saved gzip index, zero for no index */
+	unsigned int index_span;
+};
+
 struct io_save_ops {
-	void *(*open)(const char *filename);
+	void *(*open)(const char *filename, const struct io_save_opts *opts);
 	bool (*close)(void *fp);
 	int (*write)(void *fp, const void *buf, size_t buflen);
+
+	/* optional, returns bytes written (may be partial) or -1 */
+	int (*writev)(void *fp, const struct ds_append_buffer_span *spans,
+		      unsigned int num_spans);
 };
 
 /*
  * Plain file saver
  */ 
-static void *plain_open(const char *filename)
+static void *plain_open(const char *filename,
+			const struct io_save_opts *opts)
 {
 	int fd;
 
-	fd = open(filename, O_CREAT | O_WRONLY, 
+	fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC,
 		  S_IRUSR | S_IWUSR | S_IRGRP |
 		  S_IWGRP | S_IROTH | S_IWOTH);
 
@@ -87,16 +129,37 @@ static int plain_write(void *fp, const void *buf, size_t buflen)
 	return tlen;
 }
 
+static int plain_writev(void *fp, const struct ds_append_buffer_span *spans,
+			unsigned int num_spans)
+{
+	struct iovec iov[SAVE_WRITER_MAX_SPANS];
+	int fd = (long)fp - 1;
+	unsigned int i;
+	ssize_t wlen;
+
+	for (i = 0; i < num_spans; i++) {
+		iov[i].iov_base = spans[i].data;
+		iov[i].iov_len = spans[i].len;
+	}
+
+	do {
+		wlen = writev(fd, iov, num_spans);
+	} while (wlen == -1 && errno == EINTR);
+
+	return wlen;
+}
+
 static struct io_save_ops plain_ops = {
 	.open = plain_open,
 	.close = plain_close,
-	.write = plain_write
+	.write = plain_write,
+	.writev = plain_writev
 };
 
 /*
  * GZIP file saver
  */ 
-static void *gzip_open(const char *filename)
+static void *gzip_open(const char *filename, const struct io_save_opts *opts)
 {
 	return gzopen(filename, "wb9");
 }
@@ -125,107 +188,907 @@ static struct io_save_ops gzip_ops = {
 	.write = gzip_write
 };
 
+static void save_put_le32(unsigned char *buf, unsigned long val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+	buf[2] = (val >> 16) & 0xff;
+	buf[3] = (val >> 24) & 0xff;
+}
+
 /*
- * Delta encoder
+ * Parallel GZIP file saver. Text is split to blocks that are deflated on
+ * worker threads, each block primed with last 32 KiB of previous block and
+ * ended with sync flush, so that compressed blocks concatenate to single
+ * deflate stream. CRC32 of blocks is combined in order by writer.
  */
-struct io_save_delta_encoder {
-	float curr_value;
+struct pgz_block {
+	unsigned char *in;
+	unsigned int in_len;
+	unsigned char dict[PGZ_DICT_LEN];
+	unsigned int dict_len;
+	bool last;
+
+	unsigned char *out;
+	unsigned int out_len;
+	unsigned long crc;
+	bool done;
+	bool failed;
+};
+
+struct pgz_file {
+	int fd;
+	int level;
+	bool failed;
+
+	/* worker threads, none if blocks are compressed in caller thread */
+	unsigned int num_threads;
+	pthread_t threads[IO_SAVE_GZ_MAX_THREADS];
+	struct ds_async_queue *queue;
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+	z_stream zstream;
+
+	/* submitted blocks in stream order */
+	struct pgz_block *inflight[PGZ_MAX_INFLIGHT];
+	unsigned int max_inflight;
+	unsigned int first, num_inflight;
+
+	/* block being filled and tail of previous block */
+	struct pgz_block *cur;
+	unsigned char dict[PGZ_DICT_LEN];
+	unsigned int dict_len;
+
+	unsigned long crc;
+	unsigned long isize;
+
+	/* access points at block starts, saved next to file at close */
+	struct io_gz_index *index;
+	unsigned long long out_len;
+	char *filename;
 };
 
-static bool delta_encoder_init(struct io_save_delta_encoder *enc, void *file,
-			       struct io_save_ops *ops)
+static int pgz_deflate_init(z_stream *zs, int level)
+{
+	memset(zs, 0, sizeof(*zs));
+
+	/* raw deflate, gzip header and trailer are written by saver */
+	return deflateInit2(zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+			    Z_DEFAULT_STRATEGY);
+}
+
+static bool pgz_compress_block(z_stream *zs, struct pgz_block *block)
 {
+	unsigned int out_size;
+	unsigned char *out;
 	int ret;
 
-	/* init variables */
-	enc->curr_value = 0;
+	block->crc = crc32(crc32(0L, Z_NULL, 0), block->in, block->in_len);
 
-	/* mark file as delta-encoded */
-	ret = ops->write(file, "#deltaenc\n", strlen("#deltaenc\n"));
-	if (ret < 0)
+	if (deflateReset(zs) != Z_OK)
+		return false;
+	if (block->dict_len > 0 &&
+	    deflateSetDictionary(zs, block->dict, block->dict_len) != Z_OK)
 		return false;
 
+	/* room for sync flush marker on top of deflate bound */
+	out_size = deflateBound(zs, block->in_len) + 16;
+	block->out = malloc(out_size);
+	if (!block->out)
+		return false;
+
+	zs->next_in = block->in;
+	zs->avail_in = block->in_len;
+	zs->next_out = block->out;
+	zs->avail_out = out_size;
+
+	while (true) {
+		ret = deflate(zs, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_ERROR)
+			return false;
+		if (zs->avail_out > 0)
+			break;
+
+		/* output did not fit, grow buffer and continue */
+		out = realloc(block->out, out_size * 2);
+		if (!out)
+			return false;
+
+		block->out = out;
+		zs->next_out = out + out_size;
+		zs->avail_out = out_size;
+		out_size *= 2;
+	}
+
+	block->out_len = out_size - zs->avail_out;
+
+	return !block->last || ret == Z_STREAM_END;
+}
+
+static int pgz_write_fd(struct pgz_file *file, const void *buf, size_t buflen)
+{
+	/* fd handle as used by plain_ops */
+	return plain_write((void *)((long)file->fd + 1), buf, buflen);
+}
+
+static void pgz_free_block(struct pgz_block *block)
+{
+	free(block->in);
+	free(block->out);
+	free(block);
+}
+
+static void *pgz_worker_thread(void *arg)
+{
+	struct pgz_file *file = arg;
+	struct pgz_block *block, **msg;
+	size_t msglen;
+	bool ok, have_zstream;
+	z_stream zs;
+
+	have_zstream = pgz_deflate_init(&zs, file->level) == Z_OK;
+
+	while (true) {
+		ds_async_queue_pop(file->queue, (void **)&msg, &msglen);
+		block = *msg;
+		ds_async_queue_msg_free(msg);
+
+		/* NULL block stops worker */
+		if (!block)
+			break;
+
+		ok = have_zstream && pgz_compress_block(&zs, block);
+
+		pthread_mutex_lock(&file->lock);
+		block->failed = !ok;
+		block->done = true;
+		pthread_cond_broadcast(&file->done_cond);
+		pthread_mutex_unlock(&file->lock);
+	}
+
+	if (have_zstream)
+		deflateEnd(&zs);
+
+	return NULL;
+}
+
+/* Wait for oldest submitted block and append it to file */
+static void pgz_write_oldest(struct pgz_file *file)
+{
+	struct pgz_block *block = file->inflight[file->first];
+
+	if (file->num_threads > 0) {
+		pthread_mutex_lock(&file->lock);
+		while (!block->done)
+			pthread_cond_wait(&file->done_cond, &file->lock);
+		pthread_mutex_unlock(&file->lock);
+	}
+
+	/* blocks start at byte boundary after sync flush of previous one */
+	if (!block->failed && file->index && block->in_len > 0 &&
+	    io_gz_index_needs_point(file->index) &&
+	    !io_gz_index_add_point(file->index, file->out_len, 0))
+		block->failed = true;
+
+	if (block->failed ||
+	    pgz_write_fd(file, block->out, block->out_len) !=
+							(int)block->out_len) {
+		file->failed = true;
+	} else {
+		file->crc = crc32_combine(file->crc, block->crc,
+					  block->in_len);
+		file->isize += block->in_len;
+		file->out_len += block->out_len;
+		if (file->index)
+			io_gz_index_add_data(file->index, block->in,
+					     block->in_len);
+	}
+
+	file->first = (file->first + 1) % PGZ_MAX_INFLIGHT;
+	file->num_inflight--;
+	pgz_free_block(block);
+}
+
+static struct pgz_block *pgz_new_block(struct pgz_file *file)
+{
+	struct pgz_block *block;
+
+	block = calloc(1, sizeof(*block));
+	if (!block)
+		return NULL;
+
+	block->in = malloc(PGZ_BLOCK_LEN);
+	if (!block->in) {
+		free(block);
+		return NULL;
+	}
+
+	return block;
+}
+
+/* Pass current block to compression and keep its tail as dictionary */
+static bool pgz_submit_block(struct pgz_file *file, bool last)
+{
+	struct pgz_block *block = file->cur;
+	unsigned int tail;
+
+	file->cur = NULL;
+
+	memcpy(block->dict, file->dict, file->dict_len);
+	block->dict_len = file->dict_len;
+	block->last = last;
+
+	tail = block->in_len < PGZ_DICT_LEN ? block->in_len : PGZ_DICT_LEN;
+	if (tail < PGZ_DICT_LEN && file->dict_len + tail > PGZ_DICT_LEN) {
+		/* short block, keep end of previous dictionary too */
+		memmove(file->dict, file->dict + file->dict_len + tail -
+			PGZ_DICT_LEN, PGZ_DICT_LEN - tail);
+		file->dict_len = PGZ_DICT_LEN - tail;
+	} else if (tail == PGZ_DICT_LEN) {
+		file->dict_len = 0;
+	}
+	memcpy(file->dict + file->dict_len, block->in + block->in_len - tail,
+	       tail);
+	file->dict_len += tail;
+
+	if (file->num_inflight == file->max_inflight)
+		pgz_write_oldest(file);
+
+	file->inflight[(file->first + file->num_inflight) % PGZ_MAX_INFLIGHT] =
+									block;
+	file->num_inflight++;
+
+	if (file->num_threads == 0) {
+		block->failed = !pgz_compress_block(&file->zstream, block);
+		block->done = true;
+	} else {
+		ds_async_queue_push(file->queue, &block, sizeof(block));
+	}
+
+	return !file->failed;
+}
+
+static void pgz_stop_threads(struct pgz_file *file)
+{
+	struct pgz_block *stop = NULL;
+	unsigned int i;
+
+	for (i = 0; i < file->num_threads; i++)
+		ds_async_queue_push(file->queue, &stop, sizeof(stop));
+	for (i = 0; i < file->num_threads; i++)
+		pthread_join(file->threads[i], NULL);
+
+	file->num_threads = 0;
+}
+
+static void pgz_destroy(struct pgz_file *file)
+{
+	while (file->num_inflight > 0)
+		pgz_write_oldest(file);
+
+	pgz_stop_threads(file);
+
+	if (file->cur)
+		pgz_free_block(file->cur);
+	if (file->queue)
+		ds_async_queue_free(file->queue);
+	deflateEnd(&file->zstream);
+	pthread_mutex_destroy(&file->lock);
+	pthread_cond_destroy(&file->done_cond);
+	if (file->fd >= 0)
+		close(file->fd);
+	io_gz_index_free(file->index);
+	free(file->filename);
+	free(file);
+}
+
+static void *pgz_open(const char *filename, const struct io_save_opts *opts)
+{
+	unsigned char header[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0,
+				     3 /* OS: Unix */ };
+	struct pgz_file *file;
+	unsigned int i;
+	long cpus;
+
+	file = calloc(1, sizeof(*file));
+	if (!file)
+		return NULL;
+
+	file->level = opts->level;
+	file->crc = crc32(0L, Z_NULL, 0);
+	pthread_mutex_init(&file->lock, NULL);
+	pthread_cond_init(&file->done_cond, NULL);
+
+	file->fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC,
+			S_IRUSR | S_IWUSR | S_IRGRP |
+			S_IWGRP | S_IROTH | S_IWOTH);
+	if (file->fd < 0 || pgz_deflate_init(&file->zstream,
+					     file->level) != Z_OK)
+		goto err;
+
+	/* XFL: maximum compression or fastest */
+	header[8] = file->level == 9 ? 2 : (file->level == 1 ? 4 : 0);
+	if (pgz_write_fd(file, header, sizeof(header)) != sizeof(header))
+		goto err;
+	file->out_len = sizeof(header);
+
+	if (opts->index_span) {
+		file->index = io_gz_index_alloc(opts->index_span);
+		file->filename = malloc(strlen(filename) + 1);
+		if (!file->index || !file->filename)
+			goto err;
+		strcpy(file->filename, filename);
+	}
+
+	file->num_threads = opts->num_threads;
+	if (file->num_threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		file->num_threads = cpus > 0 ? cpus : 1;
+	}
+	if (file->num_threads > IO_SAVE_GZ_MAX_THREADS)
+		file->num_threads = IO_SAVE_GZ_MAX_THREADS;
+
+	/* single thread compresses in caller context */
+	if (file->num_threads == 1) {
+		file->num_threads = 0;
+		file->max_inflight = 1;
+	} else {
+		file->max_inflight = file->num_threads * PGZ_BLOCKS_PER_THREAD;
+
+		file->queue = ds_async_queue_alloc_sized(file->max_inflight +
+							 file->num_threads);
+		if (!file->queue)
+			goto err;
+
+		for (i = 0; i < file->num_threads; i++) {
+			if (pthread_create(&file->threads[i], NULL,
+					   pgz_worker_thread, file) != 0)
+				break;
+		}
+
+		/* run with threads that could be started */
+		file->num_threads = i;
+		if (i == 0)
+			file->max_inflight = 1;
+	}
+
+	return file;
+
+err:
+	if (file->fd >= 0)
+		close(file->fd);
+	io_gz_index_free(file->index);
+	free(file->filename);
+	deflateEnd(&file->zstream);
+	if (file->queue)
+		ds_async_queue_free(file->queue);
+	pthread_mutex_destroy(&file->lock);
+	pthread_cond_destroy(&file->done_cond);
+	free(file);
+	return NULL;
+}
+
+static bool pgz_close(void *fp)
+{
+	struct pgz_file *file = fp;
+	unsigned char trailer[8];
+	bool ok;
+
+	/* last block ends deflate stream, might be empty */
+	if (!file->cur)
+		file->cur = pgz_new_block(file);
+
+	ok = file->cur && pgz_submit_block(file, true);
+
+	while (file->num_inflight > 0)
+		pgz_write_oldest(file);
+
+	save_put_le32(&trailer[0], file->crc);
+	save_put_le32(&trailer[4], file->isize);
+
+	ok = ok && !file->failed &&
+	     pgz_write_fd(file, trailer, sizeof(trailer)) == sizeof(trailer);
+
+	/* index is validated against complete file */
+	if (ok && file->index) {
+		close(file->fd);
+		file->fd = -1;
+		io_gz_index_finish(file->index);
+		ok = io_gz_index_save(file->index, file->filename);
+	}
+
+	pgz_destroy(file);
+
+	return ok;
+}
+
+static int pgz_write(void *fp, const void *buf, size_t buflen)
+{
+	struct pgz_file *file = fp;
+	const unsigned char *pos = buf;
+	size_t len, left = buflen;
+
+	while (left > 0) {
+		if (!file->cur) {
+			file->cur = pgz_new_block(file);
+			if (!file->cur)
+				return -1;
+		}
+
+		len = PGZ_BLOCK_LEN - file->cur->in_len;
+		if (len > left)
+			len = left;
+
+		memcpy(file->cur->in + file->cur->in_len, pos, len);
+		file->cur->in_len += len;
+		pos += len;
+		left -= len;
+
+		if (file->cur->in_len == PGZ_BLOCK_LEN &&
+		    !pgz_submit_block(file, false))
+			return -1;
+	}
+
+	return buflen;
+}
+
+static struct io_save_ops pgz_ops = {
+	.open = pgz_open,
+	.close = pgz_close,
+	.write = pgz_write
+};
+
+/*
+ * Write all data of @buf to file, writing out buffer pieces in batches and
+ * releasing them.
+ */
+static bool save_write_buffer(struct io_save_ops *ops, void *file,
+			      struct ds_append_buffer *buf)
+{
+	struct ds_append_buffer_span spans[SAVE_WRITER_MAX_SPANS];
+	unsigned int i, num_spans;
+	int ret;
+
+	while (ds_append_buffer_length(buf) > 0) {
+		num_spans = ds_append_buffer_get_spans(buf, 0,
+				ds_append_buffer_length(buf), spans,
+				SAVE_WRITER_MAX_SPANS);
+
+		if (ops->writev) {
+			ret = ops->writev(file, spans, num_spans);
+		} else {
+			for (i = 0, ret = 0; i < num_spans; i++) {
+				if (ops->write(file, spans[i].data,
+					       spans[i].len) != (int)spans[i].len)
+					return false;
+				ret += spans[i].len;
+			}
+		}
+		if (ret <= 0)
+			return false;
+
+		ds_append_buffer_move_head(buf, ret);
+	}
+
 	return true;
 }
 
-static int delta_encode(struct io_save_delta_encoder *enc, void *buf,
-			size_t buflen, float value)
+/*
+ * Delta encoder
+ */
+struct io_save_delta_encoder {
+	float curr_value;
+};
+
+static void delta_encoder_init(struct io_save_delta_encoder *enc)
+{
+	/* init variables */
+	enc->curr_value = 0;
+}
+
+static unsigned int delta_encode(struct io_save_delta_encoder *enc, char *buf,
+				 float value)
 {
+	unsigned long long int fixed;
+	unsigned int slen;
 	float delta;
-	int slen;
 
 	/* get new delta */
 	delta = value - enc->curr_value;
 
 	/* write delta to buffer */
-	slen = snprintf(buf, buflen, "%.3f\n", delta);
+	slen = io_format_fixed_line(buf, delta, SAVE_DELTA_DECIMALS);
 
-	/* read delta back from buffer (because lost accurancy/rounding) */
-	sscanf(buf, "%f", &delta);
+	/*
+	 * Adjust encoder value with delta as read back by parser (because
+	 * lost accurancy/rounding). Small fixed-point deltas are converted
+	 * with correctly rounded division, same as parser gets.
+	 */
+	fixed = llrint(fabs((double)delta) * 1e3);
+	if (fixed <= (1ULL << 24)) {
+		delta = (double)fixed / 1e3;
+		if (buf[0] == '-')
+			delta = -delta;
+	} else {
+		delta = strtof(buf, NULL);
+	}
 
-	/* adjust encoder value with delta */
 	enc->curr_value += delta;
 
 	return slen;
 }
 
 /*
- * Generic file saver function
+ * Streaming saver. Values are delta-encoded to text in caller thread and
+ * collected to appendable buffer, full buffers are written (and compressed)
+ * in writer thread.
  */
-static bool io_save_generic_txt_file(const char *filename, float *values,
-				     unsigned int num_values, bool use_gz)
-{
-	struct io_save_delta_encoder enc;
+struct io_saver_msg {
+	bool stop;
+	struct ds_append_buffer buf;
+};
+
+struct io_saver {
 	struct io_save_ops *ops;
 	void *file;
-	unsigned int i;
-	int ret;
 
-	/* select functions to use based on whatever to use compression or not */
-	ops = use_gz ? &gzip_ops : &plain_ops;
+	struct io_save_delta_encoder enc;
+	struct ds_append_buffer buf;
 
-	file = ops->open(filename);
-	if (!file) {
-		io_set_latest_error("%s():%d: could not open filename[%s] "
-				    "(errno: %d)", __func__, __LINE__, filename,
-				    errno);
+	/* appends first channel of parser blocks */
+	struct io_sink sink;
+
+	struct ds_async_queue *queue;
+	pthread_t thread;
+
+	/* set by writer thread on write error */
+	bool failed;
+	int error;
+};
+
+static void *saver_writer_thread(void *arg)
+{
+	struct io_saver *saver = arg;
+	struct io_saver_msg *msg;
+	size_t msglen;
+	bool stop;
+
+	do {
+		ds_async_queue_pop(saver->queue, (void **)&msg, &msglen);
+		stop = msg->stop;
+
+		/* after error, drop rest of data */
+		if (!__atomic_load_n(&saver->failed, __ATOMIC_RELAXED) &&
+		    !save_write_buffer(saver->ops, saver->file, &msg->buf)) {
+			saver->error = errno;
+			__atomic_store_n(&saver->failed, true,
+					 __ATOMIC_RELEASE);
+		}
+
+		ds_append_buffer_free(&msg->buf);
+		ds_async_queue_msg_free(msg);
+	} while (!stop);
+
+	return NULL;
+}
+
+/* Pass buffered text to writer thread */
+static void saver_submit(struct io_saver *saver, bool stop)
+{
+	struct io_saver_msg msg;
+
+	msg.stop = stop;
+	ds_append_buffer_move(&msg.buf, &saver->buf);
+
+	/* queue takes copy of message, buffer pieces move with it */
+	ds_async_queue_push(saver->queue, &msg, sizeof(msg));
+}
+
+static bool saver_write(struct io_saver *saver, const void *buf,
+			unsigned int buflen)
+{
+	if (ds_append_buffer_append(&saver->buf, buf, buflen) != buflen)
 		return false;
+
+	if (ds_append_buffer_length(&saver->buf) >= SAVE_WRITER_FLUSH_LEN)
+		saver_submit(saver, false);
+
+	return true;
+}
+
+/* Values of first channel gathered from sink blocks at once */
+#define SAVER_SINK_BLOCK_LEN 256
+
+static bool saver_sink_emit_block(struct io_sink *sink, const float *frames,
+				  unsigned int num_frames,
+				  unsigned int channels,
+				  unsigned int channel_id, double time)
+{
+	struct io_saver *saver = sink->priv;
+	float values[SAVER_SINK_BLOCK_LEN];
+	unsigned int i, num;
+
+	if (channels == 1)
+		return io_saver_append(saver, frames, num_frames);
+
+	while (num_frames > 0) {
+		num = num_frames < SAVER_SINK_BLOCK_LEN ?
+				num_frames : SAVER_SINK_BLOCK_LEN;
+
+		for (i = 0; i < num; i++, frames += channels)
+			values[i] = frames[0];
+
+		if (!io_saver_append(saver, values, num))
+			return false;
+
+		num_frames -= num;
+	}
+
+	return true;
+}
+
+static struct io_saver *saver_open(const char *filename,
+				   struct io_save_ops *ops,
+				   const struct io_save_opts *opts)
+{
+	struct io_saver *saver;
+
+	saver = calloc(1, sizeof(*saver));
+	if (!saver) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
 	}
 
-	if (!delta_encoder_init(&enc, file, ops)) {
-		/* error? skip or what? */
-		io_set_latest_error("%s():%d: delta_encoder_init failed "
+	saver->ops = ops;
+	saver->sink.emit_block = saver_sink_emit_block;
+	saver->sink.priv = saver;
+	delta_encoder_init(&saver->enc);
+	ds_append_buffer_init_sized(&saver->buf, 4096,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+
+	saver->queue = ds_async_queue_alloc_sized(SAVER_MAX_PENDING);
+	if (!saver->queue) {
+		io_set_latest_error("%s():%d: could not allocate queue",
+				    __func__, __LINE__);
+		goto err_free;
+	}
+
+	saver->file = ops->open(filename, opts);
+	if (!saver->file) {
+		io_set_latest_error("%s():%d: could not open filename[%s] "
 				    "(errno: %d)", __func__, __LINE__, filename,
 				    errno);
-		ops->close(file);
+		goto err_free_queue;
+	}
+
+	if (pthread_create(&saver->thread, NULL, saver_writer_thread,
+			   saver) != 0) {
+		io_set_latest_error("%s():%d: could not create writer thread",
+				    __func__, __LINE__);
+		ops->close(saver->file);
+		goto err_free_queue;
+	}
+
+	/* mark file as delta-encoded */
+	saver_write(saver, "#deltaenc\n", strlen("#deltaenc\n"));
+
+	return saver;
+
+err_free_queue:
+	ds_async_queue_free(saver->queue);
+err_free:
+	ds_append_buffer_free(&saver->buf);
+	free(saver);
+	return NULL;
+}
+
+/**
+ * io_saver_open_txt - open streaming saver for text file
+ * @filename: filename to use
+ *
+ * Output is same as with io_save_txt_file().
+ */
+struct io_saver *io_saver_open_txt(const char *filename)
+{
+	return saver_open(filename, &plain_ops, NULL);
+}
+
+/**
+ * io_saver_open_gz_txt - open streaming saver for gzip compressed text file
+ * @filename: filename to use
+ *
+ * Output is same as with io_save_gz_txt_file().
+ */
+struct io_saver *io_saver_open_gz_txt(const char *filename)
+{
+	return saver_open(filename, &gzip_ops, NULL);
+}
+
+/**
+ * io_saver_open_gz_txt_parallel - open streaming saver for gzip compressed
+ *				   text file, compressed on worker threads
+ * @filename: filename to use
+ * @level: compression level 1 to 9, or Z_DEFAULT_COMPRESSION (-1)
+ * @num_threads: number of compression threads, zero for number of CPUs
+ *
+ * Output is same as with io_save_gz_txt_file_parallel().
+ */
+struct io_saver *io_saver_open_gz_txt_parallel(const char *filename, int level,
+					       unsigned int num_threads)
+{
+	return io_saver_open_gz_txt_indexed(filename, level, num_threads, 0);
+}
+
+/**
+ * io_saver_open_gz_txt_indexed - open streaming saver like
+ *				  io_saver_open_gz_txt_parallel(), also saving
+ *				  random access index of file
+ * @filename: filename to use
+ * @level: compression level 1 to 9, or Z_DEFAULT_COMPRESSION (-1)
+ * @num_threads: number of compression threads, zero for number of CPUs
+ * @index_span: uncompressed bytes between access points, zero for no index
+ *
+ * Compressed blocks start at byte boundary, so index points are recorded
+ * at block starts without extra decompression. Index is saved at
+ * io_saver_close(), see io_gz_index_load().
+ */
+struct io_saver *io_saver_open_gz_txt_indexed(const char *filename, int level,
+					      unsigned int num_threads,
+					      unsigned int index_span)
+{
+	struct io_save_opts opts = { level, num_threads, index_span };
+
+	if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION ||
+	    level == Z_NO_COMPRESSION) {
+		io_set_latest_error("%s():%d: invalid compression level: %d",
+				    __func__, __LINE__, level);
+		return NULL;
+	}
+
+	return saver_open(filename, &pgz_ops, &opts);
+}
+
+/**
+ * io_saver_append - append values to file
+ * @saver: saver
+ * @values: data points to append (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Returns false if saving has failed, on this or on earlier call.
+ */
+bool io_saver_append(struct io_saver *saver, const float *values,
+		     unsigned int num_values)
+{
+	char buf[IO_DATA_LINE_MAX_LEN];
+	unsigned int i, slen;
+
+	if (__atomic_load_n(&saver->failed, __ATOMIC_ACQUIRE)) {
+		io_set_latest_error("%s():%d: write failed (errno: %d)",
+				    __func__, __LINE__, saver->error);
 		return false;
 	}
 
-	/* save data values to file */
 	for (i = 0; i < num_values; i++) {
-		char buf[32];
-		int slen;
-
-		slen = delta_encode(&enc, buf, sizeof(buf), values[i]);
-
-		ret = ops->write(file, buf, slen);
-		if (ret <= 0) {
-			/* error? skip or what? */
-			io_set_latest_error("%s():%d: ops->write failed "
-					    "(ret: %d) (errno: %d)", __func__,
-					    __LINE__, ret, errno);
-			ops->close(file);
+		slen = delta_encode(&saver->enc, buf, values[i]);
+
+		if (!saver_write(saver, buf, slen)) {
+			io_set_latest_error("%s():%d: out of memory",
+					    __func__, __LINE__);
 			return false;
 		}
 	}
 
-	if (ops->close(file))
-		return true;
+	return true;
+}
+
+/**
+ * io_saver_append_i16 - append int16 fixed-point values to file
+ * @saver: saver
+ * @values: data points to append (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Returns false if saving has failed, on this or on earlier call.
+ */
+bool io_saver_append_i16(struct io_saver *saver, const int16_t *values,
+			 unsigned int num_values)
+{
+	float block[SAVER_SINK_BLOCK_LEN];
+	unsigned int i, num;
+
+	while (num_values > 0) {
+		num = num_values < SAVER_SINK_BLOCK_LEN ?
+				num_values : SAVER_SINK_BLOCK_LEN;
+
+		for (i = 0; i < num; i++)
+			block[i] = io_sample_from_i16(values[i]);
+
+		if (!io_saver_append(saver, block, num))
+			return false;
+
+		values += num;
+		num_values -= num;
+	}
+
+	return true;
+}
+
+/**
+ * io_saver_get_sink - get sink appending blocks of parser stack to file
+ * @saver: saver
+ *
+ * First channel of each frame is saved.
+ */
+struct io_sink *io_saver_get_sink(struct io_saver *saver)
+{
+	return &saver->sink;
+}
+
+/**
+ * io_saver_flush - pass values appended so far to writer thread
+ * @saver: saver
+ *
+ * Does not wait for data to be written.
+ */
+void io_saver_flush(struct io_saver *saver)
+{
+	if (ds_append_buffer_length(&saver->buf) > 0)
+		saver_submit(saver, false);
+}
+
+/**
+ * io_saver_close - write remaining values, close file and free saver
+ * @saver: saver
+ *
+ * Returns false if any write failed.
+ */
+bool io_saver_close(struct io_saver *saver)
+{
+	bool ok;
+
+	/* writer thread exits after last buffer */
+	saver_submit(saver, true);
+	pthread_join(saver->thread, NULL);
+
+	ok = !saver->failed;
+	if (!ok)
+		io_set_latest_error("%s():%d: write failed (errno: %d)",
+				    __func__, __LINE__, saver->error);
+
+	if (!saver->ops->close(saver->file)) {
+		/* error at close, compression failed */
+		if (ok)
+			io_set_latest_error("%s():%d: ops->close failed "
+					    "(errno: %d)", __func__, __LINE__,
+					    errno);
+		ok = false;
+	}
+
+	ds_async_queue_free(saver->queue);
+	ds_append_buffer_free(&saver->buf);
+	free(saver);
+
+	return ok;
+}
+
+/*
+ * Generic file saver function
+ */
+static bool io_save_generic_txt_file(const char *filename, float *values,
+				     unsigned int num_values,
+				     struct io_save_ops *ops,
+				     const struct io_save_opts *opts)
+{
+	struct io_saver *saver;
+	bool ok;
+
+	saver = saver_open(filename, ops, opts);
+	if (!saver)
+		return false;
 
-	/* error at close, compression failed */
-	io_set_latest_error("%s():%d: ops->close failed (errno: %d)", __func__,
-			    __LINE__, errno);
-	return false;
+	ok = io_saver_append(saver, values, num_values);
+
+	return io_saver_close(saver) && ok;
 }
 
 /**
@@ -262,7 +1125,8 @@ static bool io_save_generic_txt_file(const char *filename, float *values,
 bool io_save_txt_file(const char *filename, float *values,
 		      unsigned int num_values)
 {
-	return io_save_generic_txt_file(filename, values, num_values, false);
+	return io_save_generic_txt_file(filename, values, num_values,
+					&plain_ops, NULL);
 }
 
 /**
@@ -277,5 +1141,316 @@ bool io_save_txt_file(const char *filename, float *values,
 bool io_save_gz_txt_file(const char *filename, float *values,
 			 unsigned int num_values)
 {
-	return io_save_generic_txt_file(filename, values, num_values, true);
+	return io_save_generic_txt_file(filename, values, num_values,
+					&gzip_ops, NULL);
+}
+
+/**
+ * io_save_gz_txt_file_parallel - save @values to file with name @filename,
+ *				  using text formating and gzip compression on
+ *				  worker threads.
+ * @filename: filename to use
+ * @values: data points to save (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ * @level: compression level 1 to 9, or Z_DEFAULT_COMPRESSION (-1)
+ * @num_threads: number of compression threads, zero for number of CPUs
+ *
+ * Output is standard single member gzip file.
+ */
+bool io_save_gz_txt_file_parallel(const char *filename, float *values,
+				  unsigned int num_values, int level,
+				  unsigned int num_threads)
+{
+	struct io_saver *saver;
+	bool ok;
+
+	saver = io_saver_open_gz_txt_parallel(filename, level, num_threads);
+	if (!saver)
+		return false;
+
+	ok = io_saver_append(saver, values, num_values);
+
+	return io_saver_close(saver) && ok;
+}
+
+/**
+ * io_save_gz_txt_file_indexed - save @values like io_save_gz_txt_file() and
+ *				 random access index next to file
+ * @filename: filename to use
+ * @values: data points to save (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ * @index_span: uncompressed bytes between access points, zero for
+ *		IO_GZ_INDEX_DEFAULT_SPAN
+ *
+ * Compressed with block-parallel compressor, see
+ * io_saver_open_gz_txt_indexed().
+ */
+bool io_save_gz_txt_file_indexed(const char *filename, float *values,
+				 unsigned int num_values,
+				 unsigned int index_span)
+{
+	struct io_saver *saver;
+	bool ok;
+
+	saver = io_saver_open_gz_txt_indexed(filename, Z_BEST_COMPRESSION, 0,
+					     index_span ? index_span :
+					     IO_GZ_INDEX_DEFAULT_SPAN);
+	if (!saver)
+		return false;
+
+	ok = io_saver_append(saver, values, num_values);
+
+	return io_saver_close(saver) && ok;
+}
+
+/*
+ * Binary sample file saver
+ */
+
+/* Largest encoded value, varint of 32-bit delta */
+#define BIN_MAX_VALUE_LEN 5
+
+/* Fixed-point limit of delta coding, keeps deltas in 32 bits */
+#define BIN_DELTA_FIXED_MAX ((1L << 30) - 1)
+
+/* Frames converted to fixed-point at once for delta coding */
+#define BIN_DELTA_CHUNK_FRAMES 128
+
+static long bin_to_fixed(float value, long min, long max)
+{
+	float fixed = roundf(value * IO_BIN_DEFAULT_SCALE);
+
+	/* saturate, also NaN to zero */
+	if (fixed >= max)
+		return max;
+	if (fixed <= min)
+		return min;
+	if (fixed != fixed)
+		return 0;
+
+	return (long)fixed;
+}
+
+static unsigned char *bin_put_varint(unsigned char *pos, unsigned long val)
+{
+	while (val >= 0x80) {
+		*pos++ = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	*pos++ = val;
+
+	return pos;
+}
+
+/*
+ * Delta-code frames to zigzag varints, @frames in @format converted in
+ * chunks. Int16 frames are fixed-point already.
+ */
+static unsigned char *bin_put_deltas(unsigned char *pos, const void *frames,
+				     enum io_sample_format format,
+				     unsigned int num_frames,
+				     unsigned int channels)
+{
+	int32_t fixed[BIN_DELTA_CHUNK_FRAMES * IO_MAX_CHANNELS];
+	int32_t deltas[BIN_DELTA_CHUNK_FRAMES * IO_MAX_CHANNELS];
+	int32_t prev[IO_MAX_CHANNELS] = { 0 };
+	const int16_t *frames_i16 = frames;
+	const float *frames_f = frames;
+	unsigned int i, j, k, n;
+	uint32_t bits;
+
+	for (i = 0; i < num_frames; i += n) {
+		n = num_frames - i;
+		if (n > BIN_DELTA_CHUNK_FRAMES)
+			n = BIN_DELTA_CHUNK_FRAMES;
+
+		for (j = 0, k = i * channels; j < n * channels; j++, k++) {
+			if (format == IO_SAMPLE_INT16)
+				fixed[j] = frames_i16[k];
+			else
+				fixed[j] = bin_to_fixed(frames_f[k],
+							-BIN_DELTA_FIXED_MAX,
+							BIN_DELTA_FIXED_MAX);
+		}
+
+		io_delta_encode_fixed(deltas, fixed, n, channels, prev);
+
+		for (j = 0; j < n * channels; j++) {
+			/* zigzag, small negative deltas to small codes */
+			bits = (uint32_t)deltas[j] << 1;
+			if (deltas[j] < 0)
+				bits = ~bits;
+			pos = bin_put_varint(pos, bits);
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Encode block of frames in @format to @buf, returns length of block with
+ * header
+ */
+static unsigned int bin_encode_block(unsigned char *buf, const void *frames,
+				     enum io_sample_format format,
+				     unsigned int num_frames,
+				     unsigned int channels,
+				     enum io_bin_encoding encoding)
+{
+	unsigned char *pos = buf + IO_BIN_BLOCK_HEADER_LEN;
+	unsigned int i, num_values = num_frames * channels;
+	const int16_t *frames_i16 = frames;
+	const float *frames_f = frames;
+	uint32_t u32;
+	float value;
+	long fixed;
+
+	switch (encoding) {
+	case IO_BIN_INT16:
+		for (i = 0; i < num_values; i++) {
+			if (format == IO_SAMPLE_INT16)
+				fixed = frames_i16[i];
+			else
+				fixed = bin_to_fixed(frames_f[i], INT16_MIN,
+						     INT16_MAX);
+			pos[0] = fixed & 0xff;
+			pos[1] = (fixed >> 8) & 0xff;
+			pos += 2;
+		}
+		break;
+	case IO_BIN_FLOAT32:
+		for (i = 0; i < num_values; i++) {
+			value = format == IO_SAMPLE_INT16 ?
+					io_sample_from_i16(frames_i16[i]) :
+					frames_f[i];
+			memcpy(&u32, &value, sizeof(u32));
+			save_put_le32(pos, u32);
+			pos += 4;
+		}
+		break;
+	case IO_BIN_DELTA_VARINT:
+	default:
+		pos = bin_put_deltas(pos, frames, format, num_frames,
+				     channels);
+		break;
+	}
+
+	save_put_le32(&buf[0], num_frames);
+	save_put_le32(&buf[4], pos - buf - IO_BIN_BLOCK_HEADER_LEN);
+
+	return pos - buf;
+}
+
+static bool io_save_generic_bin_file(const char *filename, const void *frames,
+				     enum io_sample_format format,
+				     unsigned int num_frames,
+				     unsigned int channels,
+				     unsigned int sample_rate,
+				     enum io_bin_encoding encoding)
+{
+	size_t value_size = format == IO_SAMPLE_INT16 ? sizeof(int16_t) :
+							sizeof(float);
+	unsigned char header[IO_BIN_HEADER_LEN];
+	unsigned int i, num, len;
+	unsigned char *buf;
+	bool ok = true;
+	void *file;
+
+	if (channels == 0 || channels > IO_MAX_CHANNELS || sample_rate == 0 ||
+	    encoding < IO_BIN_INT16 || encoding > IO_BIN_DELTA_VARINT) {
+		io_set_latest_error("%s():%d: invalid format: channels: %u, "
+				    "rate: %u, encoding: %d", __func__,
+				    __LINE__, channels, sample_rate, encoding);
+		return false;
+	}
+
+	buf = malloc(IO_BIN_BLOCK_HEADER_LEN +
+		     IO_BIN_BLOCK_FRAMES * channels * BIN_MAX_VALUE_LEN);
+	if (!buf) {
+		io_set_latest_error("%s():%d: malloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return false;
+	}
+
+	file = plain_ops.open(filename, NULL);
+	if (!file) {
+		io_set_latest_error("%s():%d: could not open file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+		free(buf);
+		return false;
+	}
+
+	memcpy(header, IO_BIN_MAGIC, 4);
+	header[4] = IO_BIN_VERSION;
+	header[5] = encoding;
+	header[6] = channels;
+	header[7] = 0;
+	save_put_le32(&header[8], sample_rate);
+	save_put_le32(&header[12], IO_BIN_DEFAULT_SCALE);
+
+	if (plain_ops.write(file, header, sizeof(header)) != sizeof(header))
+		ok = false;
+
+	for (i = 0; ok && i < num_frames; i += num) {
+		num = num_frames - i;
+		if (num > IO_BIN_BLOCK_FRAMES)
+			num = IO_BIN_BLOCK_FRAMES;
+
+		len = bin_encode_block(buf, (const char *)frames +
+					    i * channels * value_size,
+				       format, num, channels, encoding);
+		if (plain_ops.write(file, buf, len) != (int)len)
+			ok = false;
+	}
+
+	if (!plain_ops.close(file))
+		ok = false;
+
+	if (!ok)
+		io_set_latest_error("%s():%d: could not write file[%s] "
+				    "(errno: %d)", __func__, __LINE__,
+				    filename, errno);
+
+	free(buf);
+
+	return ok;
+}
+
+/**
+ * io_save_bin_file - save frames to binary sample file with name @filename
+ * @filename: filename to use
+ * @frames: frames to save, @channels values each
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @sample_rate: sample rate of frames in Hz
+ * @encoding: encoding of values
+ */
+bool io_save_bin_file(const char *filename, const float *frames,
+		      unsigned int num_frames, unsigned int channels,
+		      unsigned int sample_rate, enum io_bin_encoding encoding)
+{
+	return io_save_generic_bin_file(filename, frames, IO_SAMPLE_FLOAT32,
+					num_frames, channels, sample_rate,
+					encoding);
+}
+
+/**
+ * io_save_bin_file_i16 - save int16 fixed-point frames to binary sample file
+ *			  with name @filename
+ * @filename: filename to use
+ * @frames: frames to save, @channels values each
+ * @num_frames: number of frames
+ * @channels: values per frame, 1 to IO_MAX_CHANNELS
+ * @sample_rate: sample rate of frames in Hz
+ * @encoding: encoding of values
+ */
+bool io_save_bin_file_i16(const char *filename, const int16_t *frames,
+			  unsigned int num_frames, unsigned int channels,
+			  unsigned int sample_rate,
+			  enum io_bin_encoding encoding)
+{
+	return io_save_generic_bin_file(filename, frames, IO_SAMPLE_INT16,
+					num_frames, channels, sample_rate,
+					encoding);
 }
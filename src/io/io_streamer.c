@@ -0,0 +1,684 @@
+/*
+ * Fan-out network streaming of ECG data
+ *
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "io.h"
+
+/* Queued frames written to TCP subscriber with one sendmsg() */
+#define STREAMER_MAX_IOV 64
+
+/* UDP datagrams sent with one sendmmsg() */
+#define STREAMER_MAX_MMSG 64
+
+/* Initial size of subscriber table */
+#define STREAMER_MIN_SUBS 8
+
+/*
+ * Data lines of one batch of values, shared by all subscribers that have it
+ * queued. References are taken and dropped with streamer lock held.
+ */
+struct io_stream_frame {
+	unsigned int refs;
+	unsigned int len;
+	char data[];
+};
+
+enum stream_sub_type {
+	STREAM_SUB_TCP = 0,
+	STREAM_SUB_UDP,
+};
+
+/*
+ * Subscriber. TCP subscribers have ring of frames waiting for room in socket,
+ * @offset bytes of first frame are already sent. UDP datagrams are not
+ * queued, datagram that does not fit to socket buffer is dropped.
+ */
+struct io_stream_sub {
+	enum stream_sub_type type;
+	int id;
+	int fd;
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	enum io_stream_drop_policy policy;
+	struct io_stream_frame **queue;
+	unsigned int max_queued;
+	unsigned int head;
+	unsigned int num_queued;
+	unsigned int offset;
+
+	/* UDP subscriber already handled for current frame */
+	bool udp_done;
+
+	struct io_stream_stats stats;
+};
+
+struct io_streamer {
+	pthread_mutex_t lock;
+
+	struct io_stream_sub **subs;
+	unsigned int num_subs;
+	unsigned int max_subs;
+	unsigned int num_udp;
+	int next_id;
+
+	struct io_sink sink;
+};
+
+static void stream_frame_put(struct io_stream_frame *frame)
+{
+	if (--frame->refs == 0)
+		free(frame);
+}
+
+/* Format first value of @num frames, @stride values apart, as data lines */
+static struct io_stream_frame *stream_frame_encode(const float *values,
+						   unsigned int num,
+						   unsigned int stride)
+{
+	struct io_stream_frame *frame;
+	unsigned int i, len = 0;
+
+	frame = malloc(sizeof(*frame) + num * IO_DATA_LINE_MAX_LEN);
+	if (!frame) {
+		io_set_latest_error("%s():%d: malloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++, values += stride)
+		len += io_format_data_line(&frame->data[len], *values);
+
+	frame->refs = 1;
+	frame->len = len;
+
+	return frame;
+}
+
+static struct io_stream_frame *stream_sub_frame(struct io_stream_sub *sub,
+						unsigned int idx)
+{
+	return sub->queue[(sub->head + idx) % sub->max_queued];
+}
+
+static void stream_sub_pop(struct io_stream_sub *sub)
+{
+	stream_frame_put(stream_sub_frame(sub, 0));
+
+	sub->head = (sub->head + 1) % sub->max_queued;
+	sub->num_queued--;
+	sub->offset = 0;
+}
+
+static void stream_sub_free(struct io_stream_sub *sub)
+{
+	while (sub->num_queued > 0)
+		stream_sub_pop(sub);
+
+	/* TCP sockets are owned by streamer, UDP sockets by caller */
+	if (sub->type == STREAM_SUB_TCP)
+		close(sub->fd);
+
+	free(sub->queue);
+	free(sub);
+}
+
+/*
+ * Queue @frame to TCP subscriber, applying drop policy when queue is full.
+ * Returns false if subscriber is to be disconnected.
+ */
+static bool stream_sub_enqueue(struct io_stream_sub *sub,
+			       struct io_stream_frame *frame)
+{
+	struct io_stream_frame **second;
+
+	if (sub->num_queued == sub->max_queued) {
+		switch (sub->policy) {
+		case IO_STREAM_DISCONNECT:
+			return false;
+
+		case IO_STREAM_DROP_NEWEST:
+			sub->stats.dropped_frames++;
+			return true;
+
+		case IO_STREAM_DROP_OLDEST:
+		default:
+			sub->stats.dropped_frames++;
+
+			if (sub->offset == 0) {
+				stream_sub_pop(sub);
+				break;
+			}
+
+			/*
+			 * Partially sent frame is finished first to keep
+			 * lines whole, next frame is dropped in its place.
+			 */
+			second = &sub->queue[(sub->head + 1) % sub->max_queued];
+			stream_frame_put(*second);
+			*second = sub->queue[sub->head];
+			sub->head = (sub->head + 1) % sub->max_queued;
+			sub->num_queued--;
+			break;
+		}
+	}
+
+	frame->refs++;
+	sub->queue[(sub->head + sub->num_queued) % sub->max_queued] = frame;
+	sub->num_queued++;
+
+	return true;
+}
+
+/*
+ * Write queued frames of TCP subscriber until socket buffer is full.
+ * Returns false on connection error.
+ */
+static bool stream_sub_flush(struct io_stream_sub *sub)
+{
+	struct iovec iov[STREAMER_MAX_IOV];
+	struct io_stream_frame *frame;
+	struct msghdr msg;
+	unsigned int i, num, left;
+	ssize_t ret;
+
+	while (sub->num_queued > 0) {
+		num = sub->num_queued < STREAMER_MAX_IOV ? sub->num_queued :
+							   STREAMER_MAX_IOV;
+
+		for (i = 0; i < num; i++) {
+			frame = stream_sub_frame(sub, i);
+			iov[i].iov_base = frame->data;
+			iov[i].iov_len = frame->len;
+		}
+		iov[0].iov_base = (char *)iov[0].iov_base + sub->offset;
+		iov[0].iov_len -= sub->offset;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = num;
+
+		ret = sendmsg(sub->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+
+			sub->stats.error = errno;
+			return false;
+		}
+
+		sub->stats.bytes_sent += ret;
+
+		while (ret > 0) {
+			frame = stream_sub_frame(sub, 0);
+			left = frame->len - sub->offset;
+			if ((size_t)ret < left) {
+				sub->offset += ret;
+				break;
+			}
+
+			ret -= left;
+			stream_sub_pop(sub);
+			sub->stats.frames_sent++;
+		}
+	}
+
+	return true;
+}
+
+/* Send @frame to all UDP subscribers, batching subscribers of same socket */
+static void streamer_send_udp(struct io_streamer *streamer,
+			      struct io_stream_frame *frame)
+{
+	struct mmsghdr msgs[STREAMER_MAX_MMSG];
+	struct io_stream_sub *batch[STREAMER_MAX_MMSG];
+	struct io_stream_sub *sub;
+	struct iovec iov;
+	unsigned int i, j, num, pos;
+	int ret;
+
+	iov.iov_base = frame->data;
+	iov.iov_len = frame->len;
+
+	for (i = 0; i < streamer->num_subs; i++)
+		streamer->subs[i]->udp_done = false;
+
+	for (i = 0; i < streamer->num_subs; i++) {
+		sub = streamer->subs[i];
+		if (sub->type != STREAM_SUB_UDP || sub->udp_done)
+			continue;
+
+		num = 0;
+		for (j = i; j < streamer->num_subs && num < STREAMER_MAX_MMSG;
+		     j++) {
+			struct io_stream_sub *s = streamer->subs[j];
+
+			if (s->type != STREAM_SUB_UDP || s->udp_done ||
+			    s->fd != sub->fd)
+				continue;
+
+			memset(&msgs[num], 0, sizeof(msgs[num]));
+			msgs[num].msg_hdr.msg_name = &s->addr;
+			msgs[num].msg_hdr.msg_namelen = s->addrlen;
+			msgs[num].msg_hdr.msg_iov = &iov;
+			msgs[num].msg_hdr.msg_iovlen = 1;
+			batch[num++] = s;
+			s->udp_done = true;
+		}
+
+		/* sendmmsg() fails only if first datagram cannot be sent */
+		for (pos = 0; pos < num; ) {
+			ret = sendmmsg(sub->fd, &msgs[pos], num - pos,
+				       MSG_DONTWAIT);
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+
+				batch[pos]->stats.dropped_frames++;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					batch[pos]->stats.error = errno;
+				pos++;
+				continue;
+			}
+
+			for (j = pos; j < pos + ret; j++) {
+				batch[j]->stats.bytes_sent += msgs[j].msg_len;
+				batch[j]->stats.frames_sent++;
+			}
+			pos += ret;
+		}
+	}
+}
+
+/* Remove subscriber at @idx of table, lock held */
+static void streamer_remove_at(struct io_streamer *streamer, unsigned int idx)
+{
+	struct io_stream_sub *sub = streamer->subs[idx];
+
+	if (sub->type == STREAM_SUB_UDP)
+		streamer->num_udp--;
+
+	streamer->subs[idx] = streamer->subs[--streamer->num_subs];
+	stream_sub_free(sub);
+}
+
+/* Encode and fan out @num values, @stride values apart, lock held */
+static bool streamer_send(struct io_streamer *streamer, const float *values,
+			  unsigned int num, unsigned int stride)
+{
+	struct io_stream_frame *frame;
+	struct io_stream_sub *sub;
+	unsigned int i, chunk;
+
+	while (num > 0 && streamer->num_subs > 0) {
+		chunk = num < IO_STREAMER_MAX_FRAME_VALUES ? num :
+						IO_STREAMER_MAX_FRAME_VALUES;
+
+		frame = stream_frame_encode(values, chunk, stride);
+		if (!frame)
+			return false;
+
+		if (streamer->num_udp > 0)
+			streamer_send_udp(streamer, frame);
+
+		for (i = 0; i < streamer->num_subs; ) {
+			sub = streamer->subs[i];
+			if (sub->type == STREAM_SUB_TCP &&
+			    !stream_sub_enqueue(sub, frame)) {
+				streamer_remove_at(streamer, i);
+				continue;
+			}
+			i++;
+		}
+
+		stream_frame_put(frame);
+
+		values += chunk * stride;
+		num -= chunk;
+	}
+
+	/* write queued frames, dropping broken connections */
+	for (i = 0; i < streamer->num_subs; ) {
+		sub = streamer->subs[i];
+		if (sub->type == STREAM_SUB_TCP && !stream_sub_flush(sub)) {
+			streamer_remove_at(streamer, i);
+			continue;
+		}
+		i++;
+	}
+
+	return true;
+}
+
+static bool streamer_sink_emit_block(struct io_sink *sink,
+				     const float *frames,
+				     unsigned int num_frames,
+				     unsigned int channels,
+				     unsigned int channel_id, double time)
+{
+	struct io_streamer *streamer = sink->priv;
+	bool ret;
+
+	pthread_mutex_lock(&streamer->lock);
+	ret = streamer_send(streamer, frames, num_frames, channels);
+	pthread_mutex_unlock(&streamer->lock);
+
+	return ret;
+}
+
+/* Add subscriber to table, lock held */
+static int streamer_add(struct io_streamer *streamer, struct io_stream_sub *sub)
+{
+	struct io_stream_sub **subs;
+	unsigned int max_subs;
+
+	if (streamer->num_subs == streamer->max_subs) {
+		max_subs = streamer->max_subs ? streamer->max_subs * 2 :
+						STREAMER_MIN_SUBS;
+		subs = realloc(streamer->subs, max_subs * sizeof(*subs));
+		if (!subs) {
+			io_set_latest_error("%s():%d: realloc failed "
+					    "(errno: %d)", __func__, __LINE__,
+					    errno);
+			return -1;
+		}
+
+		streamer->subs = subs;
+		streamer->max_subs = max_subs;
+	}
+
+	sub->id = streamer->next_id++;
+	if (streamer->next_id < 0)
+		streamer->next_id = 0;
+
+	if (sub->type == STREAM_SUB_UDP)
+		streamer->num_udp++;
+
+	streamer->subs[streamer->num_subs++] = sub;
+
+	return sub->id;
+}
+
+/* Find subscriber index by @id, lock held */
+static int streamer_find(struct io_streamer *streamer, int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < streamer->num_subs; i++)
+		if (streamer->subs[i]->id == id)
+			return i;
+
+	return -1;
+}
+
+/**
+ * io_streamer_alloc - allocate streamer without subscribers
+ */
+struct io_streamer *io_streamer_alloc(void)
+{
+	struct io_streamer *streamer;
+
+	streamer = calloc(1, sizeof(*streamer));
+	if (!streamer) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return NULL;
+	}
+
+	pthread_mutex_init(&streamer->lock, NULL);
+	streamer->sink.emit_block = streamer_sink_emit_block;
+	streamer->sink.priv = streamer;
+
+	return streamer;
+}
+
+/**
+ * io_streamer_free - remove all subscribers and free streamer
+ */
+void io_streamer_free(struct io_streamer *streamer)
+{
+	if (!streamer)
+		return;
+
+	while (streamer->num_subs > 0)
+		streamer_remove_at(streamer, streamer->num_subs - 1);
+
+	pthread_mutex_destroy(&streamer->lock);
+	free(streamer->subs);
+	free(streamer);
+}
+
+/**
+ * io_streamer_add_tcp - add connected stream socket as subscriber
+ * @streamer: streamer
+ * @fd: connected socket, streamer takes ownership and sets it non-blocking
+ * @policy: handling of new frames when @max_queued frames are waiting
+ * @max_queued: frames queued for slow subscriber, zero for
+ *		IO_STREAMER_DEFAULT_MAX_QUEUED
+ *
+ * Returns id of subscriber, or -1 on error. On error @fd is not closed.
+ */
+int io_streamer_add_tcp(struct io_streamer *streamer, int fd,
+			enum io_stream_drop_policy policy,
+			unsigned int max_queued)
+{
+	struct io_stream_sub *sub;
+	int id;
+
+	if (!io_set_fd_nonblocking(fd))
+		return -1;
+
+	if (max_queued == 0)
+		max_queued = IO_STREAMER_DEFAULT_MAX_QUEUED;
+	/* room for partially sent frame and one more */
+	if (max_queued < 2)
+		max_queued = 2;
+
+	sub = calloc(1, sizeof(*sub));
+	if (!sub) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return -1;
+	}
+
+	sub->queue = calloc(max_queued, sizeof(*sub->queue));
+	if (!sub->queue) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		free(sub);
+		return -1;
+	}
+
+	sub->type = STREAM_SUB_TCP;
+	sub->fd = fd;
+	sub->policy = policy;
+	sub->max_queued = max_queued;
+
+	pthread_mutex_lock(&streamer->lock);
+	id = streamer_add(streamer, sub);
+	pthread_mutex_unlock(&streamer->lock);
+
+	if (id < 0) {
+		free(sub->queue);
+		free(sub);
+	}
+
+	return id;
+}
+
+/**
+ * io_streamer_add_udp - add datagram destination as subscriber
+ * @streamer: streamer
+ * @fd: datagram socket used for sending, remains owned by caller and may be
+ *	shared by many subscribers
+ * @addr: destination address
+ * @addrlen: length of @addr
+ *
+ * Datagrams to subscribers sharing socket are sent with one sendmmsg().
+ * Datagram that cannot be sent without blocking is dropped.
+ *
+ * Returns id of subscriber, or -1 on error.
+ */
+int io_streamer_add_udp(struct io_streamer *streamer, int fd,
+			const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct io_stream_sub *sub;
+	int id;
+
+	if (addrlen > sizeof(sub->addr)) {
+		io_set_latest_error("%s():%d: invalid address length: %u",
+				    __func__, __LINE__, (unsigned int)addrlen);
+		return -1;
+	}
+
+	sub = calloc(1, sizeof(*sub));
+	if (!sub) {
+		io_set_latest_error("%s():%d: calloc failed (errno: %d)",
+				    __func__, __LINE__, errno);
+		return -1;
+	}
+
+	sub->type = STREAM_SUB_UDP;
+	sub->fd = fd;
+	memcpy(&sub->addr, addr, addrlen);
+	sub->addrlen = addrlen;
+
+	pthread_mutex_lock(&streamer->lock);
+	id = streamer_add(streamer, sub);
+	pthread_mutex_unlock(&streamer->lock);
+
+	if (id < 0)
+		free(sub);
+
+	return id;
+}
+
+/**
+ * io_streamer_remove - remove subscriber, socket of TCP subscriber is closed
+ *
+ * Returns false if there is no subscriber with @id, for example because it
+ * was disconnected by streamer.
+ */
+bool io_streamer_remove(struct io_streamer *streamer, int id)
+{
+	int idx;
+
+	pthread_mutex_lock(&streamer->lock);
+	idx = streamer_find(streamer, id);
+	if (idx >= 0)
+		streamer_remove_at(streamer, idx);
+	pthread_mutex_unlock(&streamer->lock);
+
+	return idx >= 0;
+}
+
+/**
+ * io_streamer_send - encode @values once and send them to all subscribers
+ * @streamer: streamer
+ * @values: values to send (ecg data, 4ms intervals, 250pps)
+ * @num_values: number of values
+ *
+ * Returns false when out of memory.
+ */
+bool io_streamer_send(struct io_streamer *streamer, const float *values,
+		      unsigned int num_values)
+{
+	bool ret;
+
+	pthread_mutex_lock(&streamer->lock);
+	ret = streamer_send(streamer, values, num_values, 1);
+	pthread_mutex_unlock(&streamer->lock);
+
+	return ret;
+}
+
+/**
+ * io_streamer_flush - write frames queued for slow TCP subscribers
+ */
+void io_streamer_flush(struct io_streamer *streamer)
+{
+	pthread_mutex_lock(&streamer->lock);
+	streamer_send(streamer, NULL, 0, 1);
+	pthread_mutex_unlock(&streamer->lock);
+}
+
+/**
+ * io_streamer_get_stats - get counters of subscriber
+ *
+ * Returns false if there is no subscriber with @id.
+ */
+bool io_streamer_get_stats(struct io_streamer *streamer, int id,
+			   struct io_stream_stats *stats)
+{
+	struct io_stream_sub *sub;
+	int idx;
+
+	pthread_mutex_lock(&streamer->lock);
+	idx = streamer_find(streamer, id);
+	if (idx >= 0) {
+		sub = streamer->subs[idx];
+		*stats = sub->stats;
+		stats->queued_frames = sub->num_queued;
+	}
+	pthread_mutex_unlock(&streamer->lock);
+
+	return idx >= 0;
+}
+
+/**
+ * io_streamer_num_subscribers - number of current subscribers
+ */
+unsigned int io_streamer_num_subscribers(struct io_streamer *streamer)
+{
+	unsigned int num;
+
+	pthread_mutex_lock(&streamer->lock);
+	num = streamer->num_subs;
+	pthread_mutex_unlock(&streamer->lock);
+
+	return num;
+}
+
+/**
+ * io_streamer_get_sink - get sink streaming blocks of parser stack
+ *
+ * First channel of each frame is streamed.
+ */
+struct io_sink *io_streamer_get_sink(struct io_streamer *streamer)
+{
+	return &streamer->sink;
+}
@@ -23,11 +23,16 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <math.h>
 
 #include "io.h"
 
@@ -66,6 +71,36 @@ void io_usleep(unsigned int usec)
 	io_sleep_to(&abstime);
 }
 
+/**
+ * io_sleep_until_ns - sleep to absolute time of monotonic clock
+ * @deadline_ns: time in future to sleep to, see io_get_monotonic_ns()
+ */
+void io_sleep_until_ns(unsigned long long deadline_ns)
+{
+	struct timespec time;
+
+	time.tv_sec = deadline_ns / 1000000000ULL;
+	time.tv_nsec = deadline_ns % 1000000000ULL;
+
+	/* restart after signal handler, deadline is absolute */
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time,
+			       NULL) == EINTR)
+		;
+}
+
+/**
+ * io_get_monotonic_ns - get time of monotonic clock in nanoseconds, for
+ *			 measuring intervals
+ */
+unsigned long long io_get_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * io_set_fd_nonblocking - set unix file/socket descriptor to non-blocking mode
  * @fd: file descriptor to modify
@@ -89,6 +124,89 @@ bool io_set_fd_nonblocking(int fd)
 	return true;
 }
 
+/*
+ * Fixed-point formatting is used below this limit, larger values and
+ * non-finite values go through snprintf().
+ */
+#define IO_FORMAT_FIXED_MAX 1e17
+
+/* Powers of ten up to IO_FORMAT_MAX_DECIMALS */
+static const double io_format_pow10[IO_FORMAT_MAX_DECIMALS + 1] = {
+	1e0, 1e1, 1e2, 1e3, 1e4,
+};
+
+/**
+ * io_format_fixed_line - format @value as "%.*f\n" with @decimals without
+ *			  snprintf()
+ * @buf: output buffer, at least IO_DATA_LINE_MAX_LEN bytes
+ * @value: value to format
+ * @decimals: number of decimals, up to IO_FORMAT_MAX_DECIMALS
+ *
+ * Output is null terminated and identical to snprintf().
+ *
+ * Returns length of formatted line without terminating null.
+ */
+unsigned int io_format_fixed_line(char *buf, float value,
+				  unsigned int decimals)
+{
+	unsigned long long int fixed;
+	unsigned int len = 0, num = 0;
+	char digits[24];
+	double scaled;
+
+	if (decimals > IO_FORMAT_MAX_DECIMALS)
+		decimals = IO_FORMAT_MAX_DECIMALS;
+
+	/*
+	 * Float has 24 bit mantissa, so multiplication with power of ten up
+	 * to 1e4 is exact in double and llrint() rounds the same way as
+	 * printf().
+	 */
+	scaled = fabs((double)value) * io_format_pow10[decimals];
+	if (!(scaled < IO_FORMAT_FIXED_MAX))
+		return snprintf(buf, IO_DATA_LINE_MAX_LEN, "%.*f\n",
+				(int)decimals, value);
+
+	fixed = llrint(scaled);
+
+	if (signbit(value))
+		buf[len++] = '-';
+
+	/* decimals and at least one integer digit, in reverse order */
+	do {
+		digits[num++] = '0' + fixed % 10;
+		fixed /= 10;
+	} while (fixed > 0 || num <= decimals);
+
+	while (num > decimals)
+		buf[len++] = digits[--num];
+
+	if (decimals > 0) {
+		buf[len++] = '.';
+		while (num > 0)
+			buf[len++] = digits[--num];
+	}
+
+	buf[len++] = '\n';
+	buf[len] = '\0';
+
+	return len;
+}
+
+/**
+ * io_format_data_line - format @value as "%.02f\n" without snprintf()
+ * @buf: output buffer, at least IO_DATA_LINE_MAX_LEN bytes
+ * @value: value to format
+ *
+ * Output is null terminated and identical to snprintf().
+ *
+ * Returns length of formatted line without terminating null.
+ */
+unsigned int io_format_data_line(char *buf, float value)
+{
+	return io_format_fixed_line(buf, value, 2);
+}
+
 /**
  * (internal) io_set_latest_error - set error string for currently happened
  *				    error
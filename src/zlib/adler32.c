@@ -15,6 +15,24 @@ local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 #define NMAX 5552
 /* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
 
+/*
+  Vectorized sums of 32 byte blocks, SSSE3 selected at run-time on x86 and
+  NEON on ARM builds with NEON enabled.
+ */
+#define ADLER32_SIMD_BLOCK 32
+#define ADLER32_SIMD_MIN_LEN 64
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define ADLER32_SSSE3
+#  include <immintrin.h>
+   local int adler32_ssse3_enabled OF((void));
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#  define ADLER32_NEON
+#  include <arm_neon.h>
+#endif
+#if defined(ADLER32_SSSE3) || defined(ADLER32_NEON)
+   local uLong adler32_simd OF((uLong adler, const Bytef *buf, uInt len));
+#endif
+
 #define DO1(buf,i)  {adler += (buf)[i]; sum2 += adler;}
 #define DO2(buf,i)  DO1(buf,i); DO1(buf,i+1);
 #define DO4(buf,i)  DO2(buf,i); DO2(buf,i+2);
@@ -61,6 +79,195 @@ local uLong adler32_combine_ OF((uLong adler1, uLong adler2, z_off64_t len2));
 #  define MOD63(a) a %= BASE
 #endif
 
+#ifdef ADLER32_SSSE3
+
+/* ========================================================================= */
+local int adler32_ssse3_enabled()
+{
+    static int enabled = -1;
+    int on = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+
+    if (on < 0) {
+        __builtin_cpu_init();
+        on = __builtin_cpu_supports("ssse3");
+        __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+    }
+    return on;
+}
+
+/* =========================================================================
+ * For each 32 byte block, sum1 grows by sum of bytes and sum2 by 32 * sum1
+ * before block plus bytes weighted 32..1. Sums stay in 32-bit lanes for up
+ * to NMAX bytes.
+ */
+__attribute__((target("ssse3")))
+local uLong adler32_simd(adler, buf, len)
+    uLong adler;
+    const Bytef *buf;
+    uInt len;
+{
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+    unsigned blocks = len / ADLER32_SIMD_BLOCK;
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                       24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                       8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i v_ps, v_s1, v_s2, bytes1, bytes2;
+    unsigned n;
+
+    len -= blocks * ADLER32_SIMD_BLOCK;
+
+    while (blocks) {
+        n = NMAX / ADLER32_SIMD_BLOCK;
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+
+        v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+        v_s1 = _mm_setzero_si128();
+
+        do {
+            bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            /* sum1 of previous blocks, multiplied by 32 at end */
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                       _mm_maddubs_epi16(bytes1, tap1), ones));
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                       _mm_maddubs_epi16(bytes2, tap2), ones));
+
+            buf += ADLER32_SIMD_BLOCK;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* horizontal sums */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1,
+                                                     _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1,
+                                                     _MM_SHUFFLE(1, 0, 3, 2)));
+        s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2,
+                                                     _MM_SHUFFLE(2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2,
+                                                     _MM_SHUFFLE(1, 0, 3, 2)));
+        s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /* leftover bytes */
+    while (len--) {
+        s1 += *buf++;
+        s2 += s1;
+    }
+    s1 %= BASE;
+    s2 %= BASE;
+
+    return s1 | (s2 << 16);
+}
+
+#endif /* ADLER32_SSSE3 */
+
+#ifdef ADLER32_NEON
+
+/* =========================================================================
+ * Same block sums as SSSE3 version, per-column byte sums are weighted
+ * 32..1 once per NMAX run.
+ */
+local uLong adler32_simd(adler, buf, len)
+    uLong adler;
+    const Bytef *buf;
+    uInt len;
+{
+    static const unsigned short taps[ADLER32_SIMD_BLOCK] = {
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    };
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+    unsigned blocks = len / ADLER32_SIMD_BLOCK;
+    uint32x4_t v_s1, v_s2;
+    uint16x8_t col1, col2, col3, col4;
+    uint8x16_t bytes1, bytes2;
+    uint32x2_t sum1, sum2, s1s2;
+    unsigned n;
+
+    len -= blocks * ADLER32_SIMD_BLOCK;
+
+    while (blocks) {
+        n = NMAX / ADLER32_SIMD_BLOCK;
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+
+        v_s2 = vsetq_lane_u32((uint32_t)(s1 * n), vdupq_n_u32(0), 0);
+        v_s1 = vdupq_n_u32(0);
+        col1 = col2 = col3 = col4 = vdupq_n_u16(0);
+
+        do {
+            bytes1 = vld1q_u8(buf);
+            bytes2 = vld1q_u8(buf + 16);
+
+            /* sum1 of previous blocks, multiplied by 32 at end */
+            v_s2 = vaddq_u32(v_s2, v_s1);
+            v_s1 = vpadalq_u16(v_s1, vpadalq_u8(vpaddlq_u8(bytes1), bytes2));
+
+            col1 = vaddw_u8(col1, vget_low_u8(bytes1));
+            col2 = vaddw_u8(col2, vget_high_u8(bytes1));
+            col3 = vaddw_u8(col3, vget_low_u8(bytes2));
+            col4 = vaddw_u8(col4, vget_high_u8(bytes2));
+
+            buf += ADLER32_SIMD_BLOCK;
+        } while (--n);
+
+        v_s2 = vshlq_n_u32(v_s2, 5);
+
+        v_s2 = vmlal_u16(v_s2, vget_low_u16(col1), vld1_u16(taps + 0));
+        v_s2 = vmlal_u16(v_s2, vget_high_u16(col1), vld1_u16(taps + 4));
+        v_s2 = vmlal_u16(v_s2, vget_low_u16(col2), vld1_u16(taps + 8));
+        v_s2 = vmlal_u16(v_s2, vget_high_u16(col2), vld1_u16(taps + 12));
+        v_s2 = vmlal_u16(v_s2, vget_low_u16(col3), vld1_u16(taps + 16));
+        v_s2 = vmlal_u16(v_s2, vget_high_u16(col3), vld1_u16(taps + 20));
+        v_s2 = vmlal_u16(v_s2, vget_low_u16(col4), vld1_u16(taps + 24));
+        v_s2 = vmlal_u16(v_s2, vget_high_u16(col4), vld1_u16(taps + 28));
+
+        /* horizontal sums */
+        sum1 = vpadd_u32(vget_low_u32(v_s1), vget_high_u32(v_s1));
+        sum2 = vpadd_u32(vget_low_u32(v_s2), vget_high_u32(v_s2));
+        s1s2 = vpadd_u32(sum1, sum2);
+
+        s1 += vget_lane_u32(s1s2, 0);
+        s2 += vget_lane_u32(s1s2, 1);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /* leftover bytes */
+    while (len--) {
+        s1 += *buf++;
+        s2 += s1;
+    }
+    s1 %= BASE;
+    s2 %= BASE;
+
+    return s1 | (s2 << 16);
+}
+
+#endif /* ADLER32_NEON */
+
 /* ========================================================================= */
 uLong ZEXPORT adler32(adler, buf, len)
     uLong adler;
@@ -89,6 +296,14 @@ uLong ZEXPORT adler32(adler, buf, len)
     if (buf == Z_NULL)
         return 1L;
 
+#if defined(ADLER32_SSSE3)
+    if (len >= ADLER32_SIMD_MIN_LEN && adler32_ssse3_enabled())
+        return adler32_simd(adler | (sum2 << 16), buf, len);
+#elif defined(ADLER32_NEON)
+    if (len >= ADLER32_SIMD_MIN_LEN)
+        return adler32_simd(adler | (sum2 << 16), buf, len);
+#endif
+
     /* in case short lengths are provided, keep it somewhat fast */
     if (len < 16) {
         while (len--) {
@@ -46,6 +46,28 @@
 #  define TBLS 1
 #endif /* BYFOUR */
 
+/*
+  Hardware accelerated CRC, selected at run-time: carry-less multiply
+  folding with PCLMULQDQ on x86 and CRC32 instructions on ARMv8.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define CRC32_PCLMUL
+#  include <immintrin.h>
+#  define CRC32_PCLMUL_MIN_LEN 64
+   local int crc32_pclmul_enabled OF((void));
+   local z_crc_t crc32_pclmul OF((z_crc_t, const unsigned char FAR *,
+                                  unsigned));
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#  define CRC32_ARMV8
+#  include <sys/auxv.h>
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1 << 7)
+#  endif
+   local int crc32_armv8_enabled OF((void));
+   local z_crc_t crc32_armv8 OF((z_crc_t, const unsigned char FAR *,
+                                 unsigned));
+#endif
+
 /* Local functions for crc concatenation */
 local unsigned long gf2_matrix_times OF((unsigned long *mat,
                                          unsigned long vec));
@@ -196,6 +218,181 @@ const z_crc_t FAR * ZEXPORT get_crc_table()
     return (const z_crc_t FAR *)crc_table;
 }
 
+#ifdef CRC32_PCLMUL
+
+/* ========================================================================= */
+local int crc32_pclmul_enabled()
+{
+    static int enabled = -1;
+    int on = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+
+    if (on < 0) {
+        __builtin_cpu_init();
+        on = __builtin_cpu_supports("pclmul") &&
+             __builtin_cpu_supports("sse4.1");
+        __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+    }
+    return on;
+}
+
+/* =========================================================================
+ * Fold 64 bytes at a time with carry-less multiplication, then reduce to
+ * 32 bits with Barrett reduction ("Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction", Intel, 2009). crc is not
+ * pre- or post-conditioned, len must be at least 64 and multiple of 16.
+ */
+__attribute__((target("sse4.1,pclmul")))
+local z_crc_t crc32_pclmul(crc, buf, len)
+    z_crc_t crc;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    static const unsigned long long k1k2[2] __attribute__((aligned(16))) =
+        { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const unsigned long long k3k4[2] __attribute__((aligned(16))) =
+        { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const unsigned long long k5k0[2] __attribute__((aligned(16))) =
+        { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const unsigned long long poly[2] __attribute__((aligned(16))) =
+        { 0x01db710641ULL, 0x01f7011641ULL };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+
+    buf += 64;
+    len -= 64;
+
+    /* parallel fold of four 128-bit lanes */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold four lanes into one */
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* single lane folds of remaining 16 byte blocks */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (z_crc_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif /* CRC32_PCLMUL */
+
+#ifdef CRC32_ARMV8
+
+/* ========================================================================= */
+local int crc32_armv8_enabled()
+{
+    static int enabled = -1;
+    int on = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+
+    if (on < 0) {
+        on = (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+        __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+    }
+    return on;
+}
+
+/* =========================================================================
+ * CRC32 instructions, eight bytes per instruction. crc is not pre- or
+ * post-conditioned.
+ */
+__attribute__((target("arch=armv8-a+crc")))
+local z_crc_t crc32_armv8(crc, buf, len)
+    z_crc_t crc;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    unsigned long long word;
+
+    while (len && ((ptrdiff_t)buf & 7)) {
+        crc = __builtin_aarch64_crc32b(crc, *buf++);
+        len--;
+    }
+    while (len >= 8) {
+        zmemcpy(&word, buf, 8);
+        crc = __builtin_aarch64_crc32x(crc, word);
+        buf += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __builtin_aarch64_crc32b(crc, *buf++);
+    return crc;
+}
+
+#endif /* CRC32_ARMV8 */
+
 /* ========================================================================= */
 #define DO1 crc = crc_table[0][((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8)
 #define DO8 DO1; DO1; DO1; DO1; DO1; DO1; DO1; DO1
@@ -213,6 +410,22 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef CRC32_PCLMUL
+    if (len >= CRC32_PCLMUL_MIN_LEN && crc32_pclmul_enabled()) {
+        unsigned chunk = len & ~15U;
+
+        crc = ~crc32_pclmul(~(z_crc_t)crc, buf, chunk) & 0xffffffffUL;
+        buf += chunk;
+        len -= chunk;
+        if (len == 0)
+            return crc;
+    }
+#endif /* CRC32_PCLMUL */
+#ifdef CRC32_ARMV8
+    if (crc32_armv8_enabled())
+        return ~crc32_armv8(~(z_crc_t)crc, buf, len) & 0xffffffffUL;
+#endif /* CRC32_ARMV8 */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         z_crc_t endian;
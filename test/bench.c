@@ -0,0 +1,1582 @@
+/*
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Microbenchmarks for ds containers and io parser stack. Each result is
+ * printed as one JSON object per line. Workloads use fixed sizes and seeds,
+ * every measurement is repeated and median run is reported.
+ *
+ * Usage: bench [name-prefix], run from top of source tree.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "io.h"
+
+#define BENCH_DATA_DIR "share/io_test/"
+
+/* Runs of each measurement, median is reported */
+#define BENCH_REPEATS 5
+
+/* Log2 nanosecond buckets for latency percentiles */
+#define BENCH_LATENCY_BUCKETS 40
+
+static const char *bench_filter;
+
+static bool bench_enabled(const char *name)
+{
+	return !bench_filter ||
+	       strncmp(name, bench_filter, strlen(bench_filter)) == 0;
+}
+
+/* Deterministic pseudo-random numbers, xorshift32 */
+static unsigned int bench_random(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+static int bench_cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long long bench_median(unsigned long long *ns)
+{
+	qsort(ns, BENCH_REPEATS, sizeof(*ns), bench_cmp_ull);
+
+	return ns[BENCH_REPEATS / 2];
+}
+
+/*
+ * Print result line. @ops operations, @bytes bytes processed (zero if not
+ * relevant) and median run time @ns.
+ */
+static void bench_report(const char *name, const char *params,
+			 unsigned long long ops, unsigned long long bytes,
+			 unsigned long long ns)
+{
+	printf("{\"bench\":\"%s\",%s%s\"ops\":%llu,\"ns\":%llu,"
+	       "\"ns_per_op\":%.3f", name, params, params[0] ? "," : "",
+	       ops, ns, ops ? (double)ns / ops : 0.0);
+	if (bytes)
+		printf(",\"mb_per_s\":%.2f", bytes * 1e3 / (ns ? ns : 1));
+	printf("}\n");
+	fflush(stdout);
+}
+
+/*****************************************************************************
+ * Appendable buffer
+ *****************************************************************************/
+
+#define BENCH_ABUF_BYTES (32 * 1024 * 1024)
+#define BENCH_ABUF_CHUNK 100
+#define BENCH_ABUF_COPY 4096
+
+static void bench_append_buffer(void)
+{
+	static const unsigned int piece_lens[] = { 256, 4096, 65536 };
+	static unsigned char in[BENCH_ABUF_COPY], out[BENCH_ABUF_COPY];
+	unsigned long long append_ns[BENCH_REPEATS], copy_ns[BENCH_REPEATS];
+	unsigned long long start;
+	struct ds_append_buffer abuf;
+	unsigned int p, r, pos;
+	char params[64];
+
+	if (!bench_enabled("ds_append_buffer"))
+		return;
+
+	memset(in, 0x5a, sizeof(in));
+
+	for (p = 0; p < sizeof(piece_lens) / sizeof(piece_lens[0]); p++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			ds_append_buffer_init_sized(&abuf, piece_lens[p],
+						    piece_lens[p]);
+
+			/* small appends, as from parser output */
+			start = io_get_monotonic_ns();
+			for (pos = 0; pos < BENCH_ABUF_BYTES;
+			     pos += BENCH_ABUF_CHUNK)
+				ds_append_buffer_append(&abuf, in,
+							BENCH_ABUF_CHUNK);
+			append_ns[r] = io_get_monotonic_ns() - start;
+
+			/* consume from head in larger blocks */
+			start = io_get_monotonic_ns();
+			while (ds_append_buffer_length(&abuf) > 0) {
+				pos = ds_append_buffer_copy(&abuf, 0, out,
+							    sizeof(out));
+				ds_append_buffer_move_head(&abuf, pos);
+			}
+			copy_ns[r] = io_get_monotonic_ns() - start;
+
+			ds_append_buffer_free(&abuf);
+		}
+
+		snprintf(params, sizeof(params), "\"piece_len\":%u",
+			 piece_lens[p]);
+		bench_report("ds_append_buffer_append", params,
+			     BENCH_ABUF_BYTES / BENCH_ABUF_CHUNK,
+			     BENCH_ABUF_BYTES, bench_median(append_ns));
+		bench_report("ds_append_buffer_copy_move_head", params,
+			     BENCH_ABUF_BYTES / BENCH_ABUF_COPY,
+			     BENCH_ABUF_BYTES, bench_median(copy_ns));
+	}
+}
+
+/*****************************************************************************
+ * Linked lists
+ *****************************************************************************/
+
+#define BENCH_LIST_ENTRIES (1024 * 1024)
+#define BENCH_LIST_PASSES 4
+
+static void bench_lists(void)
+{
+	unsigned long long list_ns[BENCH_REPEATS], xor_ns[BENCH_REPEATS];
+	unsigned long long cursor_ns[BENCH_REPEATS];
+	struct ds_list_entry **lentries, *lpos;
+	struct ds_xorlist_entry **xentries, *xpos, *xprev;
+	struct ds_xorlist_cursor cur;
+	struct ds_linked_list list;
+	struct ds_xor_list xlist;
+	unsigned long long start, sum = 0;
+	unsigned int i, j, r, pass, seed, shuffled;
+	char params[64];
+
+	if (!bench_enabled("ds_list") && !bench_enabled("ds_xorlist"))
+		return;
+
+	lentries = malloc(BENCH_LIST_ENTRIES * sizeof(*lentries));
+	xentries = malloc(BENCH_LIST_ENTRIES * sizeof(*xentries));
+	if (!lentries || !xentries)
+		goto out;
+
+	for (i = 0; i < BENCH_LIST_ENTRIES; i++) {
+		ds_new_list_entry(lentries[i], unsigned int, i);
+		ds_new_xorlist_entry(xentries[i], unsigned int, i);
+		if (!lentries[i] || !xentries[i])
+			goto out;
+	}
+
+	/* entries linked in allocation order, then in random order */
+	for (shuffled = 0; shuffled < 2; shuffled++) {
+		if (shuffled) {
+			seed = 0x12345678;
+			for (i = BENCH_LIST_ENTRIES - 1; i > 0; i--) {
+				void *tmp;
+
+				j = bench_random(&seed) % (i + 1);
+				tmp = lentries[i];
+				lentries[i] = lentries[j];
+				lentries[j] = tmp;
+				tmp = xentries[i];
+				xentries[i] = xentries[j];
+				xentries[j] = tmp;
+			}
+		}
+
+		ds_list_init(&list);
+		ds_xorlist_init(&xlist);
+		for (i = 0; i < BENCH_LIST_ENTRIES; i++) {
+			ds_list_append_entry(&list, lentries[i]);
+			ds_xorlist_append_entry(&xlist, xentries[i]);
+		}
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			start = io_get_monotonic_ns();
+			for (pass = 0; pass < BENCH_LIST_PASSES; pass++)
+				ds_list_for_each(lpos, &list)
+					sum += ds_list_entry_data(unsigned int,
+								  lpos);
+			list_ns[r] = io_get_monotonic_ns() - start;
+
+			start = io_get_monotonic_ns();
+			for (pass = 0; pass < BENCH_LIST_PASSES; pass++)
+				ds_xorlist_for_each(xprev, xpos, &xlist)
+					sum += ds_xorlist_entry_data(
+							unsigned int, xpos);
+			xor_ns[r] = io_get_monotonic_ns() - start;
+
+			start = io_get_monotonic_ns();
+			for (pass = 0; pass < BENCH_LIST_PASSES; pass++)
+				ds_xorlist_cursor_for_each(&cur, xpos, &xlist)
+					sum += ds_xorlist_entry_data(
+							unsigned int, xpos);
+			cursor_ns[r] = io_get_monotonic_ns() - start;
+		}
+
+		snprintf(params, sizeof(params), "\"order\":\"%s\"",
+			 shuffled ? "random" : "allocation");
+		if (bench_enabled("ds_list"))
+			bench_report("ds_list_traverse", params,
+				     (unsigned long long)BENCH_LIST_ENTRIES *
+				     BENCH_LIST_PASSES, 0,
+				     bench_median(list_ns));
+		if (bench_enabled("ds_xorlist"))
+			bench_report("ds_xorlist_traverse", params,
+				     (unsigned long long)BENCH_LIST_ENTRIES *
+				     BENCH_LIST_PASSES, 0,
+				     bench_median(xor_ns));
+		if (bench_enabled("ds_xorlist"))
+			bench_report("ds_xorlist_cursor_traverse", params,
+				     (unsigned long long)BENCH_LIST_ENTRIES *
+				     BENCH_LIST_PASSES, 0,
+				     bench_median(cursor_ns));
+	}
+
+	/* keep traversal from being optimized away */
+	if (sum == 0)
+		printf("{\"bench\":\"ds_list_checksum\",\"sum\":0}\n");
+
+out:
+	if (lentries && xentries) {
+		for (i = 0; i < BENCH_LIST_ENTRIES; i++) {
+			free(lentries[i]);
+			free(xentries[i]);
+		}
+	}
+	free(lentries);
+	free(xentries);
+}
+
+/*
+ * Session tracking: objects on list removed in random order, through
+ * ds_list_find() and ds_list_delete_entry() for allocated entries and
+ * ds_list_remove_entry() for entries embedded in objects.
+ */
+#define BENCH_LIST_SESSIONS 4096
+
+struct bench_list_session {
+	unsigned int id;
+	struct ds_list_entry entry;
+};
+
+static void bench_list_remove(void)
+{
+	unsigned long long alloc_ns[BENCH_REPEATS], intr_ns[BENCH_REPEATS];
+	struct bench_list_session *sessions;
+	unsigned int *order;
+	struct ds_linked_list list;
+	struct ds_list_entry *entry;
+	unsigned long long start;
+	unsigned int i, j, r, seed = 0x2468ace0;
+	char params[64];
+
+	if (!bench_enabled("ds_list"))
+		return;
+
+	sessions = malloc(BENCH_LIST_SESSIONS * sizeof(*sessions));
+	order = malloc(BENCH_LIST_SESSIONS * sizeof(*order));
+	if (!sessions || !order)
+		goto out;
+
+	for (i = 0; i < BENCH_LIST_SESSIONS; i++) {
+		sessions[i].id = i;
+		order[i] = i;
+	}
+	for (i = BENCH_LIST_SESSIONS - 1; i > 0; i--) {
+		j = bench_random(&seed) % (i + 1);
+		r = order[i];
+		order[i] = order[j];
+		order[j] = r;
+	}
+
+	for (r = 0; r < BENCH_REPEATS; r++) {
+		ds_list_init(&list);
+
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_LIST_SESSIONS; i++)
+			if (!ds_list_append(&list, &sessions[i]))
+				goto out;
+		for (i = 0; i < BENCH_LIST_SESSIONS; i++) {
+			entry = ds_list_find(&list, &sessions[order[i]]);
+			ds_list_delete_entry(&list, entry);
+		}
+		alloc_ns[r] = io_get_monotonic_ns() - start;
+
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_LIST_SESSIONS; i++)
+			ds_list_append_entry(&list, &sessions[i].entry);
+		for (i = 0; i < BENCH_LIST_SESSIONS; i++)
+			ds_list_remove_entry(&list,
+					     &sessions[order[i]].entry);
+		intr_ns[r] = io_get_monotonic_ns() - start;
+	}
+
+	snprintf(params, sizeof(params), "\"entries\":%u",
+		 BENCH_LIST_SESSIONS);
+	bench_report("ds_list_find_delete", params, BENCH_LIST_SESSIONS, 0,
+		     bench_median(alloc_ns));
+	bench_report("ds_list_intrusive_remove", params, BENCH_LIST_SESSIONS,
+		     0, bench_median(intr_ns));
+
+out:
+	free(sessions);
+	free(order);
+}
+
+/*
+ * Entry churn of list used as queue, entries from libds allocator and from
+ * slab.
+ */
+#define BENCH_SLAB_DEPTH 256
+#define BENCH_SLAB_OPS (1024 * 1024)
+
+static void bench_slab(void)
+{
+	unsigned long long ns[2][BENCH_REPEATS];
+	struct ds_slab_stats stats;
+	struct ds_linked_list list;
+	struct ds_slab *slab;
+	unsigned long long start;
+	unsigned int i, r, use_slab;
+	char params[64];
+
+	if (!bench_enabled("ds_slab"))
+		return;
+
+	slab = ds_slab_alloc(DS_LIST_SLAB_OBJ_SIZE, 0);
+	if (!slab)
+		return;
+
+	for (use_slab = 0; use_slab < 2; use_slab++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			ds_list_init(&list);
+			ds_list_set_slab(&list, use_slab ? slab : NULL);
+
+			start = io_get_monotonic_ns();
+			for (i = 0; i < BENCH_SLAB_OPS; i++) {
+				ds_list_append(&list, &list);
+				if (ds_list_size(&list) > BENCH_SLAB_DEPTH)
+					ds_list_delete_entry(&list,
+							     ds_list_first(&list));
+			}
+			ds_list_free(&list);
+			ns[use_slab][r] = io_get_monotonic_ns() - start;
+		}
+	}
+
+	ds_slab_get_stats(slab, &stats);
+	snprintf(params, sizeof(params), "\"depth\":%u,\"footprint\":%lu",
+		 BENCH_SLAB_DEPTH, (unsigned long)stats.footprint);
+	bench_report("ds_slab_list_churn_malloc", params, BENCH_SLAB_OPS, 0,
+		     bench_median(ns[0]));
+	bench_report("ds_slab_list_churn_slab", params, BENCH_SLAB_OPS, 0,
+		     bench_median(ns[1]));
+
+	ds_slab_free(slab);
+}
+
+/*****************************************************************************
+ * Queues of small records
+ *****************************************************************************/
+
+#define BENCH_DEQUE_RECORDS (1024 * 1024)
+#define BENCH_DEQUE_DEPTH 1024
+
+struct bench_record {
+	unsigned long long time;
+	unsigned int id;
+	float value;
+};
+
+DS_DECLARE_QUEUE(bench_record_queue, struct bench_record)
+DS_DECLARE_RING(bench_record_ring, struct bench_record)
+
+/*
+ * FIFO of 16-byte records at steady depth, list backed vs. array backed, and
+ * generic memcpy based containers vs. type-specialised ones
+ */
+static void bench_deque(void)
+{
+	unsigned long long queue_ns[BENCH_REPEATS], deque_ns[BENCH_REPEATS];
+	unsigned long long tqueue_ns[BENCH_REPEATS], tring_ns[BENCH_REPEATS];
+	unsigned long long start, sum = 0;
+	struct bench_record rec = { 0, 0, 0.0f };
+	struct bench_record_queue tq;
+	struct bench_record_ring tr;
+	struct ds_queue q;
+	struct ds_deque dq;
+	unsigned int i, r;
+	char params[64];
+
+	if (!bench_enabled("ds_queue") && !bench_enabled("ds_deque"))
+		return;
+
+	for (r = 0; r < BENCH_REPEATS; r++) {
+		ds_queue_init(&q);
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_DEQUE_RECORDS; i++) {
+			rec.time = i;
+			ds_queue_push_data(&q, struct bench_record, rec);
+			if (ds_queue_size(&q) > BENCH_DEQUE_DEPTH) {
+				ds_queue_pop_data(&q, struct bench_record, rec);
+				sum += rec.time;
+			}
+		}
+		ds_queue_free(&q);
+		queue_ns[r] = io_get_monotonic_ns() - start;
+
+		if (!ds_deque_init(&dq, sizeof(rec), 0))
+			return;
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_DEQUE_RECORDS; i++) {
+			rec.time = i;
+			ds_deque_push_data(&dq, struct bench_record, rec);
+			if (ds_deque_size(&dq) > BENCH_DEQUE_DEPTH) {
+				ds_deque_pop_data(&dq, struct bench_record, rec);
+				sum += rec.time;
+			}
+		}
+		ds_deque_free(&dq);
+		deque_ns[r] = io_get_monotonic_ns() - start;
+
+		bench_record_queue_init(&tq);
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_DEQUE_RECORDS; i++) {
+			rec.time = i;
+			bench_record_queue_push(&tq, rec);
+			if (bench_record_queue_size(&tq) > BENCH_DEQUE_DEPTH) {
+				bench_record_queue_pop(&tq, &rec);
+				sum += rec.time;
+			}
+		}
+		bench_record_queue_free(&tq);
+		tqueue_ns[r] = io_get_monotonic_ns() - start;
+
+		if (!bench_record_ring_init(&tr, 0))
+			return;
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_DEQUE_RECORDS; i++) {
+			rec.time = i;
+			bench_record_ring_push_back(&tr, rec);
+			if (bench_record_ring_size(&tr) > BENCH_DEQUE_DEPTH) {
+				bench_record_ring_pop_front(&tr, &rec);
+				sum += rec.time;
+			}
+		}
+		bench_record_ring_free(&tr);
+		tring_ns[r] = io_get_monotonic_ns() - start;
+	}
+
+	snprintf(params, sizeof(params), "\"record\":%u,\"depth\":%u",
+		 (unsigned int)sizeof(rec), BENCH_DEQUE_DEPTH);
+	if (bench_enabled("ds_queue")) {
+		bench_report("ds_queue_fifo", params, BENCH_DEQUE_RECORDS,
+			     BENCH_DEQUE_RECORDS * sizeof(rec),
+			     bench_median(queue_ns));
+		bench_report("ds_queue_typed_fifo", params, BENCH_DEQUE_RECORDS,
+			     BENCH_DEQUE_RECORDS * sizeof(rec),
+			     bench_median(tqueue_ns));
+	}
+	if (bench_enabled("ds_deque")) {
+		bench_report("ds_deque_fifo", params, BENCH_DEQUE_RECORDS,
+			     BENCH_DEQUE_RECORDS * sizeof(rec),
+			     bench_median(deque_ns));
+		bench_report("ds_ring_typed_fifo", params, BENCH_DEQUE_RECORDS,
+			     BENCH_DEQUE_RECORDS * sizeof(rec),
+			     bench_median(tring_ns));
+	}
+
+	if (sum == 0)
+		printf("{\"bench\":\"ds_deque_checksum\",\"sum\":0}\n");
+}
+
+/*****************************************************************************
+ * Asynchronous queue
+ *****************************************************************************/
+
+#define BENCH_AQ_MESSAGES (256 * 1024)
+#define BENCH_AQ_CAPACITY 1024
+#define BENCH_AQ_MAX_THREADS 8
+
+struct bench_aq_msg {
+	unsigned long long push_ns;
+	bool stop;
+};
+
+struct bench_aq_thread {
+	struct ds_async_queue *queue;
+	unsigned int num_msgs;
+	unsigned long long latency[BENCH_LATENCY_BUCKETS];
+	pthread_t thread;
+};
+
+static void *bench_aq_producer(void *arg)
+{
+	struct bench_aq_thread *t = arg;
+	struct bench_aq_msg msg = { 0, false };
+	unsigned int i;
+
+	for (i = 0; i < t->num_msgs; i++) {
+		msg.push_ns = io_get_monotonic_ns();
+		ds_async_queue_push(t->queue, &msg, sizeof(msg));
+	}
+
+	return NULL;
+}
+
+static void *bench_aq_consumer(void *arg)
+{
+	struct bench_aq_thread *t = arg;
+	struct bench_aq_msg *msg;
+	unsigned long long ns;
+	unsigned int bucket;
+	size_t msglen;
+	bool stop;
+
+	do {
+		ds_async_queue_pop(t->queue, (void **)&msg, &msglen);
+
+		stop = msg->stop;
+		if (!stop) {
+			ns = io_get_monotonic_ns() - msg->push_ns;
+			bucket = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+			if (bucket >= BENCH_LATENCY_BUCKETS)
+				bucket = BENCH_LATENCY_BUCKETS - 1;
+			t->latency[bucket]++;
+			t->num_msgs++;
+		}
+
+		free(msg);
+	} while (!stop);
+
+	return NULL;
+}
+
+/* Upper bound of latency bucket where @percent of messages are reached */
+static unsigned long long bench_percentile(const unsigned long long *hist,
+					   unsigned long long total,
+					   unsigned int percent)
+{
+	unsigned long long count = 0;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_LATENCY_BUCKETS; i++) {
+		count += hist[i];
+		if (count * 100 >= total * percent)
+			break;
+	}
+
+	return 2ULL << i;
+}
+
+static void bench_async_queue(void)
+{
+	static struct bench_aq_thread producers[BENCH_AQ_MAX_THREADS];
+	static struct bench_aq_thread consumers[BENCH_AQ_MAX_THREADS];
+	unsigned long long ns[BENCH_REPEATS], hist[BENCH_LATENCY_BUCKETS];
+	unsigned long long start;
+	struct bench_aq_msg stop_msg = { 0, true };
+	struct ds_async_queue *queue;
+	unsigned int threads, i, r, b;
+	char params[160];
+
+	if (!bench_enabled("ds_async_queue"))
+		return;
+
+	for (threads = 1; threads <= BENCH_AQ_MAX_THREADS; threads *= 2) {
+		memset(hist, 0, sizeof(hist));
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			queue = ds_async_queue_alloc_sized(BENCH_AQ_CAPACITY);
+			if (!queue)
+				return;
+
+			memset(producers, 0, sizeof(producers));
+			memset(consumers, 0, sizeof(consumers));
+
+			start = io_get_monotonic_ns();
+			for (i = 0; i < threads; i++) {
+				consumers[i].queue = queue;
+				pthread_create(&consumers[i].thread, NULL,
+					       bench_aq_consumer,
+					       &consumers[i]);
+			}
+			for (i = 0; i < threads; i++) {
+				producers[i].queue = queue;
+				producers[i].num_msgs = BENCH_AQ_MESSAGES /
+							threads;
+				pthread_create(&producers[i].thread, NULL,
+					       bench_aq_producer,
+					       &producers[i]);
+			}
+
+			for (i = 0; i < threads; i++)
+				pthread_join(producers[i].thread, NULL);
+			for (i = 0; i < threads; i++)
+				ds_async_queue_push(queue, &stop_msg,
+						    sizeof(stop_msg));
+			for (i = 0; i < threads; i++)
+				pthread_join(consumers[i].thread, NULL);
+			ns[r] = io_get_monotonic_ns() - start;
+
+			for (i = 0; i < threads; i++)
+				for (b = 0; b < BENCH_LATENCY_BUCKETS; b++)
+					hist[b] += consumers[i].latency[b];
+
+			ds_async_queue_free(queue);
+		}
+
+		snprintf(params, sizeof(params),
+			 "\"producers\":%u,\"consumers\":%u,"
+			 "\"latency_p50_ns\":%llu,\"latency_p99_ns\":%llu",
+			 threads, threads,
+			 bench_percentile(hist, (unsigned long long)
+					  BENCH_AQ_MESSAGES * BENCH_REPEATS,
+					  50),
+			 bench_percentile(hist, (unsigned long long)
+					  BENCH_AQ_MESSAGES * BENCH_REPEATS,
+					  99));
+		bench_report("ds_async_queue", params,
+			     BENCH_AQ_MESSAGES / threads * threads, 0,
+			     bench_median(ns));
+	}
+}
+
+#define BENCH_AQ_ROUND_TRIPS (32 * 1024)
+
+struct bench_aq_echo {
+	struct ds_async_queue *in;
+	struct ds_async_queue *out;
+	pthread_t thread;
+};
+
+static void *bench_aq_echo(void *arg)
+{
+	struct bench_aq_echo *echo = arg;
+	struct bench_aq_msg *msg;
+	size_t msglen;
+	bool stop;
+
+	do {
+		ds_async_queue_pop(echo->in, (void **)&msg, &msglen);
+		stop = msg->stop;
+		ds_async_queue_push_msg(echo->out, msg, msglen);
+	} while (!stop);
+
+	return NULL;
+}
+
+/* Round trip through two queues, measures wake-up latency of waiting modes */
+static void bench_async_queue_ping_pong(void)
+{
+	static const struct {
+		enum ds_async_queue_wait_mode mode;
+		const char *name;
+	} modes[] = {
+		{ DS_ASYNC_QUEUE_WAIT_PARK, "park" },
+		{ DS_ASYNC_QUEUE_WAIT_SPIN, "spin" },
+		{ DS_ASYNC_QUEUE_WAIT_ADAPTIVE, "adaptive" },
+	};
+	unsigned long long ns[BENCH_REPEATS], start;
+	struct bench_aq_msg msg = { 0, false };
+	struct bench_aq_echo echo;
+	struct bench_aq_msg *reply;
+	unsigned int m, r, i;
+	size_t msglen;
+	char params[64];
+
+	if (!bench_enabled("ds_async_queue_ping_pong"))
+		return;
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			echo.in = ds_async_queue_alloc_sized(1);
+			echo.out = ds_async_queue_alloc_sized(1);
+			if (!echo.in || !echo.out)
+				return;
+
+			ds_async_queue_set_wait_mode(echo.in, modes[m].mode, 0);
+			ds_async_queue_set_wait_mode(echo.out, modes[m].mode,
+						     0);
+			pthread_create(&echo.thread, NULL, bench_aq_echo,
+				       &echo);
+
+			start = io_get_monotonic_ns();
+			for (i = 0; i <= BENCH_AQ_ROUND_TRIPS; i++) {
+				msg.stop = i == BENCH_AQ_ROUND_TRIPS;
+				ds_async_queue_push(echo.in, &msg, sizeof(msg));
+				ds_async_queue_pop(echo.out, (void **)&reply,
+						   &msglen);
+				free(reply);
+			}
+			ns[r] = io_get_monotonic_ns() - start;
+
+			pthread_join(echo.thread, NULL);
+			ds_async_queue_free(echo.in);
+			ds_async_queue_free(echo.out);
+		}
+
+		snprintf(params, sizeof(params), "\"wait_mode\":\"%s\"",
+			 modes[m].name);
+		bench_report("ds_async_queue_ping_pong", params,
+			     BENCH_AQ_ROUND_TRIPS, 0, bench_median(ns));
+	}
+}
+
+/*****************************************************************************
+ * Work-stealing thread pool
+ *****************************************************************************/
+
+#define BENCH_WQ_TASKS (256 * 1024)
+#define BENCH_WQ_SPLIT 64
+
+struct bench_wq_split {
+	struct ds_workqueue *wq;
+	unsigned int num;
+};
+
+static unsigned long long bench_wq_sink;
+
+static void bench_wq_leaf(void *arg)
+{
+	__atomic_add_fetch(&bench_wq_sink, (unsigned long)arg,
+			   __ATOMIC_RELAXED);
+}
+
+/* recursive split, leaves are submitted by workers to own deques */
+static void bench_wq_split_task(void *arg)
+{
+	struct bench_wq_split *split = arg, half;
+	struct ds_wait_group wg;
+
+	if (split->num <= BENCH_WQ_SPLIT || !ds_wait_group_init(&wg)) {
+		bench_wq_leaf((void *)(unsigned long)split->num);
+		return;
+	}
+
+	half.wq = split->wq;
+	half.num = split->num / 2;
+	ds_workqueue_submit(split->wq, bench_wq_split_task, &half, &wg);
+	split->num -= half.num;
+	bench_wq_split_task(split);
+	ds_workqueue_wait(split->wq, &wg);
+	ds_wait_group_free(&wg);
+}
+
+static void bench_workqueue(void)
+{
+	unsigned long long inject_ns[BENCH_REPEATS], split_ns[BENCH_REPEATS];
+	struct ds_workqueue_stats stats;
+	struct bench_wq_split split;
+	struct ds_workqueue *wq;
+	struct ds_wait_group wg;
+	unsigned long long start;
+	unsigned int workers, i, r;
+	char params[128];
+
+	if (!bench_enabled("ds_workqueue"))
+		return;
+
+	for (workers = 1; workers <= 8; workers *= 2) {
+		wq = ds_workqueue_alloc(workers);
+		if (!wq || !ds_wait_group_init(&wg))
+			return;
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			/* tasks submitted from outside of pool */
+			start = io_get_monotonic_ns();
+			for (i = 0; i < BENCH_WQ_TASKS; i++)
+				ds_workqueue_submit(wq, bench_wq_leaf,
+						    (void *)1, &wg);
+			ds_wait_group_wait(&wg);
+			inject_ns[r] = io_get_monotonic_ns() - start;
+
+			/* fork-join inside of pool */
+			split.wq = wq;
+			split.num = BENCH_WQ_TASKS;
+			start = io_get_monotonic_ns();
+			ds_workqueue_submit(wq, bench_wq_split_task, &split,
+					    &wg);
+			ds_wait_group_wait(&wg);
+			split_ns[r] = io_get_monotonic_ns() - start;
+		}
+
+		ds_workqueue_get_stats(wq, &stats);
+		snprintf(params, sizeof(params),
+			 "\"workers\":%u,\"stolen\":%llu,\"parks\":%llu",
+			 workers, stats.stolen, stats.parks);
+		bench_report("ds_workqueue_inject", params, BENCH_WQ_TASKS, 0,
+			     bench_median(inject_ns));
+		bench_report("ds_workqueue_fork_join", params,
+			     BENCH_WQ_TASKS / BENCH_WQ_SPLIT, 0,
+			     bench_median(split_ns));
+
+		ds_wait_group_free(&wg);
+		ds_workqueue_free(wq);
+	}
+}
+
+/*****************************************************************************
+ * Delta coding
+ *****************************************************************************/
+
+#define BENCH_DELTA_VALUES (64 * 1024)
+#define BENCH_DELTA_LOOPS 64
+
+static void bench_delta_scalar_fixed(int32_t *values, unsigned int num_frames,
+				     unsigned int channels, int32_t *prev)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_frames * channels; i++) {
+		values[i] = (int32_t)((uint32_t)prev[i % channels] +
+				      (uint32_t)values[i]);
+		prev[i % channels] = values[i];
+	}
+}
+
+static void bench_delta_scalar(float *values, unsigned int num_frames,
+			       unsigned int channels, float *prev)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_frames * channels; i++) {
+		values[i] += prev[i % channels];
+		prev[i % channels] = values[i];
+	}
+}
+
+/* Prefix-sum decode of fixed-point and float deltas, scalar against kernel */
+static void bench_delta(void)
+{
+	static const unsigned int channels[] = { 1, 2, 8 };
+	static int32_t fixed[BENCH_DELTA_VALUES];
+	static float values[BENCH_DELTA_VALUES];
+	unsigned long long ns[BENCH_REPEATS], start;
+	int32_t fprev[IO_MAX_CHANNELS];
+	float prev[IO_MAX_CHANNELS];
+	unsigned int seed = 1, c, r, l, i, frames, kernel;
+	char params[96];
+
+	if (!bench_enabled("io_delta"))
+		return;
+
+	for (c = 0; c < sizeof(channels) / sizeof(channels[0]); c++) {
+		frames = BENCH_DELTA_VALUES / channels[c];
+
+		for (kernel = 0; kernel < 4; kernel++) {
+			for (r = 0; r < BENCH_REPEATS; r++) {
+				for (i = 0; i < BENCH_DELTA_VALUES; i++) {
+					fixed[i] = bench_random(&seed) % 64;
+					values[i] = fixed[i] / 100.0f;
+				}
+				memset(fprev, 0, sizeof(fprev));
+				memset(prev, 0, sizeof(prev));
+
+				start = io_get_monotonic_ns();
+				for (l = 0; l < BENCH_DELTA_LOOPS; l++) {
+					switch (kernel) {
+					case 0:
+						bench_delta_scalar_fixed(fixed,
+							frames, channels[c],
+							fprev);
+						break;
+					case 1:
+						io_delta_decode_fixed(fixed,
+							frames, channels[c],
+							fprev);
+						break;
+					case 2:
+						bench_delta_scalar(values,
+							frames, channels[c],
+							prev);
+						break;
+					default:
+						io_delta_decode(values, frames,
+							channels[c], prev);
+						break;
+					}
+				}
+				ns[r] = io_get_monotonic_ns() - start;
+			}
+
+			snprintf(params, sizeof(params),
+				 "\"type\":\"%s\",\"impl\":\"%s\","
+				 "\"channels\":%u",
+				 kernel < 2 ? "fixed" : "float",
+				 kernel % 2 ? "kernel" : "scalar",
+				 channels[c]);
+			bench_report("io_delta_decode", params,
+				     (unsigned long long)BENCH_DELTA_VALUES *
+				     BENCH_DELTA_LOOPS,
+				     (unsigned long long)BENCH_DELTA_VALUES *
+				     BENCH_DELTA_LOOPS * 4, bench_median(ns));
+		}
+	}
+
+	if (fixed[0] == 1 && values[0] == 1.0f)
+		printf("{\"bench\":\"io_delta_checksum\"}\n");
+}
+
+/*****************************************************************************
+ * Pacing
+ *****************************************************************************/
+
+#define BENCH_PACE_CHANNELS 64
+#define BENCH_PACE_PERIODS 50
+#define BENCH_PACE_PERIOD_NS 4000000ULL
+
+struct bench_pace_channel {
+	struct io_pacer *pacer;
+	unsigned long long start_ns;
+	unsigned long long overshoot_ns;
+	unsigned long long max_overshoot_ns;
+	pthread_t thread;
+};
+
+static void *bench_pace_channel(void *arg)
+{
+	struct bench_pace_channel *ch = arg;
+	unsigned long long deadline, late;
+	unsigned int i;
+
+	for (i = 1; i <= BENCH_PACE_PERIODS; i++) {
+		deadline = ch->start_ns + i * BENCH_PACE_PERIOD_NS;
+		if (ch->pacer)
+			io_pacer_sleep_until(ch->pacer, deadline);
+		else
+			io_sleep_until_ns(deadline);
+
+		late = io_get_monotonic_ns() - deadline;
+		ch->overshoot_ns += late;
+		if (late > ch->max_overshoot_ns)
+			ch->max_overshoot_ns = late;
+	}
+
+	return NULL;
+}
+
+/* Channels paced at 4ms, each sleeping on its own or through shared pacer */
+static void bench_pacing(void)
+{
+	static struct bench_pace_channel channels[BENCH_PACE_CHANNELS];
+	unsigned long long start, ns, overshoot, max_overshoot;
+	struct io_pacer_stats stats;
+	struct io_pacer *pacer;
+	unsigned int mode, i;
+	char params[192];
+
+	if (!bench_enabled("io_pacing"))
+		return;
+
+	for (mode = 0; mode < 2; mode++) {
+		pacer = NULL;
+		if (mode == 1) {
+			pacer = io_pacer_alloc(0);
+			if (!pacer)
+				return;
+		}
+
+		memset(channels, 0, sizeof(channels));
+		start = io_get_monotonic_ns();
+		for (i = 0; i < BENCH_PACE_CHANNELS; i++) {
+			channels[i].pacer = pacer;
+			channels[i].start_ns = start;
+			pthread_create(&channels[i].thread, NULL,
+				       bench_pace_channel, &channels[i]);
+		}
+
+		overshoot = 0;
+		max_overshoot = 0;
+		for (i = 0; i < BENCH_PACE_CHANNELS; i++) {
+			pthread_join(channels[i].thread, NULL);
+			overshoot += channels[i].overshoot_ns;
+			if (channels[i].max_overshoot_ns > max_overshoot)
+				max_overshoot = channels[i].max_overshoot_ns;
+		}
+		ns = io_get_monotonic_ns() - start;
+
+		memset(&stats, 0, sizeof(stats));
+		if (pacer) {
+			io_pacer_get_stats(pacer, &stats);
+			io_pacer_free(pacer);
+		}
+
+		snprintf(params, sizeof(params),
+			 "\"sleep\":\"%s\",\"channels\":%u,"
+			 "\"overshoot_avg_ns\":%llu,\"overshoot_max_ns\":%llu,"
+			 "\"pacer_wakeups\":%llu",
+			 pacer ? "pacer" : "clock_nanosleep",
+			 BENCH_PACE_CHANNELS, overshoot /
+			 (BENCH_PACE_CHANNELS * BENCH_PACE_PERIODS),
+			 max_overshoot, stats.wakeups);
+		bench_report("io_pacing", params,
+			     BENCH_PACE_CHANNELS * BENCH_PACE_PERIODS, 0, ns);
+	}
+}
+
+/*****************************************************************************
+ * Parser stack
+ *****************************************************************************/
+
+#define BENCH_PARSE_VALUES (1024 * 1024)
+#define BENCH_PARSE_BATCH 4096
+
+static void bench_parse(void)
+{
+	static const char *const files[] = {
+		"test2.ecg", "test2.ecg.delta", "test2.ecg.gz",
+		"test2.ecg.delta.gz",
+	};
+	static float values[BENCH_PARSE_BATCH];
+	unsigned long long ns[BENCH_REPEATS], start, median, bytes = 0;
+	struct io_context *ctx;
+	struct io_stats stats;
+	char filename[128], params[256];
+	unsigned int f, r, i;
+
+	if (!bench_enabled("io_parse"))
+		return;
+
+	ctx = io_context_alloc();
+	if (!ctx)
+		return;
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+
+	for (f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+		snprintf(filename, sizeof(filename), BENCH_DATA_DIR "%s",
+			 files[f]);
+
+		/* input wraps around at end of file */
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			start = io_get_monotonic_ns();
+			io_context_open_txt_file_input(ctx, filename);
+			for (i = 0; i < BENCH_PARSE_VALUES;
+			     i += BENCH_PARSE_BATCH)
+				if (!io_context_get_next_values(ctx, values,
+							BENCH_PARSE_BATCH))
+					break;
+			ns[r] = io_get_monotonic_ns() - start;
+
+			io_context_get_stats(ctx, &stats);
+			bytes = stats.input.bytes_in;
+			io_context_close_input(ctx);
+
+			if (i < BENCH_PARSE_VALUES) {
+				fprintf(stderr, "%s: %s\n", filename,
+					io_get_latest_error());
+				goto out;
+			}
+		}
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"file\":\"%s\",\"input_bytes\":%llu,"
+			 "\"values_per_s\":%.0f", files[f], bytes,
+			 BENCH_PARSE_VALUES * 1e9 / median);
+		bench_report("io_parse", params, BENCH_PARSE_VALUES, bytes,
+			     median);
+	}
+
+out:
+	io_context_free(ctx);
+}
+
+/*
+ * Fixed-point binary file through float values queue and through int16
+ * values queue with int16 output
+ */
+static void bench_sample_i16(void)
+{
+	static int16_t values_i16[BENCH_PARSE_BATCH];
+	static float values[BENCH_PARSE_BATCH];
+	unsigned long long ns[BENCH_REPEATS], start, median;
+	enum io_sample_format format;
+	struct io_context *ctx;
+	char filename[64], params[128];
+	unsigned int r, i, seed;
+	int16_t *frames;
+	bool ok;
+
+	if (!bench_enabled("io_sample_i16"))
+		return;
+
+	snprintf(filename, sizeof(filename), "/tmp/bench_i16_%d.bin",
+		 (int)getpid());
+
+	frames = malloc(BENCH_PARSE_VALUES * sizeof(*frames));
+	if (!frames)
+		return;
+	seed = 1;
+	for (i = 0; i < BENCH_PARSE_VALUES; i++)
+		frames[i] = (int)(bench_random(&seed) % 401) - 200;
+
+	ok = io_save_bin_file_i16(filename, frames, BENCH_PARSE_VALUES, 1,
+				  IO_DEFAULT_SAMPLE_RATE,
+				  IO_BIN_DELTA_VARINT);
+	free(frames);
+	if (!ok)
+		return;
+
+	ctx = io_context_alloc();
+	if (!ctx)
+		goto out;
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+
+	for (format = IO_SAMPLE_FLOAT32; format <= IO_SAMPLE_INT16; format++) {
+		io_context_set_sample_format(ctx, format);
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			start = io_get_monotonic_ns();
+			io_context_open_bin_file_input(ctx, filename);
+			for (i = 0; i < BENCH_PARSE_VALUES;
+			     i += BENCH_PARSE_BATCH) {
+				if (format == IO_SAMPLE_INT16)
+					ok = io_context_get_next_values_i16(
+						ctx, values_i16,
+						BENCH_PARSE_BATCH);
+				else
+					ok = io_context_get_next_values(
+						ctx, values, BENCH_PARSE_BATCH);
+				if (!ok)
+					break;
+			}
+			ns[r] = io_get_monotonic_ns() - start;
+			io_context_close_input(ctx);
+
+			if (i < BENCH_PARSE_VALUES) {
+				fprintf(stderr, "%s: %s\n", filename,
+					io_get_latest_error());
+				goto out;
+			}
+		}
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"queue\":\"%s\",\"values_per_s\":%.0f",
+			 format == IO_SAMPLE_INT16 ? "int16" : "float",
+			 BENCH_PARSE_VALUES * 1e9 / median);
+		bench_report("io_sample_i16", params, BENCH_PARSE_VALUES,
+			     BENCH_PARSE_VALUES * (format == IO_SAMPLE_INT16 ?
+						   sizeof(int16_t) :
+						   sizeof(float)),
+			     median);
+	}
+
+out:
+	io_context_free(ctx);
+	unlink(filename);
+}
+
+/*****************************************************************************
+ * Parallel file load
+ *****************************************************************************/
+
+#define BENCH_LOAD_LINES (1024 * 1024)
+
+/* Delta-encoded interval file of two channels */
+static bool bench_load_write_file(const char *filename)
+{
+	unsigned int seed = 1, i;
+	FILE *file;
+
+	file = fopen(filename, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "#deltaenc\n17543.565 -0.775 0.100\n");
+	for (i = 1; i < BENCH_LOAD_LINES; i++)
+		fprintf(file, "0.00%u %.3f %.3f\n", 3 + i % 3,
+			((int)(bench_random(&seed) % 41) - 20) / 1000.0,
+			((int)(bench_random(&seed) % 41) - 20) / 1000.0);
+
+	return fclose(file) == 0;
+}
+
+/* Serial parse through context compared to io_load_txt_file() */
+static void bench_load(void)
+{
+	static const unsigned int threads[] = { 0, 1, 2, 4, 8 };
+	unsigned long long ns[BENCH_REPEATS], start, median;
+	unsigned int t, r, num_frames = 0, n;
+	struct io_context *ctx;
+	char filename[64], params[128];
+	float *frames = NULL;
+
+	if (!bench_enabled("io_load"))
+		return;
+
+	snprintf(filename, sizeof(filename), "/tmp/bench_load_%d.txt",
+		 (int)getpid());
+	if (!bench_load_write_file(filename))
+		return;
+
+	/* number of frames with default rate */
+	frames = io_load_txt_file(filename, 2, 0, IO_RESAMPLE_LINEAR, 1,
+				  &num_frames);
+	if (!frames) {
+		fprintf(stderr, "%s: %s\n", filename, io_get_latest_error());
+		goto out;
+	}
+	free(frames);
+
+	frames = malloc(num_frames * 2 * sizeof(*frames));
+	ctx = io_context_alloc();
+	if (!frames || !ctx)
+		goto out_ctx;
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_set_channels(ctx, 2);
+
+	/* zero threads is serial parse through context */
+	for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			start = io_get_monotonic_ns();
+			if (threads[t] == 0) {
+				io_context_open_txt_file_input(ctx, filename);
+				io_context_get_next_frames(ctx, frames,
+							   num_frames);
+				io_context_close_input(ctx);
+			} else {
+				free(io_load_txt_file(filename, 2, 0,
+						      IO_RESAMPLE_LINEAR,
+						      threads[t], &n));
+			}
+			ns[r] = io_get_monotonic_ns() - start;
+		}
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"mode\":\"%s\",\"threads\":%u,"
+			 "\"frames_per_s\":%.0f",
+			 threads[t] ? "parallel" : "context", threads[t],
+			 num_frames * 1e9 / median);
+		bench_report("io_load", params, BENCH_LOAD_LINES, 0, median);
+	}
+
+out_ctx:
+	io_context_free(ctx);
+	free(frames);
+out:
+	unlink(filename);
+}
+
+/*****************************************************************************
+ * gzip random access
+ *****************************************************************************/
+
+#define BENCH_GZ_VALUES (2 * 1024 * 1024)
+#define BENCH_GZ_READS 64
+#define BENCH_GZ_READ_LEN 4096
+
+/* Random reads through index compared to decompressing from start of file */
+static void bench_gz_index(void)
+{
+	static const unsigned int spans[] = {
+		256 * 1024, IO_GZ_INDEX_DEFAULT_SPAN, 0,
+	};
+	static unsigned char buf[BENCH_GZ_READ_LEN];
+	unsigned long long ns[BENCH_REPEATS], start, median, length;
+	unsigned int s, r, i, seed, num_points;
+	struct io_gz_index *index;
+	char filename[64], idxname[80], params[128];
+	float *values;
+	int fd;
+
+	if (!bench_enabled("io_gz_index"))
+		return;
+
+	snprintf(filename, sizeof(filename), "/tmp/bench_gz_%d.gz",
+		 (int)getpid());
+	snprintf(idxname, sizeof(idxname), "%s" IO_GZ_INDEX_SUFFIX, filename);
+
+	values = malloc(BENCH_GZ_VALUES * sizeof(*values));
+	if (!values)
+		return;
+	seed = 1;
+	for (i = 0; i < BENCH_GZ_VALUES; i++)
+		values[i] = ((int)(bench_random(&seed) % 401) - 200) / 100.0;
+
+	if (!io_save_gz_txt_file_parallel(filename, values, BENCH_GZ_VALUES,
+					  6, 0)) {
+		free(values);
+		return;
+	}
+	free(values);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		goto out;
+
+	/* zero span is single point at start of file */
+	for (s = 0; s < sizeof(spans) / sizeof(spans[0]); s++) {
+		index = io_gz_index_build(filename, spans[s] ? spans[s] :
+					  0xffffffffU);
+		if (!index) {
+			fprintf(stderr, "%s: %s\n", filename,
+				io_get_latest_error());
+			break;
+		}
+		length = io_gz_index_length(index);
+		num_points = io_gz_index_num_points(index);
+
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			seed = 1;
+			start = io_get_monotonic_ns();
+			for (i = 0; i < BENCH_GZ_READS; i++)
+				io_gz_index_read(index, fd,
+						 bench_random(&seed) % length,
+						 buf, sizeof(buf));
+			ns[r] = io_get_monotonic_ns() - start;
+		}
+		io_gz_index_free(index);
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"span\":%u,\"points\":%u,\"reads_per_s\":%.0f",
+			 spans[s], num_points, BENCH_GZ_READS * 1e9 / median);
+		bench_report("io_gz_index", params, BENCH_GZ_READS,
+			     BENCH_GZ_READS * sizeof(buf), median);
+	}
+
+	close(fd);
+out:
+	unlink(filename);
+	unlink(idxname);
+}
+
+/*****************************************************************************
+ * Pipelined parser stack
+ *****************************************************************************/
+
+#define BENCH_PIPE_VALUES (4 * 1024 * 1024)
+
+static bool bench_pipe_emit_block(struct io_sink *sink, const float *frames,
+				  unsigned int num_frames,
+				  unsigned int channels,
+				  unsigned int channel_id, double time)
+{
+	unsigned long long *num_values = sink->priv;
+
+	*num_values += num_frames * channels;
+	return true;
+}
+
+/*
+ * gzip text file decoded to sink, inflate and text parsing in one thread or
+ * in two pipelined threads
+ */
+static void bench_pipe(void)
+{
+	unsigned long long ns[BENCH_REPEATS], start, median, num_values = 0;
+	struct io_parser *parser;
+	struct io_input *input;
+	struct io_sink sink;
+	char filename[64], params[128];
+	unsigned int r, i, seed, pipelined;
+	float *values;
+	struct stat st;
+
+	if (!bench_enabled("io_pipe"))
+		return;
+
+	snprintf(filename, sizeof(filename), "/tmp/bench_pipe_%d.gz",
+		 (int)getpid());
+
+	values = malloc(BENCH_PIPE_VALUES * sizeof(*values));
+	if (!values)
+		return;
+	seed = 1;
+	for (i = 0; i < BENCH_PIPE_VALUES; i++)
+		values[i] = ((int)(bench_random(&seed) % 401) - 200) / 100.0;
+
+	if (!io_save_gz_txt_file_parallel(filename, values, BENCH_PIPE_VALUES,
+					  6, 0)) {
+		free(values);
+		return;
+	}
+	free(values);
+
+	if (stat(filename, &st) != 0)
+		goto out;
+
+	sink.emit_block = bench_pipe_emit_block;
+	sink.priv = &num_values;
+
+	for (pipelined = 0; pipelined < 2; pipelined++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			parser = io_new_text_parser();
+			if (pipelined)
+				parser = io_new_pipe_parser(parser, 0);
+			parser = io_new_gz_parser(parser);
+			if (!parser)
+				goto out;
+			io_parser_set_sink(parser, &sink, 0);
+
+			num_values = 0;
+			start = io_get_monotonic_ns();
+			input = io_new_file_input(parser, filename);
+			if (!input)
+				goto out;
+			io_input_process_loop(input);
+			ns[r] = io_get_monotonic_ns() - start;
+			io_input_destroy(input);
+
+			if (num_values != BENCH_PIPE_VALUES) {
+				fprintf(stderr, "%s: %s\n", filename,
+					io_get_latest_error());
+				goto out;
+			}
+		}
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"stack\":\"%s\",\"values_per_s\":%.0f",
+			 pipelined ? "gz|pipe|text" : "gz|text",
+			 BENCH_PIPE_VALUES * 1e9 / median);
+		bench_report("io_pipe", params, BENCH_PIPE_VALUES, st.st_size,
+			     median);
+	}
+
+out:
+	unlink(filename);
+}
+
+/*****************************************************************************
+ * time seek
+ *****************************************************************************/
+
+#define BENCH_SEEK_LINES (1024 * 1024)
+#define BENCH_SEEK_SEEKS 16
+
+/* Interval file with absolute timestamps, found by binary search */
+static bool bench_seek_write_file(const char *filename, double *duration)
+{
+	unsigned int seed = 1, i;
+	FILE *file;
+
+	file = fopen(filename, "w");
+	if (!file)
+		return false;
+
+	for (i = 0; i < BENCH_SEEK_LINES; i++)
+		fprintf(file, "%.3f %.3f\n", 17543.565 + i * 0.003,
+			((int)(bench_random(&seed) % 401) - 200) / 100.0);
+
+	*duration = (BENCH_SEEK_LINES - 1) * 0.003;
+
+	return fclose(file) == 0;
+}
+
+/* Random seeks compared to decoding from start of file to same times */
+static void bench_seek(void)
+{
+	static const char * const modes[] = { "seek", "decode" };
+	unsigned long long ns[BENCH_REPEATS], start, median;
+	unsigned int m, r, i, seed;
+	char filename[64], params[128];
+	struct io_context *ctx;
+	double duration;
+	float *frames;
+
+	if (!bench_enabled("io_seek"))
+		return;
+
+	snprintf(filename, sizeof(filename), "/tmp/bench_seek_%d.txt",
+		 (int)getpid());
+	if (!bench_seek_write_file(filename, &duration))
+		goto out;
+
+	frames = malloc(duration * IO_DEFAULT_SAMPLE_RATE * sizeof(*frames));
+	ctx = io_context_alloc();
+	if (!frames || !ctx)
+		goto out_ctx;
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		for (r = 0; r < BENCH_REPEATS; r++) {
+			seed = 1;
+			start = io_get_monotonic_ns();
+			for (i = 0; i < BENCH_SEEK_SEEKS; i++) {
+				double t = (bench_random(&seed) % 1000) *
+					   duration / 1000;
+				unsigned int n = t * IO_DEFAULT_SAMPLE_RATE;
+
+				io_context_open_txt_file_input(ctx, filename);
+				if (m == 0)
+					io_context_seek_time(ctx, t);
+				else if (n > 0)
+					io_context_get_next_frames(ctx, frames,
+								   n);
+				io_context_get_next_frames(ctx, frames, 1);
+				io_context_close_input(ctx);
+			}
+			ns[r] = io_get_monotonic_ns() - start;
+		}
+
+		median = bench_median(ns);
+		snprintf(params, sizeof(params),
+			 "\"mode\":\"%s\",\"lines\":%u,\"ms_per_seek\":%.3f",
+			 modes[m], BENCH_SEEK_LINES,
+			 median / 1e6 / BENCH_SEEK_SEEKS);
+		bench_report("io_seek", params, BENCH_SEEK_SEEKS, 0, median);
+	}
+
+out_ctx:
+	io_context_free(ctx);
+	free(frames);
+out:
+	unlink(filename);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		bench_filter = argv[1];
+
+	bench_append_buffer();
+	bench_lists();
+	bench_list_remove();
+	bench_slab();
+	bench_deque();
+	bench_async_queue();
+	bench_async_queue_ping_pong();
+	bench_workqueue();
+	bench_parse();
+	bench_sample_i16();
+	bench_load();
+	bench_gz_index();
+	bench_pipe();
+	bench_seek();
+	bench_delta();
+	bench_pacing();
+
+	return 0;
+}
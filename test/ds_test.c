@@ -389,6 +389,87 @@ static int ds_linked_list_test(void)
 	return 0;
 }
 
+struct ds_list_test_session {
+	int id;
+	struct ds_list_entry all;
+	struct ds_list_entry active;
+};
+
+static int ds_list_intrusive_test(void)
+{
+	struct ds_list_test_session sessions[64];
+	struct ds_list_test_session *pos, *next;
+	struct ds_linked_list all, active;
+	int i, n;
+
+	ds_list_init(&all);
+	ds_list_init(&active);
+
+	ds_test_assert(ds_list_first_item(&all, struct ds_list_test_session,
+					  all) == NULL);
+	n = 0;
+	ds_list_for_each_item(pos, &all, struct ds_list_test_session, all)
+		n++;
+	ds_test_assert(n == 0);
+
+	for (i = 0; i < 64; i++) {
+		sessions[i].id = i;
+		ds_list_append_entry(&all, &sessions[i].all);
+		ds_list_prepend_entry(&active, &sessions[i].active);
+	}
+	ds_test_assert(ds_list_size(&all) == 64);
+	ds_test_assert(ds_list_size(&active) == 64);
+
+	/* same object on two lists, in different orders */
+	i = 0;
+	ds_list_for_each_item(pos, &all, struct ds_list_test_session, all)
+		ds_test_assert(pos == &sessions[i++]);
+	ds_test_assert(i == 64);
+	i = 63;
+	ds_list_for_each_item(pos, &active, struct ds_list_test_session,
+			      active)
+		ds_test_assert(pos->id == i--);
+	ds_test_assert(i == -1);
+
+	/* direct removal from one list leaves the other intact */
+	ds_list_remove_entry(&active, &sessions[0].active);
+	ds_list_remove_entry(&active, &sessions[63].active);
+	ds_list_remove_entry(&active, &sessions[31].active);
+	ds_test_assert(ds_list_size(&active) == 61);
+	ds_test_assert(ds_list_size(&all) == 64);
+	ds_test_assert(ds_list_first_item(&active, struct ds_list_test_session,
+					  active) == &sessions[62]);
+	ds_test_assert(ds_list_item(ds_list_last(&active),
+				    struct ds_list_test_session,
+				    active) == &sessions[1]);
+
+	/* removal of current item while iterating */
+	ds_list_for_each_item_safe(pos, next, &all,
+				   struct ds_list_test_session, all) {
+		if (pos->id % 2)
+			ds_list_remove_entry(&all, &pos->all);
+	}
+	ds_test_assert(ds_list_size(&all) == 32);
+	i = 0;
+	ds_list_for_each_item(pos, &all, struct ds_list_test_session, all) {
+		ds_test_assert(pos->id == i);
+		i += 2;
+	}
+	ds_test_assert(i == 64);
+
+	ds_list_for_each_item_safe(pos, next, &active,
+				   struct ds_list_test_session, active)
+		ds_list_remove_entry(&active, &pos->active);
+	ds_test_assert(ds_list_empty(&active));
+
+	ds_list_for_each_item_safe(pos, next, &all,
+				   struct ds_list_test_session, all)
+		ds_list_remove_entry(&all, &pos->all);
+	ds_test_assert(ds_list_empty(&all));
+
+	return 0;
+}
+
 static int ds_xor_list_test(void)
 {
 	struct ds_xor_list list;
@@ -729,6 +810,110 @@ static int ds_xor_list_test(void)
 	return 0;
 }
 
+/* Check data of xor list in both directions */
+static bool ds_xor_list_equals(struct ds_xor_list *list,
+			       const unsigned long *data, unsigned int num)
+{
+	struct ds_xorlist_entry *pos, *prev;
+	unsigned int i = 0;
+
+	if (ds_xorlist_size(list) != num)
+		return false;
+
+	ds_xorlist_for_each(prev, pos, list)
+		if (ds_xorlist_entry_data(unsigned long, pos) != data[i++])
+			return false;
+
+	ds_xorlist_for_each_tail(prev, pos, list)
+		if (ds_xorlist_entry_data(unsigned long, pos) != data[--i])
+			return false;
+
+	return true;
+}
+
+static int ds_xor_list_cursor_test(void)
+{
+	static const unsigned long odd[] = { 1, 3, 5, 7, 9 };
+	static const unsigned long inserted[] = { 1, 3, 4, 5, 6, 7, 9 };
+	static const unsigned long removed[] = { 3, 4, 5, 6, 7 };
+	struct ds_xorlist_entry *pos, *entry;
+	struct ds_xorlist_cursor cur;
+	struct ds_xor_list list;
+	unsigned long i;
+
+	ds_xorlist_init(&list);
+
+	/* empty list, cursor stays at ends */
+	ds_test_assert(ds_xorlist_cursor_first(&cur, &list) == NULL);
+	ds_test_assert(ds_xorlist_cursor_next(&cur) == NULL);
+	ds_test_assert(ds_xorlist_cursor_prev(&cur) == NULL);
+	ds_test_assert(ds_xorlist_cursor_remove(&cur) == NULL);
+
+	/* inserting before cursor past end appends */
+	for (i = 1; i <= 10; i++) {
+		ds_new_xorlist_entry(entry, unsigned long, i);
+		ds_test_assert(entry != NULL);
+		ds_xorlist_cursor_insert_before(&cur, entry);
+		ds_test_assert(ds_xorlist_last(&list) == entry);
+	}
+	ds_test_assert(ds_xorlist_size(&list) == 10);
+
+	/* delete while iterating */
+	ds_xorlist_cursor_for_each(&cur, pos, &list)
+		if (ds_xorlist_entry_data(unsigned long, pos) % 2 == 0)
+			ds_xorlist_cursor_delete(&cur);
+	ds_test_assert(ds_xor_list_equals(&list, odd, 5));
+
+	/* backwards past start and forwards again */
+	i = 5;
+	for (pos = ds_xorlist_cursor_last(&cur, &list); pos != NULL;
+	     pos = ds_xorlist_cursor_prev(&cur))
+		ds_test_assert(ds_xorlist_entry_data(unsigned long, pos) ==
+			       odd[--i]);
+	ds_test_assert(i == 0);
+	ds_test_assert(ds_xorlist_cursor_next(&cur) == ds_xorlist_first(&list));
+
+	/* insert around entry at cursor */
+	while (ds_xorlist_entry_data(unsigned long, cur.pos) != 5)
+		ds_xorlist_cursor_next(&cur);
+	ds_new_xorlist_entry(entry, unsigned long, 6);
+	ds_test_assert(entry != NULL);
+	ds_xorlist_cursor_insert_after(&cur, entry);
+	ds_new_xorlist_entry(entry, unsigned long, 4);
+	ds_test_assert(entry != NULL);
+	ds_xorlist_cursor_insert_before(&cur, entry);
+	ds_test_assert(ds_xorlist_entry_data(unsigned long, cur.pos) == 5);
+	ds_test_assert(ds_xorlist_entry_data(unsigned long,
+					     ds_xorlist_cursor_prev(&cur)) == 4);
+	ds_test_assert(ds_xor_list_equals(&list, inserted, 7));
+
+	/* remove head and tail, cursor moves to neighbours */
+	entry = ds_xorlist_cursor_first(&cur, &list);
+	ds_test_assert(ds_xorlist_cursor_remove(&cur) == entry);
+	ds_free(entry);
+	ds_test_assert(ds_xorlist_entry_data(unsigned long,
+					     ds_xorlist_cursor_next(&cur)) == 3);
+	ds_xorlist_cursor_last(&cur, &list);
+	ds_xorlist_cursor_delete(&cur);
+	ds_test_assert(ds_xorlist_entry_data(unsigned long,
+					     ds_xorlist_cursor_prev(&cur)) == 7);
+	ds_test_assert(ds_xorlist_cursor_next(&cur) == NULL);
+	ds_test_assert(ds_xor_list_equals(&list, removed, 5));
+
+	/* inserting after cursor before start prepends */
+	ds_xorlist_cursor_first(&cur, &list);
+	ds_xorlist_cursor_prev(&cur);
+	ds_new_xorlist_entry(entry, unsigned long, 1);
+	ds_test_assert(entry != NULL);
+	ds_xorlist_cursor_insert_after(&cur, entry);
+	ds_test_assert(ds_xorlist_first(&list) == entry);
+	ds_test_assert(ds_xorlist_cursor_next(&cur) == entry);
+
+	ds_xorlist_free(&list);
+
+	return 0;
+}
+
 static int ds_queue_test(void)
 {
 	struct ds_list_entry *pos;
@@ -821,6 +1006,215 @@ static int ds_queue_test(void)
 }
 
 #define NUM_PUSHERS 10
+struct ds_deque_test_record {
+	unsigned long long time;
+	unsigned int id;
+	float value;
+};
+
+static int ds_deque_test(void)
+{
+	struct ds_deque_test_record rec, *pos;
+	struct ds_deque dq;
+	unsigned int i, idx, n;
+	int val;
+
+	ds_test_assert(!ds_deque_init(&dq, 0, 0));
+	ds_test_assert(ds_deque_init(&dq, sizeof(rec), 0));
+	ds_test_assert(dq.capacity == DS_DEQUE_MIN_CAPACITY);
+	ds_test_assert(ds_deque_empty(&dq));
+	ds_test_assert(ds_deque_front(&dq) == NULL);
+	ds_test_assert(ds_deque_back(&dq) == NULL);
+	ds_test_assert(!ds_deque_pop_front(&dq, &rec));
+	ds_test_assert(!ds_deque_pop_back(&dq, &rec));
+
+	/* FIFO through wrap-around and growth */
+	n = 0;
+	for (i = 0; i < 1000; i++) {
+		rec.time = i;
+		rec.id = i * 3;
+		rec.value = i * 0.5f;
+		ds_test_assert(ds_deque_push_data(&dq,
+						  struct ds_deque_test_record,
+						  rec));
+		if (i % 3 == 2) {
+			ds_test_assert(ds_deque_pop_data(&dq,
+					struct ds_deque_test_record, rec));
+			ds_test_assert(rec.time == n);
+			ds_test_assert(rec.id == n * 3);
+			ds_test_assert(rec.value == n * 0.5f);
+			n++;
+		}
+	}
+	ds_test_assert(ds_deque_size(&dq) == 1000 - n);
+	ds_test_assert(dq.capacity == 1024);
+	ds_test_assert(((struct ds_deque_test_record *)
+			ds_deque_front(&dq))->time == n);
+	ds_test_assert(((struct ds_deque_test_record *)
+			ds_deque_back(&dq))->time == 999);
+
+	i = n;
+	ds_deque_for_each(pos, idx, &dq)
+		ds_test_assert(pos->time == i++);
+	ds_test_assert(i == 1000);
+
+	while (ds_deque_pop_front(&dq, &rec))
+		ds_test_assert(rec.time == n++);
+	ds_test_assert(n == 1000);
+	ds_test_assert(ds_deque_empty(&dq));
+	ds_deque_free(&dq);
+
+	/* both ends, growth while wrapped */
+	ds_test_assert(ds_deque_init(&dq, sizeof(int), 4));
+	for (val = 0; val < 10; val++)
+		ds_test_assert(ds_deque_push_back(&dq, &val));
+	for (val = 0; val < 6; val++)
+		ds_test_assert(ds_deque_pop_front(&dq, NULL));
+	for (val = -1; val >= -20; val--)
+		ds_test_assert(ds_deque_push_front(&dq, &val));
+	ds_test_assert(ds_deque_size(&dq) == 24);
+	ds_test_assert(dq.capacity == 32);
+
+	for (i = 0; i < 20; i++)
+		ds_test_assert(*(int *)ds_deque_at(&dq, i) == (int)i - 20);
+	for (i = 20; i < 24; i++)
+		ds_test_assert(*(int *)ds_deque_at(&dq, i) == (int)i - 14);
+
+	ds_test_assert(ds_deque_pop_back(&dq, &val) && val == 9);
+	ds_test_assert(ds_deque_pop_front(&dq, &val) && val == -20);
+	ds_test_assert(ds_deque_reserve(&dq, 100));
+	ds_test_assert(dq.capacity == 128);
+	ds_test_assert(ds_deque_size(&dq) == 22);
+	ds_test_assert(*(int *)ds_deque_front(&dq) == -19);
+	ds_test_assert(*(int *)ds_deque_back(&dq) == 8);
+	ds_test_assert(!ds_deque_reserve(&dq, DS_DEQUE_MAX_CAPACITY));
+
+	ds_deque_clear(&dq);
+	ds_test_assert(ds_deque_empty(&dq));
+	ds_deque_free(&dq);
+
+	/* freed deque grows again on push */
+	val = 5;
+	ds_test_assert(ds_deque_push_back(&dq, &val));
+	ds_test_assert(ds_deque_pop_back(&dq, &val) && val == 5);
+	ds_deque_free(&dq);
+
+	return 0;
+}
+
+DS_DECLARE_QUEUE(ds_test_rec_queue, struct ds_deque_test_record)
+DS_DECLARE_LIST(ds_test_int_list, int)
+DS_DECLARE_RING(ds_test_rec_ring, struct ds_deque_test_record)
+
+static int ds_typed_containers_test(void)
+{
+	struct ds_deque_test_record rec;
+	struct ds_test_rec_queue q;
+	struct ds_test_int_list list;
+	struct ds_test_rec_ring ring;
+	struct ds_list_entry *entry, *next;
+	unsigned int i, n;
+	int val;
+
+	/* queue: FIFO order, peek, pop of empty */
+	ds_test_rec_queue_init(&q);
+	ds_test_assert(!ds_test_rec_queue_pop(&q, &rec));
+	ds_test_assert(!ds_test_rec_queue_peek(&q, &rec));
+	n = 0;
+	for (i = 0; i < 1000; i++) {
+		rec.time = i;
+		rec.id = i * 3;
+		rec.value = i * 0.5f;
+		ds_test_assert(ds_test_rec_queue_push(&q, rec));
+		if (i % 3 == 2) {
+			ds_test_assert(ds_test_rec_queue_peek(&q, &rec));
+			ds_test_assert(rec.time == n);
+			ds_test_assert(ds_test_rec_queue_pop(&q, &rec));
+			ds_test_assert(rec.time == n);
+			ds_test_assert(rec.id == n * 3);
+			ds_test_assert(rec.value == n * 0.5f);
+			n++;
+		}
+	}
+	ds_test_assert(ds_test_rec_queue_size(&q) == 1000 - n);
+
+	/* generic queue functions see same entries */
+	ds_test_assert(ds_queue_peek_data(&q.base, struct ds_deque_test_record,
+					  rec).time == n);
+	while (ds_test_rec_queue_pop(&q, &rec))
+		ds_test_assert(rec.time == n++);
+	ds_test_assert(n == 1000);
+	ds_test_assert(ds_queue_size(&q.base) == 0);
+	ds_test_assert(ds_test_rec_queue_push(&q, rec));
+	ds_test_rec_queue_free(&q);
+	ds_test_assert(ds_test_rec_queue_size(&q) == 0);
+
+	/* list: append/prepend order and deletion */
+	ds_test_int_list_init(&list);
+	for (val = 0; val < 5; val++) {
+		ds_test_assert(ds_test_int_list_append(&list, val));
+		ds_test_assert(ds_test_int_list_prepend(&list, -val - 1));
+	}
+	ds_test_assert(ds_test_int_list_size(&list) == 10);
+
+	val = -5;
+	ds_list_for_each(entry, &list.base) {
+		ds_test_assert(*ds_test_int_list_entry_data(entry) == val);
+		val++;
+	}
+	ds_test_assert(val == 5);
+
+	for (entry = list.base.head; entry != NULL; entry = next) {
+		next = entry->next;
+		if (*ds_test_int_list_entry_data(entry) < 0)
+			ds_test_int_list_delete_entry(&list, entry);
+	}
+	ds_test_assert(ds_test_int_list_size(&list) == 5);
+	ds_test_assert(ds_list_entry_data(int, list.base.head) == 0);
+	ds_test_assert(ds_list_entry_data(int, list.base.tail) == 4);
+	ds_test_int_list_free(&list);
+	ds_test_assert(ds_test_int_list_size(&list) == 0);
+
+	/* ring: both ends through wrap-around and growth */
+	ds_test_assert(ds_test_rec_ring_init(&ring, 4));
+	ds_test_assert(ds_test_rec_ring_empty(&ring));
+	ds_test_assert(!ds_test_rec_ring_pop_front(&ring, &rec));
+	ds_test_assert(!ds_test_rec_ring_pop_back(&ring, &rec));
+	for (i = 0; i < 10; i++) {
+		rec.time = i;
+		ds_test_assert(ds_test_rec_ring_push_back(&ring, rec));
+	}
+	for (i = 0; i < 6; i++)
+		ds_test_assert(ds_test_rec_ring_pop_front(&ring, NULL));
+	for (i = 1; i <= 20; i++) {
+		rec.time = 100 + i;
+		ds_test_assert(ds_test_rec_ring_push_front(&ring, rec));
+	}
+	ds_test_assert(ds_test_rec_ring_size(&ring) == 24);
+	ds_test_assert(ring.base.capacity == 32);
+	for (i = 0; i < 20; i++)
+		ds_test_assert(ds_test_rec_ring_at(&ring, i)->time == 120 - i);
+	for (i = 20; i < 24; i++)
+		ds_test_assert(ds_test_rec_ring_at(&ring, i)->time == i - 14);
+
+	/* generic deque functions see same elements */
+	ds_test_assert(((struct ds_deque_test_record *)
+			ds_deque_back(&ring.base))->time == 9);
+	ds_test_assert(ds_test_rec_ring_pop_back(&ring, &rec) &&
+		       rec.time == 9);
+	ds_test_assert(ds_test_rec_ring_pop_front(&ring, &rec) &&
+		       rec.time == 120);
+	ds_test_assert(ds_test_rec_ring_reserve(&ring, 100));
+	ds_test_assert(ds_test_rec_ring_size(&ring) == 22);
+	ds_test_assert(ds_test_rec_ring_at(&ring, 0)->time == 119);
+
+	ds_test_rec_ring_clear(&ring);
+	ds_test_assert(ds_test_rec_ring_empty(&ring));
+	ds_test_rec_ring_free(&ring);
+
+	return 0;
+}
+
 #define NUM_PUSHS 1024
 static void *ds_async_queue_queue_push_thread(void *__param)
 {
@@ -1005,6 +1399,930 @@ int ds_async_queue_test(void)
 	return 0;
 }
 
+#define BATCH_NUM_PUSHS (64 * 1024)
+#define BATCH_LEN 32
+
+static void *ds_async_queue_batch_push_thread(void *__param)
+{
+	struct ds_async_queue *queue = __param;
+	struct ds_async_queue_msg msgs[BATCH_LEN];
+	unsigned int vals[BATCH_LEN];
+	unsigned int i, j;
+
+	for (i = 0; i < BATCH_NUM_PUSHS; i += BATCH_LEN) {
+		for (j = 0; j < BATCH_LEN; j++) {
+			vals[j] = i + j;
+			msgs[j].msg = &vals[j];
+			msgs[j].msglen = sizeof(vals[j]);
+		}
+
+		ds_async_queue_push_batch(queue, msgs, BATCH_LEN);
+	}
+
+	pthread_exit(NULL);
+}
+
+static unsigned long ds_async_queue_batch_popped;
+
+static void *ds_async_queue_batch_pop_thread(void *__param)
+{
+	struct ds_async_queue *queue = __param;
+	struct ds_async_queue_msg msgs[BATCH_LEN];
+	struct ds_timespec abstime;
+	unsigned long sum = 0;
+	int i, num;
+
+	while (__atomic_load_n(&ds_async_queue_batch_popped, __ATOMIC_RELAXED) <
+					NUM_PUSHERS * BATCH_NUM_PUSHS) {
+		ds_make_timeout_ms(&abstime, 50);
+		num = ds_async_queue_pop_batch_timed(queue, msgs, BATCH_LEN, &abstime);
+		if (num == -ETIMEDOUT)
+			continue;
+
+		__atomic_add_fetch(&ds_async_queue_batch_popped, num, __ATOMIC_RELAXED);
+
+		for (i = 0; i < num; i++) {
+			sum += *(unsigned int *)msgs[i].msg + 1;
+			free(msgs[i].msg);
+		}
+	}
+
+	pthread_exit((void *)sum);
+}
+
+static int ds_async_queue_batch_test(void)
+{
+	struct ds_async_queue *queue;
+	struct ds_async_queue_msg msgs[1500];
+	struct ds_timespec no_timeout = {0, 0};
+	pthread_t threads[NUM_PUSHERS * 2];
+	unsigned int vals[1500];
+	unsigned long sum, expected;
+	int i, ret;
+	void *status;
+
+	/* runtime capacity, rounded up to power of two */
+	ds_test_assert(ds_async_queue_alloc_sized(0) == NULL);
+	queue = ds_async_queue_alloc_sized(1000);
+	ds_test_assert(queue != NULL);
+	ds_test_assert(ds_async_queue_empty(queue));
+
+	for (i = 0; i < 1500; i++) {
+		vals[i] = i;
+		msgs[i].msg = &vals[i];
+		msgs[i].msglen = sizeof(vals[i]);
+	}
+
+	/* batch push fills queue up to capacity */
+	ret = ds_async_queue_push_batch_timed(queue, msgs, 1500, &no_timeout);
+	ds_test_assert(ret == 1024);
+	ret = ds_async_queue_push_batch_timed(queue, msgs, 1500, &no_timeout);
+	ds_test_assert(ret == -ETIMEDOUT);
+	ds_test_assert(ds_async_queue_try_push(queue, "test", sizeof("test")) == -ETIMEDOUT);
+
+	/* batch pop in order */
+	ret = ds_async_queue_pop_batch(queue, msgs, 100);
+	ds_test_assert(ret == 100);
+	for (i = 0; i < 100; i++) {
+		ds_test_assert(msgs[i].msglen == sizeof(unsigned int));
+		ds_test_assert(*(unsigned int *)msgs[i].msg == i);
+		free(msgs[i].msg);
+	}
+	ret = ds_async_queue_pop_batch(queue, msgs, 1500);
+	ds_test_assert(ret == 924);
+	for (i = 0; i < 924; i++) {
+		ds_test_assert(*(unsigned int *)msgs[i].msg == i + 100);
+		free(msgs[i].msg);
+	}
+	ds_test_assert(ds_async_queue_empty(queue));
+	ret = ds_async_queue_pop_batch_timed(queue, msgs, 10, &no_timeout);
+	ds_test_assert(ret == -ETIMEDOUT);
+
+	ds_async_queue_free(queue);
+
+	/* multiple batch pushers and poppers on small queue */
+	queue = ds_async_queue_alloc_sized(64);
+	ds_test_assert(queue != NULL);
+
+	for (i = 0; i < NUM_PUSHERS; i++) {
+		ret = pthread_create(&threads[i], NULL, ds_async_queue_batch_push_thread, queue);
+		ds_test_assert(ret == 0);
+		ret = pthread_create(&threads[i + NUM_PUSHERS], NULL, ds_async_queue_batch_pop_thread, queue);
+		ds_test_assert(ret == 0);
+	}
+
+	sum = 0;
+	for (i = 0; i < NUM_PUSHERS; i++) {
+		ret = pthread_join(threads[i], &status);
+		ds_test_assert(ret == 0);
+	}
+	for (i = 0; i < NUM_PUSHERS; i++) {
+		ret = pthread_join(threads[i + NUM_PUSHERS], &status);
+		ds_test_assert(ret == 0);
+		sum += (unsigned long)status;
+	}
+
+	/* every message was popped exactly once */
+	expected = (unsigned long)BATCH_NUM_PUSHS * (BATCH_NUM_PUSHS + 1) / 2 * NUM_PUSHERS;
+	ds_test_assert(sum == expected);
+	ds_test_assert(ds_async_queue_empty(queue));
+
+	ds_async_queue_free(queue);
+
+	return 0;
+}
+
+static int ds_async_queue_msg_test(void)
+{
+	struct ds_async_queue *queue, *queue2;
+	struct ds_async_queue_msg msgs[4];
+	struct ds_timespec no_timeout = {0, 0};
+	void *msg, *popped;
+	size_t msglen;
+	int i, ret;
+
+	queue = ds_async_queue_alloc_sized(2);
+	ds_test_assert(queue != NULL);
+	queue2 = ds_async_queue_alloc_sized(2);
+	ds_test_assert(queue2 != NULL);
+
+	/* pushed buffer is passed through without copying */
+	msg = ds_async_queue_msg_alloc(4096);
+	ds_test_assert(msg != NULL);
+	memset(msg, 0xaa, 4096);
+	ret = ds_async_queue_try_push_msg(queue, msg, 4096);
+	ds_test_assert(ret == 0);
+	ret = ds_async_queue_try_pop(queue, &popped, &msglen);
+	ds_test_assert(ret == 0);
+	ds_test_assert(popped == msg);
+	ds_test_assert(msglen == 4096);
+
+	/* popped message can be forwarded to another queue */
+	ds_async_queue_push_msg(queue2, popped, msglen);
+	ret = ds_async_queue_try_pop(queue2, &popped, &msglen);
+	ds_test_assert(ret == 0);
+	ds_test_assert(popped == msg);
+	ds_async_queue_msg_free(popped);
+
+	/* caller keeps ownership when queue is full */
+	ds_test_assert(ds_async_queue_try_push(queue, "a", 2) == 0);
+	ds_test_assert(ds_async_queue_try_push(queue, "b", 2) == 0);
+	msg = ds_async_queue_msg_alloc(16);
+	ds_test_assert(msg != NULL);
+	ret = ds_async_queue_push_msg_timed(queue, msg, 16, &no_timeout);
+	ds_test_assert(ret == -ETIMEDOUT);
+	ds_async_queue_msg_free(msg);
+
+	/* batch of buffers, partly pushed */
+	ds_test_assert(ds_async_queue_try_pop(queue, &popped, &msglen) == 0);
+	free(popped);
+	for (i = 0; i < 4; i++) {
+		msgs[i].msg = ds_async_queue_msg_alloc(8);
+		ds_test_assert(msgs[i].msg != NULL);
+		msgs[i].msglen = 8;
+	}
+	ret = ds_async_queue_push_msg_batch_timed(queue, msgs, 4, &no_timeout);
+	ds_test_assert(ret == 1);
+	for (i = ret; i < 4; i++)
+		ds_async_queue_msg_free(msgs[i].msg);
+	ds_test_assert(ds_async_queue_try_pop(queue, &popped, &msglen) == 0);
+	ds_test_assert(strcmp(popped, "b") == 0);
+	free(popped);
+	ds_test_assert(ds_async_queue_try_pop(queue, &popped, &msglen) == 0);
+	ds_test_assert(popped == msgs[0].msg);
+	free(popped);
+
+	/* queued buffers are released with queue */
+	msg = ds_async_queue_msg_alloc(64);
+	ds_async_queue_push_msg(queue, msg, 64);
+	ds_async_queue_free(queue);
+	ds_async_queue_free(queue2);
+
+	return 0;
+}
+
+struct wait_mode_echo {
+	struct ds_async_queue *in;
+	struct ds_async_queue *out;
+};
+
+static void *wait_mode_echo_thread(void *arg)
+{
+	struct wait_mode_echo *echo = arg;
+	size_t msglen;
+	void *msg;
+	int value;
+
+	do {
+		ds_async_queue_pop(echo->in, &msg, &msglen);
+		value = *(int *)msg;
+		ds_async_queue_push_msg(echo->out, msg, msglen);
+	} while (value >= 0);
+
+	return NULL;
+}
+
+static int ds_async_queue_wait_mode_test(void)
+{
+	static const enum ds_async_queue_wait_mode modes[] = {
+		DS_ASYNC_QUEUE_WAIT_PARK,
+		DS_ASYNC_QUEUE_WAIT_SPIN,
+		DS_ASYNC_QUEUE_WAIT_ADAPTIVE,
+	};
+	struct ds_async_queue *ping, *pong;
+	struct wait_mode_echo echo;
+	struct ds_timespec abstime;
+	pthread_t thread;
+	unsigned int m;
+	size_t msglen;
+	void *msg;
+	int i, value;
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		ping = ds_async_queue_alloc_sized(1);
+		ds_test_assert(ping != NULL);
+		pong = ds_async_queue_alloc_sized(1);
+		ds_test_assert(pong != NULL);
+
+		ds_async_queue_set_wait_mode(ping, modes[m], 0);
+		ds_async_queue_set_wait_mode(pong, modes[m], 20000);
+
+		/* empty queue times out also after spinning */
+		ds_test_assert(ds_make_timeout_ms(&abstime, 5) == 0);
+		ds_test_assert(ds_async_queue_pop_timed(pong, &msg, &msglen,
+							&abstime) ==
+			       -ETIMEDOUT);
+
+		echo.in = ping;
+		echo.out = pong;
+		ds_test_assert(pthread_create(&thread, NULL,
+					      wait_mode_echo_thread,
+					      &echo) == 0);
+
+		/* single slot queues, each push waits for previous pop */
+		for (i = 0; i <= 1000; i++) {
+			value = i < 1000 ? i : -1;
+			ds_async_queue_push(ping, &value, sizeof(value));
+			ds_async_queue_pop(pong, &msg, &msglen);
+			ds_test_assert(msglen == sizeof(value));
+			ds_test_assert(*(int *)msg == value);
+			free(msg);
+		}
+
+		pthread_join(thread, NULL);
+
+		ds_test_assert(ds_async_queue_empty(ping));
+		ds_test_assert(ds_async_queue_empty(pong));
+		ds_async_queue_free(ping);
+		ds_async_queue_free(pong);
+	}
+
+	return 0;
+}
+
+#define SPSC_NUM_PUSHS (200 * 1000)
+
+static void *ds_spsc_queue_push_thread(void *__param)
+{
+	struct ds_spsc_queue *queue = __param;
+	unsigned int i;
+
+	for (i = 0; i < SPSC_NUM_PUSHS; i++)
+		ds_spsc_queue_push(queue, &i, sizeof(i));
+
+	pthread_exit(NULL);
+}
+
+static int ds_spsc_queue_test(void)
+{
+	struct ds_spsc_queue *queue;
+	struct ds_timespec abstime, now;
+	pthread_t thread;
+	char msg[16];
+	size_t msglen;
+	unsigned int i, val;
+	int ret;
+
+	/* creation */
+	ds_test_assert(ds_spsc_queue_alloc(0, sizeof(msg)) == NULL);
+	queue = ds_spsc_queue_alloc(5, sizeof(msg));
+	ds_test_assert(queue != NULL);
+	ds_test_assert(ds_spsc_queue_empty(queue));
+
+	/* pushing and poping works? */
+	ret = ds_spsc_queue_try_push(queue, "test", sizeof("test"));
+	ds_test_assert(ret == 0);
+	ds_test_assert(!ds_spsc_queue_empty(queue));
+	ret = ds_spsc_queue_try_pop(queue, msg, &msglen);
+	ds_test_assert(ret == 0);
+	ds_test_assert(msglen == sizeof("test"));
+	ds_test_assert(strcmp(msg, "test") == 0);
+	ds_test_assert(ds_spsc_queue_empty(queue));
+
+	/* too large message */
+	ret = ds_spsc_queue_try_push(queue, "0123456789abcdefg", sizeof("0123456789abcdefg"));
+	ds_test_assert(ret == -EINVAL);
+
+	/* poping on empty queue */
+	ret = ds_spsc_queue_try_pop(queue, msg, &msglen);
+	ds_test_assert(ret == -ETIMEDOUT);
+
+	ret = ds_get_curr_timespec(&now);
+	ds_test_assert(ret == 0);
+	abstime = now;
+	ds_add_timesec_usec(&abstime, 100 * 1000);
+	ret = ds_spsc_queue_pop_timed(queue, msg, &msglen, &abstime);
+	ds_test_assert(ret == -ETIMEDOUT);
+	ret = ds_get_curr_timespec(&now);
+	ds_test_assert(ret == 0);
+	ds_test_assert(now.tv_sec > abstime.tv_sec ||
+		       (now.tv_sec == abstime.tv_sec && now.tv_nsec >= abstime.tv_nsec));
+
+	/* capacity is rounded up to power of two, full queue does not block try_push */
+	for (i = 0; i < 8; i++)
+		ds_test_assert(ds_spsc_queue_try_push(queue, &i, sizeof(i)) == 0);
+	ds_test_assert(ds_spsc_queue_try_push(queue, &i, sizeof(i)) == -ETIMEDOUT);
+	ds_test_assert(ds_make_timeout_ms(&abstime, 50) == 0);
+	ds_test_assert(ds_spsc_queue_push_timed(queue, &i, sizeof(i), &abstime) == -ETIMEDOUT);
+
+	for (i = 0; i < 8; i++) {
+		ds_test_assert(ds_spsc_queue_try_pop(queue, &val, &msglen) == 0);
+		ds_test_assert(msglen == sizeof(val));
+		ds_test_assert(val == i);
+	}
+	ds_test_assert(ds_spsc_queue_empty(queue));
+
+	/* producer thread, messages arrive in order */
+	ret = pthread_create(&thread, NULL, ds_spsc_queue_push_thread, queue);
+	ds_test_assert(ret == 0);
+
+	for (i = 0; i < SPSC_NUM_PUSHS; i++) {
+		ds_spsc_queue_pop(queue, &val, &msglen);
+		ds_test_assert(msglen == sizeof(val));
+		ds_test_assert(val == i);
+	}
+
+	ret = pthread_join(thread, NULL);
+	ds_test_assert(ret == 0);
+	ds_test_assert(ds_spsc_queue_empty(queue));
+
+	ds_spsc_queue_free(queue);
+
+	return 0;
+}
+
+#define SLAB_TEST_THREADS 4
+#define SLAB_TEST_ROUNDS 2000
+
+static void *ds_slab_test_thread(void *arg)
+{
+	struct ds_slab *slab = arg;
+	unsigned int *objs[64];
+	unsigned int r, i;
+
+	/* churn: allocate up to 64 objects, check contents and free */
+	for (r = 0; r < SLAB_TEST_ROUNDS; r++) {
+		for (i = 0; i < 1 + r % 64; i++) {
+			objs[i] = ds_slab_obj_alloc(slab);
+			if (!objs[i])
+				return (void *)1;
+			*objs[i] = r * 64 + i;
+		}
+		while (i-- > 0) {
+			if (*objs[i] != r * 64 + i)
+				return (void *)1;
+			ds_slab_obj_free(slab, objs[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static int ds_slab_test(void)
+{
+	pthread_t threads[SLAB_TEST_THREADS];
+	struct ds_slab_stats stats;
+	struct ds_slab *slab;
+	unsigned char *objs[200];
+	void *ret;
+	unsigned int i, j;
+
+	ds_test_assert(ds_slab_alloc(16, 24) == NULL);
+
+	slab = ds_slab_alloc(20, 32);
+	ds_test_assert(slab != NULL);
+	ds_test_assert(ds_slab_obj_size(slab) == 32);
+
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.chunks == 0);
+	ds_test_assert(stats.objs_in_use == 0);
+
+	for (i = 0; i < 200; i++) {
+		objs[i] = ds_slab_obj_alloc(slab);
+		ds_test_assert(objs[i] != NULL);
+		ds_test_assert(((unsigned long)objs[i] % 32) == 0);
+		memset(objs[i], i, 20);
+	}
+	for (i = 0; i < 200; i++)
+		for (j = 0; j < 20; j++)
+			ds_test_assert(objs[i][j] == (unsigned char)i);
+
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.obj_size == 32);
+	ds_test_assert(stats.chunks >= 1);
+	ds_test_assert(stats.objs_total >= 200);
+	ds_test_assert(stats.objs_in_use == 200);
+	ds_test_assert(stats.magazines == 1);
+	ds_test_assert(stats.footprint >= stats.objs_total * 32);
+
+	/* freed objects are cached and reused */
+	for (i = 0; i < 200; i++)
+		ds_slab_obj_free(slab, objs[i]);
+	ds_slab_obj_free(slab, NULL);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 0);
+	ds_test_assert(stats.objs_free + stats.objs_cached == stats.objs_total);
+	ds_test_assert(stats.objs_cached <= DS_SLAB_MAGAZINE_SIZE);
+	j = stats.chunks;
+
+	for (i = 0; i < 200; i++)
+		objs[i] = ds_slab_obj_alloc(slab);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.chunks == j);
+	ds_test_assert(stats.objs_in_use == 200);
+
+	/* bulk free without returning objects */
+	ds_slab_purge(slab);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.chunks == 0);
+	ds_test_assert(stats.objs_total == 0);
+	ds_test_assert(stats.objs_cached == 0);
+	ds_test_assert(ds_slab_obj_alloc(slab) != NULL);
+
+	ds_slab_free(slab);
+
+	/* magazines of exiting threads return objects to slab */
+	slab = ds_slab_alloc(sizeof(unsigned int), 0);
+	ds_test_assert(slab != NULL);
+	ds_test_assert(ds_slab_obj_size(slab) == sizeof(void *));
+
+	for (i = 0; i < SLAB_TEST_THREADS; i++)
+		ds_test_assert(pthread_create(&threads[i], NULL,
+					      ds_slab_test_thread, slab) == 0);
+	for (i = 0; i < SLAB_TEST_THREADS; i++) {
+		ds_test_assert(pthread_join(threads[i], &ret) == 0);
+		ds_test_assert(ret == NULL);
+	}
+
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.magazines == 0);
+	ds_test_assert(stats.objs_in_use == 0);
+	ds_test_assert(stats.objs_free == stats.objs_total);
+	ds_test_assert(stats.objs_total <= SLAB_TEST_THREADS *
+					   (64 + DS_SLAB_MAGAZINE_SIZE) +
+					   DS_SLAB_CHUNK_BYTES / sizeof(void *));
+
+	ds_slab_free(slab);
+
+	return 0;
+}
+
+static int ds_slab_containers_test(void)
+{
+	struct ds_slab *slab, *tiny;
+	struct ds_slab_stats stats;
+	struct ds_linked_list list;
+	struct ds_xor_list xlist;
+	struct ds_xorlist_entry *xpos, *xprev;
+	struct ds_list_entry *entry;
+	struct ds_queue q;
+	unsigned long i, val;
+
+	slab = ds_slab_alloc(ds_sizeof_list_entry(unsigned long), 0);
+	tiny = ds_slab_alloc(sizeof(struct ds_list_entry), 0);
+	ds_test_assert(slab && tiny);
+
+	/* linked list */
+	ds_list_init(&list);
+	ds_test_assert(!ds_list_set_slab(&list, tiny));
+	ds_test_assert(ds_list_set_slab(&list, slab));
+	for (i = 0; i < 100; i++)
+		ds_test_assert(ds_list_append(&list, (void *)(i + 1)));
+	ds_test_assert(!ds_list_set_slab(&list, NULL));
+
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 100);
+
+	entry = ds_list_find(&list, (void *)50);
+	ds_test_assert(entry != NULL);
+	ds_list_delete_entry(&list, entry);
+	ds_test_assert(ds_list_size(&list) == 99);
+
+	ds_list_purge(&list, NULL);
+	ds_test_assert(ds_list_empty(&list));
+	ds_test_assert(list.slab == slab);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 0);
+
+	/* xor list */
+	ds_xorlist_init(&xlist);
+	ds_test_assert(ds_xorlist_set_slab(&xlist, slab));
+	for (i = 0; i < 100; i++)
+		ds_test_assert(ds_xorlist_prepend(&xlist, (void *)i));
+	i = 100;
+	ds_xorlist_for_each(xprev, xpos, &xlist)
+		ds_test_assert(ds_xorlist_entry_data(void *, xpos) ==
+			       (void *)--i);
+	ds_test_assert(i == 0);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 100);
+	ds_xorlist_free(&xlist);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 0);
+
+	/* queue, data entries must fit slab objects */
+	ds_queue_init(&q);
+	ds_test_assert(ds_queue_set_slab(&q, slab));
+	for (i = 0; i < 100; i++)
+		ds_queue_push_data(&q, unsigned long, i);
+	ds_test_assert(ds_queue_size(&q) == 100);
+	for (i = 0; i < 50; i++) {
+		ds_test_assert(ds_queue_pop_data(&q, unsigned long, val));
+		ds_test_assert(val == i);
+	}
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 50);
+	ds_queue_free(&q);
+	ds_slab_get_stats(slab, &stats);
+	ds_test_assert(stats.objs_in_use == 0);
+
+	memset(&stats, 0, sizeof(stats));
+	ds_queue_push_data(&q, struct ds_slab_stats, stats);
+	ds_test_assert(ds_queue_size(&q) == 0);
+
+	ds_slab_free(tiny);
+	ds_slab_free(slab);
+
+	return 0;
+}
+
+static unsigned long ds_allocator_test_allocs;
+static unsigned long ds_allocator_test_frees;
+
+static void *ds_allocator_test_malloc(size_t size, void *opaque)
+{
+	(*(unsigned long *)opaque)++;
+	ds_allocator_test_allocs++;
+	return malloc(size);
+}
+
+static void *ds_allocator_test_realloc(void *ptr, size_t size, void *opaque)
+{
+	(*(unsigned long *)opaque)++;
+	if (!ptr)
+		ds_allocator_test_allocs++;
+	return realloc(ptr, size);
+}
+
+static void ds_allocator_test_free(void *ptr, void *opaque)
+{
+	(*(unsigned long *)opaque)++;
+	ds_allocator_test_frees++;
+	free(ptr);
+}
+
+static int ds_allocator_test(void)
+{
+	struct ds_allocator allocator;
+	struct ds_append_buffer abuf;
+	struct ds_async_queue *queue;
+	struct ds_linked_list list;
+	unsigned long calls = 0;
+	unsigned char buf[1000];
+	void *msg, *ptr;
+	size_t msglen;
+	int i;
+
+	memset(&allocator, 0, sizeof(allocator));
+	ds_test_assert(!ds_set_allocator(&allocator));
+
+	allocator.malloc = ds_allocator_test_malloc;
+	allocator.realloc = ds_allocator_test_realloc;
+	allocator.free = ds_allocator_test_free;
+	allocator.opaque = &calls;
+	ds_append_buffer_pool_flush();
+	ds_test_assert(ds_set_allocator(&allocator));
+
+	ds_list_init(&list);
+	for (i = 0; i < 10; i++)
+		ds_test_assert(ds_list_append(&list, &list));
+	ds_list_free(&list);
+
+	memset(buf, 0x11, sizeof(buf));
+	ds_append_buffer_init_sized(&abuf, 128, 128);
+	for (i = 0; i < 10; i++)
+		ds_test_assert(ds_append_buffer_append(&abuf, buf,
+						       sizeof(buf)));
+	ds_append_buffer_free(&abuf);
+
+	queue = ds_async_queue_alloc_sized(4);
+	ds_test_assert(queue != NULL);
+	ds_async_queue_push(queue, buf, 10);
+	ds_async_queue_pop(queue, &msg, &msglen);
+	ds_test_assert(msglen == 10);
+	ds_async_queue_msg_free(msg);
+	ds_async_queue_free(queue);
+
+	ptr = ds_aligned_alloc(256, 100);
+	ds_test_assert(ptr != NULL);
+	ds_test_assert(((unsigned long)ptr % 256) == 0);
+	ds_aligned_free(ptr);
+
+	ptr = ds_calloc(10, 10);
+	ds_test_assert(ptr != NULL);
+	ds_test_assert(((unsigned char *)ptr)[99] == 0);
+	ptr = ds_realloc(ptr, 1000);
+	ds_test_assert(ptr != NULL);
+	ds_free(ptr);
+	ds_test_assert(ds_calloc((size_t)-1, 2) == NULL);
+
+	/* pooled pieces were allocated with test allocator */
+	ds_append_buffer_pool_flush();
+	ds_test_assert(ds_set_allocator(NULL));
+
+	ds_test_assert(calls > 0);
+	ds_test_assert(ds_allocator_test_allocs > 0);
+	ds_test_assert(ds_allocator_test_allocs == ds_allocator_test_frees);
+
+	return 0;
+}
+
+#define WORKQUEUE_TEST_TASKS 10000
+
+struct ds_workqueue_test_fib {
+	struct ds_workqueue *wq;
+	unsigned int n;
+	unsigned long result;
+};
+
+static unsigned long ds_workqueue_test_counter;
+
+static void ds_workqueue_test_count(void *arg)
+{
+	__atomic_add_fetch(&ds_workqueue_test_counter, (unsigned long)arg,
+			   __ATOMIC_RELAXED);
+}
+
+/* fork-join, subtasks are pushed to deque of worker and stolen by others */
+static void ds_workqueue_test_fib_task(void *arg)
+{
+	struct ds_workqueue_test_fib *fib = arg, a, b;
+	struct ds_wait_group wg;
+
+	if (fib->n < 2) {
+		fib->result = fib->n;
+		return;
+	}
+
+	a.wq = b.wq = fib->wq;
+	a.n = fib->n - 1;
+	b.n = fib->n - 2;
+
+	if (fib->n < 10 || !ds_wait_group_init(&wg)) {
+		ds_workqueue_test_fib_task(&a);
+		ds_workqueue_test_fib_task(&b);
+	} else {
+		if (!ds_workqueue_submit(fib->wq, ds_workqueue_test_fib_task,
+					 &a, &wg))
+			ds_workqueue_test_fib_task(&a);
+		ds_workqueue_test_fib_task(&b);
+		ds_workqueue_wait(fib->wq, &wg);
+		ds_wait_group_free(&wg);
+	}
+
+	fib->result = a.result + b.result;
+}
+
+static int ds_workqueue_test(void)
+{
+	struct ds_workqueue_test_fib fib;
+	struct ds_workqueue_stats stats;
+	struct ds_workqueue *wq;
+	struct ds_wait_group wg;
+	unsigned long i, expected = 0;
+
+	wq = ds_workqueue_alloc(4);
+	ds_test_assert(wq != NULL);
+	ds_test_assert(ds_workqueue_num_workers(wq) == 4);
+	ds_test_assert(ds_workqueue_current_worker(wq) == -1);
+
+	/* tasks from outside of pool */
+	ds_test_assert(ds_wait_group_init(&wg));
+	for (i = 0; i < WORKQUEUE_TEST_TASKS; i++) {
+		ds_test_assert(ds_workqueue_submit(wq, ds_workqueue_test_count,
+						   (void *)i, &wg));
+		expected += i;
+	}
+	ds_workqueue_wait(wq, &wg);
+	ds_test_assert(ds_wait_group_pending(&wg) == 0);
+	ds_test_assert(__atomic_load_n(&ds_workqueue_test_counter,
+				       __ATOMIC_RELAXED) == expected);
+
+	/* empty wait group does not block */
+	ds_wait_group_wait(&wg);
+	ds_wait_group_free(&wg);
+
+	/* nested tasks waiting for subtasks */
+	fib.wq = wq;
+	fib.n = 24;
+	fib.result = 0;
+	ds_test_assert(ds_wait_group_init(&wg));
+	ds_test_assert(ds_workqueue_submit(wq, ds_workqueue_test_fib_task,
+					   &fib, &wg));
+	ds_wait_group_wait(&wg);
+	ds_wait_group_free(&wg);
+	ds_test_assert(fib.result == 46368);
+
+	ds_workqueue_get_stats(wq, &stats);
+	ds_test_assert(stats.num_workers == 4);
+	ds_test_assert(stats.submitted > WORKQUEUE_TEST_TASKS);
+	ds_test_assert(stats.executed == stats.submitted);
+	ds_test_assert(stats.injected >= WORKQUEUE_TEST_TASKS + 1);
+
+	/* free runs remaining tasks */
+	__atomic_store_n(&ds_workqueue_test_counter, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < 100; i++)
+		ds_test_assert(ds_workqueue_submit(wq, ds_workqueue_test_count,
+						   (void *)1, NULL));
+	ds_workqueue_free(wq);
+	ds_test_assert(__atomic_load_n(&ds_workqueue_test_counter,
+				       __ATOMIC_RELAXED) == 100);
+
+	wq = ds_workqueue_alloc(0);
+	ds_test_assert(wq != NULL);
+	ds_test_assert(ds_workqueue_num_workers(wq) >= 1);
+	ds_workqueue_free(wq);
+
+	return 0;
+}
+
+static int ds_float_ring_test(void)
+{
+	struct ds_float_ring ring;
+	struct ds_float_ring_span spans[2];
+	float in[300], out[300];
+	unsigned int i, num, len, next_in, next_out;
+
+	for (i = 0; i < 300; i++)
+		in[i] = i;
+
+	/* creation, capacity is rounded up with history to power of two */
+	ds_test_assert(!ds_float_ring_init(&ring, 0, 0));
+	ds_test_assert(ds_float_ring_init(&ring, 100, 28));
+	ds_test_assert(ring.capacity == 128);
+	ds_test_assert(((unsigned long)ring.values % DS_FLOAT_RING_ALIGN) == 0);
+	ds_test_assert(ds_float_ring_length(&ring) == 0);
+	ds_test_assert(ds_float_ring_space(&ring) == 100);
+	ds_test_assert(ds_float_ring_get_history(&ring, 10, spans) == 0);
+
+	/* writes stop at capacity, reads are FIFO */
+	ds_test_assert(ds_float_ring_write(&ring, in, 300) == 100);
+	ds_test_assert(ds_float_ring_write(&ring, in, 1) == 0);
+	ds_test_assert(ds_float_ring_read(&ring, out, 60) == 60);
+	for (i = 0; i < 60; i++)
+		ds_test_assert(out[i] == in[i]);
+	ds_test_assert(ds_float_ring_length(&ring) == 40);
+	ds_test_assert(ds_float_ring_space(&ring) == 60);
+
+	/* history keeps last consumed values, space excludes history window */
+	ds_test_assert(ds_float_ring_get_history(&ring, 100, spans) == 28);
+	ds_test_assert(spans[0].len + spans[1].len == 28);
+	ds_test_assert(spans[0].values[0] == 32.0f);
+
+	/* wrap around, peek returns two spans */
+	next_in = 100;
+	next_out = 60;
+	for (i = 0; i < 1000; i++) {
+		len = (i * 7) % 50 + 1;
+		if (len > 300 - next_in % 300)
+			len = 300 - next_in % 300;
+		next_in += ds_float_ring_write(&ring, &in[next_in % 300], len);
+
+		num = ds_float_ring_peek(&ring, (i * 13) % 60 + 1, spans);
+		ds_test_assert(spans[0].len + spans[1].len == num);
+		ds_test_assert(num == 0 ||
+			       spans[0].values[0] == in[next_out % 300]);
+		ds_test_assert(spans[1].len == 0 ||
+			       spans[1].values == ring.values);
+		ds_test_assert(spans[1].len == 0 ||
+			       spans[1].values[0] ==
+					in[(next_out + spans[0].len) % 300]);
+		ds_float_ring_move_head(&ring, num);
+		next_out += num;
+
+		/* history ends at last consumed value */
+		num = ds_float_ring_get_history(&ring, 5, spans);
+		ds_test_assert(num == 5);
+		if (spans[1].len > 0)
+			ds_test_assert(spans[1].values[spans[1].len - 1] ==
+				       in[(next_out - 1) % 300]);
+		else
+			ds_test_assert(spans[0].values[spans[0].len - 1] ==
+				       in[(next_out - 1) % 300]);
+	}
+	ds_test_assert(ds_float_ring_length(&ring) == next_in - next_out);
+
+	/* grow, keeps unread values and history */
+	num = ds_float_ring_length(&ring);
+	ds_test_assert(ds_float_ring_reserve(&ring, 200));
+	ds_test_assert(ring.capacity >= 200 + 28 + num);
+	ds_test_assert(ds_float_ring_length(&ring) == num);
+	ds_test_assert(ds_float_ring_space(&ring) >= 200);
+	ds_test_assert(ds_float_ring_get_history(&ring, 28, spans) == 28);
+	ds_test_assert(spans[1].len == 0);
+	for (i = 0; i < 28; i++)
+		ds_test_assert(spans[0].values[i] ==
+			       in[(next_out - 28 + i) % 300]);
+	ds_test_assert(ds_float_ring_read(&ring, out, num) == num);
+	for (i = 0; i < num; i++)
+		ds_test_assert(out[i] == in[(next_out + i) % 300]);
+
+	/* peek and read clip at unread values */
+	ds_test_assert(ds_float_ring_peek(&ring, 10, spans) == 0);
+	ds_test_assert(ds_float_ring_read(&ring, out, 10) == 0);
+
+	ds_float_ring_clear(&ring);
+	ds_test_assert(ds_float_ring_length(&ring) == 0);
+	ds_test_assert(ds_float_ring_get_history(&ring, 10, spans) == 0);
+	ds_float_ring_free(&ring);
+
+	/* reserve allocates freed ring */
+	ds_test_assert(ds_float_ring_reserve(&ring, 1000));
+	ds_test_assert(ds_float_ring_write(&ring, in, 300) == 300);
+	ds_test_assert(ds_float_ring_read(&ring, out, 300) == 300);
+	ds_test_assert(memcmp(in, out, sizeof(in)) == 0);
+	ds_float_ring_free(&ring);
+
+	return 0;
+}
+
+static int ds_i16_ring_test(void)
+{
+	struct ds_i16_ring ring;
+	struct ds_i16_ring_span spans[2];
+	int16_t in[300], out[300];
+	unsigned int i, num, next_in, next_out;
+
+	for (i = 0; i < 300; i++)
+		in[i] = (int16_t)(i * 100 - 15000);
+
+	ds_test_assert(!ds_i16_ring_init(&ring, 0, 0));
+	ds_test_assert(ds_i16_ring_init(&ring, 100, 28));
+	ds_test_assert(ring.capacity == 128);
+	ds_test_assert(((unsigned long)ring.values % DS_I16_RING_ALIGN) == 0);
+	ds_test_assert(ds_i16_ring_space(&ring) == 100);
+
+	ds_test_assert(ds_i16_ring_write(&ring, in, 300) == 100);
+	ds_test_assert(ds_i16_ring_read(&ring, out, 60) == 60);
+	ds_test_assert(memcmp(in, out, 60 * sizeof(*in)) == 0);
+	ds_test_assert(ds_i16_ring_get_history(&ring, 100, spans) == 28);
+	ds_test_assert(spans[0].values[0] == in[32]);
+
+	/* wrap around */
+	next_in = 100;
+	next_out = 60;
+	for (i = 0; i < 500; i++) {
+		num = (i * 7) % 50 + 1;
+		if (num > 300 - next_in % 300)
+			num = 300 - next_in % 300;
+		next_in += ds_i16_ring_write(&ring, &in[next_in % 300], num);
+
+		num = ds_i16_ring_peek(&ring, (i * 13) % 60 + 1, spans);
+		ds_test_assert(spans[0].len + spans[1].len == num);
+		ds_test_assert(num == 0 ||
+			       spans[0].values[0] == in[next_out % 300]);
+		ds_i16_ring_move_head(&ring, num);
+		next_out += num;
+	}
+
+	/* grow, keeps unread values and history */
+	num = ds_i16_ring_length(&ring);
+	ds_test_assert(ds_i16_ring_reserve(&ring, 200));
+	ds_test_assert(ds_i16_ring_space(&ring) >= 200);
+	ds_test_assert(ds_i16_ring_get_history(&ring, 28, spans) == 28);
+	ds_test_assert(spans[0].values[27] == in[(next_out - 1) % 300]);
+	ds_test_assert(ds_i16_ring_read(&ring, out, num) == num);
+	for (i = 0; i < num; i++)
+		ds_test_assert(out[i] == in[(next_out + i) % 300]);
+
+	ds_i16_ring_clear(&ring);
+	ds_test_assert(ds_i16_ring_length(&ring) == 0);
+	ds_test_assert(ds_i16_ring_get_history(&ring, 10, spans) == 0);
+	ds_i16_ring_free(&ring);
+
+	return 0;
+}
+
 static int ds_append_buffer_test(void)
 {
 	struct ds_append_buffer abuf, abuf2;
@@ -1280,6 +2598,483 @@ static int ds_append_buffer_test(void)
 	ds_test_assert(i == sizeof("0123456789"));
 	ds_append_buffer_free(&abuf);
 
+	/* fixed size pieces, sizes rounded to size class */
+	ds_append_buffer_init_sized(&abuf, 1000, 1000);
+	ds_test_assert(abuf.piece_len == 1024);
+	ds_test_assert(abuf.max_piece_len == 1024);
+	piece_buf = ds_append_buffer_get_write_buffer(&abuf, &buflen);
+	ds_test_assert(piece_buf != NULL);
+	ds_test_assert(buflen > 256 && buflen < 1024);
+	fulllen = buflen;
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, piece_buf, buflen));
+	piece_buf = ds_append_buffer_get_write_buffer(&abuf, &buflen);
+	ds_test_assert(buflen == fulllen);
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, piece_buf, 0));
+	ds_test_assert(ds_append_buffer_length(&abuf) == fulllen);
+	ds_append_buffer_free(&abuf);
+
+	/* sizes are limited to max size class */
+	ds_append_buffer_init_sized(&abuf, 0, 1024 * 1024);
+	ds_test_assert(abuf.piece_len == DS_APPEND_BUFFER_MIN_PIECE_LEN);
+	ds_test_assert(abuf.max_piece_len == DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	ds_append_buffer_free(&abuf);
+
+	/* geometric growth of pieces */
+	ds_append_buffer_init_sized(&abuf, DS_APPEND_BUFFER_MIN_PIECE_LEN,
+				    DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	for (i = 0; i < 100000; i++)
+		ds_test_assert(ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789")) == sizeof("testing_0123456789"));
+	ds_test_assert(ds_append_buffer_length(&abuf) == 100000 * sizeof("testing_0123456789"));
+	ds_test_assert(abuf.piece_len == DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	ds_test_assert(ds_xorlist_size(&abuf.list) < 50);
+	i = ds_append_buffer_copy(&abuf, sizeof("testing_0123456789") * 77777 + sizeof("testing"), buf, sizeof(buf));
+	ds_test_assert(strcmp(buf, "0123456789") == 0);
+	ds_test_assert(i == sizeof(buf));
+	ds_test_assert(ds_append_buffer_move_head(&abuf, sizeof("testing_0123456789") * 99999 + sizeof("testing")));
+	i = ds_append_buffer_copy(&abuf, 0, buf, sizeof(buf));
+	ds_test_assert(strcmp(buf, "0123456789") == 0);
+	ds_test_assert(i == sizeof("0123456789"));
+	ds_append_buffer_move(&abuf2, &abuf);
+	ds_test_assert(abuf.max_piece_len == DS_APPEND_BUFFER_MAX_PIECE_LEN);
+	ds_test_assert(ds_append_buffer_length(&abuf2) == sizeof("0123456789"));
+	ds_append_buffer_clone(&abuf, &abuf2);
+	i = ds_append_buffer_copy(&abuf, 0, buf, sizeof(buf));
+	ds_test_assert(strcmp(buf, "0123456789") == 0);
+	ds_append_buffer_free(&abuf);
+	ds_append_buffer_free(&abuf2);
+
+	return 0;
+}
+
+static void *ds_append_buffer_pool_thread(void *__param)
+{
+	struct ds_append_buffer abuf;
+	int i;
+
+	/* pieces allocated by this thread are released at thread exit */
+	ds_append_buffer_init(&abuf);
+	for (i = 0; i < 100; i++)
+		ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789"));
+	ds_append_buffer_free(&abuf);
+
+	pthread_exit(NULL);
+}
+
+static int ds_append_buffer_pool_test(void)
+{
+	struct ds_append_buffer_pool_stats stats, stats2;
+	struct ds_append_buffer abuf;
+	pthread_t thread;
+	unsigned int i, buflen;
+	void *piece_buf;
+	char buf[20];
+
+	ds_append_buffer_pool_flush();
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.pooled_pieces == 0);
+	ds_test_assert(stats.pooled_bytes == 0);
+
+	/* freed pieces are returned to pool */
+	piece_buf = ds_append_buffer_new_piece(&buflen);
+	ds_test_assert(piece_buf != NULL);
+	ds_append_buffer_free_piece(piece_buf);
+	ds_append_buffer_pool_get_stats(&stats2);
+	ds_test_assert(stats2.releases == stats.releases + 1);
+	ds_test_assert(stats2.pooled_pieces == 1);
+	ds_test_assert(stats2.pooled_bytes == DS_APPEND_BUFFER_MIN_PIECE_LEN);
+
+	/* and reused for next allocation */
+	piece_buf = ds_append_buffer_new_piece(&buflen);
+	ds_test_assert(piece_buf != NULL);
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.hits == stats2.hits + 1);
+	ds_test_assert(stats.pooled_pieces == 0);
+	ds_append_buffer_free_piece(piece_buf);
+
+	/* drain and refill buffer, pieces come from pool */
+	ds_append_buffer_init(&abuf);
+	for (i = 0; i < 100; i++)
+		ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789"));
+	ds_test_assert(ds_append_buffer_move_head(&abuf, ds_append_buffer_length(&abuf)));
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.pooled_pieces > 1);
+	for (i = 0; i < 100; i++)
+		ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789"));
+	ds_append_buffer_pool_get_stats(&stats2);
+	ds_test_assert(stats2.hits >= stats.hits + stats.pooled_pieces);
+	i = ds_append_buffer_copy(&abuf, sizeof("testing_0123456789") * 99 + sizeof("testing"), buf, sizeof(buf));
+	ds_test_assert(strcmp(buf, "0123456789") == 0);
+	ds_append_buffer_free(&abuf);
+
+	/* pool is capped */
+	ds_append_buffer_pool_set_limit(DS_APPEND_BUFFER_MIN_PIECE_LEN * 4);
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.pooled_pieces == 4);
+	ds_append_buffer_pool_set_limit(0);
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.pooled_pieces == 0);
+	piece_buf = ds_append_buffer_new_piece(&buflen);
+	ds_append_buffer_free_piece(piece_buf);
+	ds_append_buffer_pool_get_stats(&stats2);
+	ds_test_assert(stats2.pooled_pieces == 0);
+	ds_test_assert(stats2.frees == stats.frees + 1);
+	ds_append_buffer_pool_set_limit(64 * 1024);
+
+	/* other threads have their own pools */
+	ds_test_assert(pthread_create(&thread, NULL, ds_append_buffer_pool_thread, NULL) == 0);
+	ds_test_assert(pthread_join(thread, NULL) == 0);
+	ds_append_buffer_pool_get_stats(&stats);
+	ds_test_assert(stats.pooled_pieces == 0);
+
+	ds_append_buffer_pool_flush();
+
+	return 0;
+}
+
+static int ds_append_buffer_span_test(void)
+{
+	struct ds_append_buffer abuf;
+	struct ds_append_buffer_iterator iter;
+	struct ds_append_buffer_span spans[8];
+	unsigned int i, n, len, total, buflen;
+	unsigned char *span;
+	void *piece_buf;
+
+	/* empty buffer has no spans */
+	ds_append_buffer_init(&abuf);
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 0, 100, spans, 8) == 0);
+	n = 0;
+	ds_append_buffer_for_each_span(&iter, &abuf, span, len)
+		n++;
+	ds_test_assert(n == 0);
+
+	/* one piece */
+	ds_test_assert(ds_append_buffer_append(&abuf, "0123456789", 10) == 10);
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 0, 100, spans, 8) == 1);
+	ds_test_assert(spans[0].len == 10);
+	ds_test_assert(memcmp(spans[0].data, "0123456789", 10) == 0);
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 3, 5, spans, 8) == 1);
+	ds_test_assert(spans[0].len == 5);
+	ds_test_assert(memcmp(spans[0].data, "34567", 5) == 0);
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 10, 5, spans, 8) == 0);
+	ds_test_assert(ds_append_buffer_move_head(&abuf, 2));
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 0, 100, spans, 8) == 1);
+	ds_test_assert(memcmp(spans[0].data, "23456789", spans[0].len) == 0);
+	ds_test_assert(spans[0].len == 8);
+	ds_append_buffer_free(&abuf);
+
+	/* multiple pieces, spans cover whole range */
+	ds_append_buffer_init(&abuf);
+	for (i = 0; i < 100; i++)
+		ds_test_assert(ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789")) == sizeof("testing_0123456789"));
+	ds_test_assert(ds_append_buffer_move_head(&abuf, 5));
+	n = ds_append_buffer_get_spans(&abuf, 0, ds_append_buffer_length(&abuf), spans, 8);
+	ds_test_assert(n > 1 && n <= 8);
+	for (i = 0, total = 0; i < n; i++)
+		total += spans[i].len;
+	ds_test_assert(n == 8 || total == ds_append_buffer_length(&abuf));
+	ds_test_assert(memcmp(spans[0].data, "ng_0123456789", sizeof("ng_0123456789")) == 0);
+
+	/* range limited by spans array */
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 0, ds_append_buffer_length(&abuf), spans, 1) == 1);
+
+	/* range in middle of buffer */
+	n = ds_append_buffer_get_spans(&abuf, sizeof("testing_0123456789") * 80, sizeof("testing_0123456789") * 5, spans, 8);
+	for (i = 0, total = 0; i < n; i++)
+		total += spans[i].len;
+	ds_test_assert(total == sizeof("testing_0123456789") * 5);
+	ds_test_assert(memcmp(spans[0].data, "ng_01", 5) == 0);
+
+	/* for_each_span visits all data */
+	total = 0;
+	ds_append_buffer_for_each_span(&iter, &abuf, span, len) {
+		ds_test_assert(len > 0);
+		ds_test_assert(span[0] == 'n' || total > 0);
+		total += len;
+	}
+	ds_test_assert(total == ds_append_buffer_length(&abuf));
+	ds_append_buffer_free(&abuf);
+
+	/* empty trailing piece is not returned as span */
+	ds_append_buffer_init(&abuf);
+	do {
+		piece_buf = ds_append_buffer_get_write_buffer(&abuf, &buflen);
+		ds_test_assert(piece_buf != NULL);
+		memset(piece_buf, 'a', buflen);
+		ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, piece_buf, buflen));
+	} while (ds_append_buffer_length(&abuf) < 1000);
+	piece_buf = ds_append_buffer_get_write_buffer(&abuf, &buflen);
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, piece_buf, 0));
+	total = 0;
+	n = 0;
+	ds_append_buffer_for_each_span(&iter, &abuf, span, len) {
+		ds_test_assert(len > 0);
+		total += len;
+		n++;
+	}
+	ds_test_assert(total == ds_append_buffer_length(&abuf));
+	ds_test_assert(ds_append_buffer_get_spans(&abuf, 0, total + 1, spans, 8) == n);
+	ds_append_buffer_free(&abuf);
+
+	return 0;
+}
+
+static void ds_test_release_external(void *opaque, void *data,
+				     unsigned int len)
+{
+	unsigned int *released = opaque;
+
+	*released += len;
+}
+
+static int ds_append_buffer_external_test(void)
+{
+	static char ext1[1000], ext2[100000];
+	struct ds_append_buffer abuf, abuf2;
+	struct ds_append_buffer_iterator iter;
+	struct ds_append_buffer_span spans[8];
+	unsigned int i, n, len, released = 0;
+	unsigned char buf[64];
+	unsigned char *span;
+
+	for (i = 0; i < sizeof(ext1); i++)
+		ext1[i] = 'a' + i % 26;
+	for (i = 0; i < sizeof(ext2); i++)
+		ext2[i] = '0' + i % 10;
+
+	/* external pieces between copied data, not copied to buffer */
+	ds_append_buffer_init(&abuf);
+	ds_test_assert(ds_append_buffer_enable_index(&abuf));
+	ds_test_assert(ds_append_buffer_append(&abuf, "head", 4) == 4);
+	ds_test_assert(ds_append_buffer_append_external(&abuf, ext1, sizeof(ext1), ds_test_release_external, &released));
+	ds_test_assert(ds_append_buffer_append_external(&abuf, ext2, sizeof(ext2), ds_test_release_external, &released));
+	ds_test_assert(ds_append_buffer_append(&abuf, "tail", 4) == 4);
+	ds_test_assert(ds_append_buffer_length(&abuf) == 8 + sizeof(ext1) + sizeof(ext2));
+
+	n = ds_append_buffer_get_spans(&abuf, 0, ds_append_buffer_length(&abuf), spans, 8);
+	ds_test_assert(n == 4);
+	ds_test_assert(spans[1].data == ext1 && spans[1].len == sizeof(ext1));
+	ds_test_assert(spans[2].data == ext2 && spans[2].len == sizeof(ext2));
+
+	/* reads across piece boundaries */
+	ds_test_assert(ds_append_buffer_copy(&abuf, 2, buf, 4) == 4);
+	ds_test_assert(memcmp(buf, "adab", 4) == 0);
+	ds_test_assert(ds_append_buffer_copy(&abuf, 4 + sizeof(ext1) + sizeof(ext2) - 2, buf, 6) == 6);
+	ds_test_assert(memcmp(buf, "89tail", 6) == 0);
+	ds_append_buffer_iterator_seek(&abuf, &iter, 4 + sizeof(ext1) + 12345);
+	ds_test_assert(ds_append_buffer_iterator_byte(&iter) == '5');
+	len = 0;
+	ds_append_buffer_for_each_span(&iter, &abuf, span, n)
+		len += n;
+	ds_test_assert(len == ds_append_buffer_length(&abuf));
+
+	/* clone owns copy of external data */
+	ds_test_assert(ds_append_buffer_clone(&abuf2, &abuf));
+	ds_test_assert(ds_append_buffer_get_spans(&abuf2, 4, sizeof(ext1), spans, 8) == 1);
+	ds_test_assert(spans[0].data != ext1);
+	ds_test_assert(memcmp(spans[0].data, ext1, sizeof(ext1)) == 0);
+	ds_append_buffer_free(&abuf2);
+	ds_test_assert(released == 0);
+
+	/* released when head moves past */
+	ds_test_assert(ds_append_buffer_move_head(&abuf, 4 + 10));
+	ds_test_assert(released == 0);
+	ds_test_assert(ds_append_buffer_move_head(&abuf, sizeof(ext1)));
+	ds_test_assert(released == sizeof(ext1));
+	ds_test_assert(ds_append_buffer_copy(&abuf, 0, buf, 2) == 2);
+	ds_test_assert(memcmp(buf, "01", 2) == 0);
+	ds_append_buffer_free(&abuf);
+	ds_test_assert(released == sizeof(ext1) + sizeof(ext2));
+
+	/* new data after external piece is not written to external memory */
+	released = 0;
+	ds_append_buffer_init(&abuf);
+	ds_test_assert(ds_append_buffer_append_external(&abuf, ext1, 10, ds_test_release_external, &released));
+	span = ds_append_buffer_get_end_free(&abuf, &len);
+	ds_test_assert(span == NULL && len == 0);
+	span = ds_append_buffer_get_write_buffer(&abuf, &len);
+	ds_test_assert(span != NULL && (char *)span != ext1 + 10);
+	memcpy(span, "xy", 2);
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, span, 2));
+	ds_test_assert(ds_append_buffer_copy(&abuf, 9, buf, 3) == 3);
+	ds_test_assert(memcmp(buf, "jxy", 3) == 0);
+	ds_test_assert(ext1[10] == 'k');
+	ds_append_buffer_free(&abuf);
+	ds_test_assert(released == 10);
+
+	return 0;
+}
+
+static int ds_append_buffer_splice_test(void)
+{
+	static unsigned char ref[20000], out[20000];
+	static char ext[5000];
+	struct ds_append_buffer dst, src;
+	struct ds_append_buffer_iterator iter;
+	struct ds_append_buffer_span spans[64];
+	unsigned int i, n, released = 0;
+
+	for (i = 0; i < sizeof(ref); i++)
+		ref[i] = i * 7 + i / 256;
+	for (i = 0; i < sizeof(ext); i++)
+		ext[i] = i % 101;
+
+	/* partially consumed source, destination with data */
+	ds_append_buffer_init_sized(&dst, 256, 4096);
+	ds_append_buffer_init_sized(&src, 256, 4096);
+	ds_test_assert(ds_append_buffer_enable_index(&dst));
+	ds_test_assert(ds_append_buffer_append(&dst, ref, 3000) == 3000);
+	ds_test_assert(ds_append_buffer_append(&src, ref, 10000) == 10000);
+	ds_test_assert(ds_append_buffer_append_external(&src, ext, sizeof(ext), ds_test_release_external, &released));
+	ds_test_assert(ds_append_buffer_move_head(&src, 300));
+
+	ds_test_assert(ds_append_buffer_splice(&dst, &src) == 9700 + sizeof(ext));
+	ds_test_assert(ds_append_buffer_length(&src) == 0);
+	ds_test_assert(ds_append_buffer_length(&dst) == 3000 + 9700 + sizeof(ext));
+
+	ds_test_assert(ds_append_buffer_copy(&dst, 0, out, 3000) == 3000);
+	ds_test_assert(memcmp(out, ref, 3000) == 0);
+	ds_test_assert(ds_append_buffer_copy(&dst, 3000, out, 9700) == 9700);
+	ds_test_assert(memcmp(out, ref + 300, 9700) == 0);
+	ds_append_buffer_iterator_seek(&dst, &iter, 3000 + 9700 + 1234);
+	ds_test_assert(ds_append_buffer_iterator_byte(&iter) == ext[1234]);
+
+	/* external piece was moved, not copied */
+	n = ds_append_buffer_get_spans(&dst, 3000 + 9700, sizeof(ext), spans, 64);
+	ds_test_assert(n == 1 && spans[0].data == ext);
+	ds_test_assert(released == 0);
+
+	/* both buffers stay usable */
+	ds_test_assert(ds_append_buffer_append(&src, "ab", 2) == 2);
+	ds_test_assert(ds_append_buffer_append(&dst, "cd", 2) == 2);
+	ds_test_assert(ds_append_buffer_copy(&dst, ds_append_buffer_length(&dst) - 3, out, 3) == 3);
+	ds_test_assert(out[0] == ext[sizeof(ext) - 1] && memcmp(out + 1, "cd", 2) == 0);
+
+	/* empty destination takes first piece with offset */
+	ds_test_assert(ds_append_buffer_move_head(&dst, ds_append_buffer_length(&dst)));
+	ds_test_assert(released == sizeof(ext));
+	ds_test_assert(ds_append_buffer_append(&src, ref, 5000) == 5000);
+	ds_test_assert(ds_append_buffer_move_head(&src, 1));
+	ds_test_assert(ds_append_buffer_splice(&dst, &src) == 5001);
+	ds_test_assert(ds_append_buffer_copy(&dst, 0, out, 5001) == 5001);
+	ds_test_assert(out[0] == 'b' && memcmp(out + 1, ref, 5000) == 0);
+
+	/* empty source */
+	ds_test_assert(ds_append_buffer_splice(&dst, &src) == 0);
+	ds_test_assert(ds_append_buffer_length(&dst) == 5001);
+
+	ds_append_buffer_free(&dst);
+	ds_append_buffer_free(&src);
+
+	return 0;
+}
+
+static int ds_append_buffer_index_test(void)
+{
+	struct ds_append_buffer abuf, abuf2, abuf3;
+	struct ds_append_buffer_iterator iter, iter2;
+	unsigned char buf[300], buf2[300];
+	unsigned int i, j, len, offset, buflen;
+	void *piece_buf;
+
+	/* indexed and plain buffers with same content */
+	ds_append_buffer_init_sized(&abuf, 256, 4096);
+	ds_append_buffer_init_sized(&abuf2, 256, 4096);
+	ds_test_assert(ds_append_buffer_enable_index(&abuf));
+	ds_test_assert(abuf.index != NULL);
+	ds_test_assert(ds_append_buffer_enable_index(&abuf));
+
+	for (i = 0; i < 20000; i++) {
+		for (j = 0; j < 7; j++)
+			buf[j] = i * 7 + j;
+		ds_test_assert(ds_append_buffer_append(&abuf, buf, 7) == 7);
+		ds_test_assert(ds_append_buffer_append(&abuf2, buf, 7) == 7);
+
+		/* move head now and then */
+		if (i % 1000 == 999) {
+			offset = (i * 31) % 3001;
+			ds_test_assert(ds_append_buffer_move_head(&abuf, offset));
+			ds_test_assert(ds_append_buffer_move_head(&abuf2, offset));
+		}
+	}
+	ds_test_assert(ds_append_buffer_length(&abuf) == ds_append_buffer_length(&abuf2));
+
+	/* direct write pieces are indexed too */
+	piece_buf = ds_append_buffer_get_write_buffer(&abuf, &buflen);
+	memset(piece_buf, 0xaa, buflen);
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf, piece_buf, buflen));
+	piece_buf = ds_append_buffer_get_write_buffer(&abuf2, &buflen);
+	memset(piece_buf, 0xaa, buflen);
+	ds_test_assert(ds_append_buffer_finish_write_buffer(&abuf2, piece_buf, buflen));
+	piece_buf = ds_append_buffer_new_piece(&buflen);
+	memset(piece_buf, 0x55, buflen);
+	ds_test_assert(ds_append_buffer_append_piece(&abuf, piece_buf, buflen));
+	piece_buf = ds_append_buffer_new_piece(&buflen);
+	memset(piece_buf, 0x55, buflen);
+	ds_test_assert(ds_append_buffer_append_piece(&abuf2, piece_buf, buflen));
+
+	/* random offset reads match */
+	len = ds_append_buffer_length(&abuf);
+	ds_test_assert(len == ds_append_buffer_length(&abuf2));
+	for (i = 0; i < 1000; i++) {
+		offset = (i * 2654435761u) % (len + 100);
+		ds_test_assert(ds_append_buffer_copy(&abuf, offset, buf, sizeof(buf)) ==
+			       ds_append_buffer_copy(&abuf2, offset, buf2, sizeof(buf2)));
+		ds_test_assert(memcmp(buf, buf2, offset < len ? (len - offset < sizeof(buf) ? len - offset : sizeof(buf)) : 0) == 0);
+
+		ds_append_buffer_iterator_seek(&abuf, &iter, offset);
+		ds_append_buffer_iterator_init(&abuf2, &iter2);
+		ds_append_buffer_iterator_forward(&iter2, offset);
+		ds_test_assert(ds_append_buffer_iterator_has_reached_end(&iter) ==
+			       ds_append_buffer_iterator_has_reached_end(&iter2));
+		if (ds_append_buffer_iterator_has_reached_end(&iter))
+			continue;
+		ds_test_assert(ds_append_buffer_iterator_pos(&iter) == offset);
+		ds_test_assert(ds_append_buffer_iterator_byte(&iter) == buf2[0]);
+
+		/* iterating from seek position crosses pieces correctly */
+		ds_append_buffer_iterator_forward(&iter, 299);
+		ds_append_buffer_iterator_forward(&iter2, 299);
+		ds_test_assert(ds_append_buffer_iterator_has_reached_end(&iter) ==
+			       ds_append_buffer_iterator_has_reached_end(&iter2));
+		if (!ds_append_buffer_iterator_has_reached_end(&iter))
+			ds_test_assert(ds_append_buffer_iterator_byte(&iter) == buf2[299]);
+	}
+
+	/* clone keeps own index */
+	ds_test_assert(ds_append_buffer_clone(&abuf3, &abuf));
+	ds_test_assert(abuf3.index != NULL && abuf3.index != abuf.index);
+	ds_test_assert(ds_append_buffer_copy(&abuf3, len / 2, buf, sizeof(buf)) == sizeof(buf));
+	ds_test_assert(ds_append_buffer_copy(&abuf2, len / 2, buf2, sizeof(buf2)) == sizeof(buf2));
+	ds_test_assert(memcmp(buf, buf2, sizeof(buf)) == 0);
+	ds_append_buffer_free(&abuf3);
+	ds_test_assert(abuf3.index == NULL);
+
+	/* moving head to end keeps index for refilled buffer */
+	ds_test_assert(ds_append_buffer_move_head(&abuf, len));
+	ds_test_assert(abuf.index != NULL);
+	ds_test_assert(ds_append_buffer_move_head(&abuf2, len));
+	for (i = 0; i < 1000; i++) {
+		ds_test_assert(ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789")) == sizeof("testing_0123456789"));
+		ds_test_assert(ds_append_buffer_move_head(&abuf, 3));
+	}
+	ds_test_assert(ds_append_buffer_copy(&abuf, ds_append_buffer_length(&abuf) - sizeof("0123456789"), buf, sizeof(buf)) == sizeof("0123456789"));
+	ds_test_assert(strcmp((char *)buf, "0123456789") == 0);
+
+	ds_append_buffer_free(&abuf);
+	ds_append_buffer_free(&abuf2);
+	ds_test_assert(abuf.index == NULL);
+
+	/* enabling index on non-empty buffer */
+	ds_append_buffer_init(&abuf);
+	for (i = 0; i < 100; i++)
+		ds_test_assert(ds_append_buffer_append(&abuf, "testing_0123456789", sizeof("testing_0123456789")) == sizeof("testing_0123456789"));
+	ds_test_assert(ds_append_buffer_move_head(&abuf, 5));
+	ds_test_assert(ds_append_buffer_enable_index(&abuf));
+	ds_test_assert(ds_append_buffer_copy(&abuf, sizeof("testing_0123456789") * 77 + 3, buf, sizeof(buf)) == sizeof(buf));
+	ds_test_assert(strcmp((char *)buf, "0123456789") == 0);
+	ds_append_buffer_free(&abuf);
+
 	return 0;
 }
 
@@ -1305,10 +3100,29 @@ int main(int argc, char *argv[])
 {
 	run_test("ds_basic", ds_basic_test);
 	run_test("ds_linked_list", ds_linked_list_test);
+	run_test("ds_list_intrusive", ds_list_intrusive_test);
 	run_test("ds_xor_list", ds_xor_list_test);
+	run_test("ds_xor_list_cursor", ds_xor_list_cursor_test);
 	run_test("ds_append_buffer", ds_append_buffer_test);
+	run_test("ds_append_buffer_pool", ds_append_buffer_pool_test);
+	run_test("ds_append_buffer_span", ds_append_buffer_span_test);
+	run_test("ds_append_buffer_index", ds_append_buffer_index_test);
+	run_test("ds_append_buffer_external", ds_append_buffer_external_test);
+	run_test("ds_append_buffer_splice", ds_append_buffer_splice_test);
 	run_test("ds_queue", ds_queue_test);
+	run_test("ds_deque", ds_deque_test);
+	run_test("ds_typed_containers", ds_typed_containers_test);
 	run_test("ds_async_queue", ds_async_queue_test);
+	run_test("ds_async_queue_batch", ds_async_queue_batch_test);
+	run_test("ds_async_queue_msg", ds_async_queue_msg_test);
+	run_test("ds_async_queue_wait_mode", ds_async_queue_wait_mode_test);
+	run_test("ds_spsc_queue", ds_spsc_queue_test);
+	run_test("ds_workqueue", ds_workqueue_test);
+	run_test("ds_float_ring", ds_float_ring_test);
+	run_test("ds_i16_ring", ds_i16_ring_test);
+	run_test("ds_slab", ds_slab_test);
+	run_test("ds_slab_containers", ds_slab_containers_test);
+	run_test("ds_allocator", ds_allocator_test);
 
 	return 0;
 }
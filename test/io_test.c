@@ -0,0 +1,2772 @@
+/*
+ * Copyright © 2012-2013 Jussi Kivilinna <jussi.kivilinna@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "io.h"
+
+#define IO_TEST_DATA_DIR "share/io_test/"
+
+static int __io_test_assert(const bool check, const int line, const char *check_str)
+{
+	if (__builtin_expect(!!check, 1))
+		return 0;
+
+	printf("[ASSERT FAILED!]\n"
+		"\tline %d: Assertion `%s' failed.\n", line, check_str);
+	fflush(stdout);
+	fflush(stderr);
+
+	return -1;
+}
+
+#define io_test_assert(should_be_true) do { \
+		int __ret = __io_test_assert(should_be_true, __LINE__, #should_be_true); \
+		if (__builtin_expect(__ret < 0, 0)) \
+			return __ret; \
+	} while(false)
+
+/* Read @num_values from file through global input, all with one call. */
+static bool read_file_values(const char *filename, float *values,
+			     unsigned int num_values)
+{
+	bool ret;
+
+	io_open_txt_file_input(filename);
+	ret = io_main_queue_get_next_values(values, num_values);
+	io_close_main_input();
+
+	return ret;
+}
+
+/* Read 4ms fixed interval file with plain stdio for reference values */
+static unsigned int read_reference_values(const char *filename, float *values,
+					  unsigned int num_values)
+{
+	unsigned int i;
+	FILE *file;
+	float value;
+
+	file = fopen(filename, "r");
+	if (!file)
+		return 0;
+
+	for (i = 0; i < num_values && fscanf(file, "%f", &value) == 1; i++)
+		values[i] = roundf(value * 100.0f) / 100;
+
+	fclose(file);
+
+	return i;
+}
+
+static int io_txt_file_test(void)
+{
+	static float values[2000], ref[2000];
+	unsigned int i;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	/* plain text file */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg", values,
+					2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* delta-encoded text file */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg.delta",
+					values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+
+	/* short file without newline at end, read past end wraps around */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR
+					"file_with_no_newline_at_end.ecg",
+					values, 4));
+	for (i = 0; i < 4; i++)
+		io_test_assert(values[i] == (float)i);
+
+	return 0;
+}
+
+static int io_date_interval_file_test(void)
+{
+	static float values[2000], ref[1100];
+	static double times[1100];
+	char line[128];
+	unsigned int i, j = 0, num = 0;
+	float second, ecg1, ecg2;
+	double t, expected;
+	int minute;
+	FILE *file;
+
+	/* PhysioBank export, ~8ms interval in mm:ss.mmm format */
+	file = fopen(IO_TEST_DATA_DIR "physio-bank-sample1.txt", "r");
+	io_test_assert(file != NULL);
+	while (num < 1100 && fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%d:%f %f %f", &minute, &second, &ecg1,
+			   &ecg2) == 4) {
+			times[num] = minute * 60.0 + second;
+			ref[num++] = ecg1;
+		}
+	}
+	fclose(file);
+	io_test_assert(num == 1100);
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR
+					"physio-bank-sample1.txt", values,
+					2000));
+
+	/* values are linearly interpolated to 4ms interval */
+	for (i = 0; i < 2000; i++) {
+		t = times[0] + i * 0.004;
+		while (times[j + 1] < t)
+			j++;
+
+		expected = ref[j] + (ref[j + 1] - ref[j]) * (t - times[j]) /
+			   (times[j + 1] - times[j]);
+		io_test_assert(fabs(values[i] - expected) < 0.011);
+	}
+
+	return 0;
+}
+
+static int io_channels_test(void)
+{
+	static float single[2000], frames[2000 * 2], soa[2][2000];
+	static float ref[1100];
+	static double times[1100];
+	float *channels[3] = { soa[0], soa[1], single };
+	struct io_context *ctx;
+	char line[128];
+	unsigned int i, j = 0, num = 0;
+	float second, ecg1, ecg2;
+	double t, expected;
+	int minute;
+	FILE *file;
+
+	file = fopen(IO_TEST_DATA_DIR "physio-bank-sample1.txt", "r");
+	io_test_assert(file != NULL);
+	while (num < 1100 && fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%d:%f %f %f", &minute, &second, &ecg1,
+			   &ecg2) == 4) {
+			times[num] = minute * 60.0 + second;
+			ref[num++] = ecg2;
+		}
+	}
+	fclose(file);
+	io_test_assert(num == 1100);
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR
+					"physio-bank-sample1.txt", single,
+					2000));
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_test_assert(!io_context_set_channels(ctx, 0));
+	io_test_assert(!io_context_set_channels(ctx, IO_MAX_CHANNELS + 1));
+	io_test_assert(io_context_set_channels(ctx, 2));
+
+	/* interleaved frames, first channel equals single channel decoding */
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR
+				       "physio-bank-sample1.txt");
+	io_test_assert(io_context_get_channels(ctx) == 2);
+	io_test_assert(io_context_get_next_frames(ctx, frames, 2000));
+	for (i = 0; i < 2000; i++) {
+		io_test_assert(frames[i * 2] == single[i]);
+
+		/* second column is interpolated like first one */
+		t = times[0] + i * 0.004;
+		while (times[j + 1] < t)
+			j++;
+
+		expected = ref[j] + (ref[j + 1] - ref[j]) * (t - times[j]) /
+			   (times[j + 1] - times[j]);
+		io_test_assert(fabs(frames[i * 2 + 1] - expected) < 0.011);
+	}
+
+	/* array per channel, channels beyond input are zero */
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR
+				       "physio-bank-sample1.txt");
+	io_test_assert(io_context_get_next_frames_soa(ctx, channels, 3, 2000));
+	for (i = 0; i < 2000; i++) {
+		io_test_assert(soa[0][i] == frames[i * 2]);
+		io_test_assert(soa[1][i] == frames[i * 2 + 1]);
+		io_test_assert(single[i] == 0.0f);
+	}
+
+	/* single column file, missing column is zero */
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_context_get_next_frames(ctx, frames, 2000));
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg", single,
+					2000));
+	for (i = 0; i < 2000; i++) {
+		io_test_assert(frames[i * 2] == single[i]);
+		io_test_assert(frames[i * 2 + 1] == 0.0f);
+	}
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+struct io_test_resampled {
+	float values[1000];
+	unsigned int num;
+};
+
+static void io_test_resampler_emit(void *opaque, const float *frames,
+				   unsigned int num_frames)
+{
+	struct io_test_resampled *out = opaque;
+	unsigned int i;
+
+	for (i = 0; i < num_frames && out->num < 1000; i++)
+		out->values[out->num++] = frames[i];
+}
+
+static int io_resampler_test(void)
+{
+	static struct io_resampler rs;
+	static struct io_test_resampled out;
+	static float values[4000], ref[2000];
+	struct io_context *ctx;
+	unsigned int i;
+	double t;
+	float v;
+
+	/* linear input at irregular interval is reproduced at 1kHz */
+	out.num = 0;
+	io_resampler_init(&rs, 1000, IO_RESAMPLE_LINEAR, 1,
+			  io_test_resampler_emit, &out);
+	for (i = 0, t = 100.0; t < 100.5; i++, t += (i % 3) ? 0.003 : 0.011) {
+		v = 2.0 * (t - 100.0) - 0.5;
+		io_resampler_push(&rs, t, &v);
+		if (i % 50 == 0)
+			io_resampler_flush(&rs, false);
+	}
+	io_resampler_flush(&rs, true);
+	io_test_assert(out.num >= 490 && out.num <= 501);
+	for (i = 0; i < out.num; i++)
+		io_test_assert(fabs(out.values[i] - (2.0 * i * 0.001 - 0.5)) <
+			       1e-4);
+
+	/* cubic kernel reproduces quadratic input at fixed interval */
+	out.num = 0;
+	io_resampler_init(&rs, 1000, IO_RESAMPLE_CUBIC, 1,
+			  io_test_resampler_emit, &out);
+	for (i = 0; i < 126; i++) {
+		t = i * 0.004;
+		v = t * t * 10.0 - t;
+		io_resampler_push(&rs, t, &v);
+	}
+	io_resampler_flush(&rs, false);
+	io_test_assert(out.num == 497);
+	io_resampler_flush(&rs, true);
+	io_test_assert(out.num == 501);
+	for (i = 4; i < 497; i++) {
+		t = i * 0.001;
+		io_test_assert(fabs(out.values[i] - (t * t * 10.0 - t)) < 1e-4);
+	}
+
+	/* 4ms fixed interval file at 500Hz */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					2000));
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_test_assert(!io_context_set_sample_rate(ctx, 0,
+						   IO_RESAMPLE_LINEAR));
+	io_test_assert(io_context_set_sample_rate(ctx, 500,
+						  IO_RESAMPLE_LINEAR));
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_context_get_sample_rate(ctx, NULL) == 500);
+	io_test_assert(io_context_get_next_values(ctx, values, 3998));
+	for (i = 0; i < 1999; i++) {
+		io_test_assert(fabsf(values[i * 2] - ref[i]) < 0.011f);
+		io_test_assert(fabsf(values[i * 2 + 1] -
+				     (ref[i] + ref[i + 1]) / 2) < 0.011f);
+	}
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+/* Copy gzip file to temporary file with last byte of CRC32 flipped */
+static bool io_test_corrupt_gz_trailer(const char *src, char *filename,
+				       size_t filename_len)
+{
+	static unsigned char buf[4096];
+	size_t len;
+	FILE *file;
+
+	file = fopen(src, "rb");
+	if (!file)
+		return false;
+	len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
+	if (len < 8 || len == sizeof(buf))
+		return false;
+
+	buf[len - 5] ^= 0x01;
+
+	snprintf(filename, filename_len, "/tmp/io_test_%d.gz", (int)getpid());
+	file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	len = fwrite(buf, 1, len, file) - len;
+	fclose(file);
+
+	return len == 0;
+}
+
+static int io_gz_file_test(void)
+{
+	static const unsigned int window_lens[] = {
+		DS_APPEND_BUFFER_MIN_PIECE_LEN, DS_APPEND_BUFFER_MAX_PIECE_LEN,
+	};
+	static float values[10000], ref[10000];
+	struct io_context *ctx;
+	char filename[64];
+	unsigned int i, j;
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					2000));
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg.gz", values,
+					2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* concatenated members, read past end restarts from first member */
+	io_set_latest_error("%s", "");
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test_members.ecg.gz",
+					values, 4000));
+	for (i = 0; i < 4000; i++)
+		io_test_assert(values[i] == ref[i % 2000]);
+	io_test_assert(strstr(io_get_latest_error(), "checksum") == NULL);
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg.delta.gz",
+					values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+
+	/* variable interval files, interpolated to 4ms */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg", ref,
+					10000));
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg.gz", values,
+					10000));
+	for (i = 0; i < 10000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test_gz.txt.gz",
+					values, 10000));
+	for (i = 0; i < 10000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg.delta.gz",
+					values, 10000));
+	for (i = 0; i < 10000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+
+	/*
+	 * corrupted CRC32 in trailer is detected, input is restarted like
+	 * after any other parser error
+	 */
+	io_test_assert(io_test_corrupt_gz_trailer(IO_TEST_DATA_DIR "test.ecg.gz",
+						  filename, sizeof(filename)));
+	io_set_latest_error("%s", "");
+	io_test_assert(read_file_values(filename, values, 2000));
+	io_test_assert(strstr(io_get_latest_error(), "checksum") != NULL);
+	unlink(filename);
+
+	/* output window size does not change decompressed data */
+	for (j = 0; j < sizeof(window_lens) / sizeof(window_lens[0]); j++) {
+		ctx = io_context_alloc();
+		io_test_assert(ctx != NULL);
+		io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+		io_context_set_input(ctx, io_new_file_input(
+			io_new_gz_parser_sized(io_new_text_parser(),
+					       window_lens[j]),
+			IO_TEST_DATA_DIR "test2.ecg.gz"));
+		io_test_assert(io_context_get_next_values(ctx, values, 10000));
+		for (i = 0; i < 10000; i++)
+			io_test_assert(values[i] == ref[i]);
+
+		io_context_free(ctx);
+	}
+
+	return 0;
+}
+
+static void io_test_release_buffer(void *opaque, void *data,
+				   unsigned int len)
+{
+	unsigned int *released = opaque;
+
+	*released += len;
+}
+
+static int io_external_input_test(void)
+{
+	static float values[2000], ref[2000];
+	static char buf[14000];
+	unsigned int i, pos, len, released, donated;
+	FILE *file;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	file = fopen(IO_TEST_DATA_DIR "test.ecg", "r");
+	io_test_assert(file != NULL);
+	len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
+	io_test_assert(len == sizeof(buf));
+
+	/* push data in odd sized chunks */
+	io_open_txt_external_input();
+	for (pos = 0; pos < len; pos += 333) {
+		unsigned int plen = len - pos < 333 ? len - pos : 333;
+
+		io_test_assert(io_push_external_input(buf + pos, plen) == plen);
+	}
+	io_test_assert(io_main_queue_get_next_values(values, 1999));
+	io_close_main_input();
+
+	for (i = 0; i < 1999; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* caller owned buffers mixed with copied data */
+	released = 0;
+	donated = 0;
+	io_open_txt_external_input();
+	for (pos = 0; pos < len; pos += 333) {
+		unsigned int plen = len - pos < 333 ? len - pos : 333;
+
+		if ((pos / 333) % 3 == 0)
+			io_test_assert(io_push_external_input(buf + pos, plen) ==
+				       plen);
+		else {
+			io_test_assert(io_push_external_input_buffer(buf + pos,
+					plen, io_test_release_buffer,
+					&released));
+			donated += plen;
+		}
+	}
+	io_test_assert(io_main_queue_get_next_values(values, 1999));
+	io_close_main_input();
+
+	for (i = 0; i < 1999; i++)
+		io_test_assert(values[i] == ref[i]);
+	io_test_assert(released == donated);
+
+	return 0;
+}
+
+struct io_test_pusher {
+	const char *buf;
+	unsigned int len;
+	unsigned int pushed;
+};
+
+static void *io_test_pusher_thread(void *arg)
+{
+	struct io_test_pusher *pusher = arg;
+	unsigned int pos;
+
+	/* push data in odd sized chunks while consumer is waiting */
+	for (pos = 0; pos < pusher->len; pos += 333) {
+		unsigned int plen = pusher->len - pos < 333 ?
+					pusher->len - pos : 333;
+
+		pusher->pushed += io_push_external_input((void *)(pusher->buf +
+							 pos), plen);
+		io_usleep(100);
+	}
+
+	return NULL;
+}
+
+static int io_thread_test(void)
+{
+	static float values[10000], ref[10000];
+	static char buf[14000];
+	struct io_test_pusher pusher;
+	pthread_t thread;
+	unsigned int i, len;
+	FILE *file;
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg", ref,
+					10000));
+
+	io_main_set_io_thread(true);
+
+	/* request larger than queue limit */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg.gz", values,
+					10000));
+	for (i = 0; i < 10000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* read past end wraps around */
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR
+					"file_with_no_newline_at_end.ecg",
+					values, 4));
+	for (i = 0; i < 4; i++)
+		io_test_assert(values[i] == (float)i);
+
+	/* IO thread stops at queue limit and close wakes it up */
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test2.ecg");
+	for (i = 0; i < 1000 && !io_main_queue_is_full(); i++)
+		io_usleep(1000);
+	io_test_assert(io_main_queue_is_full());
+	io_close_main_input();
+
+	/* external input pushed while consumer is waiting */
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	file = fopen(IO_TEST_DATA_DIR "test.ecg", "r");
+	io_test_assert(file != NULL);
+	len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
+	io_test_assert(len == sizeof(buf));
+
+	io_open_txt_external_input();
+
+	pusher.buf = buf;
+	pusher.len = len;
+	pusher.pushed = 0;
+	io_test_assert(pthread_create(&thread, NULL, io_test_pusher_thread,
+				      &pusher) == 0);
+	io_test_assert(io_main_queue_get_next_values(values, 1999));
+	pthread_join(thread, NULL);
+	io_close_main_input();
+
+	io_test_assert(pusher.pushed == len);
+	for (i = 0; i < 1999; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	io_main_set_io_thread(false);
+
+	return 0;
+}
+
+struct io_test_blocking_pusher {
+	struct io_context *ctx;
+	struct io_input *input;
+	const char *buf;
+	unsigned int len;
+	unsigned int chunk;
+	unsigned int pushed;
+};
+
+static void *io_test_blocking_pusher_thread(void *arg)
+{
+	struct io_test_blocking_pusher *pusher = arg;
+	unsigned int pos, plen, ret;
+
+	for (pos = 0; pos < pusher->len; pos += plen) {
+		plen = pusher->len - pos < pusher->chunk ?
+					pusher->len - pos : pusher->chunk;
+
+		if (pusher->ctx)
+			ret = io_context_push_external_input(pusher->ctx,
+					(void *)(pusher->buf + pos), plen);
+		else
+			ret = io_external_input_push_data(pusher->input,
+					(void *)(pusher->buf + pos), plen);
+		__atomic_fetch_add(&pusher->pushed, ret, __ATOMIC_SEQ_CST);
+		if (ret < plen)
+			break;
+	}
+
+	return NULL;
+}
+
+static int io_backpressure_test(void)
+{
+	static float values[2000], ref[2000];
+	static char buf[14000];
+	struct io_test_blocking_pusher pusher;
+	struct io_context *ctx;
+	pthread_t thread;
+	unsigned int i, len, pushed;
+	FILE *file;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	file = fopen(IO_TEST_DATA_DIR "test.ecg", "r");
+	io_test_assert(file != NULL);
+	len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
+	io_test_assert(len == sizeof(buf));
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+
+	/* invalid watermarks */
+	io_test_assert(!io_context_set_queue_watermarks(ctx, 0, 0));
+	io_test_assert(!io_context_set_queue_watermarks(ctx, 100, 0));
+	io_test_assert(!io_context_set_queue_watermarks(ctx, 100, 200));
+	io_test_assert(!io_context_set_external_input_watermarks(ctx, 100, 200,
+								 true));
+
+	/* non-blocking pushes are short at high watermark */
+	io_test_assert(io_context_set_external_input_watermarks(ctx, 1000, 500,
+								false));
+	io_context_open_txt_external_input(ctx);
+	io_test_assert(io_context_push_external_input(ctx, buf, len) == 1000);
+	io_test_assert(io_context_push_external_input(ctx, buf, len) == 0);
+	io_test_assert(!io_context_push_external_input_buffer(ctx, buf, len,
+							      NULL, NULL));
+
+	/* consumer makes room, values are not lost */
+	io_test_assert(io_context_get_next_values(ctx, values, 10));
+	io_test_assert(io_context_push_external_input(ctx, buf + 1000,
+						      len - 1000) == 1000);
+	io_context_close_input(ctx);
+	for (i = 0; i < 10; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* blocking pusher is throttled by slow consumer of IO thread */
+	io_context_set_io_thread(ctx, true);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_test_assert(io_context_set_queue_watermarks(ctx, 256, 64));
+	io_test_assert(io_context_set_external_input_watermarks(ctx, 1024, 256,
+								true));
+	io_context_open_txt_external_input(ctx);
+
+	pusher.ctx = ctx;
+	pusher.input = NULL;
+	pusher.buf = buf;
+	pusher.len = len;
+	pusher.chunk = 333;
+	pusher.pushed = 0;
+	io_test_assert(pthread_create(&thread, NULL,
+				      io_test_blocking_pusher_thread,
+				      &pusher) == 0);
+
+	/* queue, parser buffer and push buffer are full, rest is held back */
+	io_usleep(50 * 1000);
+	pushed = __atomic_load_n(&pusher.pushed, __ATOMIC_SEQ_CST);
+	io_test_assert(pushed > 0 && pushed < len / 2);
+
+	for (i = 0; i < 1999; i += 100)
+		io_test_assert(io_context_get_next_values(ctx, values + i,
+					1999 - i < 100 ? 1999 - i : 100));
+	pthread_join(thread, NULL);
+	io_context_close_input(ctx);
+
+	io_test_assert(pusher.pushed == len);
+	for (i = 0; i < 1999; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* closing context releases blocked pusher */
+	io_context_set_io_thread(ctx, false);
+	io_context_open_txt_external_input(ctx);
+	pusher.chunk = len;
+	pusher.pushed = 0;
+	io_test_assert(pthread_create(&thread, NULL,
+				      io_test_blocking_pusher_thread,
+				      &pusher) == 0);
+	io_usleep(20 * 1000);
+	io_context_close_input(ctx);
+	pthread_join(thread, NULL);
+	io_test_assert(pusher.pushed <= 1024);
+
+	io_context_free(ctx);
+
+	/* stop of input releases blocked pusher with short push */
+	pusher.ctx = NULL;
+	pusher.input = io_new_external_input(io_new_text_parser());
+	io_test_assert(pusher.input != NULL);
+	io_test_assert(!io_external_input_set_watermarks(pusher.input, 100, 200,
+							 true));
+	io_test_assert(io_external_input_set_watermarks(pusher.input, 1000, 500,
+							true));
+	pusher.pushed = 0;
+	io_test_assert(pthread_create(&thread, NULL,
+				      io_test_blocking_pusher_thread,
+				      &pusher) == 0);
+	io_usleep(20 * 1000);
+	io_input_stop_wait(pusher.input);
+	pthread_join(thread, NULL);
+	io_test_assert(pusher.pushed == 1000);
+	io_input_destroy(pusher.input);
+
+	return 0;
+}
+
+static int io_history_test(void)
+{
+	static float values[2000], ref[2000], hist[600];
+	struct io_context *ctx;
+	unsigned int i, pass;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_test_assert(!io_context_set_history(ctx, IO_MAX_HISTORY_FRAMES + 1));
+	io_test_assert(io_context_set_history(ctx, 500));
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+
+	/* consumer thread IO, then IO thread */
+	for (pass = 0; pass < 2; pass++) {
+		io_context_set_io_thread(ctx, pass == 1);
+		io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR
+					       "test.ecg");
+
+		io_test_assert(io_context_get_history(ctx, hist, 10) == 0);
+		io_test_assert(io_context_get_next_values(ctx, values, 300));
+		io_test_assert(io_context_get_history(ctx, hist, 600) == 300);
+		for (i = 0; i < 300; i++)
+			io_test_assert(hist[i] == ref[i]);
+
+		/* window slides with consumed values */
+		for (i = 300; i < 1999; i += 97)
+			io_test_assert(io_context_get_next_values(ctx,
+					values + i, 1999 - i < 97 ?
+					1999 - i : 97));
+		io_test_assert(io_context_get_history(ctx, hist, 600) == 500);
+		for (i = 0; i < 500; i++)
+			io_test_assert(hist[i] == ref[1499 + i]);
+		io_test_assert(io_context_get_history(ctx, hist, 3) == 3);
+		for (i = 0; i < 3; i++)
+			io_test_assert(hist[i] == ref[1996 + i]);
+
+		io_context_close_input(ctx);
+		io_test_assert(io_context_get_history(ctx, hist, 10) == 0);
+	}
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+static int io_stats_test(void)
+{
+	static float values[2000];
+	struct io_context *ctx;
+	struct io_stats stats;
+	unsigned long long latency;
+	unsigned int i;
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+
+	/* nothing counted before input */
+	io_context_get_stats(ctx, &stats);
+	io_test_assert(stats.num_parsers == 0);
+	io_test_assert(stats.values_queued == 0);
+
+	io_context_set_io_thread(ctx, true);
+	io_context_set_pacing(ctx, IO_PACING_SPEEDUP, 100);
+	io_context_set_latency_histogram(ctx, true);
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR "test.ecg.gz");
+
+	for (i = 0; i < 1999; i += 100)
+		io_test_assert(io_context_get_next_values(ctx, values + i,
+					1999 - i < 100 ? 1999 - i : 100));
+
+	/* parser stack from bottom */
+	io_context_get_stats(ctx, &stats);
+	io_test_assert(stats.input.reads > 0);
+	io_test_assert(stats.input.bytes_in > 0);
+	io_test_assert(stats.num_parsers == 2);
+	io_test_assert(strcmp(stats.parser_names[0], "gzip") == 0);
+	io_test_assert(strcmp(stats.parser_names[1], "text") == 0);
+	io_test_assert(stats.parsers[0].parse_calls > 0);
+	io_test_assert(stats.parsers[0].bytes_in > 0);
+	io_test_assert(stats.parsers[0].bytes_in <= stats.input.bytes_in);
+	io_test_assert(stats.parsers[0].bytes_out > stats.parsers[0].bytes_in);
+	io_test_assert(stats.parsers[0].decode_ns > 0);
+	io_test_assert(stats.parsers[0].parse_ns >=
+		       stats.parsers[0].decode_ns);
+	io_test_assert(stats.parsers[1].bytes_in > 0);
+	io_test_assert(stats.parsers[1].bytes_in <= stats.parsers[0].bytes_out);
+
+	/* queue and consumer */
+	io_test_assert(stats.values_consumed == 1999);
+	io_test_assert(stats.values_queued >= 1999);
+	io_test_assert(stats.queue_depth == stats.values_queued - 1999);
+	io_test_assert(stats.queue_max_depth > 0);
+	io_test_assert(stats.pacing_sleeps == 19);
+	io_test_assert(stats.pacing_max_late_ns <= stats.pacing_late_ns);
+
+	latency = 0;
+	for (i = 0; i < IO_STATS_LATENCY_BUCKETS; i++)
+		latency += stats.latency[i];
+	io_test_assert(latency > 0);
+
+	/* context counters accumulate over inputs */
+	io_context_close_input(ctx);
+	io_context_get_stats(ctx, &stats);
+	io_test_assert(stats.num_parsers == 0);
+	io_test_assert(stats.input.reads == 0);
+	io_test_assert(stats.values_consumed == 1999);
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+struct io_test_stream {
+	struct io_context *ctx;
+	const char *filename;
+	float *values;
+	unsigned int num_values;
+	bool ret;
+};
+
+static void *io_test_stream_thread(void *arg)
+{
+	struct io_test_stream *stream = arg;
+
+	io_context_open_txt_file_input(stream->ctx, stream->filename);
+	stream->ret = io_context_get_next_values(stream->ctx, stream->values,
+						 stream->num_values);
+	io_context_close_input(stream->ctx);
+
+	return NULL;
+}
+
+static int io_context_test(void)
+{
+	static float values[2][10000], ref[2][10000];
+	struct io_test_stream streams[2];
+	pthread_t threads[2];
+	unsigned int i, j;
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg", ref[0],
+					2000));
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg", ref[1],
+					10000));
+
+	/* decode independent streams in parallel */
+	for (i = 0; i < 2; i++) {
+		streams[i].ctx = io_context_alloc();
+		io_test_assert(streams[i].ctx != NULL);
+		streams[i].values = values[i];
+		streams[i].ret = false;
+	}
+	streams[0].filename = IO_TEST_DATA_DIR "test.ecg.gz";
+	streams[0].num_values = 2000;
+	streams[1].filename = IO_TEST_DATA_DIR "test2.ecg.gz";
+	streams[1].num_values = 10000;
+
+	/* second context with IO thread */
+	io_context_set_io_thread(streams[1].ctx, true);
+
+	for (i = 0; i < 2; i++)
+		io_test_assert(pthread_create(&threads[i], NULL,
+					      io_test_stream_thread,
+					      &streams[i]) == 0);
+	for (i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < 2; i++) {
+		io_test_assert(streams[i].ret);
+		for (j = 0; j < streams[i].num_values; j++)
+			io_test_assert(values[i][j] == ref[i][j]);
+
+		io_context_free(streams[i].ctx);
+	}
+
+	/* global input is not affected by other contexts */
+	io_test_assert(!io_main_queue_get_next_values(values[0], 1));
+
+	return 0;
+}
+
+#define IO_TEST_LOOP_STREAMS 48
+#define IO_TEST_LOOP_VALUES 12000
+#define IO_TEST_LOOP_BATCH 500
+
+struct io_test_loop_fd {
+	int fd;
+	bool opened;
+};
+
+static int io_test_loop_open(struct io_input *io, void *priv)
+{
+	struct io_test_loop_fd *lfd = priv;
+
+	/* device stream does not restart after end of input */
+	if (lfd->opened)
+		return -1;
+
+	lfd->opened = true;
+	return lfd->fd;
+}
+
+static bool io_test_loop_close(struct io_input *io, void *priv)
+{
+	struct io_test_loop_fd *lfd = priv;
+
+	close(lfd->fd);
+	return true;
+}
+
+static float io_test_loop_value(unsigned int stream, unsigned int i)
+{
+	return (float)((stream * 131 + i) % 20000) / 100 - 100;
+}
+
+static void *io_test_loop_writer(void *arg)
+{
+	static char buf[IO_TEST_LOOP_BATCH * IO_DATA_LINE_MAX_LEN];
+	int *fds = arg;
+	unsigned int s, i, pos, len;
+	ssize_t ret;
+
+	for (i = 0; i < IO_TEST_LOOP_VALUES; i += IO_TEST_LOOP_BATCH) {
+		for (s = 0; s < IO_TEST_LOOP_STREAMS; s++) {
+			for (len = 0, pos = 0; pos < IO_TEST_LOOP_BATCH; pos++)
+				len += io_format_data_line(buf + len,
+					io_test_loop_value(s, i + pos));
+
+			/* streams closed by consumer fail with EPIPE */
+			for (pos = 0; pos < len; pos += ret) {
+				ret = send(fds[s], buf + pos, len - pos,
+					   MSG_NOSIGNAL);
+				if (ret <= 0)
+					break;
+			}
+		}
+	}
+
+	for (s = 0; s < IO_TEST_LOOP_STREAMS; s++)
+		close(fds[s]);
+
+	return NULL;
+}
+
+static int io_event_loop_test(void)
+{
+	static struct io_context *ctxs[IO_TEST_LOOP_STREAMS];
+	static float values[IO_TEST_LOOP_BATCH], ref[2000];
+	int fds[IO_TEST_LOOP_STREAMS], pair[2];
+	struct io_test_loop_fd *lfd;
+	struct io_event_loop *loop;
+	struct io_context *ctx;
+	pthread_t thread;
+	unsigned int s, i, j;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	loop = io_event_loop_alloc(3);
+	io_test_assert(loop != NULL);
+
+	for (s = 0; s < IO_TEST_LOOP_STREAMS; s++) {
+		io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+		io_test_assert(io_set_fd_nonblocking(pair[0]));
+		fds[s] = pair[1];
+
+		lfd = calloc(1, sizeof(*lfd));
+		io_test_assert(lfd != NULL);
+		lfd->fd = pair[0];
+
+		ctxs[s] = io_context_alloc();
+		io_test_assert(ctxs[s] != NULL);
+		io_context_set_pacing(ctxs[s], IO_PACING_UNTHROTTLED, 0);
+		io_context_set_event_loop(ctxs[s], loop);
+		io_context_set_input(ctxs[s], io_new_generic_fd_input(
+			io_new_text_parser(), io_test_loop_open,
+			io_test_loop_close, lfd));
+	}
+
+	io_test_assert(pthread_create(&thread, NULL, io_test_loop_writer,
+				      fds) == 0);
+
+	/* streams longer than context queue, sources get parked */
+	for (i = 0; i < IO_TEST_LOOP_VALUES; i += IO_TEST_LOOP_BATCH) {
+		for (s = 0; s < IO_TEST_LOOP_STREAMS; s++) {
+			if (!ctxs[s])
+				continue;
+
+			io_test_assert(io_context_get_next_values(ctxs[s],
+					values, IO_TEST_LOOP_BATCH));
+			for (j = 0; j < IO_TEST_LOOP_BATCH; j++)
+				io_test_assert(fabsf(values[j] -
+					io_test_loop_value(s, i + j)) < 0.001f);
+
+			/* close some inputs while data is still flowing */
+			if (s % 8 == 7 && i == IO_TEST_LOOP_VALUES / 2) {
+				io_context_free(ctxs[s]);
+				ctxs[s] = NULL;
+			}
+		}
+	}
+
+	pthread_join(thread, NULL);
+
+	/* end of input */
+	for (s = 0; s < IO_TEST_LOOP_STREAMS; s++) {
+		if (!ctxs[s])
+			continue;
+
+		io_test_assert(!io_context_get_next_values(ctxs[s], values, 1));
+		io_context_free(ctxs[s]);
+	}
+
+	/* regular file can not be polled, falls back to IO thread */
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_set_event_loop(ctx, loop);
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_context_get_next_values(ctx, values,
+						  IO_TEST_LOOP_BATCH));
+	for (i = 0; i < IO_TEST_LOOP_BATCH; i++)
+		io_test_assert(values[i] == ref[i]);
+	io_context_free(ctx);
+
+	io_event_loop_free(loop);
+
+	return 0;
+}
+
+static int io_reopen_fail_test(void)
+{
+	static const char data[] = "1.00\n2.00\n3.00\n4.00\n";
+	struct io_test_loop_fd *lfd;
+	struct io_context *ctx;
+	struct io_stats stats;
+	float values[4];
+	int pair[2];
+
+	io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+	io_test_assert(io_set_fd_nonblocking(pair[0]));
+	io_test_assert(write(pair[1], data, strlen(data)) ==
+		       (ssize_t)strlen(data));
+
+	lfd = calloc(1, sizeof(*lfd));
+	io_test_assert(lfd != NULL);
+	lfd->fd = pair[0];
+
+	/* IO in caller thread, stream cannot be reopened after end of input */
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_set_input(ctx, io_new_generic_fd_input(io_new_text_parser(),
+				io_test_loop_open, io_test_loop_close, lfd));
+
+	io_test_assert(io_context_get_next_values(ctx, values, 4));
+	io_test_assert(values[0] == 1.0f && values[3] == 4.0f);
+
+	/* failed reopen ends input instead of retrying */
+	close(pair[1]);
+	io_test_assert(!io_context_get_next_values(ctx, values, 1));
+	io_context_get_stats(ctx, &stats);
+	io_test_assert(stats.input.reopens == 1);
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+static int io_format_data_line_test(void)
+{
+	static const float fixed_values[] = {
+		0.0f, -0.0f, 0.125f, 0.375f, -0.125f, 0.005f, -0.004f, 1.0f,
+		99.995f, -1234.5f, 1e16f, 1e18f, 3.4e38f, -3.4e38f,
+	};
+	char buf[IO_DATA_LINE_MAX_LEN], ref[IO_DATA_LINE_MAX_LEN];
+	unsigned int i, seed = 1;
+	int d;
+	union {
+		float f;
+		unsigned int u;
+	} value;
+
+	for (i = 0; i < sizeof(fixed_values) / sizeof(fixed_values[0]); i++) {
+		snprintf(ref, sizeof(ref), "%.02f\n", fixed_values[i]);
+		io_test_assert(io_format_data_line(buf, fixed_values[i]) ==
+			       strlen(ref));
+		io_test_assert(strcmp(buf, ref) == 0);
+	}
+
+	/* random bit patterns, including NaN and infinity */
+	for (i = 0; i < 200000; i++) {
+		seed = seed * 1103515245 + 12345;
+		value.u = seed;
+		snprintf(ref, sizeof(ref), "%.02f\n", value.f);
+		io_test_assert(io_format_data_line(buf, value.f) ==
+			       strlen(ref));
+		io_test_assert(strcmp(buf, ref) == 0);
+	}
+
+	/* other decimal counts */
+	for (d = 0; d <= IO_FORMAT_MAX_DECIMALS; d++) {
+		for (i = 0; i < sizeof(fixed_values) / sizeof(fixed_values[0]);
+		     i++) {
+			snprintf(ref, sizeof(ref), "%.*f\n", d,
+				 fixed_values[i]);
+			io_test_assert(io_format_fixed_line(buf,
+					fixed_values[i], d) == strlen(ref));
+			io_test_assert(strcmp(buf, ref) == 0);
+		}
+
+		for (i = 0; i < 50000; i++) {
+			seed = seed * 1103515245 + 12345;
+			value.u = seed;
+			snprintf(ref, sizeof(ref), "%.*f\n", d, value.f);
+			io_test_assert(io_format_fixed_line(buf, value.f, d) ==
+				       strlen(ref));
+			io_test_assert(strcmp(buf, ref) == 0);
+		}
+	}
+
+	return 0;
+}
+
+static int io_data_lines_test(void)
+{
+	static float ref[2000];
+	static char buf[200 * IO_DATA_LINE_MAX_LEN];
+	char line[IO_DATA_LINE_MAX_LEN], *pos;
+	unsigned int i, len;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+
+	/* limited by max_values */
+	len = io_main_get_next_data_lines(buf, sizeof(buf), 150);
+	io_test_assert(len == strlen(buf));
+	for (i = 0, pos = buf; i < 150; i++) {
+		snprintf(line, sizeof(line), "%.02f\n", ref[i]);
+		io_test_assert(strncmp(pos, line, strlen(line)) == 0);
+		pos += strlen(line);
+	}
+	io_test_assert(pos == buf + len);
+
+	/* limited by buffer length */
+	len = io_main_get_next_data_lines(buf, 3 * IO_DATA_LINE_MAX_LEN + 1,
+					  10);
+	for (pos = buf; i < 153; i++) {
+		snprintf(line, sizeof(line), "%.02f\n", ref[i]);
+		io_test_assert(strncmp(pos, line, strlen(line)) == 0);
+		pos += strlen(line);
+	}
+	io_test_assert(pos == buf + len && *pos == '\0');
+
+	/* single line with truncation */
+	len = io_main_get_next_data_line(buf, 3);
+	snprintf(line, sizeof(line), "%.02f\n", ref[i]);
+	io_test_assert(len == strlen(line));
+	io_test_assert(strlen(buf) == 2 && strncmp(buf, line, 2) == 0);
+
+	io_close_main_input();
+
+	return 0;
+}
+
+static double io_test_elapsed(const struct ds_timespec *start)
+{
+	struct ds_timespec now;
+
+	ds_get_curr_timespec(&now);
+
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int io_pacing_test(void)
+{
+	static float values[2000], ref[2000];
+	struct ds_timespec start;
+	unsigned int i;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	/* unthrottled, real time would take 8 seconds */
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+	ds_get_curr_timespec(&start);
+	for (i = 0; i < 2000; i += 100)
+		io_test_assert(io_main_queue_get_next_values(values + i, 100));
+	io_test_assert(io_test_elapsed(&start) < 2.0);
+	io_close_main_input();
+
+	for (i = 0; i < 2000; i++)
+		io_test_assert(values[i] == ref[i]);
+
+	/* 20x speed, 2 seconds of data takes 0.1 seconds */
+	io_main_set_pacing(IO_PACING_SPEEDUP, 20);
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+	ds_get_curr_timespec(&start);
+	for (i = 0; i < 6; i++)
+		io_test_assert(io_main_queue_get_next_values(values, 100));
+	io_test_assert(io_test_elapsed(&start) >= 0.09);
+	io_test_assert(io_test_elapsed(&start) < 1.0);
+	io_close_main_input();
+
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+
+	return 0;
+}
+
+#define IO_TEST_PACER_THREADS 8
+
+struct io_test_sleeper {
+	struct io_pacer *pacer;
+	unsigned long long deadline_ns;
+	unsigned long long woke_ns;
+	pthread_t thread;
+};
+
+static void *io_test_sleeper_thread(void *arg)
+{
+	struct io_test_sleeper *sleeper = arg;
+
+	io_pacer_sleep_until(sleeper->pacer, sleeper->deadline_ns);
+	sleeper->woke_ns = io_get_monotonic_ns();
+
+	return NULL;
+}
+
+/* Sleeps to shared deadlines, one tick apart, and records worst lateness */
+#define IO_TEST_PACER_ROUNDS 400
+
+struct io_test_round_sleeper {
+	struct io_pacer *pacer;
+	unsigned long long start_ns;
+	unsigned long long tick_ns;
+	unsigned long long max_late_ns;
+	pthread_t thread;
+};
+
+static void *io_test_round_sleeper_thread(void *arg)
+{
+	struct io_test_round_sleeper *sleeper = arg;
+	unsigned long long deadline, now;
+	unsigned int round;
+
+	for (round = 1; round <= IO_TEST_PACER_ROUNDS; round++) {
+		deadline = sleeper->start_ns + round * sleeper->tick_ns;
+		if (io_get_monotonic_ns() >= deadline)
+			continue;
+
+		io_pacer_sleep_until(sleeper->pacer, deadline);
+
+		now = io_get_monotonic_ns();
+		if (now - deadline > sleeper->max_late_ns)
+			sleeper->max_late_ns = now - deadline;
+	}
+
+	return NULL;
+}
+
+static int io_pacer_test(void)
+{
+	static struct io_test_round_sleeper rounds[IO_TEST_PACER_THREADS];
+	static struct io_test_sleeper sleepers[IO_TEST_PACER_THREADS];
+	struct io_test_sleeper late;
+	struct io_pacer_stats stats;
+	struct io_context *ctx;
+	struct io_stats ctx_stats;
+	struct io_pacer *pacer;
+	struct ds_timespec start;
+	static float values[100];
+	unsigned long long now;
+	unsigned int i;
+
+	pacer = io_pacer_alloc(500);
+	io_test_assert(pacer != NULL);
+
+	/* passed deadline does not sleep */
+	io_pacer_sleep_until(pacer, io_get_monotonic_ns() - 1);
+
+	/* sleepers due on same tick are released by one wake-up */
+	now = io_get_monotonic_ns();
+	for (i = 0; i < IO_TEST_PACER_THREADS; i++) {
+		sleepers[i].pacer = pacer;
+		sleepers[i].deadline_ns = now + 100000000ULL;
+		io_test_assert(pthread_create(&sleepers[i].thread, NULL,
+					      io_test_sleeper_thread,
+					      &sleepers[i]) == 0);
+	}
+	for (i = 0; i < IO_TEST_PACER_THREADS; i++) {
+		pthread_join(sleepers[i].thread, NULL);
+		io_test_assert(sleepers[i].woke_ns >= sleepers[i].deadline_ns);
+	}
+
+	io_pacer_get_stats(pacer, &stats);
+	io_test_assert(stats.tick_ns == 500000);
+	io_test_assert(stats.pending == 0);
+	io_test_assert(stats.releases == IO_TEST_PACER_THREADS);
+	io_test_assert(stats.max_batch == IO_TEST_PACER_THREADS);
+	io_test_assert(stats.wakeups >= 1);
+	io_test_assert(stats.max_overshoot_ns <= stats.overshoot_ns);
+
+	/* earlier sleeper is not held back by later one */
+	late.pacer = pacer;
+	late.deadline_ns = io_get_monotonic_ns() + 500000000ULL;
+	io_test_assert(pthread_create(&late.thread, NULL,
+				      io_test_sleeper_thread, &late) == 0);
+	io_usleep(10000);
+	now = io_get_monotonic_ns();
+	io_pacer_sleep_until(pacer, now + 5000000ULL);
+	io_test_assert(io_get_monotonic_ns() - now >= 5000000ULL);
+	io_test_assert(io_get_monotonic_ns() - now < 250000000ULL);
+	pthread_join(late.thread, NULL);
+	io_test_assert(late.woke_ns >= late.deadline_ns);
+
+	/* context paced by scheduler, 20x speed as in io_pacing_test */
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacer(ctx, pacer);
+	io_context_set_pacing(ctx, IO_PACING_SPEEDUP, 20);
+	io_context_open_txt_file_input(ctx, IO_TEST_DATA_DIR "test.ecg");
+	ds_get_curr_timespec(&start);
+	for (i = 0; i < 6; i++)
+		io_test_assert(io_context_get_next_values(ctx, values, 100));
+	io_test_assert(io_test_elapsed(&start) >= 0.09);
+	io_test_assert(io_test_elapsed(&start) < 1.0);
+
+	io_context_get_stats(ctx, &ctx_stats);
+	io_test_assert(ctx_stats.pacing_sleeps == 5);
+	io_test_assert(ctx_stats.pacing_overshoot_ns <=
+		       ctx_stats.pacing_late_ns);
+	io_test_assert(ctx_stats.pacing_max_overshoot_ns <=
+		       ctx_stats.pacing_overshoot_ns);
+
+	io_context_free(ctx);
+	io_pacer_free(pacer);
+
+	/*
+	 * Sleepers joining tick other sleepers are released on are not left
+	 * in passed wheel slot for full rotation (64ms with default tick)
+	 */
+	pacer = io_pacer_alloc(0);
+	io_test_assert(pacer != NULL);
+	io_pacer_get_stats(pacer, &stats);
+	now = io_get_monotonic_ns();
+	for (i = 0; i < IO_TEST_PACER_THREADS; i++) {
+		rounds[i].pacer = pacer;
+		rounds[i].start_ns = now;
+		rounds[i].tick_ns = stats.tick_ns;
+		rounds[i].max_late_ns = 0;
+		io_test_assert(pthread_create(&rounds[i].thread, NULL,
+					      io_test_round_sleeper_thread,
+					      &rounds[i]) == 0);
+	}
+	for (i = 0; i < IO_TEST_PACER_THREADS; i++)
+		pthread_join(rounds[i].thread, NULL);
+
+	/*
+	 * Lateness beyond late wake-ups of scheduler thread itself is thread
+	 * scheduling slack, far below one wheel rotation
+	 */
+	io_pacer_get_stats(pacer, &stats);
+	for (i = 0; i < IO_TEST_PACER_THREADS; i++)
+		io_test_assert(rounds[i].max_late_ns < stats.max_drift_ns +
+			       IO_PACER_WHEEL_SLOTS / 8 * stats.tick_ns);
+	io_pacer_free(pacer);
+
+	return 0;
+}
+
+static int io_save_file_test(void)
+{
+	static const int levels[] = { 1, 6, 9, -1 };
+	static const unsigned int threads[] = { 1, 4, 0 };
+	static float values[40000], ref[2000], big[40000];
+	char filename[64];
+	unsigned int i, l, t;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.txt",
+		 (int)getpid());
+
+	io_test_assert(io_save_txt_file(filename, ref, 2000));
+	io_test_assert(read_file_values(filename, values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+
+	io_test_assert(io_save_gz_txt_file(filename, ref, 2000));
+	io_test_assert(read_file_values(filename, values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+
+	/* large deltas, delta encoder tracks value read back by parser */
+	for (i = 0; i < 2000; i++)
+		big[i] = (i % 2 ? 20000.0f : -20000.0f) + ref[i];
+	io_test_assert(io_save_txt_file(filename, big, 2000));
+	io_test_assert(read_file_values(filename, values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - big[i]) < 0.011f);
+
+	/* parallel compression, text spans multiple compression blocks */
+	for (i = 0; i < 40000; i++)
+		big[i] = ref[i % 2000] + (float)(i / 2000);
+
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+	for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+		for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			io_test_assert(io_save_gz_txt_file_parallel(filename,
+					big, 40000, levels[l], threads[t]));
+
+			io_set_latest_error("%s", "");
+			io_test_assert(read_file_values(filename, values,
+							40000));
+			io_test_assert(strstr(io_get_latest_error(),
+					      "checksum") == NULL);
+			for (i = 0; i < 40000; i++)
+				io_test_assert(fabsf(values[i] - big[i]) <
+					       0.011f);
+		}
+	}
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+
+	/* invalid compression level */
+	io_test_assert(!io_save_gz_txt_file_parallel(filename, ref, 2000, 10,
+						     1));
+
+	unlink(filename);
+
+	return 0;
+}
+
+static struct io_saver *io_test_saver_open(unsigned int type,
+					   const char *filename)
+{
+	switch (type) {
+	case 0:
+		return io_saver_open_txt(filename);
+	case 1:
+		return io_saver_open_gz_txt(filename);
+	default:
+		return io_saver_open_gz_txt_parallel(filename, 6, 4);
+	}
+}
+
+static int io_saver_test(void)
+{
+	static float values[40000], ref[2000], big[40000], whole[40000];
+	struct io_saver *saver;
+	char filename[64];
+	unsigned int i, n, type;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.txt",
+		 (int)getpid());
+
+	for (i = 0; i < 40000; i++)
+		big[i] = ref[i % 2000] + (float)(i / 2000);
+
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+
+	/* appending in batches gives same values as saving whole array */
+	io_test_assert(io_save_txt_file(filename, big, 40000));
+	io_test_assert(read_file_values(filename, whole, 40000));
+
+	for (type = 0; type < 3; type++) {
+		saver = io_test_saver_open(type, filename);
+		io_test_assert(saver != NULL);
+
+		for (i = 0, n = 1; i < 40000; i += n, n = n * 3 % 1999 + 1) {
+			if (n > 40000 - i)
+				n = 40000 - i;
+			io_test_assert(io_saver_append(saver, big + i, n));
+			if (i % 7 == 0)
+				io_saver_flush(saver);
+		}
+		io_test_assert(io_saver_close(saver));
+
+		io_test_assert(read_file_values(filename, values, 40000));
+		for (i = 0; i < 40000; i++)
+			io_test_assert(values[i] == whole[i]);
+	}
+
+	/* empty stream */
+	saver = io_saver_open_txt(filename);
+	io_test_assert(saver != NULL);
+	io_test_assert(io_saver_close(saver));
+
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+
+	/* open and write errors */
+	io_test_assert(io_saver_open_txt("/nonexistent/io_test.txt") == NULL);
+	io_test_assert(io_saver_open_gz_txt_parallel(filename, 10, 1) == NULL);
+
+	saver = io_saver_open_txt("/dev/full");
+	if (saver) {
+		for (i = 0; i < 10; i++)
+			io_saver_append(saver, big, 40000);
+		io_test_assert(!io_saver_append(saver, big, 1));
+		io_test_assert(!io_saver_close(saver));
+	}
+
+	unlink(filename);
+
+	return 0;
+}
+
+struct io_test_sink {
+	struct io_sink sink;
+	float values[4000];
+	unsigned int num_values;
+	unsigned int num_blocks;
+	bool times_ok;
+	bool ids_ok;
+};
+
+static bool io_test_sink_emit_block(struct io_sink *sink, const float *frames,
+				    unsigned int num_frames,
+				    unsigned int channels,
+				    unsigned int channel_id, double time)
+{
+	struct io_test_sink *ts = sink->priv;
+	unsigned int num = num_frames * channels;
+
+	if (fabs(time - ts->num_values / channels * 0.004) > 1e-9)
+		ts->times_ok = false;
+	if (channel_id != 7)
+		ts->ids_ok = false;
+	if (ts->num_values + num > sizeof(ts->values) / sizeof(float))
+		return false;
+
+	memcpy(&ts->values[ts->num_values], frames, num * sizeof(float));
+	ts->num_values += num;
+	ts->num_blocks++;
+
+	return true;
+}
+
+/* Parse @filename with @parser to @sink without IO context */
+static void io_test_parse_to_sink(struct io_parser *parser,
+				  const char *filename, struct io_sink *sink)
+{
+	struct io_input *input;
+
+	io_parser_set_sink(parser, sink, 7);
+	input = io_new_file_input(parser, filename);
+	io_input_process_loop(input);
+	io_input_destroy(input);
+}
+
+static int io_sink_test(void)
+{
+	static float values[2000], ref[2000];
+	static struct io_test_sink ts;
+	struct io_context *ctx;
+	struct io_saver *saver;
+	char filename[64];
+	unsigned int i;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.txt",
+		 (int)getpid());
+
+	/* 4ms fixed interval lines are passed in blocks with time of block */
+	ts.sink.emit_block = io_test_sink_emit_block;
+	ts.sink.priv = &ts;
+	ts.times_ok = true;
+	ts.ids_ok = true;
+	io_test_parse_to_sink(io_new_text_parser(), IO_TEST_DATA_DIR "test.ecg",
+			      &ts.sink);
+	io_test_assert(ts.num_values == 2000);
+	io_test_assert(ts.num_blocks < 2000 / 64);
+	io_test_assert(ts.times_ok && ts.ids_ok);
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(ts.values[i] - ref[i]) < 0.0051f);
+
+	/* gz parser passes sink to child */
+	memset(&ts, 0, sizeof(ts));
+	ts.sink.emit_block = io_test_sink_emit_block;
+	ts.sink.priv = &ts;
+	ts.times_ok = true;
+	ts.ids_ok = true;
+	io_test_parse_to_sink(io_new_gz_parser(io_new_text_parser()),
+			      IO_TEST_DATA_DIR "test.ecg.gz", &ts.sink);
+	io_test_assert(ts.num_values == 2000);
+	io_test_assert(ts.times_ok && ts.ids_ok);
+
+	/* saver as sink */
+	saver = io_saver_open_txt(filename);
+	io_test_assert(saver != NULL);
+	io_test_parse_to_sink(io_new_text_parser(), IO_TEST_DATA_DIR "test.ecg",
+			      io_saver_get_sink(saver));
+	io_test_assert(io_saver_close(saver));
+
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+	io_test_assert(read_file_values(filename, values, 2000));
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(values[i] - ref[i]) < 0.011f);
+	unlink(filename);
+
+	/* context sink queues blocks like parser without sink */
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_open_txt_external_input(ctx);
+	io_test_assert(io_context_get_sink(ctx)->emit_block(
+			io_context_get_sink(ctx), ref, 2000, 1, 0, 0.0));
+	io_test_assert(!io_context_get_sink(ctx)->emit_block(
+			io_context_get_sink(ctx), ref, 1000, 2, 0, 0.0));
+	io_test_assert(io_context_get_next_values(ctx, values, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(values[i] == ref[i]);
+	io_context_free(ctx);
+
+	return 0;
+}
+
+static int io_pipe_parser_test(void)
+{
+	static float values[20000], ref[20000];
+	static struct io_test_sink ts;
+	struct io_parser *parser;
+	struct io_context *ctx;
+	struct io_stats stats;
+	unsigned int i, mode;
+
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test2.ecg", ref,
+					20000));
+
+	/*
+	 * Same values with child parsed in caller thread, in pipe thread
+	 * feeding IO thread and with short pipe and small pieces, so that
+	 * inflate is stopped by full pipe.
+	 */
+	for (mode = 0; mode < 3; mode++) {
+		ctx = io_context_alloc();
+		io_test_assert(ctx != NULL);
+		io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+		io_context_set_io_thread(ctx, mode > 0);
+
+		if (mode < 2)
+			parser = io_new_gz_parser(
+				io_new_pipe_parser(io_new_text_parser(), 0));
+		else
+			parser = io_new_gz_parser_sized(
+				io_new_pipe_parser(io_new_text_parser(), 1),
+				DS_APPEND_BUFFER_MIN_PIECE_LEN);
+		io_test_assert(parser != NULL);
+
+		io_context_set_input(ctx, io_new_file_input(parser,
+					IO_TEST_DATA_DIR "test2.ecg.gz"));
+		/* read past end restarts stream through reset pipe */
+		io_test_assert(io_context_get_next_values(ctx, values, 20000));
+		for (i = 0; i < 20000; i++)
+			io_test_assert(values[i] == ref[i]);
+
+		io_context_get_stats(ctx, &stats);
+		io_test_assert(stats.num_parsers == 3);
+		io_test_assert(strcmp(stats.parser_names[1], "pipe") == 0);
+		io_test_assert(stats.parsers[1].bytes_in > 0);
+
+		io_context_free(ctx);
+	}
+
+	/* pipe thread passes blocks to sink, all values are in at end */
+	memset(&ts, 0, sizeof(ts));
+	ts.sink.emit_block = io_test_sink_emit_block;
+	ts.sink.priv = &ts;
+	ts.times_ok = true;
+	ts.ids_ok = true;
+	io_test_parse_to_sink(io_new_gz_parser(io_new_pipe_parser(
+					io_new_text_parser(), 2)),
+			      IO_TEST_DATA_DIR "test.ecg.gz", &ts.sink);
+	io_test_assert(ts.num_values == 2000);
+	io_test_assert(ts.times_ok && ts.ids_ok);
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+	for (i = 0; i < 2000; i++)
+		io_test_assert(fabsf(ts.values[i] - ref[i]) < 0.0051f);
+
+	io_test_assert(io_new_pipe_parser(NULL, 0) == NULL);
+
+	return 0;
+}
+
+/* Read available stream data to @buf, returns length */
+static unsigned int io_test_read_stream(int fd, char *buf, unsigned int buflen)
+{
+	unsigned int len = 0;
+	ssize_t ret;
+
+	while (len < buflen) {
+		ret = recv(fd, buf + len, buflen - len, MSG_DONTWAIT);
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+
+	return len;
+}
+
+/* Check that @buf has only whole data lines, returns number of lines */
+static int io_test_count_lines(const char *buf, unsigned int len)
+{
+	char line[IO_DATA_LINE_MAX_LEN];
+	unsigned int pos = 0, num = 0, llen;
+	const char *end;
+
+	while (pos < len) {
+		end = memchr(buf + pos, '\n', len - pos);
+		if (!end)
+			return -1;
+
+		llen = io_format_data_line(line, strtof(buf + pos, NULL));
+		if (llen != (unsigned int)(end + 1 - (buf + pos)) ||
+		    memcmp(line, buf + pos, llen) != 0)
+			return -1;
+
+		pos += llen;
+		num++;
+	}
+
+	return num;
+}
+
+static int io_streamer_test(void)
+{
+	static float ref[2000];
+	static char expect[2000 * IO_DATA_LINE_MAX_LEN];
+	static char buf[2000 * IO_DATA_LINE_MAX_LEN];
+	struct io_stream_stats stats;
+	struct io_streamer *streamer;
+	struct sockaddr_in addr[2];
+	socklen_t addrlen;
+	int fast[2], slow[2], drop[2], udp_rx[2] = { -1, -1 }, udp_tx;
+	int fast_id, slow_id, drop_id, i, num;
+	unsigned int len, elen = 0, ulen;
+	bool have_udp;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+	for (i = 0; i < 2000; i++)
+		elen += io_format_data_line(&expect[elen], ref[i]);
+
+	streamer = io_streamer_alloc();
+	io_test_assert(streamer != NULL);
+
+	io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fast) == 0);
+	io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, slow) == 0);
+	io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, drop) == 0);
+
+	/* slow subscribers have small socket buffer and are never read */
+	i = 2048;
+	setsockopt(slow[1], SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+	setsockopt(drop[1], SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+
+	fast_id = io_streamer_add_tcp(streamer, fast[1], IO_STREAM_DROP_OLDEST,
+				      0);
+	slow_id = io_streamer_add_tcp(streamer, slow[1], IO_STREAM_DROP_OLDEST,
+				      4);
+	drop_id = io_streamer_add_tcp(streamer, drop[1], IO_STREAM_DISCONNECT,
+				      2);
+	io_test_assert(fast_id >= 0 && slow_id >= 0 && drop_id >= 0);
+
+	/* two UDP destinations sharing sending socket, if loopback works */
+	udp_tx = socket(AF_INET, SOCK_DGRAM, 0);
+	have_udp = udp_tx >= 0;
+	for (i = 0; i < 2 && have_udp; i++) {
+		memset(&addr[i], 0, sizeof(addr[i]));
+		addr[i].sin_family = AF_INET;
+		addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addrlen = sizeof(addr[i]);
+
+		udp_rx[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		have_udp = udp_rx[i] >= 0 &&
+			   bind(udp_rx[i], (struct sockaddr *)&addr[i],
+				sizeof(addr[i])) == 0 &&
+			   getsockname(udp_rx[i], (struct sockaddr *)&addr[i],
+				       &addrlen) == 0;
+	}
+	for (i = 0; i < 2 && have_udp; i++)
+		io_test_assert(io_streamer_add_udp(streamer, udp_tx,
+					(struct sockaddr *)&addr[i],
+					sizeof(addr[i])) >= 0);
+
+	for (i = 0; i < 2000; i += 100)
+		io_test_assert(io_streamer_send(streamer, ref + i, 100));
+
+	/* fast subscriber receives everything */
+	len = io_test_read_stream(fast[0], buf, sizeof(buf));
+	io_test_assert(len == elen && memcmp(buf, expect, elen) == 0);
+
+	/* each datagram has one frame, same data as stream */
+	for (i = 0; i < 2 && have_udp; i++) {
+		for (len = 0; len < elen; len += ulen) {
+			ulen = recv(udp_rx[i], buf, sizeof(buf), MSG_DONTWAIT);
+			if ((int)ulen <= 0)
+				break;
+			io_test_assert(memcmp(buf, expect + len, ulen) == 0);
+		}
+		io_test_assert(len == elen);
+	}
+
+	/* slow subscriber has dropped frames, but receives whole lines */
+	io_test_assert(io_streamer_get_stats(streamer, slow_id, &stats));
+	io_test_assert(stats.dropped_frames > 0);
+	io_test_assert(stats.queued_frames <= 4);
+	io_test_assert(stats.bytes_sent > 0);
+
+	num = 0;
+	while (true) {
+		io_streamer_flush(streamer);
+		len = io_test_read_stream(slow[0], buf, sizeof(buf));
+		if (len == 0)
+			break;
+		io_test_assert(io_test_count_lines(buf, len) > 0);
+		num += io_test_count_lines(buf, len);
+	}
+	io_test_assert(num > 0 && num < 2000);
+	io_test_assert(io_streamer_get_stats(streamer, slow_id, &stats));
+	io_test_assert(stats.queued_frames == 0);
+
+	/* subscriber with disconnect policy has been removed and closed */
+	io_test_assert(!io_streamer_get_stats(streamer, drop_id, &stats));
+	while (io_test_read_stream(drop[0], buf, sizeof(buf)) > 0)
+		;
+	io_test_assert(recv(drop[0], buf, 1, 0) == 0);
+	io_test_assert(!io_streamer_remove(streamer, drop_id));
+
+	/* closed connection is removed without SIGPIPE */
+	close(slow[0]);
+	io_test_assert(io_streamer_send(streamer, ref, 2000));
+	io_test_assert(!io_streamer_get_stats(streamer, slow_id, &stats));
+
+	/* parser stack output through sink */
+	io_test_assert(io_streamer_remove(streamer, fast_id));
+	close(fast[0]);
+	io_test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fast) == 0);
+	fast_id = io_streamer_add_tcp(streamer, fast[1], IO_STREAM_DROP_OLDEST,
+				      0);
+	io_test_assert(fast_id >= 0);
+	io_test_parse_to_sink(io_new_text_parser(), IO_TEST_DATA_DIR "test.ecg",
+			      io_streamer_get_sink(streamer));
+	len = io_test_read_stream(fast[0], buf, sizeof(buf));
+	io_test_assert(io_test_count_lines(buf, len) == 2000);
+
+	io_test_assert(io_streamer_num_subscribers(streamer) ==
+		       (have_udp ? 3 : 1));
+	io_streamer_free(streamer);
+	io_test_assert(recv(fast[0], buf, 1, 0) == 0);
+
+	close(fast[0]);
+	close(drop[0]);
+	for (i = 0; i < 2; i++)
+		if (udp_rx[i] >= 0)
+			close(udp_rx[i]);
+	if (udp_tx >= 0)
+		close(udp_tx);
+
+	return 0;
+}
+
+static int io_bin_file_test(void)
+{
+	static const enum io_bin_encoding encodings[] = {
+		IO_BIN_INT16, IO_BIN_FLOAT32, IO_BIN_DELTA_VARINT
+	};
+	static float values[2000], ref[2000], frames[40000 * 3];
+	static float out[40000 * 2];
+	struct ds_append_buffer abuf;
+	struct io_parser *parser;
+	struct io_context *ctx;
+	unsigned char bytes[256];
+	char filename[64];
+	unsigned int i, e;
+	size_t len;
+	FILE *file;
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.bin",
+		 (int)getpid());
+
+	/* single channel at context rate, decoded exactly */
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+	for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+		io_test_assert(io_save_bin_file(filename, ref, 2000, 1,
+						IO_DEFAULT_SAMPLE_RATE,
+						encodings[e]));
+
+		io_open_bin_file_input(filename);
+		io_test_assert(io_main_queue_get_next_values(values, 2000));
+		for (i = 0; i < 2000; i++)
+			io_test_assert(values[i] == ref[i]);
+
+		/* end of file restarts from beginning */
+		io_test_assert(io_main_queue_get_next_values(values, 1000));
+		for (i = 0; i < 1000; i++)
+			io_test_assert(values[i] == ref[i]);
+		io_close_main_input();
+	}
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_test_assert(io_context_set_channels(ctx, 2));
+
+	/* extra file channels dropped, blocks span mapped input chunks */
+	for (i = 0; i < 40000 * 3; i++)
+		frames[i] = ref[(i / 3) % 2000] + (float)(i % 3);
+	for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+		io_test_assert(io_save_bin_file(filename, frames, 40000, 3,
+						IO_DEFAULT_SAMPLE_RATE,
+						encodings[e]));
+
+		io_context_open_bin_file_input(ctx, filename);
+		io_test_assert(io_context_get_next_frames(ctx, out, 40000));
+		for (i = 0; i < 40000; i++) {
+			io_test_assert(out[i * 2] == frames[i * 3]);
+			io_test_assert(fabsf(out[i * 2 + 1] -
+					     frames[i * 3 + 1]) < 0.0001f);
+		}
+	}
+
+	/* half rate file is resampled, missing channel is zero */
+	for (i = 0; i < 1000; i++)
+		values[i] = ref[i * 2];
+	io_test_assert(io_save_bin_file(filename, values, 1000, 1,
+					IO_DEFAULT_SAMPLE_RATE / 2,
+					IO_BIN_DELTA_VARINT));
+	io_context_open_bin_file_input(ctx, filename);
+	io_test_assert(io_context_get_next_frames(ctx, out, 1998));
+	for (i = 0; i < 1998; i++) {
+		if (i % 2 == 0)
+			io_test_assert(fabsf(out[i * 2] - values[i / 2]) <
+				       0.0001f);
+		else
+			io_test_assert(fabsf(out[i * 2] -
+					     (values[i / 2] +
+					      values[i / 2 + 1]) / 2) <
+				       0.0051f);
+		io_test_assert(out[i * 2 + 1] == 0.0f);
+	}
+	io_context_close_input(ctx);
+
+	/* invalid header is parser error */
+	parser = io_new_bin_parser();
+	io_test_assert(parser != NULL);
+	io_parser_set_context(parser, ctx);
+	ds_append_buffer_init(&abuf);
+	ds_append_buffer_append(&abuf, "ECGX\1\1\1\0\372\0\0\0d\0\0\0", 16);
+	io_test_assert(io_parser_parse(parser, &abuf, false) ==
+		       IO_PARSER_RET_ERROR);
+	io_test_assert(strstr(io_get_latest_error(), "binary") != NULL);
+	ds_append_buffer_free(&abuf);
+
+	/* block is parsed only when complete, truncated at end of input */
+	io_test_assert(io_save_bin_file(filename, ref, 10, 1,
+					IO_DEFAULT_SAMPLE_RATE, IO_BIN_INT16));
+	file = fopen(filename, "rb");
+	io_test_assert(file != NULL);
+	len = fread(bytes, 1, sizeof(bytes), file);
+	fclose(file);
+	io_test_assert(len == IO_BIN_HEADER_LEN + IO_BIN_BLOCK_HEADER_LEN + 20);
+
+	io_parser_reset(parser);
+	ds_append_buffer_init(&abuf);
+	ds_append_buffer_append(&abuf, bytes, len - 1);
+	io_test_assert(io_parser_parse(parser, &abuf, false) ==
+		       IO_PARSER_RET_CONTINUE);
+	io_test_assert(ds_append_buffer_length(&abuf) ==
+		       IO_BIN_BLOCK_HEADER_LEN + 19);
+	io_test_assert(io_parser_parse(parser, &abuf, true) ==
+		       IO_PARSER_RET_ERROR);
+	io_test_assert(strstr(io_get_latest_error(), "truncated") != NULL);
+	ds_append_buffer_free(&abuf);
+	io_parser_destroy(parser);
+
+	/* invalid format */
+	io_test_assert(!io_save_bin_file(filename, ref, 10, 0,
+					 IO_DEFAULT_SAMPLE_RATE,
+					 IO_BIN_INT16));
+	io_test_assert(!io_save_bin_file(filename, ref, 10, 1, 0,
+					 IO_BIN_INT16));
+
+	io_context_free(ctx);
+	unlink(filename);
+
+	return 0;
+}
+
+static int io_sample_i16_test(void)
+{
+	static const enum io_bin_encoding encodings[] = {
+		IO_BIN_INT16, IO_BIN_FLOAT32, IO_BIN_DELTA_VARINT
+	};
+	static int16_t values_i16[2000], frames_i16[20000 * 3];
+	static int16_t out_i16[20000 * 2];
+	static float values[2000], ref[2000], hist[10 * 2];
+	struct io_context *ctx;
+	char filename[64];
+	unsigned int i, e;
+
+	/* conversion rounds as float queue, saturates and drops NaN */
+	io_test_assert(io_sample_to_i16(1.234f) == 123);
+	io_test_assert(io_sample_to_i16(-0.005f) == -1);
+	io_test_assert(io_sample_to_i16(400.0f) == INT16_MAX);
+	io_test_assert(io_sample_to_i16(-400.0f) == INT16_MIN);
+	io_test_assert(io_sample_to_i16(NAN) == 0);
+	io_test_assert(io_sample_from_i16(123) == roundf(1.23f * 100.0f) / 100);
+	io_test_assert(io_sample_clamp_i16(40000) == INT16_MAX);
+
+	io_test_assert(read_reference_values(IO_TEST_DATA_DIR "test.ecg", ref,
+					     2000) == 2000);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.bin",
+		 (int)getpid());
+
+	/* text input through int16 queue, same values from either API */
+	io_main_set_pacing(IO_PACING_UNTHROTTLED, 0);
+	io_main_set_sample_format(IO_SAMPLE_INT16);
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_context_get_sample_format(io_main_context()) ==
+		       IO_SAMPLE_INT16);
+	io_test_assert(io_main_queue_get_next_values_i16(values_i16, 1000));
+	io_test_assert(io_main_queue_get_next_values(values + 1000, 1000));
+	for (i = 0; i < 1000; i++) {
+		io_test_assert(values_i16[i] == io_sample_to_i16(ref[i]));
+		io_test_assert(values[1000 + i] == ref[1000 + i]);
+	}
+	io_close_main_input();
+	io_main_set_sample_format(IO_SAMPLE_FLOAT32);
+
+	/* int16 values from float queue */
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_main_queue_get_next_values_i16(values_i16, 2000));
+	for (i = 0; i < 2000; i++)
+		io_test_assert(values_i16[i] == io_sample_to_i16(ref[i]));
+	io_close_main_input();
+	io_main_set_pacing(IO_PACING_REALTIME, 0);
+
+	/* binary files saved from int16 frames decode losslessly */
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_set_sample_format(ctx, IO_SAMPLE_INT16);
+	io_test_assert(io_context_set_channels(ctx, 2));
+	io_test_assert(io_context_set_history(ctx, 10));
+
+	for (i = 0; i < 20000 * 3; i++)
+		frames_i16[i] = (int16_t)((i * 7919) % 65536 - 32768);
+	for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+		io_test_assert(io_save_bin_file_i16(filename, frames_i16,
+						    20000, 3,
+						    IO_DEFAULT_SAMPLE_RATE,
+						    encodings[e]));
+
+		io_context_open_bin_file_input(ctx, filename);
+		io_test_assert(io_context_get_next_frames_i16(ctx, out_i16,
+							      20000));
+		for (i = 0; i < 20000; i++) {
+			io_test_assert(out_i16[i * 2] == frames_i16[i * 3]);
+			io_test_assert(out_i16[i * 2 + 1] ==
+				       frames_i16[i * 3 + 1]);
+		}
+
+		/* history is returned as float */
+		io_test_assert(io_context_get_history(ctx, hist, 10) == 10);
+		for (i = 0; i < 10; i++)
+			io_test_assert(hist[i * 2] ==
+				       io_sample_from_i16(
+					       frames_i16[(19990 + i) * 3]));
+	}
+	io_context_close_input(ctx);
+
+	io_context_free(ctx);
+	unlink(filename);
+
+	return 0;
+}
+
+#define IO_TEST_DELTA_VALUES (64 * IO_MAX_CHANNELS)
+
+static int io_delta_test(void)
+{
+	static float values[IO_TEST_DELTA_VALUES], deltas[IO_TEST_DELTA_VALUES];
+	static float ref[IO_TEST_DELTA_VALUES];
+	static int32_t fixed[IO_TEST_DELTA_VALUES];
+	static int32_t fdeltas[IO_TEST_DELTA_VALUES];
+	static int32_t fref[IO_TEST_DELTA_VALUES];
+	float prev[IO_MAX_CHANNELS], ref_prev[IO_MAX_CHANNELS];
+	int32_t fprev[IO_MAX_CHANNELS], fref_prev[IO_MAX_CHANNELS];
+	unsigned int seed = 1, i, ch, frames, pos, n;
+
+	for (i = 0; i < IO_TEST_DELTA_VALUES; i++) {
+		seed = seed * 1103515245 + 12345;
+		values[i] = (int)(seed >> 8) / 1000.0f;
+		fixed[i] = (int32_t)seed;
+	}
+
+	for (ch = 1; ch <= IO_MAX_CHANNELS; ch++) {
+		for (frames = 0; frames <= IO_TEST_DELTA_VALUES / ch;
+		     frames += 7) {
+			memset(prev, 0, sizeof(prev));
+			memset(ref_prev, 0, sizeof(ref_prev));
+			memset(fprev, 0, sizeof(fprev));
+			memset(fref_prev, 0, sizeof(fref_prev));
+
+			/* scalar reference, one value at a time */
+			for (i = 0; i < frames * ch; i++) {
+				deltas[i] = values[i] - ref_prev[i % ch];
+				ref_prev[i % ch] = values[i];
+				fdeltas[i] = (int32_t)((uint32_t)fixed[i] -
+					     (uint32_t)fref_prev[i % ch]);
+				fref_prev[i % ch] = fixed[i];
+			}
+			memcpy(ref, deltas, frames * ch * sizeof(*ref));
+			memcpy(fref, fdeltas, frames * ch * sizeof(*fref));
+
+			/* encoded in uneven blocks */
+			for (pos = 0; pos < frames; pos += n) {
+				n = 5 + pos % 9;
+				if (n > frames - pos)
+					n = frames - pos;
+				io_delta_encode(deltas + pos * ch,
+						values + pos * ch, n, ch, prev);
+				io_delta_encode_fixed(fdeltas + pos * ch,
+						      fixed + pos * ch, n, ch,
+						      fprev);
+			}
+			io_test_assert(memcmp(deltas, ref, frames * ch *
+					      sizeof(*ref)) == 0);
+			io_test_assert(memcmp(fdeltas, fref, frames * ch *
+					      sizeof(*fref)) == 0);
+			io_test_assert(memcmp(prev, ref_prev, ch *
+					      sizeof(*prev)) == 0);
+			io_test_assert(memcmp(fprev, fref_prev, ch *
+					      sizeof(*fprev)) == 0);
+
+			/* float sums match running sum of parser */
+			memset(ref_prev, 0, sizeof(ref_prev));
+			for (i = 0; i < frames * ch; i++) {
+				ref[i] = ref_prev[i % ch] + deltas[i];
+				ref_prev[i % ch] = ref[i];
+			}
+
+			memset(prev, 0, sizeof(prev));
+			memset(fprev, 0, sizeof(fprev));
+			for (pos = 0; pos < frames; pos += n) {
+				n = 3 + pos % 11;
+				if (n > frames - pos)
+					n = frames - pos;
+				io_delta_decode(deltas + pos * ch, n, ch, prev);
+				io_delta_decode_fixed(fdeltas + pos * ch, n, ch,
+						      fprev);
+			}
+			io_test_assert(memcmp(deltas, ref, frames * ch *
+					      sizeof(*ref)) == 0);
+			io_test_assert(memcmp(prev, ref_prev, ch *
+					      sizeof(*prev)) == 0);
+
+			/* fixed-point round trip is exact, also wrapping */
+			io_test_assert(memcmp(fdeltas, fixed, frames * ch *
+					      sizeof(*fixed)) == 0);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Load file in parallel and compare to frames read through context, which
+ * are rounded by context queue.
+ */
+static int io_test_load_txt_file(const char *filename, unsigned int channels,
+				 unsigned int rate,
+				 enum io_resample_kernel kernel,
+				 unsigned int num_threads,
+				 unsigned int *num_frames)
+{
+	struct io_context *ctx;
+	float *loaded, *frames;
+	unsigned int i;
+
+	loaded = io_load_txt_file(filename, channels, rate, kernel,
+				  num_threads, num_frames);
+	io_test_assert(loaded != NULL);
+	io_test_assert(*num_frames > 0);
+
+	frames = malloc(*num_frames * channels * sizeof(*frames));
+	io_test_assert(frames != NULL);
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_test_assert(io_context_set_channels(ctx, channels));
+	io_test_assert(io_context_set_sample_rate(ctx, rate, kernel));
+	io_context_open_txt_file_input(ctx, filename);
+	io_test_assert(io_context_get_next_frames(ctx, frames, *num_frames));
+	io_context_free(ctx);
+
+	for (i = 0; i < *num_frames * channels; i++)
+		io_test_assert(frames[i] == roundf(loaded[i] * 100.0f) / 100);
+
+	free(frames);
+	free(loaded);
+
+	return 0;
+}
+
+static int io_load_txt_file_test(void)
+{
+	static const unsigned int threads[] = { 1, 4 };
+	unsigned int i, t, num_frames;
+	char filename[64];
+	float *a, *b;
+	FILE *file;
+
+	/* small files are loaded as single chunk */
+	io_test_assert(io_test_load_txt_file(IO_TEST_DATA_DIR "test.ecg", 1,
+					     IO_DEFAULT_SAMPLE_RATE,
+					     IO_RESAMPLE_LINEAR, 4,
+					     &num_frames) == 0);
+	io_test_assert(num_frames == 2000);
+	io_test_assert(io_test_load_txt_file(IO_TEST_DATA_DIR
+					     "test.ecg.delta", 1,
+					     IO_DEFAULT_SAMPLE_RATE,
+					     IO_RESAMPLE_LINEAR, 4,
+					     &num_frames) == 0);
+	io_test_assert(num_frames == 2000);
+	io_test_assert(io_test_load_txt_file(IO_TEST_DATA_DIR
+					     "test2.ecg.delta", 1,
+					     IO_DEFAULT_SAMPLE_RATE,
+					     IO_RESAMPLE_CUBIC, 4,
+					     &num_frames) == 0);
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.txt",
+		 (int)getpid());
+
+	/* delta-encoded interval file, many chunk seams */
+	file = fopen(filename, "w");
+	io_test_assert(file != NULL);
+	fprintf(file, "# generated\n#deltaenc\n100.000 0.500 -0.500\n");
+	for (i = 1; i < 300000; i++)
+		fprintf(file, "0.00%u %.3f %.3f\n", 3 + i % 3,
+			((int)(i * 7 % 21) - 10) / 1000.0,
+			((int)(i * 5 % 17) - 8) / 1000.0);
+	fclose(file);
+
+	for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		io_test_assert(io_test_load_txt_file(filename, 2, 360,
+						     IO_RESAMPLE_CUBIC,
+						     threads[t],
+						     &num_frames) == 0);
+		io_test_assert(num_frames > 350000);
+	}
+
+	/* results do not depend on number of threads */
+	a = io_load_txt_file(filename, 2, 0, IO_RESAMPLE_LINEAR, 1,
+			     &num_frames);
+	b = io_load_txt_file(filename, 2, 0, IO_RESAMPLE_LINEAR, 4, &i);
+	io_test_assert(a != NULL && b != NULL);
+	io_test_assert(i == num_frames);
+	io_test_assert(memcmp(a, b, num_frames * 2 * sizeof(*a)) == 0);
+	free(a);
+	free(b);
+
+	/* 4ms delta file, loading ends with first stream */
+	file = fopen(filename, "w");
+	io_test_assert(file != NULL);
+	fprintf(file, "#deltaenc\n");
+	for (i = 0; i < 200000; i++) {
+		if (i == 150000)
+			fprintf(file, "end\n");
+		fprintf(file, "%.2f\n", ((int)(i * 3 % 7) - 3) / 100.0);
+	}
+	fclose(file);
+
+	for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		io_test_assert(io_test_load_txt_file(filename, 1, 500,
+						     IO_RESAMPLE_LINEAR,
+						     threads[t],
+						     &num_frames) == 0);
+		io_test_assert(num_frames == 150000 * 2 - 1);
+		io_test_assert(io_test_load_txt_file(filename, 1,
+						     IO_DEFAULT_SAMPLE_RATE,
+						     IO_RESAMPLE_LINEAR,
+						     threads[t],
+						     &num_frames) == 0);
+		io_test_assert(num_frames == 150000);
+	}
+
+	unlink(filename);
+
+	/* compressed and missing files are not loaded */
+	io_test_assert(io_load_txt_file(IO_TEST_DATA_DIR "test.ecg.gz", 1, 0,
+					IO_RESAMPLE_LINEAR, 0,
+					&num_frames) == NULL);
+	io_test_assert(io_load_txt_file(IO_TEST_DATA_DIR "missing.ecg", 1, 0,
+					IO_RESAMPLE_LINEAR, 0,
+					&num_frames) == NULL);
+
+	return 0;
+}
+
+static unsigned char *io_test_read_whole_file(const char *filename,
+					      size_t *len)
+{
+	unsigned char *buf;
+	FILE *file;
+	long size;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	buf = malloc(size + 1);
+	if (buf && fread(buf, 1, size, file) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(file);
+
+	*len = size;
+	return buf;
+}
+
+/* compare random reads through index against uncompressed @ref */
+static int io_test_gz_index_check(const struct io_gz_index *index,
+				  const char *filename,
+				  const unsigned char *ref, size_t ref_len)
+{
+	static unsigned char buf[70000];
+	struct io_gz_access_point point;
+	unsigned long long offset, lines;
+	unsigned int i, j, len, seed = 1;
+	int fd, ret;
+
+	io_test_assert(io_gz_index_length(index) == ref_len);
+	io_test_assert(io_gz_index_num_points(index) > 1);
+
+	/* line positions of access points */
+	for (i = 0; io_gz_index_get_point(index, i, &point); i++) {
+		io_test_assert(point.out < ref_len);
+		io_test_assert(point.line_start >= point.out);
+		io_test_assert(point.line_start == 0 ||
+			       ref[point.line_start - 1] == '\n');
+		for (lines = 0, offset = 0; offset < point.line_start; offset++)
+			lines += ref[offset] == '\n';
+		io_test_assert(point.line == lines);
+		io_test_assert(io_gz_index_find_offset(index, point.out) == i);
+		io_test_assert(io_gz_index_find_line(index, point.line) == i);
+	}
+	io_test_assert(i == io_gz_index_num_points(index));
+
+	fd = open(filename, O_RDONLY);
+	io_test_assert(fd >= 0);
+
+	for (i = 0; i < 200; i++) {
+		seed = seed * 1103515245 + 12345;
+		offset = (seed >> 8) % (ref_len + 100);
+		len = (seed >> 4) % sizeof(buf);
+		if (i == 0) {
+			offset = 0;
+			len = sizeof(buf);
+		}
+
+		ret = io_gz_index_read(index, fd, offset, buf, len);
+		j = offset < ref_len ? ref_len - offset : 0;
+		if (j > len)
+			j = len;
+		io_test_assert(ret == (int)j);
+		io_test_assert(memcmp(buf, ref + offset, j) == 0);
+	}
+
+	close(fd);
+	return 0;
+}
+
+static int io_gz_index_test(void)
+{
+	static float values[100000];
+	struct io_gz_index *index, *loaded;
+	struct io_gz_access_point point, point2;
+	unsigned char *ref, *gz;
+	char filename[64], txtname[64], idxname[80];
+	size_t ref_len, gz_len;
+	unsigned int i;
+	FILE *file;
+
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.gz",
+		 (int)getpid());
+	snprintf(txtname, sizeof(txtname), "/tmp/io_test_%d.txt",
+		 (int)getpid());
+	snprintf(idxname, sizeof(idxname), "%s" IO_GZ_INDEX_SUFFIX, filename);
+
+	ref = io_test_read_whole_file(IO_TEST_DATA_DIR "test2.ecg", &ref_len);
+	io_test_assert(ref != NULL);
+
+	index = io_gz_index_build(IO_TEST_DATA_DIR "test2.ecg.gz", 16 * 1024);
+	io_test_assert(index != NULL);
+	io_test_assert(io_test_gz_index_check(index, IO_TEST_DATA_DIR
+					      "test2.ecg.gz", ref,
+					      ref_len) == 0);
+	io_test_assert(io_gz_index_num_lines(index) == 16384);
+
+	/* saved index is bound to contents of gzip file */
+	gz = io_test_read_whole_file(IO_TEST_DATA_DIR "test2.ecg.gz", &gz_len);
+	io_test_assert(gz != NULL);
+	file = fopen(filename, "wb");
+	io_test_assert(file != NULL);
+	io_test_assert(fwrite(gz, 1, gz_len, file) == gz_len);
+	fclose(file);
+
+	io_test_assert(io_gz_index_load(filename) == NULL);
+	io_test_assert(io_gz_index_save(index, filename));
+	loaded = io_gz_index_load(filename);
+	io_test_assert(loaded != NULL);
+	io_test_assert(io_gz_index_num_points(loaded) ==
+		       io_gz_index_num_points(index));
+	for (i = 0; io_gz_index_get_point(index, i, &point); i++) {
+		io_test_assert(io_gz_index_get_point(loaded, i, &point2));
+		io_test_assert(point.in == point2.in &&
+			       point.bits == point2.bits &&
+			       point.out == point2.out &&
+			       point.line_start == point2.line_start &&
+			       point.line == point2.line);
+	}
+	io_test_assert(io_test_gz_index_check(loaded, filename, ref,
+					      ref_len) == 0);
+	io_gz_index_free(loaded);
+	io_gz_index_free(index);
+
+	gz[gz_len - 5] ^= 0x01;
+	file = fopen(filename, "wb");
+	io_test_assert(file != NULL);
+	io_test_assert(fwrite(gz, 1, gz_len, file) == gz_len);
+	fclose(file);
+	io_test_assert(io_gz_index_load(filename) == NULL);
+
+	/* index is built and saved at first open */
+	gz[gz_len - 5] ^= 0x01;
+	file = fopen(filename, "wb");
+	io_test_assert(file != NULL);
+	io_test_assert(fwrite(gz, 1, gz_len, file) == gz_len);
+	fclose(file);
+	free(gz);
+	unlink(idxname);
+	index = io_gz_index_open(filename, 16 * 1024);
+	io_test_assert(index != NULL);
+	io_gz_index_free(index);
+	index = io_gz_index_load(filename);
+	io_test_assert(index != NULL);
+	io_gz_index_free(index);
+	unlink(idxname);
+	free(ref);
+
+	/* concatenated members read as one stream */
+	index = io_gz_index_build(IO_TEST_DATA_DIR "test_members.ecg.gz",
+				  1024);
+	io_test_assert(index != NULL);
+	ref = malloc(io_gz_index_length(index));
+	io_test_assert(ref != NULL);
+	i = open(IO_TEST_DATA_DIR "test_members.ecg.gz", O_RDONLY);
+	io_test_assert((int)i >= 0);
+	io_test_assert(io_gz_index_read(index, i, 0, ref,
+					io_gz_index_length(index)) ==
+		       (int)io_gz_index_length(index));
+	close(i);
+	io_test_assert(io_test_gz_index_check(index, IO_TEST_DATA_DIR
+					      "test_members.ecg.gz", ref,
+					      io_gz_index_length(index)) == 0);
+	io_gz_index_free(index);
+	free(ref);
+
+	/* index written by saver */
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+		values[i] = ((int)(i * 37 % 201) - 100) / 100.0;
+
+	io_test_assert(io_save_txt_file(txtname, values, i));
+	io_test_assert(io_save_gz_txt_file_indexed(filename, values, i,
+						   64 * 1024));
+	ref = io_test_read_whole_file(txtname, &ref_len);
+	io_test_assert(ref != NULL);
+
+	index = io_gz_index_load(filename);
+	io_test_assert(index != NULL);
+	io_test_assert(io_test_gz_index_check(index, filename, ref,
+					      ref_len) == 0);
+	io_gz_index_free(index);
+
+	/* saved file can also be indexed by decompressing it */
+	index = io_gz_index_build(filename, 64 * 1024);
+	io_test_assert(index != NULL);
+	io_test_assert(io_test_gz_index_check(index, filename, ref,
+					      ref_len) == 0);
+
+	/*
+	 * Both indexes agree on lines. Decompressing picks end of deflate
+	 * block before saver's sync marker, so compressed offsets differ.
+	 */
+	loaded = io_gz_index_load(filename);
+	io_test_assert(loaded != NULL);
+	io_test_assert(io_gz_index_length(loaded) == io_gz_index_length(index));
+	io_test_assert(io_gz_index_num_lines(loaded) ==
+		       io_gz_index_num_lines(index));
+	for (i = 0; io_gz_index_get_point(index, i, &point); i++) {
+		io_test_assert(io_gz_index_get_point(loaded,
+				io_gz_index_find_offset(loaded, point.out),
+				&point2));
+		io_test_assert(point.out == point2.out &&
+			       point.line_start == point2.line_start &&
+			       point.line == point2.line);
+	}
+	io_test_assert(i > 0);
+	io_gz_index_free(loaded);
+	io_gz_index_free(index);
+	free(ref);
+
+	unlink(idxname);
+	unlink(filename);
+	unlink(txtname);
+
+	io_test_assert(io_gz_index_build(IO_TEST_DATA_DIR "test2.ecg",
+					 0) == NULL);
+	io_test_assert(io_gz_index_load(IO_TEST_DATA_DIR "missing.ecg.gz") ==
+		       NULL);
+
+	return 0;
+}
+
+#define IO_TEST_SEEK_REF 5000
+#define IO_TEST_SEEK_FRAMES 200
+
+/*
+ * Seek to @seconds in @filename and compare following frames to frames read
+ * from start of file. Frame at time t is first frame at or after t.
+ */
+static int io_test_seek_file(const char *filename, unsigned int rate,
+			     enum io_resample_kernel kernel,
+			     bool use_io_thread, const double *seconds,
+			     unsigned int num_seconds)
+{
+	static float ref[IO_TEST_SEEK_REF], frames[IO_TEST_SEEK_FRAMES];
+	struct io_context *ctx;
+	unsigned int i, j, k;
+
+	ctx = io_context_alloc();
+	io_test_assert(ctx != NULL);
+	io_context_set_pacing(ctx, IO_PACING_UNTHROTTLED, 0);
+	io_context_set_io_thread(ctx, use_io_thread);
+	io_test_assert(io_context_set_sample_rate(ctx, rate, kernel));
+	io_context_open_txt_file_input(ctx, filename);
+	io_test_assert(io_context_get_next_frames(ctx, ref, IO_TEST_SEEK_REF));
+
+	for (i = 0; i < num_seconds; i++) {
+		k = ceil(seconds[i] * rate - 1e-6);
+		io_test_assert(k + IO_TEST_SEEK_FRAMES <= IO_TEST_SEEK_REF);
+
+		io_test_assert(io_context_seek_time(ctx, seconds[i]));
+		io_test_assert(io_context_get_next_frames(ctx, frames,
+							  IO_TEST_SEEK_FRAMES));
+		for (j = 0; j < IO_TEST_SEEK_FRAMES; j++)
+			io_test_assert(frames[j] == ref[k + j]);
+	}
+
+	io_context_free(ctx);
+
+	return 0;
+}
+
+static int io_seek_test(void)
+{
+	static const double fixed[] = { 1.5, 0.25, 5.0, 0.0, 7.0 };
+	static const double interval[] = { 10.0, 0.5, 18.0, 3.0 };
+	static const char * const interval_files[] = {
+		IO_TEST_DATA_DIR "test2.ecg",
+		IO_TEST_DATA_DIR "test2.ecg.delta",
+		IO_TEST_DATA_DIR "test_gz.txt",
+	};
+	const unsigned int num_fixed = sizeof(fixed) / sizeof(fixed[0]);
+	const unsigned int num_interval = sizeof(interval) / sizeof(interval[0]);
+	static float values[100];
+	char filename[64], idxname[80];
+	unsigned char *gz;
+	size_t gz_len;
+	unsigned int i;
+	FILE *file;
+
+	/* 4ms files, at file rate and resampled */
+	io_test_assert(io_test_seek_file(IO_TEST_DATA_DIR "test.ecg",
+					 IO_DEFAULT_SAMPLE_RATE,
+					 IO_RESAMPLE_LINEAR, false, fixed,
+					 num_fixed) == 0);
+	io_test_assert(io_test_seek_file(IO_TEST_DATA_DIR "test.ecg.delta",
+					 IO_DEFAULT_SAMPLE_RATE,
+					 IO_RESAMPLE_LINEAR, true, fixed,
+					 num_fixed) == 0);
+	io_test_assert(io_test_seek_file(IO_TEST_DATA_DIR "test.ecg", 360,
+					 IO_RESAMPLE_CUBIC, false, fixed,
+					 3) == 0);
+
+	/* interval files, found by timestamp or summed deltas */
+	for (i = 0; i < 3; i++) {
+		io_test_assert(io_test_seek_file(interval_files[i],
+						 IO_DEFAULT_SAMPLE_RATE,
+						 IO_RESAMPLE_LINEAR, i == 1,
+						 interval,
+						 num_interval) == 0);
+		io_test_assert(io_test_seek_file(interval_files[i], 200,
+						 IO_RESAMPLE_CUBIC, false,
+						 interval,
+						 num_interval) == 0);
+	}
+
+	/* gzip files seek through index saved next to file */
+	snprintf(filename, sizeof(filename), "/tmp/io_test_%d.gz",
+		 (int)getpid());
+	snprintf(idxname, sizeof(idxname), "%s" IO_GZ_INDEX_SUFFIX, filename);
+
+	gz = io_test_read_whole_file(IO_TEST_DATA_DIR "test2.ecg.gz", &gz_len);
+	io_test_assert(gz != NULL);
+	file = fopen(filename, "wb");
+	io_test_assert(file != NULL);
+	io_test_assert(fwrite(gz, 1, gz_len, file) == gz_len);
+	fclose(file);
+	free(gz);
+
+	unlink(idxname);
+	io_test_assert(io_test_seek_file(filename, IO_DEFAULT_SAMPLE_RATE,
+					 IO_RESAMPLE_CUBIC, true, interval,
+					 num_interval) == 0);
+	io_test_assert(access(idxname, F_OK) == 0);
+	io_test_assert(io_test_seek_file(filename, IO_DEFAULT_SAMPLE_RATE,
+					 IO_RESAMPLE_LINEAR, false, interval,
+					 num_interval) == 0);
+	unlink(idxname);
+
+	gz = io_test_read_whole_file(IO_TEST_DATA_DIR "test.ecg.delta.gz",
+				     &gz_len);
+	io_test_assert(gz != NULL);
+	file = fopen(filename, "wb");
+	io_test_assert(file != NULL);
+	io_test_assert(fwrite(gz, 1, gz_len, file) == gz_len);
+	fclose(file);
+	free(gz);
+
+	io_test_assert(io_test_seek_file(filename, IO_DEFAULT_SAMPLE_RATE,
+					 IO_RESAMPLE_LINEAR, false, fixed,
+					 num_fixed) == 0);
+	unlink(idxname);
+	unlink(filename);
+
+	/* seek past end continues from start of file, as read past end */
+	io_open_txt_file_input(IO_TEST_DATA_DIR "test.ecg");
+	io_test_assert(io_main_seek_time(1000.0));
+	io_test_assert(io_main_queue_get_next_values(values, 100));
+	io_close_main_input();
+	io_test_assert(read_file_values(IO_TEST_DATA_DIR "test.ecg",
+					values + 50, 50));
+	for (i = 0; i < 50; i++)
+		io_test_assert(values[i] == values[50 + i]);
+
+	/* input without random access cannot seek */
+	io_test_assert(!io_main_seek_time(1.0));
+	io_open_txt_external_input();
+	io_test_assert(!io_main_seek_time(1.0));
+	io_close_main_input();
+
+	return 0;
+}
+
+static int run_test(const char *name, int (*test_fn)(void))
+{
+	int ret;
+
+	printf("Testing \"%s\" ... ", name);
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((ret = test_fn()) != 0)
+		goto out;
+
+	printf("%s\n", "[OK]");
+out:
+	fflush(stdout);
+	fflush(stderr);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	run_test("io_txt_file", io_txt_file_test);
+	run_test("io_date_interval_file", io_date_interval_file_test);
+	run_test("io_channels", io_channels_test);
+	run_test("io_resampler", io_resampler_test);
+	run_test("io_gz_file", io_gz_file_test);
+	run_test("io_external_input", io_external_input_test);
+	run_test("io_thread", io_thread_test);
+	run_test("io_backpressure", io_backpressure_test);
+	run_test("io_context", io_context_test);
+	run_test("io_history", io_history_test);
+	run_test("io_stats", io_stats_test);
+	run_test("io_event_loop", io_event_loop_test);
+	run_test("io_reopen_fail", io_reopen_fail_test);
+	run_test("io_format_data_line", io_format_data_line_test);
+	run_test("io_data_lines", io_data_lines_test);
+	run_test("io_pacing", io_pacing_test);
+	run_test("io_pacer", io_pacer_test);
+	run_test("io_save_file", io_save_file_test);
+	run_test("io_saver", io_saver_test);
+	run_test("io_sink", io_sink_test);
+	run_test("io_pipe_parser", io_pipe_parser_test);
+	run_test("io_streamer", io_streamer_test);
+	run_test("io_bin_file", io_bin_file_test);
+	run_test("io_sample_i16", io_sample_i16_test);
+	run_test("io_delta", io_delta_test);
+	run_test("io_load_txt_file", io_load_txt_file_test);
+	run_test("io_gz_index", io_gz_index_test);
+	run_test("io_seek", io_seek_test);
+
+	return 0;
+}